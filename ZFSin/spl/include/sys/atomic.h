@@ -170,6 +170,9 @@ atomic_swap_64(volatile uint64_t *_target, uint64_t _new)
 extern void *atomic_cas_ptr(volatile void *_target, void *_cmp, void *_new);
 
 static inline void membar_producer(void) { _mm_mfence(); }
+static inline void membar_consumer(void) { _mm_lfence(); }
+static inline void membar_enter(void) { _mm_mfence(); }
+static inline void membar_exit(void) { _mm_mfence(); }
 
 #ifdef	__cplusplus
 }
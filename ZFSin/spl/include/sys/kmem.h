@@ -96,6 +96,27 @@ extern uint64_t physmem;
 	void spl_free_set_fast_pressure(boolean_t);
 	uint64_t spl_free_last_pressure_wrapper(void);
 
+	/*
+	 * Graded memory pressure, pushed by the SPL to a single registered
+	 * consumer (the ARC) as soon as it is noticed, along with the number
+	 * of bytes the SPL would like given back.  The callback may run in
+	 * allocation context, so it must not block or allocate.
+	 */
+	typedef enum spl_pressure_level {
+		SPL_PRESSURE_NONE = 0,	/* shortage is over */
+		SPL_PRESSURE_LOW,	/* stop growing */
+		SPL_PRESSURE_MODERATE,	/* give back the target */
+		SPL_PRESSURE_HIGH,	/* give back the target and reap */
+		SPL_PRESSURE_CRITICAL,	/* allocations are stalled */
+		SPL_PRESSURE_LEVELS
+	} spl_pressure_level_t;
+
+	typedef void (*spl_pressure_func_t)(spl_pressure_level_t, int64_t,
+	    void *);
+
+	void spl_pressure_register(spl_pressure_func_t, void *);
+	void spl_pressure_unregister(void);
+
 #define KMC_NOTOUCH     0x00010000
 #define KMC_NODEBUG     0x00020000
 #define KMC_NOMAGAZINE  0x00040000
@@ -0,0 +1,202 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SIMD support for the Windows kernel.
+ *
+ * Feature detection is done with CPUID, and for the AVX families the
+ * XCR0 register is consulted to make sure the kernel actually saves the
+ * extended register state. Code using vector registers must bracket its
+ * use with kfpu_begin()/kfpu_end(), passing a kfpu_state_t that lives on
+ * the stack of the caller. kfpu_begin() fails when the kernel cannot save
+ * the state (for example when it is out of memory for the save area);
+ * callers must then take their scalar path and not call kfpu_end().
+ *
+ * Code confined to the 128-bit XMM registers with legacy SSE encoding
+ * (which includes AES-NI and PCLMULQDQ) may use kfpu_sse_begin() and
+ * kfpu_sse_end() instead. The x64 kernel spills the volatile XMM
+ * registers on interrupts and the calling convention preserves the
+ * non-volatile ones, so no explicit save is needed; this keeps per-block
+ * primitives cheap enough to be called one 16-byte block at a time.
+ */
+
+#ifndef _SPL_SIMD_H
+#define	_SPL_SIMD_H
+
+#include <sys/types.h>
+
+#if defined(__x86_64) || defined(__x86_64__)
+
+#include <intrin.h>
+#include <immintrin.h>
+
+#define	HAVE_SIMD_X86	1
+
+#ifndef XSTATE_MASK_AVX512
+#define	XSTATE_MASK_AVX512	((1ULL << 5) | (1ULL << 6) | (1ULL << 7))
+#endif
+
+#define	ZFS_XSTATE_MASK	\
+	(XSTATE_MASK_LEGACY | XSTATE_MASK_AVX | XSTATE_MASK_AVX512)
+
+#define	kfpu_allowed()	(KeGetCurrentIrql() <= DISPATCH_LEVEL)
+
+typedef XSTATE_SAVE kfpu_state_t;
+
+static inline boolean_t
+kfpu_begin(kfpu_state_t *state)
+{
+	return (NT_SUCCESS(KeSaveExtendedProcessorState(ZFS_XSTATE_MASK,
+	    state)));
+}
+
+static inline void
+kfpu_end(kfpu_state_t *state)
+{
+	KeRestoreExtendedProcessorState(state);
+}
+
+#define	kfpu_sse_begin()	do {} while (0)
+#define	kfpu_sse_end()		do {} while (0)
+
+/* CPUID leaf 1, ECX */
+#define	CPUID1_ECX_SSE3		(1U << 0)
+#define	CPUID1_ECX_PCLMULQDQ	(1U << 1)
+#define	CPUID1_ECX_SSSE3	(1U << 9)
+#define	CPUID1_ECX_SSE41	(1U << 19)
+#define	CPUID1_ECX_SSE42	(1U << 20)
+#define	CPUID1_ECX_AES		(1U << 25)
+#define	CPUID1_ECX_OSXSAVE	(1U << 27)
+#define	CPUID1_ECX_AVX		(1U << 28)
+/* CPUID leaf 1, EDX */
+#define	CPUID1_EDX_SSE2		(1U << 26)
+/* CPUID leaf 7, EBX */
+#define	CPUID7_EBX_AVX2		(1U << 5)
+#define	CPUID7_EBX_AVX512F	(1U << 16)
+#define	CPUID7_EBX_AVX512BW	(1U << 30)
+
+/* XCR0 bits that must be enabled by the OS */
+#define	XCR0_SSE_YMM		0x06ULL
+#define	XCR0_OPMASK_ZMM		0xe0ULL
+
+static inline boolean_t
+__simd_cpuid_check(int leaf, int reg, uint32_t mask)
+{
+	int regs[4];
+
+	__cpuid(regs, 0);
+	if (regs[0] < leaf)
+		return (B_FALSE);
+
+	__cpuidex(regs, leaf, 0);
+	return (((uint32_t)regs[reg] & mask) == mask);
+}
+
+static inline boolean_t
+__simd_xcr0_check(uint64_t mask)
+{
+	if (!__simd_cpuid_check(1, 2, CPUID1_ECX_OSXSAVE))
+		return (B_FALSE);
+	return ((_xgetbv(0) & mask) == mask);
+}
+
+static inline boolean_t
+zfs_sse2_available(void)
+{
+	return (__simd_cpuid_check(1, 3, CPUID1_EDX_SSE2));
+}
+
+static inline boolean_t
+zfs_ssse3_available(void)
+{
+	return (__simd_cpuid_check(1, 2, CPUID1_ECX_SSSE3));
+}
+
+static inline boolean_t
+zfs_sse4_1_available(void)
+{
+	return (__simd_cpuid_check(1, 2, CPUID1_ECX_SSE41));
+}
+
+static inline boolean_t
+zfs_aes_available(void)
+{
+	return (__simd_cpuid_check(1, 2, CPUID1_ECX_AES));
+}
+
+static inline boolean_t
+zfs_pclmulqdq_available(void)
+{
+	return (__simd_cpuid_check(1, 2, CPUID1_ECX_PCLMULQDQ));
+}
+
+static inline boolean_t
+zfs_avx_available(void)
+{
+	return (__simd_cpuid_check(1, 2, CPUID1_ECX_AVX) &&
+	    __simd_xcr0_check(XCR0_SSE_YMM));
+}
+
+static inline boolean_t
+zfs_avx2_available(void)
+{
+	return (zfs_avx_available() &&
+	    __simd_cpuid_check(7, 1, CPUID7_EBX_AVX2));
+}
+
+static inline boolean_t
+zfs_avx512f_available(void)
+{
+	return (zfs_avx2_available() &&
+	    __simd_xcr0_check(XCR0_SSE_YMM | XCR0_OPMASK_ZMM) &&
+	    __simd_cpuid_check(7, 1, CPUID7_EBX_AVX512F));
+}
+
+static inline boolean_t
+zfs_avx512bw_available(void)
+{
+	return (zfs_avx512f_available() &&
+	    __simd_cpuid_check(7, 1, CPUID7_EBX_AVX512BW));
+}
+
+#else /* !__x86_64 */
+
+typedef int kfpu_state_t;
+
+#define	kfpu_allowed()		0
+#define	kfpu_begin(state)	((void) (state), B_FALSE)
+#define	kfpu_end(state)		((void) (state))
+#define	kfpu_sse_begin()	do {} while (0)
+#define	kfpu_sse_end()		do {} while (0)
+
+#define	zfs_sse2_available()		B_FALSE
+#define	zfs_ssse3_available()		B_FALSE
+#define	zfs_sse4_1_available()		B_FALSE
+#define	zfs_aes_available()		B_FALSE
+#define	zfs_pclmulqdq_available()	B_FALSE
+#define	zfs_avx_available()		B_FALSE
+#define	zfs_avx2_available()		B_FALSE
+#define	zfs_avx512f_available()		B_FALSE
+#define	zfs_avx512bw_available()	B_FALSE
+
+#endif /* __x86_64 */
+
+#endif /* _SPL_SIMD_H */
@@ -155,6 +155,7 @@ extern proc_t p0;
                                 /* integrity as specified for writes by */
                                 /* FSYNC and FDSYNC flags */
 #define FOFFMAX         0x2000  /* large file */
+#define FDIRECT         0x100000 /* bypass the cache if the dataset allows */
 
 #define EXPORT_SYMBOL(X)
 #define module_param(X,Y,Z)
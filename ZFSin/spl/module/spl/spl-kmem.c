@@ -83,6 +83,14 @@ static volatile _Atomic boolean_t spl_free_fast_pressure = FALSE;
 static _Atomic boolean_t spl_free_maybe_reap_flag = FALSE;
 static _Atomic uint64_t spl_free_last_pressure = 0;
 
+// consumer of graded pressure events, see spl_pressure_post()
+static spl_pressure_func_t spl_pressure_func = NULL;
+static void *spl_pressure_arg = NULL;
+static volatile uint32_t spl_pressure_active = 0;
+static _Atomic spl_pressure_level_t spl_pressure_level = SPL_PRESSURE_NONE;
+static _Atomic int64_t spl_pressure_target = 0;
+static uint64_t spl_pressure_events[SPL_PRESSURE_LEVELS];
+
 // Start and end address of kernel memory
 extern vm_offset_t virtual_space_start;
 extern vm_offset_t virtual_space_end;
@@ -623,6 +631,14 @@ typedef struct spl_stats {
 
 	kstat_named_t kmem_free_to_slab_when_fragmented;
 
+	kstat_named_t spl_pressure_level;
+	kstat_named_t spl_pressure_target;
+	kstat_named_t spl_pressure_none;
+	kstat_named_t spl_pressure_low;
+	kstat_named_t spl_pressure_moderate;
+	kstat_named_t spl_pressure_high;
+	kstat_named_t spl_pressure_critical;
+
 } spl_stats_t;
 
 static spl_stats_t spl_stats = {
@@ -687,6 +703,14 @@ static spl_stats_t spl_stats = {
 	{"spl_arc_reclaim_avoided", KSTAT_DATA_UINT64},
 
 	{"kmem_free_to_slab_when_fragmented", KSTAT_DATA_UINT64},
+
+	{"spl_pressure_level", KSTAT_DATA_UINT64},
+	{"spl_pressure_target", KSTAT_DATA_INT64},
+	{"spl_pressure_none", KSTAT_DATA_UINT64},
+	{"spl_pressure_low", KSTAT_DATA_UINT64},
+	{"spl_pressure_moderate", KSTAT_DATA_UINT64},
+	{"spl_pressure_high", KSTAT_DATA_UINT64},
+	{"spl_pressure_critical", KSTAT_DATA_UINT64},
 };
 
 static kstat_t *spl_ksp = 0;
@@ -4288,6 +4312,49 @@ kmem_cache_fini()
 }
 
 
+/*
+ * Tell the registered consumer about memory pressure right away instead of
+ * leaving it to notice spl_free or spl_free_manual_pressure on its next
+ * poll.  The level says how urgently memory is wanted, the target how much.
+ */
+static void
+spl_pressure_post(spl_pressure_level_t level, int64_t target)
+{
+	spl_pressure_func_t func;
+
+	ASSERT3U(level, <, SPL_PRESSURE_LEVELS);
+
+	atomic_inc_64(&spl_pressure_events[level]);
+	spl_pressure_level = level;
+	spl_pressure_target = target;
+
+	atomic_inc_32(&spl_pressure_active);
+	func = spl_pressure_func;
+	if (func != NULL)
+		func(level, target, spl_pressure_arg);
+	atomic_dec_32(&spl_pressure_active);
+}
+
+void
+spl_pressure_register(spl_pressure_func_t func, void *arg)
+{
+	ASSERT3P(spl_pressure_func, ==, NULL);
+	spl_pressure_arg = arg;
+	membar_producer();
+	spl_pressure_func = func;
+}
+
+void
+spl_pressure_unregister(void)
+{
+	spl_pressure_func = NULL;
+	membar_enter();
+	// wait out any spl_pressure_post() still calling the old consumer
+	while (spl_pressure_active != 0)
+		delay(1);
+	spl_pressure_arg = NULL;
+}
+
 // this is intended to substitute for kmem_avail() in arc.c
 int64_t
 spl_free_wrapper(void)
@@ -4335,6 +4402,9 @@ spl_free_set_and_wait_pressure(int64_t new_p, boolean_t fast, clock_t check_inte
 
 	spl_free_last_pressure = start;
 
+	// an allocating thread is about to stall until this is answered
+	spl_pressure_post(SPL_PRESSURE_CRITICAL, spl_free_manual_pressure);
+
 	for  (; spl_free_manual_pressure != 0; ) {
 		// has another thread set spl_free_manual_pressure?
 		if (spl_free_manual_pressure < new_p)
@@ -4372,6 +4442,8 @@ spl_free_set_pressure(int64_t new_p)
 		cv_broadcast(&spl_free_thread_cv);
 	}
 	spl_free_last_pressure = zfs_lbolt();
+	if (new_p > 0)
+		spl_pressure_post(SPL_PRESSURE_MODERATE, new_p);
 }
 
 void
@@ -4381,6 +4453,9 @@ spl_free_set_pressure_both(int64_t new_p, boolean_t fast)
 	if (new_p > spl_free_manual_pressure || new_p <= 0)
 		spl_free_manual_pressure = new_p;
 	spl_free_last_pressure = zfs_lbolt();
+	if (new_p > 0)
+		spl_pressure_post(fast ? SPL_PRESSURE_HIGH :
+		    SPL_PRESSURE_MODERATE, new_p);
 }
 
 void spl_free_maybe_reap(void);
@@ -4393,6 +4468,8 @@ spl_free_set_emergency_pressure(int64_t new_p)
 		spl_free_manual_pressure = new_p;
 	spl_free_maybe_reap();
 	spl_free_last_pressure = zfs_lbolt();
+	if (new_p > 0)
+		spl_pressure_post(SPL_PRESSURE_HIGH, new_p);
 }
 
 void
@@ -4401,6 +4478,7 @@ spl_free_set_emergency_pressure_additive(int64_t new_p)
 	spl_free_fast_pressure = TRUE;
 	spl_free_manual_pressure += new_p;
 	spl_free_last_pressure = zfs_lbolt();
+	spl_pressure_post(SPL_PRESSURE_HIGH, spl_free_manual_pressure);
 }
 
 void
@@ -4408,6 +4486,7 @@ spl_free_set_pressure_additive(int64_t new_p)
 {
 	spl_free_manual_pressure += new_p;
 	spl_free_last_pressure = zfs_lbolt();
+	spl_pressure_post(SPL_PRESSURE_MODERATE, spl_free_manual_pressure);
 }
 
 boolean_t
@@ -4421,6 +4500,8 @@ spl_free_set_fast_pressure(boolean_t state)
 {
 	spl_free_fast_pressure = state;
 	spl_free_last_pressure = zfs_lbolt();
+	if (state && spl_free_manual_pressure > 0)
+		spl_pressure_post(SPL_PRESSURE_HIGH, spl_free_manual_pressure);
 }
 
 void
@@ -4888,6 +4969,17 @@ spl_free_thread()
 		// the direct equivalent of :
 		// __c11_atomic_store(&spl_free, new_spl_free, __ATOMIC_SEQ_CST);
 
+		// Post the edges of a shortage that nobody has put a number on
+		// yet, so the consumer stops growing now and can start growing
+		// again once it is over; manual pressure posts for itself.
+		if (spl_free_is_negative) {
+			if (spl_pressure_level == SPL_PRESSURE_NONE)
+				spl_pressure_post(SPL_PRESSURE_LOW, -new_spl_free);
+		} else if (spl_pressure_level != SPL_PRESSURE_NONE &&
+		    spl_free_manual_pressure == 0 && !lowmem) {
+			spl_pressure_post(SPL_PRESSURE_NONE, 0);
+		}
+
 
 		// Because we're already negative, arc is likely to have been
 		// signalled already. We can rely on the _maybe_ in
@@ -4973,7 +5065,7 @@ spl_event_thread()
 		xprintf("%s: LOWMEMORY EVENT *** 0x%x (memusage: %llu)\n", __func__, Status, segkmem_total_mem_allocated);
 		/* We were signalled */
 		//vm_page_free_wanted = vm_page_free_min;
-		spl_free_set_pressure(vm_page_free_min);
+		spl_free_set_pressure_both(vm_page_free_min, TRUE);
 		vm_page_free_wanted = vm_page_free_min;
 		cv_broadcast(&spl_free_thread_cv);
 	}
@@ -5058,6 +5150,19 @@ spl_kstat_update(kstat_t *ksp, int rw)
 		ks->spl_xat_lastalloc.value.ui64 = spl_xat_lastalloc;
 		ks->spl_xat_lastfree.value.ui64 = spl_xat_lastfree;
 		ks->spl_xat_forced.value.ui64 = spl_xat_forced;
+
+		ks->spl_pressure_level.value.ui64 = spl_pressure_level;
+		ks->spl_pressure_target.value.i64 = spl_pressure_target;
+		ks->spl_pressure_none.value.ui64 =
+		    spl_pressure_events[SPL_PRESSURE_NONE];
+		ks->spl_pressure_low.value.ui64 =
+		    spl_pressure_events[SPL_PRESSURE_LOW];
+		ks->spl_pressure_moderate.value.ui64 =
+		    spl_pressure_events[SPL_PRESSURE_MODERATE];
+		ks->spl_pressure_high.value.ui64 =
+		    spl_pressure_events[SPL_PRESSURE_HIGH];
+		ks->spl_pressure_critical.value.ui64 =
+		    spl_pressure_events[SPL_PRESSURE_CRITICAL];
 		ks->spl_xat_sleep.value.ui64 = spl_xat_sleep;
 		ks->spl_xat_late_deny.value.ui64 = spl_xat_late_deny;
 		ks->spl_xat_no_waiters.value.ui64 = spl_xat_no_waiters;
@@ -73,6 +73,8 @@
 #include "zfs_comutil.h"
 #include "libzfs_impl.h"
 
+#include <../lib/libkstat/kstat.h>
+
 #ifdef __APPLE__
 #include <sys/zfs_mount.h>
 #include <syslog.h>
@@ -114,6 +116,7 @@ static int zfs_do_load_key(int argc, char **argv);
 static int zfs_do_unload_key(int argc, char **argv);
 static int zfs_do_change_key(int argc, char **argv);
 static int zfs_do_remap(int argc, char **argv);
+static int zfs_do_iostat(int argc, char **argv);
 
 /*
  * Enable a reasonable set of defaults for libumem debugging on DEBUG builds.
@@ -165,6 +168,7 @@ typedef enum {
 	HELP_LOAD_KEY,
 	HELP_UNLOAD_KEY,
 	HELP_CHANGE_KEY,
+	HELP_IOSTAT,
 } zfs_help_t;
 
 typedef struct zfs_command {
@@ -194,6 +198,7 @@ static zfs_command_t command_table[] = {
 	{ "bookmark",	zfs_do_bookmark,	HELP_BOOKMARK		},
 	{ NULL },
 	{ "list",	zfs_do_list,		HELP_LIST		},
+	{ "iostat",	zfs_do_iostat,		HELP_IOSTAT		},
 	{ NULL },
 	{ "set",	zfs_do_set,		HELP_SET		},
 	{ "get",	zfs_do_get,		HELP_GET		},
@@ -353,6 +358,9 @@ get_usage(zfs_help_t idx)
 		    "\t    [-o keylocation=<value>] [-o pbkfd2iters=<value>]\n"
 		    "\t    <filesystem|volume>\n"
 		    "\tchange-key -i [-l] <filesystem|volume>\n"));
+	case HELP_IOSTAT:
+		return (gettext("\tiostat [-Hpr] [filesystem|volume] ... "
+		    "[interval [count]]\n"));
 	}
 
 	abort();
@@ -7529,6 +7537,292 @@ zfs_do_change_key(int argc, char **argv)
 	return (0);
 }
 
+/*
+ * zfs iostat [-Hpr] [filesystem|volume] ... [interval [count]]
+ *
+ *	-H	Scripted mode; no header, tab-separated columns
+ *	-p	Print exact (parsable) numbers
+ *	-r	Include the descendants of the named datasets
+ *
+ * Report the per-dataset statistics kept in the zfs/<pool>/objset-0x<id>
+ * kstats: read and write requests, logical and physical bytes, ARC hit
+ * rate and ZIL commits, all per second.  The first report covers the time
+ * since each dataset was loaded, later ones the preceding interval.
+ */
+typedef enum {
+	IOSTAT_DS_READS,
+	IOSTAT_DS_WRITES,
+	IOSTAT_DS_NREAD,
+	IOSTAT_DS_NWRITTEN,
+	IOSTAT_DS_PREAD,
+	IOSTAT_DS_PWRITTEN,
+	IOSTAT_DS_ARC_HITS,
+	IOSTAT_DS_ARC_MISSES,
+	IOSTAT_DS_ZIL_COMMITS,
+	IOSTAT_DS_NSTATS
+} iostat_ds_stat_t;
+
+static const char *iostat_ds_kstat[IOSTAT_DS_NSTATS] = {
+	"reads", "writes", "nread", "nwritten", "pread", "pwritten",
+	"arc_hits", "arc_misses", "zil_commits"
+};
+
+typedef struct iostat_ds {
+	struct iostat_ds	*ids_next;
+	char			ids_module[KSTAT_STRLEN];
+	char			ids_name[KSTAT_STRLEN];
+	hrtime_t		ids_crtime;
+	hrtime_t		ids_snaptime;
+	uint64_t		ids_val[IOSTAT_DS_NSTATS];
+} iostat_ds_t;
+
+typedef struct iostat_cbdata {
+	boolean_t	cb_scripted;
+	boolean_t	cb_literal;
+	boolean_t	cb_recurse;
+	int		cb_namewidth;
+	int		cb_argc;
+	char		**cb_argv;
+	iostat_ds_t	*cb_prev;
+} iostat_cbdata_t;
+
+static boolean_t
+iostat_ds_match(iostat_cbdata_t *cb, const char *dsname)
+{
+	if (cb->cb_argc == 0)
+		return (B_TRUE);
+
+	for (int i = 0; i < cb->cb_argc; i++) {
+		size_t len = strlen(cb->cb_argv[i]);
+
+		if (strcmp(dsname, cb->cb_argv[i]) == 0)
+			return (B_TRUE);
+		if (cb->cb_recurse &&
+		    strncmp(dsname, cb->cb_argv[i], len) == 0 &&
+		    dsname[len] == '/')
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+static void
+iostat_ds_print_rate(iostat_cbdata_t *cb, uint64_t delta, hrtime_t elapsed)
+{
+	char buf[32];
+	uint64_t rate = elapsed > 0 ?
+	    (uint64_t)((double)delta * NANOSEC / elapsed) : 0;
+
+	if (cb->cb_literal)
+		(void) snprintf(buf, sizeof (buf), "%llu", (u_longlong_t)rate);
+	else
+		zfs_nicenum(rate, buf, sizeof (buf));
+
+	if (cb->cb_scripted)
+		(void) printf("\t%s", buf);
+	else
+		(void) printf("  %6s", buf);
+}
+
+static void
+iostat_ds_print_header(iostat_cbdata_t *cb)
+{
+	(void) printf("%-*s  %6s  %6s  %6s  %6s  %6s  %6s  %6s  %6s\n",
+	    cb->cb_namewidth, gettext("DATASET"), gettext("READ"),
+	    gettext("WRITE"), gettext("RBYTES"), gettext("WBYTES"),
+	    gettext("PREAD"), gettext("PWRITE"), gettext("HIT%"),
+	    gettext("ZIL"));
+}
+
+/*
+ * Read every dataset kstat that matches, print a line for it and replace
+ * the previous samples with the new ones.
+ */
+static int
+iostat_ds_report(kstat_ctl_t *kc, iostat_cbdata_t *cb)
+{
+	iostat_ds_t *cur = NULL, *ids, *prev;
+	kstat_t *ksp;
+	int nprinted = 0;
+
+	for (ksp = kc->kc_chain; ksp != NULL; ksp = ksp->ks_next) {
+		kstat_named_t *kn;
+		char *dsname;
+
+		if (ksp->ks_type != KSTAT_TYPE_NAMED ||
+		    strncmp(ksp->ks_module, "zfs/", 4) != 0 ||
+		    strncmp(ksp->ks_name, "objset-0x", 9) != 0)
+			continue;
+		if (kstat_read(kc, ksp, NULL) == -1)
+			continue;
+
+		kn = kstat_data_lookup(ksp, "dataset_name");
+		if (kn == NULL || KSTAT_NAMED_STR_PTR(kn) == NULL)
+			continue;
+		dsname = KSTAT_NAMED_STR_PTR(kn);
+		if (!iostat_ds_match(cb, dsname))
+			continue;
+
+		ids = safe_malloc(sizeof (iostat_ds_t));
+		(void) strlcpy(ids->ids_module, ksp->ks_module,
+		    sizeof (ids->ids_module));
+		(void) strlcpy(ids->ids_name, ksp->ks_name,
+		    sizeof (ids->ids_name));
+		ids->ids_crtime = ksp->ks_crtime;
+		ids->ids_snaptime = ksp->ks_snaptime;
+		for (int s = 0; s < IOSTAT_DS_NSTATS; s++) {
+			kn = kstat_data_lookup(ksp, (char *)iostat_ds_kstat[s]);
+			ids->ids_val[s] = kn != NULL ? kn->value.ui64 : 0;
+		}
+		ids->ids_next = cur;
+		cur = ids;
+
+		/* the last sample of the same objset, if there is one */
+		for (prev = cb->cb_prev; prev != NULL; prev = prev->ids_next) {
+			if (strcmp(prev->ids_module, ids->ids_module) == 0 &&
+			    strcmp(prev->ids_name, ids->ids_name) == 0 &&
+			    prev->ids_crtime == ids->ids_crtime)
+				break;
+		}
+
+		if (nprinted++ == 0 && !cb->cb_scripted)
+			iostat_ds_print_header(cb);
+
+		uint64_t delta[IOSTAT_DS_NSTATS];
+		hrtime_t elapsed = ids->ids_snaptime -
+		    (prev != NULL ? prev->ids_snaptime : ids->ids_crtime);
+		for (int s = 0; s < IOSTAT_DS_NSTATS; s++) {
+			delta[s] = ids->ids_val[s] -
+			    (prev != NULL ? prev->ids_val[s] : 0);
+		}
+
+		if (cb->cb_scripted)
+			(void) printf("%s", dsname);
+		else
+			(void) printf("%-*s", cb->cb_namewidth, dsname);
+		for (int s = IOSTAT_DS_READS; s <= IOSTAT_DS_PWRITTEN; s++)
+			iostat_ds_print_rate(cb, delta[s], elapsed);
+
+		uint64_t lookups = delta[IOSTAT_DS_ARC_HITS] +
+		    delta[IOSTAT_DS_ARC_MISSES];
+		char hit[8] = "-";
+		if (lookups != 0) {
+			(void) snprintf(hit, sizeof (hit), "%llu",
+			    (u_longlong_t)(delta[IOSTAT_DS_ARC_HITS] * 100 /
+			    lookups));
+		}
+		(void) printf(cb->cb_scripted ? "\t%s" : "  %6s", hit);
+
+		iostat_ds_print_rate(cb, delta[IOSTAT_DS_ZIL_COMMITS], elapsed);
+		(void) printf("\n");
+	}
+
+	while ((prev = cb->cb_prev) != NULL) {
+		cb->cb_prev = prev->ids_next;
+		free(prev);
+	}
+	cb->cb_prev = cur;
+
+	return (nprinted);
+}
+
+static int
+zfs_do_iostat(int argc, char **argv)
+{
+	iostat_cbdata_t cb = { 0 };
+	kstat_ctl_t *kc;
+	unsigned long interval = 0, count = 0;
+	iostat_ds_t *ids;
+	char *end;
+	int c;
+
+	while ((c = getopt(argc, argv, "Hpr")) != -1) {
+		switch (c) {
+		case 'H':
+			cb.cb_scripted = B_TRUE;
+			break;
+		case 'p':
+			cb.cb_literal = B_TRUE;
+			break;
+		case 'r':
+			cb.cb_recurse = B_TRUE;
+			break;
+		default:
+			(void) fprintf(stderr,
+			    gettext("invalid option '%c'\n"), optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	/* trailing [interval [count]] */
+	if (argc > 0 && isdigit(argv[argc - 1][0])) {
+		interval = strtoul(argv[argc - 1], &end, 10);
+		if (*end != '\0' || interval == 0) {
+			(void) fprintf(stderr,
+			    gettext("invalid interval '%s'\n"), argv[argc - 1]);
+			usage(B_FALSE);
+		}
+		argc--;
+		if (argc > 0 && isdigit(argv[argc - 1][0])) {
+			count = interval;
+			interval = strtoul(argv[argc - 1], &end, 10);
+			if (*end != '\0' || interval == 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid interval '%s'\n"),
+				    argv[argc - 1]);
+				usage(B_FALSE);
+			}
+			argc--;
+		}
+	}
+
+	for (int i = 0; i < argc; i++) {
+		zfs_handle_t *zhp = zfs_open(g_zfs, argv[i],
+		    ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME);
+		if (zhp == NULL)
+			return (1);
+		zfs_close(zhp);
+	}
+	cb.cb_argc = argc;
+	cb.cb_argv = argv;
+	cb.cb_namewidth = 24;
+	for (int i = 0; i < argc; i++)
+		cb.cb_namewidth = MAX(cb.cb_namewidth, strlen(argv[i]));
+
+	if ((kc = kstat_open()) == NULL) {
+		(void) fprintf(stderr,
+		    gettext("cannot open kstats: %s\n"), strerror(errno));
+		return (1);
+	}
+
+	for (;;) {
+		if (iostat_ds_report(kc, &cb) == 0 && count == 0 &&
+		    interval == 0) {
+			(void) fprintf(stderr,
+			    gettext("no datasets with statistics\n"));
+		}
+
+		if (interval == 0 || (count != 0 && --count == 0))
+			break;
+
+		(void) fflush(stdout);
+		(void) sleep(interval);
+		(void) kstat_chain_update(kc);
+		if (!cb.cb_scripted)
+			(void) printf("\n");
+	}
+
+	while ((ids = cb.cb_prev) != NULL) {
+		cb.cb_prev = ids->ids_next;
+		free(ids);
+	}
+	(void) kstat_close(kc);
+
+	return (0);
+}
+
 int
 main(int argc, char **argv)
 {
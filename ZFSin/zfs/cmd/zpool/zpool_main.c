@@ -95,6 +95,7 @@ static int zpool_do_replace(int, char **);
 static int zpool_do_split(int, char **);
 
 static int zpool_do_initialize(int, char **);
+static int zpool_do_trim(int, char **);
 static int zpool_do_scrub(int, char **);
 
 static int zpool_do_import(int, char **);
@@ -147,6 +148,7 @@ typedef enum {
 	HELP_REMOVE,
 	HELP_INITIALIZE,
 	HELP_SCRUB,
+	HELP_TRIM,
 	HELP_STATUS,
 	HELP_UPGRADE,
 	HELP_EVENTS,
@@ -196,6 +198,7 @@ static const char *vsx_type_to_nvlist[IOS_COUNT][11] = {
 	    ZPOOL_CONFIG_VDEV_ASYNC_R_LAT_HISTO,
 	    ZPOOL_CONFIG_VDEV_ASYNC_W_LAT_HISTO,
 	    ZPOOL_CONFIG_VDEV_SCRUB_LAT_HISTO,
+	    ZPOOL_CONFIG_VDEV_TRIM_LAT_HISTO,
 	    NULL},
 	[IOS_LATENCY] = {
 	    ZPOOL_CONFIG_VDEV_TOT_R_LAT_HISTO,
@@ -209,6 +212,7 @@ static const char *vsx_type_to_nvlist[IOS_COUNT][11] = {
 	    ZPOOL_CONFIG_VDEV_ASYNC_R_ACTIVE_QUEUE,
 	    ZPOOL_CONFIG_VDEV_ASYNC_W_ACTIVE_QUEUE,
 	    ZPOOL_CONFIG_VDEV_SCRUB_ACTIVE_QUEUE,
+	    ZPOOL_CONFIG_VDEV_TRIM_ACTIVE_QUEUE,
 	    NULL},
 	[IOS_RQ_HISTO] = {
 	    ZPOOL_CONFIG_VDEV_SYNC_IND_R_HISTO,
@@ -274,6 +278,7 @@ static zpool_command_t command_table[] = {
 	{ NULL },
 	{ "initialize",	zpool_do_initialize,	HELP_INITIALIZE		},
 	{ "scrub",	zpool_do_scrub,		HELP_SCRUB		},
+	{ "trim",	zpool_do_trim,		HELP_TRIM		},
 	{ NULL },
 	{ "import",	zpool_do_import,	HELP_IMPORT		},
 	{ "export",	zpool_do_export,	HELP_EXPORT		},
@@ -332,7 +337,7 @@ get_usage(zpool_help_t idx) {
 		    "\t    [--rewind-to-checkpoint] <pool | id> [newpool]\n"));
 	case HELP_IOSTAT:
 		return (gettext("\tiostat [-T d | u] [-ghHLpPvy] "
-		    "[[-lq]|[-r|-w]]\n"
+		    "[[-lq]|[-r|-w]|-s]\n"
 		    "\t    [[pool ...]|[pool vdev ...]|[vdev ...]] "
 		    "[interval [count]]\n"));
 	case HELP_LABELCLEAR:
@@ -355,6 +360,9 @@ get_usage(zpool_help_t idx) {
 		return (gettext("\tinitialize [-cs] <pool> [<device> ...]\n"));
 	case HELP_SCRUB:
 		return (gettext("\tscrub [-s | -p] <pool> ...\n"));
+	case HELP_TRIM:
+		return (gettext("\ttrim [-d] [-r <rate>] [-c | -s] <pool> "
+		    "[<device> ...]\n"));
 	case HELP_STATUS:
 		return (gettext("\tstatus [-gLPvxD] [-T d|u] [pool] ... "
 		    "[interval [count]]\n"));
@@ -466,9 +474,32 @@ usage(boolean_t requested)
 	exit(requested ? 0 : 2);
 }
 
+/*
+ * Top-level vdevs are displayed in separate groups according to the
+ * allocation class they belong to.
+ */
+typedef enum vdev_class {
+	VDEV_CLASS_NORMAL,
+	VDEV_CLASS_LOG,
+	VDEV_CLASS_SPECIAL
+} vdev_class_t;
+
+static vdev_class_t
+vdev_get_class(nvlist_t *nv)
+{
+	uint64_t is_log = B_FALSE;
+
+	(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_IS_LOG, &is_log);
+	if (is_log)
+		return (VDEV_CLASS_LOG);
+	if (vdev_is_special(nv))
+		return (VDEV_CLASS_SPECIAL);
+	return (VDEV_CLASS_NORMAL);
+}
+
 void
 print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
-    boolean_t print_logs, int name_flags)
+    vdev_class_t class, int name_flags)
 {
 	nvlist_t **child;
 	uint_t c, children;
@@ -482,16 +513,12 @@ print_vdev_tree(zpool_handle_t *zhp, const char *name, nvlist_t *nv, int indent,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if ((is_log && !print_logs) || (!is_log && print_logs))
+		if (vdev_get_class(child[c]) != class)
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, zhp, child[c], name_flags);
 		print_vdev_tree(zhp, vname, child[c], indent + 2,
-		    B_FALSE, name_flags);
+		    VDEV_CLASS_NORMAL, name_flags);
 		free(vname);
 	}
 }
@@ -716,19 +743,31 @@ zpool_do_add(int argc, char **argv)
 		    "configuration:\n"), zpool_get_name(zhp));
 
 		/* print original main pool and new tree */
-		print_vdev_tree(zhp, poolname, poolnvroot, 0, B_FALSE,
+		print_vdev_tree(zhp, poolname, poolnvroot, 0,
+		    VDEV_CLASS_NORMAL, name_flags);
+		print_vdev_tree(zhp, NULL, nvroot, 0, VDEV_CLASS_NORMAL,
 		    name_flags);
-		print_vdev_tree(zhp, NULL, nvroot, 0, B_FALSE, name_flags);
+
+		/* Do the same for the special class */
+		if (num_special(poolnvroot) > 0) {
+			print_vdev_tree(zhp, VDEV_ALLOC_BIAS_SPECIAL,
+			    poolnvroot, 0, VDEV_CLASS_SPECIAL, name_flags);
+			print_vdev_tree(zhp, NULL, nvroot, 0,
+			    VDEV_CLASS_SPECIAL, name_flags);
+		} else if (num_special(nvroot) > 0) {
+			print_vdev_tree(zhp, VDEV_ALLOC_BIAS_SPECIAL, nvroot,
+			    0, VDEV_CLASS_SPECIAL, name_flags);
+		}
 
 		/* Do the same for the logs */
 		if (num_logs(poolnvroot) > 0) {
-			print_vdev_tree(zhp, "logs", poolnvroot, 0, B_TRUE,
-			    name_flags);
-			print_vdev_tree(zhp, NULL, nvroot, 0, B_TRUE,
+			print_vdev_tree(zhp, "logs", poolnvroot, 0,
+			    VDEV_CLASS_LOG, name_flags);
+			print_vdev_tree(zhp, NULL, nvroot, 0, VDEV_CLASS_LOG,
 			    name_flags);
 		} else if (num_logs(nvroot) > 0) {
-			print_vdev_tree(zhp, "logs", nvroot, 0, B_TRUE,
-			    name_flags);
+			print_vdev_tree(zhp, "logs", nvroot, 0,
+			    VDEV_CLASS_LOG, name_flags);
 		}
 
 		/* Do the same for the caches */
@@ -1281,9 +1320,14 @@ zpool_do_create(int argc, char **argv)
 		(void) printf(gettext("would create '%s' with the "
 		    "following layout:\n\n"), poolname);
 
-		print_vdev_tree(NULL, poolname, nvroot, 0, B_FALSE, 0);
+		print_vdev_tree(NULL, poolname, nvroot, 0, VDEV_CLASS_NORMAL,
+		    0);
+		if (num_special(nvroot) > 0)
+			print_vdev_tree(NULL, VDEV_ALLOC_BIAS_SPECIAL, nvroot,
+			    0, VDEV_CLASS_SPECIAL, 0);
 		if (num_logs(nvroot) > 0)
-			print_vdev_tree(NULL, "logs", nvroot, 0, B_TRUE, 0);
+			print_vdev_tree(NULL, "logs", nvroot, 0,
+			    VDEV_CLASS_LOG, 0);
 
 		ret = 0;
 	} else {
@@ -1773,17 +1817,54 @@ print_status_config(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 		    initialize_pct, zbuf);
 	}
 
+	if ((vs->vs_trim_state == VDEV_TRIM_ACTIVE ||
+	    vs->vs_trim_state == VDEV_TRIM_SUSPENDED ||
+	    vs->vs_trim_state == VDEV_TRIM_COMPLETE) &&
+	    !vs->vs_scan_removing) {
+		char zbuf[1024];
+		char tbuf[256];
+		struct tm zaction_ts;
+
+		time_t t = vs->vs_trim_action_time;
+		int trim_pct = 100;
+		if (vs->vs_trim_state != VDEV_TRIM_COMPLETE) {
+			trim_pct = (vs->vs_trim_bytes_done * 100 /
+			    (vs->vs_trim_bytes_est + 1));
+		}
+
+		(void) localtime_r(&t, &zaction_ts);
+		(void) strftime(tbuf, sizeof (tbuf), "%c", &zaction_ts);
+
+		switch (vs->vs_trim_state) {
+		case VDEV_TRIM_SUSPENDED:
+			(void) snprintf(zbuf, sizeof (zbuf),
+			    ", suspended, started at %s", tbuf);
+			break;
+		case VDEV_TRIM_ACTIVE:
+			(void) snprintf(zbuf, sizeof (zbuf),
+			    ", started at %s", tbuf);
+			break;
+		case VDEV_TRIM_COMPLETE:
+			(void) snprintf(zbuf, sizeof (zbuf),
+			    ", completed at %s", tbuf);
+			break;
+		}
+
+		(void) printf(gettext("  (%d%% trimmed%s)"),
+		    trim_pct, zbuf);
+	}
+
 	(void) printf("\n");
 
 	for (c = 0; c < children; c++) {
 		uint64_t islog = B_FALSE, ishole = B_FALSE;
 
-		/* Don't print logs or holes here */
+		/* Don't print logs, special vdevs or holes here */
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
 		    &islog);
 		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_HOLE,
 		    &ishole);
-		if (islog || ishole)
+		if (islog || ishole || vdev_is_special(child[c]))
 			continue;
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    name_flags | VDEV_NAME_TYPE_ID);
@@ -1862,11 +1943,7 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth,
 		return;
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
-
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (is_log)
+		if (vdev_get_class(child[c]) != VDEV_CLASS_NORMAL)
 			continue;
 
 		vname = zpool_vdev_name(g_zfs, NULL, child[c],
@@ -1900,16 +1977,17 @@ print_import_config(const char *name, nvlist_t *nv, int namewidth, int depth,
 }
 
 /*
- * Print log vdevs.
+ * Print log or special vdevs.
  * Logs are recorded as top level vdevs in the main pool child array
- * but with "is_log" set to 1. We use either print_status_config() or
- * print_import_config() to print the top level logs then any log
- * children (eg mirrored slogs) are printed recursively - which
- * works because only the top level vdev is marked "is_log"
+ * but with "is_log" set to 1, and special vdevs carry an "alloc_bias".
+ * We use either print_status_config() or print_import_config() to print
+ * the top level vdevs of the class then any children (eg mirrored slogs)
+ * are printed recursively - which works because only the top level vdev
+ * is marked.
  */
 static void
 print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose,
-    int name_flags)
+    int name_flags, vdev_class_t class)
 {
 	uint_t c, children;
 	nvlist_t **child;
@@ -1918,15 +1996,15 @@ print_logs(zpool_handle_t *zhp, nvlist_t *nv, int namewidth, boolean_t verbose,
 	    &children) != 0)
 		return;
 
-	(void) printf(gettext("\tlogs\n"));
+	if (class == VDEV_CLASS_SPECIAL)
+		(void) printf(gettext("\tspecial\n"));
+	else
+		(void) printf(gettext("\tlogs\n"));
 
 	for (c = 0; c < children; c++) {
-		uint64_t is_log = B_FALSE;
 		char *name;
 
-		(void) nvlist_lookup_uint64(child[c], ZPOOL_CONFIG_IS_LOG,
-		    &is_log);
-		if (!is_log)
+		if (vdev_get_class(child[c]) != class)
 			continue;
 		name = zpool_vdev_name(g_zfs, zhp, child[c],
 		    name_flags | VDEV_NAME_TYPE_ID);
@@ -2199,8 +2277,12 @@ show_import(nvlist_t *config)
 		namewidth = 10;
 
 	print_import_config(name, nvroot, namewidth, 0, 0);
+	if (num_special(nvroot) > 0)
+		print_logs(NULL, nvroot, namewidth, B_FALSE, 0,
+		    VDEV_CLASS_SPECIAL);
 	if (num_logs(nvroot) > 0)
-		print_logs(NULL, nvroot, namewidth, B_FALSE, 0);
+		print_logs(NULL, nvroot, namewidth, B_FALSE, 0,
+		    VDEV_CLASS_LOG);
 
 	if (reason == ZPOOL_STATUS_BAD_GUID_SUM) {
 		(void) printf(gettext("\n\tAdditional devices are known to "
@@ -2887,17 +2969,17 @@ typedef struct name_and_columns {
 	unsigned int columns;	/* Center name to this number of columns */
 } name_and_columns_t;
 
-#define	IOSTAT_MAX_LABELS	11	/* Max number of labels on one line */
+#define	IOSTAT_MAX_LABELS	13	/* Max number of labels on one line */
 
 static const name_and_columns_t iostat_top_labels[][IOSTAT_MAX_LABELS] =
 {
 	[IOS_DEFAULT] = {{"capacity", 2}, {"operations", 2}, {"bandwidth", 2},
 	    {NULL}},
 	[IOS_LATENCY] = {{"total_wait", 2}, {"disk_wait", 2}, {"syncq_wait", 2},
-	    {"asyncq_wait", 2}, {"scrub"}},
+	    {"asyncq_wait", 2}, {"scrub"}, {"trim"}},
 	[IOS_QUEUES] = {{"syncq_read", 2}, {"syncq_write", 2},
 	    {"asyncq_read", 2}, {"asyncq_write", 2}, {"scrubq_read", 2},
-	    {NULL}},
+	    {"trimq_write", 2}, {NULL}},
 	[IOS_L_HISTO] = {{"total_wait", 2}, {"disk_wait", 2},
 	    {"sync_queue", 2}, {"async_queue", 2}, {NULL}},
 	[IOS_RQ_HISTO] = {{"sync_read", 2}, {"sync_write", 2},
@@ -2911,11 +2993,12 @@ static const name_and_columns_t iostat_bottom_labels[][IOSTAT_MAX_LABELS] =
 	[IOS_DEFAULT] = {{"alloc"}, {"free"}, {"read"}, {"write"}, {"read"},
 	    {"write"}, {NULL}},
 	[IOS_LATENCY] = {{"read"}, {"write"}, {"read"}, {"write"}, {"read"},
-	    {"write"}, {"read"}, {"write"}, {"wait"}, {NULL}},
+	    {"write"}, {"read"}, {"write"}, {"wait"}, {"wait"}, {NULL}},
 	[IOS_QUEUES] = {{"pend"}, {"activ"}, {"pend"}, {"activ"}, {"pend"},
-	    {"activ"}, {"pend"}, {"activ"}, {"pend"}, {"activ"}, {NULL}},
+	    {"activ"}, {"pend"}, {"activ"}, {"pend"}, {"activ"},
+	    {"pend"}, {"activ"}, {NULL}},
 	[IOS_L_HISTO] = {{"read"}, {"write"}, {"read"}, {"write"}, {"read"},
-	    {"write"}, {"read"}, {"write"}, {"scrub"}, {NULL}},
+	    {"write"}, {"read"}, {"write"}, {"scrub"}, {"trim"}, {NULL}},
 	[IOS_RQ_HISTO] = {{"ind"}, {"agg"}, {"ind"}, {"agg"}, {"ind"}, {"agg"},
 	    {"ind"}, {"agg"}, {"ind"}, {"agg"}, {NULL}},
 };
@@ -3485,6 +3568,8 @@ print_iostat_queues(iostat_cbdata_t *cb, nvlist_t *oldnv,
 		ZPOOL_CONFIG_VDEV_ASYNC_W_ACTIVE_QUEUE,
 		ZPOOL_CONFIG_VDEV_SCRUB_PEND_QUEUE,
 		ZPOOL_CONFIG_VDEV_SCRUB_ACTIVE_QUEUE,
+		ZPOOL_CONFIG_VDEV_TRIM_PEND_QUEUE,
+		ZPOOL_CONFIG_VDEV_TRIM_ACTIVE_QUEUE,
 	};
 
 	struct stat_array *nva;
@@ -3523,6 +3608,7 @@ print_iostat_latency(iostat_cbdata_t *cb, nvlist_t *oldnv,
 		ZPOOL_CONFIG_VDEV_ASYNC_R_LAT_HISTO,
 		ZPOOL_CONFIG_VDEV_ASYNC_W_LAT_HISTO,
 		ZPOOL_CONFIG_VDEV_SCRUB_LAT_HISTO,
+		ZPOOL_CONFIG_VDEV_TRIM_LAT_HISTO,
 	};
 	struct stat_array *nva;
 
@@ -3800,6 +3886,144 @@ refresh_iostat(zpool_handle_t *zhp, void *data)
 	return (0);
 }
 
+/*
+ * Return the upper bound of the bucket holding the pct-th percentile of a
+ * power-of-two latency histogram.
+ */
+static uint64_t
+single_histo_percentile(uint64_t *histo, unsigned int buckets, uint64_t count,
+    unsigned int pct)
+{
+	uint64_t target = (count * pct + 99) / 100;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < buckets; i++) {
+		sum += histo[i];
+		if (sum >= target && sum != 0)
+			return ((1ULL << (i + 1)) - 1);
+	}
+
+	return (0);
+}
+
+/*
+ * Print how long the pool's zios spent in each pipeline stage since the
+ * last interval, for "zpool iostat -s".  The kernel only keeps these
+ * while the zio_stage_stats module parameter is set.
+ */
+static int
+print_iostat_stages(zpool_handle_t *zhp, void *data)
+{
+	iostat_cbdata_t *cb = data;
+	nvlist_t *oldconfig, *newconfig, *nvroot, *nvx;
+	nvlist_t *newnvs, *oldnvs = NULL;
+	nvlist_t *newnvc, *oldnvc;
+	nvpair_t *cp, *sp;
+	uint64_t d[ZIO_STAGE_HISTO_BUCKETS + VDEV_L_HISTO_BUCKETS];
+	uint64_t *nv, *ov;
+	uint_t nc, oc, i;
+	enum zfs_nicenum_format nformat, tformat;
+	char class[64], *prio;
+	const char *name = zpool_get_name(zhp);
+
+	newconfig = zpool_get_config(zhp, &oldconfig);
+	if (cb->cb_iteration == 1)
+		oldconfig = NULL;
+
+	verify(nvlist_lookup_nvlist(newconfig, ZPOOL_CONFIG_VDEV_TREE,
+	    &nvroot) == 0);
+	if (nvlist_lookup_nvlist(nvroot, ZPOOL_CONFIG_VDEV_STATS_EX,
+	    &nvx) != 0 || nvlist_lookup_nvlist(nvx,
+	    ZPOOL_CONFIG_ZIO_STAGE_HISTO, &newnvs) != 0) {
+		(void) fprintf(stderr, gettext("%s: no zio stage statistics, "
+		    "set the zio_stage_stats module parameter\n"), name);
+		return (0);
+	}
+
+	if (oldconfig != NULL &&
+	    nvlist_lookup_nvlist(oldconfig, ZPOOL_CONFIG_VDEV_TREE,
+	    &nvroot) == 0 &&
+	    nvlist_lookup_nvlist(nvroot, ZPOOL_CONFIG_VDEV_STATS_EX,
+	    &nvx) == 0)
+		(void) nvlist_lookup_nvlist(nvx, ZPOOL_CONFIG_ZIO_STAGE_HISTO,
+		    &oldnvs);
+
+	if (cb->cb_literal) {
+		nformat = ZFS_NICENUM_RAW;
+		tformat = ZFS_NICENUM_RAW;
+	} else {
+		nformat = ZFS_NICENUM_1024;
+		tformat = ZFS_NICENUM_TIME;
+	}
+
+	if (!cb->cb_scripted) {
+		(void) printf("%-*s  %-6s %-12s %-18s  %5s  %5s  %5s  %5s\n",
+		    cb->cb_namewidth, "pool", "type", "priority", "stage",
+		    "count", "avg", "p50", "p99");
+	}
+
+	for (cp = nvlist_next_nvpair(newnvs, NULL); cp != NULL;
+	    cp = nvlist_next_nvpair(newnvs, cp)) {
+		(void) strlcpy(class, nvpair_name(cp), sizeof (class));
+		if ((prio = strchr(class, '/')) != NULL)
+			*prio++ = '\0';
+		else
+			prio = "-";
+
+		verify(nvpair_value_nvlist(cp, &newnvc) == 0);
+		oldnvc = NULL;
+		if (oldnvs != NULL)
+			(void) nvlist_lookup_nvlist(oldnvs, nvpair_name(cp),
+			    &oldnvc);
+
+		for (sp = nvlist_next_nvpair(newnvc, NULL); sp != NULL;
+		    sp = nvlist_next_nvpair(newnvc, sp)) {
+			verify(nvpair_value_uint64_array(sp, &nv, &nc) == 0);
+			if (nc != ARRAY_SIZE(d))
+				continue;
+			ov = NULL;
+			if (oldnvc != NULL && nvlist_lookup_uint64_array(
+			    oldnvc, nvpair_name(sp), &ov, &oc) == 0 &&
+			    oc != nc)
+				ov = NULL;
+
+			for (i = 0; i < nc; i++)
+				d[i] = nv[i] - (ov != NULL ? ov[i] : 0);
+			if (d[ZIO_STAGE_HISTO_COUNT] == 0)
+				continue;
+
+			if (cb->cb_scripted) {
+				(void) printf("%s\t%s\t%s\t%s", name, class,
+				    prio, nvpair_name(sp));
+			} else {
+				(void) printf("%-*s  %-6s %-12s %-18s",
+				    cb->cb_namewidth, name, class, prio,
+				    nvpair_name(sp));
+			}
+			print_one_stat(d[ZIO_STAGE_HISTO_COUNT], nformat, 5,
+			    cb->cb_scripted);
+			print_one_stat(d[ZIO_STAGE_HISTO_TIME] /
+			    d[ZIO_STAGE_HISTO_COUNT], tformat, 5,
+			    cb->cb_scripted);
+			print_one_stat(single_histo_percentile(
+			    &d[ZIO_STAGE_HISTO_BUCKETS], VDEV_L_HISTO_BUCKETS,
+			    d[ZIO_STAGE_HISTO_COUNT], 50), tformat, 5,
+			    cb->cb_scripted);
+			print_one_stat(single_histo_percentile(
+			    &d[ZIO_STAGE_HISTO_BUCKETS], VDEV_L_HISTO_BUCKETS,
+			    d[ZIO_STAGE_HISTO_COUNT], 99), tformat, 5,
+			    cb->cb_scripted);
+			(void) printf("\n");
+		}
+	}
+
+	if (!cb->cb_scripted)
+		(void) printf("\n");
+
+	return (0);
+}
+
 /*
  * Callback to print out the iostats for the given pool.
  */
@@ -4231,7 +4455,7 @@ fsleep(float sec) {
 
 
 /*
- * zpool iostat [-ghHLpPvy] [[-lq]|[-r|-w]] [-n name] [-T d|u]
+ * zpool iostat [-ghHLpPvy] [[-lq]|[-r|-w]|-s] [-n name] [-T d|u]
  *		[[ pool ...]|[pool vdev ...]|[vdev ...]]
  *		[interval [count]]
  *
@@ -4247,6 +4471,7 @@ fsleep(float sec) {
  *	-q	Display queue depths
  *	-w	Display latency histograms
  *	-r	Display request size histogram
+ *	-s	Display zio pipeline stage latencies
  *	-T	Display a timestamp in date(1) or Unix format
  *
  * This command can be tricky because we want to be able to deal with pool
@@ -4267,6 +4492,7 @@ zpool_do_iostat(int argc, char **argv)
 	boolean_t verbose = B_FALSE;
 	boolean_t latency = B_FALSE, l_histo = B_FALSE, rq_histo = B_FALSE;
 	boolean_t queues = B_FALSE, parsable = B_FALSE, scripted = B_FALSE;
+	boolean_t stages = B_FALSE;
 	boolean_t omit_since_boot = B_FALSE;
 	boolean_t guid = B_FALSE;
 	boolean_t follow_links = B_FALSE;
@@ -4280,7 +4506,7 @@ zpool_do_iostat(int argc, char **argv)
 	uint64_t unsupported_flags;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "gLPT:vyhplqrwH")) != -1) {
+	while ((c = getopt(argc, argv, "gLPT:vyhplqrswH")) != -1) {
 		switch (c) {
 		case 'g':
 			guid = B_TRUE;
@@ -4315,6 +4541,9 @@ zpool_do_iostat(int argc, char **argv)
 		case 'r':
 			rq_histo = B_TRUE;
 			break;
+		case 's':
+			stages = B_TRUE;
+			break;
 		case 'y':
 			omit_since_boot = B_TRUE;
 			break;
@@ -4430,6 +4659,16 @@ zpool_do_iostat(int argc, char **argv)
 		return (1);
 	}
 
+	if (stages && (l_histo || rq_histo || queues || latency || verbose ||
+	    cb.cb_vdev_names_count != 0)) {
+		pool_list_free(list);
+		(void) fprintf(stderr,
+		    gettext("-s can't be combined with vdevs or "
+		    "[-lqrvw]\n"));
+		usage(B_FALSE);
+		return (1);
+	}
+
 	/*
 	 * Enter the main iostat loop.
 	 */
@@ -4516,7 +4755,7 @@ zpool_do_iostat(int argc, char **argv)
 			if (((++cb.cb_iteration == 1 && !skip) ||
 			    (skip != verbose)) &&
 			    (!(cb.cb_flags & IOS_ANYHISTO_M)) &&
-			    !cb.cb_scripted)
+			    !cb.cb_scripted && !stages)
 				print_iostat_header(&cb);
 
 			if (skip) {
@@ -4524,7 +4763,8 @@ zpool_do_iostat(int argc, char **argv)
 				continue;
 			}
 
-			pool_list_iter(list, B_FALSE, print_iostat, &cb);
+			pool_list_iter(list, B_FALSE,
+			    stages ? print_iostat_stages : print_iostat, &cb);
 
 			/*
 			 * If there's more than one pool, and we're not in
@@ -4538,7 +4778,7 @@ zpool_do_iostat(int argc, char **argv)
 			    !(cb.cb_flags & IOS_ANYHISTO_M)) ||
 			    (!(cb.cb_flags & IOS_ANYHISTO_M) &&
 			    cb.cb_vdev_names_count)) &&
-			    !cb.cb_scripted) {
+			    !cb.cb_scripted && !stages) {
 				print_iostat_separator(&cb);
 			}
 		}
@@ -4745,6 +4985,7 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 	boolean_t scripted = cb->cb_scripted;
 	uint64_t islog = B_FALSE;
 	boolean_t haslog = B_FALSE;
+	boolean_t hasspecial = B_FALSE;
 	char *dashes = "%-*s      -      -      -         -      -      -\n";
 
 	verify(nvlist_lookup_uint64_array(nv, ZPOOL_CONFIG_VDEV_STATS,
@@ -4807,12 +5048,31 @@ print_list_stats(zpool_handle_t *zhp, const char *name, nvlist_t *nv,
 			continue;
 		}
 
+		if (vdev_is_special(child[c])) {
+			hasspecial = B_TRUE;
+			continue;
+		}
+
 		vname = zpool_vdev_name(g_zfs, zhp, child[c],
 		    cb->cb_name_flags);
 		print_list_stats(zhp, vname, child[c], cb, depth + 2);
 		free(vname);
 	}
 
+	if (hasspecial == B_TRUE) {
+		/* LINTED E_SEC_PRINTF_VAR_FMT */
+		(void) printf(dashes, cb->cb_namewidth,
+		    VDEV_ALLOC_BIAS_SPECIAL);
+		for (c = 0; c < children; c++) {
+			if (!vdev_is_special(child[c]))
+				continue;
+			vname = zpool_vdev_name(g_zfs, zhp, child[c],
+			    cb->cb_name_flags);
+			print_list_stats(zhp, vname, child[c], cb, depth + 2);
+			free(vname);
+		}
+	}
+
 	if (haslog == B_TRUE) {
 		/* LINTED E_SEC_PRINTF_VAR_FMT */
 		(void) printf(dashes, cb->cb_namewidth, "log");
@@ -5323,8 +5583,8 @@ zpool_do_split(int argc, char **argv)
 		if (flags.dryrun) {
 			(void) printf(gettext("would create '%s' with the "
 			    "following layout:\n\n"), newpool);
-			print_vdev_tree(NULL, newpool, config, 0, B_FALSE,
-			    flags.name_flags);
+			print_vdev_tree(NULL, newpool, config, 0,
+			    VDEV_CLASS_NORMAL, flags.name_flags);
 		}
 	}
 
@@ -5903,6 +6163,138 @@ zpool_do_initialize(int argc, char **argv)
 	return (err);
 }
 
+/*
+ * zpool trim [-d] [-r <rate>] [-c | -s] <pool> [<vdev> ...]
+ * TRIM all unused blocks in the specified vdevs, or all vdevs in the pool
+ * if none specified.
+ *
+ *	-d	Secure discard. Fails when the device lacks secure erase.
+ *	-r	Limit the TRIM to the given rate in bytes per second.
+ *	-c	Cancel. Ends an active TRIM.
+ *	-s	Suspend. TRIM can then be restarted with no flags.
+ */
+int
+zpool_do_trim(int argc, char **argv)
+{
+	int c;
+	char *poolname;
+	zpool_handle_t *zhp;
+	nvlist_t *vdevs;
+	int err = 0;
+
+	struct option long_options[] = {
+		{"cancel",	no_argument,		NULL, 'c'},
+		{"secure",	no_argument,		NULL, 'd'},
+		{"rate",	required_argument,	NULL, 'r'},
+		{"suspend",	no_argument,		NULL, 's'},
+		{0, 0, 0, 0}
+	};
+
+	pool_trim_func_t cmd_type = POOL_TRIM_START;
+	uint64_t rate = 0;
+	boolean_t secure = B_FALSE;
+
+	while ((c = getopt_long(argc, argv, ":cdr:s", long_options,
+	    NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			if (cmd_type != POOL_TRIM_START &&
+			    cmd_type != POOL_TRIM_CANCEL) {
+				(void) fprintf(stderr, gettext("-c cannot be "
+				    "combined with other options\n"));
+				usage(B_FALSE);
+			}
+			cmd_type = POOL_TRIM_CANCEL;
+			break;
+		case 'd':
+			if (cmd_type != POOL_TRIM_START) {
+				(void) fprintf(stderr, gettext("-d cannot be "
+				    "combined with the -c or -s options\n"));
+				usage(B_FALSE);
+			}
+			secure = B_TRUE;
+			break;
+		case 'r':
+			if (cmd_type != POOL_TRIM_START) {
+				(void) fprintf(stderr, gettext("-r cannot be "
+				    "combined with the -c or -s options\n"));
+				usage(B_FALSE);
+			}
+			if (zfs_nicestrtonum(NULL, optarg, &rate) == -1) {
+				(void) fprintf(stderr,
+				    gettext("invalid value for rate\n"));
+				usage(B_FALSE);
+			}
+			break;
+		case 's':
+			if (cmd_type != POOL_TRIM_START &&
+			    cmd_type != POOL_TRIM_SUSPEND) {
+				(void) fprintf(stderr, gettext("-s cannot be "
+				    "combined with other options\n"));
+				usage(B_FALSE);
+			}
+			cmd_type = POOL_TRIM_SUSPEND;
+			break;
+		case ':':
+			(void) fprintf(stderr, gettext("missing argument for "
+			    "'%c' option\n"), optopt);
+			usage(B_FALSE);
+			break;
+		case '?':
+			if (optopt != 0) {
+				(void) fprintf(stderr,
+				    gettext("invalid option '%c'\n"), optopt);
+			} else {
+				(void) fprintf(stderr,
+				    gettext("invalid option '%s'\n"),
+				    argv[optind - 1]);
+			}
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool name argument\n"));
+		usage(B_FALSE);
+		return (-1);
+	}
+
+	if ((secure || rate != 0) && cmd_type != POOL_TRIM_START) {
+		(void) fprintf(stderr, gettext("-d and -r cannot be "
+		    "combined with the -c or -s options\n"));
+		usage(B_FALSE);
+	}
+
+	poolname = argv[0];
+	zhp = zpool_open(g_zfs, poolname);
+	if (zhp == NULL)
+		return (-1);
+
+	vdevs = fnvlist_alloc();
+	if (argc == 1) {
+		/* no individual leaf vdevs specified, so add them all */
+		nvlist_t *config = zpool_get_config(zhp, NULL);
+		nvlist_t *nvroot = fnvlist_lookup_nvlist(config,
+		    ZPOOL_CONFIG_VDEV_TREE);
+		zpool_collect_leaves(zhp, nvroot, vdevs);
+	} else {
+		int i;
+		for (i = 1; i < argc; i++) {
+			fnvlist_add_boolean(vdevs, argv[i]);
+		}
+	}
+
+	err = zpool_trim(zhp, cmd_type, vdevs, rate, secure);
+
+	fnvlist_free(vdevs);
+	zpool_close(zhp);
+
+	return (err);
+}
+
 typedef struct status_cbdata {
 	int		cb_count;
 	int		cb_name_flags;
@@ -5922,10 +6314,11 @@ print_scan_status(pool_scan_stat_t *ps)
 {
 	time_t start, end, pause;
 	uint64_t elapsed, mins_left, hours_left;
-	uint64_t pass_exam, examined, total;
-	uint_t rate;
+	uint64_t pass_exam, pass_issued, examined, issued, total;
+	uint64_t scan_rate, issue_rate;
 	double fraction_done;
-	char processed_buf[7], examined_buf[7], total_buf[7], rate_buf[7];
+	char processed_buf[7], examined_buf[7], issued_buf[7], total_buf[7];
+	char srate_buf[7], irate_buf[7];
 
 	(void) printf(gettext("  scan: "));
 
@@ -5997,50 +6390,65 @@ print_scan_status(pool_scan_stat_t *ps)
 		    ctime(&start));
 	}
 
-	examined = ps->pss_examined ? ps->pss_examined : 1;
+	/*
+	 * Blocks are first scanned (gathered into sorted queues) and read
+	 * later, so progress and time left are based on the issued bytes.
+	 */
+	examined = ps->pss_examined;
+	issued = ps->pss_issued;
 	total = ps->pss_to_examine;
-	fraction_done = (double)examined / total;
+	fraction_done = (double)issued / (total ? total : 1);
 
 	/* elapsed time for this pass */
 	elapsed = time(NULL) - ps->pss_pass_start;
 	elapsed -= ps->pss_pass_scrub_spent_paused;
 	elapsed = elapsed ? elapsed : 1;
-	pass_exam = ps->pss_pass_exam ? ps->pss_pass_exam : 1;
-	rate = pass_exam / elapsed;
-	rate = rate ? rate : 1;
-	mins_left = ((total - examined) / rate) / 60;
+	pass_exam = ps->pss_pass_exam;
+	pass_issued = ps->pss_pass_issued;
+	scan_rate = pass_exam / elapsed;
+	issue_rate = pass_issued / elapsed;
+	mins_left = (issue_rate != 0 && total >= issued) ?
+	    ((total - issued) / issue_rate) / 60 : UINT64_MAX;
 	hours_left = mins_left / 60;
 
 	zfs_nicenum(examined, examined_buf, sizeof (examined_buf));
+	zfs_nicenum(issued, issued_buf, sizeof (issued_buf));
 	zfs_nicenum(total, total_buf, sizeof (total_buf));
+	zfs_nicenum(scan_rate, srate_buf, sizeof (srate_buf));
+	zfs_nicenum(issue_rate, irate_buf, sizeof (irate_buf));
 
 	/*
 	 * do not print estimated time if hours_left is more than 30 days
 	 * or we have a paused scrub
 	 */
 	if (pause == 0) {
-		zfs_nicenum(rate, rate_buf, sizeof (rate_buf));
-		(void) printf(gettext("\t%s scanned out of %s at %s/s"),
-		    examined_buf, total_buf, rate_buf);
-		if (hours_left < (30 * 24)) {
-			(void) printf(gettext(", %lluh%um to go\n"),
-			    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
-		} else {
-			(void) printf(gettext(
-			    ", (scan is slow, no estimated time)\n"));
-		}
+		(void) printf(gettext("	%s scanned at %s/s, "
+		    "%s issued at %s/s, %s total\n"),
+		    examined_buf, srate_buf, issued_buf, irate_buf, total_buf);
 	} else {
-		(void) printf(gettext("\t%s scanned out of %s\n"),
-		    examined_buf, total_buf);
+		(void) printf(gettext("	%s scanned, %s issued, %s total\n"),
+		    examined_buf, issued_buf, total_buf);
 	}
 
 	if (ps->pss_func == POOL_SCAN_RESILVER) {
-		(void) printf(gettext("    %s resilvered, %.2f%% done\n"),
+		(void) printf(gettext("\t%s resilvered, %.2f%% done"),
 		    processed_buf, 100 * fraction_done);
 	} else if (ps->pss_func == POOL_SCAN_SCRUB) {
-		(void) printf(gettext("    %s repaired, %.2f%% done\n"),
+		(void) printf(gettext("\t%s repaired, %.2f%% done"),
 		    processed_buf, 100 * fraction_done);
 	}
+
+	if (pause == 0) {
+		if (hours_left < (30 * 24)) {
+			(void) printf(gettext(", %lluh%um to go\n"),
+			    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
+		} else {
+			(void) printf(gettext(
+			    ", no estimated completion time\n"));
+		}
+	} else {
+		(void) printf(gettext("\n"));
+	}
 }
 
 /*
@@ -6652,9 +7060,12 @@ status_callback(zpool_handle_t *zhp, void *data)
 		print_status_config(zhp, zpool_get_name(zhp), nvroot,
 		    namewidth, 0, B_FALSE, cbp->cb_name_flags);
 
+		if (num_special(nvroot) > 0)
+			print_logs(zhp, nvroot, namewidth, B_TRUE,
+			    cbp->cb_name_flags, VDEV_CLASS_SPECIAL);
 		if (num_logs(nvroot) > 0)
 			print_logs(zhp, nvroot, namewidth, B_TRUE,
-			    cbp->cb_name_flags);
+			    cbp->cb_name_flags, VDEV_CLASS_LOG);
 		if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_L2CACHE,
 		    &l2cache, &nl2cache) == 0)
 			print_l2cache(zhp, l2cache, nl2cache, namewidth,
@@ -28,6 +28,7 @@
 #include <libintl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <ctype.h>
 
@@ -86,6 +87,40 @@ num_logs(nvlist_t *nv)
 	return (nlogs);
 }
 
+/*
+ * Return B_TRUE if the supplied top-level vdev belongs to the special
+ * allocation class
+ */
+boolean_t
+vdev_is_special(nvlist_t *nv)
+{
+	char *bias;
+
+	return (nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+	    &bias) == 0 && strcmp(bias, VDEV_ALLOC_BIAS_SPECIAL) == 0);
+}
+
+/*
+ * Return the number of special allocation class vdevs in supplied nvlist
+ */
+uint_t
+num_special(nvlist_t *nv)
+{
+	uint_t nspecial = 0;
+	uint_t c, children;
+	nvlist_t **child;
+
+	if (nvlist_lookup_nvlist_array(nv, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (0);
+
+	for (c = 0; c < children; c++) {
+		if (vdev_is_special(child[c]))
+			nspecial++;
+	}
+	return (nspecial);
+}
+
 /* Find the max element in an array of uint64_t values */
 uint64_t
 array64_max(uint64_t array[], unsigned int len) {
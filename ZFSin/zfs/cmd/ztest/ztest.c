@@ -166,6 +166,7 @@ typedef struct ztest_shared_opts {
 	uint64_t zo_time;
 	uint64_t zo_maxloops;
 	uint64_t zo_metaslab_force_ganging;
+	char zo_benchmark[MAXNAMELEN];
 } ztest_shared_opts_t;
 
 static const ztest_shared_opts_t ztest_opts_defaults = {
@@ -187,7 +188,8 @@ static const ztest_shared_opts_t ztest_opts_defaults = {
 	.zo_init = 1,
 	.zo_time = 300,			/* 5 minutes */
 	.zo_maxloops = 50,		/* max loops during spa_freeze() */
-	.zo_metaslab_force_ganging = 32 << 10
+	.zo_metaslab_force_ganging = 32 << 10,
+	.zo_benchmark = { '\0' }
 };
 
 extern uint64_t metaslab_force_ganging;
@@ -654,6 +656,8 @@ usage(boolean_t requested)
 	    "\t[-F freezeloops (default: %llu)] max loops in spa_freeze()\n"
 	    "\t[-P passtime (default: %llu sec)] time per pass\n"
 	    "\t[-B alt_ztest (default: <none>)] alternate ztest path\n"
+	    "\t[-b benchmark] run a benchmark instead of the tests;\n"
+	    "\t    -b ? lists them\n"
 	    "\t[-o variable=value] ... set global variable to an unsigned\n"
 	    "\t    32-bit integer value\n"
 	    "\t[-h] (print help)\n"
@@ -691,7 +695,7 @@ process_options(int argc, char **argv)
 	bcopy(&ztest_opts_defaults, zo, sizeof (*zo));
 
 	while ((opt = getopt(argc, argv,
-	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:hF:B:o:"
+	    "v:s:a:m:r:R:d:t:g:i:k:p:f:VET:P:hF:B:b:o:"
 	    )) != EOF) {
 		value = 0;
 		switch (opt) {
@@ -779,6 +783,10 @@ process_options(int argc, char **argv)
 		case 'B':
 			(void) strlcpy(altdir, optarg, sizeof (altdir));
 			break;
+		case 'b':
+			(void) strlcpy(zo->zo_benchmark, optarg,
+			    sizeof (zo->zo_benchmark));
+			break;
 		case 'o':
 			if (set_global_var(optarg) != 0)
 				usage(B_FALSE);
@@ -5473,8 +5481,8 @@ ztest_fault_inject(ztest_ds_t *zd, uint64_t id)
 			    (long long)vd0->vdev_id, (int)maxfaults);
 
 			if (vf != NULL && ztest_random(3) == 0) {
-				(void) close(vf->vf_vnode->v_fd);
-				vf->vf_vnode->v_fd = -1;
+				(void) CloseHandle(vf->vf_handle);
+				vf->vf_handle = NULL;
 			} else if (ztest_random(2) == 0) {
 				vd0->vdev_cant_read = B_TRUE;
 			} else {
@@ -6754,6 +6762,798 @@ ztest_init(ztest_shared_t *zs)
 	mutex_destroy(&ztest_checkpoint_lock);
 }
 
+/*
+ * Benchmarks, selected with -b. Each one runs in this process against a
+ * freshly created pool laid out by the usual -v/-s/-m/-r options, prints
+ * its results and exits instead of running the tests.
+ */
+typedef int ztest_bench_func_t(spa_t *spa);
+
+typedef struct ztest_bench {
+	const char		*zb_name;
+	ztest_bench_func_t	*zb_func;
+	const char		*zb_desc;
+} ztest_bench_t;
+
+/*
+ * vdev_io: keep -t random reads outstanding against the first leaf vdev,
+ * first 4K and then 128K, each for -P seconds. The reads go straight to
+ * the vdev, bypassing the ARC, so this measures the leaf's backend and
+ * the vdev queue. Nothing is written, so the pool is left intact.
+ */
+typedef struct ztest_bench_io {
+	kmutex_t	zbi_lock;
+	kcondvar_t	zbi_cv;
+	vdev_t		*zbi_vd;
+	uint64_t	zbi_size;	/* bytes per read */
+	uint64_t	zbi_span;	/* offsets past the front labels */
+	uint64_t	zbi_seed;
+	hrtime_t	zbi_stop;
+	uint64_t	zbi_inflight;
+	uint64_t	zbi_done;
+	uint64_t	zbi_errors;
+} ztest_bench_io_t;
+
+/*
+ * ztest_random() reads /dev/urandom, which is too slow to sit in the
+ * issue path; a xorshift generator is plenty for picking offsets.
+ */
+static uint64_t
+ztest_bench_io_offset(ztest_bench_io_t *zbi)
+{
+	uint64_t x = zbi->zbi_seed;
+
+	ASSERT(MUTEX_HELD(&zbi->zbi_lock));
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	zbi->zbi_seed = x;
+
+	return (VDEV_LABEL_START_SIZE +
+	    P2ALIGN(x % (zbi->zbi_span - zbi->zbi_size), zbi->zbi_size));
+}
+
+static void ztest_bench_io_done(zio_t *zio);
+
+static void
+ztest_bench_io_issue(ztest_bench_io_t *zbi, uint64_t offset)
+{
+	zio_nowait(zio_read_phys(NULL, zbi->zbi_vd, offset, zbi->zbi_size,
+	    abd_alloc_for_io(zbi->zbi_size, B_FALSE), ZIO_CHECKSUM_OFF,
+	    ztest_bench_io_done, zbi, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_RETRY, B_FALSE));
+}
+
+/*
+ * Each completion issues the next read until time is up, so the queue
+ * depth stays at -t for the whole run. A failed read is not replaced.
+ */
+static void
+ztest_bench_io_done(zio_t *zio)
+{
+	ztest_bench_io_t *zbi = zio->io_private;
+	uint64_t offset;
+
+	abd_free(zio->io_abd);
+
+	mutex_enter(&zbi->zbi_lock);
+	zbi->zbi_done++;
+	if (zio->io_error != 0) {
+		zbi->zbi_errors++;
+	} else if (gethrtime() < zbi->zbi_stop) {
+		offset = ztest_bench_io_offset(zbi);
+		mutex_exit(&zbi->zbi_lock);
+		ztest_bench_io_issue(zbi, offset);
+		return;
+	}
+	zbi->zbi_inflight--;
+	cv_broadcast(&zbi->zbi_cv);
+	mutex_exit(&zbi->zbi_lock);
+}
+
+static int
+ztest_bench_vdev_io(spa_t *spa)
+{
+	static const uint64_t sizes[] = { 4096, 128 << 10 };
+	vdev_t *vd;
+	int error = 0;
+
+	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+
+	for (vd = spa->spa_root_vdev; vd->vdev_children != 0; )
+		vd = vd->vdev_child[0];
+
+	(void) printf("vdev_io: %s, %d outstanding, %llu sec per size\n",
+	    vd->vdev_path, ztest_opts.zo_threads,
+	    (u_longlong_t)ztest_opts.zo_passtime);
+
+	for (int i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+		ztest_bench_io_t zbi = { 0 };
+		char nice_size[10], nice_bw[10];
+		hrtime_t start, elapsed;
+		uint64_t offset;
+
+		mutex_init(&zbi.zbi_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&zbi.zbi_cv, NULL, CV_DEFAULT, NULL);
+		zbi.zbi_vd = vd;
+		zbi.zbi_size = sizes[i];
+		zbi.zbi_span = vd->vdev_psize - VDEV_LABEL_START_SIZE -
+		    VDEV_LABEL_END_SIZE;
+		zbi.zbi_seed = gethrtime() | 1;
+
+		start = gethrtime();
+		zbi.zbi_stop = start + ztest_opts.zo_passtime * NANOSEC;
+
+		mutex_enter(&zbi.zbi_lock);
+		zbi.zbi_inflight = ztest_opts.zo_threads;
+		for (int t = 0; t < ztest_opts.zo_threads; t++) {
+			offset = ztest_bench_io_offset(&zbi);
+			mutex_exit(&zbi.zbi_lock);
+			ztest_bench_io_issue(&zbi, offset);
+			mutex_enter(&zbi.zbi_lock);
+		}
+		while (zbi.zbi_inflight != 0)
+			cv_wait(&zbi.zbi_cv, &zbi.zbi_lock);
+		mutex_exit(&zbi.zbi_lock);
+
+		elapsed = MAX(gethrtime() - start, 1);
+
+		nicenum(zbi.zbi_size, nice_size);
+		nicenum(zbi.zbi_done * zbi.zbi_size * NANOSEC / elapsed,
+		    nice_bw);
+		(void) printf("%6s random read: %llu IOPS, %s/s, "
+		    "%llu errors\n", nice_size,
+		    (u_longlong_t)(zbi.zbi_done * NANOSEC / elapsed),
+		    nice_bw, (u_longlong_t)zbi.zbi_errors);
+
+		if (zbi.zbi_errors != 0)
+			error = SET_ERROR(EIO);
+
+		cv_destroy(&zbi.zbi_cv);
+		mutex_destroy(&zbi.zbi_lock);
+	}
+
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	return (error);
+}
+
+/*
+ * vdev_agg: read 256M from the first leaf vdev as batches of 128 adjacent
+ * 8K reads, which the vdev queue merges into 128K aggregates, once with
+ * the aggregates copied into their own buffer and once with gang ABDs
+ * (zfs_vdev_aggregate_gang). Reports throughput, the bytes the queue
+ * copied and the process CPU time per gigabyte read for each.
+ */
+#define	ZTEST_BENCH_AGG_SIZE	(8 << 10)
+#define	ZTEST_BENCH_AGG_BATCH	128
+#define	ZTEST_BENCH_AGG_TOTAL	(256ULL << 20)
+
+static hrtime_t
+ztest_bench_cputime(void)
+{
+	FILETIME create, exit, kernel, user;
+	ULARGE_INTEGER k, u;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &create, &exit,
+	    &kernel, &user))
+		return (0);
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+
+	/* FILETIME counts 100ns units */
+	return ((hrtime_t)(k.QuadPart + u.QuadPart) * 100);
+}
+
+static void
+ztest_bench_agg_done(zio_t *zio)
+{
+	abd_free(zio->io_abd);
+}
+
+static int
+ztest_bench_vdev_agg(spa_t *spa)
+{
+	int saved = zfs_vdev_aggregate_gang;
+	uint64_t batch = ZTEST_BENCH_AGG_SIZE * ZTEST_BENCH_AGG_BATCH;
+	uint64_t span, seed;
+	vdev_t *vd;
+	int error = 0;
+
+	spa_config_enter(spa, SCL_STATE, FTAG, RW_READER);
+
+	for (vd = spa->spa_root_vdev; vd->vdev_children != 0; )
+		vd = vd->vdev_child[0];
+	span = vd->vdev_psize - VDEV_LABEL_START_SIZE - VDEV_LABEL_END_SIZE;
+
+	(void) printf("vdev_agg: %s, %d x %dK reads per batch\n",
+	    vd->vdev_path, ZTEST_BENCH_AGG_BATCH, ZTEST_BENCH_AGG_SIZE >> 10);
+
+	for (int gang = 0; gang <= 1 && error == 0; gang++) {
+		uint64_t copied, ios, gangs;
+		hrtime_t start, cpu, elapsed;
+		char nice_bw[10], nice_copied[10];
+
+		zfs_vdev_aggregate_gang = gang;
+		seed = gethrtime() | 1;
+		copied = vdev_queue_stats.vqs_agg_copied_bytes.value.ui64;
+		ios = vdev_queue_stats.vqs_agg_ios.value.ui64;
+		gangs = vdev_queue_stats.vqs_agg_gang_ios.value.ui64;
+		cpu = ztest_bench_cputime();
+		start = gethrtime();
+
+		for (uint64_t done = 0; done < ZTEST_BENCH_AGG_TOTAL &&
+		    error == 0; done += batch) {
+			zio_t *rio = zio_root(spa, NULL, NULL,
+			    ZIO_FLAG_CANFAIL);
+			uint64_t offset;
+
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			offset = VDEV_LABEL_START_SIZE +
+			    P2ALIGN(seed % (span - batch), batch);
+
+			for (int i = 0; i < ZTEST_BENCH_AGG_BATCH; i++) {
+				zio_nowait(zio_read_phys(rio, vd,
+				    offset + i * ZTEST_BENCH_AGG_SIZE,
+				    ZTEST_BENCH_AGG_SIZE,
+				    abd_alloc_for_io(ZTEST_BENCH_AGG_SIZE,
+				    B_FALSE), ZIO_CHECKSUM_OFF,
+				    ztest_bench_agg_done, NULL,
+				    ZIO_PRIORITY_ASYNC_READ,
+				    ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_RETRY,
+				    B_FALSE));
+			}
+			error = zio_wait(rio);
+		}
+
+		elapsed = MAX(gethrtime() - start, 1);
+		cpu = ztest_bench_cputime() - cpu;
+		copied = vdev_queue_stats.vqs_agg_copied_bytes.value.ui64 -
+		    copied;
+		ios = vdev_queue_stats.vqs_agg_ios.value.ui64 - ios;
+		gangs = vdev_queue_stats.vqs_agg_gang_ios.value.ui64 - gangs;
+
+		nicenum(ZTEST_BENCH_AGG_TOTAL * NANOSEC / elapsed, nice_bw);
+		nicenum(copied * (1ULL << 30) / ZTEST_BENCH_AGG_TOTAL,
+		    nice_copied);
+		(void) printf("%s: %s/s, %llu aggregates (%llu gang), "
+		    "%s copied and %llu ms CPU per GB\n",
+		    gang ? "  gang" : "  copy", nice_bw, (u_longlong_t)ios,
+		    (u_longlong_t)gangs, nice_copied,
+		    (u_longlong_t)(cpu / MICROSEC *
+		    (1ULL << 30) / ZTEST_BENCH_AGG_TOTAL));
+	}
+
+	zfs_vdev_aggregate_gang = saved;
+	spa_config_exit(spa, SCL_STATE, FTAG);
+
+	return (error);
+}
+
+/*
+ * Thread scaling benchmarks: run func on 1, 2, 4, ... up to -t threads
+ * against a scratch dataset, each pass for -P seconds, and report the
+ * operations per second of each pass relative to a single thread.  If
+ * given, setup is called once on the scratch dataset before the first
+ * pass, and arg is handed to every thread as zbt_arg.
+ */
+typedef struct ztest_bench_thr {
+	objset_t	*zbt_os;
+	void		*zbt_arg;
+	hrtime_t	zbt_stop;
+	uint64_t	zbt_ops;
+	uint64_t	zbt_errors;
+} ztest_bench_thr_t;
+
+typedef void ztest_bench_setup_t(objset_t *os, void *arg);
+
+static int
+ztest_bench_scale(spa_t *spa, const char *bench, ztest_bench_setup_t *setup,
+    thread_func_t func, void *arg, const char *what)
+{
+	char name[ZFS_MAX_DATASET_NAME_LEN];
+	kt_did_t *tid;
+	objset_t *os;
+	uint64_t base = 0;
+	int error = 0;
+
+	(void) snprintf(name, sizeof (name), "%s/%s", spa_name(spa), bench);
+	VERIFY0(dmu_objset_create(name, DMU_OST_OTHER, 0, NULL, NULL, NULL));
+	VERIFY0(dmu_objset_own(name, DMU_OST_OTHER, B_FALSE, B_TRUE, FTAG,
+	    &os));
+	VERIFY3P(zil_open(os, NULL), ==, dmu_objset_zil(os));
+
+	if (setup != NULL)
+		setup(os, arg);
+
+	tid = umem_zalloc(ztest_opts.zo_threads * sizeof (kt_did_t),
+	    UMEM_NOFAIL);
+
+	for (int threads = 1; threads <= ztest_opts.zo_threads &&
+	    error == 0; threads <<= 1) {
+		ztest_bench_thr_t zbt = { 0 };
+		hrtime_t start, elapsed;
+		uint64_t rate;
+
+		zbt.zbt_os = os;
+		zbt.zbt_arg = arg;
+		start = gethrtime();
+		zbt.zbt_stop = start + ztest_opts.zo_passtime * NANOSEC;
+
+		for (int t = 0; t < threads; t++) {
+			kthread_t *thread;
+
+			VERIFY3P(thread = zk_thread_create(NULL, 0, func,
+			    &zbt, TS_RUN, NULL, 0, 0,
+			    PTHREAD_CREATE_JOINABLE), !=, NULL);
+			tid[t] = thread->t_tid;
+		}
+		for (int t = 0; t < threads; t++)
+			thread_join(tid[t]);
+
+		elapsed = MAX(gethrtime() - start, 1);
+		rate = zbt.zbt_ops * NANOSEC / elapsed;
+		if (base == 0)
+			base = MAX(rate, 1);
+
+		(void) printf("%4d threads: %llu %s/s, %llu.%02llux "
+		    "of one thread\n", threads, (u_longlong_t)rate, what,
+		    (u_longlong_t)(rate / base),
+		    (u_longlong_t)(rate * 100 / base % 100));
+
+		if (zbt.zbt_errors != 0)
+			error = SET_ERROR(EIO);
+
+		/* don't let one pass's dirty data slow the next */
+		txg_wait_synced(spa_get_dsl(spa), 0);
+	}
+
+	umem_free(tid, ztest_opts.zo_threads * sizeof (kt_did_t));
+	zil_close(dmu_objset_zil(os));
+	dmu_objset_disown(os, B_TRUE, FTAG);
+
+	return (error);
+}
+
+/*
+ * obj_alloc: create empty objects, one per transaction. This exercises
+ * dmu_object_alloc() and its per-CPU chunks of object numbers
+ * (dmu_object_alloc_chunk_shift).
+ */
+static void
+ztest_bench_obj_alloc_thread(void *arg)
+{
+	ztest_bench_thr_t *zbt = arg;
+	uint64_t ops = 0;
+	dmu_tx_t *tx;
+
+	while (gethrtime() < zbt->zbt_stop) {
+		tx = dmu_tx_create(zbt->zbt_os);
+		dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+		if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+			dmu_tx_abort(tx);
+			atomic_add_64(&zbt->zbt_errors, 1);
+			break;
+		}
+		(void) dmu_object_alloc(zbt->zbt_os, DMU_OT_UINT64_OTHER, 0,
+		    DMU_OT_NONE, 0, tx);
+		dmu_tx_commit(tx);
+		ops++;
+	}
+
+	atomic_add_64(&zbt->zbt_ops, ops);
+	thread_exit();
+}
+
+static int
+ztest_bench_obj_alloc(spa_t *spa)
+{
+	(void) printf("obj_alloc: up to %d threads, %llu sec per pass, "
+	    "chunk shift %d\n", ztest_opts.zo_threads,
+	    (u_longlong_t)ztest_opts.zo_passtime,
+	    dmu_object_alloc_chunk_shift);
+
+	return (ztest_bench_scale(spa, "obj_alloc", NULL,
+	    ztest_bench_obj_alloc_thread, NULL, "creates"));
+}
+
+/*
+ * zil_assign: log TX_CREATE records, one per transaction, and commit the
+ * log after every ZTEST_BENCH_ZIL_BATCH of them, so the per-CPU itx
+ * lists are merged by zil_commit() while the other threads keep
+ * assigning.
+ */
+#define	ZTEST_BENCH_ZIL_BATCH	64
+
+static void
+ztest_bench_zil_assign_thread(void *arg)
+{
+	ztest_bench_thr_t *zbt = arg;
+	zilog_t *zilog = dmu_objset_zil(zbt->zbt_os);
+	uint64_t ops = 0;
+	lr_create_t *lr;
+	dmu_tx_t *tx;
+	itx_t *itx;
+
+	while (gethrtime() < zbt->zbt_stop) {
+		tx = dmu_tx_create(zbt->zbt_os);
+		if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+			dmu_tx_abort(tx);
+			atomic_add_64(&zbt->zbt_errors, 1);
+			break;
+		}
+		itx = zil_itx_create(TX_CREATE, sizeof (*lr));
+		lr = (lr_create_t *)&itx->itx_lr;
+		bzero((char *)lr + sizeof (lr_t), sizeof (*lr) - sizeof (lr_t));
+		lr->lr_foid = ops + 1;
+		zil_itx_assign(zilog, itx, tx);
+		dmu_tx_commit(tx);
+
+		if (++ops % ZTEST_BENCH_ZIL_BATCH == 0)
+			zil_commit(zilog, 0);
+	}
+
+	atomic_add_64(&zbt->zbt_ops, ops);
+	thread_exit();
+}
+
+static int
+ztest_bench_zil_assign(spa_t *spa)
+{
+	(void) printf("zil_assign: up to %d threads, %llu sec per pass, "
+	    "commit every %d records\n", ztest_opts.zo_threads,
+	    (u_longlong_t)ztest_opts.zo_passtime, ZTEST_BENCH_ZIL_BATCH);
+
+	return (ztest_bench_scale(spa, "zil_assign", NULL,
+	    ztest_bench_zil_assign_thread, NULL, "records"));
+}
+
+/*
+ * arc_hit: write ZTEST_BENCH_ARC_BLOCKS small blocks, then arc_read()
+ * random ones of them.  They all stay cached, so every read is an ARC
+ * hit and the rate is bounded by the hash table lookup and the header
+ * locking (zfs_arc_hash_lockless, zfs_arc_hash_locks_per_cpu).  The
+ * second run reads them twice first to move them to the MFU state, and
+ * then reads them without asking for a buf, as a prefetch would, which
+ * doesn't take the hash lock at all.
+ */
+#define	ZTEST_BENCH_ARC_BLOCKS		4096
+#define	ZTEST_BENCH_ARC_BLOCKSIZE	4096
+#define	ZTEST_BENCH_ARC_BATCH		64
+
+typedef struct ztest_bench_arc {
+	uint64_t	zba_objset;
+	uint64_t	zba_object;
+	boolean_t	zba_nobuf;
+	blkptr_t	zba_bp[ZTEST_BENCH_ARC_BLOCKS];
+} ztest_bench_arc_t;
+
+static void
+ztest_bench_arc_hit_setup(objset_t *os, void *arg)
+{
+	ztest_bench_arc_t *zba = arg;
+	uint64_t size = ZTEST_BENCH_ARC_BATCH * ZTEST_BENCH_ARC_BLOCKSIZE;
+	uint64_t *data = umem_alloc(size, UMEM_NOFAIL);
+	dmu_buf_t *db;
+	dmu_tx_t *tx;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	zba->zba_objset = dmu_objset_id(os);
+	zba->zba_object = dmu_object_alloc(os, DMU_OT_UINT64_OTHER,
+	    ZTEST_BENCH_ARC_BLOCKSIZE, DMU_OT_NONE, 0, tx);
+	dmu_tx_commit(tx);
+
+	for (int b = 0; b < ZTEST_BENCH_ARC_BLOCKS;
+	    b += ZTEST_BENCH_ARC_BATCH) {
+		uint64_t offset = (uint64_t)b * ZTEST_BENCH_ARC_BLOCKSIZE;
+
+		for (int i = 0; i < size / sizeof (uint64_t); i++)
+			data[i] = offset + i;
+
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, zba->zba_object, offset, size);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		dmu_write(os, zba->zba_object, offset, size, data, tx);
+		dmu_tx_commit(tx);
+	}
+	txg_wait_synced(dmu_objset_pool(os), 0);
+
+	for (int b = 0; b < ZTEST_BENCH_ARC_BLOCKS; b++) {
+		VERIFY0(dmu_buf_hold(os, zba->zba_object,
+		    (uint64_t)b * ZTEST_BENCH_ARC_BLOCKSIZE, FTAG, &db, 0));
+		zba->zba_bp[b] = *dmu_buf_get_blkptr(db);
+		dmu_buf_rele(db, FTAG);
+	}
+
+	/* a second access after ARC_MINTIME moves a header to the MFU */
+	for (int pass = 0; zba->zba_nobuf && pass < 2; pass++) {
+		(void) poll(NULL, 0, 100);
+		for (int b = 0; b < ZTEST_BENCH_ARC_BLOCKS; b++) {
+			arc_flags_t flags = ARC_FLAG_WAIT;
+			zbookmark_phys_t zb;
+			arc_buf_t *abuf;
+
+			SET_BOOKMARK(&zb, zba->zba_objset, zba->zba_object,
+			    0, b);
+			VERIFY0(arc_read(NULL, dmu_objset_spa(os),
+			    &zba->zba_bp[b], arc_getbuf_func, &abuf,
+			    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &flags,
+			    &zb));
+			arc_buf_destroy(abuf, &abuf);
+		}
+	}
+
+	umem_free(data, size);
+}
+
+static void
+ztest_bench_arc_hit_thread(void *arg)
+{
+	ztest_bench_thr_t *zbt = arg;
+	ztest_bench_arc_t *zba = zbt->zbt_arg;
+	spa_t *spa = dmu_objset_spa(zbt->zbt_os);
+	uint64_t seed = gethrtime() ^ (uintptr_t)&seed;
+	uint64_t ops = 0;
+
+	while (gethrtime() < zbt->zbt_stop) {
+		arc_flags_t flags = ARC_FLAG_WAIT;
+		zbookmark_phys_t zb;
+		arc_buf_t *abuf;
+		uint64_t b;
+
+		/* ztest_random() reads /dev/urandom, far too slow here */
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		b = (seed >> 33) % ZTEST_BENCH_ARC_BLOCKS;
+
+		SET_BOOKMARK(&zb, zba->zba_objset, zba->zba_object, 0, b);
+		if (zba->zba_nobuf) {
+			if (arc_read(NULL, spa, &zba->zba_bp[b], NULL, NULL,
+			    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &flags,
+			    &zb) != 0 || !(flags & ARC_FLAG_CACHED)) {
+				atomic_add_64(&zbt->zbt_errors, 1);
+				break;
+			}
+			ops++;
+			continue;
+		}
+		if (arc_read(NULL, spa, &zba->zba_bp[b], arc_getbuf_func,
+		    &abuf, ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &flags,
+		    &zb) != 0) {
+			atomic_add_64(&zbt->zbt_errors, 1);
+			break;
+		}
+		arc_buf_destroy(abuf, &abuf);
+		ops++;
+	}
+
+	atomic_add_64(&zbt->zbt_ops, ops);
+	thread_exit();
+}
+
+static int
+ztest_bench_arc_hit(spa_t *spa)
+{
+	ztest_bench_arc_t *zba;
+	int error;
+
+	(void) printf("arc_hit: up to %d threads, %llu sec per pass, "
+	    "%d cached %dK blocks, %s lookups\n", ztest_opts.zo_threads,
+	    (u_longlong_t)ztest_opts.zo_passtime, ZTEST_BENCH_ARC_BLOCKS,
+	    ZTEST_BENCH_ARC_BLOCKSIZE >> 10,
+	    zfs_arc_hash_lockless ? "lockless" : "locked");
+
+	zba = umem_zalloc(sizeof (*zba), UMEM_NOFAIL);
+	(void) printf("returning a buf:\n");
+	error = ztest_bench_scale(spa, "arc_hit", ztest_bench_arc_hit_setup,
+	    ztest_bench_arc_hit_thread, zba, "reads");
+	if (error == 0) {
+		(void) printf("returning no buf, MFU headers:\n");
+		zba->zba_nobuf = B_TRUE;
+		error = ztest_bench_scale(spa, "arc_hit_nobuf",
+		    ztest_bench_arc_hit_setup, ztest_bench_arc_hit_thread,
+		    zba, "reads");
+	}
+	umem_free(zba, sizeof (*zba));
+
+	return (error);
+}
+
+/*
+ * read_loan: write a ZTEST_BENCH_LOAN_OBJSIZE object and read it once so
+ * it is all cached, then read random ZTEST_BENCH_LOAN_READSIZE ranges of
+ * it, copied out with dmu_read() in the first run and lent with
+ * dmu_read_loan() in the second.  The loaned run only looks up its
+ * segments, as a consumer handing them straight to a device would.
+ */
+#define	ZTEST_BENCH_LOAN_OBJSIZE	(32ULL << 20)
+#define	ZTEST_BENCH_LOAN_READSIZE	(1ULL << 20)
+
+typedef struct ztest_bench_loan {
+	uint64_t	zbl_object;
+	boolean_t	zbl_loan;
+} ztest_bench_loan_t;
+
+static void
+ztest_bench_read_loan_setup(objset_t *os, void *arg)
+{
+	ztest_bench_loan_t *zbl = arg;
+	uint64_t size = ZTEST_BENCH_LOAN_READSIZE;
+	uint64_t *data = umem_alloc(size, UMEM_NOFAIL);
+	uint64_t offset;
+	dmu_tx_t *tx;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	zbl->zbl_object = dmu_object_alloc(os, DMU_OT_UINT64_OTHER,
+	    SPA_OLD_MAXBLOCKSIZE, DMU_OT_NONE, 0, tx);
+	dmu_tx_commit(tx);
+
+	for (offset = 0; offset < ZTEST_BENCH_LOAN_OBJSIZE; offset += size) {
+		for (int i = 0; i < size / sizeof (uint64_t); i++)
+			data[i] = offset + i;
+
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_write(tx, zbl->zbl_object, offset, size);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		dmu_write(os, zbl->zbl_object, offset, size, data, tx);
+		dmu_tx_commit(tx);
+	}
+	txg_wait_synced(dmu_objset_pool(os), 0);
+
+	for (offset = 0; offset < ZTEST_BENCH_LOAN_OBJSIZE; offset += size) {
+		VERIFY0(dmu_read(os, zbl->zbl_object, offset, size, data,
+		    DMU_READ_NO_PREFETCH));
+	}
+
+	umem_free(data, size);
+}
+
+static void
+ztest_bench_read_loan_thread(void *arg)
+{
+	ztest_bench_thr_t *zbt = arg;
+	ztest_bench_loan_t *zbl = zbt->zbt_arg;
+	uint64_t size = ZTEST_BENCH_LOAN_READSIZE;
+	uint64_t seed = gethrtime() ^ (uintptr_t)&seed;
+	uint64_t ops = 0;
+	void *buf = NULL;
+
+	if (!zbl->zbl_loan)
+		buf = umem_alloc(size, UMEM_NOFAIL);
+
+	while (gethrtime() < zbt->zbt_stop) {
+		uint64_t offset, len;
+		dmu_loan_t *loan;
+		int error;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		offset = (seed >> 33) % (ZTEST_BENCH_LOAN_OBJSIZE / size) *
+		    size;
+
+		if (zbl->zbl_loan) {
+			error = dmu_read_loan(zbt->zbt_os, zbl->zbl_object,
+			    offset, size, DMU_READ_NO_PREFETCH, NULL, NULL,
+			    &loan);
+			if (error == 0) {
+				for (int i = 0; i < loan->dl_numbufs; i++)
+					(void) dmu_loan_segment(loan, i, &len);
+				dmu_loan_return(loan);
+			}
+		} else {
+			error = dmu_read(zbt->zbt_os, zbl->zbl_object, offset,
+			    size, buf, DMU_READ_NO_PREFETCH);
+		}
+		if (error != 0) {
+			atomic_add_64(&zbt->zbt_errors, 1);
+			break;
+		}
+		ops++;
+	}
+
+	if (buf != NULL)
+		umem_free(buf, size);
+	atomic_add_64(&zbt->zbt_ops, ops);
+	thread_exit();
+}
+
+static int
+ztest_bench_read_loan(spa_t *spa)
+{
+	ztest_bench_loan_t zbl = { 0 };
+	int error;
+
+	(void) printf("read_loan: up to %d threads, %llu sec per pass, "
+	    "%lluM reads from a cached %lluM object\n",
+	    ztest_opts.zo_threads, (u_longlong_t)ztest_opts.zo_passtime,
+	    (u_longlong_t)(ZTEST_BENCH_LOAN_READSIZE >> 20),
+	    (u_longlong_t)(ZTEST_BENCH_LOAN_OBJSIZE >> 20));
+
+	(void) printf("copied with dmu_read():\n");
+	zbl.zbl_loan = B_FALSE;
+	error = ztest_bench_scale(spa, "read_copy",
+	    ztest_bench_read_loan_setup, ztest_bench_read_loan_thread, &zbl,
+	    "reads");
+	if (error != 0)
+		return (error);
+
+	(void) printf("lent with dmu_read_loan():\n");
+	zbl.zbl_loan = B_TRUE;
+	return (ztest_bench_scale(spa, "read_loan",
+	    ztest_bench_read_loan_setup, ztest_bench_read_loan_thread, &zbl,
+	    "reads"));
+}
+
+static ztest_bench_t ztest_bench[] = {
+	{ "vdev_io",	ztest_bench_vdev_io,
+	    "random 4K and 128K reads at queue depth -t on a leaf vdev" },
+	{ "vdev_agg",	ztest_bench_vdev_agg,
+	    "aggregated 8K reads, copied vs. gang ABDs" },
+	{ "obj_alloc",	ztest_bench_obj_alloc,
+	    "object create rate from 1 up to -t threads" },
+	{ "zil_assign",	ztest_bench_zil_assign,
+	    "intent log record rate from 1 up to -t threads" },
+	{ "arc_hit",	ztest_bench_arc_hit,
+	    "cached ARC read rate from 1 up to -t threads" },
+	{ "read_loan",	ztest_bench_read_loan,
+	    "cached 1M reads, copied vs. loaned ARC buffers" },
+};
+
+#define	ZTEST_BENCHMARKS	(sizeof (ztest_bench) / sizeof (ztest_bench_t))
+
+static int
+ztest_benchmark(const char *name)
+{
+	ztest_bench_t *zb = NULL;
+	nvlist_t *nvroot;
+	spa_t *spa;
+	int error;
+
+	for (int b = 0; b < ZTEST_BENCHMARKS; b++) {
+		if (strcmp(name, ztest_bench[b].zb_name) == 0)
+			zb = &ztest_bench[b];
+	}
+
+	if (zb == NULL) {
+		FILE *fp = strcmp(name, "?") == 0 ? stdout : stderr;
+
+		if (fp == stderr)
+			(void) fprintf(fp, "unknown benchmark '%s'\n", name);
+		(void) fprintf(fp, "benchmarks:\n");
+		for (int b = 0; b < ZTEST_BENCHMARKS; b++) {
+			(void) fprintf(fp, "\t%-12s %s\n",
+			    ztest_bench[b].zb_name, ztest_bench[b].zb_desc);
+		}
+		return (fp == stderr);
+	}
+
+	kernel_init(FREAD | FWRITE);
+
+	(void) spa_destroy(ztest_opts.zo_pool);
+	ztest_shared->zs_vdev_next_leaf = 0;
+	nvroot = make_vdev_root(NULL, NULL, NULL, ztest_opts.zo_vdev_size, 0,
+	    0, ztest_opts.zo_raidz, ztest_opts.zo_mirrors, 1);
+	VERIFY3U(0, ==,
+	    spa_create(ztest_opts.zo_pool, nvroot, NULL, NULL, NULL));
+	nvlist_free(nvroot);
+
+	VERIFY3U(0, ==, spa_open(ztest_opts.zo_pool, &spa, FTAG));
+	error = zb->zb_func(spa);
+	spa_close(spa, FTAG);
+
+	(void) spa_destroy(ztest_opts.zo_pool);
+	kernel_fini();
+
+	return (error != 0);
+}
+
 static void
 setup_data_fd(void)
 {
@@ -7016,6 +7816,9 @@ main(int argc, char **argv)
 		exit(0);
 	}
 
+	if (ztest_opts.zo_benchmark[0] != '\0')
+		exit(ztest_benchmark(ztest_opts.zo_benchmark));
+
 	hasalt = (strlen(ztest_opts.zo_alt_ztest) != 0);
 
 	if (ztest_opts.zo_verbose >= 1) {
@@ -35,6 +35,7 @@ typedef enum abd_flags {
 	ABD_FLAG_META	= 1 << 2,	/* does this represent FS metadata? */
 	ABD_FLAG_SMALL  = 1 << 3,       /* (APPLE) : abd_alloc() went linear for a sub-chunk size */
 	ABD_FLAG_NOMOVE = 1 << 4,       /* (APPLE) : abd_to_buf() called on this abd */
+	ABD_FLAG_GANG	= 1 << 5,	/* chunks borrowed from other ABDs */
 } abd_flags_t;
 
 typedef struct abd {
@@ -60,6 +61,14 @@ typedef struct abd {
 	} abd_u;
 } abd_t;
 
+/*
+ * A virtually contiguous piece of an ABD, see abd_borrow_segs().
+ */
+typedef struct abd_seg {
+	void		*as_base;
+	size_t		as_len;
+} abd_seg_t;
+
 typedef int abd_iter_func_t(void *buf, size_t len, void *_private);
 typedef int abd_iter_func2_t(void *bufa, void *bufb, size_t len, void *_private);
 
@@ -71,6 +80,12 @@ abd_is_linear(abd_t *abd)
 	return ((abd->abd_flags & ABD_FLAG_LINEAR) != 0 ? B_TRUE : B_FALSE);
 }
 
+static inline boolean_t
+abd_is_gang(abd_t *abd)
+{
+	return ((abd->abd_flags & ABD_FLAG_GANG) != 0 ? B_TRUE : B_FALSE);
+}
+
 /*
  * Allocations and deallocations
  */
@@ -83,6 +98,8 @@ void abd_free(abd_t *);
 abd_t *abd_get_offset(abd_t *, size_t);
 abd_t *abd_get_offset_size(abd_t *, size_t, size_t);
 abd_t *abd_get_from_buf(void *, size_t);
+abd_t *abd_alloc_gang(size_t);
+boolean_t abd_gang_add(abd_t *, abd_t *, size_t, size_t);
 void abd_put(abd_t *);
 
 /*
@@ -99,6 +116,8 @@ void abd_return_buf_copy_off(abd_t *, void *, size_t, size_t, size_t);
 void abd_return_buf_off(abd_t *, void *, size_t, size_t, size_t);
 void abd_take_ownership_of_buf(abd_t *, boolean_t);
 void abd_release_ownership_of_buf(abd_t *);
+int abd_borrow_segs(abd_t *, size_t, abd_seg_t *, int, void *);
+void abd_return_segs(abd_t *, size_t, void *);
 
 /*
  * ABD operations
@@ -262,6 +262,9 @@ void l2arc_start(void);
 void l2arc_stop(void);
 
 extern int zfs_arc_average_blocksize;
+extern int zfs_arc_hash_locks_per_cpu;
+extern int zfs_arc_hash_lockless;
+extern int zfs_arc_pressure_grow_shift;
 
 #ifndef _KERNEL
 extern boolean_t arc_watch;
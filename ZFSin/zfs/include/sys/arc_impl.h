@@ -211,18 +211,152 @@ typedef struct arc_buf_hdr_crypt {
 	uint8_t			b_mac[ZIO_DATA_MAC_LEN];
 } arc_buf_hdr_crypt_t;
 
+/*
+ * Persistent L2ARC
+ *
+ * The L2ARC headers of buffers written to a cache device are recorded on the
+ * device itself, so that they can be rebuilt when the pool is imported again
+ * rather than starting with a cold cache. The layout is:
+ *
+ *	+------+---------+--------+------+---------+--------+------+--//
+ *	| dev  | payload | log    | ...  | payload | log    | ...  |
+ *	| hdr  |         | blk 0  |      |         | blk N  |      |
+ *	+------+---------+--------+------+---------+--------+------+--//
+ *	   |                 ^  ^                       |
+ *	   |                 |  +-----------------------+ lb_prev_lbp
+ *	   +-----------------|-------------------------------> dh_start_lbp
+ *
+ * The device header lives right after the front vdev labels and points at
+ * the most recently written log block. Each log block describes the buffers
+ * written to the device just before it (its payload) and points back at the
+ * previous log block, so a rebuild walks the chain from newest to oldest
+ * until it runs into a log block that has been overwritten or fails its
+ * checksum.
+ */
+#define	L2ARC_DEV_HDR_MAGIC		0x5a46534341434845LLU	/* "ZFSCACHE" */
+#define	L2ARC_LOG_BLK_MAGIC		0x4c4f47424c4b4844LLU	/* "LOGBLKHD" */
+#define	L2ARC_PERSISTENT_VERSION	1
+
+/* Number of entries in a log block, which makes it exactly 64KB. */
+#define	L2ARC_LOG_BLK_MAX_ENTRIES	1022
+
+/* dh_flags */
+#define	L2ARC_DEV_HDR_EVICT_FIRST	(1 << 0)	/* l2ad_first is set */
+
+/*
+ * Fields packed into lbp_prop and le_prop. The sizes are in bytes and use the
+ * same encoding as blk_prop.
+ */
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_PSIZE(field)	\
+	BF64_GET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_PSIZE(field, x)	\
+	BF64_SET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	BF64_GET((field), 32, 7)
+#define	L2BLK_SET_COMPRESS(field, x)	BF64_SET((field), 32, 7, x)
+#define	L2BLK_GET_PREFETCH(field)	BF64_GET((field), 39, 1)
+#define	L2BLK_SET_PREFETCH(field, x)	BF64_SET((field), 39, 1, x)
+#define	L2BLK_GET_CHECKSUM(field)	BF64_GET((field), 40, 8)
+#define	L2BLK_SET_CHECKSUM(field, x)	BF64_SET((field), 40, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 48, 8)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 48, 8, x)
+#define	L2BLK_GET_PROTECTED(field)	BF64_GET((field), 56, 1)
+#define	L2BLK_SET_PROTECTED(field, x)	BF64_SET((field), 56, 1, x)
+
+/*
+ * Pointer to a log block on the cache device. The psize of lbp_prop is the
+ * allocated size of the (possibly compressed) log block.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;		/* device address of log blk */
+	uint64_t	lbp_payload_asize;	/* asize of buffers described */
+	uint64_t	lbp_payload_start;	/* device address of payload */
+	uint64_t	lbp_prop;		/* sizes, compress, checksum */
+	zio_cksum_t	lbp_cksum;		/* fletcher4 of log blk */
+} l2arc_log_blkptr_t;
+
+/*
+ * The device header. It is written with an embedded label checksum at the
+ * end of its allocated size, hence the trailing zio_eck_t.
+ */
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t	dh_magic;		/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t	dh_version;		/* L2ARC_PERSISTENT_VERSION */
+	uint64_t	dh_spa_guid;		/* pool the device belongs to */
+	uint64_t	dh_vdev_guid;		/* guid of the cache vdev */
+	uint64_t	dh_log_entries;		/* entries per log block */
+	uint64_t	dh_evict;		/* l2ad_evict */
+	uint64_t	dh_flags;		/* L2ARC_DEV_HDR_* */
+	uint64_t	dh_start;		/* l2ad_start */
+	uint64_t	dh_end;			/* l2ad_end */
+	uint64_t	dh_lb_asize;		/* total asize of log blks */
+	uint64_t	dh_lb_count;		/* number of log blks */
+	l2arc_log_blkptr_t dh_start_lbp;	/* newest log blk */
+	uint64_t	dh_pad[40];		/* pad to 512 bytes */
+	zio_eck_t	dh_tail;
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * A single buffer's L2ARC header as stored in a log block.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;			/* dva of buffer */
+	uint64_t	le_birth;		/* birth txg of buffer */
+	uint64_t	le_prop;		/* sizes, compress, type, ... */
+	uint64_t	le_daddr;		/* device address of buffer */
+	uint64_t	le_pad[3];		/* pad to 64 bytes */
+} l2arc_log_ent_phys_t;
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous log blk */
+	uint64_t		lb_pad[7];	/* pad header to 128 bytes */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_MAX_ENTRIES];
+} l2arc_log_blk_phys_t;
+
+/* In-core copy of a log block pointer, kept on l2ad_lbptr_list. */
+typedef struct l2arc_lb_ptr_buf {
+	l2arc_log_blkptr_t	lb_ptr;
+	list_node_t		lb_node;
+} l2arc_lb_ptr_buf_t;
+
+/* A log block being written, freed once the write completes. */
+typedef struct l2arc_lb_abd_buf {
+	abd_t			*lb_abd;
+	list_node_t		lb_node;
+} l2arc_lb_abd_buf_t;
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
 	uint64_t		l2ad_hand;	/* next write location */
 	uint64_t		l2ad_start;	/* first addr on device */
 	uint64_t		l2ad_end;	/* last addr on device */
+	uint64_t		l2ad_evict;	/* last addr evicted */
 	boolean_t		l2ad_first;	/* first sweep through */
 	boolean_t		l2ad_writing;	/* currently writing */
 	kmutex_t		l2ad_mtx;	/* lock for buffer list */
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	refcount_t		l2ad_alloc;	/* allocated bytes */
+	/* persistent L2ARC state, protected by l2arc_rebuild_thr_lock */
+	boolean_t		l2ad_rebuild;	/* rebuild pending/running */
+	boolean_t		l2ad_rebuild_cancel; /* stop the rebuild */
+	/* written by the feed thread only */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* in-core device header */
+	uint64_t		l2ad_dev_hdr_asize; /* on-disk size of it */
+	l2arc_log_blk_phys_t	l2ad_log_blk;	/* log blk being built */
+	int			l2ad_log_ent_idx; /* next entry in it */
+	int			l2ad_log_entries; /* entries per log blk */
+	uint64_t		l2ad_log_blk_payload_asize;
+	uint64_t		l2ad_log_blk_payload_start;
+	/* protected by l2ad_mtx */
+	list_t			l2ad_lbptr_list; /* log blks on device */
+	refcount_t		l2ad_lb_asize;	/* asize of log blks */
+	refcount_t		l2ad_lb_count;	/* number of log blks */
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
@@ -239,6 +373,7 @@ typedef struct l2arc_buf_hdr {
 typedef struct l2arc_write_callback {
 	l2arc_dev_t	*l2wcb_dev;		/* device info */
 	arc_buf_hdr_t	*l2wcb_head;		/* head of write buflist */
+	list_t		l2wcb_abd_list;		/* log blks being written */
 } l2arc_write_callback_t;
 
 struct arc_buf_hdr {
@@ -38,4 +38,24 @@ int sha2_mod_fini(void);
 int icp_init(void);
 void icp_fini(void);
 
+/*
+ * Block cipher and GHASH implementations, selected by the icp_aes_impl
+ * and icp_gcm_impl tunables.
+ */
+#define	AES_IMPL_FASTEST	0
+#define	AES_IMPL_GENERIC	1
+#define	AES_IMPL_AESNI		2
+
+#define	GCM_IMPL_FASTEST	0
+#define	GCM_IMPL_GENERIC	1
+#define	GCM_IMPL_PCLMULQDQ	2
+
+extern uint64_t icp_aes_impl;
+extern uint64_t icp_gcm_impl;
+
+int aes_impl_set(uint64_t id);
+const char *aes_impl_name(void);
+int gcm_impl_set(uint64_t id);
+const char *gcm_impl_name(void);
+
 #endif /* _SYS_CRYPTO_ALGS_H */
@@ -0,0 +1,101 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#ifndef	_SYS_DATASET_KSTATS_H
+#define	_SYS_DATASET_KSTATS_H
+
+#include <sys/aggsum.h>
+#include <sys/dmu.h>
+#include <sys/kstat.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Counters are bumped from every CPU doing i/o to the dataset, so they
+ * are kept in aggsums and only folded into the kstat when it is read.
+ */
+typedef struct dataset_aggsum_stats {
+	aggsum_t das_writes;
+	aggsum_t das_nwritten;
+	aggsum_t das_reads;
+	aggsum_t das_nread;
+	aggsum_t das_pwritten;
+	aggsum_t das_pread;
+	aggsum_t das_arc_hits;
+	aggsum_t das_arc_misses;
+	aggsum_t das_zil_commits;
+	aggsum_t das_nread_direct;
+	aggsum_t das_nwritten_direct;
+} dataset_aggsum_stats_t;
+
+typedef struct dataset_kstat_values {
+	kstat_named_t dkv_ds_name;
+	kstat_named_t dkv_writes;	/* write requests */
+	kstat_named_t dkv_nwritten;	/* logical bytes written */
+	kstat_named_t dkv_reads;	/* read requests */
+	kstat_named_t dkv_nread;	/* logical bytes read */
+	kstat_named_t dkv_pwritten;	/* physical bytes written */
+	kstat_named_t dkv_pread;	/* physical bytes read */
+	kstat_named_t dkv_arc_hits;
+	kstat_named_t dkv_arc_misses;
+	kstat_named_t dkv_zil_commits;
+	kstat_named_t dkv_reads_delayed;	/* by readlimit/iopslimit */
+	kstat_named_t dkv_read_delay_ns;
+	kstat_named_t dkv_writes_delayed;	/* by writelimit/iopslimit */
+	kstat_named_t dkv_write_delay_ns;
+	kstat_named_t dkv_nread_direct;		/* bypassing the ARC */
+	kstat_named_t dkv_nread_buffered;
+	kstat_named_t dkv_nwritten_direct;
+	kstat_named_t dkv_nwritten_buffered;
+} dataset_kstat_values_t;
+
+typedef struct dataset_kstats {
+	dataset_aggsum_stats_t	dk_aggsums;
+	dataset_kstat_values_t	dk_values;
+	char			dk_name[ZFS_MAX_DATASET_NAME_LEN];
+	kmutex_t		dk_lock;	/* protects dk_values */
+	kstat_t			*dk_kstats;	/* NULL if not tracked */
+} dataset_kstats_t;
+
+void dataset_kstats_create(dataset_kstats_t *dk, objset_t *os);
+void dataset_kstats_destroy(dataset_kstats_t *dk);
+
+void dataset_kstats_update_read_kstats(dataset_kstats_t *dk, int64_t nread);
+void dataset_kstats_update_write_kstats(dataset_kstats_t *dk,
+    int64_t nwritten);
+void dataset_kstats_update_arc_kstats(dataset_kstats_t *dk, boolean_t hit,
+    int64_t pread);
+void dataset_kstats_update_pwritten_kstats(dataset_kstats_t *dk,
+    int64_t pwritten);
+void dataset_kstats_update_zil_kstats(dataset_kstats_t *dk);
+void dataset_kstats_update_direct_read_kstats(dataset_kstats_t *dk,
+    int64_t nread);
+void dataset_kstats_update_direct_write_kstats(dataset_kstats_t *dk,
+    int64_t nwritten);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DATASET_KSTATS_H */
@@ -156,6 +156,13 @@ typedef struct dbuf_dirty_record {
 			boolean_t dr_nopwrite;
 			boolean_t dr_has_raw_params;
 
+			/*
+			 * Set by a direct I/O write.  There is no dr_data;
+			 * the new contents only exist on disk, at
+			 * dr_overridden_by once the write has finished.
+			 */
+			boolean_t dr_direct;
+
 			/*
 			 * If dr_has_raw_params is set, the following crypt
 			 * params will be set on the BP that's written.
@@ -280,15 +287,34 @@ typedef struct dmu_buf_impl {
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
-/* Note: the dbuf hash table is exposed only for the mdb module */
+/*
+ * Note: the dbuf hash table is exposed only for the mdb module
+ *
+ * The table is resized while in use.  A chain is protected by the mutex
+ * picked by the low bits of its index, which are the same bits of the
+ * hash value at any table size because the table never has fewer than
+ * DBUF_MUTEXES buckets.  Each mutex also records the table (and mask)
+ * that its chains currently live in, so a resize moves the chains over
+ * one mutex at a time and lookups only ever wait for one of those steps.
+ * hash_table and hash_table_mask describe the newest table.
+ */
 #define	DBUF_MUTEXES 8192
-#define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+#define	DBUF_HASH_LOCK(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+#define	DBUF_HASH_MUTEX(h, idx) (&DBUF_HASH_LOCK(h, idx)->dhm_mutex)
+typedef struct dbuf_hash_mutex {
+	kmutex_t dhm_mutex;
+	uint64_t dhm_mask;
+	dmu_buf_impl_t **dhm_table;
+} dbuf_hash_mutex_t;
+
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
 	dmu_buf_impl_t **hash_table;
-	kmutex_t hash_mutexes[DBUF_MUTEXES];
+	dbuf_hash_mutex_t hash_mutexes[DBUF_MUTEXES];
 } dbuf_hash_table_t;
 
+extern int dbuf_hash_load_max;
+
 
 uint64_t dbuf_whichblock(struct dnode *di, int64_t level, uint64_t offset);
 
@@ -319,9 +345,14 @@ dmu_buf_impl_t *dbuf_find(struct objset *os, uint64_t object, uint8_t level,
     uint64_t blkid);
 
 int dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags);
+int dbuf_read_direct(dmu_buf_impl_t *db, zio_t *pio, void *buf,
+    uint32_t flags);
 void dmu_buf_will_not_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_fill_done(dmu_buf_t *db, dmu_tx_t *tx);
+boolean_t dmu_buf_will_direct(dmu_buf_t *db, dmu_tx_t *tx);
+void dmu_buf_direct_done(dmu_buf_t *db, dmu_tx_t *tx, const blkptr_t *bp,
+    uint8_t copies, int err);
 void dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx);
 dbuf_dirty_record_t *dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx);
 arc_buf_t *dbuf_loan_arcbuf(dmu_buf_impl_t *db);
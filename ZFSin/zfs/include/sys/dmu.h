@@ -143,6 +143,16 @@ typedef enum dmu_object_byteswap {
 #define	DMU_OT_HAS_FILL(ot) \
 	((ot) == DMU_OT_DNODE || (ot) == DMU_OT_OBJSET)
 
+#define	DMU_OT_IS_DDT(ot) \
+	((ot) == DMU_OT_DDT_ZAP)
+
+#define	DMU_OT_IS_ZIL(ot) \
+	((ot) == DMU_OT_INTENT_LOG)
+
+/* Note: ztest uses DMU_OT_UINT64_OTHER as a proxy for file blocks */
+#define	DMU_OT_IS_FILE(ot) \
+	((ot) == DMU_OT_PLAIN_FILE_CONTENTS || (ot) == DMU_OT_UINT64_OTHER)
+
 #define	DMU_OT_BYTESWAP(ot) (((ot) & DMU_OT_NEWTYPE) ? \
 	((ot) & DMU_OT_BYTESWAP_MASK) : \
 	dmu_ot[(int)(ot)].ot_byteswap)
@@ -370,6 +380,7 @@ typedef struct dmu_buf {
 #define	DMU_POOL_OBSOLETE_BPOBJ		"com.delphix:obsolete_bpobj"
 #define	DMU_POOL_CONDENSING_INDIRECT	"com.delphix:condensing_indirect"
 #define	DMU_POOL_ZPOOL_CHECKPOINT	"com.delphix:zpool_checkpoint"
+#define	DMU_POOL_LOG_SPACEMAP_ZAP	"com.delphix:log_spacemap_zap"
 
 /*
  * Allocate an object from this objset.  The range of object numbers
@@ -384,6 +395,11 @@ typedef struct dmu_buf {
  * dmu_object_claim() allocates a specific object number.  If that
  * number is already allocated, it fails and returns EEXIST.
  *
+ * The *_dnsize() variants take the on-disk size of the dnode in bytes;
+ * a dnodesize of 0 selects the minimum (legacy) 512 byte dnode.  Larger
+ * dnodes consume several consecutive slots of the meta dnode and leave
+ * more room for the bonus buffer (system attributes).
+ *
  * Return 0 on success, or ENOSPC or EEXIST as specified above.
  */
 uint64_t dmu_object_alloc(objset_t *os, dmu_object_type_t ot,
@@ -391,10 +407,19 @@ uint64_t dmu_object_alloc(objset_t *os, dmu_object_type_t ot,
 uint64_t dmu_object_alloc_ibs(objset_t *os, dmu_object_type_t ot, int blocksize,
     int indirect_blockshift,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx);
+uint64_t dmu_object_alloc_dnsize(objset_t *os, dmu_object_type_t ot,
+    int blocksize, dmu_object_type_t bonus_type, int bonus_len,
+    int dnodesize, dmu_tx_t *tx);
 int dmu_object_claim(objset_t *os, uint64_t object, dmu_object_type_t ot,
     int blocksize, dmu_object_type_t bonus_type, int bonus_len, dmu_tx_t *tx);
+int dmu_object_claim_dnsize(objset_t *os, uint64_t object,
+    dmu_object_type_t ot, int blocksize, dmu_object_type_t bonus_type,
+    int bonus_len, int dnodesize, dmu_tx_t *tx);
 int dmu_object_reclaim(objset_t *os, uint64_t object, dmu_object_type_t ot,
     int blocksize, dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *txp);
+int dmu_object_reclaim_dnsize(objset_t *os, uint64_t object,
+    dmu_object_type_t ot, int blocksize, dmu_object_type_t bonustype,
+    int bonuslen, int dnodesize, dmu_tx_t *txp);
 
 /*
  * Free an object from this objset.
@@ -809,6 +834,38 @@ void dmu_write_by_dnode(dnode_t *dn, uint64_t offset, uint64_t size,
 void dmu_prealloc(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	dmu_tx_t *tx);
 
+/*
+ * Read-only loans of file data.  Instead of copying out as dmu_read()
+ * does, dmu_read_loan() holds the dbufs covering [offset, offset + size)
+ * and lets the caller use their data in place: dmu_loan_segment() returns
+ * the part of dl_dbp[i] inside the range.  The holds keep the ARC buffers
+ * from being evicted or freed until the loan comes back through
+ * dmu_loan_return(), which then calls the done callback, if any.  As with
+ * any other read, the caller must keep writers off the range (e.g. with
+ * a range lock) if it needs the data not to change under it.  A loan
+ * covers at most DMU_MAX_ACCESS / 2 bytes.
+ */
+typedef struct dmu_loan dmu_loan_t;
+typedef void dmu_loan_done_func_t(dmu_loan_t *loan, void *arg);
+
+struct dmu_loan {
+	uint64_t		dl_offset;	/* object offset of the range */
+	uint64_t		dl_size;	/* bytes in the range */
+	int			dl_numbufs;	/* segments in the loan */
+	dmu_buf_t		**dl_dbp;	/* held dbufs, one per segment */
+	dmu_loan_done_func_t	*dl_done;	/* called by dmu_loan_return() */
+	void			*dl_arg;
+};
+
+int dmu_read_loan(objset_t *os, uint64_t object, uint64_t offset,
+    uint64_t size, uint32_t flags, dmu_loan_done_func_t *done, void *arg,
+    dmu_loan_t **loanp);
+int dmu_read_loan_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    uint32_t flags, dmu_loan_done_func_t *done, void *arg,
+    dmu_loan_t **loanp);
+const void *dmu_loan_segment(dmu_loan_t *loan, int i, uint64_t *lenp);
+void dmu_loan_return(dmu_loan_t *loan);
+
 #ifdef _KERNEL
     //#include <linux/blkdev_compat.h>
 struct iomem;
@@ -828,6 +885,10 @@ int dmu_write_uio_dbuf(dmu_buf_t *zdb, struct uio *uio, uint64_t size,
 	dmu_tx_t *tx);
 int dmu_write_iokit_dbuf(dmu_buf_t *zdb, uint64_t *offset, uint64_t position,
     uint64_t *size, struct iomem *iomem, dmu_tx_t *tx);
+int dmu_read_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    void *buf);
+int dmu_write_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    const void *buf, dmu_tx_t *tx);
 int dmu_buf_hold_array(objset_t *os, uint64_t object, uint64_t offset,
      uint64_t length, int read, void *tag, int *numbufsp, dmu_buf_t ***dbpp);
 int dmu_allocate_check(objset_t *z_os, off_t length);
@@ -855,6 +916,7 @@ void xuio_stat_wbuf_nocopy(void);
 
 extern boolean_t zfs_prefetch_disable;
 extern int zfs_max_recordsize;
+extern int dmu_object_alloc_chunk_shift;
 
 /*
  * Asynchronously try to read in the data.
@@ -869,6 +931,7 @@ typedef struct dmu_object_info {
 	dmu_object_type_t doi_type;
 	dmu_object_type_t doi_bonus_type;
 	uint64_t doi_bonus_size;
+	uint64_t doi_dnodesize;
 	uint8_t doi_indirection;		/* 2 = dnode->indirect->data */
 	uint8_t doi_checksum;
 	uint8_t doi_compress;
@@ -919,6 +982,8 @@ void dmu_object_info_from_db(dmu_buf_t *db, dmu_object_info_t *doi);
 void dmu_object_size_from_db(dmu_buf_t *db, uint32_t *blksize,
     u_longlong_t *nblk512);
 
+void dmu_object_dnsize_from_db(dmu_buf_t *db, int *dnsize);
+
 typedef struct dmu_objset_stats {
 	uint64_t dds_num_clones; /* number of clones of this */
 	uint64_t dds_creation_txg;
@@ -978,6 +1043,7 @@ extern dmu_objset_type_t dmu_objset_type(objset_t *os);
 extern uint64_t dmu_objset_id(objset_t *os);
 extern zfs_sync_type_t dmu_objset_syncprop(objset_t *os);
 extern zfs_logbias_op_t dmu_objset_logbias(objset_t *os);
+extern int dmu_objset_dnodesize(objset_t *os);
 extern int dmu_snapshot_list_next(objset_t *os, int namelen, char *name,
     uint64_t *id, uint64_t *offp, boolean_t *case_conflict);
 extern int dmu_snapshot_lookup(objset_t *os, const char *name, uint64_t *val);
@@ -38,6 +38,8 @@
 #include <sys/dnode.h>
 #include <sys/zio.h>
 #include <sys/zil.h>
+#include <sys/dmu_throttle.h>
+#include <sys/dataset_kstats.h>
 #include <sys/sa.h>
 #include <sys/zfs_ioctl.h>
 
@@ -109,7 +111,21 @@ struct objset {
 	zfs_cache_type_t os_secondary_cache;
 	zfs_sync_type_t os_sync;
 	zfs_redundant_metadata_type_t os_redundant_metadata;
+	uint64_t os_dnodesize;	/* default dnode size for new objects */
+	zfs_direct_t os_direct;
 	int os_recordsize;
+	/*
+	 * File blocks no larger than this go to the special class, if any
+	 */
+	int os_zpl_special_smallblock;
+	/*
+	 * Read and write bandwidth (bytes/s) and IOPS limits, 0 if none
+	 */
+	uint64_t os_readlimit;
+	uint64_t os_writelimit;
+	uint64_t os_iopslimit;
+	dmu_throttle_t os_throttle;
+	dataset_kstats_t os_dsks;
 	/*
 	 * The next four values are used as a cache of whatever's on disk, and
 	 * are initialized the first time these properties are queried. Before
@@ -141,7 +157,11 @@ struct objset {
 
 	/* Protected by os_obj_lock */
 	kmutex_t os_obj_lock;
-	uint64_t os_obj_next;
+	uint64_t os_obj_next_chunk;
+
+	/* Per-CPU next object to allocate, updated atomically */
+	uint64_t *os_obj_next_percpu;
+	int os_obj_next_percpu_len;
 
 	/* Protected by os_lock */
 	kmutex_t os_lock;
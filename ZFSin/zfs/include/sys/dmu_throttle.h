@@ -0,0 +1,72 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#ifndef	_SYS_DMU_THROTTLE_H
+#define	_SYS_DMU_THROTTLE_H
+
+#include <sys/zfs_context.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct objset;
+
+/*
+ * Per-dataset I/O limits (the readlimit, writelimit and iopslimit
+ * properties), enforced with one token bucket each.
+ */
+typedef enum dmu_throttle_type {
+	DMU_THROTTLE_READ,	/* bytes read per second */
+	DMU_THROTTLE_WRITE,	/* bytes written per second */
+	DMU_THROTTLE_IOPS,	/* reads and writes per second */
+	DMU_THROTTLE_TYPES
+} dmu_throttle_type_t;
+
+typedef struct dmu_tbucket {
+	int64_t		tb_tokens;	/* negative while in debt */
+	hrtime_t	tb_stamp;	/* last refill */
+} dmu_tbucket_t;
+
+/* reported through the dataset's kstat, see dataset_kstats.c */
+typedef struct dmu_throttle_stats {
+	uint64_t	dts_reads_delayed;
+	uint64_t	dts_read_delay_ns;
+	uint64_t	dts_writes_delayed;
+	uint64_t	dts_write_delay_ns;
+} dmu_throttle_stats_t;
+
+typedef struct dmu_throttle {
+	kmutex_t		dt_lock;
+	dmu_tbucket_t		dt_bucket[DMU_THROTTLE_TYPES];
+	dmu_throttle_stats_t	dt_stats;	/* protected by dt_lock */
+} dmu_throttle_t;
+
+void dmu_throttle_init(struct objset *os);
+void dmu_throttle_fini(struct objset *os);
+void dmu_throttle(struct objset *os, boolean_t write, uint64_t size);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_DMU_THROTTLE_H */
@@ -100,6 +100,24 @@ typedef enum dsl_scan_flags {
  *			the scan but have not yet been processed (i.e deferred
  *			frees) are accounted for.
  *
+ * A scrub or resilver is normally run as a sorted scan: the traversal only
+ * gathers block pointers into per top-level vdev queues sorted by offset,
+ * and the reads are issued later in address order. Because gathered blocks
+ * only live in memory, the on-disk state (scn_phys_cached) is only advanced
+ * to the in-memory traversal position (scn_phys) once every queue has been
+ * drained; this is called a checkpoint. The following members direct the
+ * sorted scan:
+ *
+ * scn_is_sorted -	the scan gathers blocks into sorted queues instead
+ *			of issuing them straight from the traversal.
+ *
+ * scn_clearing -	the queues hold as much memory as we allow, so the
+ *			traversal stops and only queued I/Os are issued until
+ *			usage falls below the soft limit.
+ *
+ * scn_checkpointing -	we are draining the queues completely so that the
+ *			current traversal position can be written out.
+ *
  * This structure also maintains information about deferred frees which are
  * a special kind of traversal. Deferred free can exist in either a bptree or
  * a bpobj structure. The scn_is_bptree flag will indicate the type of
@@ -123,10 +141,27 @@ typedef struct dsl_scan {
 
 	/* for debugging / information */
 	uint64_t scn_visited_this_txg;
-
-	dsl_scan_phys_t scn_phys;
+	uint64_t scn_issued_this_txg;
+	uint64_t scn_segs_this_txg;
+
+	/* sorted scan state */
+	boolean_t scn_is_sorted;
+	boolean_t scn_clearing;
+	boolean_t scn_checkpointing;
+	uint64_t scn_last_checkpoint;	/* lbolt of the last checkpoint */
+	uint64_t scn_bytes_pending;	/* bytes sitting in the vdev queues */
+	uint64_t scn_issued_before_pass; /* bytes issued before this pass */
+	taskq_t *scn_taskq;		/* issues the per-vdev queues */
+
+	/* datasets still to be traversed, synced to scn_queue_obj */
+	avl_tree_t scn_queue;
+
+	dsl_scan_phys_t scn_phys;	/* in-memory traversal state */
+	dsl_scan_phys_t scn_phys_cached; /* state as of the last checkpoint */
 } dsl_scan_t;
 
+typedef struct dsl_scan_io_queue dsl_scan_io_queue_t;
+
 int dsl_scan_init(struct dsl_pool *dp, uint64_t txg);
 void dsl_scan_fini(struct dsl_pool *dp);
 void dsl_scan_sync(struct dsl_pool *, dmu_tx_t *);
@@ -145,6 +180,9 @@ void dsl_scan_ds_clone_swapped(struct dsl_dataset *ds1, struct dsl_dataset *ds2,
     struct dmu_tx *tx);
 boolean_t dsl_scan_active(dsl_scan_t *scn);
 boolean_t dsl_scan_is_paused_scrub(const dsl_scan_t *scn);
+void dsl_scan_freed(spa_t *spa, const blkptr_t *bp);
+void dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue);
+void dsl_scan_io_queue_vdev_xfer(vdev_t *svd, vdev_t *tvd);
 
 #ifdef	__cplusplus
 }
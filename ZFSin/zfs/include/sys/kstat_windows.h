@@ -46,6 +46,9 @@ typedef struct osx_kstat {
 	kstat_named_t arc_zfs_arc_shrink_shift;
 	kstat_named_t arc_zfs_arc_p_min_shift;
 	kstat_named_t arc_zfs_arc_average_blocksize;
+	kstat_named_t arc_zfs_arc_hash_locks_per_cpu;
+	kstat_named_t arc_zfs_arc_hash_lockless;
+	kstat_named_t arc_zfs_arc_pressure_grow_shift;
 
 	kstat_named_t l2arc_write_max;
 	kstat_named_t l2arc_write_boost;
@@ -66,6 +69,17 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_vdev_async_write_max_active;
 	kstat_named_t zfs_vdev_scrub_min_active;
 	kstat_named_t zfs_vdev_scrub_max_active;
+	kstat_named_t zfs_vdev_trim_min_active;
+	kstat_named_t zfs_vdev_trim_max_active;
+	kstat_named_t zfs_vdev_deadline;
+	kstat_named_t zfs_vdev_sync_read_deadline_ms;
+	kstat_named_t zfs_vdev_sync_write_deadline_ms;
+	kstat_named_t zfs_vdev_async_read_deadline_ms;
+	kstat_named_t zfs_vdev_async_write_deadline_ms;
+	kstat_named_t zfs_vdev_scrub_deadline_ms;
+	kstat_named_t zfs_vdev_removal_deadline_ms;
+	kstat_named_t zfs_vdev_initializing_deadline_ms;
+	kstat_named_t zfs_vdev_trim_deadline_ms;
 	kstat_named_t zfs_vdev_async_write_active_min_dirty_percent;
 	kstat_named_t zfs_vdev_async_write_active_max_dirty_percent;
 	kstat_named_t zfs_vdev_aggregation_limit;
@@ -87,6 +101,8 @@ typedef struct osx_kstat {
 	kstat_named_t zfetch_array_rd_sz;
 	kstat_named_t zfs_default_bs;
 	kstat_named_t zfs_default_ibs;
+	kstat_named_t dmu_object_alloc_chunk_shift;
+	kstat_named_t dbuf_hash_load_max;
 	kstat_named_t metaslab_aliquot;
 	kstat_named_t spa_max_replication_override;
 	kstat_named_t spa_mode_global;
@@ -96,6 +112,15 @@ typedef struct osx_kstat {
 	kstat_named_t zfs_vdev_cache_size;
 	kstat_named_t zfs_vdev_cache_bshift;
 	kstat_named_t vdev_mirror_shift;
+	kstat_named_t zfs_vdev_mirror_rotating_inc;
+	kstat_named_t zfs_vdev_mirror_rotating_seek_inc;
+	kstat_named_t zfs_vdev_mirror_rotating_seek_offset;
+	kstat_named_t zfs_vdev_mirror_non_rotating_inc;
+	kstat_named_t zfs_vdev_mirror_non_rotating_seek_inc;
+	kstat_named_t zfs_vdev_mirror_latency_aware;
+	kstat_named_t zfs_vdev_latency_ewma_shift;
+	kstat_named_t zfs_vdev_max_segs;
+	kstat_named_t zfs_vdev_aggregate_gang;
 	kstat_named_t zfs_scrub_limit;
 	kstat_named_t zfs_no_scrub_io;
 	kstat_named_t zfs_no_scrub_prefetch;
@@ -112,11 +137,37 @@ typedef struct osx_kstat {
 	kstat_named_t l2arc_noprefetch;
 	kstat_named_t l2arc_feed_again;
 	kstat_named_t l2arc_norw;
+	kstat_named_t l2arc_rebuild_enabled;
+	kstat_named_t l2arc_rebuild_blocks_min_l2size;
 
 	kstat_named_t zfs_top_maxinflight;
 	kstat_named_t zfs_resilver_delay;
 	kstat_named_t zfs_scrub_delay;
 	kstat_named_t zfs_scan_idle;
+	kstat_named_t zfs_scan_legacy;
+	kstat_named_t zfs_scan_vdev_limit;
+	kstat_named_t zfs_scan_checkpoint_intval;
+	kstat_named_t zfs_scan_strict_mem_lim;
+	kstat_named_t zfs_scan_mem_lim_fact;
+	kstat_named_t zfs_scan_mem_lim_soft_fact;
+
+	kstat_named_t zfs_trim_extent_bytes_max;
+	kstat_named_t zfs_trim_extent_bytes_min;
+	kstat_named_t zfs_trim_metaslab_skip;
+	kstat_named_t zfs_trim_queue_limit;
+	kstat_named_t zfs_trim_txg_batch;
+
+	kstat_named_t zfs_ddt_data_is_special;
+	kstat_named_t zfs_user_indirect_is_special;
+	kstat_named_t zfs_special_class_metadata_reserve_pct;
+
+	kstat_named_t zfs_unflushed_max_mem_amt;
+	kstat_named_t zfs_unflushed_max_mem_ppm;
+	kstat_named_t zfs_unflushed_log_block_max;
+	kstat_named_t zfs_unflushed_log_block_min;
+	kstat_named_t zfs_unflushed_log_block_pct;
+	kstat_named_t zfs_min_metaslabs_to_flush;
+	kstat_named_t zfs_keep_log_spacemaps_at_export;
 
 	kstat_named_t zfs_recover;
 
@@ -136,8 +187,14 @@ typedef struct osx_kstat {
 
 	kstat_named_t zfs_vdev_queue_depth_pct;
 	kstat_named_t zio_dva_throttle_enabled;
+	kstat_named_t zio_stage_stats;
 
 	kstat_named_t zfs_vdev_file_size_mismatch_cnt;
+
+	kstat_named_t zfs_fletcher_4_impl;
+	kstat_named_t zfs_vdev_raidz_impl;
+	kstat_named_t icp_aes_impl;
+	kstat_named_t icp_gcm_impl;
 } osx_kstat_t;
 
 
@@ -157,6 +214,9 @@ extern int zfs_arc_grow_retry;
 extern int zfs_arc_shrink_shift;
 extern int zfs_arc_p_min_shift;
 extern int zfs_arc_average_blocksize;
+extern int zfs_arc_hash_locks_per_cpu;
+extern int zfs_arc_hash_lockless;
+extern int zfs_arc_pressure_grow_shift;
 
 extern uint64_t l2arc_write_max;
 extern uint64_t l2arc_write_boost;
@@ -165,6 +225,8 @@ extern uint64_t l2arc_headroom_boost;
 extern uint64_t l2arc_max_block_size;
 extern uint64_t l2arc_feed_secs;
 extern uint64_t l2arc_feed_min_ms;
+extern boolean_t l2arc_rebuild_enabled;
+extern uint64_t l2arc_rebuild_blocks_min_l2size;
 
 extern uint32_t zfs_vdev_max_active;
 extern uint32_t zfs_vdev_sync_read_min_active;
@@ -177,11 +239,31 @@ extern uint32_t zfs_vdev_async_write_min_active;
 extern uint32_t zfs_vdev_async_write_max_active;
 extern uint32_t zfs_vdev_scrub_min_active;
 extern uint32_t zfs_vdev_scrub_max_active;
+extern uint32_t zfs_vdev_trim_min_active;
+extern uint32_t zfs_vdev_trim_max_active;
+extern int zfs_vdev_deadline;
+extern uint32_t zfs_vdev_sync_read_deadline_ms;
+extern uint32_t zfs_vdev_sync_write_deadline_ms;
+extern uint32_t zfs_vdev_async_read_deadline_ms;
+extern uint32_t zfs_vdev_async_write_deadline_ms;
+extern uint32_t zfs_vdev_scrub_deadline_ms;
+extern uint32_t zfs_vdev_removal_deadline_ms;
+extern uint32_t zfs_vdev_initializing_deadline_ms;
+extern uint32_t zfs_vdev_trim_deadline_ms;
 extern int zfs_vdev_async_write_active_min_dirty_percent;
 extern int zfs_vdev_async_write_active_max_dirty_percent;
 extern int zfs_vdev_aggregation_limit;
 extern int zfs_vdev_read_gap_limit;
 extern int zfs_vdev_write_gap_limit;
+extern int zfs_vdev_mirror_rotating_inc;
+extern int zfs_vdev_mirror_rotating_seek_inc;
+extern int zfs_vdev_mirror_rotating_seek_offset;
+extern int zfs_vdev_mirror_non_rotating_inc;
+extern int zfs_vdev_mirror_non_rotating_seek_inc;
+extern int zfs_vdev_mirror_latency_aware;
+extern int zfs_vdev_latency_ewma_shift;
+extern int zfs_vdev_max_segs;
+extern int zfs_vdev_aggregate_gang;
 
 extern uint_t arc_reduce_dnlc_percent;
 extern int arc_lotsfree_percent;
@@ -191,6 +273,8 @@ extern unsigned int	zfetch_max_streams;
 extern unsigned int	zfetch_min_sec_reap;
 extern int zfs_default_bs;
 extern int zfs_default_ibs;
+extern int dmu_object_alloc_chunk_shift;
+extern int dbuf_hash_load_max;
 extern uint64_t metaslab_aliquot;
 extern int zfs_vdev_cache_max;
 extern int spa_max_replication_override;
@@ -210,6 +294,30 @@ extern int zfs_top_maxinflight;
 extern int zfs_resilver_delay;
 extern int zfs_scrub_delay;
 extern int zfs_scan_idle;
+extern int zfs_scan_legacy;
+extern uint64_t zfs_scan_vdev_limit;
+extern int zfs_scan_checkpoint_intval;
+extern int zfs_scan_strict_mem_lim;
+extern int zfs_scan_mem_lim_fact;
+extern int zfs_scan_mem_lim_soft_fact;
+
+extern uint64_t zfs_trim_extent_bytes_max;
+extern uint64_t zfs_trim_extent_bytes_min;
+extern int zfs_trim_metaslab_skip;
+extern int zfs_trim_queue_limit;
+extern int zfs_trim_txg_batch;
+
+extern int zfs_ddt_data_is_special;
+extern int zfs_user_indirect_is_special;
+extern int zfs_special_class_metadata_reserve_pct;
+
+extern uint64_t zfs_unflushed_max_mem_amt;
+extern uint64_t zfs_unflushed_max_mem_ppm;
+extern uint64_t zfs_unflushed_log_block_max;
+extern uint64_t zfs_unflushed_log_block_min;
+extern uint64_t zfs_unflushed_log_block_pct;
+extern uint64_t zfs_min_metaslabs_to_flush;
+extern int zfs_keep_log_spacemaps_at_export;
 
 extern int64_t zfs_free_bpobj_enabled;
 
@@ -228,9 +336,15 @@ extern uint64_t dbuf_cache_max_bytes;
 
 extern uint64_t zfs_vdev_queue_depth_pct;
 extern boolean_t zio_dva_throttle_enabled;
+extern int zio_stage_stats;
 
 extern uint64_t zfs_vdev_file_size_mismatch_cnt;
 
+extern uint64_t zfs_fletcher_4_impl;
+extern uint64_t zfs_vdev_raidz_impl;
+extern uint64_t icp_aes_impl;
+extern uint64_t icp_gcm_impl;
+
 int        kstat_osx_init(void);
 void       kstat_osx_fini(void);
 
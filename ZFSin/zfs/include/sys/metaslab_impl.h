@@ -69,7 +69,7 @@ typedef enum trace_alloc_type {
 	TRACE_ENOSPC		= -6ULL,
 	TRACE_CONDENSING	= -7ULL,
 	TRACE_VDEV_ERROR	= -8ULL,
-	TRACE_INITIALIZING	= -9ULL
+	TRACE_DISABLED		= -9ULL
 } trace_alloc_type_t;
 
 #define	METASLAB_WEIGHT_PRIMARY		(1ULL << 63)
@@ -273,12 +273,21 @@ struct metaslab_group {
 	uint64_t		mg_fragmentation;
 	uint64_t		mg_histogram[RANGE_TREE_HISTOGRAM_SIZE];
 
-	int			mg_ms_initializing;
-	boolean_t		mg_initialize_updating;
-	kmutex_t		mg_ms_initialize_lock;
-	kcondvar_t		mg_ms_initialize_cv;
+	int			mg_ms_disabled;
+	boolean_t		mg_disabled_updating;
+	kmutex_t		mg_ms_disabled_lock;
+	kcondvar_t		mg_ms_disabled_cv;
 };
 
+/*
+ * On-disk entry of the VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS object of a
+ * top-level vdev, indexed by metaslab id.
+ */
+typedef struct metaslab_unflushed_phys {
+	/* on-disk counterpart of ms_unflushed_txg */
+	uint64_t	msp_unflushed_txg;
+} metaslab_unflushed_phys_t;
+
 /*
  * This value defines the number of elements in the ms_lbas array. The value
  * of 64 was chosen as it covers all power of 2 buckets up to UINT64_MAX.
@@ -339,6 +348,17 @@ struct metaslab_group {
  * metaslab needs to condense then we must set the ms_condensing flag to
  * ensure that allocations are not performed on the metaslab that is
  * being written.
+ *
+ * When the log_spacemap feature is active, the allocs and frees of a txg
+ * are not appended to each metaslab's space map. Instead they are written
+ * to a single pool-wide log space map for that txg (see the block comment
+ * in spa_log_spacemap.c) and accumulated in-core in ms_unflushed_allocs
+ * and ms_unflushed_frees. Every txg a few metaslabs are flushed: their
+ * unflushed changes are appended to their own space map, the unflushed
+ * trees are emptied and ms_unflushed_txg is advanced to the syncing txg.
+ * Condensing a metaslab has the same effect as flushing it. When the
+ * metaslab is loaded, the unflushed changes are applied on top of the
+ * contents of its space map.
  */
 struct metaslab {
 	kmutex_t	ms_lock;
@@ -363,11 +383,49 @@ struct metaslab {
 	range_tree_t	*ms_defer[TXG_DEFER_SIZE];
 	range_tree_t	*ms_checkpointing; /* to add to the checkpoint */
 
+	/*
+	 * Changes made to the metaslab since ms_unflushed_txg that are in
+	 * the log space maps but not yet in ms_sm. A range is never in both
+	 * trees; an alloc cancels an unflushed free and vice versa.
+	 */
+	range_tree_t	*ms_unflushed_allocs;
+	range_tree_t	*ms_unflushed_frees;
+
+	/*
+	 * The first txg whose changes are not in ms_sm, or zero if the
+	 * metaslab has never been synced with the log_spacemap feature
+	 * active. Metaslabs with a non-zero ms_unflushed_txg are linked in
+	 * spa_metaslabs_by_flushed, which is protected by
+	 * spa_flushed_ms_lock.
+	 */
+	uint64_t	ms_unflushed_txg;
+	avl_node_t	ms_spa_txg_node;
+
+	/*
+	 * Set while the unflushed changes are being written to ms_sm with
+	 * the ms_lock dropped; metaslab_load() waits on ms_flush_cv.
+	 */
+	boolean_t	ms_flushing;
+	kcondvar_t	ms_flush_cv;
+
+	/*
+	 * Synced allocated space of the metaslab, including the unflushed
+	 * changes, and the delta accumulated by the txg being synced.
+	 */
+	uint64_t	ms_allocated_space;
+	int64_t		ms_allocated_this_txg;
+
 	boolean_t	ms_condensing;	/* condensing? */
 	boolean_t	ms_condense_wanted;
 	uint64_t	ms_condense_checked_txg;
 
-	uint64_t	ms_initializing; /* leaves initializing this ms */
+	uint64_t	ms_disabled; /* # of threads disabling this ms */
+
+	/*
+	 * Freed ranges not yet trimmed, only populated when the autotrim
+	 * pool property is enabled.  Consumed by the autotrim thread.
+	 */
+	range_tree_t	*ms_trim;
 
 	/*
 	 * We must hold both ms_lock and ms_group->mg_lock in order to
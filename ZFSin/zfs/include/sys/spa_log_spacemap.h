@@ -0,0 +1,89 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2018, 2019 by Delphix. All rights reserved.
+ */
+
+#ifndef _SYS_SPA_LOG_SPACEMAP_H
+#define	_SYS_SPA_LOG_SPACEMAP_H
+
+#include <sys/avl.h>
+#include <sys/spa.h>
+#include <sys/space_map.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-core entry of spa_sm_logs_by_txg, one per log space map on disk.
+ */
+typedef struct spa_log_sm {
+	uint64_t	sls_sm_obj;	/* space map object ID */
+	uint64_t	sls_txg;	/* txg logged in the space map */
+	uint64_t	sls_nblocks;	/* number of blocks in this log */
+	avl_node_t	sls_node;	/* node in spa_sm_logs_by_txg */
+} spa_log_sm_t;
+
+/*
+ * Pool-wide accounting of the log space maps and of the metaslab changes
+ * that have not been flushed yet.
+ */
+typedef struct spa_unflushed_stats {
+	uint64_t	sus_memused;	/* memory used by unflushed trees */
+	uint64_t	sus_blocklimit;	/* max blocks across all logs */
+	uint64_t	sus_nblocks;	/* blocks in all the log space maps */
+
+	/* cumulative counters, reported by the log_spacemap kstat */
+	uint64_t	sus_ms_flushed;	/* metaslabs flushed */
+	uint64_t	sus_ms_logged;	/* metaslab syncs that went to the log */
+	uint64_t	sus_flush_time;	/* time spent flushing (ns) */
+} spa_unflushed_stats_t;
+
+extern uint64_t zfs_unflushed_max_mem_amt;
+extern uint64_t zfs_unflushed_max_mem_ppm;
+extern uint64_t zfs_unflushed_log_block_max;
+extern uint64_t zfs_unflushed_log_block_min;
+extern uint64_t zfs_unflushed_log_block_pct;
+extern uint64_t zfs_min_metaslabs_to_flush;
+extern int zfs_keep_log_spacemaps_at_export;
+
+int spa_log_sm_sort_by_txg(const void *, const void *);
+
+space_map_t *spa_syncing_log_sm(spa_t *);
+void spa_generate_syncing_log_sm(spa_t *, dmu_tx_t *);
+void spa_sync_close_syncing_log_sm(spa_t *);
+void spa_flush_metaslabs(spa_t *, dmu_tx_t *);
+void spa_cleanup_old_sm_logs(spa_t *, dmu_tx_t *);
+
+uint64_t spa_log_sm_memlimit(void);
+uint64_t spa_log_sm_flush_backlog(spa_t *);
+
+int spa_ld_log_spacemaps(spa_t *);
+void spa_unload_log_sm_flush_all(spa_t *);
+void spa_unload_log_sm_metadata(spa_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_SPA_LOG_SPACEMAP_H */
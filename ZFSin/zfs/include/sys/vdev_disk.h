@@ -47,6 +47,9 @@ typedef struct vdev_disk {
 extern int vdev_disk_physio(vdev_t *,
     caddr_t, size_t, uint64_t, int, boolean_t);
 
+extern void vdev_disk_init(void);
+extern void vdev_disk_fini(void);
+
 #ifdef  __cplusplus
 }
 #endif
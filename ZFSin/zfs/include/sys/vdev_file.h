@@ -33,14 +33,32 @@
 extern "C" {
 #endif
 
+typedef struct vdev_file {
 #ifdef _KERNEL
-	typedef struct vdev_file {
 	HANDLE vf_handle;
 	PFILE_OBJECT vf_FileObject;
 	PDEVICE_OBJECT vf_DeviceObject;
 	uint32_t	vf_vid;
-} vdev_file_t;
+
+	/*
+	 * IRP completion runs at DISPATCH_LEVEL, so completed i/os are
+	 * pushed onto vf_done_list and finished by vf_done_thread.
+	 */
+	KSPIN_LOCK	vf_done_lock;
+	struct vdev_file_callback_struct *vf_done_list;
+	KEVENT		vf_done_event;
+	kthread_t	*vf_done_thread;
+	boolean_t	vf_done_exit;
+	kmutex_t	vf_lock;
+	kcondvar_t	vf_cv;
+#else
+	HANDLE		vf_handle;	/* overlapped, bound to the iocp */
 #endif
+	uint64_t	vf_inflight;	/* i/os issued but not yet finished */
+} vdev_file_t;
+
+extern void vdev_file_init(void);
+extern void vdev_file_fini(void);
 
 #ifdef	__cplusplus
 }
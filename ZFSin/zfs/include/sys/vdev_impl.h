@@ -61,6 +61,23 @@ struct abd;
 extern uint64_t zfs_vdev_queue_depth_pct;
 extern int zfs_vdev_def_queue_depth;
 extern uint32_t zfs_vdev_async_write_max_active;
+extern int zfs_vdev_max_segs;
+extern int zfs_vdev_aggregate_gang;
+
+/*
+ * Aggregation counters, reported by the vdev_queue_stats kstat.
+ */
+typedef struct vdev_queue_stats {
+	kstat_named_t vqs_agg_ios;
+	kstat_named_t vqs_agg_gang_ios;
+	kstat_named_t vqs_agg_copied_bytes;
+	kstat_named_t vqs_agg_gang_bytes;
+	kstat_named_t vqs_deadline_promoted;
+	kstat_named_t vqs_deadline_missed;
+	kstat_named_t vqs_deadline_backoffs;
+} vdev_queue_stats_t;
+
+extern vdev_queue_stats_t vdev_queue_stats;
 
 /*
  * Virtual device operations
@@ -133,6 +150,15 @@ typedef struct vdev_queue_class {
 	 * LBA-ordered vs FIFO.
 	 */
 	avl_tree_t	vqc_queued_tree;
+
+	/*
+	 * The same i/os in the order they were queued, so that the oldest
+	 * one can be found for deadline scheduling (zfs_vdev_deadline).
+	 */
+	list_t		vqc_fifo;
+
+	/* max active i/os allowed by the deadline scheduler */
+	uint32_t	vqc_limit;
 } vdev_queue_class_t;
 
 struct vdev_queue {
@@ -141,12 +167,16 @@ struct vdev_queue {
 	avl_tree_t	vq_active_tree;
 	avl_tree_t	vq_read_offset_tree;
 	avl_tree_t	vq_write_offset_tree;
+	avl_tree_t	vq_trim_offset_tree;
 	uint64_t	vq_last_offset;
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
 	uint64_t	vq_lastoffset;
+	uint64_t	vq_lat_ewma;	/* moving avg of device time (ns) */
+	uint64_t	vq_lat_samples;	/* i/os sampled into vq_lat_ewma */
+	hrtime_t	vq_dl_backoff_ts; /* last deadline limit cut */
 };
 
 /*
@@ -188,6 +218,15 @@ typedef struct vdev_indirect_config {
 	uint64_t	vic_prev_indirect_vdev;
 } vdev_indirect_config_t;
 
+/*
+ * Allocation class a top-level vdev serves, beyond the normal class.
+ * Log devices are still identified by vdev_islog.
+ */
+typedef enum vdev_alloc_bias {
+	VDEV_BIAS_NONE,
+	VDEV_BIAS_SPECIAL	/* metadata and small blocks */
+} vdev_alloc_bias_t;
+
 /*
  * Virtual device descriptor
  */
@@ -219,6 +258,8 @@ struct vdev {
 	boolean_t	vdev_expanding;	/* expand the vdev?		*/
 	boolean_t	vdev_reopening;	/* reopen in progress?		*/
 	boolean_t	vdev_nonrot;	/* true if solid state		*/
+	boolean_t	vdev_has_trim;	/* TRIM is supported		*/
+	boolean_t	vdev_has_securetrim; /* secure TRIM is supported	*/
 	int		vdev_open_error; /* error on last open		*/
 	kthread_t	*vdev_open_thread; /* thread opening children	*/
 	uint64_t	vdev_crtxg;	/* txg when top-level was added */
@@ -241,11 +282,16 @@ struct vdev {
 	list_node_t	vdev_state_dirty_node; /* state dirty list	*/
 	uint64_t	vdev_deflate_ratio; /* deflation ratio (x512)	*/
 	uint64_t	vdev_islog;	/* is an intent log device	*/
+	vdev_alloc_bias_t vdev_alloc_bias; /* metaslab class bias	*/
 	uint64_t	vdev_removing;	/* device is being removed?	*/
 	boolean_t	vdev_ishole;	/* is a hole in the namespace	*/
 	kmutex_t	vdev_queue_lock; /* protects vdev_queue_depth	*/
 	uint64_t	vdev_top_zap;
 
+	/* sorted scrub/resilver I/O queue, see dsl_scan.c */
+	kmutex_t	vdev_scan_io_queue_lock;
+	struct dsl_scan_io_queue *vdev_scan_io_queue;
+
 	/* pool checkpoint related */
 	space_map_t	*vdev_checkpoint_sm;	/* contains reserved blocks */
 	
@@ -267,6 +313,32 @@ struct vdev {
 	kcondvar_t	vdev_initialize_io_cv;
 	uint64_t	vdev_initialize_inflight;
 
+	/* TRIM related */
+	boolean_t	vdev_trim_exit_wanted;
+	boolean_t	vdev_autotrim_exit_wanted;
+	vdev_trim_state_t	vdev_trim_state;
+	kthread_t	*vdev_trim_thread;
+	kthread_t	*vdev_autotrim_thread;
+	/* Protects vdev_trim_thread and vdev_trim_state. */
+	kmutex_t	vdev_trim_lock;
+	kcondvar_t	vdev_trim_cv;
+	/* Protects vdev_autotrim_thread. */
+	kmutex_t	vdev_autotrim_lock;
+	kcondvar_t	vdev_autotrim_cv;
+	uint64_t	vdev_trim_offset[TXG_SIZE];
+	uint64_t	vdev_trim_last_offset;
+	uint64_t	vdev_trim_bytes_est;
+	uint64_t	vdev_trim_bytes_done;
+	uint64_t	vdev_trim_rate;		/* requested rate (bytes/sec) */
+	uint64_t	vdev_trim_partial;	/* requested partial TRIM */
+	uint64_t	vdev_trim_secure;	/* requested secure TRIM */
+	time_t		vdev_trim_action_time;	/* start and end time */
+
+	/* for limiting outstanding TRIMs */
+	kmutex_t	vdev_trim_io_lock;
+	kcondvar_t	vdev_trim_io_cv;
+	uint64_t	vdev_trim_inflight[2];	/* manual, automatic */
+
 	/*
 	 * Values stored in the config for an indirect or removing vdev.
 	 */
@@ -478,6 +550,14 @@ extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
 
+/*
+ * Leaf vdev i/o straight into scattered ABDs
+ */
+#define	VDEV_MAX_SEGS	256
+extern int vdev_io_borrow_segs(zio_t *zio, struct abd_seg *segs,
+    int maxsegs);
+extern void vdev_io_return_segs(zio_t *zio);
+
 /*
  * Global variables
  */
@@ -0,0 +1,139 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VDEV_RAIDZ_IMPL_H
+#define	_SYS_VDEV_RAIDZ_IMPL_H
+
+#include <sys/types.h>
+#include <sys/simd.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
+#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
+
+/*
+ * We provide a mechanism to perform the field multiplication operation on a
+ * 64-bit value all at once rather than a byte at a time. This works by
+ * creating a mask from the top bit in each byte and using that to
+ * conditionally apply the XOR of 0x1d.
+ */
+#define	VDEV_RAIDZ_64MUL_2(x, mask) \
+{ \
+	(mask) = (x) & 0x8080808080808080ULL; \
+	(mask) = ((mask) << 1) - ((mask) >> 7); \
+	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
+	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
+}
+
+#define	VDEV_RAIDZ_64MUL_4(x, mask) \
+{ \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+	VDEV_RAIDZ_64MUL_2((x), mask); \
+}
+
+/*
+ * Vectorized implementations process RAIDZ_MATH_ALIGN bytes per iteration
+ * and are only ever handed multiples of it; the remainder of a buffer is
+ * finished by the scalar code.
+ */
+#define	RAIDZ_MATH_ALIGN	64
+
+/*
+ * Buffer primitives every RAID-Z math backend provides. All parity
+ * generation and reconstruction in vdev_raidz.c is expressed in terms of
+ * these; 'c' is a Galois field constant, not a logarithm, and field
+ * addition is XOR.
+ *
+ *	add		dst ^= src
+ *	gen_pq		p ^= src, q = 2 * q ^ src
+ *	gen_pqr		p ^= src, q = 2 * q ^ src, r = 4 * r ^ src
+ *	mul2		dst = 2 * dst
+ *	mul2_add	dst = 2 * dst ^ src
+ *	mul		dst = c * src (dst may equal src)
+ *	mul_add		dst ^= c * src
+ *
+ * Vectorized backends do not save the vector state themselves; callers
+ * bracket them with vdev_raidz_math_begin()/vdev_raidz_math_end().
+ */
+typedef struct raidz_impl_ops {
+	void (*add)(void *dst, const void *src, size_t size);
+	void (*gen_pq)(void *p, void *q, const void *src, size_t size);
+	void (*gen_pqr)(void *p, void *q, void *r, const void *src,
+	    size_t size);
+	void (*mul2)(void *dst, size_t size);
+	void (*mul2_add)(void *dst, const void *src, size_t size);
+	void (*mul)(void *dst, const void *src, uint8_t c, size_t size);
+	void (*mul_add)(void *dst, const void *src, uint8_t c, size_t size);
+	boolean_t (*valid)(void);
+	const char *name;
+} raidz_impl_ops_t;
+
+extern const raidz_impl_ops_t vdev_raidz_scalar_impl;
+extern const raidz_impl_ops_t vdev_raidz_sse2_impl;
+extern const raidz_impl_ops_t vdev_raidz_ssse3_impl;
+extern const raidz_impl_ops_t vdev_raidz_avx2_impl;
+extern const raidz_impl_ops_t vdev_raidz_avx512bw_impl;
+
+/*
+ * Multiplication by a constant is done with two 16-entry tables, indexed
+ * by the low and high nibble of each byte: c * x = lo[x & 15] ^ hi[x >> 4].
+ */
+extern uint8_t vdev_raidz_gf_mul(uint8_t a, uint8_t b);
+extern void vdev_raidz_mul_tables(uint8_t c, uint8_t *lo, uint8_t *hi);
+
+/*
+ * Dispatch to the selected backend, see vdev_raidz_math.c. A whole parity
+ * generation or reconstruction runs between one vdev_raidz_math_begin()
+ * and vdev_raidz_math_end(), so the vector state is saved once per
+ * operation rather than once per ABD chunk; the caller must not sleep in
+ * between.
+ */
+typedef struct raidz_math {
+	const raidz_impl_ops_t	*rzm_ops;
+	kfpu_state_t		rzm_fpu;
+} raidz_math_t;
+
+extern void vdev_raidz_math_begin(raidz_math_t *rzm);
+extern void vdev_raidz_math_end(raidz_math_t *rzm);
+
+extern void vdev_raidz_math_add(const raidz_math_t *rzm, void *dst,
+    const void *src, size_t size);
+extern void vdev_raidz_math_gen_pq(const raidz_math_t *rzm, void *p,
+    void *q, const void *src, size_t size);
+extern void vdev_raidz_math_gen_pqr(const raidz_math_t *rzm, void *p,
+    void *q, void *r, const void *src, size_t size);
+extern void vdev_raidz_math_mul2(const raidz_math_t *rzm, void *dst,
+    size_t size);
+extern void vdev_raidz_math_mul2_add(const raidz_math_t *rzm, void *dst,
+    const void *src, size_t size);
+extern void vdev_raidz_math_mul(const raidz_math_t *rzm, void *dst,
+    const void *src, uint8_t c, size_t size);
+extern void vdev_raidz_math_mul_add(const raidz_math_t *rzm, void *dst,
+    const void *src, uint8_t c, size_t size);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_VDEV_RAIDZ_IMPL_H */
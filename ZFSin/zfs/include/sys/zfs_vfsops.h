@@ -119,6 +119,7 @@ struct zfsvfs {
         uint64_t	    z_groupquota_obj;
         uint64_t	    z_replay_eof;	/* New end of file - replay only */
         sa_attr_type_t  *z_attr_table;  /* SA attr mapping->id */
+	uint64_t	z_mdl_loans;	/* outstanding zfs_mdl_read() loans */
 #define ZFS_OBJ_MTX_SZ  256
         kmutex_t        z_hold_mtx[ZFS_OBJ_MTX_SZ];     /* znode hold locks */
 };
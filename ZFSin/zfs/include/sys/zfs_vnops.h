@@ -137,6 +137,9 @@ extern int    zfs_ioctl  ( vnode_t *vp, u_long com, intptr_t data, int flag,
                            cred_t *cred, int *rvalp, caller_context_t *ct);
 extern int    zfs_read   ( vnode_t *vp, uio_t *uio, int ioflag,
                            cred_t *cr, caller_context_t *ct);
+extern int    zfs_read_loan( vnode_t *vp, uint64_t offset, uint64_t size,
+                           void (*done)(struct dmu_loan *, void *), void *arg,
+                           struct dmu_loan **loanp);
 extern int    zfs_write  ( vnode_t *vp, uio_t *uio, int ioflag,
                            cred_t *cr, caller_context_t *ct);
 extern int    zfs_lookup ( vnode_t *dvp, char *nm, vnode_t **vpp,
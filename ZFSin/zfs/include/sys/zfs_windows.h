@@ -64,6 +64,12 @@ NTSTATUS zfsdev_open(dev_t dev, PIRP Irp);
 NTSTATUS zfsdev_release(dev_t dev, PIRP Irp);
 
 int zfs_vnop_recycle(znode_t *zp, int force);
+
+void zfs_mdl_loan_init(void);
+void zfs_mdl_loan_fini(void);
+void zfs_mdl_loan_drain(zfsvfs_t *zfsvfs);
+NTSTATUS zfs_mdl_read(struct vnode *vp, uint64_t offset, ULONG length, PIRP Irp);
+boolean_t zfs_mdl_read_complete(PMDL mdl);
 uint64_t zfs_blksz(znode_t *zp);
 
 int zfs_vnop_mount(PDEVICE_OBJECT DiskDevice, PIRP Irp, PIO_STACK_LOCATION IrpSp);
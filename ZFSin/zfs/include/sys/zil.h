@@ -212,6 +212,17 @@ typedef struct {
 	/* remainder of array and any additional fields */
 } lr_attr_t;
 
+/*
+ * The lr_foid of a create record also carries the number of dnode slots
+ * the new object consumes, so that replay recreates it with the same
+ * dnode size.  The slot count is stored minus one in the upper bits,
+ * which leaves records written before large dnodes decoding as one slot.
+ */
+#define	LR_FOID_GET_SLOTS(oid) (BF64_GET((oid), 56, 8) + 1)
+#define	LR_FOID_SET_SLOTS(oid, x) BF64_SET((oid), 56, 8, (x) - 1)
+#define	LR_FOID_GET_OBJ(oid) BF64_GET((oid), 0, DN_MAX_OBJECT_SHIFT)
+#define	LR_FOID_SET_OBJ(oid, x) BF64_SET((oid), 0, DN_MAX_OBJECT_SHIFT, (x))
+
 /*
  * log record for creates without optional ACL.
  * This log record does support optional xvattr_t attributes.
@@ -377,6 +388,7 @@ typedef struct itx {
 	void            *itx_callback_data; /* User data for the callback */
 	size_t          itx_size;       /* allocated itx structure size */
 	uint64_t	itx_oid;	/* object id */
+	uint64_t	itx_seq;	/* assignment order, see zil_itx_assign */
 	lr_t		itx_lr;		/* common part of log record */
 	/* followed by type-specific part of lr_xx_t and its immediate data */
 } itx_t;
@@ -146,6 +146,23 @@ typedef struct itxg {
 	itxs_t		*itxg_itxs;	/* sync and async itxs */
 } itxg_t;
 
+/*
+ * The itxgs are kept per CPU, so that zil_itx_assign() only takes a lock
+ * private to the calling CPU. Each itx is stamped with the next zl_itx_seq
+ * while that lock is held, which keeps every list of an itxg sorted by
+ * itx_seq; the lists of all CPUs are merged back into assignment order
+ * when the itxs are committed. zl_itx_seq itself is still shared by all
+ * CPUs, as it is what orders itxs assigned on different CPUs.
+ */
+typedef struct itxg_cpu {
+	itxg_t		ic_itxg[TXG_SIZE];
+	list_t		ic_commit_list;	/* zil_get_commit_list() scratch */
+	uint64_t	ic_pad[8];	/* keep CPUs off each other's lines */
+} itxg_cpu_t;
+
+#define	ZIL_ITXG(zilog, c, txg)	\
+	(&(zilog)->zl_itxg_cpu[(c)].ic_itxg[(txg) & TXG_MASK])
+
 /* for async nodes we build up an AVL tree of lists of async itxs per file */
 typedef struct itx_async_node {
 	uint64_t	ia_foid;	/* file object id */
@@ -195,7 +212,12 @@ struct zilog {
 	uint64_t	zl_parse_lr_seq; /* highest lr seq on last parse */
 	uint64_t	zl_parse_blk_count; /* number of blocks parsed */
 	uint64_t	zl_parse_lr_count; /* number of log records parsed */
-	itxg_t		zl_itxg[TXG_SIZE]; /* intent log txg chains */
+	itxg_cpu_t	*zl_itxg_cpu;	/* per-CPU intent log txg chains */
+	int		zl_itxg_ncpu;	/* number of zl_itxg_cpu entries */
+	uint64_t	zl_itx_pad0[8];	/* zl_itx_seq on a line of its own */
+	uint64_t	zl_itx_seq;	/* last itx_seq handed out */
+	uint64_t	zl_itx_pad1[7];
+	list_t		**zl_itxg_lists; /* zil_get_commit_list() scratch */
 	list_t		zl_itx_commit_list; /* itx list to be committed */
 	uint64_t	zl_cur_used;	/* current commit log size used */
 	list_t		zl_lwb_list;	/* in-flight log write list */
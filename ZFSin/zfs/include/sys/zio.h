@@ -213,6 +213,13 @@ enum zio_flag {
 	ZIO_FLAG_FASTWRITE	= 1ULL << 31,
 };
 
+/*
+ * Flags for TRIM zios, passed through to the leaf vdev.
+ */
+enum trim_flag {
+	ZIO_TRIM_SECURE		= 1 << 0,
+};
+
 #define	ZIO_FLAG_MUSTSUCCEED		0
 #define ZIO_FLAG_FAILFAST               0x00002
 #define ZIO_FLAG_RAW    (ZIO_FLAG_RAW_COMPRESS | ZIO_FLAG_RAW_ENCRYPT)
@@ -264,6 +271,7 @@ enum zio_wait_type {
 typedef void zio_done_func_t(zio_t *zio);
 
 extern boolean_t zio_dva_throttle_enabled;
+extern int zio_stage_stats;
 extern const char *zio_type_name[ZIO_TYPES];
 
 /*
@@ -325,6 +333,7 @@ typedef struct zio_prop {
 	dmu_object_type_t	zp_type;
 	uint8_t			zp_level;
 	uint8_t			zp_copies;
+	uint32_t		zp_zpl_smallblk;
 	boolean_t		zp_dedup;
 	boolean_t		zp_dedup_verify;
 	boolean_t		zp_nopwrite;
@@ -420,6 +429,7 @@ struct zio {
 	enum zio_child	io_child_type;
 	int		io_cmd;
 	zio_priority_t	io_priority;
+	enum trim_flag	io_trim_flags;
 	uint8_t		io_reexecute;
 	uint8_t		io_state[ZIO_WAIT_TYPES];
 	uint64_t	io_txg;
@@ -463,6 +473,7 @@ struct zio {
 					/* file). */
 	avl_node_t	io_queue_node;
 	avl_node_t	io_offset_node;
+	list_node_t	io_fifo_node;	/* vqc_fifo, while queued */
 	avl_node_t	io_alloc_node;
 	zio_alloc_list_t 	io_alloc_list;
 
@@ -474,6 +485,8 @@ struct zio {
 	enum zio_stage	io_orig_stage;
 	enum zio_stage	io_orig_pipeline;
 	enum zio_stage	io_pipeline_trace;
+	enum zio_stage	io_stage_last;	/* stage timed by zio_stage_stats */
+	hrtime_t	io_stage_ts;	/* when io_stage_last was entered */
 	int		io_error;
 	int		io_child_error[ZIO_CHILD_TYPES];
 	uint64_t	io_children[ZIO_CHILD_TYPES][ZIO_WAIT_TYPES];
@@ -488,6 +501,7 @@ struct zio {
 	kmutex_t	io_lock;
 	kcondvar_t	io_cv;
 	int		io_allocator;
+	metaslab_class_t *io_metaslab_class;	/* dva throttle class */
 
 	/* FMA state */
 	zio_cksum_report_t *io_cksum_report;
@@ -532,6 +546,10 @@ extern zio_t *zio_claim(zio_t *pio, spa_t *spa, uint64_t txg,
 extern zio_t *zio_ioctl(zio_t *pio, spa_t *spa, vdev_t *vd, int cmd,
     zio_done_func_t *done, void *_private, enum zio_flag flags);
 
+extern zio_t *zio_trim(zio_t *pio, vdev_t *vd, uint64_t offset, uint64_t size,
+    zio_done_func_t *done, void *_private, zio_priority_t priority,
+    enum zio_flag flags, enum trim_flag trim_flags);
+
 extern zio_t *zio_read_phys(zio_t *pio, vdev_t *vd, uint64_t offset,
     uint64_t size, struct abd *data, int checksum,
     zio_done_func_t *done, void *_private, zio_priority_t priority,
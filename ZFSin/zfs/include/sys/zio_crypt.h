@@ -142,4 +142,7 @@ int zio_do_crypt_abd(boolean_t encrypt, zio_crypt_key_t *key,
     uint8_t *mac, uint_t datalen, abd_t *pabd, abd_t *cabd,
     boolean_t *no_crypt);
 
+void zio_crypt_init(void);
+void zio_crypt_fini(void);
+
 #endif
@@ -154,6 +154,16 @@ enum zio_stage {
 	ZIO_STAGE_DONE			= 1 << 24	/* RWFCI */
 };
 
+#define	ZIO_STAGES			25
+
+/*
+ * Stage slots tracked by zio_stage_stats: one per pipeline stage, indexed
+ * by highbit64(stage) - 1, plus a pseudo-stage for the time a leaf vdev
+ * I/O spends waiting in the vdev queue.
+ */
+#define	ZIO_STAGE_STAT_QUEUE		ZIO_STAGES
+#define	ZIO_STAGE_STATS			(ZIO_STAGES + 1)
+
 #define	ZIO_INTERLOCK_STAGES			\
 	(ZIO_STAGE_READY |			\
 	ZIO_STAGE_DONE)
@@ -253,6 +263,11 @@ enum zio_stage {
 	ZIO_STAGE_VDEV_IO_START |		\
 	ZIO_STAGE_VDEV_IO_ASSESS)
 
+#define	ZIO_TRIM_PIPELINE			\
+	(ZIO_INTERLOCK_STAGES |			\
+	ZIO_STAGE_ISSUE_ASYNC |			\
+	ZIO_VDEV_IO_STAGES)
+
 #define	ZIO_BLOCKING_STAGES			\
 	(ZIO_STAGE_DVA_ALLOCATE |		\
 	ZIO_STAGE_DVA_CLAIM |			\
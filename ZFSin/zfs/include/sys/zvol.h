@@ -150,6 +150,9 @@ extern int zvol_read_iokit(zvol_state_t *zv, uint64_t offset,
 
 extern int zvol_write_iokit(zvol_state_t *zv, uint64_t offset,
     uint64_t count, struct iomem *iomem);
+extern int zvol_read_loan(zvol_state_t *zv, uint64_t offset, uint64_t size,
+    void (*done)(struct dmu_loan *, void *), void *arg,
+    struct dmu_loan **loanp);
 extern int zvol_unmap(zvol_state_t *zv, uint64_t off, uint64_t bytes);
 
 extern void zvol_add_symlink(zvol_state_t *zv, const char *bsd_disk,
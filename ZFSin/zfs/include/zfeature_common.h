@@ -59,6 +59,9 @@ typedef enum spa_feature {
 	SPA_FEATURE_OBSOLETE_COUNTS,
 	SPA_FEATURE_POOL_CHECKPOINT,
 	SPA_FEATURE_SPACEMAP_V2,
+	SPA_FEATURE_ALLOCATION_CLASSES,
+	SPA_FEATURE_LOG_SPACEMAP,
+	SPA_FEATURE_LARGE_DNODE,
 	SPA_FEATURES
 } spa_feature_t;
 
@@ -51,6 +51,76 @@ void fletcher_4_native(const void *, size_t, const void *, zio_cksum_t *);
 void fletcher_4_byteswap(const void *, size_t, const void *, zio_cksum_t *);
 int fletcher_4_incremental_native(void *, size_t, void *);
 int fletcher_4_incremental_byteswap(void *, size_t, void *);
+int fletcher_4_impl_set(uint64_t);
+const char *fletcher_4_impl_name(void);
+void fletcher_4_init(void);
+void fletcher_4_fini(void);
+
+/*
+ * Incremental updates are combined from independent chunk checksums. The
+ * combine factors overflow for chunks approaching 16MiB, so larger buffers
+ * are processed in steps of this size.
+ */
+#define	ZFS_FLETCHER_4_INC_MAX_SIZE	(1ULL << 23)
+
+/*
+ * Vectorized fletcher4 keeps several independent streams of a/b/c/d
+ * accumulators, one per vector lane. The lanes are only mixed back into a
+ * single checksum in the fini step. Lane storage is kept unaligned so the
+ * context can live on any stack; the compute routines use unaligned
+ * loads and stores when spilling to it.
+ */
+typedef struct zfs_fletcher_superscalar {
+	uint64_t v[4];
+} zfs_fletcher_superscalar_t;
+
+typedef struct zfs_fletcher_sse {
+	uint64_t v[2];
+} zfs_fletcher_sse_t;
+
+typedef struct zfs_fletcher_avx {
+	uint64_t v[4];
+} zfs_fletcher_avx_t;
+
+typedef struct zfs_fletcher_avx512 {
+	uint64_t v[8];
+} zfs_fletcher_avx512_t;
+
+typedef union fletcher_4_ctx {
+	zio_cksum_t scalar;
+	zfs_fletcher_superscalar_t superscalar[4];
+	zfs_fletcher_sse_t sse[4];
+	zfs_fletcher_avx_t avx[4];
+	zfs_fletcher_avx512_t avx512[4];
+} fletcher_4_ctx_t;
+
+typedef void (*fletcher_4_init_f)(fletcher_4_ctx_t *);
+typedef void (*fletcher_4_fini_f)(fletcher_4_ctx_t *, zio_cksum_t *);
+typedef void (*fletcher_4_compute_f)(fletcher_4_ctx_t *,
+    const void *, uint64_t);
+
+/*
+ * The compute callbacks of vectorized implementations do not save the
+ * vector state themselves; zfs_fletcher.c brackets them with
+ * kfpu_begin()/kfpu_end().
+ */
+typedef struct fletcher_4_ops {
+	fletcher_4_init_f init_native;
+	fletcher_4_fini_f fini_native;
+	fletcher_4_compute_f compute_native;
+	fletcher_4_init_f init_byteswap;
+	fletcher_4_fini_f fini_byteswap;
+	fletcher_4_compute_f compute_byteswap;
+	boolean_t (*valid)(void);
+	const char *name;
+} fletcher_4_ops_t;
+
+extern const fletcher_4_ops_t fletcher_4_superscalar_ops;
+extern const fletcher_4_ops_t fletcher_4_superscalar4_ops;
+extern const fletcher_4_ops_t fletcher_4_sse2_ops;
+extern const fletcher_4_ops_t fletcher_4_ssse3_ops;
+extern const fletcher_4_ops_t fletcher_4_avx2_ops;
+extern const fletcher_4_ops_t fletcher_4_avx512f_ops;
 
 #ifdef	__cplusplus
 }
@@ -248,6 +248,11 @@ void
 kstat_named_init(kstat_named_t *knp, const char *name, uchar_t type)
 {}
 
+/*ARGSUSED*/
+void
+kstat_named_setstr(kstat_named_t *knp, const char *src)
+{}
+
 /*ARGSUSED*/
 void
 kstat_install(kstat_t *ksp)
@@ -0,0 +1,95 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AES block encryption and decryption with the AES-NI instructions.
+ *
+ * The round keys are the FIPS-197 key schedule stored as byte strings,
+ * sixteen bytes per round, which aes_impl.c derives from the generic key
+ * expansion. AES-NI decrypts with the "equivalent inverse cipher", so the
+ * decryption schedule is the encryption schedule in reverse order with
+ * InvMixColumns applied to every round key but the first and the last.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+
+#if defined(HAVE_SIMD_X86)
+
+void
+aes_key_setup_dec_intel(uint32_t dk[], const uint32_t ek[], int Nr)
+{
+	const __m128i *e = (const __m128i *)ek;
+	__m128i *d = (__m128i *)dk;
+	int r;
+
+	kfpu_sse_begin();
+	_mm_storeu_si128(&d[0], _mm_loadu_si128(&e[Nr]));
+	for (r = 1; r < Nr; r++)
+		_mm_storeu_si128(&d[r],
+		    _mm_aesimc_si128(_mm_loadu_si128(&e[Nr - r])));
+	_mm_storeu_si128(&d[Nr], _mm_loadu_si128(&e[0]));
+	kfpu_sse_end();
+}
+
+/*
+ * Encrypt one block. pt and ct may overlap and need not be aligned.
+ */
+void
+aes_encrypt_intel(const uint32_t rk[], int Nr, const uint32_t pt[4],
+    uint32_t ct[4])
+{
+	const __m128i *k = (const __m128i *)rk;
+	__m128i s;
+	int r;
+
+	kfpu_sse_begin();
+	s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)pt),
+	    _mm_loadu_si128(&k[0]));
+	for (r = 1; r < Nr; r++)
+		s = _mm_aesenc_si128(s, _mm_loadu_si128(&k[r]));
+	s = _mm_aesenclast_si128(s, _mm_loadu_si128(&k[Nr]));
+	_mm_storeu_si128((__m128i *)ct, s);
+	kfpu_sse_end();
+}
+
+/*
+ * Decrypt one block with the schedule from aes_key_setup_dec_intel().
+ */
+void
+aes_decrypt_intel(const uint32_t rk[], int Nr, const uint32_t ct[4],
+    uint32_t pt[4])
+{
+	const __m128i *k = (const __m128i *)rk;
+	__m128i s;
+	int r;
+
+	kfpu_sse_begin();
+	s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)ct),
+	    _mm_loadu_si128(&k[0]));
+	for (r = 1; r < Nr; r++)
+		s = _mm_aesdec_si128(s, _mm_loadu_si128(&k[r]));
+	s = _mm_aesdeclast_si128(s, _mm_loadu_si128(&k[Nr]));
+	_mm_storeu_si128((__m128i *)pt, s);
+	kfpu_sse_end();
+}
+
+#endif /* HAVE_SIMD_X86 */
@@ -26,10 +26,16 @@
 #include <sys/crypto/spi.h>
 #include <modes/modes.h>
 #include <aes/aes_impl.h>
+#include <sys/crypto/icp.h>
 
 #ifdef _WIN32
 // No assembler for now
 #undef __amd64
+/* AES-NI is reached through compiler intrinsics instead, see aes_aesni.c */
+#include <sys/simd.h>
+#ifdef HAVE_SIMD_X86
+#define	HAVE_AES_INTEL
+#endif
 #endif
 
 #ifdef __amd64
@@ -119,6 +125,27 @@ static int intel_aes_instructions_present(void);
 #define	AES_BYTE_SWAP
 #endif
 
+#ifdef HAVE_AES_INTEL
+/*
+ * These functions execute the AES-NI instructions on a byte-order key
+ * schedule, kept next to the generic one in the same aes_key_t:
+ */
+extern void aes_key_setup_dec_intel(uint32_t dk[], const uint32_t ek[],
+	int Nr);
+extern void aes_encrypt_intel(const uint32_t rk[], int Nr,
+	const uint32_t pt[4], uint32_t ct[4]);
+extern void aes_decrypt_intel(const uint32_t rk[], int Nr,
+	const uint32_t ct[4], uint32_t pt[4]);
+
+static int intel_aes_instructions_present(void);
+#endif	/* HAVE_AES_INTEL */
+
+/*
+ * Implementation used for new key schedules: 0 picks AES-NI when the CPU
+ * has it, 1 forces the generic C code and 2 requires AES-NI.
+ */
+uint64_t icp_aes_impl = AES_IMPL_FASTEST;
+
 
 #if !defined(__amd64)
 /*
@@ -1114,7 +1141,37 @@ aes_setupkeys(aes_key_t *key, const uint32_t *keyarr32, int keybits)
 	key->nr = rijndael_key_setup_dec(&(key->decr_ks.ks32[0]), keyarr32,
 	    keybits);
 	key->type = AES_32BIT_KS;
+#ifdef HAVE_AES_INTEL
+	key->flags = 0;
+#endif
+}
+
+#ifdef HAVE_AES_INTEL
+/*
+ * Expand the key schedules for AES-NI. The instructions use the FIPS-197
+ * schedule as byte strings, which is the generic expansion with every
+ * 32-bit word stored big-endian.
+ *
+ * Parameters:
+ * key		AES key schedule to be initialized
+ * keyarr32	User key, byte-swapped as for aes_setupkeys()
+ * keyBits	AES key size (128, 192, or 256 bits)
+ */
+static void
+aes_setupkeys_intel(aes_key_t *key, const uint32_t *keyarr32, int keybits)
+{
+	uint32_t rk[((MAX_AES_NR) + 1) * (MAX_AES_NB)];
+	int i;
+
+	key->nr = rijndael_key_setup_enc(rk, keyarr32, keybits);
+	for (i = 0; i < 4 * (key->nr + 1); i++)
+		key->encr_ks.ks32[i] = htonl(rk[i]);
+	aes_key_setup_dec_intel(&(key->decr_ks.ks32[0]),
+	    &(key->encr_ks.ks32[0]), key->nr);
+	key->type = AES_32BIT_KS;
+	key->flags = INTEL_AES_NI_CAPABLE;
 }
+#endif	/* HAVE_AES_INTEL */
 
 
 /*
@@ -1436,6 +1493,12 @@ aes_init_keysched(const uint8_t *cipherKey, uint_t keyBits, void *keysched)
 	}
 #endif
 
+#ifdef HAVE_AES_INTEL
+	if (intel_aes_instructions_present()) {
+		aes_setupkeys_intel(newbie, keyarr.ka32, keyBits);
+		return;
+	}
+#endif
 	aes_setupkeys(newbie, keyarr.ka32, keyBits);
 }
 
@@ -1454,6 +1517,15 @@ aes_encrypt_block(const void *ks, const uint8_t *pt, uint8_t *ct)
 {
 	aes_key_t	*ksch = (aes_key_t *)ks;
 
+#ifdef	HAVE_AES_INTEL
+	/* AES-NI loads and stores the block unaligned, in byte order */
+	if (ksch->flags & INTEL_AES_NI_CAPABLE) {
+		aes_encrypt_intel(&ksch->encr_ks.ks32[0], ksch->nr,
+		    (const uint32_t *)pt, (uint32_t *)ct);
+		return (CRYPTO_SUCCESS);
+	}
+#endif
+
 #ifndef	AES_BYTE_SWAP
 	if (IS_P2ALIGNED2(pt, ct, sizeof (uint32_t))) {
 		/* LINTED:  pointer alignment */
@@ -1507,6 +1579,14 @@ aes_decrypt_block(const void *ks, const uint8_t *ct, uint8_t *pt)
 {
 	aes_key_t	*ksch = (aes_key_t *)ks;
 
+#ifdef	HAVE_AES_INTEL
+	if (ksch->flags & INTEL_AES_NI_CAPABLE) {
+		aes_decrypt_intel(&ksch->decr_ks.ks32[0], ksch->nr,
+		    (const uint32_t *)ct, (uint32_t *)pt);
+		return (CRYPTO_SUCCESS);
+	}
+#endif
+
 #ifndef	AES_BYTE_SWAP
 	if (IS_P2ALIGNED2(ct, pt, sizeof (uint32_t))) {
 		/* LINTED:  pointer alignment */
@@ -1621,3 +1701,51 @@ intel_aes_instructions_present(void)
 }
 
 #endif	/* __amd64 */
+
+#ifdef HAVE_AES_INTEL
+
+/*
+ * Return 1 if new key schedules should use the AES-NI instructions,
+ * otherwise 0. The CPUID check is cached, as the CPU can't change.
+ */
+static int
+intel_aes_instructions_present(void)
+{
+	static int cached_result = -1;
+
+	if (cached_result == -1)
+		cached_result = !!zfs_aes_available();
+
+	return (cached_result && icp_aes_impl != AES_IMPL_GENERIC);
+}
+
+#endif	/* HAVE_AES_INTEL */
+
+/*
+ * Select the AES implementation for key schedules created from now on;
+ * existing schedules keep the one they were built for.
+ */
+int
+aes_impl_set(uint64_t id)
+{
+	if (id > AES_IMPL_AESNI)
+		return (EINVAL);
+#ifdef HAVE_AES_INTEL
+	if (id == AES_IMPL_AESNI && !zfs_aes_available())
+		return (ENOTSUP);
+	icp_aes_impl = id;
+	return (0);
+#else
+	return (id == AES_IMPL_AESNI ? ENOTSUP : 0);
+#endif
+}
+
+const char *
+aes_impl_name(void)
+{
+#ifdef HAVE_AES_INTEL
+	if (intel_aes_instructions_present())
+		return ("aesni");
+#endif
+	return ("generic");
+}
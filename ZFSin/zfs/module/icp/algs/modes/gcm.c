@@ -27,10 +27,16 @@
 #include <sys/crypto/common.h>
 #include <sys/crypto/impl.h>
 #include <sys/byteorder.h>
+#include <sys/crypto/icp.h>
 
 #ifdef _WIN32
 // No assembler for now
 #undef __amd64
+/* PCLMULQDQ is reached through compiler intrinsics, see gcm_pclmulqdq.c */
+#include <sys/simd.h>
+#ifdef HAVE_SIMD_X86
+#define	HAVE_GCM_PCLMULQDQ
+#endif
 #endif
 
 #ifdef __amd64
@@ -45,10 +51,24 @@
 #define	KPREEMPT_ENABLE
 #endif	/* _KERNEL */
 
+extern void gcm_mul_pclmulqdq(uint64_t *x_in, uint64_t *y, uint64_t *res);
+static int intel_pclmulqdq_instruction_present(void);
+
+#elif defined(HAVE_GCM_PCLMULQDQ)
+
+#define	KPREEMPT_DISABLE	kfpu_sse_begin()
+#define	KPREEMPT_ENABLE		kfpu_sse_end()
+
 extern void gcm_mul_pclmulqdq(uint64_t *x_in, uint64_t *y, uint64_t *res);
 static int intel_pclmulqdq_instruction_present(void);
 #endif	/* __amd64 */
 
+/*
+ * GHASH implementation: 0 picks PCLMULQDQ when the CPU has it, 1 forces
+ * the generic C code and 2 requires PCLMULQDQ.
+ */
+uint64_t icp_gcm_impl = GCM_IMPL_FASTEST;
+
 struct aes_block {
 	uint64_t a;
 	uint64_t b;
@@ -68,13 +88,13 @@ struct aes_block {
 void
 gcm_mul(uint64_t *x_in, uint64_t *y, uint64_t *res)
 {
-#ifdef __amd64
+#if defined(__amd64) || defined(HAVE_GCM_PCLMULQDQ)
 	if (intel_pclmulqdq_instruction_present()) {
 		KPREEMPT_DISABLE;
 		gcm_mul_pclmulqdq(x_in, y, res);
 		KPREEMPT_ENABLE;
 	} else
-#endif	/* __amd64 */
+#endif	/* __amd64 || HAVE_GCM_PCLMULQDQ */
 	{
 		static const uint64_t R = 0xe100000000000000ULL;
 		struct aes_block z = {0, 0};
@@ -751,3 +771,50 @@ intel_pclmulqdq_instruction_present(void)
 }
 
 #endif	/* __amd64 */
+
+#ifdef HAVE_GCM_PCLMULQDQ
+
+/*
+ * Return 1 if GHASH should use the PCLMULQDQ instruction, otherwise 0.
+ * The byte reflection also needs SSSE3. Cache the CPUID check, as the
+ * CPU can't change.
+ */
+static int
+intel_pclmulqdq_instruction_present(void)
+{
+	static int cached_result = -1;
+
+	if (cached_result == -1)
+		cached_result = zfs_pclmulqdq_available() &&
+		    zfs_ssse3_available();
+
+	return (cached_result && icp_gcm_impl != GCM_IMPL_GENERIC);
+}
+
+#endif	/* HAVE_GCM_PCLMULQDQ */
+
+int
+gcm_impl_set(uint64_t id)
+{
+	if (id > GCM_IMPL_PCLMULQDQ)
+		return (EINVAL);
+#ifdef HAVE_GCM_PCLMULQDQ
+	if (id == GCM_IMPL_PCLMULQDQ &&
+	    !(zfs_pclmulqdq_available() && zfs_ssse3_available()))
+		return (ENOTSUP);
+	icp_gcm_impl = id;
+	return (0);
+#else
+	return (id == GCM_IMPL_PCLMULQDQ ? ENOTSUP : 0);
+#endif
+}
+
+const char *
+gcm_impl_name(void)
+{
+#ifdef HAVE_GCM_PCLMULQDQ
+	if (intel_pclmulqdq_instruction_present())
+		return ("pclmulqdq");
+#endif
+	return ("generic");
+}
@@ -0,0 +1,88 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * GHASH multiplication with the PCLMULQDQ carry-less multiply.
+ *
+ * GCM numbers are bit-reflected, so the operands are byte-swapped into
+ * little-endian order and the 256-bit product of the four 64x64 bit
+ * multiplies is shifted left by one bit before being reduced modulo
+ * x^128 + x^7 + x^2 + x + 1, following Gueron and Kounavis, "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing the
+ * GCM Mode".
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+
+#if defined(HAVE_SIMD_X86)
+
+/*
+ * Same contract as gcm_mul(): x_in, y and res point to 16-byte numbers
+ * in GCM byte order.
+ */
+void
+gcm_mul_pclmulqdq(uint64_t *x_in, uint64_t *y, uint64_t *res)
+{
+	__m128i bswap, a, b, lo, mid, hi, t0, t1, t2;
+
+	kfpu_sse_begin();
+	bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+	    8, 9, 10, 11, 12, 13, 14, 15);
+	a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)x_in), bswap);
+	b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)y), bswap);
+
+	/* 256-bit product in hi:lo */
+	lo = _mm_clmulepi64_si128(a, b, 0x00);
+	hi = _mm_clmulepi64_si128(a, b, 0x11);
+	mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10),
+	    _mm_clmulepi64_si128(a, b, 0x01));
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	/* Shift hi:lo left by one bit to undo the bit reflection */
+	t0 = _mm_srli_epi32(lo, 31);
+	t1 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t2 = _mm_srli_si128(t0, 12);
+	t1 = _mm_slli_si128(t1, 4);
+	t0 = _mm_slli_si128(t0, 4);
+	lo = _mm_or_si128(lo, t0);
+	hi = _mm_or_si128(hi, _mm_or_si128(t1, t2));
+
+	/* Reduce: first phase folds the low 32 bits of each lane */
+	t0 = _mm_xor_si128(_mm_slli_epi32(lo, 31),
+	    _mm_xor_si128(_mm_slli_epi32(lo, 30), _mm_slli_epi32(lo, 25)));
+	t1 = _mm_srli_si128(t0, 4);
+	lo = _mm_xor_si128(lo, _mm_slli_si128(t0, 12));
+
+	/* Second phase */
+	t0 = _mm_xor_si128(_mm_srli_epi32(lo, 1),
+	    _mm_xor_si128(_mm_srli_epi32(lo, 2), _mm_srli_epi32(lo, 7)));
+	t0 = _mm_xor_si128(t0, t1);
+	hi = _mm_xor_si128(hi, _mm_xor_si128(lo, t0));
+
+	_mm_storeu_si128((__m128i *)res, _mm_shuffle_epi8(hi, bswap));
+	kfpu_sse_end();
+}
+
+#endif /* HAVE_SIMD_X86 */
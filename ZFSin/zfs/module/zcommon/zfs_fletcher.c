@@ -134,6 +134,8 @@
 #include <sys/byteorder.h>
 #include <sys/zio.h>
 #include <sys/spa.h>
+#include <sys/simd.h>
+#include <sys/kstat.h>
 #include <zfs_fletcher.h>
 
 void
@@ -209,19 +211,30 @@ fletcher_2_byteswap(const void *buf, size_t size,
 	(void) fletcher_2_incremental_byteswap((void *) buf, size, zcp);
 }
 
-int
-fletcher_4_incremental_native(void *buf, size_t size, void *data)
+static void
+fletcher_4_scalar_init(fletcher_4_ctx_t *ctx)
 {
-	zio_cksum_t *zcp = data;
+	ZIO_SET_CHECKSUM(&ctx->scalar, 0, 0, 0, 0);
+}
 
+static void
+fletcher_4_scalar_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	memcpy(zcp, &ctx->scalar, sizeof (zio_cksum_t));
+}
+
+static void
+fletcher_4_scalar_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
 	const uint32_t *ip = buf;
 	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
 	uint64_t a, b, c, d;
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+	a = ctx->scalar.zc_word[0];
+	b = ctx->scalar.zc_word[1];
+	c = ctx->scalar.zc_word[2];
+	d = ctx->scalar.zc_word[3];
 
 	for (; ip < ipend; ip++) {
 		a += ip[0];
@@ -230,17 +243,290 @@ fletcher_4_incremental_native(void *buf, size_t size, void *data)
 		d += c;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+	ZIO_SET_CHECKSUM(&ctx->scalar, a, b, c, d);
+}
+
+static void
+fletcher_4_scalar_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+
+	a = ctx->scalar.zc_word[0];
+	b = ctx->scalar.zc_word[1];
+	c = ctx->scalar.zc_word[2];
+	d = ctx->scalar.zc_word[3];
+
+	for (; ip < ipend; ip++) {
+		a += BSWAP_32(ip[0]);
+		b += a;
+		c += b;
+		d += c;
+	}
+
+	ZIO_SET_CHECKSUM(&ctx->scalar, a, b, c, d);
+}
+
+static boolean_t
+fletcher_4_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+static const fletcher_4_ops_t fletcher_4_scalar_ops = {
+	.init_native = fletcher_4_scalar_init,
+	.fini_native = fletcher_4_scalar_fini,
+	.compute_native = fletcher_4_scalar_native,
+	.init_byteswap = fletcher_4_scalar_init,
+	.fini_byteswap = fletcher_4_scalar_fini,
+	.compute_byteswap = fletcher_4_scalar_byteswap,
+	.valid = fletcher_4_scalar_valid,
+	.name = "scalar"
+};
+
+/*
+ * All fletcher4 implementations known to this build. Whether each one is
+ * usable is decided at runtime by its valid() callback. The order of this
+ * table defines the values accepted by the zfs_fletcher_4_impl tunable:
+ * 0 selects the fastest implementation found by the benchmark, and N
+ * selects the Nth entry below.
+ */
+static const fletcher_4_ops_t *fletcher_4_impls[] = {
+	&fletcher_4_scalar_ops,
+	&fletcher_4_superscalar_ops,
+	&fletcher_4_superscalar4_ops,
+#if defined(HAVE_SIMD_X86)
+	&fletcher_4_sse2_ops,
+	&fletcher_4_ssse3_ops,
+	&fletcher_4_avx2_ops,
+	&fletcher_4_avx512f_ops,
+#endif
+};
+
+#define	FLETCHER_4_IMPL_COUNT	\
+	(sizeof (fletcher_4_impls) / sizeof (fletcher_4_impls[0]))
+
+#define	FLETCHER_4_IMPL_FASTEST	0
+
+/* Size of the benchmark buffer and time spent on each implementation */
+#define	FLETCHER_4_BENCH_SIZE	(128 * 1024)
+#define	FLETCHER_4_BENCH_NS	(MSEC2NSEC(1))
+
+typedef struct fletcher_4_bench {
+	uint64_t	fb_native;	/* MB/s */
+	uint64_t	fb_byteswap;	/* MB/s */
+} fletcher_4_bench_t;
+
+static fletcher_4_bench_t fletcher_4_stat_data[FLETCHER_4_IMPL_COUNT];
+static const fletcher_4_ops_t *fletcher_4_fastest_impl =
+	&fletcher_4_scalar_ops;
+static const fletcher_4_ops_t *fletcher_4_selected_impl =
+	&fletcher_4_scalar_ops;
+
+/* Tunable, see fletcher_4_impls[] for the accepted values */
+uint64_t zfs_fletcher_4_impl = FLETCHER_4_IMPL_FASTEST;
+
+static kstat_t *fletcher_4_kstat;
+static kstat_named_t fletcher_4_kstat_data[1 + 2 * FLETCHER_4_IMPL_COUNT];
+
+static inline const fletcher_4_ops_t *
+fletcher_4_impl_get(void)
+{
+	if (!kfpu_allowed())
+		return (&fletcher_4_scalar_ops);
+
+	return (fletcher_4_selected_impl);
+}
+
+/*
+ * Select the implementation used for all fletcher4 checksums. An id of
+ * FLETCHER_4_IMPL_FASTEST uses the benchmark winner, any other id is an
+ * index (1-based) into fletcher_4_impls[]. Returns EINVAL for unknown ids
+ * and ENOTSUP for implementations the CPU cannot run.
+ */
+int
+fletcher_4_impl_set(uint64_t id)
+{
+	const fletcher_4_ops_t *ops;
+
+	if (id == FLETCHER_4_IMPL_FASTEST) {
+		ops = fletcher_4_fastest_impl;
+	} else {
+		if (id > FLETCHER_4_IMPL_COUNT)
+			return (EINVAL);
+		ops = fletcher_4_impls[id - 1];
+		if (!ops->valid())
+			return (ENOTSUP);
+	}
+
+	zfs_fletcher_4_impl = id;
+	fletcher_4_selected_impl = ops;
 	return (0);
 }
 
+const char *
+fletcher_4_impl_name(void)
+{
+	return (fletcher_4_impl_get()->name);
+}
+
+/*
+ * Checksum 'buf' with 'ops', saving the vector state around anything but
+ * the scalar code. Returns B_FALSE, leaving 'zcp' untouched, when the
+ * state cannot be saved.
+ */
+static boolean_t
+fletcher_4_run(const fletcher_4_ops_t *ops, boolean_t native,
+    const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	fletcher_4_ctx_t ctx;
+	kfpu_state_t fpu;
+	const boolean_t simd = (ops != &fletcher_4_scalar_ops);
+
+	if (simd && !kfpu_begin(&fpu))
+		return (B_FALSE);
+
+	if (native) {
+		ops->init_native(&ctx);
+		ops->compute_native(&ctx, buf, size);
+		ops->fini_native(&ctx, zcp);
+	} else {
+		ops->init_byteswap(&ctx);
+		ops->compute_byteswap(&ctx, buf, size);
+		ops->fini_byteswap(&ctx, zcp);
+	}
+
+	if (simd)
+		kfpu_end(&fpu);
+	return (B_TRUE);
+}
+
+static inline void
+fletcher_4_native_impl(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	if (!fletcher_4_run(fletcher_4_impl_get(), B_TRUE, buf, size, zcp))
+		(void) fletcher_4_run(&fletcher_4_scalar_ops, B_TRUE, buf,
+		    size, zcp);
+}
+
+/*
+ * The vectorized implementations consume 64 bytes per iteration; any tail
+ * is folded in by the scalar loop, which continues directly from the
+ * checksum state produced for the aligned part.
+ */
 /*ARGSUSED*/
 void
 fletcher_4_native(const void *buf, size_t size,
     const void *ctx_template, zio_cksum_t *zcp)
 {
-	fletcher_init(zcp);
-	(void) fletcher_4_incremental_native((void *) buf, size, zcp);
+	const uint64_t p2size = P2ALIGN((uint64_t)size, 64);
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint32_t)));
+
+	if (p2size == 0) {
+		ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+		if (size > 0)
+			fletcher_4_scalar_native((fletcher_4_ctx_t *)zcp,
+			    buf, size);
+	} else {
+		fletcher_4_native_impl(buf, p2size, zcp);
+		if (p2size < size)
+			fletcher_4_scalar_native((fletcher_4_ctx_t *)zcp,
+			    (const char *)buf + p2size, size - p2size);
+	}
+}
+
+static inline void
+fletcher_4_byteswap_impl(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	if (!fletcher_4_run(fletcher_4_impl_get(), B_FALSE, buf, size, zcp))
+		(void) fletcher_4_run(&fletcher_4_scalar_ops, B_FALSE, buf,
+		    size, zcp);
+}
+
+/*ARGSUSED*/
+void
+fletcher_4_byteswap(const void *buf, size_t size,
+    const void *ctx_template, zio_cksum_t *zcp)
+{
+	const uint64_t p2size = P2ALIGN((uint64_t)size, 64);
+
+	ASSERT(IS_P2ALIGNED(size, sizeof (uint32_t)));
+
+	if (p2size == 0) {
+		ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+		if (size > 0)
+			fletcher_4_scalar_byteswap((fletcher_4_ctx_t *)zcp,
+			    buf, size);
+	} else {
+		fletcher_4_byteswap_impl(buf, p2size, zcp);
+		if (p2size < size)
+			fletcher_4_scalar_byteswap((fletcher_4_ctx_t *)zcp,
+			    (const char *)buf + p2size, size - p2size);
+	}
+}
+
+/*
+ * Fold the checksum 'nzcp' of a chunk of 'size' bytes, computed from a
+ * zero state, into the running checksum 'zcp'. With c1 words in the chunk,
+ * the state carried in from before the chunk contributes:
+ *
+ *	a' = a
+ *	b' = b + c1 * a
+ *	c' = c + c1 * b + c2 * a		c2 = c1 * (c1 + 1) / 2
+ *	d' = d + c1 * c + c2 * b + c3 * a	c3 = c2 * (c1 + 2) / 3
+ */
+static inline void
+fletcher_4_incremental_combine(zio_cksum_t *zcp, const uint64_t size,
+    const zio_cksum_t *nzcp)
+{
+	const uint64_t c1 = size / sizeof (uint32_t);
+	const uint64_t c2 = c1 * (c1 + 1) / 2;
+	const uint64_t c3 = c2 * (c1 + 2) / 3;
+
+	ASSERT3U(size, <=, ZFS_FLETCHER_4_INC_MAX_SIZE);
+
+	zcp->zc_word[3] += nzcp->zc_word[3] + c1 * zcp->zc_word[2] +
+	    c2 * zcp->zc_word[1] + c3 * zcp->zc_word[0];
+	zcp->zc_word[2] += nzcp->zc_word[2] + c1 * zcp->zc_word[1] +
+	    c2 * zcp->zc_word[0];
+	zcp->zc_word[1] += nzcp->zc_word[1] + c1 * zcp->zc_word[0];
+	zcp->zc_word[0] += nzcp->zc_word[0];
+}
+
+static inline void
+fletcher_4_incremental_impl(boolean_t native, const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	while (size > 0) {
+		zio_cksum_t nzc;
+		uint64_t len = MIN(size, ZFS_FLETCHER_4_INC_MAX_SIZE);
+
+		if (native)
+			fletcher_4_native(buf, len, NULL, &nzc);
+		else
+			fletcher_4_byteswap(buf, len, NULL, &nzc);
+
+		fletcher_4_incremental_combine(zcp, len, &nzc);
+
+		size -= len;
+		buf = (const char *)buf + len;
+	}
+}
+
+int
+fletcher_4_incremental_native(void *buf, size_t size, void *data)
+{
+	zio_cksum_t *zcp = data;
+
+	/* Use the scalar loop to directly update small chunks */
+	if (size < SPA_MINBLOCKSIZE)
+		fletcher_4_scalar_native((fletcher_4_ctx_t *)zcp, buf, size);
+	else
+		fletcher_4_incremental_impl(B_TRUE, buf, size, zcp);
+	return (0);
 }
 
 int
@@ -248,33 +534,172 @@ fletcher_4_incremental_byteswap(void *buf, size_t size, void *data)
 {
 	zio_cksum_t *zcp = data;
 
-	const uint32_t *ip = buf;
-	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
-	uint64_t a, b, c, d;
+	if (size < SPA_MINBLOCKSIZE)
+		fletcher_4_scalar_byteswap((fletcher_4_ctx_t *)zcp, buf, size);
+	else
+		fletcher_4_incremental_impl(B_FALSE, buf, size, zcp);
+	return (0);
+}
 
-	a = zcp->zc_word[0];
-	b = zcp->zc_word[1];
-	c = zcp->zc_word[2];
-	d = zcp->zc_word[3];
+static uint64_t
+fletcher_4_benchmark_impl(const fletcher_4_ops_t *ops, boolean_t native,
+    const char *data, uint64_t size)
+{
+	zio_cksum_t zc;
+	uint64_t run_count = 0;
+	hrtime_t start, run_time;
 
-	for (; ip < ipend; ip++) {
-		a += BSWAP_32(ip[0]);
-		b += a;
-		c += b;
-		d += c;
+	start = gethrtime();
+	do {
+		int i;
+
+		for (i = 0; i < 32; i++, run_count++) {
+			if (!fletcher_4_run(ops, native, data, size, &zc))
+				return (0);
+		}
+		run_time = gethrtime() - start;
+	} while (run_time < FLETCHER_4_BENCH_NS);
+
+	/* MB/s */
+	return ((run_count * size * NANOSEC / (uint64_t)run_time) >> 20);
+}
+
+/*
+ * Verify an implementation against the scalar reference before it is
+ * allowed to win the benchmark.
+ */
+static boolean_t
+fletcher_4_verify_impl(const fletcher_4_ops_t *ops, const char *data,
+    uint64_t size)
+{
+	fletcher_4_ctx_t ctx;
+	zio_cksum_t ref, zc;
+
+	fletcher_4_scalar_init(&ctx);
+	fletcher_4_scalar_native(&ctx, data, size);
+	fletcher_4_scalar_fini(&ctx, &ref);
+	if (!fletcher_4_run(ops, B_TRUE, data, size, &zc) ||
+	    !ZIO_CHECKSUM_EQUAL(ref, zc))
+		return (B_FALSE);
+
+	fletcher_4_scalar_init(&ctx);
+	fletcher_4_scalar_byteswap(&ctx, data, size);
+	fletcher_4_scalar_fini(&ctx, &ref);
+	if (!fletcher_4_run(ops, B_FALSE, data, size, &zc))
+		return (B_FALSE);
+	return (ZIO_CHECKSUM_EQUAL(ref, zc));
+}
+
+static void
+fletcher_4_benchmark(void)
+{
+	const fletcher_4_ops_t *fastest = &fletcher_4_scalar_ops;
+	uint64_t best = 0;
+	char *databuf;
+	int i;
+
+	databuf = kmem_alloc(FLETCHER_4_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < FLETCHER_4_BENCH_SIZE / sizeof (uint64_t); i++)
+		((uint64_t *)databuf)[i] = (uintptr_t)(databuf + i) *
+		    0x9e3779b97f4a7c15ULL;
+
+	for (i = 0; i < FLETCHER_4_IMPL_COUNT; i++) {
+		const fletcher_4_ops_t *ops = fletcher_4_impls[i];
+		fletcher_4_bench_t *fb = &fletcher_4_stat_data[i];
+
+		if (!ops->valid() ||
+		    !fletcher_4_verify_impl(ops, databuf,
+		    FLETCHER_4_BENCH_SIZE)) {
+			fb->fb_native = fb->fb_byteswap = 0;
+			continue;
+		}
+
+		fb->fb_native = fletcher_4_benchmark_impl(ops, B_TRUE,
+		    databuf, FLETCHER_4_BENCH_SIZE);
+		fb->fb_byteswap = fletcher_4_benchmark_impl(ops, B_FALSE,
+		    databuf, FLETCHER_4_BENCH_SIZE);
+
+		/* Native checksums dominate, so they pick the winner */
+		if (fb->fb_native > best) {
+			best = fb->fb_native;
+			fastest = ops;
+		}
+	}
+
+	kmem_free(databuf, FLETCHER_4_BENCH_SIZE);
+	fletcher_4_fastest_impl = fastest;
+}
+
+static int
+fletcher_4_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *knp = ksp->ks_data;
+	int i;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	(void) strlcpy(knp->value.c, fletcher_4_impl_name(),
+	    sizeof (knp->value.c));
+	knp++;
+
+	for (i = 0; i < FLETCHER_4_IMPL_COUNT; i++) {
+		knp->value.ui64 = fletcher_4_stat_data[i].fb_native;
+		knp++;
+		knp->value.ui64 = fletcher_4_stat_data[i].fb_byteswap;
+		knp++;
 	}
 
-	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
 	return (0);
 }
 
-/*ARGSUSED*/
+/*
+ * Benchmark all usable implementations and select the fastest one, unless
+ * the administrator already asked for a specific one. Exposes the results
+ * as zfs:0:fletcher_4_bench, with throughput in MB/s.
+ */
 void
-fletcher_4_byteswap(const void *buf, size_t size,
-    const void *ctx_template, zio_cksum_t *zcp)
+fletcher_4_init(void)
 {
-	fletcher_init(zcp);
-	(void) fletcher_4_incremental_byteswap((void *) buf, size, zcp);
+	kstat_named_t *knp = fletcher_4_kstat_data;
+	char name[KSTAT_STRLEN];
+	int i;
+
+	fletcher_4_benchmark();
+
+	if (fletcher_4_impl_set(zfs_fletcher_4_impl) != 0)
+		(void) fletcher_4_impl_set(FLETCHER_4_IMPL_FASTEST);
+
+	kstat_named_init(knp++, "selected", KSTAT_DATA_CHAR);
+	for (i = 0; i < FLETCHER_4_IMPL_COUNT; i++) {
+		(void) snprintf(name, sizeof (name), "%s_native",
+		    fletcher_4_impls[i]->name);
+		kstat_named_init(knp++, name, KSTAT_DATA_UINT64);
+		(void) snprintf(name, sizeof (name), "%s_byteswap",
+		    fletcher_4_impls[i]->name);
+		kstat_named_init(knp++, name, KSTAT_DATA_UINT64);
+	}
+
+	fletcher_4_kstat = kstat_create("zfs", 0, "fletcher_4_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (fletcher_4_kstat_data) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (fletcher_4_kstat != NULL) {
+		fletcher_4_kstat->ks_data = fletcher_4_kstat_data;
+		fletcher_4_kstat->ks_update = fletcher_4_kstat_update;
+		kstat_install(fletcher_4_kstat);
+	}
+}
+
+void
+fletcher_4_fini(void)
+{
+	if (fletcher_4_kstat != NULL) {
+		kstat_delete(fletcher_4_kstat);
+		fletcher_4_kstat = NULL;
+	}
+
+	fletcher_4_selected_impl = &fletcher_4_scalar_ops;
+	fletcher_4_fastest_impl = &fletcher_4_scalar_ops;
 }
 
 #if defined(_KERNEL) && defined(HAVE_SPL)
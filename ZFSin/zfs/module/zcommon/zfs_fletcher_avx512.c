@@ -0,0 +1,169 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX-512F fletcher4. Eight 32-bit words are zero-extended into the eight
+ * 64-bit lanes of a zmm register per step, so lane j accumulates the words
+ * at positions j, j + 8, j + 16, ... The byteswap variant reorders the
+ * bytes with a 256-bit vpshufb before widening, which only needs AVX2.
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(HAVE_SIMD_X86)
+
+static void
+fletcher_4_avx512f_init(fletcher_4_ctx_t *ctx)
+{
+	bzero(ctx->avx512, 4 * sizeof (zfs_fletcher_avx512_t));
+}
+
+/*
+ * Lane mixing coefficients for eight lanes, indexed by lane.
+ */
+static const uint64_t fletcher_4_avx512_cb[8] =
+	{ 28, 36, 44, 52, 60, 68, 76, 84 };
+static const uint64_t fletcher_4_avx512_ca[8] =
+	{ 0, 0, 1, 3, 6, 10, 15, 21 };
+static const uint64_t fletcher_4_avx512_dc[8] =
+	{ 448, 512, 576, 640, 704, 768, 832, 896 };
+static const uint64_t fletcher_4_avx512_db[8] =
+	{ 56, 84, 120, 164, 216, 276, 344, 420 };
+static const uint64_t fletcher_4_avx512_da[8] =
+	{ 0, 0, 0, 1, 4, 10, 20, 35 };
+
+static void
+fletcher_4_avx512f_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	const uint64_t *a = ctx->avx512[0].v;
+	const uint64_t *b = ctx->avx512[1].v;
+	const uint64_t *c = ctx->avx512[2].v;
+	const uint64_t *d = ctx->avx512[3].v;
+	uint64_t A = 0, B = 0, C = 0, D = 0;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		A += a[i];
+		B += 8 * b[i] - i * a[i];
+		C += 64 * c[i] - fletcher_4_avx512_cb[i] * b[i] +
+		    fletcher_4_avx512_ca[i] * a[i];
+		D += 512 * d[i] - fletcher_4_avx512_dc[i] * c[i] +
+		    fletcher_4_avx512_db[i] * b[i] -
+		    fletcher_4_avx512_da[i] * a[i];
+	}
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+#define	FLETCHER_4_AVX512_LOAD(ctx, a, b, c, d)				\
+	do {								\
+		a = _mm512_loadu_si512((ctx)->avx512[0].v);		\
+		b = _mm512_loadu_si512((ctx)->avx512[1].v);		\
+		c = _mm512_loadu_si512((ctx)->avx512[2].v);		\
+		d = _mm512_loadu_si512((ctx)->avx512[3].v);		\
+	} while (0)
+
+#define	FLETCHER_4_AVX512_STORE(ctx, a, b, c, d)			\
+	do {								\
+		_mm512_storeu_si512((ctx)->avx512[0].v, a);		\
+		_mm512_storeu_si512((ctx)->avx512[1].v, b);		\
+		_mm512_storeu_si512((ctx)->avx512[2].v, c);		\
+		_mm512_storeu_si512((ctx)->avx512[3].v, d);		\
+	} while (0)
+
+#define	FLETCHER_4_AVX512_STEP(w, a, b, c, d)				\
+	do {								\
+		a = _mm512_add_epi64(a, _mm512_cvtepu32_epi64(w));	\
+		b = _mm512_add_epi64(b, a);				\
+		c = _mm512_add_epi64(c, b);				\
+		d = _mm512_add_epi64(d, c);				\
+	} while (0)
+
+static void
+fletcher_4_avx512f_native(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const __m256i *ip = buf;
+	const __m256i *ipend = (const __m256i *)((const uint8_t *)buf + size);
+	__m512i a, b, c, d;
+
+	FLETCHER_4_AVX512_LOAD(ctx, a, b, c, d);
+
+	for (; ip < ipend; ip += 2) {
+		FLETCHER_4_AVX512_STEP(_mm256_loadu_si256(ip), a, b, c, d);
+		FLETCHER_4_AVX512_STEP(_mm256_loadu_si256(ip + 1), a, b, c, d);
+	}
+
+	FLETCHER_4_AVX512_STORE(ctx, a, b, c, d);
+
+	_mm256_zeroupper();
+}
+
+static void
+fletcher_4_avx512f_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const __m256i *ip = buf;
+	const __m256i *ipend = (const __m256i *)((const uint8_t *)buf + size);
+	__m512i a, b, c, d;
+	__m256i mask;
+
+	mask = _mm256_set_epi8(
+	    12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+	    12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+	FLETCHER_4_AVX512_LOAD(ctx, a, b, c, d);
+
+	for (; ip < ipend; ip += 2) {
+		FLETCHER_4_AVX512_STEP(_mm256_shuffle_epi8(
+		    _mm256_loadu_si256(ip), mask), a, b, c, d);
+		FLETCHER_4_AVX512_STEP(_mm256_shuffle_epi8(
+		    _mm256_loadu_si256(ip + 1), mask), a, b, c, d);
+	}
+
+	FLETCHER_4_AVX512_STORE(ctx, a, b, c, d);
+
+	_mm256_zeroupper();
+}
+
+static boolean_t
+fletcher_4_avx512f_valid(void)
+{
+	return (zfs_avx2_available() && zfs_avx512f_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx512f_ops = {
+	.init_native = fletcher_4_avx512f_init,
+	.fini_native = fletcher_4_avx512f_fini,
+	.compute_native = fletcher_4_avx512f_native,
+	.init_byteswap = fletcher_4_avx512f_init,
+	.fini_byteswap = fletcher_4_avx512f_fini,
+	.compute_byteswap = fletcher_4_avx512f_byteswap,
+	.valid = fletcher_4_avx512f_valid,
+	.name = "avx512f"
+};
+
+#endif /* HAVE_SIMD_X86 */
@@ -0,0 +1,160 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 fletcher4. Four 32-bit words are zero-extended into the four 64-bit
+ * lanes of a ymm register per step, so lane j accumulates the words at
+ * positions j, j + 4, j + 8, ... The byteswap variant reorders the bytes
+ * with vpshufb before widening.
+ *
+ * Mixing the lanes back into the checksum:
+ *
+ *	a = sum(a[j])
+ *	b = 4 sum(b[j]) - sum(j a[j])
+ *	c = 16 sum(c[j]) - sum((4j + 6) b[j]) + sum(j (j - 1) / 2 a[j])
+ *	d = 64 sum(d[j]) - sum((16j + 48) c[j]) + (4, 10, 20, 34) . b - a[3]
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(HAVE_SIMD_X86)
+
+static void
+fletcher_4_avx2_init(fletcher_4_ctx_t *ctx)
+{
+	bzero(ctx->avx, 4 * sizeof (zfs_fletcher_avx_t));
+}
+
+static void
+fletcher_4_avx2_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	const uint64_t *a = ctx->avx[0].v;
+	const uint64_t *b = ctx->avx[1].v;
+	const uint64_t *c = ctx->avx[2].v;
+	const uint64_t *d = ctx->avx[3].v;
+	uint64_t A, B, C, D;
+
+	A = a[0] + a[1] + a[2] + a[3];
+	B = 4 * (b[0] + b[1] + b[2] + b[3]) -
+	    a[1] - 2 * a[2] - 3 * a[3];
+	C = 16 * (c[0] + c[1] + c[2] + c[3]) -
+	    6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3] +
+	    a[2] + 3 * a[3];
+	D = 64 * (d[0] + d[1] + d[2] + d[3]) -
+	    48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3] +
+	    4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3] -
+	    a[3];
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+#define	FLETCHER_4_AVX2_LOAD(ctx, a, b, c, d)				\
+	do {								\
+		a = _mm256_loadu_si256((const __m256i *)(ctx)->avx[0].v); \
+		b = _mm256_loadu_si256((const __m256i *)(ctx)->avx[1].v); \
+		c = _mm256_loadu_si256((const __m256i *)(ctx)->avx[2].v); \
+		d = _mm256_loadu_si256((const __m256i *)(ctx)->avx[3].v); \
+	} while (0)
+
+#define	FLETCHER_4_AVX2_STORE(ctx, a, b, c, d)				\
+	do {								\
+		_mm256_storeu_si256((__m256i *)(ctx)->avx[0].v, a);	\
+		_mm256_storeu_si256((__m256i *)(ctx)->avx[1].v, b);	\
+		_mm256_storeu_si256((__m256i *)(ctx)->avx[2].v, c);	\
+		_mm256_storeu_si256((__m256i *)(ctx)->avx[3].v, d);	\
+	} while (0)
+
+#define	FLETCHER_4_AVX2_STEP(w, a, b, c, d)				\
+	do {								\
+		a = _mm256_add_epi64(a, _mm256_cvtepu32_epi64(w));	\
+		b = _mm256_add_epi64(b, a);				\
+		c = _mm256_add_epi64(c, b);				\
+		d = _mm256_add_epi64(d, c);				\
+	} while (0)
+
+static void
+fletcher_4_avx2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = (const __m128i *)((const uint8_t *)buf + size);
+	__m256i a, b, c, d;
+
+	FLETCHER_4_AVX2_LOAD(ctx, a, b, c, d);
+
+	for (; ip < ipend; ip += 2) {
+		FLETCHER_4_AVX2_STEP(_mm_loadu_si128(ip), a, b, c, d);
+		FLETCHER_4_AVX2_STEP(_mm_loadu_si128(ip + 1), a, b, c, d);
+	}
+
+	FLETCHER_4_AVX2_STORE(ctx, a, b, c, d);
+
+	_mm256_zeroupper();
+}
+
+static void
+fletcher_4_avx2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = (const __m128i *)((const uint8_t *)buf + size);
+	__m256i a, b, c, d;
+	__m128i mask;
+
+	mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+	    4, 5, 6, 7, 0, 1, 2, 3);
+
+	FLETCHER_4_AVX2_LOAD(ctx, a, b, c, d);
+
+	for (; ip < ipend; ip += 2) {
+		FLETCHER_4_AVX2_STEP(_mm_shuffle_epi8(_mm_loadu_si128(ip),
+		    mask), a, b, c, d);
+		FLETCHER_4_AVX2_STEP(_mm_shuffle_epi8(_mm_loadu_si128(ip + 1),
+		    mask), a, b, c, d);
+	}
+
+	FLETCHER_4_AVX2_STORE(ctx, a, b, c, d);
+
+	_mm256_zeroupper();
+}
+
+static boolean_t
+fletcher_4_avx2_valid(void)
+{
+	return (zfs_avx_available() && zfs_avx2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_avx2_ops = {
+	.init_native = fletcher_4_avx2_init,
+	.fini_native = fletcher_4_avx2_fini,
+	.compute_native = fletcher_4_avx2_native,
+	.init_byteswap = fletcher_4_avx2_init,
+	.fini_byteswap = fletcher_4_avx2_fini,
+	.compute_byteswap = fletcher_4_avx2_byteswap,
+	.valid = fletcher_4_avx2_valid,
+	.name = "avx2"
+};
+
+#endif /* HAVE_SIMD_X86 */
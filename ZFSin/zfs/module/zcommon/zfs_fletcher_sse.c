@@ -0,0 +1,190 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSE2 and SSSE3 fletcher4. Each 128-bit load holds four 32-bit words,
+ * which are zero-extended into two 64-bit lanes and accumulated in two
+ * steps, so lane j sees the words at positions j, j + 2, j + 4, ... The
+ * lanes are mixed with the same matrix as the two-lane superscalar code.
+ *
+ * SSE2 has no byte shuffle, so its byteswap variant swaps the 16-bit
+ * halves of each word and then the bytes within each half. SSSE3 does it
+ * with a single pshufb.
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/simd.h>
+#include <zfs_fletcher.h>
+
+#if defined(HAVE_SIMD_X86)
+
+static void
+fletcher_4_sse2_init(fletcher_4_ctx_t *ctx)
+{
+	bzero(ctx->sse, 4 * sizeof (zfs_fletcher_sse_t));
+}
+
+static void
+fletcher_4_sse2_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	uint64_t A, B, C, D;
+
+	A = ctx->sse[0].v[0] + ctx->sse[0].v[1];
+	B = 2 * ctx->sse[1].v[0] + 2 * ctx->sse[1].v[1] - ctx->sse[0].v[1];
+	C = 4 * ctx->sse[2].v[0] - ctx->sse[1].v[0] +
+	    4 * ctx->sse[2].v[1] - 3 * ctx->sse[1].v[1];
+	D = 8 * ctx->sse[3].v[0] - 4 * ctx->sse[2].v[0] +
+	    8 * ctx->sse[3].v[1] - 8 * ctx->sse[2].v[1] + ctx->sse[1].v[1];
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+#define	FLETCHER_4_SSE_LOAD(ctx, a, b, c, d)				\
+	do {								\
+		a = _mm_loadu_si128((const __m128i *)(ctx)->sse[0].v);	\
+		b = _mm_loadu_si128((const __m128i *)(ctx)->sse[1].v);	\
+		c = _mm_loadu_si128((const __m128i *)(ctx)->sse[2].v);	\
+		d = _mm_loadu_si128((const __m128i *)(ctx)->sse[3].v);	\
+	} while (0)
+
+#define	FLETCHER_4_SSE_STORE(ctx, a, b, c, d)				\
+	do {								\
+		_mm_storeu_si128((__m128i *)(ctx)->sse[0].v, a);	\
+		_mm_storeu_si128((__m128i *)(ctx)->sse[1].v, b);	\
+		_mm_storeu_si128((__m128i *)(ctx)->sse[2].v, c);	\
+		_mm_storeu_si128((__m128i *)(ctx)->sse[3].v, d);	\
+	} while (0)
+
+/* Accumulate four 32-bit words held in 'w' into two 64-bit lanes */
+#define	FLETCHER_4_SSE_STEP(w, zero, a, b, c, d)			\
+	do {								\
+		a = _mm_add_epi64(a, _mm_unpacklo_epi32(w, zero));	\
+		b = _mm_add_epi64(b, a);				\
+		c = _mm_add_epi64(c, b);				\
+		d = _mm_add_epi64(d, c);				\
+		a = _mm_add_epi64(a, _mm_unpackhi_epi32(w, zero));	\
+		b = _mm_add_epi64(b, a);				\
+		c = _mm_add_epi64(c, b);				\
+		d = _mm_add_epi64(d, c);				\
+	} while (0)
+
+static void
+fletcher_4_sse2_native(fletcher_4_ctx_t *ctx, const void *buf, uint64_t size)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = (const __m128i *)((const uint8_t *)buf + size);
+	__m128i a, b, c, d, w, zero;
+
+	zero = _mm_setzero_si128();
+
+	FLETCHER_4_SSE_LOAD(ctx, a, b, c, d);
+
+	for (; ip < ipend; ip++) {
+		w = _mm_loadu_si128(ip);
+		FLETCHER_4_SSE_STEP(w, zero, a, b, c, d);
+	}
+
+	FLETCHER_4_SSE_STORE(ctx, a, b, c, d);
+}
+
+static void
+fletcher_4_sse2_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = (const __m128i *)((const uint8_t *)buf + size);
+	__m128i a, b, c, d, w, zero;
+
+	zero = _mm_setzero_si128();
+
+	FLETCHER_4_SSE_LOAD(ctx, a, b, c, d);
+
+	for (; ip < ipend; ip++) {
+		w = _mm_loadu_si128(ip);
+		/* swap the 16-bit halves, then the bytes within each half */
+		w = _mm_shufflehi_epi16(_mm_shufflelo_epi16(w, 0xb1), 0xb1);
+		w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+		FLETCHER_4_SSE_STEP(w, zero, a, b, c, d);
+	}
+
+	FLETCHER_4_SSE_STORE(ctx, a, b, c, d);
+}
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (zfs_sse2_available());
+}
+
+const fletcher_4_ops_t fletcher_4_sse2_ops = {
+	.init_native = fletcher_4_sse2_init,
+	.fini_native = fletcher_4_sse2_fini,
+	.compute_native = fletcher_4_sse2_native,
+	.init_byteswap = fletcher_4_sse2_init,
+	.fini_byteswap = fletcher_4_sse2_fini,
+	.compute_byteswap = fletcher_4_sse2_byteswap,
+	.valid = fletcher_4_sse2_valid,
+	.name = "sse2"
+};
+
+static void
+fletcher_4_ssse3_byteswap(fletcher_4_ctx_t *ctx, const void *buf,
+    uint64_t size)
+{
+	const __m128i *ip = buf;
+	const __m128i *ipend = (const __m128i *)((const uint8_t *)buf + size);
+	__m128i a, b, c, d, w, zero, mask;
+
+	zero = _mm_setzero_si128();
+	mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+	    4, 5, 6, 7, 0, 1, 2, 3);
+
+	FLETCHER_4_SSE_LOAD(ctx, a, b, c, d);
+
+	for (; ip < ipend; ip++) {
+		w = _mm_shuffle_epi8(_mm_loadu_si128(ip), mask);
+		FLETCHER_4_SSE_STEP(w, zero, a, b, c, d);
+	}
+
+	FLETCHER_4_SSE_STORE(ctx, a, b, c, d);
+}
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const fletcher_4_ops_t fletcher_4_ssse3_ops = {
+	.init_native = fletcher_4_sse2_init,
+	.fini_native = fletcher_4_sse2_fini,
+	.compute_native = fletcher_4_sse2_native,
+	.init_byteswap = fletcher_4_sse2_init,
+	.fini_byteswap = fletcher_4_sse2_fini,
+	.compute_byteswap = fletcher_4_ssse3_byteswap,
+	.valid = fletcher_4_ssse3_valid,
+	.name = "ssse3"
+};
+
+#endif /* HAVE_SIMD_X86 */
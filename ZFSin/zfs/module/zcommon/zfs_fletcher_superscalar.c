@@ -0,0 +1,155 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Two-lane superscalar fletcher4. Even 32-bit words feed the first set of
+ * accumulators and odd words the second, so the CPU can overlap the two
+ * dependency chains. The lanes are mixed back into the checksum by:
+ *
+ *	a = a0 + a1
+ *	b = 2b0 + 2b1 - a1
+ *	c = 4c0 - b0 + 4c1 - 3b1
+ *	d = 8d0 - 4c0 + 8d1 - 8c1 + b1
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <zfs_fletcher.h>
+
+static void
+fletcher_4_superscalar_init(fletcher_4_ctx_t *ctx)
+{
+	bzero(ctx->superscalar, 4 * sizeof (zfs_fletcher_superscalar_t));
+}
+
+static void
+fletcher_4_superscalar_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	uint64_t A, B, C, D;
+
+	A = ctx->superscalar[0].v[0] + ctx->superscalar[0].v[1];
+	B = 2 * ctx->superscalar[1].v[0] + 2 * ctx->superscalar[1].v[1] -
+	    ctx->superscalar[0].v[1];
+	C = 4 * ctx->superscalar[2].v[0] - ctx->superscalar[1].v[0] +
+	    4 * ctx->superscalar[2].v[1] - 3 * ctx->superscalar[1].v[1];
+	D = 8 * ctx->superscalar[3].v[0] - 4 * ctx->superscalar[2].v[0] +
+	    8 * ctx->superscalar[3].v[1] - 8 * ctx->superscalar[2].v[1] +
+	    ctx->superscalar[1].v[1];
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+static void
+fletcher_4_superscalar_native(fletcher_4_ctx_t *ctx,
+    const void *buf, uint64_t size)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+	uint64_t a2, b2, c2, d2;
+
+	a = ctx->superscalar[0].v[0];
+	b = ctx->superscalar[1].v[0];
+	c = ctx->superscalar[2].v[0];
+	d = ctx->superscalar[3].v[0];
+	a2 = ctx->superscalar[0].v[1];
+	b2 = ctx->superscalar[1].v[1];
+	c2 = ctx->superscalar[2].v[1];
+	d2 = ctx->superscalar[3].v[1];
+
+	for (; ip < ipend; ip += 2) {
+		a += ip[0];
+		a2 += ip[1];
+		b += a;
+		b2 += a2;
+		c += b;
+		c2 += b2;
+		d += c;
+		d2 += c2;
+	}
+
+	ctx->superscalar[0].v[0] = a;
+	ctx->superscalar[1].v[0] = b;
+	ctx->superscalar[2].v[0] = c;
+	ctx->superscalar[3].v[0] = d;
+	ctx->superscalar[0].v[1] = a2;
+	ctx->superscalar[1].v[1] = b2;
+	ctx->superscalar[2].v[1] = c2;
+	ctx->superscalar[3].v[1] = d2;
+}
+
+static void
+fletcher_4_superscalar_byteswap(fletcher_4_ctx_t *ctx,
+    const void *buf, uint64_t size)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+	uint64_t a2, b2, c2, d2;
+
+	a = ctx->superscalar[0].v[0];
+	b = ctx->superscalar[1].v[0];
+	c = ctx->superscalar[2].v[0];
+	d = ctx->superscalar[3].v[0];
+	a2 = ctx->superscalar[0].v[1];
+	b2 = ctx->superscalar[1].v[1];
+	c2 = ctx->superscalar[2].v[1];
+	d2 = ctx->superscalar[3].v[1];
+
+	for (; ip < ipend; ip += 2) {
+		a += BSWAP_32(ip[0]);
+		a2 += BSWAP_32(ip[1]);
+		b += a;
+		b2 += a2;
+		c += b;
+		c2 += b2;
+		d += c;
+		d2 += c2;
+	}
+
+	ctx->superscalar[0].v[0] = a;
+	ctx->superscalar[1].v[0] = b;
+	ctx->superscalar[2].v[0] = c;
+	ctx->superscalar[3].v[0] = d;
+	ctx->superscalar[0].v[1] = a2;
+	ctx->superscalar[1].v[1] = b2;
+	ctx->superscalar[2].v[1] = c2;
+	ctx->superscalar[3].v[1] = d2;
+}
+
+static boolean_t
+fletcher_4_superscalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+const fletcher_4_ops_t fletcher_4_superscalar_ops = {
+	.init_native = fletcher_4_superscalar_init,
+	.compute_native = fletcher_4_superscalar_native,
+	.fini_native = fletcher_4_superscalar_fini,
+	.init_byteswap = fletcher_4_superscalar_init,
+	.compute_byteswap = fletcher_4_superscalar_byteswap,
+	.fini_byteswap = fletcher_4_superscalar_fini,
+	.valid = fletcher_4_superscalar_valid,
+	.name = "superscalar"
+};
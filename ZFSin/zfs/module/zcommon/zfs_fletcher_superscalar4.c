@@ -0,0 +1,209 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Four-lane superscalar fletcher4. Word i feeds accumulator set (i % 4);
+ * this gives out-of-order cores four independent dependency chains. The
+ * lane mixing coefficients follow from splitting the fletcher series by
+ * word position modulo four.
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <zfs_fletcher.h>
+
+static void
+fletcher_4_superscalar4_init(fletcher_4_ctx_t *ctx)
+{
+	bzero(ctx->superscalar, 4 * sizeof (zfs_fletcher_superscalar_t));
+}
+
+static void
+fletcher_4_superscalar4_fini(fletcher_4_ctx_t *ctx, zio_cksum_t *zcp)
+{
+	const uint64_t *a = ctx->superscalar[0].v;
+	const uint64_t *b = ctx->superscalar[1].v;
+	const uint64_t *c = ctx->superscalar[2].v;
+	const uint64_t *d = ctx->superscalar[3].v;
+	uint64_t A, B, C, D;
+
+	A = a[0] + a[1] + a[2] + a[3];
+	B = 4 * (b[0] + b[1] + b[2] + b[3]) -
+	    a[1] - 2 * a[2] - 3 * a[3];
+	C = 16 * (c[0] + c[1] + c[2] + c[3]) -
+	    6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3] +
+	    a[2] + 3 * a[3];
+	D = 64 * (d[0] + d[1] + d[2] + d[3]) -
+	    48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3] +
+	    4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3] -
+	    a[3];
+
+	ZIO_SET_CHECKSUM(zcp, A, B, C, D);
+}
+
+static void
+fletcher_4_superscalar4_native(fletcher_4_ctx_t *ctx,
+    const void *buf, uint64_t size)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+	uint64_t a2, b2, c2, d2;
+	uint64_t a3, b3, c3, d3;
+	uint64_t a4, b4, c4, d4;
+
+	a = ctx->superscalar[0].v[0];
+	b = ctx->superscalar[1].v[0];
+	c = ctx->superscalar[2].v[0];
+	d = ctx->superscalar[3].v[0];
+	a2 = ctx->superscalar[0].v[1];
+	b2 = ctx->superscalar[1].v[1];
+	c2 = ctx->superscalar[2].v[1];
+	d2 = ctx->superscalar[3].v[1];
+	a3 = ctx->superscalar[0].v[2];
+	b3 = ctx->superscalar[1].v[2];
+	c3 = ctx->superscalar[2].v[2];
+	d3 = ctx->superscalar[3].v[2];
+	a4 = ctx->superscalar[0].v[3];
+	b4 = ctx->superscalar[1].v[3];
+	c4 = ctx->superscalar[2].v[3];
+	d4 = ctx->superscalar[3].v[3];
+
+	for (; ip < ipend; ip += 4) {
+		a += ip[0];
+		a2 += ip[1];
+		a3 += ip[2];
+		a4 += ip[3];
+		b += a;
+		b2 += a2;
+		b3 += a3;
+		b4 += a4;
+		c += b;
+		c2 += b2;
+		c3 += b3;
+		c4 += b4;
+		d += c;
+		d2 += c2;
+		d3 += c3;
+		d4 += c4;
+	}
+
+	ctx->superscalar[0].v[0] = a;
+	ctx->superscalar[1].v[0] = b;
+	ctx->superscalar[2].v[0] = c;
+	ctx->superscalar[3].v[0] = d;
+	ctx->superscalar[0].v[1] = a2;
+	ctx->superscalar[1].v[1] = b2;
+	ctx->superscalar[2].v[1] = c2;
+	ctx->superscalar[3].v[1] = d2;
+	ctx->superscalar[0].v[2] = a3;
+	ctx->superscalar[1].v[2] = b3;
+	ctx->superscalar[2].v[2] = c3;
+	ctx->superscalar[3].v[2] = d3;
+	ctx->superscalar[0].v[3] = a4;
+	ctx->superscalar[1].v[3] = b4;
+	ctx->superscalar[2].v[3] = c4;
+	ctx->superscalar[3].v[3] = d4;
+}
+
+static void
+fletcher_4_superscalar4_byteswap(fletcher_4_ctx_t *ctx,
+    const void *buf, uint64_t size)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+	uint64_t a2, b2, c2, d2;
+	uint64_t a3, b3, c3, d3;
+	uint64_t a4, b4, c4, d4;
+
+	a = ctx->superscalar[0].v[0];
+	b = ctx->superscalar[1].v[0];
+	c = ctx->superscalar[2].v[0];
+	d = ctx->superscalar[3].v[0];
+	a2 = ctx->superscalar[0].v[1];
+	b2 = ctx->superscalar[1].v[1];
+	c2 = ctx->superscalar[2].v[1];
+	d2 = ctx->superscalar[3].v[1];
+	a3 = ctx->superscalar[0].v[2];
+	b3 = ctx->superscalar[1].v[2];
+	c3 = ctx->superscalar[2].v[2];
+	d3 = ctx->superscalar[3].v[2];
+	a4 = ctx->superscalar[0].v[3];
+	b4 = ctx->superscalar[1].v[3];
+	c4 = ctx->superscalar[2].v[3];
+	d4 = ctx->superscalar[3].v[3];
+
+	for (; ip < ipend; ip += 4) {
+		a += BSWAP_32(ip[0]);
+		a2 += BSWAP_32(ip[1]);
+		a3 += BSWAP_32(ip[2]);
+		a4 += BSWAP_32(ip[3]);
+		b += a;
+		b2 += a2;
+		b3 += a3;
+		b4 += a4;
+		c += b;
+		c2 += b2;
+		c3 += b3;
+		c4 += b4;
+		d += c;
+		d2 += c2;
+		d3 += c3;
+		d4 += c4;
+	}
+
+	ctx->superscalar[0].v[0] = a;
+	ctx->superscalar[1].v[0] = b;
+	ctx->superscalar[2].v[0] = c;
+	ctx->superscalar[3].v[0] = d;
+	ctx->superscalar[0].v[1] = a2;
+	ctx->superscalar[1].v[1] = b2;
+	ctx->superscalar[2].v[1] = c2;
+	ctx->superscalar[3].v[1] = d2;
+	ctx->superscalar[0].v[2] = a3;
+	ctx->superscalar[1].v[2] = b3;
+	ctx->superscalar[2].v[2] = c3;
+	ctx->superscalar[3].v[2] = d3;
+	ctx->superscalar[0].v[3] = a4;
+	ctx->superscalar[1].v[3] = b4;
+	ctx->superscalar[2].v[3] = c4;
+	ctx->superscalar[3].v[3] = d4;
+}
+
+static boolean_t
+fletcher_4_superscalar4_valid(void)
+{
+	return (B_TRUE);
+}
+
+const fletcher_4_ops_t fletcher_4_superscalar4_ops = {
+	.init_native = fletcher_4_superscalar4_init,
+	.compute_native = fletcher_4_superscalar4_native,
+	.fini_native = fletcher_4_superscalar4_fini,
+	.init_byteswap = fletcher_4_superscalar4_init,
+	.compute_byteswap = fletcher_4_superscalar4_byteswap,
+	.fini_byteswap = fletcher_4_superscalar4_fini,
+	.valid = fletcher_4_superscalar4_valid,
+	.name = "superscalar4"
+};
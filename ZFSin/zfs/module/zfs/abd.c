@@ -165,6 +165,10 @@ typedef struct abd_stats {
 	kstat_named_t abdstat_scattered_metadata_cnt;
 	kstat_named_t abdstat_scattered_filedata_cnt;
 	kstat_named_t abdstat_borrowed_buf_cnt;
+	kstat_named_t abdstat_borrowed_copy_bytes;
+	kstat_named_t abdstat_borrowed_segs_bytes;
+	kstat_named_t abdstat_gang_cnt;
+	kstat_named_t abdstat_gang_data_size;
 	kstat_named_t abdstat_move_refcount_nonzero;
 	kstat_named_t abdstat_moved_linear;
 	kstat_named_t abdstat_moved_scattered_filedata;
@@ -209,6 +213,15 @@ static abd_stats_t abd_stats = {
 	{ "filedata_scattered_buffers",         KSTAT_DATA_UINT64 },
 	/* number of borrowed bufs */
 	{ "borrowed_bufs",                      KSTAT_DATA_UINT64 },
+	/*
+	 * Bytes memcpy'd to or from scattered ABDs by the borrow/return
+	 * functions, versus bytes handed out in place by abd_borrow_segs().
+	 */
+	{ "borrowed_copy_bytes",                KSTAT_DATA_UINT64 },
+	{ "borrowed_segs_bytes",                KSTAT_DATA_UINT64 },
+	/* Gang ABDs currently allocated, and the data they refer to */
+	{ "gang_cnt",                           KSTAT_DATA_UINT64 },
+	{ "gang_data_size",                     KSTAT_DATA_UINT64 },
 	/* abd_try_move() statistics */
 	{ "move_refcount_nonzero",              KSTAT_DATA_UINT64 },
 	{ "moved_linear",                       KSTAT_DATA_UINT64 },
@@ -383,11 +396,17 @@ abd_verify(abd_t *abd)
 	ASSERT3U(abd->abd_size, >, 0);
 	ASSERT3U(abd->abd_size, <=, SPA_MAXBLOCKSIZE);
 	ASSERT3U(abd->abd_flags, ==, abd->abd_flags & (ABD_FLAG_LINEAR |
-	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_SMALL | ABD_FLAG_NOMOVE));
+	    ABD_FLAG_OWNER | ABD_FLAG_META | ABD_FLAG_SMALL | ABD_FLAG_NOMOVE |
+	    ABD_FLAG_GANG));
 	IMPLY(abd->abd_parent != NULL, !(abd->abd_flags & ABD_FLAG_OWNER));
 	IMPLY(abd->abd_flags & ABD_FLAG_META, abd->abd_flags & ABD_FLAG_OWNER);
+	IMPLY(abd->abd_flags & ABD_FLAG_GANG, !(abd->abd_flags &
+	    (ABD_FLAG_OWNER | ABD_FLAG_LINEAR)));
 	if (abd_is_linear(abd)) {
 		ASSERT3P(abd->abd_u.abd_linear.abd_buf, !=, NULL);
+	} else if (abd_is_gang(abd)) {
+		/* may still be partly filled in, see abd_gang_add() */
+		ASSERT0(abd->abd_u.abd_scatter.abd_offset);
 	} else {
 		ASSERT3U(abd->abd_u.abd_scatter.abd_offset, <,
 		    zfs_abd_chunk_size);
@@ -420,6 +439,8 @@ abd_free_struct(abd_t *abd)
 {
 	mutex_enter(&abd->abd_mutex);
 	size_t chunkcnt = abd_is_linear(abd) ? 0 : abd_scatter_chunkcnt(abd);
+	if (abd_is_gang(abd))
+		chunkcnt = 2 * chunkcnt + 1;
 	int size = offsetof(abd_t, abd_u.abd_scatter.abd_chunks[chunkcnt]);
 	VERIFY_ABD_MAGIC(abd);
 #ifdef DEBUG
@@ -755,8 +776,130 @@ abd_get_from_buf(void *buf, size_t size)
 }
 
 /*
- * Free an ABD allocated from abd_get_offset() or abd_get_from_buf(). Will not
- * free the underlying scatterlist or buffer.
+ * A gang ABD is a scattered ABD whose chunk pointers are borrowed from other
+ * ABDs, so that several buffers can be handed to the vdev as one i/o without
+ * being copied together (see vdev_queue_aggregate()). Since a scattered
+ * ABD's chunks all have to be zfs_abd_chunk_size long, every piece but the
+ * last must cover a whole number of chunks and start on a chunk boundary of
+ * its own ABD; a linear ABD can start anywhere, as its buffer is simply cut
+ * into chunk-sized pieces. Each ABD a piece comes from is held, as with
+ * abd_get_offset(), until the gang is released with abd_put().
+ *
+ * The chunk array is followed by a NULL-terminated list of those ABDs.
+ * Pieces are at least one chunk long except the last, so there are never
+ * more of them than chunks.
+ */
+static inline abd_t **
+abd_gang_pieces(abd_t *abd)
+{
+	ASSERT(abd_is_gang(abd));
+	return ((abd_t **)&abd->abd_u.abd_scatter.abd_chunks[
+	    abd_scatter_chunkcnt(abd)]);
+}
+
+/*
+ * The pieces are added in order, so the chunks filled in so far are a
+ * prefix of the array.
+ */
+static size_t
+abd_gang_chunks_filled(abd_t *abd)
+{
+	size_t lo = 0, hi = abd_scatter_chunkcnt(abd);
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (abd->abd_u.abd_scatter.abd_chunks[mid] != NULL)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*
+ * Allocate an empty gang ABD of the given size, to be filled in with
+ * abd_gang_add() and freed with abd_put().
+ */
+abd_t *
+abd_alloc_gang(size_t size)
+{
+	size_t chunkcnt = abd_chunkcnt_for_bytes(size);
+	abd_t *abd = abd_alloc_struct(2 * chunkcnt + 1);
+
+	VERIFY3U(size, <=, SPA_MAXBLOCKSIZE);
+
+	abd->abd_flags = ABD_FLAG_GANG | ABD_FLAG_NOMOVE;
+	abd->abd_size = size;
+	abd->abd_parent = NULL;
+	abd->abd_u.abd_scatter.abd_offset = 0;
+	abd->abd_u.abd_scatter.abd_chunk_size = zfs_abd_chunk_size;
+	refcount_create(&abd->abd_children);
+
+	ABDSTAT_BUMP(abdstat_gang_cnt);
+	ABDSTAT_INCR(abdstat_gang_data_size, size);
+
+	return (abd);
+}
+
+/*
+ * Append [off, off + size) of sabd to a gang ABD. Returns B_FALSE, leaving
+ * the gang as it was, if that range can't be expressed in whole chunks; the
+ * caller then has to copy the data instead.
+ */
+boolean_t
+abd_gang_add(abd_t *abd, abd_t *sabd, size_t off, size_t size)
+{
+	void **chunks = abd->abd_u.abd_scatter.abd_chunks;
+	size_t first = abd_gang_chunks_filled(abd);
+	size_t pos = first * zfs_abd_chunk_size;
+	abd_t **pieces = abd_gang_pieces(abd);
+	size_t n, soff;
+	int p;
+
+	ASSERT(abd_is_gang(abd));
+	ASSERT3U(size, >, 0);
+	ASSERT3U(pos + size, <=, (size_t)abd->abd_size);
+
+	if (size % zfs_abd_chunk_size != 0 && pos + size != abd->abd_size)
+		return (B_FALSE);
+
+	mutex_enter(&sabd->abd_mutex);
+	abd_verify(sabd);
+	ASSERT(!abd_is_gang(sabd));
+	ASSERT3U(off + size, <=, (size_t)sabd->abd_size);
+
+	n = abd_chunkcnt_for_bytes(size);
+	if (abd_is_linear(sabd)) {
+		for (size_t i = 0; i < n; i++) {
+			chunks[first + i] = (char *)sabd->abd_u.abd_linear.abd_buf +
+			    off + i * zfs_abd_chunk_size;
+		}
+	} else {
+		soff = sabd->abd_u.abd_scatter.abd_offset + off;
+		if (soff % zfs_abd_chunk_size != 0) {
+			mutex_exit(&sabd->abd_mutex);
+			return (B_FALSE);
+		}
+		(void) memcpy(&chunks[first],
+		    &sabd->abd_u.abd_scatter.abd_chunks[soff /
+		    zfs_abd_chunk_size], n * sizeof (void *));
+	}
+
+	sabd->abd_flags |= ABD_FLAG_NOMOVE;
+	(void) refcount_add(&sabd->abd_children, abd);
+	mutex_exit(&sabd->abd_mutex);
+
+	for (p = 0; pieces[p] != NULL; p++)
+		;
+	pieces[p] = sabd;
+
+	return (B_TRUE);
+}
+
+/*
+ * Free an ABD allocated from abd_get_offset(), abd_get_from_buf() or
+ * abd_alloc_gang(). Will not free the underlying scatterlist or buffer.
  */
 void
 abd_put(abd_t *abd)
@@ -765,6 +908,23 @@ abd_put(abd_t *abd)
 	abd_verify(abd);
 	ASSERT(!(abd->abd_flags & ABD_FLAG_OWNER));
 
+	if (abd_is_gang(abd)) {
+		abd_t **pieces = abd_gang_pieces(abd);
+
+		for (int p = 0; pieces[p] != NULL; p++) {
+			abd_t *sabd = pieces[p];
+
+			mutex_enter(&sabd->abd_mutex);
+			(void) refcount_remove(&sabd->abd_children, abd);
+			if (refcount_is_zero(&sabd->abd_children))
+				sabd->abd_flags &= ~(ABD_FLAG_NOMOVE);
+			mutex_exit(&sabd->abd_mutex);
+		}
+
+		ABDSTAT_BUMPDOWN(abdstat_gang_cnt);
+		ABDSTAT_INCR(abdstat_gang_data_size, -(int)abd->abd_size);
+	}
+
 	if (abd->abd_parent != NULL) {
 		mutex_enter(&abd->abd_parent->abd_mutex);
 		(void) refcount_remove_many(&abd->abd_parent->abd_children,
@@ -840,6 +1000,7 @@ abd_borrow_buf_copy(abd_t *abd, size_t n)
 	void *buf = abd_borrow_buf(abd, n);
 	if (!abd_is_linear(abd)) {
 		abd_copy_to_buf(buf, abd, n);
+		ABDSTAT_INCR(abdstat_borrowed_copy_bytes, n);
 	}
 	return (buf);
 }
@@ -880,6 +1041,7 @@ abd_return_buf_copy(abd_t *abd, void *buf, size_t n)
 
 	if (!abd_is_linear(abd)) {
 		abd_copy_from_buf(abd, buf, n);
+		ABDSTAT_INCR(abdstat_borrowed_copy_bytes, n);
 	}
 	abd_return_buf(abd, buf, n);
 }
@@ -898,6 +1060,7 @@ abd_return_buf_copy_off(abd_t *abd, void *buf, size_t off, size_t len, size_t n)
 	if (!abd_is_linear(abd)) {
 		ASSERT3S(abd->abd_size,>=,off+len);
 		abd_copy_from_buf_off(abd, buf, off, len);
+		ABDSTAT_INCR(abdstat_borrowed_copy_bytes, len);
 	}
 	abd_return_buf_off(abd, buf, off, len, n);
 }
@@ -1112,6 +1275,76 @@ abd_iterate_func(abd_t *abd, size_t off, size_t size,
 	return (ret);
 }
 
+/*
+ * Describe the first "size" bytes of an ABD as a list of virtually
+ * contiguous segments, so that I/O can be done straight into the ABD's
+ * chunks rather than through a linear copy. Chunks that happen to sit next
+ * to each other in memory are merged into one segment. Returns the number
+ * of segments filled in, or 0 if more than maxsegs would be needed, in
+ * which case nothing is held and the caller should fall back to
+ * abd_borrow_buf(). As with a borrowed buffer, the chunks can't move until
+ * abd_return_segs() is called with the same tag.
+ */
+int
+abd_borrow_segs(abd_t *abd, size_t size, abd_seg_t *segs, int maxsegs,
+    void *tag)
+{
+	struct abd_iter aiter;
+	size_t left = size;
+	int nsegs = 0;
+
+	mutex_enter(&abd->abd_mutex);
+	abd_verify(abd);
+	ASSERT3U(size, <=, (size_t)abd->abd_size);
+	ASSERT3U(size, >, 0);
+
+	abd_iter_init(&aiter, abd);
+
+	while (left > 0) {
+		abd_iter_map(&aiter);
+
+		size_t len = MIN(aiter.iter_mapsize, left);
+		ASSERT3U(len, >, 0);
+
+		if (nsegs > 0 && (char *)segs[nsegs - 1].as_base +
+		    segs[nsegs - 1].as_len == aiter.iter_mapaddr) {
+			segs[nsegs - 1].as_len += len;
+		} else if (nsegs < maxsegs) {
+			segs[nsegs].as_base = aiter.iter_mapaddr;
+			segs[nsegs].as_len = len;
+			nsegs++;
+		} else {
+			abd_iter_unmap(&aiter);
+			mutex_exit(&abd->abd_mutex);
+			return (0);
+		}
+
+		abd_iter_unmap(&aiter);
+
+		left -= len;
+		abd_iter_advance(&aiter, len);
+	}
+
+	(void) refcount_add_many(&abd->abd_children, size, tag);
+	mutex_exit(&abd->abd_mutex);
+
+	ABDSTAT_BUMP(abdstat_borrowed_buf_cnt);
+	ABDSTAT_INCR(abdstat_borrowed_segs_bytes, size);
+
+	return (nsegs);
+}
+
+void
+abd_return_segs(abd_t *abd, size_t size, void *tag)
+{
+	mutex_enter(&abd->abd_mutex);
+	abd_verify(abd);
+	(void) refcount_remove_many(&abd->abd_children, size, tag);
+	mutex_exit(&abd->abd_mutex);
+
+	ABDSTAT_BUMPDOWN(abdstat_borrowed_buf_cnt);
+}
+
 struct buf_arg {
 	void *arg_buf;
 };
@@ -90,7 +90,11 @@
  *
  * buf_hash_find() returns the appropriate mutex (held) when it
  * locates the requested buffer in the hash table.  It returns
- * NULL for the mutex if the buffer was not in the table.
+ * NULL for the mutex if the buffer was not in the table.  The chain
+ * itself is walked without the mutex and the result validated against
+ * a per-lock sequence count, so a lookup that misses usually takes no
+ * lock at all.  Headers are therefore freed through buf_hash_free(),
+ * which holds them back until no such walk can still be looking at them.
  *
  * buf_hash_remove() expects the appropriate hash mutex to be
  * already held before it is invoked.
@@ -313,7 +317,16 @@ static _Atomic boolean_t arc_reclaim_in_loop = B_FALSE;
 #ifdef _KERNEL
 extern vmem_t *zio_arena_parent;
 extern vmem_t *heap_arena;
-static _Atomic int64_t reclaim_shrink_target = 0;
+/*
+ * Memory pressure posted by the SPL or by arc_get_data_impl() that
+ * arc_reclaim_thread() has not acted on yet; see arc_pressure_raise().
+ */
+static volatile uint64_t arc_pressure_level = SPL_PRESSURE_NONE;
+static volatile uint64_t arc_pressure_target = 0;
+static volatile uint64_t arc_pressure_time = 0;
+static volatile boolean_t arc_pressure_eased = B_FALSE;
+/* arc_adapt() won't grow arc_c past this while recovering from pressure */
+static volatile uint64_t arc_grow_limit = UINT64_MAX;
 #endif
 static boolean_t arc_abd_try_move(arc_buf_hdr_t *);
 #endif
@@ -396,6 +409,9 @@ int zfs_arc_grow_retry = 0;
 int zfs_arc_shrink_shift = 0;
 int zfs_arc_p_min_shift = 0;
 int zfs_arc_average_blocksize = 8 * 1024; /* 8KB */
+int zfs_arc_hash_locks_per_cpu = 64;
+int zfs_arc_hash_lockless = 1;
+int zfs_arc_pressure_grow_shift = 7;
 
 boolean_t zfs_compressed_arc_enabled = B_TRUE;
 
@@ -482,6 +498,8 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_hash_collisions;
 	kstat_named_t arcstat_hash_chains;
 	kstat_named_t arcstat_hash_chain_max;
+	kstat_named_t arcstat_hash_lockless_retries;
+	kstat_named_t arcstat_lockless_hits;
 	kstat_named_t arcstat_p;
 	kstat_named_t arcstat_c;
 	kstat_named_t arcstat_c_min;
@@ -680,6 +698,28 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_psize;
 	/* Not updated directly; only synced in arc_kstat_update. */
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Persistent L2ARC: log blocks written and currently on the cache
+	 * devices, and the outcome of rebuilding the L2ARC headers at import.
+	 */
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_log_blk_avg_asize;
+	kstat_named_t arcstat_l2_log_blk_asize;
+	kstat_named_t arcstat_l2_log_blk_count;
+	kstat_named_t arcstat_l2_data_to_meta_ratio;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_dh_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_in_progress;
+	kstat_named_t arcstat_l2_rebuild_time_ms;
 	kstat_named_t arcstat_memory_throttle_count;
 	/* Not updated directly; only synced in arc_kstat_update. */
 	kstat_named_t arcstat_meta_used;
@@ -714,6 +754,11 @@ typedef struct arc_stats {
 	kstat_named_t arc_reclaim_waiters_early_wakeup;
 	kstat_named_t arc_reclaim_waiters_early_broadcast;
 	kstat_named_t arc_reclaim_waiters_loop_timeout;
+	kstat_named_t arcstat_memory_pressure_events;
+	kstat_named_t arcstat_memory_pressure_responses;
+	kstat_named_t arcstat_memory_pressure_freed;
+	kstat_named_t arcstat_memory_pressure_latency;
+	kstat_named_t arcstat_memory_pressure_latency_max;
 #endif
 } arc_stats_t;
 
@@ -745,6 +790,8 @@ static arc_stats_t arc_stats = {
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
 	{ "hash_chains",		KSTAT_DATA_UINT64 },
 	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_lockless_retries",	KSTAT_DATA_UINT64 },
+	{ "lockless_hits",		KSTAT_DATA_UINT64 },
 	{ "p",				KSTAT_DATA_UINT64 },
 	{ "c",				KSTAT_DATA_UINT64 },
 	{ "c_min",			KSTAT_DATA_UINT64 },
@@ -793,6 +840,24 @@ static arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_avg_asize",	KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_count",		KSTAT_DATA_UINT64 },
+	{ "l2_data_to_meta_ratio",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_dh_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_in_progress",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_time_ms",		KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "arc_meta_used",		KSTAT_DATA_UINT64 },
 	{ "arc_meta_limit",		KSTAT_DATA_UINT64 },
@@ -826,6 +891,11 @@ static arc_stats_t arc_stats = {
 	{ "arc_reclaim_waiters_sig",   KSTAT_DATA_UINT64 },
 	{ "arc_reclaim_waiters_bcst",  KSTAT_DATA_UINT64 },
 	{ "arc_reclaim_waiters_tout",  KSTAT_DATA_UINT64 },
+	{ "memory_pressure_events",    KSTAT_DATA_UINT64 },
+	{ "memory_pressure_responses", KSTAT_DATA_UINT64 },
+	{ "memory_pressure_freed",     KSTAT_DATA_UINT64 },
+	{ "memory_pressure_latency_ns", KSTAT_DATA_UINT64 },
+	{ "memory_pressure_latency_max_ns", KSTAT_DATA_UINT64 },
 #endif
 };
 
@@ -847,6 +917,14 @@ static arc_stats_t arc_stats = {
 #define	ARCSTAT_MAXSTAT(stat) \
 	ARCSTAT_MAX(stat##_max, arc_stats.stat.value.ui64)
 
+/*
+ * Exponentially weighted moving average with a weight of 1/2^shift for the
+ * new value. Racy, but only used for informational statistics.
+ */
+#define	ARCSTAT_F_AVG(stat, value, shift) \
+	ARCSTAT(stat) = ARCSTAT(stat) - (ARCSTAT(stat) >> (shift)) + \
+	    ((value) >> (shift))
+
 /*
  * We define a macro to allow ARC hits/misses to be easily broken down by
  * two separate conditions, giving a total of four different subtypes for
@@ -1030,25 +1108,40 @@ typedef struct l2arc_dev l2arc_dev_t;
 
 #define	HT_LOCK_PAD	128
 
+/*
+ * Each hash lock covers the chains whose index maps onto it and carries
+ * a sequence count that is odd while one of those chains is being
+ * changed.  Lockless readers use it to validate what they walked.
+ */
 struct ht_lock {
 	kmutex_t	ht_lock;
+	volatile uint64_t ht_seq;
 #ifdef _KERNEL
-	unsigned char	pad[(HT_LOCK_PAD - sizeof (kmutex_t))];
+	unsigned char	pad[(HT_LOCK_PAD - sizeof (kmutex_t) -
+	    sizeof (uint64_t))];
 #endif
 };
 
-#define	BUF_LOCKS 256
+/*
+ * The number of hash locks scales with the number of CPUs
+ * (zfs_arc_hash_locks_per_cpu each), bounded by BUF_LOCKS_MIN,
+ * BUF_LOCKS_MAX and the number of hash buckets.
+ */
+#define	BUF_LOCKS_MIN	256
+#define	BUF_LOCKS_MAX	(1 << 16)
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
-	struct ht_lock ht_locks[BUF_LOCKS];
+	uint64_t ht_lock_mask;
+	struct ht_lock *ht_locks;
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
 #define	BUF_HASH_INDEX(spa, dva, birth) \
 	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK_NTRY(idx) (buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
+#define	BUF_HASH_LOCK_NTRY(idx) \
+	(buf_hash_table.ht_locks[(idx) & buf_hash_table.ht_lock_mask])
 #define	BUF_HASH_LOCK(idx)	(&(BUF_HASH_LOCK_NTRY(idx).ht_lock))
 #define	HDR_LOCK(hdr) \
 	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
@@ -1096,6 +1189,15 @@ boolean_t l2arc_noprefetch = B_TRUE;		/* don't cache prefetch bufs */
 boolean_t l2arc_feed_again = B_TRUE;		/* turbo warmup */
 boolean_t l2arc_norw = B_TRUE;			/* no reads during writes */
 
+/*
+ * Persistent L2ARC tunables. Rebuilding can be disabled, in which case the
+ * contents of cache devices are discarded at import. Cache devices smaller
+ * than l2arc_rebuild_blocks_min_l2size are not worth the log block overhead
+ * and are never made persistent.
+ */
+boolean_t l2arc_rebuild_enabled = B_TRUE;
+uint64_t l2arc_rebuild_blocks_min_l2size = 1024 * 1024 * 1024;
+
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
@@ -1133,6 +1235,9 @@ static kmutex_t l2arc_feed_thr_lock;
 static kcondvar_t l2arc_feed_thr_cv;
 static uint8_t l2arc_thread_exit;
 
+static kmutex_t l2arc_rebuild_thr_lock;
+static kcondvar_t l2arc_rebuild_thr_cv;
+
 static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, void *);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, void *);
 static void arc_get_data_impl(arc_buf_hdr_t *, uint64_t, void *);
@@ -1153,6 +1258,15 @@ static inline void arc_hdr_clear_flags(arc_buf_hdr_t *hdr, arc_flags_t flags);
 static boolean_t l2arc_write_eligible(uint64_t, arc_buf_hdr_t *);
 static void l2arc_read_done(zio_t *);
 
+static uint64_t l2arc_log_blk_overhead(uint64_t, l2arc_dev_t *);
+static boolean_t l2arc_log_blkptr_valid(l2arc_dev_t *,
+    const l2arc_log_blkptr_t *);
+static boolean_t l2arc_log_blk_insert(l2arc_dev_t *, const arc_buf_hdr_t *);
+static void l2arc_log_blk_commit(l2arc_dev_t *, zio_t *,
+    l2arc_write_callback_t *);
+static void l2arc_dev_hdr_update(l2arc_dev_t *);
+static void l2arc_rebuild_vdev(l2arc_dev_t *);
+
 
 /*
  * We use Cityhash for this. It's fast, and has good hash properties without
@@ -1181,16 +1295,129 @@ buf_discard_identity(arc_buf_hdr_t *hdr)
 	hdr->b_birth = 0;
 }
 
+/*
+ * buf_hash_find() first walks the hash chain without the hash lock.  A
+ * header unlinked from a chain may still be visited by such a walk, so
+ * headers are not returned to their kmem cache until every lockless
+ * reader that could have seen them is done (see buf_hash_free()).
+ * Readers announce themselves in a per-CPU counter picked by the parity
+ * of buf_hash_epoch; buf_hash_reclaim() advances the epoch and waits for
+ * the counters of the previous parity to drain.
+ */
+typedef struct buf_hash_reader {
+	volatile uint64_t	bhr_count[2];
+	uint64_t		bhr_pad[6];
+} buf_hash_reader_t;
+
+static buf_hash_reader_t *buf_hash_readers;
+static int buf_hash_nreaders;
+static volatile uint64_t buf_hash_epoch;
+
+/* Longest chain walked without the lock before giving up on it */
+#define	BUF_HASH_LOCKLESS_STEPS	32
+
+static volatile uint64_t *
+buf_hash_read_enter(void)
+{
+	volatile uint64_t *countp;
+	uint64_t epoch;
+
+	for (;;) {
+		epoch = buf_hash_epoch;
+		countp = &buf_hash_readers[CPU_SEQID %
+		    buf_hash_nreaders].bhr_count[epoch & 1];
+		atomic_inc_64(countp);
+		membar_enter();
+		if (buf_hash_epoch == epoch)
+			return (countp);
+		atomic_dec_64(countp);
+	}
+}
+
+static void
+buf_hash_read_exit(volatile uint64_t *countp)
+{
+	membar_exit();
+	atomic_dec_64(countp);
+}
+
+/*
+ * Chains may only be changed between these two calls, with the hash
+ * lock held.
+ */
+static void
+buf_hash_write_begin(struct ht_lock *htl)
+{
+	ASSERT(MUTEX_HELD(&htl->ht_lock));
+	htl->ht_seq++;
+	membar_producer();
+}
+
+static void
+buf_hash_write_end(struct ht_lock *htl)
+{
+	membar_producer();
+	htl->ht_seq++;
+}
+
 static arc_buf_hdr_t *
 buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 {
 	const dva_t *dva = BP_IDENTITY(bp);
 	uint64_t birth = BP_PHYSICAL_BIRTH(bp);
 	uint64_t idx = BUF_HASH_INDEX(spa, dva, birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+	struct ht_lock *htl = &BUF_HASH_LOCK_NTRY(idx);
+	kmutex_t *hash_lock = &htl->ht_lock;
+	volatile uint64_t *countp;
 	arc_buf_hdr_t *hdr;
+	uint64_t seq;
+	int steps;
+
+	if (!zfs_arc_hash_lockless)
+		goto locked;
+
+	/*
+	 * Walk the chain locklessly.  If no chain covered by this lock
+	 * changed while we walked (ht_seq is even and unchanged), a miss
+	 * is authoritative.  A hit is confirmed by taking the lock and
+	 * checking ht_seq again, which proves the header is still linked.
+	 */
+	seq = htl->ht_seq;
+	if (seq & 1) {
+		ARCSTAT_BUMP(arcstat_hash_lockless_retries);
+		goto locked;
+	}
+
+	countp = buf_hash_read_enter();
+	for (hdr = buf_hash_table.ht_table[idx], steps = 0; hdr != NULL;
+	    hdr = hdr->b_hash_next) {
+		if (HDR_EQUAL(spa, dva, birth, hdr) ||
+		    ++steps == BUF_HASH_LOCKLESS_STEPS)
+			break;
+	}
+	buf_hash_read_exit(countp);
+
+	if (hdr == NULL) {
+		membar_consumer();
+		if (htl->ht_seq == seq) {
+			*lockp = NULL;
+			return (NULL);
+		}
+		ARCSTAT_BUMP(arcstat_hash_lockless_retries);
+		goto locked;
+	}
 
 	mutex_enter(hash_lock);
+	if (htl->ht_seq == seq && HDR_EQUAL(spa, dva, birth, hdr)) {
+		*lockp = hash_lock;
+		return (hdr);
+	}
+	ARCSTAT_BUMP(arcstat_hash_lockless_retries);
+	goto walk;
+
+locked:
+	mutex_enter(hash_lock);
+walk:
 	for (hdr = buf_hash_table.ht_table[idx]; hdr != NULL;
 	    hdr = hdr->b_hash_next) {
 		if (HDR_EQUAL(spa, dva, birth, hdr)) {
@@ -1214,7 +1441,8 @@ static arc_buf_hdr_t *
 buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 {
 	uint64_t idx = BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+	struct ht_lock *htl = &BUF_HASH_LOCK_NTRY(idx);
+	kmutex_t *hash_lock = &htl->ht_lock;
 	arc_buf_hdr_t *fhdr;
 	uint32_t i;
 
@@ -1235,8 +1463,11 @@ buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 			return (fhdr);
 	}
 
+	buf_hash_write_begin(htl);
 	hdr->b_hash_next = buf_hash_table.ht_table[idx];
+	membar_producer();
 	buf_hash_table.ht_table[idx] = hdr;
+	buf_hash_write_end(htl);
 	arc_hdr_set_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
@@ -1259,8 +1490,9 @@ buf_hash_remove(arc_buf_hdr_t *hdr)
 {
 	arc_buf_hdr_t *fhdr, **hdrp;
 	uint64_t idx = BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
+	struct ht_lock *htl = &BUF_HASH_LOCK_NTRY(idx);
 
-	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(idx)));
+	ASSERT(MUTEX_HELD(&htl->ht_lock));
 	ASSERT(HDR_IN_HASH_TABLE(hdr));
 
 	hdrp = &buf_hash_table.ht_table[idx];
@@ -1268,8 +1500,10 @@ buf_hash_remove(arc_buf_hdr_t *hdr)
 		ASSERT3P(fhdr, !=, NULL);
 		hdrp = &fhdr->b_hash_next;
 	}
+	buf_hash_write_begin(htl);
 	*hdrp = hdr->b_hash_next;
 	hdr->b_hash_next = NULL;
+	buf_hash_write_end(htl);
 	arc_hdr_clear_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
@@ -1289,15 +1523,116 @@ static kmem_cache_t *hdr_full_crypt_cache;
 static kmem_cache_t *hdr_l2only_cache;
 static kmem_cache_t *buf_cache;
 
+/*
+ * Headers waiting for lockless readers to drain before they can go back
+ * to their kmem cache, one list per header cache, linked through
+ * b_hash_next.
+ */
+typedef struct buf_hash_deferred {
+	kmem_cache_t	*bhd_cache;
+	arc_buf_hdr_t	*bhd_list;
+} buf_hash_deferred_t;
+
+#define	BUF_HASH_DEFERRED_CACHES	3
+/* Wake the reclaim thread once this many headers are waiting */
+#define	BUF_HASH_DEFERRED_MAX		4096
+
+static kmutex_t buf_hash_deferred_lock;
+static kmutex_t buf_hash_reclaim_lock;
+static buf_hash_deferred_t buf_hash_deferred[BUF_HASH_DEFERRED_CACHES];
+static uint64_t buf_hash_deferred_count;
+
+/*
+ * Free a header that may have been in the hash table.  This takes the
+ * place of kmem_cache_free() for hdr_full_cache, hdr_full_crypt_cache
+ * and hdr_l2only_cache.
+ */
+static void
+buf_hash_free(kmem_cache_t *cache, arc_buf_hdr_t *hdr)
+{
+	buf_hash_deferred_t *bhd;
+	boolean_t wakeup;
+	int i;
+
+	ASSERT(!HDR_IN_HASH_TABLE(hdr));
+	ASSERT3P(hdr->b_hash_next, ==, NULL);
+
+	for (i = 0; buf_hash_deferred[i].bhd_cache != cache; i++)
+		ASSERT3S(i, <, BUF_HASH_DEFERRED_CACHES - 1);
+	bhd = &buf_hash_deferred[i];
+
+	mutex_enter(&buf_hash_deferred_lock);
+	hdr->b_hash_next = bhd->bhd_list;
+	bhd->bhd_list = hdr;
+	wakeup = (++buf_hash_deferred_count == BUF_HASH_DEFERRED_MAX);
+	mutex_exit(&buf_hash_deferred_lock);
+
+	if (wakeup && !arc_dead)
+		cv_signal(&arc_reclaim_thread_cv);
+}
+
+/*
+ * Return the deferred headers to their caches once no lockless reader
+ * can still be looking at them.
+ */
+static void
+buf_hash_reclaim(void)
+{
+	arc_buf_hdr_t *list[BUF_HASH_DEFERRED_CACHES];
+	arc_buf_hdr_t *hdr, *next;
+	uint64_t epoch;
+	int i;
+
+	mutex_enter(&buf_hash_reclaim_lock);
+	mutex_enter(&buf_hash_deferred_lock);
+	if (buf_hash_deferred_count == 0) {
+		mutex_exit(&buf_hash_deferred_lock);
+		mutex_exit(&buf_hash_reclaim_lock);
+		return;
+	}
+	for (i = 0; i < BUF_HASH_DEFERRED_CACHES; i++) {
+		list[i] = buf_hash_deferred[i].bhd_list;
+		buf_hash_deferred[i].bhd_list = NULL;
+	}
+	buf_hash_deferred_count = 0;
+	mutex_exit(&buf_hash_deferred_lock);
+
+	/*
+	 * Readers that enter after the epoch moves on cannot find these
+	 * headers; wait out the ones that entered before.
+	 */
+	epoch = atomic_inc_64_nv(&buf_hash_epoch) - 1;
+	for (i = 0; i < buf_hash_nreaders; i++) {
+		while (buf_hash_readers[i].bhr_count[epoch & 1] != 0)
+			kpreempt(KPREEMPT_SYNC);
+	}
+	mutex_exit(&buf_hash_reclaim_lock);
+
+	for (i = 0; i < BUF_HASH_DEFERRED_CACHES; i++) {
+		for (hdr = list[i]; hdr != NULL; hdr = next) {
+			next = hdr->b_hash_next;
+			hdr->b_hash_next = NULL;
+			kmem_cache_free(buf_hash_deferred[i].bhd_cache, hdr);
+		}
+	}
+}
+
 static void
 buf_fini(void)
 {
 	int i;
 
+	buf_hash_reclaim();
 	kmem_free(buf_hash_table.ht_table,
 	    (buf_hash_table.ht_mask + 1) * sizeof (void *));
-	for (i = 0; i < BUF_LOCKS; i++)
+	for (i = 0; i <= buf_hash_table.ht_lock_mask; i++)
 		mutex_destroy(&buf_hash_table.ht_locks[i].ht_lock);
+	kmem_free(buf_hash_table.ht_locks,
+	    (buf_hash_table.ht_lock_mask + 1) * sizeof (struct ht_lock));
+	kmem_free(buf_hash_readers,
+	    buf_hash_nreaders * sizeof (buf_hash_reader_t));
+	mutex_destroy(&buf_hash_deferred_lock);
+	mutex_destroy(&buf_hash_reclaim_lock);
 	kmem_cache_destroy(hdr_full_cache);
 	kmem_cache_destroy(hdr_full_crypt_cache);
 	kmem_cache_destroy(hdr_l2only_cache);
@@ -1438,6 +1773,7 @@ buf_init(void)
 {
 	uint64_t *ct;
 	uint64_t hsize = 1ULL << 12;
+	uint64_t nlocks;
 	int i, j;
 
 	/*
@@ -1475,10 +1811,32 @@ retry:
 		for (ct = zfs_crc64_table + i, *ct = i, j = 8; j > 0; j--)
 			*ct = (*ct >> 1) ^ (-(*ct & 1) & ZFS_CRC64_POLY);
 
-	for (i = 0; i < BUF_LOCKS; i++) {
+	/*
+	 * Give each CPU zfs_arc_hash_locks_per_cpu locks worth of the
+	 * table so that concurrent lookups rarely meet on the same lock,
+	 * but never use more locks than there are buckets.
+	 */
+	nlocks = BUF_LOCKS_MIN;
+	while (nlocks < (uint64_t)max_ncpus * zfs_arc_hash_locks_per_cpu &&
+	    nlocks < BUF_LOCKS_MAX && nlocks < hsize)
+		nlocks <<= 1;
+	buf_hash_table.ht_lock_mask = nlocks - 1;
+	buf_hash_table.ht_locks =
+	    kmem_zalloc(nlocks * sizeof (struct ht_lock), KM_SLEEP);
+	for (i = 0; i < nlocks; i++) {
 		mutex_init(&buf_hash_table.ht_locks[i].ht_lock,
 		    NULL, MUTEX_DEFAULT, NULL);
 	}
+
+	buf_hash_nreaders = max_ncpus;
+	buf_hash_readers =
+	    kmem_zalloc(buf_hash_nreaders * sizeof (buf_hash_reader_t),
+	    KM_SLEEP);
+	mutex_init(&buf_hash_deferred_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&buf_hash_reclaim_lock, NULL, MUTEX_DEFAULT, NULL);
+	buf_hash_deferred[0].bhd_cache = hdr_full_cache;
+	buf_hash_deferred[1].bhd_cache = hdr_full_crypt_cache;
+	buf_hash_deferred[2].bhd_cache = hdr_l2only_cache;
 }
 
 /*
@@ -3567,7 +3925,7 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 	(void) refcount_add_many(&dev->l2ad_alloc, arc_hdr_size(nhdr), nhdr);
 
 	buf_discard_identity(hdr);
-	kmem_cache_free(old, hdr);
+	buf_hash_free(old, hdr);
 
 	return (nhdr);
 }
@@ -3695,7 +4053,7 @@ arc_hdr_realloc_crypt(arc_buf_hdr_t *hdr, boolean_t need_crypt)
 	arc_space_return(osize, ARC_SPACE_HDRS);
 
 	buf_discard_identity(hdr);
- 	kmem_cache_free(ocache, hdr);
+	buf_hash_free(ocache, hdr);
 
 	return (nhdr);
 }
@@ -3921,12 +4279,12 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 		ASSERT3P(hdr->b_l1hdr.b_acb, ==, NULL);
 
 		if (!HDR_PROTECTED(hdr)) {
-			kmem_cache_free(hdr_full_cache, hdr);
+			buf_hash_free(hdr_full_cache, hdr);
 		} else {
-			kmem_cache_free(hdr_full_crypt_cache, hdr);
+			buf_hash_free(hdr_full_crypt_cache, hdr);
 		}
 	} else {
-		kmem_cache_free(hdr_l2only_cache, hdr);
+		buf_hash_free(hdr_l2only_cache, hdr);
 	}
 }
 
@@ -4729,12 +5087,9 @@ arc_available_memory(void)
 #ifdef _WIN32
 	// memory logic is in spl_free_wrapper(), including absorption
 	// of pressure terms
+	// pressure is pushed to arc_reclaim_thread() by arc_pressure_notify()
 	lowest = spl_free_wrapper();
 	r = FMR_SPL_FREE;
-	if(spl_free_fast_pressure_wrapper() != FALSE && arc_reclaim_in_loop == B_FALSE) {
-		// wake up arc_reclaim_thread() if it is sleeping
-		cv_signal(&arc_reclaim_thread_cv);
-	}
 #endif //_WIN32
 #ifdef sun
 	int64_t n;
@@ -4923,6 +5278,161 @@ arc_kmem_reap_now(void)
 #endif
 }
 
+#if defined(_WIN32) && defined(_KERNEL)
+/*
+ * Record memory pressure for arc_reclaim_thread().  Posts are merged:
+ * the level and target only ever rise until the thread takes them, and
+ * arc_pressure_time keeps the arrival of the oldest one so the response
+ * latency covers the whole wait.  This runs in whatever context noticed
+ * the shortage, often an allocating thread, so it must not block.
+ */
+static void
+arc_pressure_raise(spl_pressure_level_t level, int64_t target,
+    boolean_t additive)
+{
+	uint64_t old;
+
+	if (additive) {
+		atomic_add_64(&arc_pressure_target, target);
+	} else {
+		while ((old = arc_pressure_target) < (uint64_t)target &&
+		    atomic_cas_64(&arc_pressure_target, old, target) != old)
+			;
+	}
+	while ((old = arc_pressure_level) < (uint64_t)level &&
+	    atomic_cas_64(&arc_pressure_level, old, level) != old)
+		;
+	(void) atomic_cas_64(&arc_pressure_time, 0, gethrtime());
+	ARCSTAT_BUMP(arcstat_memory_pressure_events);
+
+	/* LOW only holds off growth, which can wait for the next pass */
+	if (level >= SPL_PRESSURE_MODERATE)
+		cv_signal(&arc_reclaim_thread_cv);
+}
+
+/* ARGSUSED */
+static void
+arc_pressure_notify(spl_pressure_level_t level, int64_t target, void *arg)
+{
+	if (level == SPL_PRESSURE_NONE) {
+		arc_pressure_eased = B_TRUE;
+		return;
+	}
+	arc_pressure_eased = B_FALSE;
+	arc_pressure_raise(level, MAX(target, 0), B_FALSE);
+}
+
+/*
+ * Act on posted pressure.  The ARC gives back the target it was asked
+ * for rather than a fixed fraction of arc_c, reaps harder the more urgent
+ * the level, and holds off growth for a time that grows with the level.
+ * Returns the level that was handled.
+ */
+static spl_pressure_level_t
+arc_pressure_respond(hrtime_t *growtime, uint64_t *evicted)
+{
+	static spl_pressure_level_t last_level = SPL_PRESSURE_NONE;
+	spl_pressure_level_t level;
+	int64_t target;
+	hrtime_t posted, now, hold, latency;
+
+	level = atomic_swap_64(&arc_pressure_level, SPL_PRESSURE_NONE);
+	if (level == SPL_PRESSURE_NONE) {
+		/*
+		 * The SPL says the shortage is over.  If all it ever asked
+		 * for was to stop growing, start again now; arc_grow_limit
+		 * keeps the regrowth gradual.
+		 */
+		if (arc_pressure_eased) {
+			arc_pressure_eased = B_FALSE;
+			if (last_level == SPL_PRESSURE_LOW && *growtime > 0)
+				*growtime = gethrtime();
+		}
+		return (level);
+	}
+	target = atomic_swap_64(&arc_pressure_target, 0);
+	posted = atomic_swap_64(&arc_pressure_time, 0);
+	last_level = level;
+
+	switch (level) {
+	case SPL_PRESSURE_LOW:
+		hold = MSEC2NSEC(500);
+		break;
+	case SPL_PRESSURE_MODERATE:
+		hold = SEC2NSEC(1);
+		break;
+	case SPL_PRESSURE_HIGH:
+		hold = SEC2NSEC(arc_grow_retry) / 4;
+		break;
+	default:
+		hold = SEC2NSEC(arc_grow_retry) / 2;
+		break;
+	}
+	now = gethrtime();
+	arc_no_grow = B_TRUE;
+	if (*growtime < now + hold)
+		*growtime = now + hold;
+
+	if (level >= SPL_PRESSURE_MODERATE) {
+		if (target > 0) {
+			*evicted = arc_shrink(target);
+			ARCSTAT_INCR(arcstat_memory_pressure_freed, *evicted);
+		}
+		if (level >= SPL_PRESSURE_CRITICAL) {
+			arc_kmem_reap_now();
+		} else if (level >= SPL_PRESSURE_HIGH) {
+			extern kmem_cache_t	*abd_chunk_cache;
+			kmem_cache_reap_now(abd_chunk_cache);
+		}
+		if (*evicted > 64LL*1024LL*1024LL)
+			cv_signal(&arc_abd_move_thr_cv);
+
+		/* answer the SPL, releasing spl_free_set_and_wait_pressure() */
+		spl_free_set_pressure(0);
+	}
+	arc_grow_limit = arc_c;
+
+	ARCSTAT_BUMP(arcstat_memory_pressure_responses);
+	if (posted != 0) {
+		latency = gethrtime() - posted;
+		ARCSTAT(arcstat_memory_pressure_latency) = latency;
+		if (latency > ARCSTAT(arcstat_memory_pressure_latency_max))
+			ARCSTAT(arcstat_memory_pressure_latency_max) = latency;
+	}
+
+	return (level);
+}
+
+/*
+ * Once growth is allowed again after pressure, let arc_c come back by
+ * 1/2^zfs_arc_pressure_grow_shift of itself every half second instead of
+ * by every allocation that arrives, so a single burst of reads can't
+ * regrow the ARC straight into the next shortage.
+ */
+static void
+arc_pressure_ramp(void)
+{
+	static hrtime_t last_step = 0;
+	hrtime_t now;
+
+	if (arc_grow_limit == UINT64_MAX || arc_no_grow)
+		return;
+
+	now = gethrtime();
+	if (now - last_step < MSEC2NSEC(500))
+		return;
+	last_step = now;
+
+	if (zfs_arc_pressure_grow_shift <= 0 ||
+	    arc_grow_limit >= arc_c_max) {
+		arc_grow_limit = UINT64_MAX;
+		return;
+	}
+	arc_grow_limit = MAX(arc_grow_limit,
+	    arc_c + (arc_c >> zfs_arc_pressure_grow_shift));
+}
+#endif
+
 /*
  * Threads can block in arc_get_data_impl() waiting for this thread to evict
  * enough data and signal them to proceed. When this happens, the threads in
@@ -4973,17 +5483,19 @@ arc_reclaim_thread(void)
 
 		mutex_exit(&arc_reclaim_lock);
 
+		/* Free headers that lockless lookups are done with. */
+		buf_hash_reclaim();
+
 #ifdef _WIN32
 #ifdef _KERNEL
-		if (reclaim_shrink_target > 0) {
-			int64_t t = reclaim_shrink_target;
-			reclaim_shrink_target = 0;
-			evicted = arc_shrink(t);
-			extern kmem_cache_t	*abd_chunk_cache;
-			kmem_cache_reap_now(abd_chunk_cache);
-			IOSleep(1);
+		/*
+		 * Posted pressure has been answered in full, so skip the
+		 * spl_free based sizing below, which would only see the
+		 * shortage again before spl_free_thread() recomputes it.
+		 */
+		if (arc_pressure_respond(&growtime, &evicted) >=
+		    SPL_PRESSURE_MODERATE)
 			goto lock_and_sleep;
-		}
 
 		int64_t pre_adjust_free_memory = MIN(spl_free_wrapper(), arc_available_memory());
 
@@ -5212,6 +5724,10 @@ arc_reclaim_thread(void)
 			arc_no_grow = B_FALSE;
 		}
 
+#if defined(_WIN32) && defined(_KERNEL)
+		arc_pressure_ramp();
+#endif
+
 #ifdef _WIN32
 #ifdef _KERNEL
 	lock_and_sleep:
@@ -5245,6 +5761,10 @@ arc_reclaim_thread(void)
 			 * even if we aren't being signalled)
 			 */
 			CALLB_CPR_SAFE_BEGIN(&cpr);
+#if defined(_WIN32) && defined(_KERNEL)
+			/* don't sleep on pressure posted during this pass */
+			if (arc_pressure_level == SPL_PRESSURE_NONE)
+#endif
 			(void) cv_timedwait_hires(&arc_reclaim_thread_cv,
 			    &arc_reclaim_lock, MSEC2NSEC(500), MSEC2NSEC(1), 0);
 			CALLB_CPR_SAFE_END(&cpr, &arc_reclaim_lock);
@@ -5332,6 +5852,10 @@ arc_adapt(int bytes, arc_state_t *state)
 		return;
 	}
 
+	/* still ramping back up after memory pressure */
+	if (arc_c + bytes > arc_grow_limit)
+		return;
+
 	boolean_t buf_is_metadata = B_FALSE;
 	if (type == ARC_BUFC_METADATA) {
 		buf_is_metadata = B_TRUE;
@@ -5398,7 +5922,8 @@ arc_adapt(int bytes, arc_state_t *state)
 			if (!overflowing) {
 				return;
 			} else {
-				reclaim_shrink_target += bytes;
+				arc_pressure_raise(SPL_PRESSURE_MODERATE,
+				    bytes, B_TRUE);
 			}
 		} else {
 			/*
@@ -6056,6 +6581,74 @@ arc_read_done(zio_t *zio)
 		arc_hdr_destroy(hdr);
 }
 
+/*
+ * Answer a cache hit without taking the hash lock, when it needs nothing
+ * from the header but a new access time: the caller wants no buf, and the
+ * header is in arc_mfu, where arc_access() only sets b_arc_access, and
+ * already has the flags the read would set. The header is found with the
+ * same lockless walk as buf_hash_find() and checked against ht_seq after
+ * its fields have been read; buf_hash_free() keeps it from being reused
+ * until buf_hash_read_exit(). Returns B_FALSE if the locked path has to
+ * handle the read.
+ *
+ * A header evicted to arc_mfu_ghost meanwhile can still be counted as a
+ * hit. The caller then skips a read that nobody waits for, which only
+ * matters to a prefetch, and a prefetch of it can be issued again later.
+ */
+static boolean_t
+arc_read_lockless(uint64_t spa, const blkptr_t *bp, arc_flags_t arc_flags,
+    boolean_t encrypted_read)
+{
+	const dva_t *dva = BP_IDENTITY(bp);
+	uint64_t birth = BP_PHYSICAL_BIRTH(bp);
+	uint64_t idx = BUF_HASH_INDEX(spa, dva, birth);
+	struct ht_lock *htl = &BUF_HASH_LOCK_NTRY(idx);
+	volatile uint64_t *countp;
+	arc_buf_hdr_t *hdr;
+	boolean_t hit = B_FALSE;
+	uint64_t seq;
+	int steps;
+
+	if (!zfs_arc_hash_lockless || encrypted_read)
+		return (B_FALSE);
+
+	seq = htl->ht_seq;
+	if (seq & 1)
+		return (B_FALSE);
+	membar_consumer();
+
+	countp = buf_hash_read_enter();
+	for (hdr = buf_hash_table.ht_table[idx], steps = 0; hdr != NULL;
+	    hdr = hdr->b_hash_next) {
+		if (HDR_EQUAL(spa, dva, birth, hdr) ||
+		    ++steps == BUF_HASH_LOCKLESS_STEPS)
+			break;
+	}
+
+	if (hdr != NULL && HDR_EQUAL(spa, dva, birth, hdr) &&
+	    HDR_HAS_L1HDR(hdr) && hdr->b_l1hdr.b_state == arc_mfu &&
+	    hdr->b_l1hdr.b_pabd != NULL && !HDR_IO_IN_PROGRESS(hdr) &&
+	    (!(arc_flags & ARC_FLAG_PREFETCH) ||
+	    refcount_count(&hdr->b_l1hdr.b_refcnt) != 0) &&
+	    (!(arc_flags & ARC_FLAG_L2CACHE) || HDR_L2CACHE(hdr))) {
+		membar_consumer();
+		if (htl->ht_seq == seq) {
+			DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
+			hdr->b_l1hdr.b_arc_access = ddi_get_lbolt();
+			ARCSTAT_BUMP(arcstat_mfu_hits);
+			ARCSTAT_BUMP(arcstat_hits);
+			ARCSTAT_CONDSTAT(!HDR_PREFETCH(hdr),
+			    demand, prefetch, !HDR_ISTYPE_METADATA(hdr),
+			    data, metadata, hits);
+			ARCSTAT_BUMP(arcstat_lockless_hits);
+			hit = B_TRUE;
+		}
+	}
+	buf_hash_read_exit(countp);
+
+	return (hit);
+}
+
 /*
  * "Read" the block at the specified DVA (in bp) via the
  * cache.  If the block is found in the cache, invoke the provided
@@ -6093,6 +6686,12 @@ arc_read(zio_t *pio, spa_t *spa, const blkptr_t *bp,
 	ASSERT(!BP_IS_EMBEDDED(bp) ||
 	    BPE_GET_ETYPE(bp) == BP_EMBEDDED_TYPE_DATA);
 
+	if (done == NULL && !BP_IS_EMBEDDED(bp) &&
+	    arc_read_lockless(guid, bp, *arc_flags, encrypted_read)) {
+		*arc_flags |= ARC_FLAG_CACHED;
+		return (0);
+	}
+
 top:
 	if (!BP_IS_EMBEDDED(bp)) {
 		/*
@@ -7452,6 +8051,11 @@ int arc_kstat_update_osx(kstat_t *ksp, int rw)
 		zfs_arc_shrink_shift      = ks->arc_zfs_arc_shrink_shift.value.ui64;
 		zfs_arc_p_min_shift       = ks->arc_zfs_arc_p_min_shift.value.ui64;
 		zfs_arc_average_blocksize = ks->arc_zfs_arc_average_blocksize.value.ui64;
+		zfs_arc_hash_locks_per_cpu =
+		    ks->arc_zfs_arc_hash_locks_per_cpu.value.ui64;
+		zfs_arc_hash_lockless = ks->arc_zfs_arc_hash_lockless.value.ui64;
+		zfs_arc_pressure_grow_shift =
+		    ks->arc_zfs_arc_pressure_grow_shift.value.ui64;
 
 	} else {
 
@@ -7468,6 +8072,11 @@ int arc_kstat_update_osx(kstat_t *ksp, int rw)
 		ks->arc_zfs_arc_shrink_shift.value.ui64      = zfs_arc_shrink_shift;
 		ks->arc_zfs_arc_p_min_shift.value.ui64       = zfs_arc_p_min_shift;
 		ks->arc_zfs_arc_average_blocksize.value.ui64 = zfs_arc_average_blocksize;
+		ks->arc_zfs_arc_hash_locks_per_cpu.value.ui64 =
+		    zfs_arc_hash_locks_per_cpu;
+		ks->arc_zfs_arc_hash_lockless.value.ui64 = zfs_arc_hash_lockless;
+		ks->arc_zfs_arc_pressure_grow_shift.value.ui64 =
+		    zfs_arc_pressure_grow_shift;
 	}
 	return 0;
 }
@@ -7758,6 +8367,10 @@ arc_init(void)
 	(void) thread_create(NULL, 0, arc_reclaim_thread, NULL, 0, &p0,
 	    TS_RUN, minclsyspri);
 
+#if defined(_WIN32) && defined(_KERNEL)
+	spl_pressure_register(arc_pressure_notify, NULL);
+#endif
+
 	arc_dead = B_FALSE;
 	arc_warm = B_FALSE;
 
@@ -7786,6 +8399,9 @@ void
 arc_fini(void)
 {
 #ifdef _WIN32
+#ifdef _KERNEL
+	spl_pressure_unregister();
+#endif
 	arc_abd_move_thr_fini();
 #endif
 	mutex_enter(&arc_reclaim_lock);
@@ -8067,10 +8683,14 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
-	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	/*
+	 * If we were unable to find any usable vdevs, return NULL. Devices
+	 * whose headers are still being rebuilt are not written to, as that
+	 * could overwrite log blocks not yet read.
+	 */
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -8225,6 +8845,14 @@ top:
 
 	l2arc_do_free_on_write();
 
+	/* Free the log blocks written along with the buffers. */
+	l2arc_lb_abd_buf_t *abd_buf;
+	while ((abd_buf = list_remove_head(&cb->l2wcb_abd_list)) != NULL) {
+		abd_free(abd_buf->lb_abd);
+		kmem_free(abd_buf, sizeof (l2arc_lb_abd_buf_t));
+	}
+	list_destroy(&cb->l2wcb_abd_list);
+
 	kmem_free(cb, sizeof (l2arc_write_callback_t));
 }
 
@@ -8503,24 +9131,27 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 {
 	list_t *buflist;
 	arc_buf_hdr_t *hdr, *hdr_prev;
+	l2arc_lb_ptr_buf_t *lb_ptr_buf, *lb_ptr_buf_prev;
 	kmutex_t *hash_lock;
 	uint64_t taddr;
+	boolean_t rerun;
 
 	buflist = &dev->l2ad_buflist;
 
-	if (!all && dev->l2ad_first) {
-		/*
-		 * This is the first sweep through the device.  There is
-		 * nothing to evict.
-		 */
-		return;
-	}
+	/*
+	 * The log blocks written along with the buffers need room too.
+	 */
+	distance += l2arc_log_blk_overhead(distance, dev);
 
-	if (dev->l2ad_hand >= (dev->l2ad_end - (2 * distance))) {
+again:
+	rerun = B_FALSE;
+	if (dev->l2ad_hand >= (dev->l2ad_end - distance)) {
 		/*
-		 * When nearing the end of the device, evict to the end
-		 * before the device write hand jumps to the start.
+		 * When there is no room left for the upcoming write, evict
+		 * to the end of the device, then move the write and evict
+		 * hands to the start and go around again.
 		 */
+		rerun = B_TRUE;
 		taddr = dev->l2ad_end;
 	} else {
 		taddr = dev->l2ad_hand + distance;
@@ -8528,8 +9159,47 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
+	/*
+	 * The evict hand is persisted in the device header, so that a rebuild
+	 * knows which part of the device may already have been overwritten.
+	 */
+	dev->l2ad_evict = MAX(dev->l2ad_evict, taddr);
+
+	if (!all && dev->l2ad_first) {
+		/*
+		 * This is the first sweep through the device.  There is
+		 * nothing to evict.
+		 */
+		goto out;
+	}
+
 top:
 	mutex_enter(&dev->l2ad_mtx);
+
+	/*
+	 * Drop the log blocks that are about to be overwritten, or whose
+	 * payload is. They are kept oldest last, so stop at the first one
+	 * which is still intact.
+	 */
+	for (lb_ptr_buf = list_tail(&dev->l2ad_lbptr_list); lb_ptr_buf != NULL;
+	    lb_ptr_buf = lb_ptr_buf_prev) {
+		uint64_t asize = L2BLK_GET_PSIZE(lb_ptr_buf->lb_ptr.lbp_prop);
+
+		lb_ptr_buf_prev = list_prev(&dev->l2ad_lbptr_list, lb_ptr_buf);
+
+		if (!all && l2arc_log_blkptr_valid(dev, &lb_ptr_buf->lb_ptr))
+			break;
+
+		vdev_space_update(dev->l2ad_vdev, -asize, 0, 0);
+		ARCSTAT_INCR(arcstat_l2_log_blk_asize, -asize);
+		ARCSTAT_BUMPDOWN(arcstat_l2_log_blk_count);
+		(void) refcount_remove_many(&dev->l2ad_lb_asize, asize,
+		    lb_ptr_buf);
+		(void) refcount_remove(&dev->l2ad_lb_count, lb_ptr_buf);
+		list_remove(&dev->l2ad_lbptr_list, lb_ptr_buf);
+		kmem_free(lb_ptr_buf, sizeof (l2arc_lb_ptr_buf_t));
+	}
+
 	for (hdr = list_tail(buflist); hdr; hdr = hdr_prev) {
 		hdr_prev = list_prev(buflist, hdr);
 
@@ -8560,7 +9230,7 @@ top:
 		ASSERT(!HDR_L2_WRITING(hdr));
 		ASSERT(!HDR_L2_WRITE_HEAD(hdr));
 
-		if (!all && (hdr->b_l2hdr.b_daddr >= taddr ||
+		if (!all && (hdr->b_l2hdr.b_daddr >= dev->l2ad_evict ||
 		    hdr->b_l2hdr.b_daddr < dev->l2ad_hand)) {
 			/*
 			 * We've evicted to the target address,
@@ -8597,6 +9267,18 @@ top:
 		mutex_exit(hash_lock);
 	}
 	mutex_exit(&dev->l2ad_mtx);
+
+out:
+	if (!all && rerun) {
+		/*
+		 * Bump the device hands to the start now that everything up
+		 * to the end has been evicted, and evict ahead from there.
+		 */
+		dev->l2ad_hand = dev->l2ad_start;
+		dev->l2ad_evict = dev->l2ad_start;
+		dev->l2ad_first = B_FALSE;
+		goto again;
+	}
 }
 
 static int
@@ -8881,6 +9563,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 				    sizeof (l2arc_write_callback_t), KM_SLEEP);
 				cb->l2wcb_dev = dev;
 				cb->l2wcb_head = head;
+				list_create(&cb->l2wcb_abd_list,
+				    sizeof (l2arc_lb_abd_buf_t),
+				    offsetof(l2arc_lb_abd_buf_t, lb_node));
 				pio = zio_root(spa, l2arc_write_done, cb,
 				    ZIO_FLAG_CANFAIL);
 			}
@@ -8910,9 +9595,18 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			write_psize += psize;
 			dev->l2ad_hand += asize;
 
+			/*
+			 * Record the header in the current log block, which
+			 * is written out right behind its payload once full.
+			 */
+			boolean_t lb_full = l2arc_log_blk_insert(dev, hdr);
+
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			if (lb_full)
+				l2arc_log_blk_commit(dev, pio, cb);
 		}
 
 		multilist_sublist_unlock(mls);
@@ -8926,6 +9620,10 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		ASSERT0(write_lsize);
 		ASSERT(!HDR_HAS_L1HDR(head));
 		kmem_cache_free(hdr_l2only_cache, head);
+
+		/* The evict hand may still have moved. */
+		if (dev->l2ad_evict != dev->l2ad_dev_hdr->dh_evict)
+			l2arc_dev_hdr_update(dev);
 		return (0);
 	}
 
@@ -8936,19 +9634,16 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	ARCSTAT_INCR(arcstat_l2_psize, write_psize);
 	vdev_space_update(dev->l2ad_vdev, write_psize, 0, 0);
 
-	/*
-	 * Bump device hand to the device start if it is approaching the end.
-	 * l2arc_evict() will already have evicted ahead for this case.
-	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
-		dev->l2ad_hand = dev->l2ad_start;
-		dev->l2ad_first = B_FALSE;
-	}
-
 	dev->l2ad_writing = B_TRUE;
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
 
+	/*
+	 * Only now that the log blocks are on the device can the device
+	 * header point at them.
+	 */
+	l2arc_dev_hdr_update(dev);
+
 	return (write_asize);
 }
 
@@ -9031,6 +9726,15 @@ l2arc_feed_thread(void)
 
 		size = l2arc_write_size();
 
+		/*
+		 * The write, and the log blocks describing it, must fit
+		 * between the start and the end of the device, or
+		 * l2arc_evict() could never make room for it.
+		 */
+		if (size + l2arc_log_blk_overhead(size, dev) >=
+		    (dev->l2ad_end - dev->l2ad_start) / 2)
+			size = (dev->l2ad_end - dev->l2ad_start) / 4;
+
 		/*
 		 * Evict L2ARC buffers that will be overwritten.
 		 */
@@ -9087,9 +9791,17 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	/* The device header sits between the front labels and the data. */
+	adddev->l2ad_dev_hdr_asize = MAX(sizeof (l2arc_dev_hdr_phys_t),
+	    1ULL << vd->vdev_ashift);
+	adddev->l2ad_dev_hdr = kmem_zalloc(adddev->l2ad_dev_hdr_asize,
+	    KM_SLEEP);
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE +
+	    adddev->l2ad_dev_hdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
+	ASSERT3U(adddev->l2ad_start, <, adddev->l2ad_end);
 	adddev->l2ad_hand = adddev->l2ad_start;
+	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
 
@@ -9101,8 +9813,23 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_create(&adddev->l2ad_buflist, sizeof (arc_buf_hdr_t),
 	    offsetof(arc_buf_hdr_t, b_l2hdr.b_l2node));
 
+	/*
+	 * This is a list of pointers to the log blocks that are still
+	 * present on the device, newest first.
+	 */
+	list_create(&adddev->l2ad_lbptr_list, sizeof (l2arc_lb_ptr_buf_t),
+	    offsetof(l2arc_lb_ptr_buf_t, lb_node));
+
 	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
 	refcount_create(&adddev->l2ad_alloc);
+	refcount_create(&adddev->l2ad_lb_asize);
+	refcount_create(&adddev->l2ad_lb_count);
+
+	/*
+	 * Pick up the headers a previous import left on the device, or
+	 * start it afresh.
+	 */
+	l2arc_rebuild_vdev(adddev);
 
 	/*
 	 * Add device to global list
@@ -9142,13 +9869,27 @@ l2arc_remove_vdev(vdev_t *vd)
 	atomic_dec_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
 
+	/*
+	 * Stop a rebuild in progress, as it references the device.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
 	l2arc_evict(remdev, 0, B_TRUE);
 	list_destroy(&remdev->l2ad_buflist);
+	ASSERT(list_is_empty(&remdev->l2ad_lbptr_list));
+	list_destroy(&remdev->l2ad_lbptr_list);
 	mutex_destroy(&remdev->l2ad_mtx);
 	refcount_destroy(&remdev->l2ad_alloc);
+	refcount_destroy(&remdev->l2ad_lb_asize);
+	refcount_destroy(&remdev->l2ad_lb_count);
+	kmem_free(remdev->l2ad_dev_hdr, remdev->l2ad_dev_hdr_asize);
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
@@ -9162,6 +9903,8 @@ l2arc_init(void)
 
 	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
 
@@ -9186,6 +9929,8 @@ l2arc_fini(void)
 
 	mutex_destroy(&l2arc_feed_thr_lock);
 	cv_destroy(&l2arc_feed_thr_cv);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
 
@@ -9217,6 +9962,641 @@ l2arc_stop(void)
 	mutex_exit(&l2arc_feed_thr_lock);
 }
 
+/*
+ * Persistent L2ARC
+ *
+ * See the description of the on-disk layout in arc_impl.h. As buffers are
+ * written to a cache device, their headers are appended to an in-core log
+ * block, which is written to the device right behind the buffers once full.
+ * After each write the device header is updated to point at the newest log
+ * block, so the order on the device is always buffers, then the log block
+ * describing them, then the header referencing it.
+ *
+ * When the device is added again, the header is read and validated, and a
+ * thread walks the log blocks from newest to oldest, recreating an L2-only
+ * ARC header for each buffer. The device is not written to until this has
+ * finished, as the write hand sits just behind the newest log block. The walk
+ * stops at the first log block that has been (or whose payload has been)
+ * evicted, that fails its checksum, or when memory runs low; the buffers
+ * rebuilt so far remain usable either way, since every L2ARC read is verified
+ * against the block pointer of the data.
+ */
+
+/*
+ * Returns whether check lies in the circular range [bottom, top].
+ */
+static boolean_t
+l2arc_range_check_overlap(uint64_t bottom, uint64_t top, uint64_t check)
+{
+	if (bottom < top)
+		return (bottom <= check && check <= top);
+	else if (bottom > top)
+		return (check <= top || bottom <= check);
+	else
+		return (check == top);
+}
+
+/*
+ * Worst case space taken by the log blocks describing a write of write_sz
+ * bytes, assuming the smallest possible buffers.
+ */
+static uint64_t
+l2arc_log_blk_overhead(uint64_t write_sz, l2arc_dev_t *dev)
+{
+	uint64_t log_entries, log_blocks;
+
+	if (dev->l2ad_log_entries == 0)
+		return (0);
+
+	log_entries = write_sz >> SPA_MINBLOCKSHIFT;
+	log_blocks = (log_entries + dev->l2ad_log_entries - 1) /
+	    dev->l2ad_log_entries;
+
+	return (vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)) * log_blocks);
+}
+
+/*
+ * A log block pointer is valid if the log block and its payload lie within
+ * the device and neither has been evicted, i.e. they do not overlap the
+ * region between the write hand and the evict hand:
+ *
+ *	     l2ad_hand        l2ad_evict
+ *		 |		  |	  lbp_daddr
+ *		 |  payload_start |	  |  end
+ *		 v  v		  v	  v  v
+ *   l2ad_start ======================================== l2ad_end
+ *		    --------------------------||||
+ *			    payload		log blk
+ */
+static boolean_t
+l2arc_log_blkptr_valid(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t asize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	uint64_t start = lbp->lbp_payload_start;
+	uint64_t end = lbp->lbp_daddr + asize - 1;
+	boolean_t evicted;
+
+	evicted =
+	    l2arc_range_check_overlap(start, end, dev->l2ad_hand) ||
+	    l2arc_range_check_overlap(start, end, dev->l2ad_evict) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, start) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, end);
+
+	return (start >= dev->l2ad_start && end <= dev->l2ad_end &&
+	    lbp->lbp_daddr >= dev->l2ad_start &&
+	    asize <= sizeof (l2arc_log_blk_phys_t) &&
+	    (!evicted || dev->l2ad_first));
+}
+
+/*
+ * Appends the header of a buffer just written to the device to the current
+ * log block. Returns B_TRUE when the log block is full and has to be
+ * committed.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, const arc_buf_hdr_t *hdr)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_log_ent_phys_t *le;
+	int index;
+
+	if (dev->l2ad_log_entries == 0)
+		return (B_FALSE);
+
+	index = dev->l2ad_log_ent_idx++;
+	ASSERT3S(index, <, dev->l2ad_log_entries);
+	ASSERT(HDR_HAS_L2HDR(hdr));
+
+	le = &lb->lb_entries[index];
+	bzero(le, sizeof (*le));
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	if (index == 0)
+		dev->l2ad_log_blk_payload_start = le->le_daddr;
+	L2BLK_SET_LSIZE(le->le_prop, HDR_GET_LSIZE(hdr));
+	L2BLK_SET_PSIZE(le->le_prop, HDR_GET_PSIZE(hdr));
+	L2BLK_SET_COMPRESS(le->le_prop, HDR_GET_COMPRESS(hdr));
+	L2BLK_SET_TYPE(le->le_prop, hdr->b_type);
+	L2BLK_SET_PROTECTED(le->le_prop, !!HDR_PROTECTED(hdr));
+	L2BLK_SET_PREFETCH(le->le_prop, !!HDR_PREFETCH(hdr));
+
+	dev->l2ad_log_blk_payload_asize +=
+	    vdev_psize_to_asize(dev->l2ad_vdev, HDR_GET_PSIZE(hdr));
+
+	return (dev->l2ad_log_ent_idx == dev->l2ad_log_entries);
+}
+
+/*
+ * Writes out the current log block at the write hand as part of pio, and
+ * makes it the newest log block in the chain. The buffer is freed by
+ * l2arc_write_done(), and the device header is updated by the caller once
+ * pio has completed.
+ */
+static void
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio, l2arc_write_callback_t *cb)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_log_blkptr_t *lbp = &dev->l2ad_dev_hdr->dh_start_lbp;
+	l2arc_lb_abd_buf_t *abd_buf;
+	l2arc_lb_ptr_buf_t *lb_ptr_buf;
+	uint64_t psize, asize;
+	abd_t *src;
+	void *tmpbuf;
+	zio_t *wzio;
+
+	VERIFY3S(dev->l2ad_log_ent_idx, ==, dev->l2ad_log_entries);
+
+	/* Link the log block into the chain. */
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev_lbp = *lbp;
+
+	abd_buf = kmem_alloc(sizeof (l2arc_lb_abd_buf_t), KM_SLEEP);
+	abd_buf->lb_abd = abd_alloc_linear(sizeof (*lb), B_TRUE);
+	tmpbuf = abd_to_buf(abd_buf->lb_abd);
+
+	src = abd_get_from_buf(lb, sizeof (*lb));
+	psize = zio_compress_data(ZIO_COMPRESS_LZ4, src, tmpbuf,
+	    sizeof (*lb), 0);
+	abd_put(src);
+
+	/* A log block is never entirely zero. */
+	ASSERT3U(psize, !=, 0);
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	ASSERT3U(asize, <=, sizeof (*lb));
+
+	bzero(lbp, sizeof (*lbp));
+	lbp->lbp_daddr = dev->l2ad_hand;
+	lbp->lbp_payload_asize = dev->l2ad_log_blk_payload_asize;
+	lbp->lbp_payload_start = dev->l2ad_log_blk_payload_start;
+	L2BLK_SET_LSIZE(lbp->lbp_prop, sizeof (*lb));
+	L2BLK_SET_PSIZE(lbp->lbp_prop, asize);
+	L2BLK_SET_CHECKSUM(lbp->lbp_prop, ZIO_CHECKSUM_FLETCHER_4);
+	if (asize < sizeof (*lb)) {
+		bzero((char *)tmpbuf + psize, asize - psize);
+		L2BLK_SET_COMPRESS(lbp->lbp_prop, ZIO_COMPRESS_LZ4);
+	} else {
+		bcopy(lb, tmpbuf, sizeof (*lb));
+		L2BLK_SET_COMPRESS(lbp->lbp_prop, ZIO_COMPRESS_OFF);
+	}
+	fletcher_4_native(tmpbuf, asize, NULL, &lbp->lbp_cksum);
+
+	list_insert_tail(&cb->l2wcb_abd_list, abd_buf);
+	wzio = zio_write_phys(pio, dev->l2ad_vdev, dev->l2ad_hand, asize,
+	    abd_buf->lb_abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE);
+	DTRACE_PROBE2(l2arc__write, vdev_t *, dev->l2ad_vdev, zio_t *, wzio);
+	(void) zio_nowait(wzio);
+
+	dev->l2ad_hand += asize;
+
+	lb_ptr_buf = kmem_alloc(sizeof (l2arc_lb_ptr_buf_t), KM_SLEEP);
+	lb_ptr_buf->lb_ptr = *lbp;
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_head(&dev->l2ad_lbptr_list, lb_ptr_buf);
+	(void) refcount_add_many(&dev->l2ad_lb_asize, asize, lb_ptr_buf);
+	(void) refcount_add(&dev->l2ad_lb_count, lb_ptr_buf);
+	mutex_exit(&dev->l2ad_mtx);
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+
+	ARCSTAT_INCR(arcstat_l2_write_bytes, asize);
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+	ARCSTAT_INCR(arcstat_l2_log_blk_asize, asize);
+	ARCSTAT_BUMP(arcstat_l2_log_blk_count);
+	ARCSTAT_F_AVG(arcstat_l2_log_blk_avg_asize, asize, 3);
+	ARCSTAT_F_AVG(arcstat_l2_data_to_meta_ratio,
+	    dev->l2ad_log_blk_payload_asize / asize, 3);
+
+	/* Start a new log block. */
+	dev->l2ad_log_ent_idx = 0;
+	dev->l2ad_log_blk_payload_asize = 0;
+	dev->l2ad_log_blk_payload_start = 0;
+}
+
+/*
+ * Writes the in-core device header out to the device.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	vdev_t *vd = dev->l2ad_vdev;
+	abd_t *abd;
+	int err;
+
+	l2dhdr->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	l2dhdr->dh_version = L2ARC_PERSISTENT_VERSION;
+	l2dhdr->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	l2dhdr->dh_vdev_guid = vd->vdev_guid;
+	l2dhdr->dh_log_entries = dev->l2ad_log_entries;
+	l2dhdr->dh_evict = dev->l2ad_evict;
+	l2dhdr->dh_flags = 0;
+	if (dev->l2ad_first)
+		l2dhdr->dh_flags |= L2ARC_DEV_HDR_EVICT_FIRST;
+	l2dhdr->dh_start = dev->l2ad_start;
+	l2dhdr->dh_end = dev->l2ad_end;
+	l2dhdr->dh_lb_asize = refcount_count(&dev->l2ad_lb_asize);
+	l2dhdr->dh_lb_count = refcount_count(&dev->l2ad_lb_count);
+
+	abd = abd_get_from_buf(l2dhdr, dev->l2ad_dev_hdr_asize);
+	err = zio_wait(zio_write_phys(NULL, vd, VDEV_LABEL_START_SIZE,
+	    dev->l2ad_dev_hdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	abd_put(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC IO error (%d) while writing device header, "
+		    "vdev guid: %llu", err, (u_longlong_t)vd->vdev_guid);
+	}
+}
+
+/*
+ * Reads the device header into dev->l2ad_dev_hdr and checks that it was
+ * written for this very device and its current geometry.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	vdev_t *vd = dev->l2ad_vdev;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_linear(dev->l2ad_dev_hdr_asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, vd, VDEV_LABEL_START_SIZE,
+	    dev->l2ad_dev_hdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL, NULL,
+	    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY |
+	    ZIO_FLAG_SPECULATIVE, B_FALSE));
+	if (err == 0)
+		abd_copy_to_buf(l2dhdr, abd, dev->l2ad_dev_hdr_asize);
+	abd_free(abd);
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_dh_errors);
+		zfs_dbgmsg("L2ARC IO error (%d) while reading device header, "
+		    "vdev guid: %llu", err, (u_longlong_t)vd->vdev_guid);
+		return (err);
+	}
+
+	if (l2dhdr->dh_magic == BSWAP_64(L2ARC_DEV_HDR_MAGIC))
+		byteswap_uint64_array(l2dhdr, sizeof (*l2dhdr));
+
+	if (l2dhdr->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    l2dhdr->dh_version != L2ARC_PERSISTENT_VERSION ||
+	    l2dhdr->dh_spa_guid != spa_guid(dev->l2ad_spa) ||
+	    l2dhdr->dh_vdev_guid != vd->vdev_guid ||
+	    l2dhdr->dh_log_entries != dev->l2ad_log_entries ||
+	    l2dhdr->dh_start != dev->l2ad_start ||
+	    l2dhdr->dh_end != dev->l2ad_end ||
+	    !l2arc_range_check_overlap(dev->l2ad_start, dev->l2ad_end,
+	    l2dhdr->dh_evict)) {
+		/*
+		 * No header, a header from another pool or device, or one
+		 * written for a different device size or format.
+		 */
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	return (0);
+}
+
+/*
+ * Reads the log block lbp points at into lb, verifying its checksum.
+ */
+static int
+l2arc_log_blk_read(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    l2arc_log_blk_phys_t *lb)
+{
+	uint64_t asize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	zio_cksum_t cksum;
+	abd_t *abd;
+	void *buf;
+	int err;
+
+	abd = abd_alloc_linear(asize, B_TRUE);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, lbp->lbp_daddr,
+	    asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_READ, ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		goto out;
+	}
+
+	buf = abd_to_buf(abd);
+	fletcher_4_native(buf, asize, NULL, &cksum);
+	if (L2BLK_GET_CHECKSUM(lbp->lbp_prop) != ZIO_CHECKSUM_FLETCHER_4 ||
+	    !ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum)) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		err = SET_ERROR(ECKSUM);
+		goto out;
+	}
+
+	switch (L2BLK_GET_COMPRESS(lbp->lbp_prop)) {
+	case ZIO_COMPRESS_OFF:
+		bcopy(buf, lb, sizeof (*lb));
+		break;
+	case ZIO_COMPRESS_LZ4:
+		if (zio_decompress_data_buf(ZIO_COMPRESS_LZ4, buf, lb,
+		    asize, sizeof (*lb)) != 0)
+			err = SET_ERROR(EINVAL);
+		break;
+	default:
+		err = SET_ERROR(EINVAL);
+		break;
+	}
+	if (err != 0)
+		goto out;
+
+	if (lb->lb_magic == BSWAP_64(L2ARC_LOG_BLK_MAGIC))
+		byteswap_uint64_array(lb, sizeof (*lb));
+	if (lb->lb_magic != L2ARC_LOG_BLK_MAGIC)
+		err = SET_ERROR(EINVAL);
+out:
+	abd_free(abd);
+	return (err);
+}
+
+/*
+ * Recreates the L2-only ARC header of a buffer described by a log entry,
+ * unless the buffer is already cached.
+ */
+static void
+l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
+{
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+	arc_buf_contents_t type = L2BLK_GET_TYPE(le->le_prop);
+	uint64_t psize;
+
+	/*
+	 * Set everything up before the header becomes discoverable, the
+	 * flags can only be changed without the hash lock while it is empty.
+	 */
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	hdr->b_type = type;
+	hdr->b_flags = 0;
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L2HDR);
+	HDR_SET_LSIZE(hdr, L2BLK_GET_LSIZE(le->le_prop));
+	HDR_SET_PSIZE(hdr, L2BLK_GET_PSIZE(le->le_prop));
+	arc_hdr_set_compress(hdr, L2BLK_GET_COMPRESS(le->le_prop));
+	if (L2BLK_GET_PROTECTED(le->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PROTECTED);
+	if (L2BLK_GET_PREFETCH(le->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PREFETCH);
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+
+	/* Account for it as l2arc_write_buffers() does. */
+	psize = arc_hdr_size(hdr);
+	ARCSTAT_INCR(arcstat_l2_psize, psize);
+	ARCSTAT_INCR(arcstat_l2_lsize, HDR_GET_LSIZE(hdr));
+	vdev_space_update(dev->l2ad_vdev, psize, 0, 0);
+
+	/*
+	 * Headers are restored from newest to oldest, so they go at the tail
+	 * of the buffer list where l2arc_evict() expects the oldest.
+	 */
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) refcount_add_many(&dev->l2ad_alloc, psize, hdr);
+	mutex_exit(&dev->l2ad_mtx);
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* The buffer is already cached, drop the copy. */
+		arc_hdr_destroy(hdr);
+
+		/*
+		 * The cached header may have lost its L2 header when the
+		 * device went away, e.g. across an offline/online cycle.
+		 */
+		if (!HDR_HAS_L2HDR(exists)) {
+			arc_hdr_set_flags(exists, ARC_FLAG_HAS_L2HDR);
+			exists->b_l2hdr.b_dev = dev;
+			exists->b_l2hdr.b_daddr = le->le_daddr;
+
+			psize = arc_hdr_size(exists);
+			ARCSTAT_INCR(arcstat_l2_psize, psize);
+			ARCSTAT_INCR(arcstat_l2_lsize, HDR_GET_LSIZE(exists));
+			vdev_space_update(dev->l2ad_vdev, psize, 0, 0);
+
+			mutex_enter(&dev->l2ad_mtx);
+			list_insert_tail(&dev->l2ad_buflist, exists);
+			(void) refcount_add_many(&dev->l2ad_alloc, psize,
+			    exists);
+			mutex_exit(&dev->l2ad_mtx);
+		}
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+	}
+
+	mutex_exit(hash_lock);
+}
+
+/*
+ * Restores all the buffers of a log block, and starts tracking the log
+ * block itself as present on the device.
+ */
+static void
+l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb,
+    const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t lb_asize = L2BLK_GET_PSIZE(lbp->lbp_prop);
+	uint64_t size = 0, asize = 0;
+	l2arc_lb_ptr_buf_t *lb_ptr_buf;
+
+	/*
+	 * Entries are appended in the order the buffers were written, so
+	 * walk them backwards to keep the buffer list sorted newest first.
+	 */
+	for (int i = dev->l2ad_log_entries - 1; i >= 0; i--) {
+		const l2arc_log_ent_phys_t *le = &lb->lb_entries[i];
+
+		size += L2BLK_GET_LSIZE(le->le_prop);
+		asize += vdev_psize_to_asize(dev->l2ad_vdev,
+		    L2BLK_GET_PSIZE(le->le_prop));
+		l2arc_hdr_restore(le, dev);
+	}
+
+	lb_ptr_buf = kmem_alloc(sizeof (l2arc_lb_ptr_buf_t), KM_SLEEP);
+	lb_ptr_buf->lb_ptr = *lbp;
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_lbptr_list, lb_ptr_buf);
+	(void) refcount_add_many(&dev->l2ad_lb_asize, lb_asize, lb_ptr_buf);
+	(void) refcount_add(&dev->l2ad_lb_count, lb_ptr_buf);
+	mutex_exit(&dev->l2ad_mtx);
+	vdev_space_update(dev->l2ad_vdev, lb_asize, 0, 0);
+
+	ARCSTAT_INCR(arcstat_l2_log_blk_asize, lb_asize);
+	ARCSTAT_BUMP(arcstat_l2_log_blk_count);
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, size);
+	ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+	ARCSTAT_INCR(arcstat_l2_rebuild_bufs, dev->l2ad_log_entries);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+	ARCSTAT_F_AVG(arcstat_l2_data_to_meta_ratio, asize / lb_asize, 3);
+}
+
+/*
+ * Takes the config lock the feed thread takes, giving up if the device is
+ * being removed meanwhile (its remover may hold the lock as writer).
+ */
+static int
+l2arc_rebuild_enter(l2arc_dev_t *dev)
+{
+	spa_t *spa = dev->l2ad_spa;
+
+	for (;;) {
+		mutex_enter(&l2arc_rebuild_thr_lock);
+		if (dev->l2ad_rebuild_cancel) {
+			mutex_exit(&l2arc_rebuild_thr_lock);
+			return (SET_ERROR(ECANCELED));
+		}
+		mutex_exit(&l2arc_rebuild_thr_lock);
+
+		if (spa_config_tryenter(spa, SCL_L2ARC, dev, RW_READER))
+			return (0);
+		delay(1);
+	}
+}
+
+/*
+ * Walks the log block chain of a device from the newest log block back,
+ * restoring the buffers they describe.
+ */
+static int
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	spa_t *spa = dev->l2ad_spa;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbp;
+	hrtime_t start_time = gethrtime();
+	uint64_t lb_count = 0;
+	int err = 0;
+
+	lb = kmem_alloc(sizeof (l2arc_log_blk_phys_t), KM_SLEEP);
+	lbp = l2dhdr->dh_start_lbp;
+
+	/*
+	 * Bound the walk by the number of log blocks the header says are on
+	 * the device, so that stale blocks can never form a cycle.
+	 */
+	while (lb_count < l2dhdr->dh_lb_count) {
+		if ((err = l2arc_rebuild_enter(dev)) != 0)
+			break;
+
+		if (!l2arc_log_blkptr_valid(dev, &lbp)) {
+			spa_config_exit(spa, SCL_L2ARC, dev);
+			break;
+		}
+		err = l2arc_log_blk_read(dev, &lbp, lb);
+		spa_config_exit(spa, SCL_L2ARC, dev);
+		if (err != 0)
+			break;
+
+		/*
+		 * Rather than filling memory with headers for buffers that
+		 * are not in demand yet, give up; the device can be
+		 * rebuilt again later by exporting and importing the pool.
+		 */
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			cmn_err(CE_NOTE, "System running low on memory, "
+			    "aborting L2ARC rebuild.");
+			err = SET_ERROR(ENOMEM);
+			break;
+		}
+
+		l2arc_log_blk_restore(dev, lb, &lbp);
+		lb_count++;
+		lbp = lb->lb_prev_lbp;
+	}
+
+	kmem_free(lb, sizeof (l2arc_log_blk_phys_t));
+
+	ARCSTAT(arcstat_l2_rebuild_time_ms) =
+	    NSEC2MSEC(gethrtime() - start_time);
+	if (err == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+
+	zfs_dbgmsg("L2ARC rebuild %s: restored %llu log blocks, vdev guid: "
+	    "%llu, error: %d", err == 0 ? "completed" : "aborted",
+	    (u_longlong_t)lb_count, (u_longlong_t)dev->l2ad_vdev->vdev_guid,
+	    err);
+
+	return (err);
+}
+
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+
+	(void) l2arc_rebuild(dev);
+
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	ARCSTAT_BUMPDOWN(arcstat_l2_rebuild_in_progress);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
+	thread_exit();
+}
+
+/*
+ * Called as a device is added: reads its header and, if it holds a log
+ * block chain for this device, starts rebuilding the L2ARC from it in the
+ * background. Otherwise whatever is on the device is forgotten by writing
+ * out a fresh header.
+ */
+static void
+l2arc_rebuild_vdev(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	uint64_t l2size = dev->l2ad_end - dev->l2ad_start;
+
+	/*
+	 * Size the log blocks so that even a device full of the largest
+	 * buffers is described by a reasonable number of them. Devices below
+	 * l2arc_rebuild_blocks_min_l2size do not write log blocks at all.
+	 */
+	if (l2size < l2arc_rebuild_blocks_min_l2size)
+		dev->l2ad_log_entries = 0;
+	else
+		dev->l2ad_log_entries = (int)MIN(l2size >> SPA_MAXBLOCKSHIFT,
+		    L2ARC_LOG_BLK_MAX_ENTRIES);
+
+	if (l2arc_dev_hdr_read(dev) == 0 && l2arc_rebuild_enabled &&
+	    dev->l2ad_log_entries != 0 && l2dhdr->dh_lb_count != 0) {
+		/*
+		 * Resume writing right behind the newest log block, so that
+		 * nothing the rebuild is about to read is overwritten.
+		 */
+		dev->l2ad_evict = MAX(l2dhdr->dh_evict, dev->l2ad_start);
+		dev->l2ad_hand = MAX(l2dhdr->dh_start_lbp.lbp_daddr +
+		    L2BLK_GET_PSIZE(l2dhdr->dh_start_lbp.lbp_prop),
+		    dev->l2ad_start);
+		dev->l2ad_first = !!(l2dhdr->dh_flags &
+		    L2ARC_DEV_HDR_EVICT_FIRST);
+
+		ARCSTAT_BUMP(arcstat_l2_rebuild_in_progress);
+		dev->l2ad_rebuild = B_TRUE;
+		(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread, dev,
+		    0, &p0, TS_RUN, minclsyspri);
+		return;
+	}
+
+	bzero(l2dhdr, dev->l2ad_dev_hdr_asize);
+	if (spa_writeable(dev->l2ad_spa))
+		l2arc_dev_hdr_update(dev);
+}
+
 #ifdef _WIN32
 #undef ZDB_DEBUG
 #ifdef _KERNEL
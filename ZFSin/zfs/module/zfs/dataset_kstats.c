@@ -0,0 +1,276 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#include <sys/dataset_kstats.h>
+#include <sys/dmu_objset.h>
+#include <sys/dsl_dataset.h>
+#include <sys/spa.h>
+
+/*
+ * Per-dataset I/O statistics
+ *
+ * Every filesystem and volume head gets a zfs/<pool>/objset-0x<id> kstat
+ * (the id is the dataset's object number, as in the zdb output) with the
+ * request counts and logical bytes seen at the ZPL and zvol entry points,
+ * the physical bytes its dbufs read and wrote, ARC hits and misses for
+ * those reads, ZIL commits, the time spent delayed by the dataset's
+ * readlimit/writelimit/iopslimit, and how much of the logical i/o went
+ * around the ARC through direct I/O. The dataset name is included since
+ * it's not otherwise derivable from the kstat name. `zfs iostat` samples
+ * these.
+ *
+ * The kstat follows the objset, so the counters start over whenever the
+ * objset is evicted (e.g. on rollback or receive).
+ */
+
+static dataset_kstat_values_t empty_dataset_kstats = {
+	{ "dataset_name",	KSTAT_DATA_STRING },
+	{ "writes",		KSTAT_DATA_UINT64 },
+	{ "nwritten",		KSTAT_DATA_UINT64 },
+	{ "reads",		KSTAT_DATA_UINT64 },
+	{ "nread",		KSTAT_DATA_UINT64 },
+	{ "pwritten",		KSTAT_DATA_UINT64 },
+	{ "pread",		KSTAT_DATA_UINT64 },
+	{ "arc_hits",		KSTAT_DATA_UINT64 },
+	{ "arc_misses",		KSTAT_DATA_UINT64 },
+	{ "zil_commits",	KSTAT_DATA_UINT64 },
+	{ "reads_delayed",	KSTAT_DATA_UINT64 },
+	{ "read_delay_ns",	KSTAT_DATA_UINT64 },
+	{ "writes_delayed",	KSTAT_DATA_UINT64 },
+	{ "write_delay_ns",	KSTAT_DATA_UINT64 },
+	{ "nread_direct",	KSTAT_DATA_UINT64 },
+	{ "nread_buffered",	KSTAT_DATA_UINT64 },
+	{ "nwritten_direct",	KSTAT_DATA_UINT64 },
+	{ "nwritten_buffered",	KSTAT_DATA_UINT64 },
+};
+
+static int
+dataset_kstats_update(kstat_t *ksp, int rw)
+{
+	objset_t *os = ksp->ks_private;
+	dataset_kstats_t *dk = &os->os_dsks;
+	dataset_kstat_values_t *dkv = &dk->dk_values;
+	dmu_throttle_t *dt = &os->os_throttle;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	/* pick up renames */
+	dmu_objset_name(os, dk->dk_name);
+	kstat_named_setstr(&dkv->dkv_ds_name, dk->dk_name);
+
+	dkv->dkv_writes.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_writes);
+	dkv->dkv_nwritten.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_nwritten);
+	dkv->dkv_reads.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_reads);
+	dkv->dkv_nread.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_nread);
+	dkv->dkv_pwritten.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_pwritten);
+	dkv->dkv_pread.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_pread);
+	dkv->dkv_arc_hits.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_arc_hits);
+	dkv->dkv_arc_misses.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_arc_misses);
+	dkv->dkv_zil_commits.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_zil_commits);
+	dkv->dkv_nread_direct.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_nread_direct);
+	dkv->dkv_nread_buffered.value.ui64 = dkv->dkv_nread.value.ui64 -
+	    MIN(dkv->dkv_nread.value.ui64, dkv->dkv_nread_direct.value.ui64);
+	dkv->dkv_nwritten_direct.value.ui64 =
+	    aggsum_value(&dk->dk_aggsums.das_nwritten_direct);
+	dkv->dkv_nwritten_buffered.value.ui64 = dkv->dkv_nwritten.value.ui64 -
+	    MIN(dkv->dkv_nwritten.value.ui64,
+	    dkv->dkv_nwritten_direct.value.ui64);
+
+	mutex_enter(&dt->dt_lock);
+	dkv->dkv_reads_delayed.value.ui64 = dt->dt_stats.dts_reads_delayed;
+	dkv->dkv_read_delay_ns.value.ui64 = dt->dt_stats.dts_read_delay_ns;
+	dkv->dkv_writes_delayed.value.ui64 = dt->dt_stats.dts_writes_delayed;
+	dkv->dkv_write_delay_ns.value.ui64 = dt->dt_stats.dts_write_delay_ns;
+	mutex_exit(&dt->dt_lock);
+
+	return (0);
+}
+
+void
+dataset_kstats_create(dataset_kstats_t *dk, objset_t *os)
+{
+	dsl_dataset_t *ds = os->os_dsl_dataset;
+	char kstat_module_name[KSTAT_STRLEN];
+	char kstat_name[KSTAT_STRLEN];
+	kstat_t *kstat;
+
+	dk->dk_kstats = NULL;
+
+	/* only filesystem and volume heads see i/o */
+	if (ds == NULL || ds->ds_is_snapshot)
+		return;
+
+	(void) snprintf(kstat_module_name, KSTAT_STRLEN, "zfs/%s",
+	    spa_name(os->os_spa));
+	(void) snprintf(kstat_name, KSTAT_STRLEN, "objset-0x%llx",
+	    (u_longlong_t)ds->ds_object);
+
+	kstat = kstat_create(kstat_module_name, 0, kstat_name, "dataset",
+	    KSTAT_TYPE_NAMED,
+	    sizeof (dataset_kstat_values_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (kstat == NULL)
+		return;
+
+	mutex_init(&dk->dk_lock, NULL, MUTEX_DEFAULT, NULL);
+	bcopy(&empty_dataset_kstats, &dk->dk_values,
+	    sizeof (empty_dataset_kstats));
+	dk->dk_name[0] = '\0';
+	kstat_named_setstr(&dk->dk_values.dkv_ds_name, dk->dk_name);
+
+	aggsum_init(&dk->dk_aggsums.das_writes, 0);
+	aggsum_init(&dk->dk_aggsums.das_nwritten, 0);
+	aggsum_init(&dk->dk_aggsums.das_reads, 0);
+	aggsum_init(&dk->dk_aggsums.das_nread, 0);
+	aggsum_init(&dk->dk_aggsums.das_pwritten, 0);
+	aggsum_init(&dk->dk_aggsums.das_pread, 0);
+	aggsum_init(&dk->dk_aggsums.das_arc_hits, 0);
+	aggsum_init(&dk->dk_aggsums.das_arc_misses, 0);
+	aggsum_init(&dk->dk_aggsums.das_zil_commits, 0);
+	aggsum_init(&dk->dk_aggsums.das_nread_direct, 0);
+	aggsum_init(&dk->dk_aggsums.das_nwritten_direct, 0);
+
+	kstat->ks_data = &dk->dk_values;
+	kstat->ks_lock = &dk->dk_lock;
+	kstat->ks_update = dataset_kstats_update;
+	kstat->ks_private = os;
+	kstat_install(kstat);
+	dk->dk_kstats = kstat;
+}
+
+void
+dataset_kstats_destroy(dataset_kstats_t *dk)
+{
+	if (dk->dk_kstats == NULL)
+		return;
+
+	kstat_delete(dk->dk_kstats);
+	dk->dk_kstats = NULL;
+	mutex_destroy(&dk->dk_lock);
+
+	aggsum_fini(&dk->dk_aggsums.das_writes);
+	aggsum_fini(&dk->dk_aggsums.das_nwritten);
+	aggsum_fini(&dk->dk_aggsums.das_reads);
+	aggsum_fini(&dk->dk_aggsums.das_nread);
+	aggsum_fini(&dk->dk_aggsums.das_pwritten);
+	aggsum_fini(&dk->dk_aggsums.das_pread);
+	aggsum_fini(&dk->dk_aggsums.das_arc_hits);
+	aggsum_fini(&dk->dk_aggsums.das_arc_misses);
+	aggsum_fini(&dk->dk_aggsums.das_zil_commits);
+	aggsum_fini(&dk->dk_aggsums.das_nread_direct);
+	aggsum_fini(&dk->dk_aggsums.das_nwritten_direct);
+}
+
+void
+dataset_kstats_update_read_kstats(dataset_kstats_t *dk, int64_t nread)
+{
+	ASSERT3S(nread, >=, 0);
+
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_reads, 1);
+	aggsum_add(&dk->dk_aggsums.das_nread, nread);
+}
+
+void
+dataset_kstats_update_write_kstats(dataset_kstats_t *dk, int64_t nwritten)
+{
+	ASSERT3S(nwritten, >=, 0);
+
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_writes, 1);
+	aggsum_add(&dk->dk_aggsums.das_nwritten, nwritten);
+}
+
+void
+dataset_kstats_update_arc_kstats(dataset_kstats_t *dk, boolean_t hit,
+    int64_t pread)
+{
+	if (dk->dk_kstats == NULL)
+		return;
+
+	if (hit) {
+		aggsum_add(&dk->dk_aggsums.das_arc_hits, 1);
+	} else {
+		aggsum_add(&dk->dk_aggsums.das_arc_misses, 1);
+		aggsum_add(&dk->dk_aggsums.das_pread, pread);
+	}
+}
+
+void
+dataset_kstats_update_pwritten_kstats(dataset_kstats_t *dk, int64_t pwritten)
+{
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_pwritten, pwritten);
+}
+
+void
+dataset_kstats_update_zil_kstats(dataset_kstats_t *dk)
+{
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_zil_commits, 1);
+}
+
+/*
+ * Direct I/O is counted on top of the read and write kstats, which cover
+ * all logical i/o; the buffered share is the difference.
+ */
+void
+dataset_kstats_update_direct_read_kstats(dataset_kstats_t *dk, int64_t nread)
+{
+	ASSERT3S(nread, >=, 0);
+
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_nread_direct, nread);
+}
+
+void
+dataset_kstats_update_direct_write_kstats(dataset_kstats_t *dk,
+    int64_t nwritten)
+{
+	ASSERT3S(nwritten, >=, 0);
+
+	if (dk->dk_kstats == NULL)
+		return;
+
+	aggsum_add(&dk->dk_aggsums.das_nwritten_direct, nwritten);
+}
@@ -231,6 +231,107 @@ static dbuf_hash_table_t dbuf_hash_table;
 
 static uint64_t dbuf_hash_count;
 
+/*
+ * The hash table doubles once it holds more than dbuf_hash_load_max
+ * dbufs per bucket on average, and halves again (but not below its
+ * initial size) once it holds fewer than 1/DBUF_HASH_SHRINK_FACTOR of
+ * that.  The dbuf eviction thread does the resizing.  Zero disables it.
+ */
+int dbuf_hash_load_max = 2;
+#define	DBUF_HASH_SHRINK_FACTOR	8
+#define	DBUF_HASH_MAX_SIZE	(1ULL << 32)
+static uint64_t dbuf_hash_min_size;
+
+typedef struct dbuf_stats {
+	kstat_named_t hash_hits;
+	kstat_named_t hash_misses;
+	kstat_named_t hash_lookup_steps;
+	kstat_named_t hash_collisions;
+	kstat_named_t hash_elements;
+	kstat_named_t hash_elements_max;
+	kstat_named_t hash_chains;
+	kstat_named_t hash_chain_max;
+	kstat_named_t hash_table_size;
+	kstat_named_t hash_resizes;
+	kstat_named_t hash_resize_time;
+} dbuf_stats_t;
+
+static dbuf_stats_t dbuf_stats = {
+	{ "hash_hits",			KSTAT_DATA_UINT64 },
+	{ "hash_misses",		KSTAT_DATA_UINT64 },
+	{ "hash_lookup_steps",		KSTAT_DATA_UINT64 },
+	{ "hash_collisions",		KSTAT_DATA_UINT64 },
+	{ "hash_elements",		KSTAT_DATA_UINT64 },
+	{ "hash_elements_max",		KSTAT_DATA_UINT64 },
+	{ "hash_chains",		KSTAT_DATA_UINT64 },
+	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_table_size",		KSTAT_DATA_UINT64 },
+	{ "hash_resizes",		KSTAT_DATA_UINT64 },
+	{ "hash_resize_time",		KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *dbuf_ksp;
+
+#define	DBUF_STAT_BUMP(stat)	atomic_inc_64(&dbuf_stats.stat.value.ui64)
+#define	DBUF_STAT_BUMPDOWN(stat) atomic_dec_64(&dbuf_stats.stat.value.ui64)
+#define	DBUF_STAT_MAX(stat, val) {					\
+	uint64_t m;							\
+	while ((val) > (m = dbuf_stats.stat.value.ui64) &&		\
+	    (m != atomic_cas_64(&dbuf_stats.stat.value.ui64, m, (val))))\
+		continue;						\
+}
+
+/*
+ * Every dbuf_hold() does a dbuf_find(), so its counters are kept per CPU
+ * rather than in dbuf_stats, and summed by dbuf_kstat_update().  The
+ * average lookup cost is hash_lookup_steps (chain entries examined) over
+ * hash_hits + hash_misses.
+ */
+typedef struct dbuf_hash_cpu_stats {
+	uint64_t	dhc_hits;
+	uint64_t	dhc_misses;
+	uint64_t	dhc_steps;
+	uint64_t	dhc_pad[5];
+} dbuf_hash_cpu_stats_t;
+
+static dbuf_hash_cpu_stats_t *dbuf_hash_cpu_stats;
+
+static void
+dbuf_hash_lookup_stat(boolean_t hit, uint64_t steps)
+{
+	dbuf_hash_cpu_stats_t *dhc =
+	    &dbuf_hash_cpu_stats[CPU_SEQID % max_ncpus];
+
+	if (hit)
+		atomic_inc_64(&dhc->dhc_hits);
+	else
+		atomic_inc_64(&dhc->dhc_misses);
+	atomic_add_64(&dhc->dhc_steps, steps);
+}
+
+static int
+dbuf_kstat_update(kstat_t *ksp, int rw)
+{
+	dbuf_stats_t *ds = ksp->ks_data;
+	uint64_t hits = 0, misses = 0, steps = 0;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	for (int c = 0; c < max_ncpus; c++) {
+		hits += dbuf_hash_cpu_stats[c].dhc_hits;
+		misses += dbuf_hash_cpu_stats[c].dhc_misses;
+		steps += dbuf_hash_cpu_stats[c].dhc_steps;
+	}
+	ds->hash_hits.value.ui64 = hits;
+	ds->hash_misses.value.ui64 = misses;
+	ds->hash_lookup_steps.value.ui64 = steps;
+	ds->hash_elements.value.ui64 = dbuf_hash_count;
+	ds->hash_table_size.value.ui64 = dbuf_hash_table.hash_table_mask + 1;
+
+	return (0);
+}
+
 /*
  * We use Cityhash for this. It's fast, and has good hash properties without
  * requiring any large static buffers.
@@ -247,28 +348,42 @@ dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 	(dbuf)->db_level == (level) &&			\
 	(dbuf)->db_blkid == (blkid))
 
+/*
+ * The chain for hash value hv, in whichever table the mutex covering it
+ * currently points at.
+ */
+static dmu_buf_impl_t **
+dbuf_hash_chain(dbuf_hash_mutex_t *hm, uint64_t hv)
+{
+	ASSERT(MUTEX_HELD(&hm->dhm_mutex));
+	return (&hm->dhm_table[hv & hm->dhm_mask]);
+}
+
 dmu_buf_impl_t *
 dbuf_find(objset_t *os, uint64_t obj, uint8_t level, uint64_t blkid)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv = dbuf_hash(os, obj, level, blkid);
-	uint64_t idx;
+	dbuf_hash_mutex_t *hm = DBUF_HASH_LOCK(h, hv);
 	dmu_buf_impl_t *db;
+	uint64_t steps = 0;
 
-	idx = hv & h->hash_table_mask;
-
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
+	mutex_enter(&hm->dhm_mutex);
+	for (db = *dbuf_hash_chain(hm, hv); db != NULL;
+	    db = db->db_hash_next) {
+		steps++;
 		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
 			mutex_enter(&db->db_mtx);
 			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(&hm->dhm_mutex);
+				dbuf_hash_lookup_stat(B_TRUE, steps);
 				return (db);
 			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	mutex_exit(&hm->dhm_mutex);
+	dbuf_hash_lookup_stat(B_FALSE, steps);
 	return (NULL);
 }
 
@@ -305,15 +420,18 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	int level = db->db_level;
 	uint64_t blkid = db->db_blkid;
 	uint64_t hv = dbuf_hash(os, obj, level, blkid);
-	uint64_t idx = hv & h->hash_table_mask;
-	dmu_buf_impl_t *dbf;
-
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (dbf = h->hash_table[idx]; dbf != NULL; dbf = dbf->db_hash_next) {
+	dbuf_hash_mutex_t *hm = DBUF_HASH_LOCK(h, hv);
+	dmu_buf_impl_t *dbf, **chain;
+	uint64_t count;
+	uint32_t i;
+
+	mutex_enter(&hm->dhm_mutex);
+	chain = dbuf_hash_chain(hm, hv);
+	for (dbf = *chain, i = 0; dbf != NULL; dbf = dbf->db_hash_next, i++) {
 		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
 			mutex_enter(&dbf->db_mtx);
 			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+				mutex_exit(&hm->dhm_mutex);
 				return (dbf);
 			}
 			mutex_exit(&dbf->db_mtx);
@@ -321,10 +439,23 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	}
 
 	mutex_enter(&db->db_mtx);
-	db->db_hash_next = h->hash_table[idx];
-	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_inc_64(&dbuf_hash_count);
+	db->db_hash_next = *chain;
+	*chain = db;
+	mutex_exit(&hm->dhm_mutex);
+	count = atomic_inc_64_nv(&dbuf_hash_count);
+
+	/* collect some hash table performance data */
+	if (i > 0) {
+		DBUF_STAT_BUMP(hash_collisions);
+		if (i == 1)
+			DBUF_STAT_BUMP(hash_chains);
+		DBUF_STAT_MAX(hash_chain_max, i);
+	}
+	DBUF_STAT_MAX(hash_elements_max, count);
+
+	/* let the eviction thread know once the table needs to grow */
+	if (count == (h->hash_table_mask + 1) * dbuf_hash_load_max + 1)
+		cv_signal(&dbuf_evict_cv);
 
 	return (NULL);
 }
@@ -338,7 +469,7 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv = dbuf_hash(db->db_objset, db->db.db_object,
 		db->db_level, db->db_blkid);
-	uint64_t idx = hv & h->hash_table_mask;
+	dbuf_hash_mutex_t *hm = DBUF_HASH_LOCK(h, hv);
 	dmu_buf_impl_t *dbf, **dbp;
 
 	/*
@@ -349,18 +480,107 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	dbp = &h->hash_table[idx];
+	mutex_enter(&hm->dhm_mutex);
+	dbp = dbuf_hash_chain(hm, hv);
 	while ((dbf = *dbp) != db) {
 		dbp = &dbf->db_hash_next;
 		ASSERT(dbf != NULL);
 	}
 	*dbp = db->db_hash_next;
 	db->db_hash_next = NULL;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	dbp = dbuf_hash_chain(hm, hv);
+	if (*dbp != NULL && (*dbp)->db_hash_next == NULL)
+		DBUF_STAT_BUMPDOWN(hash_chains);
+	mutex_exit(&hm->dhm_mutex);
 	atomic_dec_64(&dbuf_hash_count);
 }
 
+/*
+ * The size the hash table should have for the current number of dbufs,
+ * or its current size if it is fine as it is.
+ */
+static uint64_t
+dbuf_hash_target_size(void)
+{
+	uint64_t size = dbuf_hash_table.hash_table_mask + 1;
+	uint64_t count = dbuf_hash_count;
+
+	if (dbuf_hash_load_max <= 0)
+		return (size);
+	if (count > size * dbuf_hash_load_max && size < DBUF_HASH_MAX_SIZE)
+		return (size << 1);
+	if (count < size * dbuf_hash_load_max / DBUF_HASH_SHRINK_FACTOR &&
+	    size > dbuf_hash_min_size)
+		return (size >> 1);
+	return (size);
+}
+
+/*
+ * Move every chain into a new table of nsize buckets.  This goes one
+ * hash mutex at a time, so lookups and inserts carry on throughout and
+ * at worst wait for the chains of a single mutex to be rehashed.  Only
+ * the dbuf eviction thread calls this.
+ */
+static void
+dbuf_hash_resize(uint64_t nsize)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+	uint64_t osize = h->hash_table_mask + 1;
+	dmu_buf_impl_t **otable = h->hash_table;
+	dmu_buf_impl_t **ntable, *db, *next;
+	hrtime_t start = gethrtime();
+
+	ASSERT(ISP2(nsize));
+	ASSERT3U(nsize, >=, DBUF_MUTEXES);
+
+	ntable = kmem_zalloc(nsize * sizeof (void *), KM_NOSLEEP);
+	if (ntable == NULL)
+		return;
+
+	for (int i = 0; i < DBUF_MUTEXES; i++) {
+		dbuf_hash_mutex_t *hm = &h->hash_mutexes[i];
+		int64_t chains = 0;
+
+		mutex_enter(&hm->dhm_mutex);
+		ASSERT3P(hm->dhm_table, ==, otable);
+		for (uint64_t idx = i; idx < osize; idx += DBUF_MUTEXES) {
+			if (otable[idx] != NULL &&
+			    otable[idx]->db_hash_next != NULL)
+				chains--;
+			for (db = otable[idx]; db != NULL; db = next) {
+				uint64_t nidx = dbuf_hash(db->db_objset,
+				    db->db.db_object, db->db_level,
+				    db->db_blkid) & (nsize - 1);
+
+				ASSERT3U(nidx & (DBUF_MUTEXES - 1), ==, i);
+				next = db->db_hash_next;
+				db->db_hash_next = ntable[nidx];
+				ntable[nidx] = db;
+			}
+			otable[idx] = NULL;
+		}
+		for (uint64_t idx = i; idx < nsize; idx += DBUF_MUTEXES) {
+			if (ntable[idx] != NULL &&
+			    ntable[idx]->db_hash_next != NULL)
+				chains++;
+		}
+		hm->dhm_table = ntable;
+		hm->dhm_mask = nsize - 1;
+		mutex_exit(&hm->dhm_mutex);
+
+		if (chains != 0)
+			atomic_add_64(&dbuf_stats.hash_chains.value.ui64,
+			    chains);
+	}
+
+	h->hash_table = ntable;
+	h->hash_table_mask = nsize - 1;
+	kmem_free(otable, osize * sizeof (void *));
+
+	dbuf_stats.hash_resize_time.value.ui64 += gethrtime() - start;
+	DBUF_STAT_BUMP(hash_resizes);
+}
+
 typedef enum {
 	DBVU_EVICTING,
 	DBVU_NOT_EVICTING
@@ -595,12 +815,15 @@ dbuf_evict_one(void)
  * and destroyed. The eviction thread will continue running until the size
  * of the dbuf cache is at or below the maximum size. Once the dbuf is aged
  * out of the cache it is destroyed and becomes eligible for arc eviction.
+ * The thread also resizes the dbuf hash table as the number of dbufs
+ * changes.
  */
 /* ARGSUSED */
 static void
 dbuf_evict_thread(void *unused)
 {
 	callb_cpr_t cpr;
+	uint64_t hsize;
 
 	CALLB_CPR_INIT(&cpr, &dbuf_evict_lock, callb_generic_cpr, FTAG);
 
@@ -611,9 +834,17 @@ dbuf_evict_thread(void *unused)
 			(void) cv_timedwait_hires(&dbuf_evict_cv,
 			    &dbuf_evict_lock, SEC2NSEC(1), MSEC2NSEC(1), 0);
 			CALLB_CPR_SAFE_END(&cpr, &dbuf_evict_lock);
+			if (dbuf_hash_target_size() !=
+			    dbuf_hash_table.hash_table_mask + 1)
+				break;
 		}
 		mutex_exit(&dbuf_evict_lock);
 
+		hsize = dbuf_hash_target_size();
+		if (hsize != dbuf_hash_table.hash_table_mask + 1 &&
+		    !dbuf_evict_thread_exit)
+			dbuf_hash_resize(hsize);
+
 		/*
 		 * Keep evicting as long as we're above the low water mark
 		 * for the cache. We do this without holding the locks to
@@ -694,6 +925,7 @@ dbuf_init(void)
 
 retry:
 	h->hash_table_mask = hsize - 1;
+	dbuf_hash_min_size = hsize;
 
     //printf("[dbuf] init hsize is 0x%llx mask is 0x%llx\n", hsize, h->hash_table_mask);
 
@@ -701,7 +933,7 @@ retry:
 
 	if (h->hash_table == NULL) {
 		/* XXX - we should really return an error instead of assert */
-		ASSERT(hsize > (1ULL << 10));
+		ASSERT(hsize > DBUF_MUTEXES);
 		hsize >>= 1;
 		goto retry;
 	}
@@ -714,11 +946,26 @@ retry:
 	    sizeof (dmu_buf_impl_t),
 	    0, dbuf_cons, dbuf_dest, NULL, NULL, NULL, 0);
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
+	for (i = 0; i < DBUF_MUTEXES; i++) {
+		mutex_init(&h->hash_mutexes[i].dhm_mutex, NULL,
+		    MUTEX_DEFAULT, NULL);
+		h->hash_mutexes[i].dhm_mask = h->hash_table_mask;
+		h->hash_mutexes[i].dhm_table = h->hash_table;
+	}
 
 	dbuf_stats_init(h);
 
+	dbuf_hash_cpu_stats = kmem_zalloc(max_ncpus *
+	    sizeof (dbuf_hash_cpu_stats_t), KM_SLEEP);
+	dbuf_ksp = kstat_create("zfs", 0, "dbufstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (dbuf_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (dbuf_ksp != NULL) {
+		dbuf_ksp->ks_data = &dbuf_stats;
+		dbuf_ksp->ks_update = dbuf_kstat_update;
+		kstat_install(dbuf_ksp);
+	}
+
 	/*
 	 * Setup the parameters for the dbuf caches. We set the sizes of the
 	 * dbuf cache and the metadata cache to 1/32nd and 1/16th (default)
@@ -768,13 +1015,12 @@ dbuf_fini(void)
 
 	dbuf_stats_destroy();
 
-	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_destroy(&h->hash_mutexes[i]);
-
-	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
-	kmem_cache_destroy(dbuf_kmem_cache);
-	taskq_destroy(dbu_evict_taskq);
+	if (dbuf_ksp != NULL) {
+		kstat_delete(dbuf_ksp);
+		dbuf_ksp = NULL;
+	}
 
+	/* the eviction thread may be resizing the hash table */
 	mutex_enter(&dbuf_evict_lock);
 	dbuf_evict_thread_exit = B_TRUE;
 	while (dbuf_evict_thread_exit) {
@@ -782,6 +1028,15 @@ dbuf_fini(void)
 		cv_wait(&dbuf_evict_cv, &dbuf_evict_lock);
 	}
 	mutex_exit(&dbuf_evict_lock);
+
+	for (i = 0; i < DBUF_MUTEXES; i++)
+		mutex_destroy(&h->hash_mutexes[i].dhm_mutex);
+
+	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
+	kmem_free(dbuf_hash_cpu_stats, max_ncpus *
+	    sizeof (dbuf_hash_cpu_stats_t));
+	kmem_cache_destroy(dbuf_kmem_cache);
+	taskq_destroy(dbu_evict_taskq);
 #ifdef _KERNEL
 	tsd_destroy(&zfs_dbuf_evict_key);
 #endif
@@ -956,6 +1211,54 @@ dbuf_clear_data(dmu_buf_impl_t *db)
 		db->db_state = DB_UNCACHED;
 }
 
+/*
+ * Is the newest version of this block one written by direct I/O in a txg
+ * that has not synced yet?  Its dirty record holds no data, so the block
+ * can only be read back through the bp recorded there.
+ */
+static boolean_t
+dbuf_direct_pending(dmu_buf_impl_t *db)
+{
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	return (db->db_level == 0 && db->db_blkid != DMU_BONUS_BLKID &&
+	    db->db_last_dirty != NULL && db->db_last_dirty->dt.dl.dr_direct);
+}
+
+/*
+ * Is a direct write of this block still in flight?  Its bp is only known
+ * once dmu_buf_direct_done() wakes db_changed.  The writer waits for
+ * nothing but its own zio in between, so callers may wait for it with
+ * dn_struct_rwlock held.
+ */
+static boolean_t
+dbuf_direct_in_flight(dmu_buf_impl_t *db)
+{
+	return (db->db_state == DB_NOFILL && dbuf_direct_pending(db) &&
+	    db->db_last_dirty->dt.dl.dr_override_state == DR_IN_DMU_SYNC);
+}
+
+/*
+ * Where to read back the block a settled direct write left.  The bp is
+ * recorded by dmu_buf_direct_done() and stays in dr_overridden_by after
+ * dbuf_write() hands it to syncing context and resets the override
+ * state, until dbuf_write_done().  A direct write that failed has no bp;
+ * its writer fills the block in the same tx.
+ */
+static const blkptr_t *
+dbuf_direct_bp(dmu_buf_impl_t *db)
+{
+	dbuf_dirty_record_t *dr = db->db_last_dirty;
+
+	ASSERT(dbuf_direct_pending(db));
+
+	if (dr->dt.dl.dr_override_state == DR_OVERRIDDEN ||
+	    (dr->dt.dl.dr_override_state == DR_NOT_OVERRIDDEN &&
+	    dr->dr_zio != NULL))
+		return (&dr->dt.dl.dr_overridden_by);
+	return (NULL);
+}
+
 static void
 dbuf_set_data(dmu_buf_impl_t *db, arc_buf_t *buf)
 {
@@ -1043,7 +1346,8 @@ dbuf_read_done(zio_t *zio, int err, arc_buf_t *buf, void *vdb)
 		ASSERT(zio == NULL || zio->io_error != 0);
 		ASSERT(db->db_blkid != DMU_BONUS_BLKID);
 		ASSERT3P(db->db_buf, ==, NULL);
-		db->db_state = DB_UNCACHED;
+		db->db_state = dbuf_direct_pending(db) ? DB_NOFILL :
+		    DB_UNCACHED;
 	} else if (db->db_level == 0 && db->db_freed_in_flight) {
 		/* freed in flight */
 		ASSERT(zio == NULL || zio->io_error == 0);
@@ -1127,6 +1431,8 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	dnode_t *dn;
 	zbookmark_phys_t zb;
 	arc_flags_t aflags = ARC_FLAG_NOWAIT;
+	const blkptr_t *read_bp = db->db_blkptr;
+	blkptr_t direct_bp;
 	int err, zio_flags = 0;
 
 	DB_DNODE_ENTER(db);
@@ -1135,11 +1441,12 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	/* We need the struct_rwlock to prevent db_blkptr from changing. */
 	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
 	ASSERT(MUTEX_HELD(&db->db_mtx));
-	ASSERT(db->db_state == DB_UNCACHED);
+	ASSERT(db->db_state == DB_UNCACHED || db->db_state == DB_NOFILL);
 	ASSERT(db->db_buf == NULL);
 
 	if (db->db_blkid == DMU_BONUS_BLKID) {
 		int bonuslen = MIN(dn->dn_bonuslen, dn->dn_phys->dn_bonuslen);
+		int max_bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
 
  		/* if the underlying dnode block is encrypted, decrypt it */
 		err = dbuf_read_verify_dnode_crypt(db, flags);
@@ -1150,10 +1457,10 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
  		}
 
 		ASSERT3U(bonuslen, <=, db->db.db_size);
-		db->db.db_data = zio_buf_alloc(DN_MAX_BONUSLEN);
-		arc_space_consume(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
-		if (bonuslen < DN_MAX_BONUSLEN)
-			bzero(db->db.db_data, DN_MAX_BONUSLEN);
+		db->db.db_data = zio_buf_alloc(max_bonuslen);
+		arc_space_consume(max_bonuslen, ARC_SPACE_OTHER);
+		if (bonuslen < max_bonuslen)
+			bzero(db->db.db_data, max_bonuslen);
 		if (bonuslen)
 			bcopy(DN_BONUS(dn->dn_phys), db->db.db_data, bonuslen);
 		DB_DNODE_EXIT(db);
@@ -1162,14 +1469,37 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		return (0);
 	}
 
+	if (db->db_state == DB_NOFILL) {
+		const blkptr_t *bp;
+
+		/*
+		 * Other NOFILL buffers have nothing to read.  Until its txg
+		 * syncs, a block written by direct I/O is only found through
+		 * the bp in its dirty record.
+		 */
+		if (!dbuf_direct_pending(db)) {
+			DB_DNODE_EXIT(db);
+			mutex_exit(&db->db_mtx);
+			return (0);
+		}
+		ASSERT(!dbuf_direct_in_flight(db));
+		if ((bp = dbuf_direct_bp(db)) == NULL) {
+			DB_DNODE_EXIT(db);
+			mutex_exit(&db->db_mtx);
+			return (SET_ERROR(EIO));
+		}
+		direct_bp = *bp;
+		read_bp = &direct_bp;
+	}
+
 	/*
 	 * Recheck BP_IS_HOLE() after dnode_block_freed() in case dnode_sync()
 	 * processes the delete record and clears the bp while we are waiting
 	 * for the dn_mtx (resulting in a "no" from block_freed).
 	 */
-	if (db->db_blkptr == NULL || BP_IS_HOLE(db->db_blkptr) ||
-	    (db->db_level == 0 && (dnode_block_freed(dn, db->db_blkid) ||
-	    BP_IS_HOLE(db->db_blkptr)))) {
+	if (read_bp == NULL || BP_IS_HOLE(read_bp) ||
+	    (db->db_level == 0 && read_bp == db->db_blkptr &&
+	    (dnode_block_freed(dn, db->db_blkid) || BP_IS_HOLE(read_bp)))) {
 		arc_buf_contents_t type = DBUF_GET_BUFC_TYPE(db);
 
 		dbuf_set_data(db, arc_alloc_buf(db->db_objset->os_spa, db, type,
@@ -1211,7 +1541,7 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	 * All bps of an encrypted os should have the encryption bit set.
 	 * If this is not true it indicates tampering and we report an error.
 	 */
-	if (db->db_objset->os_encrypted && !BP_USES_CRYPT(db->db_blkptr)) {
+	if (db->db_objset->os_encrypted && !BP_USES_CRYPT(read_bp)) {
 		spa_log_error(db->db_objset->os_spa, &zb);
 		zfs_panic_recover("unencrypted block in encrypted "
 		    "object set %llu", dmu_objset_id(db->db_objset));
@@ -1240,13 +1570,17 @@ dbuf_read_impl(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	zio_flags = (flags & DB_RF_CANFAIL) ?
 	    ZIO_FLAG_CANFAIL : ZIO_FLAG_MUSTSUCCEED;
 
-	if ((flags & DB_RF_NO_DECRYPT) && BP_IS_PROTECTED(db->db_blkptr))
+	if ((flags & DB_RF_NO_DECRYPT) && BP_IS_PROTECTED(read_bp))
 		zio_flags |= ZIO_FLAG_RAW;
 
-	err = arc_read(zio, db->db_objset->os_spa, db->db_blkptr,
+	err = arc_read(zio, db->db_objset->os_spa, read_bp,
 	    dbuf_read_done, db, ZIO_PRIORITY_SYNC_READ, zio_flags,
 	    &aflags, &zb);
 
+	dataset_kstats_update_arc_kstats(&db->db_objset->os_dsks,
+	    (aflags & ARC_FLAG_CACHED) != 0, BP_IS_EMBEDDED(read_bp) ?
+	    0 : BP_GET_PSIZE(read_bp));
+
 	return (SET_ERROR(err));
 }
 
@@ -1287,10 +1621,13 @@ dbuf_fix_old_data(dmu_buf_impl_t *db, uint64_t txg)
 	 */
 	ASSERT3U(dr->dr_txg, >=, txg - 2);
 	if (db->db_blkid == DMU_BONUS_BLKID) {
+		dnode_t *dn = DB_DNODE(db);
+		int bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
+
 		/* Note that the data bufs here are zio_bufs */
-		dr->dt.dl.dr_data = zio_buf_alloc(DN_MAX_BONUSLEN);
-		arc_space_consume(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
-		bcopy(db->db.db_data, dr->dt.dl.dr_data, DN_MAX_BONUSLEN);
+		dr->dt.dl.dr_data = zio_buf_alloc(bonuslen);
+		arc_space_consume(bonuslen, ARC_SPACE_OTHER);
+		bcopy(db->db.db_data, dr->dt.dl.dr_data, bonuslen);
 	} else if (refcount_count(&db->db_holds) > db->db_dirtycnt) {
 		dnode_t *dn = DB_DNODE(db);
 		int size = arc_buf_size(db->db_buf);
@@ -1338,9 +1675,6 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	 */
 	ASSERT(!refcount_is_zero(&db->db_holds));
 
-	if (db->db_state == DB_NOFILL)
-		return (SET_ERROR(EIO));
-
 	DB_DNODE_ENTER(db);
 	dn = DB_DNODE(db);
 	if ((flags & DB_RF_HAVESTRUCT) == 0)
@@ -1351,6 +1685,10 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	    DBUF_IS_CACHEABLE(db);
 
 	mutex_enter(&db->db_mtx);
+	/* A direct write of this block has no bp to read until it is done */
+	while (dbuf_direct_in_flight(db))
+		cv_wait(&db->db_changed, &db->db_mtx);
+
 	if (db->db_state == DB_CACHED) {
 		spa_t *spa = dn->dn_objset->os_spa;
 
@@ -1387,12 +1725,17 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 		if ((flags & DB_RF_HAVESTRUCT) == 0)
 			rw_exit(&dn->dn_struct_rwlock);
 		DB_DNODE_EXIT(db);
-	} else if (db->db_state == DB_UNCACHED) {
+	} else if (db->db_state == DB_UNCACHED ||
+	    db->db_state == DB_NOFILL) {
 		spa_t *spa = dn->dn_objset->os_spa;
 		boolean_t need_wait = B_FALSE;
 
-		if (zio == NULL &&
-		    db->db_blkptr != NULL && !BP_IS_HOLE(db->db_blkptr)) {
+		/*
+		 * A NOFILL buffer can only be read back when it was
+		 * written by direct I/O; dbuf_read_impl() leaves the rest.
+		 */
+		if (zio == NULL && (db->db_state == DB_NOFILL ||
+		    (db->db_blkptr != NULL && !BP_IS_HOLE(db->db_blkptr)))) {
 			zio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
 			need_wait = B_TRUE;
 		}
@@ -1407,8 +1750,12 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 			rw_exit(&dn->dn_struct_rwlock);
 		DB_DNODE_EXIT(db);
 
-		if (!err && need_wait)
-			err = zio_wait(zio);
+		if (need_wait) {
+			/* wait even on error so the root zio is not leaked */
+			int zio_err = zio_wait(zio);
+			if (err == 0)
+				err = zio_err;
+		}
 	} else {
 		/*
 		 * Another reader came in while the dbuf was in flight
@@ -1436,7 +1783,8 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 				    db, zio_t *, zio);
 				cv_wait(&db->db_changed, &db->db_mtx);
 			}
-			if (db->db_state == DB_UNCACHED)
+			if (db->db_state == DB_UNCACHED ||
+			    db->db_state == DB_NOFILL)
 				err = SET_ERROR(EIO);
 		}
 		mutex_exit(&db->db_mtx);
@@ -1445,6 +1793,92 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	return (err);
 }
 
+static void
+dbuf_read_direct_done(zio_t *zio)
+{
+	if (zio->io_error == 0)
+		abd_copy_to_buf(zio->io_private, zio->io_abd, zio->io_size);
+	abd_free(zio->io_abd);
+}
+
+/*
+ * Read a level-0 block for direct I/O into buf, which holds db_size bytes.
+ * A block that is cached in the dbuf is copied from there, so direct
+ * readers see buffered writes that have not synced yet.  Anything else is
+ * read from disk as a child of pio, without going through the ARC.  buf
+ * may be mapped from the application, which can change it at any time,
+ * so the block is read and verified in a buffer of our own and only
+ * copied to buf once the read has succeeded.  The caller holds
+ * dn_struct_rwlock so that db_blkptr cannot change before the read has
+ * been issued.
+ */
+int
+dbuf_read_direct(dmu_buf_impl_t *db, zio_t *pio, void *buf, uint32_t flags)
+{
+	dnode_t *dn;
+	zbookmark_phys_t zb;
+	blkptr_t bp;
+
+	ASSERT(!refcount_is_zero(&db->db_holds));
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+	ASSERT0(db->db_level);
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	ASSERT(RW_LOCK_HELD(&dn->dn_struct_rwlock));
+
+	mutex_enter(&db->db_mtx);
+	while (db->db_state == DB_READ || db->db_state == DB_FILL ||
+	    dbuf_direct_in_flight(db))
+		cv_wait(&db->db_changed, &db->db_mtx);
+
+	if (db->db_state == DB_CACHED) {
+		bcopy(db->db.db_data, buf, db->db.db_size);
+		mutex_exit(&db->db_mtx);
+		DB_DNODE_EXIT(db);
+		return (0);
+	} else if (db->db_state == DB_NOFILL) {
+		const blkptr_t *direct_bp = NULL;
+
+		if (dbuf_direct_pending(db))
+			direct_bp = dbuf_direct_bp(db);
+		if (direct_bp == NULL) {
+			mutex_exit(&db->db_mtx);
+			DB_DNODE_EXIT(db);
+			return (SET_ERROR(EIO));
+		}
+		bp = *direct_bp;
+	} else {
+		ASSERT3U(db->db_state, ==, DB_UNCACHED);
+		if (db->db_blkptr == NULL ||
+		    dnode_block_freed(dn, db->db_blkid))
+			BP_ZERO(&bp);
+		else
+			bp = *db->db_blkptr;
+	}
+	mutex_exit(&db->db_mtx);
+	DB_DNODE_EXIT(db);
+
+	if (BP_IS_HOLE(&bp)) {
+		bzero(buf, db->db.db_size);
+		return (0);
+	}
+
+	/* Encrypted objsets never take the direct path. */
+	ASSERT(!BP_IS_PROTECTED(&bp));
+	ASSERT3U(BP_GET_LSIZE(&bp), ==, db->db.db_size);
+
+	SET_BOOKMARK(&zb, dmu_objset_id(db->db_objset),
+	    db->db.db_object, 0, db->db_blkid);
+	zio_nowait(zio_read(pio, dmu_objset_spa(db->db_objset), &bp,
+	    abd_alloc_for_io(db->db.db_size, B_FALSE), db->db.db_size,
+	    dbuf_read_direct_done, buf, ZIO_PRIORITY_SYNC_READ,
+	    (flags & DB_RF_CANFAIL) ? ZIO_FLAG_CANFAIL : ZIO_FLAG_MUSTSUCCEED,
+	    &zb));
+
+	return (0);
+}
+
 static void
 dbuf_noread(dmu_buf_impl_t *db)
 {
@@ -1453,7 +1887,8 @@ dbuf_noread(dmu_buf_impl_t *db)
 	mutex_enter(&db->db_mtx);
 	while (db->db_state == DB_READ || db->db_state == DB_FILL)
 		cv_wait(&db->db_changed, &db->db_mtx);
-	if (db->db_state == DB_UNCACHED) {
+	if (db->db_state == DB_UNCACHED ||
+	    (db->db_state == DB_NOFILL && dbuf_direct_pending(db))) {
 		arc_buf_contents_t type = DBUF_GET_BUFC_TYPE(db);
 		spa_t *spa = db->db_objset->os_spa;
 
@@ -1500,9 +1935,10 @@ dbuf_unoverride(dbuf_dirty_record_t *dr)
 	 * modifying the buffer, so they will immediately do
 	 * another (redundant) arc_release().  Therefore, leave
 	 * the buf thawed to save the effort of freezing &
-	 * immediately re-thawing it.
+	 * immediately re-thawing it.  A direct write has no buffer.
 	 */
-	arc_release(dr->dt.dl.dr_data, db);
+	if (dr->dt.dl.dr_data != NULL)
+		arc_release(dr->dt.dl.dr_data, db);
 }
 
 /*
@@ -1551,6 +1987,16 @@ dbuf_free_range(dnode_t *dn, uint64_t start_blkid, uint64_t end_blkid,
 			continue;
 		}
 
+		if (db->db_state == DB_NOFILL && dbuf_direct_pending(db)) {
+			/*
+			 * A direct write from an earlier txg is no longer
+			 * the newest version of this block, the free is.
+			 * Readers go back to db_blkptr and find the hole.
+			 */
+			db->db_last_dirty->dt.dl.dr_direct = B_FALSE;
+			db->db_state = DB_UNCACHED;
+		}
+
 		if (db->db_state == DB_UNCACHED ||
 			db->db_state == DB_NOFILL ||
 			db->db_state == DB_EVICTING) {
@@ -1695,6 +2141,17 @@ dbuf_redirty(dbuf_dirty_record_t *dr)
 		 * we now need to reset its state.
 		 */
 		dbuf_unoverride(dr);
+		if (dr->dt.dl.dr_direct) {
+			/*
+			 * The block written by direct I/O was just freed;
+			 * from now on this record carries the buffer that
+			 * was read or filled on top of it.
+			 */
+			ASSERT(db->db_buf != NULL);
+			arc_release(db->db_buf, db);
+			dr->dt.dl.dr_data = db->db_buf;
+			dr->dt.dl.dr_direct = B_FALSE;
+		}
 		if (db->db.db_object != DMU_META_DNODE_OBJECT &&
 		    db->db_state != DB_NOFILL) {
 			/* Already released on initial dirty, so just thaw. */
@@ -2070,22 +2527,29 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	}
 	DB_DNODE_EXIT(db);
 
-	if (db->db_state != DB_NOFILL) {
+	if (db->db_state != DB_NOFILL || dr->dt.dl.dr_direct) {
 		dbuf_unoverride(dr);
 
-		ASSERT(db->db_buf != NULL);
-		ASSERT(dr->dt.dl.dr_data != NULL);
-		if (dr->dt.dl.dr_data != db->db_buf)
+		ASSERT(db->db_buf != NULL || dr->dt.dl.dr_direct);
+		ASSERT(dr->dt.dl.dr_data != NULL || dr->dt.dl.dr_direct);
+		if (dr->dt.dl.dr_data != NULL &&
+		    dr->dt.dl.dr_data != db->db_buf)
 			arc_buf_destroy(dr->dt.dl.dr_data, db);
 	}
 
+	/* Without its direct write, a NOFILL block reads from db_blkptr */
+	if (db->db_state == DB_NOFILL && dr->dt.dl.dr_direct &&
+	    !dbuf_direct_pending(db))
+		db->db_state = DB_UNCACHED;
+
 	kmem_free(dr, sizeof (dbuf_dirty_record_t));
 
 	ASSERT(db->db_dirtycnt > 0);
 	db->db_dirtycnt -= 1;
 
 	if (refcount_remove(&db->db_holds, (void *)(uintptr_t)txg) == 0) {
-		ASSERT(db->db_state == DB_NOFILL || arc_released(db->db_buf));
+		ASSERT(db->db_state == DB_NOFILL || db->db_buf == NULL ||
+		    arc_released(db->db_buf));
 		dbuf_destroy(db);
 		return (B_TRUE);
 	}
@@ -2131,6 +2595,23 @@ dmu_buf_will_dirty_impl(dmu_buf_t *db_fake, int flags, dmu_tx_t *tx)
 		flags |= DB_RF_HAVESTRUCT;
 	DB_DNODE_EXIT(db);
 	(void) dbuf_read(db, NULL, flags);
+
+	/*
+	 * A block written by direct I/O was read back above through the bp
+	 * its write left.  If it left none, the direct write failed and its
+	 * writer is about to fill the block in the same tx; there is no data
+	 * to dirty until then, so wait for the fill rather than dirtying the
+	 * block as if it were NOFILL.
+	 */
+	mutex_enter(&db->db_mtx);
+	while (db->db_state == DB_FILL ||
+	    (db->db_state == DB_NOFILL && dbuf_direct_pending(db) &&
+	    dbuf_direct_bp(db) == NULL)) {
+		ASSERT((flags & DB_RF_HAVESTRUCT) == 0);
+		cv_wait(&db->db_changed, &db->db_mtx);
+	}
+	mutex_exit(&db->db_mtx);
+
 	(void) dbuf_dirty(db, tx);
 }
 
@@ -2146,7 +2627,12 @@ dmu_buf_will_not_fill(dmu_buf_t *db_fake, dmu_tx_t *tx)
 {
 	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
 
+	mutex_enter(&db->db_mtx);
+	/* Whatever a direct write left in this block is being replaced. */
+	if (dbuf_direct_pending(db))
+		db->db_last_dirty->dt.dl.dr_direct = B_FALSE;
 	db->db_state = DB_NOFILL;
+	mutex_exit(&db->db_mtx);
 
 	dmu_buf_will_fill(db_fake, tx);
 }
@@ -2266,6 +2752,105 @@ dmu_buf_write_embedded(dmu_buf_t *dbuf, void *data,
 	dl->dr_overridden_by.blk_birth = db->db_last_dirty->dr_txg;
 }
 
+/*
+ * Prepare a level-0 block to be written by direct I/O in this tx.  Any
+ * cached copy is dropped and the block is dirtied without data, like
+ * dmu_buf_will_not_fill(), with its override marked in flight so that
+ * syncing context waits for the caller's write.  The caller must then
+ * write the block itself and report the result with
+ * dmu_buf_direct_done() before committing the tx.
+ *
+ * Returns B_FALSE, leaving the block alone, if anyone but the caller and
+ * the block's dirty records holds it: the cached copy may still be in
+ * use (e.g. loaned out for read), so the caller must fill the block
+ * through dmu_buf_will_fill() instead.
+ */
+boolean_t
+dmu_buf_will_direct(dmu_buf_t *db_fake, dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	dbuf_dirty_record_t *dr;
+
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+	ASSERT0(db->db_level);
+	ASSERT(tx->tx_txg != 0);
+	ASSERT(!refcount_is_zero(&db->db_holds));
+
+	mutex_enter(&db->db_mtx);
+	while (db->db_state == DB_READ || db->db_state == DB_FILL)
+		cv_wait(&db->db_changed, &db->db_mtx);
+
+	if (db->db_buf != NULL &&
+	    refcount_count(&db->db_holds) > db->db_dirtycnt + 1) {
+		mutex_exit(&db->db_mtx);
+		return (B_FALSE);
+	}
+
+	/* Anything already written to this block in this txg is replaced. */
+	VERIFY(!dbuf_undirty(db, tx));
+
+	if (db->db_buf != NULL) {
+		dr = db->db_last_dirty;
+
+		/*
+		 * The buffer belongs to an older txg's dirty record if it
+		 * still refers to it; that record frees it once synced.
+		 */
+		if (dr == NULL || dr->dt.dl.dr_data != db->db_buf) {
+			arc_release(db->db_buf, db);
+			arc_buf_destroy(db->db_buf, db);
+		}
+		db->db_buf = NULL;
+		dbuf_clear_data(db);
+	}
+	ASSERT3P(db->db.db_data, ==, NULL);
+	db->db_state = DB_NOFILL;
+	mutex_exit(&db->db_mtx);
+
+	dr = dbuf_dirty(db, tx);
+
+	mutex_enter(&db->db_mtx);
+	ASSERT3P(dr->dt.dl.dr_data, ==, NULL);
+	ASSERT3U(dr->dt.dl.dr_override_state, ==, DR_NOT_OVERRIDDEN);
+	dr->dt.dl.dr_direct = B_TRUE;
+	dr->dt.dl.dr_override_state = DR_IN_DMU_SYNC;
+	mutex_exit(&db->db_mtx);
+
+	return (B_TRUE);
+}
+
+/*
+ * Record the outcome of a write started with dmu_buf_will_direct().  On
+ * success bp becomes the block's override, as with dmu_sync().  On
+ * failure the dirty record is left without data and the caller must fill
+ * the block through dmu_buf_will_fill() in the same tx.
+ */
+void
+dmu_buf_direct_done(dmu_buf_t *db_fake, dmu_tx_t *tx, const blkptr_t *bp,
+    uint8_t copies, int err)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	dbuf_dirty_record_t *dr;
+
+	mutex_enter(&db->db_mtx);
+	dr = db->db_last_dirty;
+	ASSERT3P(dr, !=, NULL);
+	ASSERT3U(dr->dr_txg, ==, tx->tx_txg);
+	ASSERT(dr->dt.dl.dr_direct);
+	ASSERT3U(dr->dt.dl.dr_override_state, ==, DR_IN_DMU_SYNC);
+
+	if (err == 0) {
+		dr->dt.dl.dr_overridden_by = *bp;
+		dr->dt.dl.dr_override_state = DR_OVERRIDDEN;
+		dr->dt.dl.dr_copies = copies;
+		dr->dt.dl.dr_nopwrite = B_FALSE;
+	} else {
+		dr->dt.dl.dr_override_state = DR_NOT_OVERRIDDEN;
+	}
+	cv_broadcast(&db->db_changed);
+	mutex_exit(&db->db_mtx);
+}
+
 /*
  * Directly assign a provided arc buf to a given dbuf if it's not referenced
  * by anybody except our caller. Otherwise copy arcbuf's contents to dbuf.
@@ -2289,6 +2874,10 @@ dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx)
 	while (db->db_state == DB_READ || db->db_state == DB_FILL)
 		cv_wait(&db->db_changed, &db->db_mtx);
 
+	/* A block written by direct I/O is replaced like an uncached one */
+	if (db->db_state == DB_NOFILL && dbuf_direct_pending(db))
+		db->db_state = DB_UNCACHED;
+
 	ASSERT(db->db_state == DB_CACHED || db->db_state == DB_UNCACHED);
 
 	if (db->db_state == DB_CACHED &&
@@ -2353,9 +2942,11 @@ dbuf_destroy(dmu_buf_impl_t *db)
 	}
 
 	if (db->db_blkid == DMU_BONUS_BLKID) {
+		int slots = DB_DNODE(db)->dn_num_slots;
+		int bonuslen = DN_SLOTS_TO_BONUSLEN(slots);
 		if (db->db.db_data != NULL) {
-			zio_buf_free(db->db.db_data, DN_MAX_BONUSLEN);
-			arc_space_return(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+			zio_buf_free(db->db.db_data, bonuslen);
+			arc_space_return(bonuslen, ARC_SPACE_OTHER);
 			db->db_state = DB_UNCACHED;
 		}
 	}
@@ -2453,7 +3044,7 @@ dbuf_findbp(dnode_t *dn, int level, uint64_t blkid, int fail_sparse,
 		mutex_enter(&dn->dn_mtx);
 		if (dn->dn_have_spill &&
 		    (dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR))
-			*bpp = &dn->dn_phys->dn_spill;
+			*bpp = DN_SPILL_BLKPTR(dn->dn_phys);
 		else
 			*bpp = NULL;
 		dbuf_add_ref(dn->dn_dbuf, NULL);
@@ -2562,7 +3153,7 @@ dbuf_create(dnode_t *dn, uint8_t level, uint64_t blkid,
 
 	if (blkid == DMU_BONUS_BLKID) {
 		ASSERT3P(parent, ==, dn->dn_dbuf);
-		db->db.db_size = DN_MAX_BONUSLEN -
+		db->db.db_size = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots) -
 		    (dn->dn_nblkptr-1) * sizeof (blkptr_t);
 		ASSERT3U(db->db.db_size, >=, dn->dn_bonuslen);
 		db->db.db_offset = DMU_BONUS_BLKID;
@@ -3404,7 +3995,7 @@ dbuf_check_blkptr(dnode_t *dn, dmu_buf_impl_t *db)
 		return;
 
 	if (db->db_blkid == DMU_SPILL_BLKID) {
-		db->db_blkptr = &dn->dn_phys->dn_spill;
+		db->db_blkptr = DN_SPILL_BLKPTR(dn->dn_phys);
 		BP_ZERO(db->db_blkptr);
 		return;
 	}
@@ -3584,6 +4175,7 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 	 */
 	if (db->db_blkid == DMU_BONUS_BLKID) {
 		dbuf_dirty_record_t **drp;
+		int bonuslen = DN_SLOTS_TO_BONUSLEN(dn->dn_num_slots);
 
 		ASSERT(*datap != NULL);
 		ASSERT0(db->db_level);
@@ -3594,8 +4186,8 @@ dbuf_sync_leaf(dbuf_dirty_record_t *dr, dmu_tx_t *tx)
 		DB_DNODE_EXIT(db);
 
 		if (*datap != db->db.db_data) {
-			zio_buf_free(*datap, DN_MAX_BONUSLEN);
-			arc_space_return(DN_MAX_BONUSLEN, ARC_SPACE_OTHER);
+			zio_buf_free(*datap, bonuslen);
+			arc_space_return(bonuslen, ARC_SPACE_OTHER);
 		}
 		db->db_data_pending = NULL;
 		drp = &db->db_last_dirty;
@@ -3772,7 +4364,7 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 	if (db->db_blkid == DMU_SPILL_BLKID) {
 		ASSERT(dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR);
 		ASSERT(!(BP_IS_HOLE(bp)) &&
-		    db->db_blkptr == &dn->dn_phys->dn_spill);
+		    db->db_blkptr == DN_SPILL_BLKPTR(dn->dn_phys));
 	}
 #endif
 
@@ -3786,11 +4378,17 @@ dbuf_write_ready(zio_t *zio, arc_buf_t *buf, void *vdb)
 		mutex_exit(&dn->dn_mtx);
 
 		if (dn->dn_type == DMU_OT_DNODE) {
-			dnode_phys_t *dnp = db->db.db_data;
-			for (i = db->db.db_size >> DNODE_SHIFT; i > 0;
-			    i--, dnp++) {
-				if (dnp->dn_type != DMU_OT_NONE)
+			i = 0;
+			while (i < db->db.db_size) {
+				dnode_phys_t *dnp =
+				    (void *)(((char *)db->db.db_data) + i);
+
+				i += DNODE_MIN_SIZE;
+				if (dnp->dn_type != DMU_OT_NONE) {
 					fill++;
+					i += dnp->dn_extra_slots *
+					    DNODE_MIN_SIZE;
+				}
 			}
 		} else {
 			if (BP_IS_HOLE(bp)) {
@@ -3915,6 +4513,10 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		dsl_dataset_t *ds = os->os_dsl_dataset;
 		(void) dsl_dataset_block_kill(ds, bp_orig, tx, B_TRUE);
 		dsl_dataset_block_born(ds, bp, tx);
+		if (!BP_IS_HOLE(bp) && !BP_IS_EMBEDDED(bp)) {
+			dataset_kstats_update_pwritten_kstats(&os->os_dsks,
+			    BP_GET_PSIZE(bp));
+		}
 	}
 
 	mutex_enter(&db->db_mtx);
@@ -3937,7 +4539,7 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		dn = DB_DNODE(db);
 		ASSERT(dn->dn_phys->dn_flags & DNODE_FLAG_SPILL_BLKPTR);
 		ASSERT(!(BP_IS_HOLE(db->db_blkptr)) &&
-		    db->db_blkptr == &dn->dn_phys->dn_spill);
+		    db->db_blkptr == DN_SPILL_BLKPTR(dn->dn_phys));
 		DB_DNODE_EXIT(db);
 	}
 #endif
@@ -3945,10 +4547,16 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 	if (db->db_level == 0) {
 		ASSERT(db->db_blkid != DMU_BONUS_BLKID);
 		ASSERT(dr->dt.dl.dr_override_state == DR_NOT_OVERRIDDEN);
-		if (db->db_state != DB_NOFILL) {
-			if (dr->dt.dl.dr_data != db->db_buf)
-				arc_buf_destroy(dr->dt.dl.dr_data, db);
-		}
+		if (dr->dt.dl.dr_data != NULL &&
+		    dr->dt.dl.dr_data != db->db_buf)
+			arc_buf_destroy(dr->dt.dl.dr_data, db);
+		/*
+		 * Once the last direct write has synced, the block is
+		 * found through db_blkptr again.
+		 */
+		if (db->db_state == DB_NOFILL && dr->dt.dl.dr_direct &&
+		    !dbuf_direct_pending(db))
+			db->db_state = DB_UNCACHED;
 	} else {
 		dnode_t *dn;
 
@@ -4009,7 +4617,8 @@ dbuf_write_override_done(zio_t *zio)
 	if (!BP_EQUAL(zio->io_bp, obp)) {
 		if (!BP_IS_HOLE(obp))
 			dsl_free(spa_get_dsl(zio->io_spa), zio->io_txg, obp);
-		arc_release(dr->dt.dl.dr_data, db);
+		if (dr->dt.dl.dr_data != NULL)
+			arc_release(dr->dt.dl.dr_data, db);
 	}
 	mutex_exit(&db->db_mtx);
 	dbuf_write_done(zio, NULL, db);
@@ -4144,7 +4753,8 @@ dbuf_remap(dnode_t *dn, dmu_buf_impl_t *db, dmu_tx_t *tx)
 		dnode_phys_t *dnp = db->db.db_data;
 		ASSERT3U(db->db_dnode_handle->dnh_dnode->dn_type, ==,
 		    DMU_OT_DNODE);
-		for (int i = 0; i < db->db.db_size >> DNODE_SHIFT; i++) {
+		for (int i = 0; i < db->db.db_size >> DNODE_SHIFT;
+		    i += dnp[i].dn_extra_slots + 1) {
 			for (int j = 0; j < dnp[i].dn_nblkptr; j++) {
 				dbuf_remap_impl(dn, &dnp[i].dn_blkptr[j], tx);
 			}
@@ -4223,7 +4833,7 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 
 	if (db->db_blkid == DMU_SPILL_BLKID)
 		wp_flag = WP_SPILL;
-	wp_flag |= (db->db_state == DB_NOFILL) ? WP_NOFILL : 0;
+	wp_flag |= (db->db_level == 0 && data == NULL) ? WP_NOFILL : 0;
 
 	dmu_write_policy(os, dn, db->db_level, wp_flag, &zp);
 	DB_DNODE_EXIT(db);
@@ -4255,7 +4865,8 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 		zio_write_override(dr->dr_zio, &dr->dt.dl.dr_overridden_by,
 			dr->dt.dl.dr_copies, dr->dt.dl.dr_nopwrite);
 		mutex_exit(&db->db_mtx);
-	} else if (db->db_state == DB_NOFILL) {
+	} else if (data == NULL) {
+		ASSERT0(db->db_level);
 		ASSERT(zp.zp_checksum == ZIO_CHECKSUM_OFF ||
 			zp.zp_checksum == ZIO_CHECKSUM_NOPARITY);
 		dr->dr_zio = zio_write(zio, os->os_spa, txg,
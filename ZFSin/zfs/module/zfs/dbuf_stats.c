@@ -132,15 +132,23 @@ dbuf_stats_hash_table_data(char *buf, uint32_t size, void *data)
 {
 	dbuf_stats_t *dsh = (dbuf_stats_t *)data;
 	dbuf_hash_table_t *h = dsh->hash;
+	dbuf_hash_mutex_t *hm = DBUF_HASH_LOCK(h, dsh->idx);
 	dmu_buf_impl_t *db;
 	int length, error = 0;
 
 	ASSERT3S(dsh->idx, >=, 0);
-	ASSERT3S(dsh->idx, <=, h->hash_table_mask);
 	memset(buf, 0, size);
 
-	mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
-	for (db = h->hash_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
+	/*
+	 * The table may have been resized since the walk started; a bucket
+	 * beyond the end of the table it now lives in has nothing to show.
+	 */
+	mutex_enter(&hm->dhm_mutex);
+	if (dsh->idx > hm->dhm_mask) {
+		mutex_exit(&hm->dhm_mutex);
+		return (0);
+	}
+	for (db = hm->dhm_table[dsh->idx]; db != NULL; db = db->db_hash_next) {
 		/*
 		 * Returning ENOMEM will cause the data and header functions
 		 * to be called with a larger scratch buffers.
@@ -151,7 +159,7 @@ dbuf_stats_hash_table_data(char *buf, uint32_t size, void *data)
 		}
 
 		mutex_enter(&db->db_mtx);
-		mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+		mutex_exit(&hm->dhm_mutex);
 
 		if (db->db_state != DB_EVICTING) {
 			length = __dbuf_stats_hash_table_data(buf, size, db);
@@ -160,9 +168,9 @@ dbuf_stats_hash_table_data(char *buf, uint32_t size, void *data)
 		}
 
 		mutex_exit(&db->db_mtx);
-		mutex_enter(DBUF_HASH_MUTEX(h, dsh->idx));
+		mutex_enter(&hm->dhm_mutex);
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, dsh->idx));
+	mutex_exit(&hm->dhm_mutex);
 
 	return (error);
 }
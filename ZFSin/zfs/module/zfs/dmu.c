@@ -244,7 +244,7 @@ dmu_buf_hold(objset_t *os, uint64_t object, uint64_t offset,
 int
 dmu_bonus_max(void)
 {
-	return (DN_MAX_BONUSLEN);
+	return (DN_OLD_MAX_BONUSLEN);
 }
 
 int
@@ -1263,6 +1263,10 @@ typedef struct xuio_stats {
 	/* whether a copy is made when assigning a write buffer */
 	kstat_named_t xuiostat_wbuf_copied;
 	kstat_named_t xuiostat_wbuf_nocopy;
+	/* dmu_read_loan(): loans made, bytes loaned, loans not returned */
+	kstat_named_t xuiostat_loan_reads;
+	kstat_named_t xuiostat_loan_bytes;
+	kstat_named_t xuiostat_onloan_reads;
 } xuio_stats_t;
 
 static xuio_stats_t xuio_stats = {
@@ -1271,7 +1275,10 @@ static xuio_stats_t xuio_stats = {
 	{ "read_buf_copied",	KSTAT_DATA_UINT64 },
 	{ "read_buf_nocopy",	KSTAT_DATA_UINT64 },
 	{ "write_buf_copied",	KSTAT_DATA_UINT64 },
-	{ "write_buf_nocopy",	KSTAT_DATA_UINT64 }
+	{ "write_buf_nocopy",	KSTAT_DATA_UINT64 },
+	{ "loan_reads",		KSTAT_DATA_UINT64 },
+	{ "loan_read_bytes",	KSTAT_DATA_UINT64 },
+	{ "onloan_reads",	KSTAT_DATA_UINT64 }
 };
 
 #define	XUIOSTAT_INCR(stat, val)        \
@@ -1409,6 +1416,114 @@ xuio_stat_wbuf_nocopy(void)
 	XUIOSTAT_BUMP(xuiostat_wbuf_nocopy);
 }
 
+static int
+dmu_read_loan_dnode(dnode_t *dn, uint64_t offset, uint64_t size,
+    uint32_t flags, dmu_loan_done_func_t *done, void *arg,
+    dmu_loan_t **loanp)
+{
+	dmu_loan_t *loan;
+	int err;
+
+	if (size == 0 || size > DMU_MAX_ACCESS >> 1)
+		return (SET_ERROR(EINVAL));
+
+	/* the loan itself is the tag its dbufs are held with */
+	loan = kmem_zalloc(sizeof (dmu_loan_t), KM_SLEEP);
+	err = dmu_buf_hold_array_by_dnode(dn, offset, size, TRUE, loan,
+	    &loan->dl_numbufs, &loan->dl_dbp, flags);
+	if (err != 0) {
+		kmem_free(loan, sizeof (dmu_loan_t));
+		return (err);
+	}
+	loan->dl_offset = offset;
+	loan->dl_size = size;
+	loan->dl_done = done;
+	loan->dl_arg = arg;
+
+	XUIOSTAT_BUMP(xuiostat_loan_reads);
+	XUIOSTAT_INCR(xuiostat_loan_bytes, size);
+	XUIOSTAT_BUMP(xuiostat_onloan_reads);
+
+	*loanp = loan;
+	return (0);
+}
+
+/*
+ * Lend the caller the data for [offset, offset + size) of the object;
+ * see the comment above dmu_loan_t.
+ */
+int
+dmu_read_loan(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
+    uint32_t flags, dmu_loan_done_func_t *done, void *arg, dmu_loan_t **loanp)
+{
+	dnode_t *dn;
+	int err;
+
+	err = dnode_hold(os, object, FTAG, &dn);
+	if (err != 0)
+		return (err);
+
+	err = dmu_read_loan_dnode(dn, offset, size, flags, done, arg, loanp);
+	dnode_rele(dn, FTAG);
+	return (err);
+}
+
+/*
+ * As dmu_read_loan(), for the object zdb belongs to (e.g. through its
+ * bonus buffer), without having to look up its dnode.
+ */
+int
+dmu_read_loan_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    uint32_t flags, dmu_loan_done_func_t *done, void *arg, dmu_loan_t **loanp)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)zdb;
+	int err;
+
+	DB_DNODE_ENTER(db);
+	err = dmu_read_loan_dnode(DB_DNODE(db), offset, size, flags, done,
+	    arg, loanp);
+	DB_DNODE_EXIT(db);
+
+	return (err);
+}
+
+/*
+ * Return the part of the loan's i'th dbuf that lies inside the loaned
+ * range, and its length in *lenp.  The data must not be written to.
+ */
+const void *
+dmu_loan_segment(dmu_loan_t *loan, int i, uint64_t *lenp)
+{
+	dmu_buf_t *db = loan->dl_dbp[i];
+	uint64_t start, end;
+
+	ASSERT3S(i, <, loan->dl_numbufs);
+	ASSERT(db->db_data != NULL);
+
+	start = MAX(loan->dl_offset, db->db_offset);
+	end = MIN(loan->dl_offset + loan->dl_size,
+	    db->db_offset + db->db_size);
+	ASSERT3U(start, <, end);
+
+	*lenp = end - start;
+	return ((char *)db->db_data + (start - db->db_offset));
+}
+
+/*
+ * Give back a loan made by dmu_read_loan().  The dbufs are released
+ * before the done callback runs, so it must not look at the data.
+ */
+void
+dmu_loan_return(dmu_loan_t *loan)
+{
+	dmu_buf_rele_array(loan->dl_dbp, loan->dl_numbufs, loan);
+	XUIOSTAT_INCR(xuiostat_onloan_reads, -1);
+
+	if (loan->dl_done != NULL)
+		loan->dl_done(loan, loan->dl_arg);
+	kmem_free(loan, sizeof (dmu_loan_t));
+}
+
 #ifdef _KERNEL
 
 static int
@@ -1832,6 +1947,222 @@ dmu_write_iokit_dbuf(dmu_buf_t *zdb, uint64_t *offset, uint64_t position,
 
 	return (err);
 }
+
+/*
+ * Direct I/O moves whole blocks between the caller's buffer and disk
+ * without going through the ARC.  The range must be block aligned; the
+ * caller checks that, and keeps encrypted objsets on the buffered path.
+ */
+static int
+dmu_read_direct_dnode(dnode_t *dn, uint64_t offset, uint64_t size, void *buf)
+{
+	dmu_buf_t **dbp;
+	int numbufs, i, err, err2;
+	zio_t *zio;
+
+	ASSERT0(P2PHASE(offset, dn->dn_datablksz));
+	ASSERT0(P2PHASE(size, dn->dn_datablksz));
+	ASSERT(!dn->dn_objset->os_encrypted);
+
+	err = dmu_buf_hold_array_by_dnode(dn, offset, size, FALSE, FTAG,
+	    &numbufs, &dbp, DMU_READ_NO_PREFETCH);
+	if (err)
+		return (err);
+
+	zio = zio_root(dn->dn_objset->os_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	for (i = 0; i < numbufs; i++) {
+		dmu_buf_t *db = dbp[i];
+
+		err = dbuf_read_direct((dmu_buf_impl_t *)db, zio,
+		    (char *)buf + (db->db_offset - offset), DB_RF_CANFAIL);
+		if (err)
+			break;
+	}
+	rw_exit(&dn->dn_struct_rwlock);
+
+	err2 = zio_wait(zio);
+	if (err == 0)
+		err = err2;
+
+	dmu_buf_rele_array(dbp, numbufs, FTAG);
+	return (err);
+}
+
+int
+dmu_read_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    void *buf)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)zdb;
+	dnode_t *dn;
+	int err;
+
+	if (size == 0)
+		return (0);
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	err = dmu_read_direct_dnode(dn, offset, size, buf);
+	DB_DNODE_EXIT(db);
+
+	return (err);
+}
+
+typedef struct dmu_direct_arg {
+	dmu_buf_t	*dda_db;
+	blkptr_t	dda_bp;
+	uint8_t		dda_copies;
+	int		dda_error;
+} dmu_direct_arg_t;
+
+static void
+dmu_write_direct_ready(zio_t *zio)
+{
+	dmu_direct_arg_t *dda = zio->io_private;
+	blkptr_t *bp = zio->io_bp;
+
+	if (zio->io_error == 0) {
+		if (BP_IS_HOLE(bp)) {
+			/* As in dmu_sync_ready(), keep the size for replay */
+			BP_SET_LSIZE(bp, dda->dda_db->db_size);
+		} else if (!BP_IS_EMBEDDED(bp)) {
+			ASSERT(BP_GET_LEVEL(bp) == 0);
+			BP_SET_FILL(bp, 1);
+		}
+	}
+}
+
+static void
+dmu_write_direct_done(zio_t *zio)
+{
+	dmu_direct_arg_t *dda = zio->io_private;
+	blkptr_t *bp = zio->io_bp;
+
+	dda->dda_error = zio->io_error;
+	if (zio->io_error == 0) {
+		dda->dda_copies = zio->io_prop.zp_copies;
+		/* Old style holes are all zeros, see dmu_sync_done() */
+		if (BP_IS_HOLE(bp) && bp->blk_birth == 0)
+			BP_ZERO(bp);
+	}
+	abd_free(zio->io_abd);
+}
+
+/*
+ * Write one block of a direct write through the dbuf instead, for the
+ * txg to write out.
+ */
+static void
+dmu_write_direct_fill(dmu_buf_t *db, const char *data, dmu_tx_t *tx)
+{
+	dmu_buf_will_fill(db, tx);
+	bcopy(data, db->db_data, db->db_size);
+	dmu_buf_fill_done(db, tx);
+}
+
+static int
+dmu_write_direct_dnode(dnode_t *dn, uint64_t offset, uint64_t size,
+    const void *buf, dmu_tx_t *tx)
+{
+	objset_t *os = dn->dn_objset;
+	dmu_buf_t **dbp;
+	dmu_direct_arg_t *dda;
+	zbookmark_phys_t zb;
+	zio_prop_t zp;
+	int numbufs, i, err;
+	zio_t *zio;
+
+	ASSERT0(P2PHASE(offset, dn->dn_datablksz));
+	ASSERT0(P2PHASE(size, dn->dn_datablksz));
+	ASSERT(!os->os_encrypted);
+
+	err = dmu_buf_hold_array_by_dnode(dn, offset, size, FALSE, FTAG,
+	    &numbufs, &dbp, DMU_READ_NO_PREFETCH);
+	if (err)
+		return (err);
+
+	/*
+	 * The blocks are written the way dmu_sync() writes them, so they
+	 * can be handed to the ZIL as they are.  Nopwrite would compare
+	 * against db_blkptr, which may change before this txg syncs.
+	 *
+	 * buf may be mapped from the application, which can change it while
+	 * the write is in flight; checksumming it in place could then store
+	 * a checksum that does not match the data, or different data on
+	 * each side of a mirror.  Each block is copied to a buffer of our
+	 * own first, which still keeps it out of the ARC.
+	 */
+	dmu_write_policy(os, dn, 0, WP_DMU_SYNC, &zp);
+	zp.zp_nopwrite = B_FALSE;
+
+	dda = kmem_zalloc(sizeof (dmu_direct_arg_t) * numbufs, KM_SLEEP);
+	zio = zio_root(os->os_spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	for (i = 0; i < numbufs; i++) {
+		dmu_buf_t *db = dbp[i];
+		const char *data = (const char *)buf + (db->db_offset - offset);
+		abd_t *abd;
+
+		if (!dmu_buf_will_direct(db, tx)) {
+			/* Others still use the cached copy; write through it */
+			dmu_write_direct_fill(db, data, tx);
+			continue;
+		}
+
+		abd = abd_alloc_for_io(db->db_size, B_FALSE);
+		abd_copy_from_buf(abd, data, db->db_size);
+
+		dda[i].dda_db = db;
+		BP_ZERO(&dda[i].dda_bp);
+		SET_BOOKMARK(&zb, dmu_objset_id(os), db->db_object, 0,
+		    ((dmu_buf_impl_t *)db)->db_blkid);
+		zio_nowait(zio_write(zio, os->os_spa, dmu_tx_get_txg(tx),
+		    &dda[i].dda_bp, abd, db->db_size, db->db_size, &zp,
+		    dmu_write_direct_ready, NULL, NULL, dmu_write_direct_done,
+		    &dda[i], ZIO_PRIORITY_SYNC_WRITE, ZIO_FLAG_CANFAIL, &zb));
+	}
+	(void) zio_wait(zio);
+
+	for (i = 0; i < numbufs; i++) {
+		dmu_buf_t *db = dda[i].dda_db;
+
+		if (db == NULL)
+			continue;
+		dmu_buf_direct_done(db, tx, &dda[i].dda_bp,
+		    dda[i].dda_copies, dda[i].dda_error);
+		if (dda[i].dda_error == 0)
+			continue;
+
+		/*
+		 * The data is still in the caller's buffer, so rather
+		 * than failing the write, let the txg write this block.
+		 */
+		dmu_write_direct_fill(db,
+		    (const char *)buf + (db->db_offset - offset), tx);
+	}
+
+	kmem_free(dda, sizeof (dmu_direct_arg_t) * numbufs);
+	dmu_buf_rele_array(dbp, numbufs, FTAG);
+	return (0);
+}
+
+int
+dmu_write_direct_dbuf(dmu_buf_t *zdb, uint64_t offset, uint64_t size,
+    const void *buf, dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)zdb;
+	dnode_t *dn;
+	int err;
+
+	if (size == 0)
+		return (0);
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	err = dmu_write_direct_dnode(dn, offset, size, buf, tx);
+	DB_DNODE_EXIT(db);
+
+	return (err);
+}
 #endif /* _KERNEL */
 
 /*
@@ -2257,6 +2588,18 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 	DB_DNODE_EXIT(db);
 
 	ASSERT(dr->dr_txg == txg);
+	if (dr->dt.dl.dr_direct &&
+	    dr->dt.dl.dr_override_state == DR_OVERRIDDEN) {
+		/*
+		 * This block was written by direct I/O and is already on
+		 * disk; the log record only needs its bp.
+		 */
+		*zgd->zgd_bp = dr->dt.dl.dr_overridden_by;
+		mutex_exit(&db->db_mtx);
+		done(zgd, 0);
+		return (0);
+	}
+
 	if (dr->dt.dl.dr_override_state == DR_IN_DMU_SYNC ||
 	    dr->dt.dl.dr_override_state == DR_OVERRIDDEN) {
 		/*
@@ -2505,6 +2848,8 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	zp->zp_type = (wp & WP_SPILL) ? dn->dn_bonustype : type;
 	zp->zp_level = level;
 	zp->zp_copies = MIN(copies, spa_max_replication(os->os_spa));
+	zp->zp_zpl_smallblk = DMU_OT_IS_FILE(zp->zp_type) ?
+	    os->os_zpl_special_smallblock : 0;
 	zp->zp_dedup = dedup;
 	zp->zp_dedup_verify = dedup && dedup_verify;
 	zp->zp_nopwrite = nopwrite;
@@ -2587,6 +2932,7 @@ __dmu_object_info_from_dnode(dnode_t *dn, dmu_object_info_t *doi)
 	doi->doi_type = dn->dn_type;
 	doi->doi_bonus_type = dn->dn_bonustype;
 	doi->doi_bonus_size = dn->dn_bonuslen;
+	doi->doi_dnodesize = dn->dn_num_slots << DNODE_SHIFT;
 	doi->doi_indirection = dn->dn_nlevels;
 	doi->doi_checksum = dn->dn_checksum;
 	doi->doi_compress = dn->dn_compress;
@@ -2659,9 +3005,21 @@ dmu_object_size_from_db(dmu_buf_t *db_fake, uint32_t *blksize,
 	dn = DB_DNODE(db);
 
 	*blksize = dn->dn_datablksz;
-	/* add 1 for dnode space */
+	/* add in number of slots used for the dnode itself */
 	*nblk512 = ((DN_USED_BYTES(dn->dn_phys) + SPA_MINBLOCKSIZE/2) >>
-	    SPA_MINBLOCKSHIFT) + 1;
+	    SPA_MINBLOCKSHIFT) + dn->dn_num_slots;
+	DB_DNODE_EXIT(db);
+}
+
+void
+dmu_object_dnsize_from_db(dmu_buf_t *db_fake, int *dnsize)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+	dnode_t *dn;
+
+	DB_DNODE_ENTER(db);
+	dn = DB_DNODE(db);
+	*dnsize = dn->dn_num_slots << DNODE_SHIFT;
 	DB_DNODE_EXIT(db);
 }
 
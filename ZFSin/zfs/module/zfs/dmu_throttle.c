@@ -0,0 +1,152 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+
+#include <sys/zfs_context.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_throttle.h>
+
+#define	DMU_THROTTLE_RATE_MAX	(1ULL << 40)
+
+/*
+ * Per-dataset I/O limits
+ *
+ * The readlimit, writelimit and iopslimit properties cap the rate at which
+ * a dataset (and, as they are inherited, everything below it that doesn't
+ * set its own) can read and write through the ZPL and zvols. Each limit is
+ * a token bucket refilled at the configured rate and holding at most one
+ * second's worth of tokens. An i/o takes what it needs even if that leaves
+ * the bucket in debt, and the caller then sleeps until the debt would be
+ * repaid; later callers see the debt too and queue up behind it. The rate
+ * is re-read on every call, so a property change applies at once.
+ *
+ * The limits are charged in the thread that issued the request, before
+ * any tx is assigned so a throttled writer never holds up a txg: in
+ * fs_read()/fs_write() for files, and in the zvol read/write entry points.
+ * Paging I/O is never charged, as sleeping there would stall the cache
+ * manager's lazy writer and the mapped page writer. Time spent asleep is
+ * reported in the objset-0x<id> kstat of each dataset (dataset_kstats.c).
+ */
+
+void
+dmu_throttle_init(objset_t *os)
+{
+	dmu_throttle_t *dt = &os->os_throttle;
+
+	mutex_init(&dt->dt_lock, NULL, MUTEX_DEFAULT, NULL);
+	bzero(&dt->dt_stats, sizeof (dt->dt_stats));
+	for (int t = 0; t < DMU_THROTTLE_TYPES; t++) {
+		dt->dt_bucket[t].tb_tokens = 0;
+		dt->dt_bucket[t].tb_stamp = 0;
+	}
+}
+
+void
+dmu_throttle_fini(objset_t *os)
+{
+	mutex_destroy(&os->os_throttle.dt_lock);
+}
+
+/*
+ * Refill the bucket up to now, take n tokens out of it and return how
+ * long the caller has to wait for the bucket to get out of debt.
+ */
+static hrtime_t
+dmu_tbucket_take(dmu_tbucket_t *tb, uint64_t rate, uint64_t n, hrtime_t now)
+{
+	hrtime_t elapsed = now - tb->tb_stamp;
+	uint64_t debt;
+	int64_t room;
+
+	/* anything faster than this is as good as unlimited */
+	rate = MIN(rate, DMU_THROTTLE_RATE_MAX);
+
+	if (tb->tb_stamp == 0) {
+		tb->tb_tokens = rate;
+	} else if (elapsed > 0) {
+		/*
+		 * Refill in whole seconds and microseconds so that a long
+		 * idle period can't overflow, but don't forget any debt
+		 * that takes longer than a second to repay.
+		 */
+		uint64_t secs = elapsed / NANOSEC;
+		uint64_t usecs = (elapsed % NANOSEC) / (NANOSEC / MICROSEC);
+
+		room = (int64_t)rate - tb->tb_tokens;
+		if (room <= 0 || secs > (uint64_t)room / rate) {
+			tb->tb_tokens = rate;
+		} else {
+			tb->tb_tokens += MIN(room,
+			    (int64_t)(secs * rate + rate * usecs / MICROSEC));
+		}
+	}
+	tb->tb_stamp = now;
+
+	tb->tb_tokens -= MIN(n, DMU_THROTTLE_RATE_MAX);
+	if (tb->tb_tokens >= 0)
+		return (0);
+
+	/* no floating point in the kernel; split to keep this from overflowing */
+	debt = -tb->tb_tokens;
+	return ((hrtime_t)((debt / rate) * NANOSEC +
+	    (debt % rate) * MICROSEC / rate * (NANOSEC / MICROSEC)));
+}
+
+/*
+ * Charge an i/o of size bytes against os's limits, sleeping if any of
+ * them is exceeded.
+ */
+void
+dmu_throttle(objset_t *os, boolean_t write, uint64_t size)
+{
+	dmu_throttle_t *dt = &os->os_throttle;
+	uint64_t bytes_rate = write ? os->os_writelimit : os->os_readlimit;
+	uint64_t iops_rate = os->os_iopslimit;
+	hrtime_t now, wait = 0;
+
+	if (bytes_rate == 0 && iops_rate == 0)
+		return;
+
+	mutex_enter(&dt->dt_lock);
+	now = gethrtime();
+	if (bytes_rate != 0) {
+		wait = dmu_tbucket_take(&dt->dt_bucket[write ?
+		    DMU_THROTTLE_WRITE : DMU_THROTTLE_READ],
+		    bytes_rate, size, now);
+	}
+	if (iops_rate != 0) {
+		wait = MAX(wait, dmu_tbucket_take(
+		    &dt->dt_bucket[DMU_THROTTLE_IOPS], iops_rate, 1, now));
+	}
+	if (wait > 0) {
+		if (write) {
+			dt->dt_stats.dts_writes_delayed++;
+			dt->dt_stats.dts_write_delay_ns += wait;
+		} else {
+			dt->dt_stats.dts_reads_delayed++;
+			dt->dt_stats.dts_read_delay_ns += wait;
+		}
+	}
+	mutex_exit(&dt->dt_lock);
+
+	if (wait > 0)
+		zfs_sleep_until(now + wait);
+}
@@ -55,14 +55,94 @@
 #include <sys/zfs_vfsops.h>
 #endif
 
+/*
+ * Sorted scrub and resilver.
+ *
+ * Issuing scrub reads in the order the traversal finds the block pointers
+ * turns a scrub into a stream of small random reads, since logically
+ * adjacent blocks are rarely physically adjacent. Instead, the scan runs
+ * in two phases:
+ *
+ * 1) The traversal (dsl_scan_visit()) reads only metadata. Every block it
+ *    wants scrubbed is recorded as a scan_io_t in the queue of the top-level
+ *    vdev holding each of its DVAs, sorted by offset.
+ *
+ * 2) Once the queues have gathered as much as we allow them to, or the
+ *    traversal is complete, the queues are drained: a thread per top-level
+ *    vdev sweeps its queue in ascending offset order so that the reads reach
+ *    the disks as nearly sequential extents, which the vdev queue can then
+ *    aggregate into large I/Os.
+ *
+ * The queues only live in memory. The traversal position is therefore only
+ * written out ("checkpointed") when all the queues are empty: dsl_scan_t
+ * keeps the live position in scn_phys and the last checkpoint in
+ * scn_phys_cached, and the dataset work queue is held in memory and synced
+ * to scn_queue_obj at the same time. If the pool is exported, or the system
+ * goes down, the scan resumes from the last checkpoint and gathers the lost
+ * blocks again. A checkpoint is forced every zfs_scan_checkpoint_intval
+ * seconds so that not too much work is repeated in that case.
+ *
+ * Setting zfs_scan_legacy issues the reads straight from the traversal, as
+ * was done before.
+ */
+
 typedef int (scan_cb_t)(dsl_pool_t *, const blkptr_t *,
     const zbookmark_phys_t *);
 
+/*
+ * A dataset in the in-memory traversal work queue.
+ */
+typedef struct scan_ds {
+	avl_node_t	sds_node;
+	uint64_t	sds_dsobj;
+	uint64_t	sds_txg;
+} scan_ds_t;
+
+/*
+ * A single gathered scrub read: one DVA of a block pointer.
+ */
+typedef struct scan_io {
+	blkptr_t		sio_bp;
+	uint64_t		sio_offset;	/* offset of the queued DVA */
+	uint64_t		sio_asize;	/* asize of the queued DVA */
+	int			sio_dva;	/* index of the queued DVA */
+	int			sio_flags;	/* zio flags for the read */
+	zbookmark_phys_t	sio_zb;
+	avl_node_t		sio_addr_node;	/* link in q_sios_by_addr */
+} scan_io_t;
+
+/*
+ * The per top-level vdev queue of gathered reads. The queue is protected by
+ * vdev_scan_io_queue_lock of the vdev it is attached to.
+ */
+struct dsl_scan_io_queue {
+	dsl_scan_t	*q_scn;
+	vdev_t		*q_vd;		/* top-level vdev of this queue */
+	avl_tree_t	q_sios_by_addr;	/* scan_io_t sorted by offset */
+	uint64_t	q_sio_memused;	/* memory held by q_sios_by_addr */
+	uint64_t	q_cursor;	/* end of the last issued read */
+
+	/* members for zio rate limiting */
+	uint64_t	q_maxinflight_bytes;
+	uint64_t	q_inflight_bytes;
+	kcondvar_t	q_zio_cv;
+};
+
 static scan_cb_t dsl_scan_scrub_cb;
 static void dsl_scan_cancel_sync(void *, dmu_tx_t *);
-static void dsl_scan_sync_state(dsl_scan_t *, dmu_tx_t *);
 static boolean_t dsl_scan_restarting(dsl_scan_t *, dmu_tx_t *);
 
+typedef enum {
+	SYNC_OPTIONAL,	/* write the state out if the queues are empty */
+	SYNC_MANDATORY,	/* the queues must be empty */
+	SYNC_CACHED,	/* write the last checkpoint if they are not */
+} state_sync_type_t;
+
+static void dsl_scan_sync_state(dsl_scan_t *, dmu_tx_t *, state_sync_type_t);
+static void scan_ds_queue_clear(dsl_scan_t *);
+static void scan_ds_queue_insert(dsl_scan_t *, uint64_t, uint64_t);
+static void scan_io_queues_destroy(dsl_scan_t *);
+
 int zfs_top_maxinflight = 32;		/* maximum I/Os per top-level */
 int zfs_resilver_delay = 2;		/* number of ticks to delay resilver */
 int zfs_scrub_delay = 4;		/* number of ticks to delay scrub */
@@ -79,6 +159,21 @@ int dsl_scan_delay_completion = B_FALSE; /* set to delay scan completion */
 /* max number of blocks to free in a single TXG */
 uint64_t zfs_async_block_max_blocks = UINT64_MAX;
 
+int zfs_scan_legacy = B_FALSE; /* don't sort scrub i/o before issuing it */
+uint64_t zfs_scan_vdev_limit = 4 << 20; /* in-flight sorted bytes per leaf */
+int zfs_scan_checkpoint_intval = 7200; /* seconds between checkpoints */
+int zfs_scan_strict_mem_lim = B_FALSE; /* check memory during traversal */
+/*
+ * The queues may use up to 1/zfs_scan_mem_lim_fact of physical memory (but
+ * at least zfs_scan_mem_lim_min). Once that limit is reached they are
+ * drained by 1/zfs_scan_mem_lim_soft_fact of it (at most
+ * zfs_scan_mem_lim_soft_max) before the traversal continues.
+ */
+int zfs_scan_mem_lim_fact = 20;
+int zfs_scan_mem_lim_soft_fact = 20;
+uint64_t zfs_scan_mem_lim_min = 16 << 20;
+uint64_t zfs_scan_mem_lim_soft_max = 128 << 20;
+
 #define	DSL_SCAN_IS_SCRUB_RESILVER(scn) \
 	((scn)->scn_phys.scn_func == POOL_SCAN_SCRUB || \
 	(scn)->scn_phys.scn_func == POOL_SCAN_RESILVER)
@@ -95,6 +190,95 @@ static scan_cb_t *scan_funcs[POOL_SCAN_FUNCS] = {
 	dsl_scan_scrub_cb,	/* POOL_SCAN_RESILVER */
 };
 
+static int
+scan_ds_queue_compare(const void *a, const void *b)
+{
+	const scan_ds_t *sds_a = a, *sds_b = b;
+
+	if (sds_a->sds_dsobj < sds_b->sds_dsobj)
+		return (-1);
+	if (sds_a->sds_dsobj > sds_b->sds_dsobj)
+		return (1);
+	return (0);
+}
+
+static void
+scan_ds_queue_clear(dsl_scan_t *scn)
+{
+	void *cookie = NULL;
+	scan_ds_t *sds;
+
+	while ((sds = avl_destroy_nodes(&scn->scn_queue, &cookie)) != NULL)
+		kmem_free(sds, sizeof (*sds));
+}
+
+static boolean_t
+scan_ds_queue_contains(dsl_scan_t *scn, uint64_t dsobj, uint64_t *txg)
+{
+	scan_ds_t srch, *sds;
+
+	srch.sds_dsobj = dsobj;
+	sds = avl_find(&scn->scn_queue, &srch, NULL);
+	if (sds != NULL && txg != NULL)
+		*txg = sds->sds_txg;
+	return (sds != NULL);
+}
+
+static void
+scan_ds_queue_insert(dsl_scan_t *scn, uint64_t dsobj, uint64_t txg)
+{
+	scan_ds_t *sds;
+	avl_index_t where;
+
+	sds = kmem_zalloc(sizeof (*sds), KM_SLEEP);
+	sds->sds_dsobj = dsobj;
+	sds->sds_txg = txg;
+
+	VERIFY3P(avl_find(&scn->scn_queue, sds, &where), ==, NULL);
+	avl_insert(&scn->scn_queue, sds, where);
+}
+
+static void
+scan_ds_queue_remove(dsl_scan_t *scn, uint64_t dsobj)
+{
+	scan_ds_t srch, *sds;
+
+	srch.sds_dsobj = dsobj;
+
+	sds = avl_find(&scn->scn_queue, &srch, NULL);
+	VERIFY(sds != NULL);
+	avl_remove(&scn->scn_queue, sds);
+	kmem_free(sds, sizeof (*sds));
+}
+
+/*
+ * Replace the on-disk dataset queue with the in-memory one. Only done at
+ * a checkpoint, when everything traversed so far has been issued.
+ */
+static void
+scan_ds_queue_sync(dsl_scan_t *scn, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = scn->scn_dp;
+	spa_t *spa = dp->dp_spa;
+	dmu_object_type_t ot = (spa_version(spa) >= SPA_VERSION_DSL_SCRUB) ?
+	    DMU_OT_SCAN_QUEUE : DMU_OT_ZAP_OTHER;
+	scan_ds_t *sds;
+
+	ASSERT0(scn->scn_bytes_pending);
+	ASSERT(scn->scn_phys.scn_queue_obj != 0);
+
+	VERIFY0(dmu_object_free(dp->dp_meta_objset,
+	    scn->scn_phys.scn_queue_obj, tx));
+	scn->scn_phys.scn_queue_obj = zap_create(dp->dp_meta_objset, ot,
+	    DMU_OT_NONE, 0, tx);
+	for (sds = avl_first(&scn->scn_queue); sds != NULL;
+	    sds = AVL_NEXT(&scn->scn_queue, sds)) {
+		VERIFY0(zap_add_int_key(dp->dp_meta_objset,
+		    scn->scn_phys.scn_queue_obj, sds->sds_dsobj,
+		    sds->sds_txg, tx));
+	}
+}
+
 int
 dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 {
@@ -105,6 +289,8 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 
 	scn = dp->dp_scan = kmem_zalloc(sizeof (dsl_scan_t), KM_SLEEP);
 	scn->scn_dp = dp;
+	avl_create(&scn->scn_queue, scan_ds_queue_compare, sizeof (scan_ds_t),
+	    offsetof(scan_ds_t, sds_node));
 
 	/*
 	 * It's possible that we're resuming a scan after a reboot so
@@ -193,8 +379,34 @@ dsl_scan_init(dsl_pool_t *dp, uint64_t txg)
 			    "by old software; restarting in txg %llu",
 			    scn->scn_restart_txg);
 		}
+
+		/*
+		 * The on-disk state is a checkpoint, so everything it counts
+		 * as examined has also been issued.
+		 */
+		scn->scn_issued_before_pass = scn->scn_phys.scn_examined;
+
+		/* reload the dataset queue into the in-core state */
+		if (scn->scn_phys.scn_state == DSS_SCANNING &&
+		    scn->scn_phys.scn_queue_obj != 0) {
+			zap_cursor_t zc;
+			zap_attribute_t *za;
+
+			za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+			for (zap_cursor_init(&zc, dp->dp_meta_objset,
+			    scn->scn_phys.scn_queue_obj);
+			    zap_cursor_retrieve(&zc, za) == 0;
+			    (void) zap_cursor_advance(&zc)) {
+				scan_ds_queue_insert(scn,
+				    strtonum(za->za_name, NULL),
+				    za->za_first_integer);
+			}
+			zap_cursor_fini(&zc);
+			kmem_free(za, sizeof (zap_attribute_t));
+		}
 	}
 
+	bcopy(&scn->scn_phys, &scn->scn_phys_cached, sizeof (scn->scn_phys));
 	spa_scan_stat_init(spa);
 	return (0);
 }
@@ -203,6 +415,19 @@ void
 dsl_scan_fini(dsl_pool_t *dp)
 {
 	if (dp->dp_scan) {
+		dsl_scan_t *scn = dp->dp_scan;
+
+		/*
+		 * The vdev queues are normally gone by now, as the vdevs
+		 * are freed before the pool is closed.
+		 */
+		if (dp->dp_spa->spa_root_vdev != NULL)
+			scan_io_queues_destroy(scn);
+		if (scn->scn_taskq != NULL)
+			taskq_destroy(scn->scn_taskq);
+		scan_ds_queue_clear(scn);
+		avl_destroy(&scn->scn_queue);
+
 		kmem_free(dp->dp_scan, sizeof (dsl_scan_t));
 		dp->dp_scan = NULL;
 	}
@@ -242,6 +467,8 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 	scn->scn_phys.scn_to_examine = spa->spa_root_vdev->vdev_stat.vs_alloc;
 	scn->scn_restart_txg = 0;
 	scn->scn_done_txg = 0;
+	scn->scn_issued_before_pass = 0;
+	scn->scn_last_checkpoint = ddi_get_lbolt64();
 	spa_scan_stat_init(spa);
 
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
@@ -283,8 +510,11 @@ dsl_scan_setup_sync(void *arg, dmu_tx_t *tx)
 
 	scn->scn_phys.scn_queue_obj = zap_create(dp->dp_meta_objset,
 	    ot ? ot : DMU_OT_SCAN_QUEUE, DMU_OT_NONE, 0, tx);
+	ASSERT0(avl_numnodes(&scn->scn_queue));
+
+	bcopy(&scn->scn_phys, &scn->scn_phys_cached, sizeof (scn->scn_phys));
 
-	dsl_scan_sync_state(scn, tx);
+	dsl_scan_sync_state(scn, tx, SYNC_MANDATORY);
 
 	spa_history_log_internal(spa, "scan setup", tx,
 	    "func=%u mintxg=%llu maxtxg=%llu",
@@ -322,6 +552,18 @@ dsl_scan_done(dsl_scan_t *scn, boolean_t complete, dmu_tx_t *tx)
 		    scn->scn_phys.scn_queue_obj, tx));
 		scn->scn_phys.scn_queue_obj = 0;
 	}
+	scan_ds_queue_clear(scn);
+
+	/*
+	 * Sorted reads are only in flight while dsl_scan_sync() issues them,
+	 * so whatever is still queued now (on cancel) can simply be dropped.
+	 */
+	if (scn->scn_is_sorted) {
+		scan_io_queues_destroy(scn);
+		scn->scn_is_sorted = B_FALSE;
+	}
+	scn->scn_clearing = B_FALSE;
+	scn->scn_checkpointing = B_FALSE;
 
 	scn->scn_phys.scn_flags &= ~DSF_SCRUB_PAUSED;
 
@@ -412,7 +654,7 @@ dsl_scan_cancel_sync(void *arg, dmu_tx_t *tx)
 	dsl_scan_t *scn = dmu_tx_pool(tx)->dp_scan;
 
 	dsl_scan_done(scn, B_FALSE, tx);
-	dsl_scan_sync_state(scn, tx);
+	dsl_scan_sync_state(scn, tx, SYNC_MANDATORY);
 	spa_event_notify(scn->scn_dp->dp_spa, NULL, NULL, ESC_ZFS_SCRUB_ABORT);
 }
 
@@ -467,7 +709,8 @@ dsl_scrub_pause_resume_sync(void *arg, dmu_tx_t *tx)
 		/* can't pause a scrub when there is no in-progress scrub */
 		spa->spa_scan_pass_scrub_pause = gethrestime_sec();
 		scn->scn_phys.scn_flags |= DSF_SCRUB_PAUSED;
-		dsl_scan_sync_state(scn, tx);
+		scn->scn_phys_cached.scn_flags |= DSF_SCRUB_PAUSED;
+		dsl_scan_sync_state(scn, tx, SYNC_CACHED);
 		spa_event_notify(spa, NULL, NULL, ESC_ZFS_SCRUB_PAUSED);
 	} else {
 		ASSERT3U(*cmd, ==, POOL_SCRUB_NORMAL);
@@ -481,7 +724,8 @@ dsl_scrub_pause_resume_sync(void *arg, dmu_tx_t *tx)
 			    gethrestime_sec() - spa->spa_scan_pass_scrub_pause;
 			spa->spa_scan_pass_scrub_pause = 0;
 			scn->scn_phys.scn_flags &= ~DSF_SCRUB_PAUSED;
-			dsl_scan_sync_state(scn, tx);
+			scn->scn_phys_cached.scn_flags &= ~DSF_SCRUB_PAUSED;
+			dsl_scan_sync_state(scn, tx, SYNC_CACHED);
 		}
 	}
 }
@@ -538,24 +782,79 @@ dsl_scan_ds_maxtxg(dsl_dataset_t *ds)
 	return (smt);
 }
 
+/*
+ * Write out the scan state. The live traversal state can only be written
+ * when nothing gathered is still waiting in the vdev queues, in which case
+ * this also completes a checkpoint. Otherwise SYNC_CACHED writes the last
+ * checkpoint again, to persist changes made to it (e.g. pausing).
+ */
 static void
-dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx)
+dsl_scan_sync_state(dsl_scan_t *scn, dmu_tx_t *tx, state_sync_type_t sync_type)
 {
-	VERIFY0(zap_update(scn->scn_dp->dp_meta_objset,
-	    DMU_POOL_DIRECTORY_OBJECT,
-	    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
-	    &scn->scn_phys, tx));
+	ASSERT(sync_type != SYNC_MANDATORY || scn->scn_bytes_pending == 0);
+
+	if (scn->scn_bytes_pending == 0) {
+		if (scn->scn_phys.scn_queue_obj != 0)
+			scan_ds_queue_sync(scn, tx);
+		VERIFY0(zap_update(scn->scn_dp->dp_meta_objset,
+		    DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
+		    &scn->scn_phys, tx));
+		bcopy(&scn->scn_phys, &scn->scn_phys_cached,
+		    sizeof (scn->scn_phys));
+
+		if (scn->scn_checkpointing)
+			zfs_dbgmsg("finish scan checkpoint");
+
+		scn->scn_checkpointing = B_FALSE;
+		scn->scn_last_checkpoint = ddi_get_lbolt64();
+	} else if (sync_type == SYNC_CACHED) {
+		VERIFY0(zap_update(scn->scn_dp->dp_meta_objset,
+		    DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_SCAN, sizeof (uint64_t), SCAN_PHYS_NUMINTS,
+		    &scn->scn_phys_cached, tx));
+	}
 }
 
 extern int zfs_vdev_async_write_active_min_dirty_percent;
 
+/*
+ * We stop scanning (traversing or issuing) for this txg if:
+ *  - we have scanned for the maximum time: an entire txg
+ *    timeout (default 5 sec)
+ *  or
+ *  - we have scanned for at least the minimum time (default 1 sec
+ *    for scrub, 3 sec for resilver), and either we have sufficient
+ *    dirty data that we are starting to write more quickly
+ *    (default 30%), or someone is explicitly waiting for this txg
+ *    to complete.
+ *  or
+ *  - the spa is shutting down because this pool is being exported
+ *    or the machine is rebooting.
+ */
 static boolean_t
-dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
+dsl_scan_time_exceeded(dsl_scan_t *scn)
 {
 	uint64_t elapsed_nanosecs;
 	int mintime;
 	int dirty_pct;
 
+	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
+	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
+	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
+	dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
+	return (elapsed_nanosecs / NANOSEC >= zfs_txg_timeout ||
+	    (NSEC2MSEC(elapsed_nanosecs) > mintime &&
+	    (txg_sync_waiting(scn->scn_dp) ||
+	    dirty_pct >= zfs_vdev_async_write_active_min_dirty_percent)) ||
+	    spa_shutting_down(scn->scn_dp->dp_spa));
+}
+
+static boolean_t dsl_scan_should_clear(dsl_scan_t *scn);
+
+static boolean_t
+dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
+{
 	/* we never skip user/group accounting objects */
 	if (zb && (int64_t)zb->zb_object < 0)
 		return (B_FALSE);
@@ -571,28 +870,13 @@ dsl_scan_check_suspend(dsl_scan_t *scn, const zbookmark_phys_t *zb)
 		return (B_FALSE);
 
 	/*
-	 * We suspend if:
-	 *  - we have scanned for the maximum time: an entire txg
-	 *    timeout (default 5 sec)
-	 *  or
-	 *  - we have scanned for at least the minimum time (default 1 sec
-	 *    for scrub, 3 sec for resilver), and either we have sufficient
-	 *    dirty data that we are starting to write more quickly
-	 *    (default 30%), or someone is explicitly waiting for this txg
-	 *    to complete.
-	 *  or
-	 *  - the spa is shutting down because this pool is being exported
-	 *    or the machine is rebooting.
+	 * Besides running out of time, a sorted scan also suspends the
+	 * traversal once the queues are full, if zfs_scan_strict_mem_lim
+	 * is set. Otherwise that is only checked once per txg.
 	 */
-	mintime = (scn->scn_phys.scn_func == POOL_SCAN_RESILVER) ?
-	    zfs_resilver_min_time_ms : zfs_scan_min_time_ms;
-	elapsed_nanosecs = gethrtime() - scn->scn_sync_start_time;
-	dirty_pct = scn->scn_dp->dp_dirty_total * 100 / zfs_dirty_data_max;
-	if (elapsed_nanosecs / NANOSEC >= zfs_txg_timeout ||
-	    (NSEC2MSEC(elapsed_nanosecs) > mintime &&
-	    (txg_sync_waiting(scn->scn_dp) ||
-	    dirty_pct >= zfs_vdev_async_write_active_min_dirty_percent)) ||
-	    spa_shutting_down(scn->scn_dp->dp_spa)) {
+	if (dsl_scan_time_exceeded(scn) ||
+	    (scn->scn_is_sorted && zfs_scan_strict_mem_lim &&
+	    dsl_scan_should_clear(scn))) {
 		if (zb) {
 			dprintf("suspending at bookmark %llx/%llx/%llx/%llx\n",
 			    (longlong_t)zb->zb_objset,
@@ -827,14 +1111,18 @@ dsl_scan_recurse(dsl_scan_t *scn, dsl_dataset_t *ds, dmu_objset_type_t ostype,
 			scn->scn_phys.scn_errors++;
 			return (err);
 		}
-		for (i = 0, cdnp = buf->b_data; i < epb; i++, cdnp++) {
+		for (i = 0, cdnp = buf->b_data; i < epb;
+		    i += cdnp->dn_extra_slots + 1,
+		    cdnp += cdnp->dn_extra_slots + 1) {
 			for (j = 0; j < cdnp->dn_nblkptr; j++) {
 				blkptr_t *cbp = &cdnp->dn_blkptr[j];
 				dsl_scan_prefetch(scn, buf, cbp,
 				    zb->zb_objset, zb->zb_blkid * epb + i, j);
 			}
 		}
-		for (i = 0, cdnp = buf->b_data; i < epb; i++, cdnp++) {
+		for (i = 0, cdnp = buf->b_data; i < epb;
+		    i += cdnp->dn_extra_slots + 1,
+		    cdnp += cdnp->dn_extra_slots + 1) {
 			dsl_scan_visitdnode(scn, ds, ostype,
 			    cdnp, zb->zb_blkid * epb + i, tx);
 		}
@@ -897,7 +1185,7 @@ dsl_scan_visitdnode(dsl_scan_t *scn, dsl_dataset_t *ds,
 		zbookmark_phys_t czb;
 		SET_BOOKMARK(&czb, ds ? ds->ds_object : 0, object,
 		    0, DMU_SPILL_BLKID);
-		dsl_scan_visitbp(&dnp->dn_spill,
+		dsl_scan_visitbp(DN_SPILL_BLKPTR(dnp),
 		    &czb, dnp, ds, scn, ostype, tx);
 	}
 }
@@ -987,17 +1275,10 @@ dsl_scan_visit_rootbp(dsl_scan_t *scn, dsl_dataset_t *ds, blkptr_t *bp,
 	dprintf_ds(ds, "finished scan%s", "");
 }
 
-void
-dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
+static void
+ds_destroyed_scn_phys(dsl_dataset_t *ds, dsl_scan_phys_t *scn_phys)
 {
-	dsl_pool_t *dp = ds->ds_dir->dd_pool;
-	dsl_scan_t *scn = dp->dp_scan;
-	uint64_t mintxg;
-
-	if (scn->scn_phys.scn_state != DSS_SCANNING)
-		return;
-
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds->ds_object) {
+	if (scn_phys->scn_bookmark.zb_objset == ds->ds_object) {
 		if (ds->ds_is_snapshot) {
 			/*
 			 * Note:
@@ -1009,22 +1290,51 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 			 *    ignore it when we retraverse it in
 			 *    dsl_scan_visitds().
 			 */
-			scn->scn_phys.scn_bookmark.zb_objset =
+			scn_phys->scn_bookmark.zb_objset =
 			    dsl_dataset_phys(ds)->ds_next_snap_obj;
 			zfs_dbgmsg("destroying ds %llu; currently traversing; "
 			    "reset zb_objset to %llu",
 			    (u_longlong_t)ds->ds_object,
 			    (u_longlong_t)dsl_dataset_phys(ds)->
 			    ds_next_snap_obj);
-			scn->scn_phys.scn_flags |= DSF_VISIT_DS_AGAIN;
+			scn_phys->scn_flags |= DSF_VISIT_DS_AGAIN;
 		} else {
-			SET_BOOKMARK(&scn->scn_phys.scn_bookmark,
+			SET_BOOKMARK(&scn_phys->scn_bookmark,
 			    ZB_DESTROYED_OBJSET, 0, 0, 0);
 			zfs_dbgmsg("destroying ds %llu; currently traversing; "
 			    "reset bookmark to -1,0,0,0",
 			    (u_longlong_t)ds->ds_object);
 		}
-	} else if (zap_lookup_int_key(dp->dp_meta_objset,
+	}
+}
+
+/*
+ * Both the live traversal state and the last checkpoint, as well as the
+ * in-memory and on-disk dataset queues, have to be kept up to date when
+ * datasets are destroyed, snapshotted or swapped during a scan.
+ */
+void
+dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = ds->ds_dir->dd_pool;
+	dsl_scan_t *scn = dp->dp_scan;
+	uint64_t mintxg;
+
+	if (scn->scn_phys.scn_state != DSS_SCANNING)
+		return;
+
+	ds_destroyed_scn_phys(ds, &scn->scn_phys);
+	ds_destroyed_scn_phys(ds, &scn->scn_phys_cached);
+
+	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds->ds_object);
+		if (ds->ds_is_snapshot) {
+			scan_ds_queue_insert(scn,
+			    dsl_dataset_phys(ds)->ds_next_snap_obj, mintxg);
+		}
+	}
+
+	if (zap_lookup_int_key(dp->dp_meta_objset,
 	    scn->scn_phys.scn_queue_obj, ds->ds_object, &mintxg) == 0) {
 		ASSERT3U(dsl_dataset_phys(ds)->ds_num_children, <=, 1);
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
@@ -1054,7 +1364,20 @@ dsl_scan_ds_destroyed(dsl_dataset_t *ds, dmu_tx_t *tx)
 	 * dsl_scan_sync() should be called after this, and should sync
 	 * out our changed state, but just to be safe, do it here.
 	 */
-	dsl_scan_sync_state(scn, tx);
+	dsl_scan_sync_state(scn, tx, SYNC_CACHED);
+}
+
+static void
+ds_snapshotted_bookmark(dsl_dataset_t *ds, zbookmark_phys_t *scn_bookmark)
+{
+	if (scn_bookmark->zb_objset == ds->ds_object) {
+		scn_bookmark->zb_objset =
+		    dsl_dataset_phys(ds)->ds_prev_snap_obj;
+		zfs_dbgmsg("snapshotting ds %llu; currently traversing; "
+		    "reset zb_objset to %llu",
+		    (u_longlong_t)ds->ds_object,
+		    (u_longlong_t)dsl_dataset_phys(ds)->ds_prev_snap_obj);
+	}
 }
 
 void
@@ -1069,14 +1392,16 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 
 	ASSERT(dsl_dataset_phys(ds)->ds_prev_snap_obj != 0);
 
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset =
-		    dsl_dataset_phys(ds)->ds_prev_snap_obj;
-		zfs_dbgmsg("snapshotting ds %llu; currently traversing; "
-		    "reset zb_objset to %llu",
-		    (u_longlong_t)ds->ds_object,
-		    (u_longlong_t)dsl_dataset_phys(ds)->ds_prev_snap_obj);
-	} else if (zap_lookup_int_key(dp->dp_meta_objset,
+	ds_snapshotted_bookmark(ds, &scn->scn_phys.scn_bookmark);
+	ds_snapshotted_bookmark(ds, &scn->scn_phys_cached.scn_bookmark);
+
+	if (scan_ds_queue_contains(scn, ds->ds_object, &mintxg)) {
+		scan_ds_queue_remove(scn, ds->ds_object);
+		scan_ds_queue_insert(scn,
+		    dsl_dataset_phys(ds)->ds_prev_snap_obj, mintxg);
+	}
+
+	if (zap_lookup_int_key(dp->dp_meta_objset,
 	    scn->scn_phys.scn_queue_obj, ds->ds_object, &mintxg) == 0) {
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
 		    scn->scn_phys.scn_queue_obj, ds->ds_object, tx));
@@ -1088,69 +1413,96 @@ dsl_scan_ds_snapshotted(dsl_dataset_t *ds, dmu_tx_t *tx)
 		    (u_longlong_t)ds->ds_object,
 		    (u_longlong_t)dsl_dataset_phys(ds)->ds_prev_snap_obj);
 	}
-	dsl_scan_sync_state(scn, tx);
+	dsl_scan_sync_state(scn, tx, SYNC_CACHED);
 }
 
-void
-dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
+static void
+ds_clone_swapped_bookmark(dsl_dataset_t *ds1, dsl_dataset_t *ds2,
+    zbookmark_phys_t *scn_bookmark)
 {
-	dsl_pool_t *dp = ds1->ds_dir->dd_pool;
-	dsl_scan_t *scn = dp->dp_scan;
-	uint64_t mintxg;
-
-	if (scn->scn_phys.scn_state != DSS_SCANNING)
-		return;
-
-	if (scn->scn_phys.scn_bookmark.zb_objset == ds1->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset = ds2->ds_object;
+	if (scn_bookmark->zb_objset == ds1->ds_object) {
+		scn_bookmark->zb_objset = ds2->ds_object;
 		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
 		    "reset zb_objset to %llu",
 		    (u_longlong_t)ds1->ds_object,
 		    (u_longlong_t)ds2->ds_object);
-	} else if (scn->scn_phys.scn_bookmark.zb_objset == ds2->ds_object) {
-		scn->scn_phys.scn_bookmark.zb_objset = ds1->ds_object;
+	} else if (scn_bookmark->zb_objset == ds2->ds_object) {
+		scn_bookmark->zb_objset = ds1->ds_object;
 		zfs_dbgmsg("clone_swap ds %llu; currently traversing; "
 		    "reset zb_objset to %llu",
 		    (u_longlong_t)ds2->ds_object,
 		    (u_longlong_t)ds1->ds_object);
 	}
+}
+
+void
+dsl_scan_ds_clone_swapped(dsl_dataset_t *ds1, dsl_dataset_t *ds2, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = ds1->ds_dir->dd_pool;
+	dsl_scan_t *scn = dp->dp_scan;
+	uint64_t mintxg1, mintxg2;
+	boolean_t ds1_queued, ds2_queued;
+
+	if (scn->scn_phys.scn_state != DSS_SCANNING)
+		return;
+
+	ds_clone_swapped_bookmark(ds1, ds2, &scn->scn_phys.scn_bookmark);
+	ds_clone_swapped_bookmark(ds1, ds2, &scn->scn_phys_cached.scn_bookmark);
+
+	/*
+	 * The on-disk queue is an older version of the in-memory one, so
+	 * the swap has to be applied to each of them independently.
+	 */
+	ds1_queued = scan_ds_queue_contains(scn, ds1->ds_object, &mintxg1);
+	ds2_queued = scan_ds_queue_contains(scn, ds2->ds_object, &mintxg2);
+	if (ds1_queued && !ds2_queued) {
+		ASSERT3U(mintxg1, ==, dsl_dataset_phys(ds1)->ds_prev_snap_txg);
+		ASSERT3U(mintxg1, ==, dsl_dataset_phys(ds2)->ds_prev_snap_txg);
+		scan_ds_queue_remove(scn, ds1->ds_object);
+		scan_ds_queue_insert(scn, ds2->ds_object, mintxg1);
+	} else if (ds2_queued && !ds1_queued) {
+		ASSERT3U(mintxg2, ==, dsl_dataset_phys(ds1)->ds_prev_snap_txg);
+		ASSERT3U(mintxg2, ==, dsl_dataset_phys(ds2)->ds_prev_snap_txg);
+		scan_ds_queue_remove(scn, ds2->ds_object);
+		scan_ds_queue_insert(scn, ds1->ds_object, mintxg2);
+	}
 
 	if (zap_lookup_int_key(dp->dp_meta_objset, scn->scn_phys.scn_queue_obj,
-	    ds1->ds_object, &mintxg) == 0) {
+	    ds1->ds_object, &mintxg1) == 0) {
 		int err;
 
-		ASSERT3U(mintxg, ==, dsl_dataset_phys(ds1)->ds_prev_snap_txg);
-		ASSERT3U(mintxg, ==, dsl_dataset_phys(ds2)->ds_prev_snap_txg);
+		ASSERT3U(mintxg1, ==, dsl_dataset_phys(ds1)->ds_prev_snap_txg);
+		ASSERT3U(mintxg1, ==, dsl_dataset_phys(ds2)->ds_prev_snap_txg);
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
 		    scn->scn_phys.scn_queue_obj, ds1->ds_object, tx));
 		err = zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, ds2->ds_object, mintxg, tx);
+		    scn->scn_phys.scn_queue_obj, ds2->ds_object, mintxg1, tx);
 		VERIFY(err == 0 || err == EEXIST);
 		if (err == EEXIST) {
 			/* Both were there to begin with */
 			VERIFY(0 == zap_add_int_key(dp->dp_meta_objset,
 			    scn->scn_phys.scn_queue_obj,
-			    ds1->ds_object, mintxg, tx));
+			    ds1->ds_object, mintxg1, tx));
 		}
 		zfs_dbgmsg("clone_swap ds %llu; in queue; "
 		    "replacing with %llu",
 		    (u_longlong_t)ds1->ds_object,
 		    (u_longlong_t)ds2->ds_object);
 	} else if (zap_lookup_int_key(dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj, ds2->ds_object, &mintxg) == 0) {
-		ASSERT3U(mintxg, ==, dsl_dataset_phys(ds1)->ds_prev_snap_txg);
-		ASSERT3U(mintxg, ==, dsl_dataset_phys(ds2)->ds_prev_snap_txg);
+	    scn->scn_phys.scn_queue_obj, ds2->ds_object, &mintxg2) == 0) {
+		ASSERT3U(mintxg2, ==, dsl_dataset_phys(ds1)->ds_prev_snap_txg);
+		ASSERT3U(mintxg2, ==, dsl_dataset_phys(ds2)->ds_prev_snap_txg);
 		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
 		    scn->scn_phys.scn_queue_obj, ds2->ds_object, tx));
 		VERIFY(0 == zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, ds1->ds_object, mintxg, tx));
+		    scn->scn_phys.scn_queue_obj, ds1->ds_object, mintxg2, tx));
 		zfs_dbgmsg("clone_swap ds %llu; in queue; "
 		    "replacing with %llu",
 		    (u_longlong_t)ds2->ds_object,
 		    (u_longlong_t)ds1->ds_object);
 	}
 
-	dsl_scan_sync_state(scn, tx);
+	dsl_scan_sync_state(scn, tx, SYNC_CACHED);
 }
 
 struct enqueue_clones_arg {
@@ -1184,9 +1536,8 @@ enqueue_clones_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 			return (err);
 		ds = prev;
 	}
-	VERIFY(zap_add_int_key(dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj, ds->ds_object,
-	    dsl_dataset_phys(ds)->ds_prev_snap_txg, eca->tx) == 0);
+	scan_ds_queue_insert(scn, ds->ds_object,
+	    dsl_dataset_phys(ds)->ds_prev_snap_txg);
 	dsl_dataset_rele(ds, FTAG);
 	return (0);
 }
@@ -1289,9 +1640,8 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_flags & DSF_VISIT_DS_AGAIN) {
 		zfs_dbgmsg("incomplete pass; visiting again");
 		scn->scn_phys.scn_flags &= ~DSF_VISIT_DS_AGAIN;
-		VERIFY(zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, ds->ds_object,
-		    scn->scn_phys.scn_cur_max_txg, tx) == 0);
+		scan_ds_queue_insert(scn, ds->ds_object,
+		    scn->scn_phys.scn_cur_max_txg);
 		goto out;
 	}
 
@@ -1299,10 +1649,9 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 	 * Add descendent datasets to work queue.
 	 */
 	if (dsl_dataset_phys(ds)->ds_next_snap_obj != 0) {
-		VERIFY(zap_add_int_key(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj,
+		scan_ds_queue_insert(scn,
 		    dsl_dataset_phys(ds)->ds_next_snap_obj,
-		    dsl_dataset_phys(ds)->ds_creation_txg, tx) == 0);
+		    dsl_dataset_phys(ds)->ds_creation_txg);
 	}
 	if (dsl_dataset_phys(ds)->ds_num_children > 1) {
 		boolean_t usenext = B_FALSE;
@@ -1323,10 +1672,20 @@ dsl_scan_visitds(dsl_scan_t *scn, uint64_t dsobj, dmu_tx_t *tx)
 		}
 
 		if (usenext) {
-			VERIFY0(zap_join_key(dp->dp_meta_objset,
-			    dsl_dataset_phys(ds)->ds_next_clones_obj,
-			    scn->scn_phys.scn_queue_obj,
-			    dsl_dataset_phys(ds)->ds_creation_txg, tx));
+			zap_cursor_t zc;
+			zap_attribute_t *za;
+
+			za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
+			for (zap_cursor_init(&zc, dp->dp_meta_objset,
+			    dsl_dataset_phys(ds)->ds_next_clones_obj);
+			    zap_cursor_retrieve(&zc, za) == 0;
+			    (void) zap_cursor_advance(&zc)) {
+				scan_ds_queue_insert(scn,
+				    strtonum(za->za_name, NULL),
+				    dsl_dataset_phys(ds)->ds_creation_txg);
+			}
+			zap_cursor_fini(&zc);
+			kmem_free(za, sizeof (zap_attribute_t));
 		} else {
 			struct enqueue_clones_arg eca;
 			eca.tx = tx;
@@ -1345,7 +1704,6 @@ out:
 static int
 enqueue_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 {
-	dmu_tx_t *tx = arg;
 	dsl_dataset_t *ds;
 	int err;
 	dsl_scan_t *scn = dp->dp_scan;
@@ -1375,8 +1733,8 @@ enqueue_cb(dsl_pool_t *dp, dsl_dataset_t *hds, void *arg)
 		ds = prev;
 	}
 
-	VERIFY(zap_add_int_key(dp->dp_meta_objset, scn->scn_phys.scn_queue_obj,
-	    ds->ds_object, dsl_dataset_phys(ds)->ds_prev_snap_txg, tx) == 0);
+	scan_ds_queue_insert(scn, ds->ds_object,
+	    dsl_dataset_phys(ds)->ds_prev_snap_txg);
 	dsl_dataset_rele(ds, FTAG);
 	return (0);
 }
@@ -1484,8 +1842,7 @@ static void
 dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 {
 	dsl_pool_t *dp = scn->scn_dp;
-	zap_cursor_t *zc;
-	zap_attribute_t *za;
+	scan_ds_t *sds;
 
 	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
 	    scn->scn_phys.scn_ddt_class_max) {
@@ -1533,26 +1890,24 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 	 * bookmark so we don't think that we're still trying to resume.
 	 */
 	bzero(&scn->scn_phys.scn_bookmark, sizeof (zbookmark_phys_t));
-	zc = kmem_alloc(sizeof (zap_cursor_t), KM_SLEEP);
-	za = kmem_alloc(sizeof (zap_attribute_t), KM_SLEEP);
 
-	/* keep pulling things out of the zap-object-as-queue */
-	while (zap_cursor_init(zc, dp->dp_meta_objset,
-	    scn->scn_phys.scn_queue_obj),
-	    zap_cursor_retrieve(zc, za) == 0) {
+	/*
+	 * Keep pulling things out of the in-memory dataset queue. The
+	 * on-disk queue is only updated at checkpoints.
+	 */
+	while ((sds = avl_first(&scn->scn_queue)) != NULL) {
 		dsl_dataset_t *ds;
-		uint64_t dsobj;
+		uint64_t dsobj = sds->sds_dsobj;
+		uint64_t txg = sds->sds_txg;
 
-		dsobj = strtonum(za->za_name, NULL);
-		VERIFY3U(0, ==, zap_remove_int(dp->dp_meta_objset,
-		    scn->scn_phys.scn_queue_obj, dsobj, tx));
+		scan_ds_queue_remove(scn, dsobj);
+		sds = NULL;
 
 		/* Set up min/max txg */
 		VERIFY3U(0, ==, dsl_dataset_hold_obj(dp, dsobj, FTAG, &ds));
-		if (za->za_first_integer != 0) {
+		if (txg != 0) {
 			scn->scn_phys.scn_cur_min_txg =
-			    MAX(scn->scn_phys.scn_min_txg,
-			    za->za_first_integer);
+			    MAX(scn->scn_phys.scn_min_txg, txg);
 		} else {
 			scn->scn_phys.scn_cur_min_txg =
 			    MAX(scn->scn_phys.scn_min_txg,
@@ -1562,14 +1917,9 @@ dsl_scan_visit(dsl_scan_t *scn, dmu_tx_t *tx)
 		dsl_dataset_rele(ds, FTAG);
 
 		dsl_scan_visitds(scn, dsobj, tx);
-		zap_cursor_fini(zc);
 		if (scn->scn_suspending)
-			goto out;
+			return;
 	}
-	zap_cursor_fini(zc);
-out:
-	kmem_free(za, sizeof (zap_attribute_t));
-	kmem_free(zc, sizeof (zap_cursor_t));
 }
 
 static boolean_t
@@ -1849,57 +2199,134 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 	if (scn->scn_phys.scn_state != DSS_SCANNING)
 		return;
 
-	if (scn->scn_done_txg == tx->tx_txg) {
+	/*
+	 * The scan is complete once the traversal is done and everything it
+	 * gathered has been issued.
+	 */
+	if (scn->scn_done_txg != 0 && scn->scn_done_txg <= tx->tx_txg &&
+	    scn->scn_bytes_pending == 0) {
 		ASSERT(!scn->scn_suspending);
 		/* finished with scan. */
 		zfs_dbgmsg("txg %llu scan complete", tx->tx_txg);
 		dsl_scan_done(scn, B_TRUE, tx);
 		ASSERT3U(spa->spa_scrub_inflight, ==, 0);
-		dsl_scan_sync_state(scn, tx);
+		dsl_scan_sync_state(scn, tx, SYNC_MANDATORY);
 		return;
 	}
 
 	if (dsl_scan_is_paused_scrub(scn))
 		return;
 
-	if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
-	    scn->scn_phys.scn_ddt_class_max) {
-		zfs_dbgmsg("doing scan sync txg %llu; "
-		    "ddt bm=%llu/%llu/%llu/%llx",
-		    (longlong_t)tx->tx_txg,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_class,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_type,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_checksum,
-		    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_cursor);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_objset == 0);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_object == 0);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_level == 0);
-		ASSERT(scn->scn_phys.scn_bookmark.zb_blkid == 0);
-	} else {
-		zfs_dbgmsg("doing scan sync txg %llu; bm=%llu/%llu/%llu/%llu",
-		    (longlong_t)tx->tx_txg,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_objset,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_object,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_level,
-		    (longlong_t)scn->scn_phys.scn_bookmark.zb_blkid);
+	/*
+	 * A scan can switch from unsorted to sorted at any time, but it
+	 * then stays sorted until it is reloaded from a checkpoint.
+	 */
+	if (!zfs_scan_legacy && DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
+		scn->scn_is_sorted = B_TRUE;
+		if (scn->scn_last_checkpoint == 0)
+			scn->scn_last_checkpoint = ddi_get_lbolt64();
 	}
 
-	scn->scn_zio_root = zio_root(dp->dp_spa, NULL,
-	    NULL, ZIO_FLAG_CANFAIL);
-	dsl_pool_config_enter(dp, FTAG);
-	dsl_scan_visit(scn, tx);
-	dsl_pool_config_exit(dp, FTAG);
-	(void) zio_wait(scn->scn_zio_root);
-	scn->scn_zio_root = NULL;
+	/*
+	 * Decide whether to traverse or to issue this txg. Once the
+	 * checkpoint interval has passed we drain the queues completely
+	 * so that our position can be written out. Otherwise we gather
+	 * until the queues reach the hard memory limit, and then issue
+	 * until they fall below the soft limit.
+	 */
+	if (scn->scn_is_sorted) {
+		if (scn->scn_checkpointing ||
+		    ddi_get_lbolt64() - scn->scn_last_checkpoint >
+		    SEC_TO_TICK(zfs_scan_checkpoint_intval)) {
+			if (!scn->scn_checkpointing)
+				zfs_dbgmsg("begin scan checkpoint");
+
+			scn->scn_checkpointing = B_TRUE;
+			scn->scn_clearing = B_TRUE;
+		} else {
+			boolean_t should_clear = dsl_scan_should_clear(scn);
+
+			if (should_clear && !scn->scn_clearing) {
+				zfs_dbgmsg("begin scan clearing");
+				scn->scn_clearing = B_TRUE;
+			} else if (!should_clear && scn->scn_clearing) {
+				zfs_dbgmsg("finish scan clearing");
+				scn->scn_clearing = B_FALSE;
+			}
+		}
+	} else {
+		ASSERT0(scn->scn_checkpointing);
+		ASSERT0(scn->scn_clearing);
+	}
 
-	zfs_dbgmsg("visited %llu blocks in %llums",
-	    (longlong_t)scn->scn_visited_this_txg,
-	    (longlong_t)NSEC2MSEC(gethrtime() - scn->scn_sync_start_time));
+	if (!scn->scn_clearing && scn->scn_done_txg == 0) {
+		/* Traverse the pool for more blocks to scrub */
+		if (scn->scn_phys.scn_ddt_bookmark.ddb_class <=
+		    scn->scn_phys.scn_ddt_class_max) {
+			zfs_dbgmsg("doing scan sync txg %llu; "
+			    "ddt bm=%llu/%llu/%llu/%llx",
+			    (longlong_t)tx->tx_txg,
+			    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_class,
+			    (longlong_t)scn->scn_phys.scn_ddt_bookmark.ddb_type,
+			    (longlong_t)scn->scn_phys.scn_ddt_bookmark.
+			    ddb_checksum,
+			    (longlong_t)scn->scn_phys.scn_ddt_bookmark.
+			    ddb_cursor);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_objset == 0);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_object == 0);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_level == 0);
+			ASSERT(scn->scn_phys.scn_bookmark.zb_blkid == 0);
+		} else {
+			zfs_dbgmsg("doing scan sync txg %llu; "
+			    "bm=%llu/%llu/%llu/%llu",
+			    (longlong_t)tx->tx_txg,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_objset,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_object,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_level,
+			    (longlong_t)scn->scn_phys.scn_bookmark.zb_blkid);
+		}
 
-	if (!scn->scn_suspending) {
-		scn->scn_done_txg = tx->tx_txg + 1;
-		zfs_dbgmsg("txg %llu traversal complete, waiting till txg %llu",
-		    tx->tx_txg, scn->scn_done_txg);
+		scn->scn_zio_root = zio_root(dp->dp_spa, NULL,
+		    NULL, ZIO_FLAG_CANFAIL);
+		dsl_pool_config_enter(dp, FTAG);
+		dsl_scan_visit(scn, tx);
+		dsl_pool_config_exit(dp, FTAG);
+		(void) zio_wait(scn->scn_zio_root);
+		scn->scn_zio_root = NULL;
+
+		zfs_dbgmsg("visited %llu blocks in %llums "
+		    "(%llu bytes pending)",
+		    (longlong_t)scn->scn_visited_this_txg,
+		    (longlong_t)NSEC2MSEC(gethrtime() -
+		    scn->scn_sync_start_time),
+		    (longlong_t)scn->scn_bytes_pending);
+
+		if (!scn->scn_suspending) {
+			ASSERT0(avl_numnodes(&scn->scn_queue));
+			scn->scn_done_txg = tx->tx_txg + 1;
+			if (scn->scn_is_sorted) {
+				scn->scn_checkpointing = B_TRUE;
+				scn->scn_clearing = B_TRUE;
+			}
+			zfs_dbgmsg("txg %llu traversal complete, "
+			    "waiting till txg %llu",
+			    tx->tx_txg, scn->scn_done_txg);
+		}
+	} else if (scn->scn_is_sorted && scn->scn_bytes_pending != 0) {
+		ASSERT(scn->scn_clearing);
+
+		/* Issue scrub reads from the per-vdev queues */
+		scn->scn_issued_this_txg = 0;
+		scn->scn_segs_this_txg = 0;
+		scan_io_queues_run(scn);
+
+		zfs_dbgmsg("issued %llu blocks (%llu extents) in %llums "
+		    "(%llu bytes pending)",
+		    (longlong_t)scn->scn_issued_this_txg,
+		    (longlong_t)scn->scn_segs_this_txg,
+		    (longlong_t)NSEC2MSEC(gethrtime() -
+		    scn->scn_sync_start_time),
+		    (longlong_t)scn->scn_bytes_pending);
 	}
 
 	if (DSL_SCAN_IS_SCRUB_RESILVER(scn)) {
@@ -1911,7 +2338,7 @@ dsl_scan_sync(dsl_pool_t *dp, dmu_tx_t *tx)
 		mutex_exit(&spa->spa_scrub_lock);
 	}
 
-	dsl_scan_sync_state(scn, tx);
+	dsl_scan_sync_state(scn, tx, SYNC_OPTIONAL);
 }
 
 /*
@@ -1999,9 +2426,19 @@ static void
 dsl_scan_scrub_done(zio_t *zio)
 {
 	spa_t *spa = zio->io_spa;
+	dsl_scan_io_queue_t *queue = zio->io_private;
 
 	abd_free(zio->io_abd);
 
+	if (queue != NULL) {
+		kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+
+		mutex_enter(q_lock);
+		queue->q_inflight_bytes -= zio->io_size;
+		cv_broadcast(&queue->q_zio_cv);
+		mutex_exit(q_lock);
+	}
+
 	mutex_enter(&spa->spa_scrub_lock);
 	spa->spa_scrub_inflight--;
 	cv_broadcast(&spa->spa_scrub_io_cv);
@@ -2013,17 +2450,480 @@ dsl_scan_scrub_done(zio_t *zio)
 	mutex_exit(&spa->spa_scrub_lock);
 }
 
+/*
+ * Issue a scrub or resilver read. Reads from the sorted queues are limited
+ * per top-level vdev by the number of bytes in flight, all others by the
+ * pool-wide number of reads in flight.
+ */
+static void
+scan_exec_io(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_phys_t *zb, dsl_scan_io_queue_t *queue)
+{
+	spa_t *spa = dp->dp_spa;
+	size_t size = BP_GET_PSIZE(bp);
+	int scan_delay;
+	int d;
+
+	if (queue == NULL) {
+		vdev_t *rvd = spa->spa_root_vdev;
+		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
+
+		mutex_enter(&spa->spa_scrub_lock);
+		while (spa->spa_scrub_inflight >= maxinflight)
+			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
+		spa->spa_scrub_inflight++;
+		mutex_exit(&spa->spa_scrub_lock);
+	} else {
+		kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+
+		mutex_enter(q_lock);
+		while (queue->q_inflight_bytes >= queue->q_maxinflight_bytes)
+			cv_wait(&queue->q_zio_cv, q_lock);
+		queue->q_inflight_bytes += size;
+		mutex_exit(q_lock);
+
+		mutex_enter(&spa->spa_scrub_lock);
+		spa->spa_scrub_inflight++;
+		mutex_exit(&spa->spa_scrub_lock);
+	}
+
+	/* a sorted read only counts the DVA it was queued for */
+	if (queue != NULL) {
+		atomic_add_64(&spa->spa_scan_pass_issued,
+		    DVA_GET_ASIZE(&bp->blk_dva[0]));
+	} else {
+		for (d = 0; d < BP_GET_NDVAS(bp); d++) {
+			atomic_add_64(&spa->spa_scan_pass_issued,
+			    DVA_GET_ASIZE(&bp->blk_dva[d]));
+		}
+	}
+
+	/*
+	 * If we're seeing recent (zfs_scan_idle) "important" I/Os
+	 * then throttle our workload to limit the impact of a scan.
+	 */
+	scan_delay = (zio_flags & ZIO_FLAG_RESILVER) ?
+	    zfs_resilver_delay : zfs_scrub_delay;
+	if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
+		delay(scan_delay);
+
+	zio_nowait(zio_read(NULL, spa, bp,
+	    abd_alloc_for_io(size, B_FALSE), size, dsl_scan_scrub_done,
+	    queue, ZIO_PRIORITY_SCRUB, zio_flags, zb));
+}
+
+static int
+sio_addr_compare(const void *x, const void *y)
+{
+	const scan_io_t *a = x, *b = y;
+
+	if (a->sio_offset < b->sio_offset)
+		return (-1);
+	if (a->sio_offset > b->sio_offset)
+		return (1);
+	return (0);
+}
+
+/*
+ * Build the block pointer for reading copy "d" of a block: that DVA is
+ * swapped to the front, which is the only one a sorted scan reads unless
+ * it fails (see vdev_mirror_map_alloc()).
+ */
+static void
+scan_bp_for_dva(const blkptr_t *bp, int d, blkptr_t *dbp)
+{
+	*dbp = *bp;
+	if (d != 0) {
+		dbp->blk_dva[0] = bp->blk_dva[d];
+		dbp->blk_dva[d] = bp->blk_dva[0];
+	}
+}
+
+static dsl_scan_io_queue_t *
+scan_io_queue_create(vdev_t *vd)
+{
+	dsl_scan_t *scn = vd->vdev_spa->spa_dsl_pool->dp_scan;
+	dsl_scan_io_queue_t *q = kmem_zalloc(sizeof (*q), KM_SLEEP);
+
+	q->q_scn = scn;
+	q->q_vd = vd;
+	cv_init(&q->q_zio_cv, NULL, CV_DEFAULT, NULL);
+	avl_create(&q->q_sios_by_addr, sio_addr_compare,
+	    sizeof (scan_io_t), offsetof(scan_io_t, sio_addr_node));
+
+	return (q);
+}
+
+/*
+ * Destroys a scan queue and all segments and scan_io_t's contained in it.
+ * Must be called with the vdev_scan_io_queue_lock held and no reads from
+ * the queue in flight.
+ */
+void
+dsl_scan_io_queue_destroy(dsl_scan_io_queue_t *queue)
+{
+	dsl_scan_t *scn = queue->q_scn;
+	scan_io_t *sio;
+	void *cookie = NULL;
+	uint64_t bytes_dequeued = 0;
+
+	ASSERT(MUTEX_HELD(&queue->q_vd->vdev_scan_io_queue_lock));
+	ASSERT0(queue->q_inflight_bytes);
+
+	while ((sio = avl_destroy_nodes(&queue->q_sios_by_addr, &cookie)) !=
+	    NULL) {
+		bytes_dequeued += sio->sio_asize;
+		queue->q_sio_memused -= sizeof (scan_io_t);
+		kmem_free(sio, sizeof (scan_io_t));
+	}
+
+	ASSERT0(queue->q_sio_memused);
+	atomic_add_64(&scn->scn_bytes_pending, -bytes_dequeued);
+	avl_destroy(&queue->q_sios_by_addr);
+	cv_destroy(&queue->q_zio_cv);
+
+	kmem_free(queue, sizeof (*queue));
+}
+
+static void
+scan_io_queues_destroy(dsl_scan_t *scn)
+{
+	vdev_t *rvd = scn->scn_dp->dp_spa->spa_root_vdev;
+	uint64_t i;
+
+	for (i = 0; i < rvd->vdev_children; i++) {
+		vdev_t *tvd = rvd->vdev_child[i];
+
+		mutex_enter(&tvd->vdev_scan_io_queue_lock);
+		if (tvd->vdev_scan_io_queue != NULL)
+			dsl_scan_io_queue_destroy(tvd->vdev_scan_io_queue);
+		tvd->vdev_scan_io_queue = NULL;
+		mutex_exit(&tvd->vdev_scan_io_queue_lock);
+	}
+	ASSERT0(scn->scn_bytes_pending);
+}
+
+/*
+ * Properly transfers a dsl_scan_queue_t from `svd' to `tvd'. This is
+ * called on behalf of vdev_top_transfer when creating or destroying
+ * a mirror vdev due to zpool attach/detach.
+ */
+void
+dsl_scan_io_queue_vdev_xfer(vdev_t *svd, vdev_t *tvd)
+{
+	mutex_enter(&svd->vdev_scan_io_queue_lock);
+	mutex_enter(&tvd->vdev_scan_io_queue_lock);
+
+	VERIFY3P(tvd->vdev_scan_io_queue, ==, NULL);
+	tvd->vdev_scan_io_queue = svd->vdev_scan_io_queue;
+	svd->vdev_scan_io_queue = NULL;
+	if (tvd->vdev_scan_io_queue != NULL)
+		tvd->vdev_scan_io_queue->q_vd = tvd;
+
+	mutex_exit(&tvd->vdev_scan_io_queue_lock);
+	mutex_exit(&svd->vdev_scan_io_queue_lock);
+}
+
+/*
+ * Queue a block for sorted reads, one for each of its DVAs, in the queue of
+ * the top-level vdev holding that DVA. Gang blocks are read right away, as
+ * their members are scattered anyway.
+ */
+static void
+dsl_scan_enqueue(dsl_pool_t *dp, const blkptr_t *bp, int zio_flags,
+    const zbookmark_phys_t *zb)
+{
+	spa_t *spa = dp->dp_spa;
+	dsl_scan_t *scn = dp->dp_scan;
+	int d;
+
+	ASSERT(!BP_IS_EMBEDDED(bp));
+
+	if (!scn->scn_is_sorted) {
+		scan_exec_io(dp, bp, zio_flags, zb, NULL);
+		return;
+	}
+
+	for (d = 0; d < BP_GET_NDVAS(bp); d++) {
+		const dva_t *dva = &bp->blk_dva[d];
+		vdev_t *vd = vdev_lookup_top(spa, DVA_GET_VDEV(dva));
+		dsl_scan_io_queue_t *queue;
+		scan_io_t *sio;
+		avl_index_t where;
+
+		if (BP_IS_GANG(bp)) {
+			blkptr_t dbp;
+
+			scan_bp_for_dva(bp, d, &dbp);
+			scan_exec_io(dp, &dbp, zio_flags, zb, NULL);
+			continue;
+		}
+
+		ASSERT(vd != NULL);
+		sio = kmem_zalloc(sizeof (scan_io_t), KM_SLEEP);
+		sio->sio_bp = *bp;
+		sio->sio_offset = DVA_GET_OFFSET(dva);
+		sio->sio_asize = DVA_GET_ASIZE(dva);
+		sio->sio_dva = d;
+		sio->sio_flags = zio_flags;
+		sio->sio_zb = *zb;
+
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		if (vd->vdev_scan_io_queue == NULL)
+			vd->vdev_scan_io_queue = scan_io_queue_create(vd);
+		queue = vd->vdev_scan_io_queue;
+
+		if (avl_find(&queue->q_sios_by_addr, sio, &where) != NULL) {
+			/*
+			 * Already queued, e.g. from the DDT. Count it as
+			 * issued so the issued bytes still add up.
+			 */
+			mutex_exit(&vd->vdev_scan_io_queue_lock);
+			atomic_add_64(&spa->spa_scan_pass_issued,
+			    sio->sio_asize);
+			kmem_free(sio, sizeof (scan_io_t));
+			continue;
+		}
+		avl_insert(&queue->q_sios_by_addr, sio, where);
+		queue->q_sio_memused += sizeof (scan_io_t);
+		atomic_add_64(&scn->scn_bytes_pending, sio->sio_asize);
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+}
+
+/*
+ * A block that is freed while it sits in a queue must not be read later,
+ * as its space may have been reused by then.
+ */
+void
+dsl_scan_freed(spa_t *spa, const blkptr_t *bp)
+{
+	dsl_pool_t *dp = spa->spa_dsl_pool;
+	dsl_scan_t *scn;
+	int d;
+
+	if (dp == NULL || (scn = dp->dp_scan) == NULL ||
+	    !scn->scn_is_sorted || scn->scn_bytes_pending == 0 ||
+	    BP_IS_EMBEDDED(bp))
+		return;
+
+	for (d = 0; d < BP_GET_NDVAS(bp); d++) {
+		const dva_t *dva = &bp->blk_dva[d];
+		vdev_t *vd = vdev_lookup_top(spa, DVA_GET_VDEV(dva));
+		dsl_scan_io_queue_t *queue;
+		scan_io_t srch, *sio;
+
+		if (vd == NULL)
+			continue;
+
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		queue = vd->vdev_scan_io_queue;
+		if (queue != NULL) {
+			srch.sio_offset = DVA_GET_OFFSET(dva);
+			sio = avl_find(&queue->q_sios_by_addr, &srch, NULL);
+			if (sio != NULL &&
+			    sio->sio_asize == DVA_GET_ASIZE(dva) &&
+			    BP_PHYSICAL_BIRTH(&sio->sio_bp) ==
+			    BP_PHYSICAL_BIRTH(bp)) {
+				avl_remove(&queue->q_sios_by_addr, sio);
+				queue->q_sio_memused -= sizeof (scan_io_t);
+				atomic_add_64(&scn->scn_bytes_pending,
+				    -sio->sio_asize);
+				atomic_add_64(&spa->spa_scan_pass_issued,
+				    sio->sio_asize);
+				kmem_free(sio, sizeof (scan_io_t));
+			}
+		}
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+}
+
+static uint64_t
+dsl_scan_count_leaves(vdev_t *vd)
+{
+	uint64_t i, leaves = 0;
+
+	/* we only count leaves that belong to the main pool and are readable */
+	if (vd->vdev_islog || vd->vdev_isspare ||
+	    vd->vdev_isl2cache || !vdev_readable(vd))
+		return (0);
+
+	if (vd->vdev_ops->vdev_op_leaf)
+		return (1);
+
+	for (i = 0; i < vd->vdev_children; i++)
+		leaves += dsl_scan_count_leaves(vd->vdev_child[i]);
+
+	return (leaves);
+}
+
+/*
+ * Decide whether the queues use enough memory that we should stop
+ * gathering and issue what we have.
+ */
+static boolean_t
+dsl_scan_should_clear(dsl_scan_t *scn)
+{
+	spa_t *spa = scn->scn_dp->dp_spa;
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t alloc, mlim_hard, mlim_soft, mused;
+	uint64_t i;
+
+	alloc = metaslab_class_get_alloc(spa_normal_class(spa));
+
+	mlim_hard = MAX((physmem / zfs_scan_mem_lim_fact) * PAGESIZE,
+	    zfs_scan_mem_lim_min);
+	mlim_hard = MIN(mlim_hard, alloc / 20);
+	mlim_soft = mlim_hard - MIN(mlim_hard / zfs_scan_mem_lim_soft_fact,
+	    zfs_scan_mem_lim_soft_max);
+	mused = 0;
+	for (i = 0; i < rvd->vdev_children; i++) {
+		vdev_t *tvd = rvd->vdev_child[i];
+
+		mutex_enter(&tvd->vdev_scan_io_queue_lock);
+		if (tvd->vdev_scan_io_queue != NULL)
+			mused += tvd->vdev_scan_io_queue->q_sio_memused;
+		mutex_exit(&tvd->vdev_scan_io_queue_lock);
+	}
+
+	dprintf("current scan memory usage: %llu bytes\n", (longlong_t)mused);
+
+	if (mused == 0)
+		ASSERT0(scn->scn_bytes_pending);
+
+	/*
+	 * If we are above our hard limit, we need to clear out memory.
+	 * If we are below our soft limit, we need to accumulate sequential IOs.
+	 * Otherwise, we should keep doing whatever we are currently doing.
+	 */
+	if (mused >= mlim_hard)
+		return (B_TRUE);
+	else if (mused < mlim_soft)
+		return (B_FALSE);
+	else
+		return (scn->scn_clearing);
+}
+
+/*
+ * Issue the reads of one vdev queue until we run out of time or reads.
+ * The queue is swept like an elevator: reads go out in ascending offset
+ * order starting where the last one ended, wrapping around to the lowest
+ * offset at the end of the vdev, so that runs of adjacent blocks form
+ * sequential extents on the disks.
+ */
+static void
+scan_io_queues_run_one(void *arg)
+{
+	dsl_scan_io_queue_t *queue = arg;
+	kmutex_t *q_lock = &queue->q_vd->vdev_scan_io_queue_lock;
+	dsl_scan_t *scn = queue->q_scn;
+	dsl_pool_t *dp = scn->scn_dp;
+	uint64_t nr_leaves = dsl_scan_count_leaves(queue->q_vd);
+	uint64_t issued = 0, segs = 0;
+	scan_io_t srch, *sio;
+	avl_index_t where;
+	blkptr_t bp;
+
+	mutex_enter(q_lock);
+
+	/* calculate maximum in-flight bytes for this vdev */
+	queue->q_maxinflight_bytes =
+	    MAX(nr_leaves * zfs_scan_vdev_limit, SPA_MAXBLOCKSIZE);
+
+	while (!dsl_scan_time_exceeded(scn)) {
+		srch.sio_offset = queue->q_cursor;
+		sio = avl_find(&queue->q_sios_by_addr, &srch, &where);
+		if (sio == NULL) {
+			sio = avl_nearest(&queue->q_sios_by_addr, where,
+			    AVL_AFTER);
+		}
+		if (sio == NULL) {
+			/* reached the end of the vdev, start a new sweep */
+			sio = avl_first(&queue->q_sios_by_addr);
+			if (sio == NULL)
+				break;
+		}
+
+		avl_remove(&queue->q_sios_by_addr, sio);
+		queue->q_sio_memused -= sizeof (scan_io_t);
+		if (sio->sio_offset != queue->q_cursor)
+			segs++;
+		queue->q_cursor = sio->sio_offset + sio->sio_asize;
+		mutex_exit(q_lock);
+
+		scan_bp_for_dva(&sio->sio_bp, sio->sio_dva, &bp);
+		scan_exec_io(dp, &bp, sio->sio_flags, &sio->sio_zb, queue);
+		atomic_add_64(&scn->scn_bytes_pending, -sio->sio_asize);
+		kmem_free(sio, sizeof (scan_io_t));
+		issued++;
+
+		mutex_enter(q_lock);
+	}
+
+	mutex_exit(q_lock);
+
+	atomic_add_64(&scn->scn_issued_this_txg, issued);
+	atomic_add_64(&scn->scn_segs_this_txg, segs);
+}
+
+/*
+ * Drain the vdev queues in parallel, one taskq thread per top-level vdev,
+ * and wait for them to finish issuing for this txg.
+ */
+static void
+scan_io_queues_run(dsl_scan_t *scn)
+{
+	spa_t *spa = scn->scn_dp->dp_spa;
+	uint64_t i;
+
+	ASSERT(scn->scn_is_sorted);
+	ASSERT(spa_config_held(spa, SCL_CONFIG, RW_READER));
+
+	if (scn->scn_bytes_pending == 0)
+		return;
+
+	if (scn->scn_taskq == NULL) {
+		char *tq_name = kmem_zalloc(ZFS_MAX_DATASET_NAME_LEN + 16,
+		    KM_SLEEP);
+		int nthreads = spa->spa_root_vdev->vdev_children;
+
+		/*
+		 * We need to make this taskq *always* execute as many
+		 * threads in parallel as we have top-level vdevs and no
+		 * less, otherwise the queues of different vdevs would
+		 * wait for each other.
+		 */
+		(void) snprintf(tq_name, ZFS_MAX_DATASET_NAME_LEN + 16,
+		    "dsl_scan_tq_%s", spa->spa_name);
+		scn->scn_taskq = taskq_create(tq_name, nthreads, minclsyspri,
+		    nthreads, nthreads, TASKQ_PREPOPULATE);
+		kmem_free(tq_name, ZFS_MAX_DATASET_NAME_LEN + 16);
+	}
+
+	for (i = 0; i < spa->spa_root_vdev->vdev_children; i++) {
+		vdev_t *vd = spa->spa_root_vdev->vdev_child[i];
+
+		mutex_enter(&vd->vdev_scan_io_queue_lock);
+		if (vd->vdev_scan_io_queue != NULL) {
+			(void) taskq_dispatch(scn->scn_taskq,
+			    scan_io_queues_run_one, vd->vdev_scan_io_queue,
+			    TQ_SLEEP);
+		}
+		mutex_exit(&vd->vdev_scan_io_queue_lock);
+	}
+
+	taskq_wait(scn->scn_taskq);
+}
+
 static int
 dsl_scan_scrub_cb(dsl_pool_t *dp,
     const blkptr_t *bp, const zbookmark_phys_t *zb)
 {
 	dsl_scan_t *scn = dp->dp_scan;
-	size_t size = BP_GET_PSIZE(bp);
 	spa_t *spa = dp->dp_spa;
 	uint64_t phys_birth = BP_PHYSICAL_BIRTH(bp);
 	boolean_t needs_io = B_FALSE;
 	int zio_flags = ZIO_FLAG_SCAN_THREAD | ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL;
-	int scan_delay = 0;
 	int d;
 
 	count_block(dp->dp_blkstats, bp);
@@ -2039,12 +2939,10 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	if (scn->scn_phys.scn_func == POOL_SCAN_SCRUB) {
 		zio_flags |= ZIO_FLAG_SCRUB;
 		needs_io = B_TRUE;
-		scan_delay = zfs_scrub_delay;
 	} else {
 		ASSERT3U(scn->scn_phys.scn_func, ==, POOL_SCAN_RESILVER);
 		zio_flags |= ZIO_FLAG_RESILVER;
 		needs_io = B_FALSE;
-		scan_delay = zfs_resilver_delay;
 	}
 
 	/* If it's an intent log block, failure is expected. */
@@ -2091,25 +2989,13 @@ dsl_scan_scrub_cb(dsl_pool_t *dp,
 	}
 
 	if (needs_io && !zfs_no_scrub_io) {
-		vdev_t *rvd = spa->spa_root_vdev;
-		uint64_t maxinflight = rvd->vdev_children * zfs_top_maxinflight;
-
-		mutex_enter(&spa->spa_scrub_lock);
-		while (spa->spa_scrub_inflight >= maxinflight)
-			cv_wait(&spa->spa_scrub_io_cv, &spa->spa_scrub_lock);
-		spa->spa_scrub_inflight++;
-		mutex_exit(&spa->spa_scrub_lock);
-
-		/*
-		 * If we're seeing recent (zfs_scan_idle) "important" I/Os
-		 * then throttle our workload to limit the impact of a scan.
-		 */
-		if (ddi_get_lbolt64() - spa->spa_last_io <= zfs_scan_idle)
-			delay(scan_delay);
-
-		zio_nowait(zio_read(NULL, spa, bp,
-		    abd_alloc_for_io(size, B_FALSE), size, dsl_scan_scrub_done,
-		    NULL, ZIO_PRIORITY_SCRUB, zio_flags, zb));
+		dsl_scan_enqueue(dp, bp, zio_flags, zb);
+	} else {
+		/* nothing to read, so this block is done as far as we care */
+		for (d = 0; d < BP_GET_NDVAS(bp); d++) {
+			atomic_add_64(&spa->spa_scan_pass_issued,
+			    DVA_GET_ASIZE(&bp->blk_dva[d]));
+		}
 	}
 
 	/* do not relocate this block */
@@ -203,6 +203,12 @@ boolean_t metaslab_trace_enabled = B_TRUE;
  */
 uint64_t metaslab_trace_max_entries = 5000;
 
+/*
+ * Maximum number of metaslabs per group that can be disabled
+ * simultaneously.
+ */
+int max_disabled_ms = 3;
+
 static uint64_t metaslab_weight(metaslab_t *);
 static void metaslab_set_fragmentation(metaslab_t *);
 static void metaslab_free_impl(vdev_t *, uint64_t, uint64_t, boolean_t);
@@ -516,8 +522,8 @@ metaslab_verify_space(metaslab_t *msp, uint64_t txg)
 	    !msp->ms_loaded)
 		return;
 
-	sm_free_space = msp->ms_size - space_map_allocated(msp->ms_sm) -
-	    space_map_alloc_delta(msp->ms_sm);
+	sm_free_space = msp->ms_size - metaslab_allocated_space(msp) -
+	    msp->ms_allocated_this_txg;
 
 	/*
 	 * Account for future allocations since we would have already
@@ -629,8 +635,8 @@ metaslab_group_create(metaslab_class_t *mc, vdev_t *vd, int allocators)
 
 	mg = kmem_zalloc(sizeof (metaslab_group_t), KM_SLEEP);
 	mutex_init(&mg->mg_lock, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&mg->mg_ms_initialize_lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&mg->mg_ms_initialize_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&mg->mg_ms_disabled_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&mg->mg_ms_disabled_cv, NULL, CV_DEFAULT, NULL);
 	mg->mg_primaries = kmem_zalloc(allocators * sizeof (metaslab_t *),
 	    KM_SLEEP);
 	mg->mg_secondaries = kmem_zalloc(allocators * sizeof (metaslab_t *),
@@ -679,8 +685,8 @@ metaslab_group_destroy(metaslab_group_t *mg)
 	kmem_free(mg->mg_secondaries, mg->mg_allocators *
 	    sizeof (metaslab_t *));
 	mutex_destroy(&mg->mg_lock);
-	mutex_destroy(&mg->mg_ms_initialize_lock);
-	cv_destroy(&mg->mg_ms_initialize_cv);
+	mutex_destroy(&mg->mg_ms_disabled_lock);
+	cv_destroy(&mg->mg_ms_disabled_cv);
 
 	for (int i = 0; i < mg->mg_allocators; i++) {
 		refcount_destroy(&mg->mg_alloc_queue_depth[i]);
@@ -1004,11 +1010,12 @@ metaslab_group_allocatable(metaslab_group_t *mg, metaslab_group_t *rotor,
 
 	/*
 	 * We can only consider skipping this metaslab group if it's
-	 * in the normal metaslab class and there are other metaslab
-	 * groups to select from. Otherwise, we always consider it eligible
-	 * for allocations.
+	 * in the normal or special metaslab class and there are other
+	 * metaslab groups to select from. Otherwise, we always consider
+	 * it eligible for allocations.
 	 */
-	if (mc != spa_normal_class(spa) || mc->mc_groups <= 1)
+	if ((mc != spa_normal_class(spa) && mc != spa_special_class(spa)) ||
+	    mc->mc_groups <= 1)
 		return (B_TRUE);
 
 	/*
@@ -1494,6 +1501,17 @@ metaslab_load(metaslab_t *msp)
 	ASSERT(!msp->ms_loading);
 
 	msp->ms_loading = B_TRUE;
+
+	/*
+	 * A metaslab_flush() that is in progress is appending the unflushed
+	 * changes to the space map with the lock dropped. Wait for it, so
+	 * that we don't read those changes from the space map and apply
+	 * them again from the unflushed trees. No flush can start once
+	 * ms_loading is set.
+	 */
+	while (msp->ms_flushing)
+		cv_wait(&msp->ms_flush_cv, &msp->ms_lock);
+
 	/*
 	 * Nobody else can manipulate a loading metaslab, so it's now safe
 	 * to drop the lock.  This way we don't have to hold the lock while
@@ -1524,10 +1542,27 @@ metaslab_load(metaslab_t *msp)
 
 		/*
 		 * If the metaslab already has a spacemap, then we need to
+		 * apply the changes that are only in the log space maps and
 		 * remove all segments from the defer tree; otherwise, the
 		 * metaslab is completely empty and we can skip this.
 		 */
 		if (msp->ms_sm != NULL) {
+			range_tree_walk(msp->ms_unflushed_allocs,
+			    range_tree_remove, msp->ms_allocatable);
+			range_tree_walk(msp->ms_unflushed_frees,
+			    range_tree_add, msp->ms_allocatable);
+
+			/*
+			 * The frees of the syncing txg are already in
+			 * ms_unflushed_frees once metaslab_sync() has run,
+			 * but they must not be allocated before they go
+			 * through the defer trees.
+			 */
+			if (msp->ms_unflushed_txg != 0) {
+				range_tree_walk(msp->ms_freed,
+				    range_tree_remove, msp->ms_allocatable);
+			}
+
 			for (int t = 0; t < TXG_DEFER_SIZE; t++) {
 				range_tree_walk(msp->ms_defer[t],
 				    range_tree_remove, msp->ms_allocatable);
@@ -1549,6 +1584,103 @@ metaslab_unload(metaslab_t *msp)
 	msp->ms_max_size = 0;
 }
 
+/*
+ * Returns the synced allocated space of the metaslab, including the
+ * changes that are only in the log space maps.
+ */
+uint64_t
+metaslab_allocated_space(metaslab_t *msp)
+{
+	return (msp->ms_allocated_space);
+}
+
+/*
+ * Comparator for spa_metaslabs_by_flushed: least recently flushed first.
+ */
+int
+metaslab_sort_by_flushed(const void *va, const void *vb)
+{
+	const metaslab_t *a = va;
+	const metaslab_t *b = vb;
+
+	if (a->ms_unflushed_txg < b->ms_unflushed_txg)
+		return (-1);
+	if (a->ms_unflushed_txg > b->ms_unflushed_txg)
+		return (1);
+
+	uint64_t a_vdev_id = a->ms_group->mg_vd->vdev_id;
+	uint64_t b_vdev_id = b->ms_group->mg_vd->vdev_id;
+	if (a_vdev_id < b_vdev_id)
+		return (-1);
+	if (a_vdev_id > b_vdev_id)
+		return (1);
+
+	if (a->ms_id < b->ms_id)
+		return (-1);
+	if (a->ms_id > b->ms_id)
+		return (1);
+	return (0);
+}
+
+/*
+ * Memory used by the unflushed trees of the metaslab, accounted for in
+ * sus_memused.
+ */
+uint64_t
+metaslab_unflushed_changes_memused(metaslab_t *msp)
+{
+	return ((avl_numnodes(&msp->ms_unflushed_allocs->rt_root) +
+	    avl_numnodes(&msp->ms_unflushed_frees->rt_root)) *
+	    sizeof (range_seg_t));
+}
+
+/*
+ * Drop the unflushed changes of the metaslab and unlink it from
+ * spa_metaslabs_by_flushed. Used when the metaslab's space map is going
+ * away, either with the metaslab itself or with its (empty) vdev.
+ */
+void
+metaslab_unflushed_forget(metaslab_t *msp)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	if (msp->ms_unflushed_txg != 0) {
+		mutex_enter(&spa->spa_flushed_ms_lock);
+		avl_remove(&spa->spa_metaslabs_by_flushed, msp);
+		mutex_exit(&spa->spa_flushed_ms_lock);
+		msp->ms_unflushed_txg = 0;
+	}
+
+	spa->spa_unflushed_stats.sus_memused -=
+	    metaslab_unflushed_changes_memused(msp);
+	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+}
+
+/*
+ * Called at import once the log space maps have been replayed into the
+ * unflushed trees, to account for them in the allocated space of the
+ * metaslab and its vdev, and in the metaslab's weight.
+ */
+void
+metaslab_unflushed_replayed(metaslab_t *msp)
+{
+	metaslab_group_t *mg = msp->ms_group;
+	int64_t delta;
+
+	mutex_enter(&msp->ms_lock);
+	delta = (int64_t)range_tree_space(msp->ms_unflushed_allocs) -
+	    (int64_t)range_tree_space(msp->ms_unflushed_frees);
+	msp->ms_allocated_space += delta;
+	vdev_space_update(mg->mg_vd, delta, 0, 0);
+
+	ASSERT0(msp->ms_weight & METASLAB_ACTIVE_MASK);
+	metaslab_group_sort(mg, msp, metaslab_weight(msp));
+	mutex_exit(&msp->ms_lock);
+}
+
 int
 metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
     metaslab_t **msp)
@@ -1562,6 +1694,7 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	mutex_init(&ms->ms_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&ms->ms_sync_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&ms->ms_load_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&ms->ms_flush_cv, NULL, CV_DEFAULT, NULL);
 
 	ms->ms_id = id;
 	ms->ms_start = id << vd->vdev_ms_shift;
@@ -1583,6 +1716,8 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 		}
 
 		ASSERT(ms->ms_sm != NULL);
+		space_map_update(ms->ms_sm);
+		ms->ms_allocated_space = space_map_allocated(ms->ms_sm);
 	}
 
 	/*
@@ -1593,6 +1728,9 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	 * data fault on any attempt to use this metaslab before it's ready.
 	 */
 	ms->ms_allocatable = range_tree_create(&metaslab_rt_ops, ms);
+	ms->ms_trim = range_tree_create(NULL, NULL);
+	ms->ms_unflushed_allocs = range_tree_create(NULL, NULL);
+	ms->ms_unflushed_frees = range_tree_create(NULL, NULL);
 	metaslab_group_add(mg, ms);
 
 	metaslab_set_fragmentation(ms);
@@ -1612,9 +1750,12 @@ metaslab_init(metaslab_group_t *mg, uint64_t id, uint64_t object, uint64_t txg,
 	/*
 	 * If metaslab_debug_load is set and we're initializing a metaslab
 	 * that has an allocated space map object then load the its space
-	 * map so that can verify frees.
+	 * map so that can verify frees. With log space maps this is done
+	 * by spa_ld_log_spacemaps() instead, once the unflushed changes
+	 * have been replayed.
 	 */
-	if (metaslab_debug_load && ms->ms_sm != NULL) {
+	if (metaslab_debug_load && ms->ms_sm != NULL &&
+	    !spa_feature_is_active(vd->vdev_spa, SPA_FEATURE_LOG_SPACEMAP)) {
 		mutex_enter(&ms->ms_lock);
 		VERIFY0(metaslab_load(ms));
 		mutex_exit(&ms->ms_lock);
@@ -1635,14 +1776,21 @@ metaslab_fini(metaslab_t *msp)
 {
 	metaslab_group_t *mg = msp->ms_group;
 
+	mutex_enter(&msp->ms_lock);
+	metaslab_unflushed_forget(msp);
+	mutex_exit(&msp->ms_lock);
+
 	metaslab_group_remove(mg, msp);
 
 	mutex_enter(&msp->ms_lock);
 	VERIFY(msp->ms_group == NULL);
-	vdev_space_update(mg->mg_vd, -space_map_allocated(msp->ms_sm),
+	vdev_space_update(mg->mg_vd, -metaslab_allocated_space(msp),
 	    0, -msp->ms_size);
 	space_map_close(msp->ms_sm);
 
+	range_tree_destroy(msp->ms_unflushed_allocs);
+	range_tree_destroy(msp->ms_unflushed_frees);
+
 	metaslab_unload(msp);
 	range_tree_destroy(msp->ms_allocatable);
 	range_tree_destroy(msp->ms_freeing);
@@ -1659,8 +1807,12 @@ metaslab_fini(metaslab_t *msp)
 
 	range_tree_destroy(msp->ms_checkpointing);
 
+	range_tree_vacate(msp->ms_trim, NULL, NULL);
+	range_tree_destroy(msp->ms_trim);
+
 	mutex_exit(&msp->ms_lock);
 	cv_destroy(&msp->ms_load_cv);
+	cv_destroy(&msp->ms_flush_cv);
 	mutex_destroy(&msp->ms_lock);
 	mutex_destroy(&msp->ms_sync_lock);
 	ASSERT3U(msp->ms_allocator, ==, -1);
@@ -1806,7 +1958,7 @@ metaslab_space_weight(metaslab_t *msp)
 	/*
 	 * The baseline weight is the metaslab's free space.
 	 */
-	space = msp->ms_size - space_map_allocated(msp->ms_sm);
+	space = msp->ms_size - metaslab_allocated_space(msp);
 
 	if (metaslab_fragmentation_factor_enabled &&
 	    msp->ms_fragmentation != ZFS_FRAG_INVALID) {
@@ -1942,7 +2094,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * The metaslab is completely free.
 	 */
-	if (space_map_allocated(msp->ms_sm) == 0) {
+	if (metaslab_allocated_space(msp) == 0) {
 		int idx = highbit64(msp->ms_size) - 1;
 		int max_idx = SPACE_MAP_HISTOGRAM_SIZE + shift - 1;
 
@@ -1964,7 +2116,7 @@ metaslab_segment_weight(metaslab_t *msp)
 	/*
 	 * If the metaslab is fully allocated then just make the weight 0.
 	 */
-	if (space_map_allocated(msp->ms_sm) == msp->ms_size)
+	if (metaslab_allocated_space(msp) == msp->ms_size)
 		return (0);
 	/*
 	 * If the metaslab is already loaded, then use the range tree to
@@ -2257,6 +2409,134 @@ metaslab_group_preload(metaslab_group_t *mg)
 	mutex_exit(&mg->mg_lock);
 }
 
+/*
+ * Returns true if the changes of the syncing txg go to the log space map
+ * rather than to the metaslab's own space map. The unflushed txgs are
+ * kept in the vdev's top-level ZAP, so vdevs without one (pools that
+ * predate per-vdev ZAPs, until their first config sync) keep using the
+ * metaslab space maps directly.
+ */
+static boolean_t
+metaslab_use_log(metaslab_t *msp)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+
+	return (spa_syncing_log_sm(vd->vdev_spa) != NULL &&
+	    vd->vdev_top_zap != 0);
+}
+
+static void
+metaslab_set_unflushed_txg(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
+{
+	vdev_t *vd = msp->ms_group->mg_vd;
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa_meta_objset(spa);
+
+	ASSERT(spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP));
+	ASSERT3U(vd->vdev_top_zap, !=, 0);
+
+	if (msp->ms_unflushed_txg == txg)
+		return;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	if (msp->ms_unflushed_txg != 0)
+		avl_remove(&spa->spa_metaslabs_by_flushed, msp);
+	msp->ms_unflushed_txg = txg;
+	avl_add(&spa->spa_metaslabs_by_flushed, msp);
+	mutex_exit(&spa->spa_flushed_ms_lock);
+
+	uint64_t object = 0;
+	int error = zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1,
+	    &object);
+	if (error == ENOENT) {
+		object = dmu_object_alloc(mos, DMU_OTN_UINT64_METADATA,
+		    SPA_OLD_MAXBLOCKSIZE, DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1,
+		    &object, tx));
+	} else {
+		VERIFY0(error);
+	}
+
+	metaslab_unflushed_phys_t entry;
+	entry.msp_unflushed_txg = txg;
+	dmu_write(mos, object, msp->ms_id * sizeof (entry), sizeof (entry),
+	    &entry, tx);
+}
+
+/*
+ * The metaslab's space map now has all the changes made before the
+ * syncing txg: drop the unflushed changes and advance the unflushed txg.
+ */
+static void
+metaslab_flush_update(metaslab_t *msp, dmu_tx_t *tx)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+
+	spa->spa_unflushed_stats.sus_memused -=
+	    metaslab_unflushed_changes_memused(msp);
+	range_tree_vacate(msp->ms_unflushed_allocs, NULL, NULL);
+	range_tree_vacate(msp->ms_unflushed_frees, NULL, NULL);
+
+	space_map_update(msp->ms_sm);
+	metaslab_set_unflushed_txg(msp, dmu_tx_get_txg(tx), tx);
+}
+
+/*
+ * Append the unflushed changes of the metaslab to its space map. Called
+ * by spa_flush_metaslabs() in the first sync pass, before any metaslab
+ * is synced. Returns false if the metaslab could not be flushed.
+ */
+boolean_t
+metaslab_flush(metaslab_t *msp, dmu_tx_t *tx)
+{
+	spa_t *spa = msp->ms_group->mg_vd->vdev_spa;
+
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+	ASSERT(spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP));
+
+	mutex_enter(&msp->ms_sync_lock);
+	mutex_enter(&msp->ms_lock);
+
+	/*
+	 * A loading metaslab reads its space map with the lock dropped
+	 * and applies the unflushed changes afterwards, so we can't move
+	 * them to the space map in the meantime.
+	 */
+	if (msp->ms_loading) {
+		mutex_exit(&msp->ms_lock);
+		mutex_exit(&msp->ms_sync_lock);
+		return (B_FALSE);
+	}
+
+	ASSERT3P(msp->ms_sm, !=, NULL);
+	ASSERT3U(msp->ms_unflushed_txg, <, dmu_tx_get_txg(tx));
+
+	/*
+	 * The unflushed trees are only changed by metaslab_sync(), which
+	 * the ms_sync_lock keeps out, so it's safe to drop the ms_lock
+	 * while writing them out.
+	 */
+	msp->ms_flushing = B_TRUE;
+	mutex_exit(&msp->ms_lock);
+	space_map_write(msp->ms_sm, msp->ms_unflushed_allocs, SM_ALLOC,
+	    SM_NO_VDEVID, tx);
+	space_map_write(msp->ms_sm, msp->ms_unflushed_frees, SM_FREE,
+	    SM_NO_VDEVID, tx);
+	mutex_enter(&msp->ms_lock);
+
+	metaslab_flush_update(msp, tx);
+	msp->ms_flushing = B_FALSE;
+	cv_broadcast(&msp->ms_flush_cv);
+
+	mutex_exit(&msp->ms_lock);
+	mutex_exit(&msp->ms_sync_lock);
+	return (B_TRUE);
+}
+
 /*
  * Determine if the space map's on-disk footprint is past our tolerance
  * for inefficiency. We would like to use the following criteria to make
@@ -2329,15 +2609,23 @@ metaslab_should_condense(metaslab_t *msp)
  * Condense the on-disk space map representation to its minimized form.
  * The minimized form consists of a small number of allocations followed by
  * the entries of the free range tree.
+ *
+ * The condensed space map describes the metaslab as it was before the
+ * syncing txg; the allocs and frees of this txg are then appended by
+ * metaslab_sync() (or logged) as in any other txg. When log space maps are
+ * in use this also flushes the metaslab.
  */
 static void
-metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
+metaslab_condense(metaslab_t *msp, dmu_tx_t *tx)
 {
 	range_tree_t *condense_tree;
 	space_map_t *sm = msp->ms_sm;
+	uint64_t txg = dmu_tx_get_txg(tx);
 
 	ASSERT(MUTEX_HELD(&msp->ms_lock));
 	ASSERT(msp->ms_loaded);
+	ASSERT(msp->ms_sm != NULL);
+	ASSERT3U(spa_sync_pass(msp->ms_group->mg_vd->vdev_spa), ==, 1);
 
 	zfs_dbgmsg("condensing: txg %llu, msp[%llu] %p, vdev id %llu, "
 	    "spa %s, smp size %llu, segments %lu, forcing condense=%s", txg,
@@ -2350,26 +2638,23 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	msp->ms_condense_wanted = B_FALSE;
 
 	/*
-	 * Create an range tree that is 100% allocated. We remove segments
-	 * that have been freed in this txg, any deferred frees that exist,
-	 * and any allocation in the future. Removing segments should be
-	 * a relatively inexpensive operation since we expect these trees to
-	 * have a small number of nodes.
+	 * Besides ms_allocatable, the space that was free before this txg
+	 * is in the defer trees and in the allocations of this txg and
+	 * of the future ones. Since we are in the first sync pass, ms_freed
+	 * is empty and ms_allocating[txg] holds all of this txg's allocs.
+	 * Adding segments should be a relatively inexpensive operation
+	 * since we expect these trees to have a small number of nodes.
 	 */
 	condense_tree = range_tree_create(NULL, NULL);
-	range_tree_add(condense_tree, msp->ms_start, msp->ms_size);
-
-	range_tree_walk(msp->ms_freeing, range_tree_remove, condense_tree);
-	range_tree_walk(msp->ms_freed, range_tree_remove, condense_tree);
 
 	for (int t = 0; t < TXG_DEFER_SIZE; t++) {
 		range_tree_walk(msp->ms_defer[t],
-		    range_tree_remove, condense_tree);
+		    range_tree_add, condense_tree);
 	}
 
-	for (int t = 1; t < TXG_CONCURRENT_STATES; t++) {
+	for (int t = 0; t < TXG_CONCURRENT_STATES; t++) {
 		range_tree_walk(msp->ms_allocating[(txg + t) & TXG_MASK],
-		    range_tree_remove, condense_tree);
+		    range_tree_add, condense_tree);
 	}
 
 	/*
@@ -2391,18 +2676,26 @@ metaslab_condense(metaslab_t *msp, uint64_t txg, dmu_tx_t *tx)
 	 * that consists only of allocation records, doing so can be
 	 * prohibitively expensive because the in-core free tree can be
 	 * large, and therefore computationally expensive to subtract
-	 * from the condense_tree. Instead we sync out two trees, a cheap
-	 * allocation only tree followed by the in-core free tree. While not
-	 * optimal, this is typically close to optimal, and much cheaper to
-	 * compute.
+	 * from the condense_tree. Instead we sync out an allocation record
+	 * for the whole metaslab followed by the in-core free tree and the
+	 * condense_tree. While not optimal, this is typically close to
+	 * optimal, and much cheaper to compute.
 	 */
-	space_map_write(sm, condense_tree, SM_ALLOC, SM_NO_VDEVID, tx);
+	range_tree_t *tmp_tree = range_tree_create(NULL, NULL);
+	range_tree_add(tmp_tree, msp->ms_start, msp->ms_size);
+	space_map_write(sm, tmp_tree, SM_ALLOC, SM_NO_VDEVID, tx);
+	space_map_write(sm, msp->ms_allocatable, SM_FREE, SM_NO_VDEVID, tx);
+	space_map_write(sm, condense_tree, SM_FREE, SM_NO_VDEVID, tx);
+
 	range_tree_vacate(condense_tree, NULL, NULL);
 	range_tree_destroy(condense_tree);
-
-	space_map_write(sm, msp->ms_allocatable, SM_FREE, SM_NO_VDEVID, tx);
+	range_tree_vacate(tmp_tree, NULL, NULL);
+	range_tree_destroy(tmp_tree);
 	mutex_enter(&msp->ms_lock);
 	msp->ms_condensing = B_FALSE;
+
+	if (metaslab_use_log(msp))
+		metaslab_flush_update(msp, tx);
 }
 
 /*
@@ -2463,6 +2756,11 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	 */
 	tx = dmu_tx_create_assigned(spa_get_dsl(spa), txg);
 
+	/*
+	 * Generate a log space map if one doesn't exist already.
+	 */
+	spa_generate_syncing_log_sm(spa, tx);
+
 	if (msp->ms_sm == NULL) {
 		uint64_t new_object;
 
@@ -2508,8 +2806,43 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 	metaslab_class_histogram_verify(mg->mg_class);
 	metaslab_group_histogram_remove(mg, msp);
 
-	if (msp->ms_loaded && metaslab_should_condense(msp)) {
-		metaslab_condense(msp, txg, tx);
+	/*
+	 * Condensing writes out the state of the metaslab before this
+	 * txg, which is only known in the first sync pass.
+	 */
+	if (spa_sync_pass(spa) == 1 && msp->ms_loaded &&
+	    metaslab_should_condense(msp))
+		metaslab_condense(msp, tx);
+
+	if (metaslab_use_log(msp)) {
+		/*
+		 * Log the changes of this txg to the pool-wide log space
+		 * map instead of appending them to our own space map; they
+		 * are kept in the unflushed trees until we get flushed.
+		 */
+		space_map_t *log_sm = spa_syncing_log_sm(spa);
+		spa_unflushed_stats_t *sus = &spa->spa_unflushed_stats;
+
+		mutex_exit(&msp->ms_lock);
+		space_map_write(log_sm, alloctree, SM_ALLOC,
+		    vd->vdev_id, tx);
+		space_map_write(log_sm, msp->ms_freeing, SM_FREE,
+		    vd->vdev_id, tx);
+		mutex_enter(&msp->ms_lock);
+
+		sus->sus_memused -= metaslab_unflushed_changes_memused(msp);
+		range_tree_remove_xor_add(alloctree,
+		    msp->ms_unflushed_frees, msp->ms_unflushed_allocs);
+		range_tree_remove_xor_add(msp->ms_freeing,
+		    msp->ms_unflushed_allocs, msp->ms_unflushed_frees);
+		sus->sus_memused += metaslab_unflushed_changes_memused(msp);
+
+		if (msp->ms_unflushed_txg == 0)
+			metaslab_set_unflushed_txg(msp, txg, tx);
+
+		if (!range_tree_is_empty(alloctree) ||
+		    !range_tree_is_empty(msp->ms_freeing))
+			sus->sus_ms_logged++;
 	} else {
 		mutex_exit(&msp->ms_lock);
 		space_map_write(msp->ms_sm, alloctree, SM_ALLOC,
@@ -2519,6 +2852,9 @@ metaslab_sync(metaslab_t *msp, uint64_t txg)
 		mutex_enter(&msp->ms_lock);
 	}
 
+	msp->ms_allocated_this_txg += range_tree_space(alloctree) -
+	    range_tree_space(msp->ms_freeing);
+
 	if (!range_tree_is_empty(msp->ms_checkpointing)) {
 		ASSERT(spa_has_checkpoint(spa));
 		ASSERT3P(vd->vdev_checkpoint_sm, !=, NULL);
@@ -2664,7 +3000,8 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 		ASSERT3P(msp->ms_checkpointing, ==, NULL);
 		msp->ms_checkpointing = range_tree_create(NULL, NULL);
 
-		vdev_space_update(vd, 0, 0, msp->ms_size);
+		vdev_space_update(vd, msp->ms_allocated_space, 0,
+		    msp->ms_size);
 	}
 	ASSERT0(range_tree_space(msp->ms_freeing));
 	ASSERT0(range_tree_space(msp->ms_checkpointing));
@@ -2678,7 +3015,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	defer_delta = 0;
-	alloc_delta = space_map_alloc_delta(msp->ms_sm);
+	alloc_delta = msp->ms_allocated_this_txg;
 	if (defer_allowed) {
 		defer_delta = range_tree_space(msp->ms_freed) -
 		    range_tree_space(*defer_tree);
@@ -2687,6 +3024,8 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	}
 
 	vdev_space_update(vd, alloc_delta + defer_delta, defer_delta, 0);
+	msp->ms_allocated_space += alloc_delta;
+	msp->ms_allocated_this_txg = 0;
 
 	/*
 	 * If there's a metaslab_load() in progress, wait for it to complete
@@ -2694,6 +3033,24 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 */
 	metaslab_load_wait(msp);
 
+	/*
+	 * When auto-trimming is enabled, free ranges which are added to
+	 * ms_allocatable are also added to ms_trim.  The ms_trim tree is
+	 * periodically consumed by the vdev_autotrim_thread() which issues
+	 * trims for all ranges and then vacates the tree.  The ms_trim tree
+	 * can be discarded at any time with the sole consequence of recent
+	 * frees not being trimmed.
+	 */
+	if (spa_get_autotrim(spa) == SPA_AUTOTRIM_ON) {
+		range_tree_walk(*defer_tree, range_tree_add, msp->ms_trim);
+		if (!defer_allowed) {
+			range_tree_walk(msp->ms_freed, range_tree_add,
+			    msp->ms_trim);
+		}
+	} else {
+		range_tree_vacate(msp->ms_trim, NULL, NULL);
+	}
+
 	/*
 	 * Move the frees from the defer_tree back to the free
 	 * range tree (if it's loaded). Swap the freed_tree and
@@ -2740,7 +3097,7 @@ metaslab_sync_done(metaslab_t *msp, uint64_t txg)
 	 * from it in 'metaslab_unload_delay' txgs, then unload it.
 	 */
 	if (msp->ms_loaded &&
-	    msp->ms_initializing == 0 &&
+	    msp->ms_disabled == 0 &&
 	    msp->ms_selected_txg + metaslab_unload_delay < txg) {
 		for (int t = 1; t < TXG_CONCURRENT_STATES; t++) {
 			VERIFY0(range_tree_space(
@@ -2990,7 +3347,7 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 	metaslab_class_t *mc = msp->ms_group->mg_class;
 
 	VERIFY(!msp->ms_condensing);
-	VERIFY0(msp->ms_initializing);
+	VERIFY0(msp->ms_disabled);
 
 	start = mc->mc_ops->msop_alloc(msp, size);
 	if (start != -1ULL) {
@@ -3001,6 +3358,7 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t txg)
 		VERIFY0(P2PHASE(size, 1ULL << vd->vdev_ashift));
 		VERIFY3U(range_tree_space(rt) - size, <=, msp->ms_size);
 		range_tree_remove(rt, start, size);
+		range_tree_clear(msp->ms_trim, start, size);
 
 		if (range_tree_is_empty(msp->ms_allocating[txg & TXG_MASK]))
 			vdev_dirty(mg->mg_vd, VDD_METASLAB, msp, txg);
@@ -3051,10 +3409,10 @@ find_valid_metaslab(metaslab_group_t *mg, uint64_t activation_weight,
 		}
 
 		/*
-			 * If the selected metaslab is condensing or being
-			 * initialized, skip it.
+			 * If the selected metaslab is condensing or disabled,
+			 * skip it.
 		 */
-			if (msp->ms_condensing || msp->ms_initializing > 0)
+			if (msp->ms_condensing || msp->ms_disabled > 0)
 			continue;
 
 		*was_active = msp->ms_allocator != -1;
@@ -3069,7 +3427,7 @@ find_valid_metaslab(metaslab_group_t *mg, uint64_t activation_weight,
 			break;
 
 		uint64_t target_distance = min_distance
-		    + (space_map_allocated(msp->ms_sm) != 0 ? 0 :
+		    + (metaslab_allocated_space(msp) != 0 ? 0 :
 		    min_distance >> 1);
 
 		for (i = 0; i < d; i++) {
@@ -3219,9 +3577,9 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 		/*
 		 * If this metaslab is currently condensing then pick again as
 		 * we can't manipulate this metaslab until it's committed
-		 * to disk. If this metaslab is being initialized, we shouldn't
-		 * allocate from it since the allocated region might be
-		 * overwritten after allocation.
+		 * to disk. If this metaslab is being initialized or trimmed, we
+		 * shouldn't allocate from it since the allocated region might be
+		 * overwritten or discarded after allocation.
 		 */
 		if (msp->ms_condensing) {
 			metaslab_trace_add(zal, mg, msp, asize, d,
@@ -3230,9 +3588,9 @@ metaslab_group_alloc_normal(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			    ~METASLAB_ACTIVE_MASK);
 			mutex_exit(&msp->ms_lock);
 			continue;
-		} else if (msp->ms_initializing > 0) {
+		} else if (msp->ms_disabled > 0) {
 			metaslab_trace_add(zal, mg, msp, asize, d,
-			    TRACE_INITIALIZING, allocator);
+			    TRACE_DISABLED, allocator);
 			metaslab_passivate(msp, msp->ms_weight &
 			    ~METASLAB_ACTIVE_MASK);
 			mutex_exit(&msp->ms_lock);
@@ -3902,7 +4260,12 @@ metaslab_class_throttle_reserve(metaslab_class_t *mc, int slots, int allocator,
 	if (reserved_slots < max)
 		available_slots = max - reserved_slots;
 
-	if (slots <= available_slots || GANG_ALLOCATION(flags)) {
+	/*
+	 * Gang blocks, and allocations that move a reservation over from
+	 * a full allocation class, are always allowed to reserve.
+	 */
+	if (slots <= available_slots || GANG_ALLOCATION(flags) ||
+	    (flags & METASLAB_MUST_RESERVE)) {
 		/*
 		 * We reserve the slots individually so that we can unreserve
 		 * them individually when an I/O completes.
@@ -4289,6 +4652,91 @@ metaslab_fastwrite_unmark(spa_t *spa, const blkptr_t *bp)
 	spa_config_exit(spa, SCL_VDEV, FTAG);
 }
 
+static void
+metaslab_group_disable_wait(metaslab_group_t *mg)
+{
+	ASSERT(MUTEX_HELD(&mg->mg_ms_disabled_lock));
+	while (mg->mg_disabled_updating) {
+		cv_wait(&mg->mg_ms_disabled_cv, &mg->mg_ms_disabled_lock);
+	}
+}
+
+static void
+metaslab_group_disabled_increment(metaslab_group_t *mg)
+{
+	ASSERT(MUTEX_HELD(&mg->mg_ms_disabled_lock));
+	ASSERT(mg->mg_disabled_updating);
+
+	while (mg->mg_ms_disabled >= max_disabled_ms) {
+		cv_wait(&mg->mg_ms_disabled_cv, &mg->mg_ms_disabled_lock);
+	}
+	mg->mg_ms_disabled++;
+	ASSERT3U(mg->mg_ms_disabled, <=, max_disabled_ms);
+}
+
+/*
+ * Mark the metaslab as disabled to prevent any allocations on this metaslab.
+ * We must also track how many metaslabs are currently disabled within a
+ * metaslab group and limit them to prevent allocation failures from
+ * occurring because all metaslabs are disabled.  This is used by both
+ * initializing and trimming, which write to or discard unallocated space.
+ */
+void
+metaslab_disable(metaslab_t *msp)
+{
+	ASSERT(!MUTEX_HELD(&msp->ms_lock));
+	metaslab_group_t *mg = msp->ms_group;
+
+	mutex_enter(&mg->mg_ms_disabled_lock);
+
+	/*
+	 * To keep an accurate count of how many threads have disabled
+	 * a specific metaslab group, we only allow one thread to mark
+	 * the metaslab group at a time. This ensures that the value of
+	 * ms_disabled will be accurate when we decide to mark a metaslab
+	 * group as disabled. To do this we force all other threads
+	 * to wait till the metaslab's mg_disabled_updating flag is no
+	 * longer set.
+	 */
+	metaslab_group_disable_wait(mg);
+	mg->mg_disabled_updating = B_TRUE;
+	if (msp->ms_disabled == 0) {
+		metaslab_group_disabled_increment(mg);
+	}
+	mutex_enter(&msp->ms_lock);
+	msp->ms_disabled++;
+	mutex_exit(&msp->ms_lock);
+
+	mg->mg_disabled_updating = B_FALSE;
+	cv_broadcast(&mg->mg_ms_disabled_cv);
+	mutex_exit(&mg->mg_ms_disabled_lock);
+}
+
+/*
+ * Re-enable allocations on a metaslab disabled by metaslab_disable().
+ * When 'sync' is set we first wait for the open txg to sync, so that any
+ * initializing writes or trims issued against unallocated space have
+ * completed before the space can be handed out again.
+ */
+void
+metaslab_enable(metaslab_t *msp, boolean_t sync)
+{
+	metaslab_group_t *mg = msp->ms_group;
+	spa_t *spa = mg->mg_vd->vdev_spa;
+
+	if (sync)
+		txg_wait_synced(spa_get_dsl(spa), 0);
+
+	mutex_enter(&mg->mg_ms_disabled_lock);
+	mutex_enter(&msp->ms_lock);
+	if (--msp->ms_disabled == 0) {
+		mg->mg_ms_disabled--;
+		cv_broadcast(&mg->mg_ms_disabled_cv);
+	}
+	mutex_exit(&msp->ms_lock);
+	mutex_exit(&mg->mg_ms_disabled_lock);
+}
+
 void
 metaslab_check_free(spa_t *spa, const blkptr_t *bp)
 {
@@ -0,0 +1,704 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright (c) 2018, 2019 by Delphix. All rights reserved.
+ */
+
+#include <sys/dmu_objset.h>
+#include <sys/metaslab.h>
+#include <sys/metaslab_impl.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/spa_log_spacemap.h>
+#include <sys/vdev_impl.h>
+#include <sys/zap.h>
+
+/*
+ * Log Space Maps
+ *
+ * Without this feature every txg appends the allocs and frees of each
+ * metaslab it touches to that metaslab's own space map. On a large,
+ * fragmented pool a txg of random writes touches hundreds of metaslabs,
+ * and each of them costs at least one block write (plus indirect blocks)
+ * for a handful of entries. The space map updates can then dominate the
+ * time spent syncing a txg.
+ *
+ * With log space maps, each txg writes all of its metaslab changes to a
+ * single new space map (the log of that txg) using two-word entries that
+ * record the vdev id. The changes are also kept in-core, per metaslab, in
+ * ms_unflushed_allocs and ms_unflushed_frees. Every txg we flush a few
+ * metaslabs: their unflushed changes are appended to their own space map
+ * in one go and their ms_unflushed_txg is set to the syncing txg. Logs
+ * that are older than the oldest ms_unflushed_txg no longer contain any
+ * change that isn't also in a metaslab space map, and are destroyed.
+ *
+ * == On disk data structures ==
+ *
+ * - The log space maps are referenced by a ZAP in the MOS directory
+ *   (DMU_POOL_LOG_SPACEMAP_ZAP), keyed by the txg they were written in.
+ *
+ * - Each top-level vdev has a VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS object
+ *   in its top ZAP holding an array of metaslab_unflushed_phys_t indexed
+ *   by metaslab id, the on-disk counterpart of ms_unflushed_txg.
+ *
+ * == Import ==
+ *
+ * After the metaslabs are opened, we read their unflushed txgs and replay
+ * the log space maps in txg order, skipping the entries of each metaslab
+ * that are older than its unflushed txg (those are already in its space
+ * map). The result is the in-core unflushed trees of each metaslab as
+ * they were before the export or crash. Only the logs have to be read,
+ * and their total size is bounded by the flushing policy below.
+ *
+ * == Flushing policy ==
+ *
+ * Flushing too few metaslabs lets the logs (and thus import time) and the
+ * memory used by the unflushed trees grow without bound; flushing too many
+ * gives back the write amplification we are trying to avoid. Each txg we
+ * flush the metaslabs that were flushed the longest time ago, as many as
+ * needed so that:
+ *
+ * - the memory used by the unflushed trees stays below
+ *   spa_log_sm_memlimit(),
+ * - the number of blocks in the logs stays below sus_blocklimit, which
+ *   is proportional to the number of metaslabs in the pool (see
+ *   zfs_unflushed_log_block_pct), and
+ * - we keep a pace that keeps the number of log blocks steady, given the
+ *   average number of blocks each txg adds to the logs.
+ */
+
+/*
+ * Upper bound of the memory used by the unflushed trees of all metaslabs
+ * in a pool, as an absolute amount and in parts per million of physical
+ * memory. The smaller of the two applies.
+ */
+uint64_t zfs_unflushed_max_mem_amt = 1ULL << 30;
+uint64_t zfs_unflushed_max_mem_ppm = 1000;
+
+/*
+ * Bounds on the number of blocks across all log space maps of a pool. The
+ * limit is zfs_unflushed_log_block_pct percent of the number of metaslabs
+ * in the pool, clamped to [zfs_unflushed_log_block_min,
+ * zfs_unflushed_log_block_max]. The larger the limit, the fewer metaslabs
+ * are flushed per txg but the longer an import takes to replay the logs.
+ */
+uint64_t zfs_unflushed_log_block_max = 1ULL << 18;
+uint64_t zfs_unflushed_log_block_min = 1000;
+uint64_t zfs_unflushed_log_block_pct = 400;
+
+/* Minimum number of metaslabs flushed per dirty txg */
+uint64_t zfs_min_metaslabs_to_flush = 1;
+
+/*
+ * By default we flush every metaslab when a pool is exported, so that the
+ * next import doesn't have to replay any log. Setting this skips the
+ * flush and makes exports faster at the expense of the next import.
+ */
+int zfs_keep_log_spacemaps_at_export = 0;
+
+/* Block size of the log space maps */
+static const int zfs_log_sm_blksz = 1 << 17;
+
+extern int metaslab_debug_load;
+
+int
+spa_log_sm_sort_by_txg(const void *va, const void *vb)
+{
+	const spa_log_sm_t *a = va;
+	const spa_log_sm_t *b = vb;
+
+	if (a->sls_txg < b->sls_txg)
+		return (-1);
+	if (a->sls_txg > b->sls_txg)
+		return (1);
+	return (0);
+}
+
+static spa_log_sm_t *
+spa_log_sm_alloc(uint64_t sm_obj, uint64_t txg)
+{
+	spa_log_sm_t *sls = kmem_zalloc(sizeof (*sls), KM_SLEEP);
+
+	sls->sls_sm_obj = sm_obj;
+	sls->sls_txg = txg;
+	return (sls);
+}
+
+/*
+ * Number of blocks used by a space map, including any unsynced appends.
+ */
+static uint64_t
+spa_log_sm_nblocks(space_map_t *sm)
+{
+	return (howmany(sm->sm_phys->smp_objsize, sm->sm_blksz));
+}
+
+space_map_t *
+spa_syncing_log_sm(spa_t *spa)
+{
+	return (spa->spa_syncing_log_sm);
+}
+
+uint64_t
+spa_log_sm_memlimit(void)
+{
+	uint64_t ppm_limit = ((uint64_t)physmem * PAGESIZE) *
+	    zfs_unflushed_max_mem_ppm / 1000000;
+	return (MIN(zfs_unflushed_max_mem_amt, ppm_limit));
+}
+
+static uint64_t
+spa_log_sm_blocklimit(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	uint64_t nmetaslabs = 0;
+
+	for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+
+		if (vdev_is_concrete(tvd))
+			nmetaslabs += tvd->vdev_ms_count;
+	}
+
+	uint64_t limit = nmetaslabs * zfs_unflushed_log_block_pct / 100;
+	limit = MAX(limit, zfs_unflushed_log_block_min);
+	return (MIN(limit, zfs_unflushed_log_block_max));
+}
+
+/*
+ * Number of txgs of changes that the least recently flushed metaslab
+ * has not written to its space map yet.
+ */
+uint64_t
+spa_log_sm_flush_backlog(spa_t *spa)
+{
+	uint64_t backlog = 0;
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	metaslab_t *oldest = avl_first(&spa->spa_metaslabs_by_flushed);
+	if (oldest != NULL) {
+		uint64_t txg = spa_last_synced_txg(spa) + 1;
+		if (txg > oldest->ms_unflushed_txg)
+			backlog = txg - oldest->ms_unflushed_txg;
+	}
+	mutex_exit(&spa->spa_flushed_ms_lock);
+
+	return (backlog);
+}
+
+/*
+ * Create the log space map of the syncing txg. Called the first time a
+ * metaslab is synced in a txg, once the log_spacemap feature is enabled.
+ */
+void
+spa_generate_syncing_log_sm(spa_t *spa, dmu_tx_t *tx)
+{
+	uint64_t txg = dmu_tx_get_txg(tx);
+	objset_t *mos = spa_meta_objset(spa);
+
+	if (spa_syncing_log_sm(spa) != NULL)
+		return;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_LOG_SPACEMAP))
+		return;
+
+	/*
+	 * The log space maps need two-word entries to record the vdev of
+	 * each range, which is what the spacemap_v2 dependency gives us.
+	 */
+	ASSERT(spa_feature_is_active(spa, SPA_FEATURE_SPACEMAP_V2));
+
+	if (!spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+		spa_feature_incr(spa, SPA_FEATURE_LOG_SPACEMAP, tx);
+
+	uint64_t spacemap_zap;
+	int error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (spacemap_zap), 1,
+	    &spacemap_zap);
+	if (error == ENOENT) {
+		ASSERT(avl_is_empty(&spa->spa_sm_logs_by_txg));
+
+		spacemap_zap = zap_create(mos,
+		    DMU_OTN_ZAP_METADATA, DMU_OT_NONE, 0, tx);
+		VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT,
+		    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (spacemap_zap), 1,
+		    &spacemap_zap, tx));
+	} else {
+		VERIFY0(error);
+	}
+
+	uint64_t sm_obj = space_map_alloc(mos, zfs_log_sm_blksz, tx);
+	VERIFY0(zap_add_int_key(mos, spacemap_zap, txg, sm_obj, tx));
+	avl_add(&spa->spa_sm_logs_by_txg, spa_log_sm_alloc(sm_obj, txg));
+
+	/*
+	 * The log space map covers all vdevs, so it spans the whole 64-bit
+	 * offset range with the smallest possible shift.
+	 */
+	VERIFY0(space_map_open(&spa->spa_syncing_log_sm, mos, sm_obj,
+	    0, UINT64_MAX, SPA_MINBLOCKSHIFT));
+}
+
+/*
+ * Called once the syncing txg has converged, to account for the blocks
+ * of its log and close it.
+ */
+void
+spa_sync_close_syncing_log_sm(spa_t *spa)
+{
+	space_map_t *sm = spa_syncing_log_sm(spa);
+
+	if (sm == NULL)
+		return;
+	ASSERT(spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP));
+
+	spa_log_sm_t *sls = avl_last(&spa->spa_sm_logs_by_txg);
+	ASSERT3U(sls->sls_txg, ==, spa_syncing_txg(spa));
+
+	sls->sls_nblocks = spa_log_sm_nblocks(sm);
+	spa->spa_unflushed_stats.sus_nblocks += sls->sls_nblocks;
+
+	space_map_close(sm);
+	spa->spa_syncing_log_sm = NULL;
+}
+
+/*
+ * Destroy the log space maps whose changes have all been flushed to the
+ * metaslab space maps, i.e. the ones older than the oldest unflushed txg.
+ */
+void
+spa_cleanup_old_sm_logs(spa_t *spa, dmu_tx_t *tx)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	spa_unflushed_stats_t *sus = &spa->spa_unflushed_stats;
+
+	if (avl_is_empty(&spa->spa_sm_logs_by_txg))
+		return;
+
+	uint64_t spacemap_zap;
+	VERIFY0(zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (spacemap_zap), 1,
+	    &spacemap_zap));
+
+	mutex_enter(&spa->spa_flushed_ms_lock);
+	metaslab_t *oldest = avl_first(&spa->spa_metaslabs_by_flushed);
+	uint64_t txg_tail = (oldest != NULL) ?
+	    oldest->ms_unflushed_txg : spa_syncing_txg(spa);
+	mutex_exit(&spa->spa_flushed_ms_lock);
+
+	spa_log_sm_t *sls;
+	while ((sls = avl_first(&spa->spa_sm_logs_by_txg)) != NULL &&
+	    sls->sls_txg < txg_tail) {
+		space_map_free_obj(mos, sls->sls_sm_obj, tx);
+		VERIFY0(zap_remove_int(mos, spacemap_zap, sls->sls_txg, tx));
+
+		ASSERT3U(sus->sus_nblocks, >=, sls->sls_nblocks);
+		sus->sus_nblocks -= sls->sls_nblocks;
+
+		avl_remove(&spa->spa_sm_logs_by_txg, sls);
+		kmem_free(sls, sizeof (*sls));
+	}
+}
+
+/*
+ * Flush the metaslabs with the oldest unflushed changes, see the flushing
+ * policy in the block comment at the top of this file. Called in the first
+ * sync pass, before the dirty metaslabs are synced.
+ */
+void
+spa_flush_metaslabs(spa_t *spa, dmu_tx_t *tx)
+{
+	uint64_t txg = dmu_tx_get_txg(tx);
+	spa_unflushed_stats_t *sus = &spa->spa_unflushed_stats;
+
+	if (!spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+		return;
+
+	ASSERT(spa_writeable(spa));
+	ASSERT3U(spa_sync_pass(spa), ==, 1);
+
+	sus->sus_blocklimit = spa_log_sm_blocklimit(spa);
+
+	if (avl_is_empty(&spa->spa_metaslabs_by_flushed))
+		return;
+
+	/*
+	 * Flushing dirties the MOS, so doing it in an otherwise clean txg
+	 * would keep the pool from ever going idle. The flush-all requested
+	 * at export is the exception; it is done before spa_final_txg is
+	 * set, so it can't dirty one of the txgs that must stay empty.
+	 */
+	boolean_t flushall = (spa->spa_log_flushall_txg != 0);
+	if (!flushall && !dmu_objset_is_dirty(spa_meta_objset(spa), txg))
+		return;
+
+	uint64_t memlimit = spa_log_sm_memlimit();
+
+	/*
+	 * If each txg adds B blocks to the logs on average and we flush k of
+	 * the N unflushed metaslabs per txg, every log lives for about N/k
+	 * txgs, so the logs hold about N * B / k blocks in steady state.
+	 * Pick k so that this stays within the block limit.
+	 */
+	uint64_t nlogs = avl_numnodes(&spa->spa_sm_logs_by_txg);
+	uint64_t avg_blocks = (nlogs == 0) ? 1 :
+	    MAX(sus->sus_nblocks / nlogs, 1);
+	uint64_t want = howmany(avl_numnodes(&spa->spa_metaslabs_by_flushed) *
+	    avg_blocks, MAX(sus->sus_blocklimit, 1));
+	want = MAX(want, zfs_min_metaslabs_to_flush);
+
+	hrtime_t start = gethrtime();
+	uint64_t nblocks = sus->sus_nblocks;
+	uint64_t flushed = 0;
+	spa_log_sm_t *sls = avl_first(&spa->spa_sm_logs_by_txg);
+
+	metaslab_t *curr, *next;
+	for (curr = avl_first(&spa->spa_metaslabs_by_flushed); curr != NULL;
+	    curr = next) {
+		next = AVL_NEXT(&spa->spa_metaslabs_by_flushed, curr);
+
+		/* flushed metaslabs are moved to the end of the tree */
+		if (curr->ms_unflushed_txg >= txg)
+			break;
+
+		if (!flushall && flushed >= want &&
+		    sus->sus_memused <= memlimit &&
+		    nblocks <= sus->sus_blocklimit)
+			break;
+
+		/*
+		 * A metaslab that can't be flushed right now (because it is
+		 * being loaded) keeps every newer log alive anyway, so there
+		 * is no point in going further.
+		 */
+		if (!metaslab_flush(curr, tx))
+			break;
+		flushed++;
+
+		/*
+		 * Project the number of log blocks once the logs that are
+		 * no longer needed are destroyed.
+		 */
+		uint64_t txg_tail = (next != NULL && next->ms_unflushed_txg <
+		    txg) ? next->ms_unflushed_txg : txg;
+		while (sls != NULL && sls->sls_txg < txg_tail) {
+			nblocks -= sls->sls_nblocks;
+			sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls);
+		}
+	}
+
+	sus->sus_ms_flushed += flushed;
+	sus->sus_flush_time += gethrtime() - start;
+
+	spa_cleanup_old_sm_logs(spa, tx);
+}
+
+/*
+ * Make the txg after the current one flush every metaslab with unflushed
+ * changes and wait for it, so that the logs left on disk are as small as
+ * possible. Called when exporting a pool, before spa_final_txg is set.
+ */
+void
+spa_unload_log_sm_flush_all(spa_t *spa)
+{
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+
+	ASSERT3U(spa->spa_log_flushall_txg, ==, 0);
+	spa->spa_log_flushall_txg = dmu_tx_get_txg(tx);
+
+	dmu_tx_commit(tx);
+	txg_wait_synced(dp, spa->spa_log_flushall_txg);
+
+	spa->spa_log_flushall_txg = 0;
+}
+
+/*
+ * Release the in-core log space map state. Called from spa_unload() once
+ * all the metaslabs are gone.
+ */
+void
+spa_unload_log_sm_metadata(spa_t *spa)
+{
+	void *cookie = NULL;
+	spa_log_sm_t *sls;
+
+	while ((sls = avl_destroy_nodes(&spa->spa_sm_logs_by_txg,
+	    &cookie)) != NULL) {
+		kmem_free(sls, sizeof (*sls));
+	}
+
+	ASSERT(avl_is_empty(&spa->spa_metaslabs_by_flushed));
+	ASSERT3P(spa->spa_syncing_log_sm, ==, NULL);
+
+	spa->spa_unflushed_stats.sus_memused = 0;
+	spa->spa_unflushed_stats.sus_blocklimit = 0;
+	spa->spa_unflushed_stats.sus_nblocks = 0;
+	spa->spa_log_flushall_txg = 0;
+}
+
+/*
+ * Read the unflushed txg of each metaslab of a top-level vdev and link
+ * the ones that have one into spa_metaslabs_by_flushed.
+ */
+static int
+spa_ld_unflushed_txgs(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	objset_t *mos = spa_meta_objset(spa);
+
+	if (vd->vdev_top_zap == 0)
+		return (0);
+
+	uint64_t object = 0;
+	int error = zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS,
+	    sizeof (uint64_t), 1, &object);
+	if (error == ENOENT)
+		return (0);
+	else if (error != 0) {
+		spa_load_failed(spa, "spa_ld_unflushed_txgs(): failed at "
+		    "zap_lookup(vdev_top_zap=%llu) [error %d]",
+		    (u_longlong_t)vd->vdev_top_zap, error);
+		return (error);
+	}
+
+	for (uint64_t m = 0; m < vd->vdev_ms_count; m++) {
+		metaslab_t *ms = vd->vdev_ms[m];
+		ASSERT(ms != NULL);
+
+		metaslab_unflushed_phys_t entry;
+		uint64_t entry_size = sizeof (entry);
+		uint64_t entry_offset = ms->ms_id * entry_size;
+
+		error = dmu_read(mos, object,
+		    entry_offset, entry_size, &entry, 0);
+		if (error != 0) {
+			spa_load_failed(spa, "spa_ld_unflushed_txgs(): "
+			    "failed at dmu_read(obj=%llu) [error %d]",
+			    (u_longlong_t)object, error);
+			return (error);
+		}
+
+		if (entry.msp_unflushed_txg == 0)
+			continue;
+		ASSERT3P(ms->ms_sm, !=, NULL);
+
+		ms->ms_unflushed_txg = entry.msp_unflushed_txg;
+		mutex_enter(&spa->spa_flushed_ms_lock);
+		avl_add(&spa->spa_metaslabs_by_flushed, ms);
+		mutex_exit(&spa->spa_flushed_ms_lock);
+	}
+	return (0);
+}
+
+typedef struct spa_ld_log_sm_arg {
+	spa_t		*slls_spa;
+	uint64_t	slls_txg;
+} spa_ld_log_sm_arg_t;
+
+static int
+spa_ld_log_sm_cb(space_map_entry_t *sme, void *arg)
+{
+	spa_ld_log_sm_arg_t *slls = arg;
+	uint64_t offset = sme->sme_offset;
+	uint64_t size = sme->sme_run;
+
+	/*
+	 * Entries of removed vdevs are skipped; their data has already
+	 * been moved elsewhere.
+	 */
+	vdev_t *vd = vdev_lookup_top(slls->slls_spa, sme->sme_vdev);
+	if (vd == NULL || !vdev_is_concrete(vd))
+		return (0);
+
+	uint64_t ms_id = offset >> vd->vdev_ms_shift;
+	if (ms_id >= vd->vdev_ms_count)
+		return (SET_ERROR(EINVAL));
+	metaslab_t *ms = vd->vdev_ms[ms_id];
+	ASSERT(!ms->ms_loaded);
+
+	/*
+	 * A metaslab is flushed before the changes of the syncing txg are
+	 * logged, so its space map already has every change logged before
+	 * its unflushed txg.
+	 */
+	if (ms->ms_unflushed_txg == 0 ||
+	    slls->slls_txg < ms->ms_unflushed_txg)
+		return (0);
+
+	switch (sme->sme_type) {
+	case SM_ALLOC:
+		range_tree_remove_xor_add_segment(offset, offset + size,
+		    ms->ms_unflushed_frees, ms->ms_unflushed_allocs);
+		break;
+	case SM_FREE:
+		range_tree_remove_xor_add_segment(offset, offset + size,
+		    ms->ms_unflushed_allocs, ms->ms_unflushed_frees);
+		break;
+	default:
+		return (SET_ERROR(EINVAL));
+	}
+	return (0);
+}
+
+/*
+ * Read the log space map ZAP and replay every log in txg order.
+ */
+static int
+spa_ld_log_sm_data(spa_t *spa)
+{
+	objset_t *mos = spa_meta_objset(spa);
+	spa_unflushed_stats_t *sus = &spa->spa_unflushed_stats;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	int error;
+
+	uint64_t spacemap_zap;
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_LOG_SPACEMAP_ZAP, sizeof (spacemap_zap), 1,
+	    &spacemap_zap);
+	if (error == ENOENT)
+		return (0);
+	else if (error != 0) {
+		spa_load_failed(spa, "spa_ld_log_sm_data(): failed at "
+		    "zap_lookup(DMU_POOL_DIRECTORY_OBJECT) [error %d]", error);
+		return (error);
+	}
+
+	for (zap_cursor_init(&zc, mos, spacemap_zap);
+	    (error = zap_cursor_retrieve(&zc, &za)) == 0;
+	    zap_cursor_advance(&zc)) {
+		uint64_t log_txg = strtonum(za.za_name, NULL);
+		avl_add(&spa->spa_sm_logs_by_txg,
+		    spa_log_sm_alloc(za.za_first_integer, log_txg));
+	}
+	zap_cursor_fini(&zc);
+	if (error != ENOENT) {
+		spa_load_failed(spa, "spa_ld_log_sm_data(): failed at "
+		    "zap_cursor_retrieve(spacemap_zap) [error %d]", error);
+		return (error);
+	}
+
+	hrtime_t start = gethrtime();
+	for (spa_log_sm_t *sls = avl_first(&spa->spa_sm_logs_by_txg);
+	    sls != NULL; sls = AVL_NEXT(&spa->spa_sm_logs_by_txg, sls)) {
+		space_map_t *sm = NULL;
+
+		error = space_map_open(&sm, mos, sls->sls_sm_obj,
+		    0, UINT64_MAX, SPA_MINBLOCKSHIFT);
+		if (error != 0) {
+			spa_load_failed(spa, "spa_ld_log_sm_data(): failed at "
+			    "space_map_open(obj=%llu) [error %d]",
+			    (u_longlong_t)sls->sls_sm_obj, error);
+			return (error);
+		}
+		space_map_update(sm);
+
+		spa_ld_log_sm_arg_t slls;
+		slls.slls_spa = spa;
+		slls.slls_txg = sls->sls_txg;
+		error = space_map_iterate(sm, spa_ld_log_sm_cb, &slls);
+
+		sls->sls_nblocks = spa_log_sm_nblocks(sm);
+		sus->sus_nblocks += sls->sls_nblocks;
+		space_map_close(sm);
+
+		if (error != 0) {
+			spa_load_failed(spa, "spa_ld_log_sm_data(): failed at "
+			    "space_map_iterate(obj=%llu) [error %d]",
+			    (u_longlong_t)sls->sls_sm_obj, error);
+			return (error);
+		}
+	}
+
+	zfs_dbgmsg("spa=%s replayed %llu log space maps (%llu blocks) "
+	    "in %llu ms", spa_name(spa),
+	    (u_longlong_t)avl_numnodes(&spa->spa_sm_logs_by_txg),
+	    (u_longlong_t)sus->sus_nblocks,
+	    (u_longlong_t)NSEC2MSEC(gethrtime() - start));
+
+	return (0);
+}
+
+/*
+ * Called at import once the metaslabs are opened. Rebuilds the unflushed
+ * changes of every metaslab from the log space maps.
+ */
+int
+spa_ld_log_spacemaps(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	int error;
+
+	if (!spa_feature_is_active(spa, SPA_FEATURE_LOG_SPACEMAP))
+		return (0);
+
+	for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+		vdev_t *tvd = rvd->vdev_child[c];
+
+		if (!vdev_is_concrete(tvd))
+			continue;
+		if ((error = spa_ld_unflushed_txgs(tvd)) != 0)
+			return (error);
+	}
+
+	if ((error = spa_ld_log_sm_data(spa)) != 0)
+		return (error);
+
+	/*
+	 * Account for the replayed changes in the metaslabs' allocated space
+	 * and weight, which were computed from their space maps alone.
+	 */
+	for (metaslab_t *ms = avl_first(&spa->spa_metaslabs_by_flushed);
+	    ms != NULL; ms = AVL_NEXT(&spa->spa_metaslabs_by_flushed, ms)) {
+		metaslab_unflushed_replayed(ms);
+		spa->spa_unflushed_stats.sus_memused +=
+		    metaslab_unflushed_changes_memused(ms);
+	}
+
+	/*
+	 * metaslab_init() skips metaslab_debug_load when the log space maps
+	 * are in use, as the unflushed changes weren't known yet.
+	 */
+	if (metaslab_debug_load) {
+		for (uint64_t c = 0; c < rvd->vdev_children; c++) {
+			vdev_t *tvd = rvd->vdev_child[c];
+
+			if (!vdev_is_concrete(tvd))
+				continue;
+			for (uint64_t m = 0; m < tvd->vdev_ms_count; m++) {
+				metaslab_t *ms = tvd->vdev_ms[m];
+
+				if (ms->ms_sm == NULL)
+					continue;
+				mutex_enter(&ms->ms_lock);
+				VERIFY0(metaslab_load(ms));
+				mutex_exit(&ms->ms_lock);
+			}
+		}
+	}
+
+	return (0);
+}
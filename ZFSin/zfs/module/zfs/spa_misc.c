@@ -35,11 +35,14 @@
 #include <sys/zio_compress.h>
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
+#include <sys/dnode.h>
 #include <sys/zap.h>
 #include <sys/zil.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_disk.h>
 #include <sys/vdev_file.h>
 #include <sys/vdev_initialize.h>
+#include <sys/vdev_trim.h>
 #include <sys/metaslab.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
@@ -57,6 +60,9 @@
 #include <sys/stropts.h>
 #include "zfs_prop.h"
 #include <sys/zfeature.h>
+#include <zfs_fletcher.h>
+#include <sys/vdev_raidz.h>
+#include <sys/zio_crypt.h>
 
 /*
  * SPA locking
@@ -350,6 +356,18 @@ uint64_t spa_min_slop = 128 * 1024 * 1024;
 
 int spa_allocators = 4;
 
+/*
+ * Placement of blocks when the pool has a special allocation class.
+ * Metadata always goes to the special class while it has space. DDT
+ * blocks and the indirect blocks of user data can be kept on the normal
+ * class, and small file blocks (see the special_small_blocks property)
+ * may only use the special class up to the point where
+ * zfs_special_class_metadata_reserve_pct of it is left for metadata.
+ */
+int zfs_ddt_data_is_special = B_TRUE;
+int zfs_user_indirect_is_special = B_TRUE;
+int zfs_special_class_metadata_reserve_pct = 25;
+
 /*PRINTFLIKE2*/
 void
 spa_load_failed(spa_t *spa, const char *fmt, ...)
@@ -611,6 +629,7 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	mutex_init(&spa->spa_suspend_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_feat_stats_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_vdev_top_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_flushed_ms_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_evicting_os_cv, NULL, CV_DEFAULT, NULL);
@@ -774,6 +793,7 @@ spa_remove(spa_t *spa)
 	mutex_destroy(&spa->spa_suspend_lock);
 	mutex_destroy(&spa->spa_vdev_top_lock);
 	mutex_destroy(&spa->spa_feat_stats_lock);
+	mutex_destroy(&spa->spa_flushed_ms_lock);
 
 	kmem_free(spa, sizeof (spa_t));
 }
@@ -1144,6 +1164,7 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 	 */
 	ASSERT(metaslab_class_validate(spa_normal_class(spa)) == 0);
 	ASSERT(metaslab_class_validate(spa_log_class(spa)) == 0);
+	ASSERT(metaslab_class_validate(spa_special_class(spa)) == 0);
 
 	spa_config_exit(spa, SCL_ALL, spa);
 
@@ -1169,8 +1190,17 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 			mutex_enter(&vd->vdev_initialize_lock);
 			vdev_initialize_stop(vd, VDEV_INITIALIZE_CANCELED);
 			mutex_exit(&vd->vdev_initialize_lock);
+
+			mutex_enter(&vd->vdev_trim_lock);
+			vdev_trim_stop(vd, VDEV_TRIM_CANCELED);
+			mutex_exit(&vd->vdev_trim_lock);
 		}
 
+		/*
+		 * The vdev may be both a leaf and top-level device.
+		 */
+		vdev_autotrim_stop_wait(vd);
+
 		spa_config_enter(spa, SCL_ALL, spa, RW_WRITER);
 		vdev_free(vd);
 		spa_config_exit(spa, SCL_ALL, spa);
@@ -1756,6 +1786,12 @@ spa_get_failmode(spa_t *spa)
 	return (spa->spa_failmode);
 }
 
+spa_autotrim_t
+spa_get_autotrim(spa_t *spa)
+{
+	return (spa->spa_autotrim);
+}
+
 boolean_t
 spa_suspended(spa_t *spa)
 {
@@ -1786,6 +1822,75 @@ spa_log_class(spa_t *spa)
 	return (spa->spa_log_class);
 }
 
+metaslab_class_t *
+spa_special_class(spa_t *spa)
+{
+	return (spa->spa_special_class);
+}
+
+/*
+ * Locate an appropriate allocation class for a block of the given type,
+ * level and size. The caller falls back to the normal class if the
+ * returned class has no space left.
+ */
+metaslab_class_t *
+spa_preferred_class(spa_t *spa, uint64_t size, dmu_object_type_t objtype,
+    uint_t level, uint_t special_smallblk)
+{
+	boolean_t has_special_class;
+
+	if (DMU_OT_IS_ZIL(objtype)) {
+		if (spa->spa_log_class->mc_groups != 0)
+			return (spa_log_class(spa));
+		else
+			return (spa_normal_class(spa));
+	}
+
+	has_special_class = spa->spa_special_class->mc_groups != 0;
+
+	if (DMU_OT_IS_DDT(objtype)) {
+		if (has_special_class && zfs_ddt_data_is_special)
+			return (spa_special_class(spa));
+		else
+			return (spa_normal_class(spa));
+	}
+
+	/* Indirect blocks for user data can land in special if allowed */
+	if (level > 0 && (DMU_OT_IS_FILE(objtype) || objtype == DMU_OT_ZVOL)) {
+		if (has_special_class && zfs_user_indirect_is_special)
+			return (spa_special_class(spa));
+		else
+			return (spa_normal_class(spa));
+	}
+
+	if (DMU_OT_IS_METADATA(objtype) || level > 0) {
+		if (has_special_class)
+			return (spa_special_class(spa));
+		else
+			return (spa_normal_class(spa));
+	}
+
+	/*
+	 * Allow small file blocks in the special class, but always leave
+	 * a reserve of zfs_special_class_metadata_reserve_pct exclusively
+	 * for metadata.
+	 */
+	if (DMU_OT_IS_FILE(objtype) &&
+	    has_special_class && size <= special_smallblk) {
+		metaslab_class_t *special = spa_special_class(spa);
+		uint64_t alloc = metaslab_class_get_alloc(special);
+		uint64_t space = metaslab_class_get_space(special);
+		uint64_t limit =
+		    (space * (100 - zfs_special_class_metadata_reserve_pct))
+		    / 100;
+
+		if (alloc < limit)
+			return (special);
+	}
+
+	return (spa_normal_class(spa));
+}
+
 void
 spa_evicting_os_register(spa_t *spa, objset_t *os)
 {
@@ -1954,10 +2059,18 @@ spa_init(int mode)
 	range_tree_init();
 	metaslab_alloc_trace_init();
 	ddt_init();
+	fletcher_4_init();
+	vdev_raidz_math_init();
 	zio_init();
+	zio_crypt_init();
 	dmu_init();
 	zil_init();
 	vdev_cache_stat_init();
+	vdev_queue_stat_init();
+	vdev_file_init();
+#ifdef _KERNEL
+	vdev_disk_init();
+#endif
 	zfs_prop_init();
 	zpool_prop_init();
 	zpool_feature_init();
@@ -1972,10 +2085,18 @@ spa_fini(void)
 
 	spa_evict_all();
 
+#ifdef _KERNEL
+	vdev_disk_fini();
+#endif
+	vdev_file_fini();
+	vdev_queue_stat_fini();
 	vdev_cache_stat_fini();
 	zil_fini();
 	dmu_fini();
+	zio_crypt_fini();
 	zio_fini();
+	vdev_raidz_math_fini();
+	fletcher_4_fini();
 	ddt_fini();
 	metaslab_alloc_trace_fini();
 	range_tree_fini();
@@ -2083,6 +2204,7 @@ spa_scan_stat_init(spa_t *spa)
 		spa->spa_scan_pass_scrub_pause = 0;
 	spa->spa_scan_pass_scrub_spent_paused = 0;
 	spa->spa_scan_pass_exam = 0;
+	spa->spa_scan_pass_issued = 0;
 	vdev_scan_stat_init(spa->spa_root_vdev);
 }
 
@@ -2114,6 +2236,9 @@ spa_scan_get_stats(spa_t *spa, pool_scan_stat_t *ps)
 	ps->pss_pass_exam = spa->spa_scan_pass_exam;
 	ps->pss_pass_scrub_pause = spa->spa_scan_pass_scrub_pause;
 	ps->pss_pass_scrub_spent_paused = spa->spa_scan_pass_scrub_spent_paused;
+	ps->pss_pass_issued = spa->spa_scan_pass_issued;
+	ps->pss_issued =
+	    scn->scn_issued_before_pass + spa->spa_scan_pass_issued;
 
 	return (0);
 }
@@ -2127,6 +2252,15 @@ spa_maxblocksize(spa_t *spa)
 		return (SPA_OLD_MAXBLOCKSIZE);
 }
 
+int
+spa_maxdnodesize(spa_t *spa)
+{
+	if (spa_feature_is_enabled(spa, SPA_FEATURE_LARGE_DNODE))
+		return (DNODE_MAX_SIZE);
+	else
+		return (DNODE_MIN_SIZE);
+}
+
 /*
  * Returns the txg that the last device removal completed. No indirect mappings
  * have been added since this txg.
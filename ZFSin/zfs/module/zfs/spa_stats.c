@@ -21,6 +21,8 @@
 
 #include <sys/zfs_context.h>
 #include <sys/spa_impl.h>
+#include <sys/vdev_impl.h>
+#include <sys/zio.h>
 
 /*
  * Keeps stats on last N reads per spa_t, disabled by default.
@@ -655,6 +657,591 @@ spa_io_history_destroy(spa_t *spa)
 	mutex_destroy(&ssh->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA Vdev Latency Routines
+ * ==========================================================================
+ */
+
+/*
+ * Snapshot of the load and latency estimates of each leaf vdev, which is
+ * what vdev_mirror_child_select() bases its choice of child on.
+ */
+typedef struct spa_vdev_latency {
+	uint64_t	guid;		/* leaf vdev guid */
+	uint64_t	top;		/* id of its top-level vdev */
+	uint64_t	nonrot;		/* non-rotational */
+	uint64_t	queued;		/* active i/os */
+	uint64_t	latency;	/* moving avg of device time (ns) */
+	uint64_t	samples;	/* i/os sampled */
+	uint64_t	reads;		/* read operations */
+	uint64_t	writes;		/* write operations */
+	char		path[48];	/* tail of the vdev path */
+} spa_vdev_latency_t;
+
+static int
+spa_vdev_latency_headers(char *buf, uint32_t size)
+{
+	(void) snprintf(buf, size, "%-20s %-4s %-6s %-6s %-12s %-12s "
+	    "%-12s %-12s %s\n", "guid", "top", "nonrot", "queued",
+	    "latency_ns", "samples", "reads", "writes", "path");
+
+	return (0);
+}
+
+static int
+spa_vdev_latency_data(char *buf, uint32_t size, void *data)
+{
+	spa_vdev_latency_t *svl = (spa_vdev_latency_t *)data;
+
+	(void) snprintf(buf, size, "%-20llu %-4llu %-6llu %-6llu %-12llu "
+	    "%-12llu %-12llu %-12llu %s\n",
+	    (u_longlong_t)svl->guid, (u_longlong_t)svl->top,
+	    (u_longlong_t)svl->nonrot, (u_longlong_t)svl->queued,
+	    (u_longlong_t)svl->latency, (u_longlong_t)svl->samples,
+	    (u_longlong_t)svl->reads, (u_longlong_t)svl->writes, svl->path);
+
+	return (0);
+}
+
+static void *
+spa_vdev_latency_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_latency;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < 0 || (uint64_t)n >= ssh->count)
+		return (NULL);
+
+	return (&((spa_vdev_latency_t *)ssh->_private)[n]);
+}
+
+static uint64_t
+spa_vdev_latency_count(vdev_t *vd)
+{
+	uint64_t n = vd->vdev_ops->vdev_op_leaf ? 1 : 0;
+
+	for (uint64_t c = 0; c < vd->vdev_children; c++)
+		n += spa_vdev_latency_count(vd->vdev_child[c]);
+
+	return (n);
+}
+
+static void
+spa_vdev_latency_fill(vdev_t *vd, spa_vdev_latency_t *svl, uint64_t *n,
+    uint64_t max)
+{
+	for (uint64_t c = 0; c < vd->vdev_children; c++)
+		spa_vdev_latency_fill(vd->vdev_child[c], svl, n, max);
+
+	if (!vd->vdev_ops->vdev_op_leaf || *n >= max)
+		return;
+
+	spa_vdev_latency_t *e = &svl[(*n)++];
+	const char *path = (vd->vdev_path != NULL) ? vd->vdev_path : "-";
+	size_t len = strlen(path);
+
+	e->guid = vd->vdev_guid;
+	e->top = (vd->vdev_top != NULL) ? vd->vdev_top->vdev_id : 0;
+	e->nonrot = vd->vdev_nonrot;
+	e->queued = vdev_queue_length(vd);
+	e->latency = vd->vdev_queue.vq_lat_ewma;
+	e->samples = vd->vdev_queue.vq_lat_samples;
+	e->reads = vd->vdev_stat.vs_ops[ZIO_TYPE_READ];
+	e->writes = vd->vdev_stat.vs_ops[ZIO_TYPE_WRITE];
+	if (len >= sizeof (e->path))
+		path += len - (sizeof (e->path) - 1);
+	(void) strlcpy(e->path, path, sizeof (e->path));
+}
+
+/*
+ * Take a new snapshot on every read. The kstat can't be written.
+ */
+static int
+spa_vdev_latency_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_latency;
+	uint64_t n = 0;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	if (ssh->_private != NULL) {
+		kmem_free(ssh->_private, ssh->size);
+		ssh->_private = NULL;
+		ssh->size = 0;
+		ssh->count = 0;
+	}
+
+	spa_config_enter(spa, SCL_VDEV, FTAG, RW_READER);
+	if (spa->spa_root_vdev != NULL) {
+		uint64_t max = spa_vdev_latency_count(spa->spa_root_vdev);
+
+		if (max != 0) {
+			ssh->size = max * sizeof (spa_vdev_latency_t);
+			ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+			spa_vdev_latency_fill(spa->spa_root_vdev,
+			    ssh->_private, &n, max);
+		}
+	}
+	spa_config_exit(spa, SCL_VDEV, FTAG);
+
+	ssh->count = n;
+	ksp->ks_ndata = n;
+	ksp->ks_data_size = n * sizeof (spa_vdev_latency_t);
+
+	return (0);
+}
+
+static void
+spa_vdev_latency_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_latency;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "vdev_latency", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_vdev_latency_update;
+		kstat_set_raw_ops(ksp, spa_vdev_latency_headers,
+		    spa_vdev_latency_data, spa_vdev_latency_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_vdev_latency_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.vdev_latency;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * ==========================================================================
+ * SPA zio Pipeline Stage Routines
+ * ==========================================================================
+ */
+
+/*
+ * Time spent by zios in each pipeline stage, kept per I/O type and priority
+ * while zio_stage_stats is set. A histogram is only allocated once an I/O
+ * of its type and priority has been timed, and lives until the pool is
+ * removed; the counters are updated with atomics and never reset.
+ */
+typedef struct spa_zio_stage_histo {
+	uint64_t	szs_count[ZIO_STAGE_STATS];
+	uint64_t	szs_time[ZIO_STAGE_STATS];	/* total ns */
+	uint64_t	szs_histo[ZIO_STAGE_STATS][VDEV_L_HISTO_BUCKETS];
+} spa_zio_stage_histo_t;
+
+#define	SPA_ZIO_STAGE_PRIOS	(ZIO_PRIORITY_NOW + 1)
+#define	SPA_ZIO_STAGE_CLASSES	(ZIO_TYPES * SPA_ZIO_STAGE_PRIOS)
+
+static const char *spa_zio_stage_type[ZIO_TYPES] = {
+	"null", "read", "write", "free", "claim", "ioctl", "trim"
+};
+
+static const char *spa_zio_stage_prio[SPA_ZIO_STAGE_PRIOS] = {
+	"sync_read", "sync_write", "async_read", "async_write", "scrub",
+	"removal", "initializing", "trim", "-", "now"
+};
+
+static const char *spa_zio_stage_name[ZIO_STAGE_STATS] = {
+	"open", "read_bp_init", "write_bp_init", "free_bp_init",
+	"issue_async", "write_compress", "encrypt", "checksum_generate",
+	"nop_write", "ddt_read_start", "ddt_read_done", "ddt_write",
+	"ddt_free", "gang_assemble", "gang_issue", "dva_throttle",
+	"dva_allocate", "dva_free", "dva_claim", "ready", "vdev_io_start",
+	"vdev_io_done", "vdev_io_assess", "checksum_verify", "done",
+	"vdev_queue"
+};
+
+/*
+ * One row of the zio_stages kstat, for each stage that has samples.
+ */
+typedef struct spa_zio_stage_row {
+	uint32_t	type;
+	uint32_t	priority;
+	uint32_t	stage;
+	uint64_t	count;
+	uint64_t	time;
+	uint64_t	histo[VDEV_L_HISTO_BUCKETS];
+} spa_zio_stage_row_t;
+
+void
+spa_zio_stage_add(spa_t *spa, zio_type_t type, zio_priority_t priority,
+    int stage, hrtime_t delta)
+{
+	spa_zio_stage_histo_t *szs, **szsp;
+
+	if (spa->spa_stats.zio_stage_histo == NULL || type >= ZIO_TYPES ||
+	    priority >= SPA_ZIO_STAGE_PRIOS || delta < 0)
+		return;
+
+	ASSERT3S(stage, <, ZIO_STAGE_STATS);
+
+	szsp = &spa->spa_stats.zio_stage_histo[type * SPA_ZIO_STAGE_PRIOS +
+	    priority];
+	if ((szs = *szsp) == NULL) {
+		/* This runs in the I/O path, just skip the sample */
+		szs = kmem_zalloc(sizeof (*szs), KM_NOSLEEP);
+		if (szs == NULL)
+			return;
+		if (atomic_cas_ptr(szsp, NULL, szs) != NULL) {
+			kmem_free(szs, sizeof (*szs));
+			szs = *szsp;
+		}
+	}
+
+	atomic_inc_64(&szs->szs_count[stage]);
+	atomic_add_64(&szs->szs_time[stage], delta);
+	atomic_inc_64(&szs->szs_histo[stage][L_HISTO(delta)]);
+}
+
+/*
+ * Add the histograms to the root vdev's extended stats, for zpool iostat.
+ */
+void
+spa_zio_stage_generate(spa_t *spa, nvlist_t *nv)
+{
+	spa_zio_stage_histo_t *szs;
+	uint64_t row[ZIO_STAGE_HISTO_BUCKETS + VDEV_L_HISTO_BUCKETS];
+	char name[32];
+	nvlist_t *nvs, *nvc;
+
+	if (spa->spa_stats.zio_stage_histo == NULL)
+		return;
+
+	nvs = NULL;
+	for (int c = 0; c < SPA_ZIO_STAGE_CLASSES; c++) {
+		if ((szs = spa->spa_stats.zio_stage_histo[c]) == NULL)
+			continue;
+
+		nvc = fnvlist_alloc();
+		for (int s = 0; s < ZIO_STAGE_STATS; s++) {
+			if (szs->szs_count[s] == 0)
+				continue;
+			row[ZIO_STAGE_HISTO_COUNT] = szs->szs_count[s];
+			row[ZIO_STAGE_HISTO_TIME] = szs->szs_time[s];
+			bcopy(szs->szs_histo[s], &row[ZIO_STAGE_HISTO_BUCKETS],
+			    sizeof (szs->szs_histo[s]));
+			fnvlist_add_uint64_array(nvc, spa_zio_stage_name[s],
+			    row, ARRAY_SIZE(row));
+		}
+
+		if (nvs == NULL)
+			nvs = fnvlist_alloc();
+		(void) snprintf(name, sizeof (name), "%s/%s",
+		    spa_zio_stage_type[c / SPA_ZIO_STAGE_PRIOS],
+		    spa_zio_stage_prio[c % SPA_ZIO_STAGE_PRIOS]);
+		fnvlist_add_nvlist(nvs, name, nvc);
+		fnvlist_free(nvc);
+	}
+
+	if (nvs != NULL) {
+		fnvlist_add_nvlist(nv, ZPOOL_CONFIG_ZIO_STAGE_HISTO, nvs);
+		fnvlist_free(nvs);
+	}
+}
+
+static int
+spa_zio_stages_headers(char *buf, uint32_t size)
+{
+	(void) snprintf(buf, size, "%-6s %-12s %-18s %-12s %-16s %s\n",
+	    "type", "priority", "stage", "count", "total_ns",
+	    "histogram (log2 ns:count)");
+
+	return (0);
+}
+
+static int
+spa_zio_stages_data(char *buf, uint32_t size, void *data)
+{
+	spa_zio_stage_row_t *szr = (spa_zio_stage_row_t *)data;
+	uint32_t off;
+
+	(void) snprintf(buf, size, "%-6s %-12s %-18s %-12llu %-16llu",
+	    spa_zio_stage_type[szr->type], spa_zio_stage_prio[szr->priority],
+	    spa_zio_stage_name[szr->stage], (u_longlong_t)szr->count,
+	    (u_longlong_t)szr->time);
+
+	for (int b = 0; b < VDEV_L_HISTO_BUCKETS; b++) {
+		if (szr->histo[b] == 0)
+			continue;
+		off = strlen(buf);
+		if (off >= size)
+			break;
+		(void) snprintf(buf + off, size - off, " %d:%llu", b,
+		    (u_longlong_t)szr->histo[b]);
+	}
+
+	off = strlen(buf);
+	if (off < size)
+		(void) snprintf(buf + off, size - off, "\n");
+
+	return (0);
+}
+
+static void *
+spa_zio_stages_addr(kstat_t *ksp, off_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (n < 0 || (uint64_t)n >= ssh->count)
+		return (NULL);
+
+	return (&((spa_zio_stage_row_t *)ssh->_private)[n]);
+}
+
+/*
+ * Take a new snapshot on every read. The kstat can't be written.
+ */
+static int
+spa_zio_stages_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+	spa_zio_stage_histo_t *szs;
+	spa_zio_stage_row_t *szr;
+	uint64_t max = 0, n = 0;
+
+	ASSERT(MUTEX_HELD(&ssh->lock));
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	if (ssh->_private != NULL) {
+		kmem_free(ssh->_private, ssh->size);
+		ssh->_private = NULL;
+		ssh->size = 0;
+		ssh->count = 0;
+	}
+
+	for (int c = 0; c < SPA_ZIO_STAGE_CLASSES; c++) {
+		if ((szs = spa->spa_stats.zio_stage_histo[c]) == NULL)
+			continue;
+		for (int s = 0; s < ZIO_STAGE_STATS; s++)
+			if (szs->szs_count[s] != 0)
+				max++;
+	}
+
+	if (max != 0) {
+		ssh->size = max * sizeof (spa_zio_stage_row_t);
+		ssh->_private = kmem_zalloc(ssh->size, KM_SLEEP);
+	}
+
+	/* New samples may have arrived since counting, stop at max */
+	for (int c = 0; c < SPA_ZIO_STAGE_CLASSES && n < max; c++) {
+		if ((szs = spa->spa_stats.zio_stage_histo[c]) == NULL)
+			continue;
+		for (int s = 0; s < ZIO_STAGE_STATS && n < max; s++) {
+			if (szs->szs_count[s] == 0)
+				continue;
+			szr = &((spa_zio_stage_row_t *)ssh->_private)[n++];
+			szr->type = c / SPA_ZIO_STAGE_PRIOS;
+			szr->priority = c % SPA_ZIO_STAGE_PRIOS;
+			szr->stage = s;
+			szr->count = szs->szs_count[s];
+			szr->time = szs->szs_time[s];
+			bcopy(szs->szs_histo[s], szr->histo,
+			    sizeof (szr->histo));
+		}
+	}
+
+	ssh->count = n;
+	ksp->ks_ndata = n;
+	ksp->ks_data_size = n * sizeof (spa_zio_stage_row_t);
+
+	return (0);
+}
+
+static void
+spa_zio_stages_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->count = 0;
+	ssh->size = 0;
+	ssh->_private = NULL;
+
+	spa->spa_stats.zio_stage_histo = kmem_zalloc(SPA_ZIO_STAGE_CLASSES *
+	    sizeof (spa_zio_stage_histo_t *), KM_SLEEP);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "zio_stages", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zio_stages_update;
+		kstat_set_raw_ops(ksp, spa_zio_stages_headers,
+		    spa_zio_stages_data, spa_zio_stages_addr);
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_zio_stages_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.zio_stages;
+	spa_zio_stage_histo_t **szsp = spa->spa_stats.zio_stage_histo;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	for (int c = 0; c < SPA_ZIO_STAGE_CLASSES; c++) {
+		if (szsp[c] != NULL)
+			kmem_free(szsp[c], sizeof (spa_zio_stage_histo_t));
+	}
+	kmem_free(szsp, SPA_ZIO_STAGE_CLASSES *
+	    sizeof (spa_zio_stage_histo_t *));
+	spa->spa_stats.zio_stage_histo = NULL;
+
+	if (ssh->_private != NULL)
+		kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
+/*
+ * ==========================================================================
+ * SPA Log Space Map Routines
+ * ==========================================================================
+ */
+
+/*
+ * State of the log space maps and of the unflushed metaslab changes,
+ * see spa_log_spacemap.c. The flush counters are cumulative since the
+ * pool was imported; writing the kstat doesn't reset them.
+ */
+typedef struct spa_log_sm_stats {
+	kstat_named_t	log_spacemaps;
+	kstat_named_t	log_blocks;
+	kstat_named_t	log_block_limit;
+	kstat_named_t	unflushed_metaslabs;
+	kstat_named_t	unflushed_memused;
+	kstat_named_t	unflushed_memlimit;
+	kstat_named_t	flush_backlog_txgs;
+	kstat_named_t	metaslabs_flushed;
+	kstat_named_t	sm_appends_avoided;
+	kstat_named_t	flush_time_ns;
+} spa_log_sm_stats_t;
+
+static spa_log_sm_stats_t spa_log_sm_stats_template = {
+	{ "log_spacemaps",		KSTAT_DATA_UINT64 },
+	{ "log_blocks",			KSTAT_DATA_UINT64 },
+	{ "log_block_limit",		KSTAT_DATA_UINT64 },
+	{ "unflushed_metaslabs",	KSTAT_DATA_UINT64 },
+	{ "unflushed_memused",		KSTAT_DATA_UINT64 },
+	{ "unflushed_memlimit",		KSTAT_DATA_UINT64 },
+	{ "flush_backlog_txgs",		KSTAT_DATA_UINT64 },
+	{ "metaslabs_flushed",		KSTAT_DATA_UINT64 },
+	{ "sm_appends_avoided",		KSTAT_DATA_UINT64 },
+	{ "flush_time_ns",		KSTAT_DATA_UINT64 },
+};
+
+static int
+spa_log_spacemap_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_log_sm_stats_t *lss = ksp->ks_data;
+	spa_unflushed_stats_t *sus = &spa->spa_unflushed_stats;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	lss->log_spacemaps.value.ui64 =
+	    avl_numnodes(&spa->spa_sm_logs_by_txg);
+	lss->log_blocks.value.ui64 = sus->sus_nblocks;
+	lss->log_block_limit.value.ui64 = sus->sus_blocklimit;
+	lss->unflushed_metaslabs.value.ui64 =
+	    avl_numnodes(&spa->spa_metaslabs_by_flushed);
+	lss->unflushed_memused.value.ui64 = sus->sus_memused;
+	lss->unflushed_memlimit.value.ui64 = spa_log_sm_memlimit();
+	lss->flush_backlog_txgs.value.ui64 = spa_log_sm_flush_backlog(spa);
+	lss->metaslabs_flushed.value.ui64 = sus->sus_ms_flushed;
+	lss->sm_appends_avoided.value.ui64 = sus->sus_ms_logged;
+	lss->flush_time_ns.value.ui64 = sus->sus_flush_time;
+
+	return (0);
+}
+
+static void
+spa_log_spacemap_init(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.log_spacemap;
+	char name[KSTAT_STRLEN];
+	kstat_t *ksp;
+
+	mutex_init(&ssh->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	ssh->size = sizeof (spa_log_sm_stats_t);
+	ssh->_private = kmem_alloc(ssh->size, KM_SLEEP);
+	bcopy(&spa_log_sm_stats_template, ssh->_private, ssh->size);
+
+	(void) snprintf(name, KSTAT_STRLEN, "zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "log_spacemap", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (spa_log_sm_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	ssh->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &ssh->lock;
+		ksp->ks_data = ssh->_private;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_log_spacemap_update;
+		kstat_install(ksp);
+	}
+}
+
+static void
+spa_log_spacemap_destroy(spa_t *spa)
+{
+	spa_stats_history_t *ssh = &spa->spa_stats.log_spacemap;
+
+	if (ssh->kstat)
+		kstat_delete(ssh->kstat);
+
+	kmem_free(ssh->_private, ssh->size);
+	mutex_destroy(&ssh->lock);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
@@ -662,6 +1249,9 @@ spa_stats_init(spa_t *spa)
 	spa_txg_history_init(spa);
 	spa_tx_assign_init(spa);
 	spa_io_history_init(spa);
+	spa_log_spacemap_init(spa);
+	spa_vdev_latency_init(spa);
+	spa_zio_stages_init(spa);
 }
 
 void
@@ -671,4 +1261,7 @@ spa_stats_destroy(spa_t *spa)
 	spa_txg_history_destroy(spa);
 	spa_read_history_destroy(spa);
 	spa_io_history_destroy(spa);
+	spa_log_spacemap_destroy(spa);
+	spa_vdev_latency_destroy(spa);
+	spa_zio_stages_destroy(spa);
 }
@@ -44,6 +44,7 @@
 #include <sys/space_reftree.h>
 #include <sys/zio.h>
 #include <sys/zap.h>
+#include <sys/zfeature.h>
 #include <sys/fs/zfs.h>
 #include <sys/arc.h>
 #include <sys/zil.h>
@@ -52,6 +53,7 @@
 #include <sys/zfs_context.h>
 #include <sys/abd.h>
 #include <sys/vdev_initialize.h>
+#include <sys/vdev_trim.h>
 
 /*
  * Virtual device management.
@@ -169,7 +171,8 @@ vdev_dbgmsg_print_tree(vdev_t *vd, int indent)
 
 	zfs_dbgmsg("%*svdev %u: %s%s, guid: %llu, path: %s, %s", indent,
 	    "", vd->vdev_id, vd->vdev_ops->vdev_op_type,
-	    vd->vdev_islog ? " (log)" : "",
+	    vd->vdev_islog ? " (log)" :
+	    vd->vdev_alloc_bias == VDEV_BIAS_SPECIAL ? " (special)" : "",
 	    (u_longlong_t)vd->vdev_guid,
 	    vd->vdev_path ? vd->vdev_path : "N/A", state);
 
@@ -218,6 +221,51 @@ vdev_default_asize(vdev_t *vd, uint64_t psize)
 	return (asize);
 }
 
+/*
+ * Describe the data of a leaf vdev read or write as segments of its ABD,
+ * so that the backend can do the i/o in place, one request per segment.
+ * Every segment must be a whole number of sectors, as each one is sent to
+ * the device on its own. Splitting the i/o is only worth it for large,
+ * page aligned segments: many small ones cost more in requests than the
+ * copy they save, so unless the data is a single segment every segment
+ * must be at least a page long and start on a page boundary. Returns the
+ * number of segments (at most maxsegs, itself capped by zfs_vdev_max_segs),
+ * or 0 with nothing held if the i/o should be bounced through
+ * abd_borrow_buf() instead, as linear ABDs always are: borrowing those
+ * doesn't copy.
+ */
+int
+vdev_io_borrow_segs(zio_t *zio, abd_seg_t *segs, int maxsegs)
+{
+	uint64_t secsize = 1ULL << zio->io_vd->vdev_ashift;
+	int nsegs;
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
+
+	maxsegs = MIN(maxsegs, MIN(zfs_vdev_max_segs, VDEV_MAX_SEGS));
+	if (maxsegs <= 0 || abd_is_linear(zio->io_abd))
+		return (0);
+
+	nsegs = abd_borrow_segs(zio->io_abd, zio->io_size, segs, maxsegs, zio);
+
+	for (int i = 0; i < nsegs; i++) {
+		if (P2PHASE(segs[i].as_len, secsize) != 0 || (nsegs > 1 &&
+		    (segs[i].as_len < PAGESIZE ||
+		    P2PHASE((uintptr_t)segs[i].as_base, PAGESIZE) != 0))) {
+			vdev_io_return_segs(zio);
+			return (0);
+		}
+	}
+
+	return (nsegs);
+}
+
+void
+vdev_io_return_segs(zio_t *zio)
+{
+	abd_return_segs(zio->io_abd, zio->io_size, zio);
+}
+
 /*
  * Get the minimum allocatable size. We define the allocatable size as
  * the vdev's asize rounded to the nearest metaslab. This allows us to
@@ -475,10 +523,17 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	mutex_init(&vd->vdev_stat_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_probe_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_queue_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_scan_io_queue_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_initialize_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&vd->vdev_initialize_io_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&vd->vdev_initialize_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&vd->vdev_initialize_io_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&vd->vdev_trim_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_autotrim_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&vd->vdev_trim_io_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_trim_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&vd->vdev_autotrim_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&vd->vdev_trim_io_cv, NULL, CV_DEFAULT, NULL);
 
 	for (int t = 0; t < DTL_TYPES; t++) {
 		vd->vdev_dtl[t] = range_tree_create(NULL, NULL);
@@ -504,10 +559,11 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
     int alloctype)
 {
 	vdev_ops_t *ops;
-	char *type;
+	char *type, *bias;
 	uint64_t guid = 0, islog, nparity;
 	vdev_t *vd;
 	vdev_indirect_config_t *vic;
+	vdev_alloc_bias_t alloc_bias = VDEV_BIAS_NONE;
 
 	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
 
@@ -558,6 +614,26 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (ops == &vdev_hole_ops && spa_version(spa) < SPA_VERSION_HOLES)
 		return (SET_ERROR(ENOTSUP));
 
+	/*
+	 * Determine the allocation class of a top-level vdev.
+	 */
+	if (parent && !parent->vdev_parent && alloctype != VDEV_ALLOC_ATTACH &&
+	    nvlist_lookup_string(nv, ZPOOL_CONFIG_ALLOCATION_BIAS,
+	    &bias) == 0) {
+		if (islog || strcmp(bias, VDEV_ALLOC_BIAS_SPECIAL) != 0)
+			return (SET_ERROR(EINVAL));
+		/*
+		 * spa_create() checks the feature for a new pool, a device
+		 * added later needs it to be enabled already.
+		 */
+		if (alloctype == VDEV_ALLOC_ADD &&
+		    spa->spa_load_state != SPA_LOAD_CREATE &&
+		    !spa_feature_is_enabled(spa,
+		    SPA_FEATURE_ALLOCATION_CLASSES))
+			return (SET_ERROR(ENOTSUP));
+		alloc_bias = VDEV_BIAS_SPECIAL;
+	}
+
 	/*
 	 * Set the nparity property for RAID-Z vdevs.
 	 */
@@ -598,6 +674,7 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	vic = &vd->vdev_indirect_config;
 
 	vd->vdev_islog = islog;
+	vd->vdev_alloc_bias = alloc_bias;
 	vd->vdev_nparity = nparity;
 
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
@@ -670,8 +747,15 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		    alloctype == VDEV_ALLOC_ADD ||
 		    alloctype == VDEV_ALLOC_SPLIT ||
 		    alloctype == VDEV_ALLOC_ROOTPOOL);
-		vd->vdev_mg = metaslab_group_create(islog ?
-		    spa_log_class(spa) : spa_normal_class(spa), vd,
+		metaslab_class_t *mc;
+
+		if (islog)
+			mc = spa_log_class(spa);
+		else if (alloc_bias == VDEV_BIAS_SPECIAL)
+			mc = spa_special_class(spa);
+		else
+			mc = spa_normal_class(spa);
+		vd->vdev_mg = metaslab_group_create(mc, vd,
 		    spa->spa_alloc_count);
 	}
 
@@ -754,6 +838,8 @@ vdev_free(vdev_t *vd)
 	int c, t;
 	spa_t *spa = vd->vdev_spa;
 	ASSERT3P(vd->vdev_initialize_thread, ==, NULL);
+	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
+	ASSERT3P(vd->vdev_autotrim_thread, ==, NULL);
 
 	/*
 	 * vdev_free() implies closing the vdev first.  This is simpler than
@@ -787,6 +873,16 @@ vdev_free(vdev_t *vd)
 	ASSERT0(vd->vdev_stat.vs_dspace);
 	ASSERT0(vd->vdev_stat.vs_alloc);
 
+	/*
+	 * Drop any scrub I/Os still sorted for this vdev.
+	 */
+	mutex_enter(&vd->vdev_scan_io_queue_lock);
+	if (vd->vdev_scan_io_queue != NULL) {
+		dsl_scan_io_queue_destroy(vd->vdev_scan_io_queue);
+		vd->vdev_scan_io_queue = NULL;
+	}
+	mutex_exit(&vd->vdev_scan_io_queue_lock);
+
 	/*
 	 * Remove this vdev from its parent's child list.
 	 */
@@ -843,6 +939,7 @@ vdev_free(vdev_t *vd)
 	mutex_destroy(&vd->vdev_obsolete_lock);
 
 	mutex_destroy(&vd->vdev_queue_lock);
+	mutex_destroy(&vd->vdev_scan_io_queue_lock);
 	mutex_destroy(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_stat_lock);
 	mutex_destroy(&vd->vdev_probe_lock);
@@ -850,6 +947,12 @@ vdev_free(vdev_t *vd)
 	mutex_destroy(&vd->vdev_initialize_io_lock);
 	cv_destroy(&vd->vdev_initialize_io_cv);
 	cv_destroy(&vd->vdev_initialize_cv);
+	mutex_destroy(&vd->vdev_trim_lock);
+	mutex_destroy(&vd->vdev_autotrim_lock);
+	mutex_destroy(&vd->vdev_trim_io_lock);
+	cv_destroy(&vd->vdev_trim_cv);
+	cv_destroy(&vd->vdev_autotrim_cv);
+	cv_destroy(&vd->vdev_trim_io_cv);
 
 	if (vd == spa->spa_root_vdev)
 		spa->spa_root_vdev = NULL;
@@ -895,6 +998,8 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 	tvd->vdev_checkpoint_sm = svd->vdev_checkpoint_sm;
 	svd->vdev_checkpoint_sm = NULL;
 
+	dsl_scan_io_queue_vdev_xfer(svd, tvd);
+
 	tvd->vdev_stat.vs_alloc = svd->vdev_stat.vs_alloc;
 	tvd->vdev_stat.vs_space = svd->vdev_stat.vs_space;
 	tvd->vdev_stat.vs_dspace = svd->vdev_stat.vs_dspace;
@@ -953,6 +1058,9 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
+
+	tvd->vdev_alloc_bias = svd->vdev_alloc_bias;
+	svd->vdev_alloc_bias = VDEV_BIAS_NONE;
 }
 
 static void
@@ -1369,6 +1477,8 @@ vdev_open_children(vdev_t *vd)
 	int c;
 
 	vd->vdev_nonrot = B_TRUE;
+	vd->vdev_has_trim = B_TRUE;
+	vd->vdev_has_securetrim = B_TRUE;
 
 	/*
 	 * in order to handle pools on top of zvols, do the opens
@@ -1380,6 +1490,9 @@ vdev_open_children(vdev_t *vd)
 			vd->vdev_child[c]->vdev_open_error =
 			    vdev_open(vd->vdev_child[c]);
 			vd->vdev_nonrot &= vd->vdev_child[c]->vdev_nonrot;
+			vd->vdev_has_trim &= vd->vdev_child[c]->vdev_has_trim;
+			vd->vdev_has_securetrim &=
+			    vd->vdev_child[c]->vdev_has_securetrim;
 		}
 		return;
 	}
@@ -1392,8 +1505,12 @@ vdev_open_children(vdev_t *vd)
 
 	taskq_destroy(tq);
 
-	for (c = 0; c < children; c++)
+	for (c = 0; c < children; c++) {
 		vd->vdev_nonrot &= vd->vdev_child[c]->vdev_nonrot;
+		vd->vdev_has_trim &= vd->vdev_child[c]->vdev_has_trim;
+		vd->vdev_has_securetrim &=
+		    vd->vdev_child[c]->vdev_has_securetrim;
+	}
 }
 
 /*
@@ -1613,7 +1730,8 @@ vdev_open(vdev_t *vd)
 	 * Track the min and max ashift values for normal data devices.
 	 */
 	if (vd->vdev_top == vd && vd->vdev_ashift != 0 &&
-	    !vd->vdev_islog && vd->vdev_aux == NULL) {
+	    !vd->vdev_islog && vd->vdev_alloc_bias == VDEV_BIAS_NONE &&
+	    vd->vdev_aux == NULL) {
 		if (vd->vdev_ashift > spa->spa_max_ashift)
 			spa->spa_max_ashift = vd->vdev_ashift;
 		if (vd->vdev_ashift < spa->spa_min_ashift)
@@ -2507,6 +2625,23 @@ vdev_create_link_zap(vdev_t *vd, dmu_tx_t *tx)
 	return (zap);
 }
 
+/*
+ * Record the allocation class of a new top-level vdev in its ZAP, which
+ * also activates the allocation_classes feature for it.
+ */
+static void
+vdev_zap_allocation_data(vdev_t *vd, dmu_tx_t *tx)
+{
+	spa_t *spa = vd->vdev_spa;
+	const char *string = VDEV_ALLOC_BIAS_SPECIAL;
+
+	ASSERT3U(vd->vdev_alloc_bias, ==, VDEV_BIAS_SPECIAL);
+
+	VERIFY0(zap_add(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_ALLOCATION_BIAS, 1, strlen(string) + 1, string, tx));
+	spa_feature_incr(spa, SPA_FEATURE_ALLOCATION_CLASSES, tx);
+}
+
 void
 vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 {
@@ -2519,6 +2654,8 @@ vdev_construct_zaps(vdev_t *vd, dmu_tx_t *tx)
 		}
 		if (vd == vd->vdev_top && vd->vdev_top_zap == 0) {
 			vd->vdev_top_zap = vdev_create_link_zap(vd, tx);
+			if (vd->vdev_alloc_bias != VDEV_BIAS_NONE)
+				vdev_zap_allocation_data(vd, tx);
 		}
 	}
 	for (uint64_t i = 0; i < vd->vdev_children; i++) {
@@ -2849,10 +2986,24 @@ vdev_validate_aux(vdev_t *vd)
 void
 vdev_destroy_spacemaps(vdev_t *vd, dmu_tx_t *tx)
 {
+	objset_t *mos = vd->vdev_spa->spa_meta_objset;
+	uint64_t object;
+
+	/*
+	 * Destroy the unflushed txgs of the metaslabs; any entries left in
+	 * the log space maps for this vdev are skipped at import.
+	 */
+	if (vd->vdev_top_zap != 0 && zap_lookup(mos, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, sizeof (uint64_t), 1,
+	    &object) == 0) {
+		VERIFY0(dmu_object_free(mos, object, tx));
+		VERIFY0(zap_remove(mos, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_MS_UNFLUSHED_PHYS_TXGS, tx));
+	}
+
 	if (vd->vdev_ms_array == 0)
 		return;
 
-	objset_t *mos = vd->vdev_spa->spa_meta_objset;
 	uint64_t array_count = vd->vdev_asize >> vd->vdev_ms_shift;
 	size_t array_bytes = array_count * sizeof (uint64_t);
 	uint64_t *smobj_array = kmem_alloc(array_bytes, KM_SLEEP);
@@ -2904,7 +3055,8 @@ vdev_remove_empty(vdev_t *vd, uint64_t txg)
 			 */
 			metaslab_group_histogram_remove(mg, msp);
 
-			VERIFY0(space_map_allocated(msp->ms_sm));
+			VERIFY0(metaslab_allocated_space(msp));
+			metaslab_unflushed_forget(msp);
 			space_map_close(msp->ms_sm);
 			msp->ms_sm = NULL;
 			mutex_exit(&msp->ms_lock);
@@ -3176,6 +3328,16 @@ vdev_online(spa_t *spa, uint64_t guid, uint64_t flags, vdev_state_t *newstate)
 	}
 	mutex_exit(&vd->vdev_initialize_lock);
 
+	/* Restart trimming if necessary */
+	mutex_enter(&vd->vdev_trim_lock);
+	if (vdev_writeable(vd) &&
+	    vd->vdev_trim_thread == NULL &&
+	    vd->vdev_trim_state == VDEV_TRIM_ACTIVE) {
+		(void) vdev_trim(vd, vd->vdev_trim_rate, vd->vdev_trim_partial,
+		    vd->vdev_trim_secure);
+	}
+	mutex_exit(&vd->vdev_trim_lock);
+
 	if (wasoffline ||
 	    (oldstate < VDEV_STATE_DEGRADED &&
 	    vd->vdev_state >= VDEV_STATE_DEGRADED))
@@ -3441,7 +3603,7 @@ static void
 vdev_get_child_stat(vdev_t *cvd, vdev_stat_t *vs, vdev_stat_t *cvs)
 {
 	int t;
-	for (t = 0; t < ZIO_TYPES; t++) {
+	for (t = 0; t < VS_ZIO_TYPES; t++) {
 		vs->vs_ops[t] += cvs->vs_ops[t];
 		vs->vs_bytes[t] += cvs->vs_bytes[t];
 	}
@@ -3473,7 +3635,7 @@ static void
 vdev_get_child_stat_ex(vdev_t *cvd, vdev_stat_ex_t *vsx, vdev_stat_ex_t *cvsx)
 {
 	int t, b;
-	for (t = 0; t < ZIO_TYPES; t++) {
+	for (t = 0; t < VS_ZIO_TYPES; t++) {
 		for (b = 0; b < ARRAY_SIZE(vsx->vsx_disk_histo[0]); b++)
 			vsx->vsx_disk_histo[t][b] += cvsx->vsx_disk_histo[t][b];
 
@@ -3571,6 +3733,16 @@ vdev_get_stats_ex(vdev_t *vd, vdev_stat_t *vs, vdev_stat_ex_t *vsx)
 			vs->vs_initialize_bytes_est = vd->vdev_initialize_bytes_est;
 			vs->vs_initialize_state = vd->vdev_initialize_state;
 			vs->vs_initialize_action_time = vd->vdev_initialize_action_time;
+
+			/*
+			 * Report manual TRIM progress. Like initializing
+			 * this is an estimate since the trim locks aren't held.
+			 */
+			vs->vs_trim_notsup = !vd->vdev_has_trim;
+			vs->vs_trim_bytes_done = vd->vdev_trim_bytes_done;
+			vs->vs_trim_bytes_est = vd->vdev_trim_bytes_est;
+			vs->vs_trim_state = vd->vdev_trim_state;
+			vs->vs_trim_action_time = vd->vdev_trim_action_time;
        }
 		/*
 		 * Report expandable space on top-level, non-auxillary devices only.
@@ -3688,9 +3860,16 @@ vdev_stat_update(zio_t *zio, uint64_t psize)
 		 * aggregated into the higher level vdevs in vdev_get_stats().
 		 */
 		if (vd->vdev_ops->vdev_op_leaf) {
+			/*
+			 * TRIM ops and bytes are reported to user space as
+			 * ZIO_TYPE_IOCTL to preserve the vdev_stat_t layout.
+			 */
+			zio_type_t vs_type = type;
+			if (type == ZIO_TYPE_TRIM)
+				vs_type = ZIO_TYPE_IOCTL;
 
-			vs->vs_ops[type]++;
-			vs->vs_bytes[type] += psize;
+			vs->vs_ops[vs_type]++;
+			vs->vs_bytes[vs_type] += psize;
 
 			if (flags & ZIO_FLAG_DELEGATED) {
 				vsx->vsx_agg_histo[zio->io_priority]
@@ -3703,9 +3882,9 @@ vdev_stat_update(zio_t *zio, uint64_t psize)
 			if (zio->io_delta && zio->io_delay) {
 				vsx->vsx_queue_histo[zio->io_priority]
 				    [L_HISTO(zio->io_delta - zio->io_delay)]++;
-				vsx->vsx_disk_histo[type]
+				vsx->vsx_disk_histo[vs_type]
 				    [L_HISTO(zio->io_delay)]++;
-				vsx->vsx_total_histo[type]
+				vsx->vsx_total_histo[vs_type]
 				    [L_HISTO(zio->io_delta)]++;
 			}
 		}
@@ -3744,6 +3923,8 @@ vdev_stat_update(zio_t *zio, uint64_t psize)
 	}
 	if (type == ZIO_TYPE_WRITE && !vdev_is_dead(vd))
 		vs->vs_write_errors++;
+	if (type == ZIO_TYPE_TRIM && !vdev_is_dead(vd))
+		vs->vs_trim_errors++;
 	mutex_exit(&vd->vdev_stat_lock);
 
 	if (spa->spa_load_state == SPA_LOAD_NONE &&
@@ -3822,7 +4003,8 @@ vdev_space_update(vdev_t *vd, int64_t alloc_delta, int64_t defer_delta,
 	vd->vdev_stat.vs_dspace += dspace_delta;
 	mutex_exit(&vd->vdev_stat_lock);
 
-	if (mc == spa_normal_class(spa)) {
+	/* every class but log contributes to root space stats */
+	if (mc == spa_normal_class(spa) || mc == spa_special_class(spa)) {
 		mutex_enter(&rvd->vdev_stat_lock);
 		rvd->vdev_stat.vs_alloc += alloc_delta;
 		rvd->vdev_stat.vs_space += space_delta;
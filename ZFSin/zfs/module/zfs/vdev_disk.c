@@ -41,6 +41,8 @@
 #undef dprintf
 #define dprintf
 
+/* runs the synchronous TRIM requests, see vdev_disk_io_trim() */
+static taskq_t *vdev_disk_taskq;
 
 static void vdev_disk_close(vdev_t *);
 
@@ -380,6 +382,14 @@ skip_open:
 
 	/* Inform the ZIO pipeline that we are non-rotational */
 	vd->vdev_nonrot = B_FALSE;
+
+	/*
+	 * Assume the device accepts TRIM; the first TRIM to fail with
+	 * ENOTSUP clears this again in zio_vdev_io_assess(). The DSM
+	 * interface has no secure erase variant.
+	 */
+	vd->vdev_has_trim = B_TRUE;
+	vd->vdev_has_securetrim = B_FALSE;
 //	if (ldi_ioctl(dvd->vd_lh, DKIOCISSOLIDSTATE, (intptr_t)&isssd,
 //		FKIOCTL, kcred, NULL) == 0) {
 //		vd->vdev_nonrot = (isssd ? B_TRUE : B_FALSE);
@@ -445,14 +455,35 @@ vdev_disk_physio(vdev_t *vd, caddr_t data,
 }
 
 
+/*
+ * One IRP: for the whole i/o when it goes through a bounce buffer,
+ * otherwise for one segment of the ABD (see vdev_io_borrow_segs()).
+ */
+typedef struct vdev_disk_seg {
+	struct vdev_disk_callback_struct *vs_cb;
+	PIRP vs_irp;
+	IO_STATUS_BLOCK vs_iosb;
+} vd_seg_t;
+
+/*
+ * The buffers the segments cover follow vb_segs[] in vb_bufs[].
+ */
 struct vdev_disk_callback_struct {
 	KEVENT Event;
 	zio_t *zio;
-	PIRP irp;
-	void *b_addr;
+	void *b_addr;			/* bounce buffer, NULL if in place */
+	abd_seg_t *vb_bufs;
+	int vb_maxsegs;			/* allocated size of the arrays */
+	int vb_nsegs;
+	uint32_t vb_pending;		/* IRPs still in flight */
+	int vb_error;
+	vd_seg_t vb_segs[];
 };
 typedef struct vdev_disk_callback_struct vd_callback_t;
 
+#define	VD_CALLBACK_SIZE(n)	\
+	(offsetof(vd_callback_t, vb_segs[n]) + (n) * sizeof (abd_seg_t))
+
 
 /*
 * IO has finished callback, in Windows this is called as a different
@@ -464,9 +495,8 @@ vdev_disk_io_intr(void *Context)
 {
 	vd_callback_t *vb = (vd_callback_t *)Context;
 	zio_t *zio = vb->zio;
-	PIRP irp = vb->irp;
 
-	// Wait for IoCompletionRoutine to have been called.
+	// Wait for IoCompletionRoutine to have been called for every IRP.
 	KeWaitForSingleObject(&vb->Event, Executive, KernelMode, FALSE, NULL); // SYNC
 
 	dprintf("%s: done\n", __func__);
@@ -480,24 +510,19 @@ vdev_disk_io_intr(void *Context)
 
 //	if (zio->io_error == 0 && bp->b_resid != 0)
 //		zio->io_error = SET_ERROR(EIO);
-	zio->io_error = (irp->IoStatus.Status != 0 ? EIO : 0);
+	zio->io_error = vb->vb_error;
 
-	if (zio->io_type == ZIO_TYPE_READ) {
-		VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
-		abd_return_buf_copy_off(zio->io_abd, vb->b_addr,
-			0, zio->io_size, zio->io_abd->abd_size);
-	} else {
-		VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
-		abd_return_buf_off(zio->io_abd, vb->b_addr,
-			0, zio->io_size, zio->io_abd->abd_size);
-	}
+	for (int i = 0; i < vb->vb_nsegs; i++) {
+		PIRP irp = vb->vb_segs[i].vs_irp;
 
-	if (irp->IoStatus.Information != zio->io_size)
-		dprintf("%s: size mismatch 0x%llx != 0x%llx\n",
-			irp->IoStatus.Information, zio->io_size);
+		if (irp == NULL)
+			continue;
 
-	// Release irp
-	if (irp) {
+		if (irp->IoStatus.Information != vb->vb_bufs[i].as_len)
+			dprintf("%s: size mismatch 0x%llx != 0x%llx\n", __func__,
+				irp->IoStatus.Information, vb->vb_bufs[i].as_len);
+
+		// Release irp
 		while (irp->MdlAddress != NULL) {
 			PMDL NextMdl;
 			NextMdl = irp->MdlAddress->Next;
@@ -506,10 +531,22 @@ vdev_disk_io_intr(void *Context)
 			irp->MdlAddress = NextMdl;
 		}
 		IoFreeIrp(irp);
+		vb->vb_segs[i].vs_irp = NULL;
 	}
-	irp = NULL;
 
-	kmem_free(vb, sizeof(vd_callback_t));
+	if (vb->b_addr == NULL) {
+		vdev_io_return_segs(zio);
+	} else if (zio->io_type == ZIO_TYPE_READ) {
+		VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
+		abd_return_buf_copy_off(zio->io_abd, vb->b_addr,
+			0, zio->io_size, zio->io_abd->abd_size);
+	} else {
+		VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
+		abd_return_buf_off(zio->io_abd, vb->b_addr,
+			0, zio->io_size, zio->io_abd->abd_size);
+	}
+
+	kmem_free(vb, VD_CALLBACK_SIZE(vb->vb_maxsegs));
 	vb = NULL;
 
 	zio_delay_interrupt(zio);
@@ -517,15 +554,79 @@ vdev_disk_io_intr(void *Context)
 	thread_exit();
 }
 
+typedef struct vdev_disk_trim_req {
+	DEVICE_MANAGE_DATA_SET_ATTRIBUTES dsm;
+	DEVICE_DATA_SET_RANGE range;
+} vdev_disk_trim_req_t;
+
+/*
+ * Issue a TRIM as a data set management request covering the zio range.
+ * The request is synchronous, so it runs from vdev_disk_taskq rather than
+ * the issuing thread; the taskq also bounds how many are waiting at once.
+ */
+static void
+vdev_disk_io_trim(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_t *vd = zio->io_vd;
+	vdev_disk_t *dvd = vd->vdev_tsd;
+	vdev_disk_trim_req_t req;
+	IO_STATUS_BLOCK iosb;
+	KEVENT event;
+	PIRP irp;
+	NTSTATUS status;
+
+	bzero(&req, sizeof (req));
+	req.dsm.Size = sizeof (req.dsm);
+	req.dsm.Action = DeviceDsmAction_Trim;
+	req.dsm.Flags = DEVICE_DSM_FLAG_TRIM_NOT_FS_ALLOCATED;
+	req.dsm.DataSetRangesOffset = offsetof(vdev_disk_trim_req_t, range);
+	req.dsm.DataSetRangesLength = sizeof (req.range);
+	req.range.StartingOffset = zio->io_offset + vd->vdev_win_offset;
+	req.range.LengthInBytes = zio->io_size;
+
+	KeInitializeEvent(&event, NotificationEvent, FALSE);
+	irp = IoBuildDeviceIoControlRequest(
+	    IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES, dvd->vd_DeviceObject,
+	    &req, sizeof (req), NULL, 0, FALSE, &event, &iosb);
+
+	if (irp == NULL) {
+		zio->io_error = SET_ERROR(EIO);
+	} else {
+		IoGetNextIrpStackLocation(irp)->FileObject =
+		    dvd->vd_FileObject;
+		status = IoCallDriver(dvd->vd_DeviceObject, irp);
+		if (status == STATUS_PENDING) {
+			KeWaitForSingleObject(&event, Executive, KernelMode,
+			    FALSE, NULL);
+			status = iosb.Status;
+		}
+
+		if (status == STATUS_INVALID_DEVICE_REQUEST ||
+		    status == STATUS_NOT_SUPPORTED)
+			zio->io_error = SET_ERROR(ENOTSUP);
+		else
+			zio->io_error = (status != STATUS_SUCCESS ? EIO : 0);
+	}
+
+	zio_interrupt(zio);
+}
+
 IO_COMPLETION_ROUTINE vdev_disk_io_intrxxx;
 
 static NTSTATUS
 vdev_disk_io_intrxxx(PDEVICE_OBJECT DeviceObject, PIRP irp, PVOID Context)
 {
-	KEVENT *kevent = Context;
+	vd_seg_t *vs = Context;
+	vd_callback_t *vb = vs->vs_cb;
 
 	dprintf("%s: event\n", __func__);
-	KeSetEvent(kevent, 0, FALSE);
+	if (irp->IoStatus.Status != STATUS_SUCCESS)
+		vb->vb_error = EIO;
+
+	// Only the last IRP of the i/o wakes up vdev_disk_io_intr()
+	if (atomic_dec_32_nv(&vb->vb_pending) == 0)
+		KeSetEvent(&vb->Event, 0, FALSE);
 	return STATUS_MORE_PROCESSING_REQUIRED;
 }
 
@@ -623,6 +724,17 @@ vdev_disk_io_start(zio_t *zio)
 		zio_execute(zio);
 		return;
 
+	case ZIO_TYPE_TRIM:
+		if (!vdev_writeable(vd)) {
+			zio->io_error = SET_ERROR(ENXIO);
+			zio_interrupt(zio);
+			return;
+		}
+
+		VERIFY3U(taskq_dispatch(vdev_disk_taskq, vdev_disk_io_trim,
+		    zio, TQ_SLEEP), !=, 0);
+		return;
+
 	case ZIO_TYPE_WRITE:
 		if (zio->io_priority == ZIO_PRIORITY_SYNC_WRITE)
 			flags = B_WRITE;
@@ -668,69 +780,90 @@ vdev_disk_io_start(zio_t *zio)
 	PIO_STACK_LOCATION irpStack = NULL;
 	//KEVENT completionEvent;
 
-	IO_STATUS_BLOCK IoStatusBlock;
 	LARGE_INTEGER offset;
+	int maxsegs = MIN(zfs_vdev_max_segs, VDEV_MAX_SEGS);
 
 	offset.QuadPart = zio->io_offset + vd->vdev_win_offset;
 
-	vd_callback_t *vb = (vd_callback_t *)kmem_alloc(sizeof(vd_callback_t), KM_SLEEP);
+	/*
+	 * Read or write the ABD's chunks in place, one IRP per segment, if
+	 * it allows; otherwise go through a contiguous buffer.
+	 */
+	maxsegs = MAX(maxsegs, 1);
+	vd_callback_t *vb = (vd_callback_t *)kmem_zalloc(VD_CALLBACK_SIZE(maxsegs), KM_SLEEP);
+	vb->vb_bufs = (abd_seg_t *)&vb->vb_segs[maxsegs];
+	vb->vb_maxsegs = maxsegs;
 	vb->zio = zio;
-	if (zio->io_type == ZIO_TYPE_READ) {
-		ASSERT3S(zio->io_abd->abd_size, >= , zio->io_size);
-		vb->b_addr =
-			abd_borrow_buf(zio->io_abd, zio->io_abd->abd_size);
-	} else {
-		vb->b_addr =
-			abd_borrow_buf_copy(zio->io_abd, zio->io_abd->abd_size);
+	vb->vb_nsegs = vdev_io_borrow_segs(zio, vb->vb_bufs, maxsegs);
+	if (vb->vb_nsegs == 0) {
+		if (zio->io_type == ZIO_TYPE_READ) {
+			ASSERT3S(zio->io_abd->abd_size, >= , zio->io_size);
+			vb->b_addr =
+				abd_borrow_buf(zio->io_abd, zio->io_abd->abd_size);
+		} else {
+			vb->b_addr =
+				abd_borrow_buf_copy(zio->io_abd, zio->io_abd->abd_size);
+		}
+		vb->vb_bufs[0].as_base = vb->b_addr;
+		vb->vb_bufs[0].as_len = zio->io_size;
+		vb->vb_nsegs = 1;
 	}
 	KeInitializeEvent(&vb->Event, NotificationEvent, FALSE);
 
-	if (flags & B_READ) {
-		irp = IoBuildAsynchronousFsdRequest(IRP_MJ_READ,
-			dvd->vd_DeviceObject,
-			vb->b_addr,
-			(ULONG)zio->io_size,
-			&offset,
-			&IoStatusBlock);
-	} else {
-			irp = IoBuildAsynchronousFsdRequest(IRP_MJ_WRITE,
+	/*
+	 * The extra count is dropped once every IRP has been sent, so the
+	 * event can't fire while we are still issuing.
+	 */
+	vb->vb_pending = vb->vb_nsegs + 1;
+
+	// Start a thread to wait for IO completion, which is signalled
+	// by CompletionRouting setting event.
+	(void)thread_create(NULL, 0, vdev_disk_io_intr, vb, 0, &p0,
+		TS_RUN, minclsyspri);
+
+	for (int i = 0; i < vb->vb_nsegs; i++) {
+		vd_seg_t *vs = &vb->vb_segs[i];
+
+		vs->vs_cb = vb;
+
+		irp = IoBuildAsynchronousFsdRequest(
+			(flags & B_READ) ? IRP_MJ_READ : IRP_MJ_WRITE,
 			dvd->vd_DeviceObject,
-			vb->b_addr,
-			(ULONG)zio->io_size,
+			vb->vb_bufs[i].as_base,
+			(ULONG)vb->vb_bufs[i].as_len,
 			&offset,
-			&IoStatusBlock);
-	}
-	
-	if (!irp) {
-		kmem_free(vb, sizeof(vd_callback_t));
-		zio->io_error = EIO;
-		zio_interrupt(zio);
-		return;
-	}
+			&vs->vs_iosb);
+		offset.QuadPart += vb->vb_bufs[i].as_len;
+
+		if (!irp) {
+			vb->vb_error = EIO;
+			if (atomic_dec_32_nv(&vb->vb_pending) == 0)
+				KeSetEvent(&vb->Event, 0, FALSE);
+			continue;
+		}
 
-	vb->irp = irp;
+		vs->vs_irp = irp;
 
-	irpStack = IoGetNextIrpStackLocation(irp);
-	if (irpStack == 0xffffffffffffffff)
-		panic("%s: bad irpStack\n", __func__);
+		irpStack = IoGetNextIrpStackLocation(irp);
+		if (irpStack == 0xffffffffffffffff)
+			panic("%s: bad irpStack\n", __func__);
 
-	irpStack->Flags |= SL_OVERRIDE_VERIFY_VOLUME; // SetFlag(IoStackLocation->Flags, SL_OVERRIDE_VERIFY_VOLUME);
-												  //SetFlag(ReadIrp->Flags, IRP_NOCACHE);
-	irpStack->FileObject = dvd->vd_FileObject;
+		irpStack->Flags |= SL_OVERRIDE_VERIFY_VOLUME; // SetFlag(IoStackLocation->Flags, SL_OVERRIDE_VERIFY_VOLUME);
+													  //SetFlag(ReadIrp->Flags, IRP_NOCACHE);
+		irpStack->FileObject = dvd->vd_FileObject;
 
-	IoSetCompletionRoutine(irp,
-		vdev_disk_io_intrxxx,
-		&vb->Event, // "Context" in vdev_disk_io_intr()
-		TRUE, // On Success
-		TRUE, // On Error
-		TRUE);// On Cancel
+		IoSetCompletionRoutine(irp,
+			vdev_disk_io_intrxxx,
+			vs, // "Context" in vdev_disk_io_intrxxx()
+			TRUE, // On Success
+			TRUE, // On Error
+			TRUE);// On Cancel
 
-	// Start a thread to wait for IO completion, which is signalled
-	// by CompletionRouting setting event.
-	(void)thread_create(NULL, 0, vdev_disk_io_intr, vb, 0, &p0,
-		TS_RUN, minclsyspri);
+		status = IoCallDriver(dvd->vd_DeviceObject, irp);
+	}
 
-	status = IoCallDriver(dvd->vd_DeviceObject, irp);
+	if (atomic_dec_32_nv(&vb->vb_pending) == 0)
+		KeSetEvent(&vb->Event, 0, FALSE);
 
 	//dprintf("%s: IoCallDriver %d\n", __func__, status);
 
@@ -830,6 +963,21 @@ vdev_ops_t vdev_disk_ops = {
 	B_TRUE			/* leaf vdev */
 };
 
+void
+vdev_disk_init(void)
+{
+	vdev_disk_taskq = taskq_create("vdev_disk_taskq", 100, minclsyspri,
+	    max_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_THREADS_CPU_PCT);
+
+	VERIFY(vdev_disk_taskq);
+}
+
+void
+vdev_disk_fini(void)
+{
+	taskq_destroy(vdev_disk_taskq);
+}
+
 /*
  * Given the root disk device devid or pathname, read the label from
  * the device, and construct a configuration nvlist.
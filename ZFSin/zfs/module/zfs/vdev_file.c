@@ -51,6 +51,299 @@ vdev_file_rele(vdev_t *vd)
 	ASSERT(vd->vdev_path != NULL);
 }
 
+/*
+ * One request to the backend: the whole i/o when it goes through a bounce
+ * buffer, otherwise one segment of the ABD (see vdev_io_borrow_segs()).
+ */
+typedef struct vdev_file_seg {
+	struct vdev_file_callback_struct *vs_cb;
+#ifdef _KERNEL
+	PIRP vs_irp;
+	IO_STATUS_BLOCK vs_iosb;
+#else
+	OVERLAPPED vs_overlapped;
+#endif
+} vf_seg_t;
+
+/*
+ * Per-i/o state, from vdev_file_io_start() until the zio is handed back.
+ * Any number of these may be outstanding on a vdev at once; the depth is
+ * bounded only by the vdev queue (zfs_vdev_max_active). The buffers the
+ * segments read into or write from follow vb_segs[] in vb_bufs[].
+ */
+struct vdev_file_callback_struct {
+	vdev_file_t *vb_vf;
+	zio_t *zio;
+	void *b_data;			/* bounce buffer, NULL if in place */
+	abd_seg_t *vb_bufs;
+	int vb_maxsegs;			/* allocated size of the arrays */
+	int vb_nsegs;
+	uint32_t vb_pending;		/* segments still in flight */
+	int vb_error;
+#ifdef _KERNEL
+	struct vdev_file_callback_struct *vb_next;	/* on vf_done_list */
+#endif
+	vf_seg_t vb_segs[];
+};
+typedef struct vdev_file_callback_struct vf_callback_t;
+
+#define	VF_CALLBACK_SIZE(n)	\
+	(offsetof(vf_callback_t, vb_segs[n]) + (n) * sizeof (abd_seg_t))
+
+static vf_callback_t *
+vdev_file_cb_alloc(vdev_file_t *vf, zio_t *zio, int maxsegs)
+{
+	vf_callback_t *vb;
+
+	vb = kmem_zalloc(VF_CALLBACK_SIZE(maxsegs), KM_SLEEP);
+	vb->vb_bufs = (abd_seg_t *)&vb->vb_segs[maxsegs];
+	vb->vb_maxsegs = maxsegs;
+	vb->vb_vf = vf;
+	vb->zio = zio;
+
+	return (vb);
+}
+
+/*
+ * Return the ABD's chunks or the bounce buffer to the zio and hand the
+ * zio back to the pipeline.
+ */
+static void
+vdev_file_io_finish(vf_callback_t *vb)
+{
+	zio_t *zio = vb->zio;
+	vdev_file_t *vf = vb->vb_vf;
+
+	/*
+	 * The rest of the zio stack only deals with EIO, ECKSUM, and ENXIO.
+	 * Rather than teach the rest of the stack about other error
+	 * possibilities (EFAULT, etc), the completions normalize vb_error.
+	 */
+	zio->io_error = vb->vb_error;
+	if (vb->b_data == NULL) {
+		vdev_io_return_segs(zio);
+	} else if (zio->io_type == ZIO_TYPE_READ) {
+		if (zio->io_abd->abd_size == zio->io_size) {
+			abd_return_buf_copy(zio->io_abd, vb->b_data, zio->io_size);
+		} else {
+			VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
+			abd_return_buf_copy_off(zio->io_abd, vb->b_data,
+				0, zio->io_size, zio->io_abd->abd_size);
+		}
+	} else {
+		VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
+		abd_return_buf_off(zio->io_abd, vb->b_data, 0, zio->io_size, zio->io_abd->abd_size);
+	}
+
+	kmem_free(vb, VF_CALLBACK_SIZE(vb->vb_maxsegs));
+	atomic_dec_64(&vf->vf_inflight);
+
+	zio_delay_interrupt(zio);
+}
+
+#ifdef _KERNEL
+/*
+ * IRP completion routine. This runs at DISPATCH_LEVEL, where we can
+ * neither block nor call into the zio pipeline, so just queue the i/o
+ * for the vdev's completion thread.
+ */
+static NTSTATUS
+vdev_file_io_intrxxx(PDEVICE_OBJECT DeviceObject, PIRP irp, PVOID Context)
+{
+	vf_seg_t *vs = Context;
+	vf_callback_t *vb = vs->vs_cb;
+	vdev_file_t *vf = vb->vb_vf;
+	KIRQL irql;
+
+	if (irp->IoStatus.Status != STATUS_SUCCESS)
+		vb->vb_error = EIO;
+
+	/* The last segment in queues the whole i/o */
+	if (atomic_dec_32_nv(&vb->vb_pending) != 0)
+		return STATUS_MORE_PROCESSING_REQUIRED;
+
+	KeAcquireSpinLock(&vf->vf_done_lock, &irql);
+	vb->vb_next = vf->vf_done_list;
+	vf->vf_done_list = vb;
+	KeReleaseSpinLock(&vf->vf_done_lock, irql);
+
+	KeSetEvent(&vf->vf_done_event, 0, FALSE);
+	return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+static void
+vdev_file_io_intr(vf_callback_t *vb)
+{
+	for (int i = 0; i < vb->vb_nsegs; i++) {
+		PIRP irp = vb->vb_segs[i].vs_irp;
+
+		if (irp == NULL)
+			continue;
+
+		if (irp->IoStatus.Information != vb->vb_bufs[i].as_len)
+			dprintf("%s: size mismatch 0x%llx != 0x%llx\n", __func__,
+				irp->IoStatus.Information, vb->vb_bufs[i].as_len);
+
+		// Release irp
+		while (irp->MdlAddress != NULL) {
+			PMDL NextMdl;
+			NextMdl = irp->MdlAddress->Next;
+			MmUnlockPages(irp->MdlAddress);
+			IoFreeMdl(irp->MdlAddress);
+			irp->MdlAddress = NextMdl;
+		}
+		IoFreeIrp(irp);
+		vb->vb_segs[i].vs_irp = NULL;
+	}
+
+	vdev_file_io_finish(vb);
+}
+
+/*
+ * One completion thread per open file vdev. It takes everything the
+ * completion routine has queued in one go and finishes the i/os in the
+ * order they completed. It exits once vdev_file_close() has asked it to
+ * and nothing is left in flight.
+ */
+static void
+vdev_file_done_thread(void *arg)
+{
+	vdev_file_t *vf = arg;
+	vf_callback_t *vb, *next, *done;
+	KIRQL irql;
+
+	for (;;) {
+		KeWaitForSingleObject(&vf->vf_done_event, Executive,
+			KernelMode, FALSE, NULL);
+
+		KeAcquireSpinLock(&vf->vf_done_lock, &irql);
+		vb = vf->vf_done_list;
+		vf->vf_done_list = NULL;
+		KeReleaseSpinLock(&vf->vf_done_lock, irql);
+
+		/* The list was built LIFO; reverse it into completion order */
+		for (done = NULL; vb != NULL; vb = next) {
+			next = vb->vb_next;
+			vb->vb_next = done;
+			done = vb;
+		}
+
+		for (vb = done; vb != NULL; vb = next) {
+			next = vb->vb_next;
+			vdev_file_io_intr(vb);
+		}
+
+		if (vf->vf_done_exit && vf->vf_inflight == 0)
+			break;
+	}
+
+	mutex_enter(&vf->vf_lock);
+	vf->vf_done_thread = NULL;
+	cv_broadcast(&vf->vf_cv);
+	mutex_exit(&vf->vf_lock);
+
+	thread_exit();
+}
+
+#else	/* !_KERNEL */
+
+/*
+ * In userland every file vdev is opened for overlapped i/o and bound to a
+ * single completion port, drained by a small pool of threads.
+ */
+#define	VDEV_FILE_IOCP_THREADS	8
+
+static HANDLE vdev_file_iocp;
+static kmutex_t vdev_file_iocp_lock;
+static kcondvar_t vdev_file_iocp_cv;
+static int vdev_file_iocp_running;
+
+static void
+vdev_file_iocp_thread(void *arg)
+{
+	for (;;) {
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED *ov = NULL;
+		vf_callback_t *vb;
+		vf_seg_t *vs;
+		BOOL ok;
+
+		ok = GetQueuedCompletionStatus(vdev_file_iocp, &bytes, &key,
+		    &ov, INFINITE);
+
+		/* vdev_file_fini() posts packets without an OVERLAPPED */
+		if (ov == NULL)
+			break;
+
+		vs = CONTAINING_RECORD(ov, vf_seg_t, vs_overlapped);
+		vb = vs->vs_cb;
+		if (!ok || bytes != vb->vb_bufs[vs - vb->vb_segs].as_len)
+			vb->vb_error = EIO;
+
+		if (atomic_dec_32_nv(&vb->vb_pending) == 0)
+			vdev_file_io_finish(vb);
+	}
+
+	mutex_enter(&vdev_file_iocp_lock);
+	vdev_file_iocp_running--;
+	cv_broadcast(&vdev_file_iocp_cv);
+	mutex_exit(&vdev_file_iocp_lock);
+
+	thread_exit();
+}
+
+/*
+ * Size of a file or, failing that, of a raw disk. The handle may already
+ * be bound to the completion port, so the ioctl sets the low bit of its
+ * event to keep the completion off the port.
+ */
+static int
+vdev_file_getsize(HANDLE h, uint64_t *psize)
+{
+	LARGE_INTEGER size;
+	GET_LENGTH_INFORMATION gli;
+	OVERLAPPED ov = { 0 };
+	HANDLE event;
+	DWORD len;
+	int error = 0;
+
+	if (GetFileSizeEx(h, &size)) {
+		*psize = size.QuadPart;
+		return (0);
+	}
+
+	event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (event == NULL)
+		return (SET_ERROR(EIO));
+	ov.hEvent = (HANDLE)((uintptr_t)event | 1);
+
+	if (DeviceIoControl(h, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0,
+	    &gli, sizeof (gli), &len, &ov) ||
+	    (GetLastError() == ERROR_IO_PENDING &&
+	    GetOverlappedResult(h, &ov, &len, TRUE)))
+		*psize = gli.Length.QuadPart;
+	else
+		error = SET_ERROR(EIO);
+
+	CloseHandle(event);
+	return (error);
+}
+
+static void
+vdev_file_io_fsync(void *arg)
+{
+	zio_t *zio = (zio_t *)arg;
+	vdev_file_t *vf = zio->io_vd->vdev_tsd;
+
+	if (!FlushFileBuffers(vf->vf_handle))
+		zio->io_error = SET_ERROR(EIO);
+
+	zio_interrupt(zio);
+}
+
+#endif	/* _KERNEL */
+
 #ifdef _KERNEL
 extern int VOP_GETATTR(struct vnode *vp, vattr_t *vap, int flags, void *x3, void *x4);
 #endif
@@ -61,8 +354,8 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 {
 #if _KERNEL
 	static vattr_t vattr;
-	vdev_file_t *vf;
 #endif
+	vdev_file_t *vf = NULL;
 	int error = 0;
 
     dprintf("vdev_file_open %p\n", vd->vdev_tsd);
@@ -82,7 +375,6 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	 * Reopen the device if it's not currently open.  Otherwise,
 	 * just update the physical size of the device.
 	 */
-#ifdef _KERNEL
 	if (vd->vdev_tsd != NULL) {
 		ASSERT(vd->vdev_reopening);
 		vf = vd->vdev_tsd;
@@ -90,7 +382,6 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	}
 
 	vf = vd->vdev_tsd = kmem_zalloc(sizeof (vdev_file_t), KM_SLEEP);
-#endif
 
 	/*
 	 * We always open the files from the root of the global zone, even if
@@ -230,10 +521,68 @@ vdev_file_open(vdev_t *vd, uint64_t *psize, uint64_t *max_psize,
 	vf->vf_FileObject = FileObject;
 	vf->vf_DeviceObject = DeviceObject;
 
+	/*
+	 * TRIM is implemented by punching holes in the backing file, which
+	 * requires it to be marked sparse. Filesystems that can't do this
+	 * leave vdev_has_trim unset and TRIM is simply not offered.
+	 */
+	vd->vdev_has_trim = B_FALSE;
+	if (spa_mode(vd->vdev_spa) != FREAD) {
+		FILE_SET_SPARSE_BUFFER sparse = { .SetSparse = TRUE };
+
+		if (ZwFsControlFile(vf->vf_handle, NULL, NULL, NULL, &iob,
+		    FSCTL_SET_SPARSE, &sparse, sizeof (sparse),
+		    NULL, 0) == STATUS_SUCCESS)
+			vd->vdev_has_trim = B_TRUE;
+	}
+
+	/*
+	 * Completed IRPs are finished by a thread of our own; it lives as
+	 * long as the file stays open, across reopens.
+	 */
+	KeInitializeSpinLock(&vf->vf_done_lock);
+	KeInitializeEvent(&vf->vf_done_event, SynchronizationEvent, FALSE);
+	mutex_init(&vf->vf_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vf->vf_cv, NULL, CV_DEFAULT, NULL);
+	vf->vf_done_thread = thread_create(NULL, 0, vdev_file_done_thread,
+		vf, 0, &p0, TS_RUN, minclsyspri);
+
+#else	/* !_KERNEL */
+
+	char path[MAXPATHLEN];
+	DWORD access = GENERIC_READ;
+
+	/* Win32 spells the native "\??\" prefix as "\\?\" */
+	(void) strlcpy(path, (char *)FileName, sizeof (path));
+	if (!strncmp("\\??\\", path, 4))
+		path[1] = '\\';
+
+	if (spa_mode(vd->vdev_spa) & FWRITE)
+		access |= GENERIC_WRITE;
+
+	vf->vf_handle = CreateFileA(path, access,
+	    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+	    FILE_FLAG_OVERLAPPED, NULL);
+	if (vf->vf_handle == INVALID_HANDLE_VALUE) {
+		vf->vf_handle = NULL;
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		error = SET_ERROR(ENOENT);
+		goto failed;
+	}
+
+	if (CreateIoCompletionPort(vf->vf_handle, vdev_file_iocp, 0, 0) ==
+	    NULL) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		error = SET_ERROR(EIO);
+		goto failed;
+	}
+
+	vd->vdev_has_trim = B_FALSE;
+
 #endif
 
-#if _KERNEL
 skip_open:
+#if _KERNEL
 	/*
 	 * Determine the physical size of the file.
 	 */
@@ -246,38 +595,53 @@ skip_open:
 #ifdef _KERNEL
 	*max_psize = *psize = info.EndOfFile.QuadPart;
 #else
-    /* userland's vn_open() will get the device size for us, so we can
-     * just look it up - there is argument for a userland VOP_GETATTR to make
-     * this function cleaner. */
-//	*max_psize = *psize = vp->v_size;
+	error = vdev_file_getsize(vf->vf_handle, psize);
+	if (error != 0) {
+		vd->vdev_stat.vs_aux = VDEV_AUX_OPEN_FAILED;
+		goto failed;
+	}
+	*max_psize = *psize;
 #endif
     *ashift = SPA_MINBLOCKSHIFT;
 
 	return (0);
 
 failed:
-#ifdef _KERNEL
 	if (vf) {
 		if (vf->vf_handle != NULL) {
+#ifndef _KERNEL
+			CloseHandle(vf->vf_handle);
+#endif
 			vf->vf_handle = NULL;
 		}
 
 		kmem_free(vf, sizeof(vdev_file_t));
 		vd->vdev_tsd = NULL;
 	}
-#endif
 	return error;
 }
 
 static void
 vdev_file_close(vdev_t *vd)
 {
-#ifdef _KERNEL
 	vdev_file_t *vf = vd->vdev_tsd;
 
 	if (vd->vdev_reopening || vf == NULL)
 		return;
 
+	ASSERT0(vf->vf_inflight);
+
+#ifdef _KERNEL
+	/* Stop the completion thread before the file goes away */
+	mutex_enter(&vf->vf_lock);
+	vf->vf_done_exit = B_TRUE;
+	KeSetEvent(&vf->vf_done_event, 0, FALSE);
+	while (vf->vf_done_thread != NULL)
+		cv_wait(&vf->vf_cv, &vf->vf_lock);
+	mutex_exit(&vf->vf_lock);
+	mutex_destroy(&vf->vf_lock);
+	cv_destroy(&vf->vf_cv);
+
 	if (vf->vf_handle != NULL) {
 
 		// Release our holds
@@ -289,92 +653,46 @@ vdev_file_close(vdev_t *vd)
 
 	vf->vf_FileObject = NULL;
 	vf->vf_DeviceObject = NULL;
+#else
+	if (vf->vf_handle != NULL)
+		CloseHandle(vf->vf_handle);
+#endif
 	vf->vf_handle = NULL;
 	vd->vdev_delayed_close = B_FALSE;
 	kmem_free(vf, sizeof (vdev_file_t));
 	vd->vdev_tsd = NULL;
-#endif
 }
 
 #ifdef _KERNEL
-struct vdev_file_callback_struct {
-	KEVENT Event;
-	zio_t *zio;
-	PIRP irp;
-	void *b_data;
-};
-typedef struct vdev_file_callback_struct vf_callback_t;
-
-
-static NTSTATUS
-vdev_file_io_intrxxx(PDEVICE_OBJECT DeviceObject, PIRP irp, PVOID Context)
-{
-	KEVENT *kevent = Context;
-
-//	dprintf("%s: event\n", __func__);
-	KeSetEvent(kevent, 0, FALSE);
-	return STATUS_MORE_PROCESSING_REQUIRED;
-}
-
-
+/*
+ * Deallocate the range by zeroing it, which frees the clusters of a
+ * sparse file. This may block in the filesystem, so it runs from
+ * vdev_file_taskq rather than the issuing thread.
+ */
 static void
-vdev_file_io_intr(void *Context)
+vdev_file_io_trim(void *arg)
 {
-	vf_callback_t *vb = (vf_callback_t *)Context;
-	zio_t *zio = vb->zio;
-	PIRP irp = vb->irp;
-
-	// Wait for IoCompletionRoutine to have been called.
-	KeWaitForSingleObject(&vb->Event, Executive, KernelMode, FALSE, NULL); // SYNC
-
-//	dprintf("%s: done\n", __func__);
-
-	/*
-	* The rest of the zio stack only deals with EIO, ECKSUM, and ENXIO.
-	* Rather than teach the rest of the stack about other error
-	* possibilities (EFAULT, etc), we normalize the error value here.
-	*/
-	//	zio->io_error = (geterror(bp) != 0 ? EIO : 0);
-
-	//	if (zio->io_error == 0 && bp->b_resid != 0)
-	//		zio->io_error = SET_ERROR(EIO);
-	zio->io_error = (irp->IoStatus.Status != 0 ? EIO : 0);
-	if (zio->io_type == ZIO_TYPE_READ) {
-		if (zio->io_abd->abd_size == zio->io_size) {
-			abd_return_buf_copy(zio->io_abd, vb->b_data, zio->io_size);
-		} else {
-			VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
-			abd_return_buf_copy_off(zio->io_abd, vb->b_data,
-				0, zio->io_size, zio->io_abd->abd_size);
-		}
-	} else {
-		VERIFY3S(zio->io_abd->abd_size, >= , zio->io_size);
-		abd_return_buf_off(zio->io_abd, vb->b_data, 0, zio->io_size, zio->io_abd->abd_size);
-	}
-
-	if (irp->IoStatus.Information != zio->io_size)
-		dprintf("%s: size mismatch 0x%llx != 0x%llx\n",
-			irp->IoStatus.Information, zio->io_size);
+	zio_t *zio = (zio_t *)arg;
+	vdev_t *vd = zio->io_vd;
+	vdev_file_t *vf = vd->vdev_tsd;
+	FILE_ZERO_DATA_INFORMATION fzdi;
+	IO_STATUS_BLOCK iob;
+	NTSTATUS status;
 
-	// Release irp
-	if (irp) {
-		while (irp->MdlAddress != NULL) {
-			PMDL NextMdl;
-			NextMdl = irp->MdlAddress->Next;
-			MmUnlockPages(irp->MdlAddress);
-			IoFreeMdl(irp->MdlAddress);
-			irp->MdlAddress = NextMdl;
-		}
-		IoFreeIrp(irp);
-	}
-	irp = NULL;
+	fzdi.FileOffset.QuadPart = zio->io_offset + vd->vdev_win_offset;
+	fzdi.BeyondFinalZero.QuadPart = fzdi.FileOffset.QuadPart +
+	    zio->io_size;
 
-	kmem_free(vb, sizeof(vf_callback_t));
-	vb = NULL;
+	status = ZwFsControlFile(vf->vf_handle, NULL, NULL, NULL, &iob,
+	    FSCTL_SET_ZERO_DATA, &fzdi, sizeof (fzdi), NULL, 0);
 
-	zio_delay_interrupt(zio);
+	if (status == STATUS_INVALID_DEVICE_REQUEST ||
+	    status == STATUS_NOT_SUPPORTED)
+		zio->io_error = SET_ERROR(ENOTSUP);
+	else
+		zio->io_error = (status != STATUS_SUCCESS ? EIO : 0);
 
-	thread_exit();
+	zio_interrupt(zio);
 }
 #endif
 
@@ -400,6 +718,11 @@ vdev_file_io_start(zio_t *zio)
 
         switch (zio->io_cmd) {
         case DKIOCFLUSHWRITECACHE:
+#ifndef _KERNEL
+			VERIFY3U(taskq_dispatch(vdev_file_taskq,
+			    vdev_file_io_fsync, zio, TQ_SLEEP), !=, 0);
+			return;
+#endif
 #if 0
 			if (!vnode_getwithvid(vf->vf_vnode, vf->vf_vid)) {
                 zio->io_error = VOP_FSYNC(vf->vf_vnode, FSYNC | FDSYNC,
@@ -416,94 +739,149 @@ vdev_file_io_start(zio_t *zio)
         return;
     }
 
+	if (zio->io_type == ZIO_TYPE_TRIM) {
+		if (!vdev_writeable(vd)) {
+			zio->io_error = SET_ERROR(ENXIO);
+			zio_interrupt(zio);
+			return;
+		}
+#ifdef _KERNEL
+		VERIFY3U(taskq_dispatch(vdev_file_taskq, vdev_file_io_trim,
+		    zio, TQ_SLEEP), !=, 0);
+#else
+		zio->io_error = SET_ERROR(ENOTSUP);
+		zio_interrupt(zio);
+#endif
+		return;
+	}
+
 	ASSERT(zio->io_type == ZIO_TYPE_READ || zio->io_type == ZIO_TYPE_WRITE);
 	zio->io_target_timestamp = zio_handle_io_delay(zio);
 
 
 	ASSERT(zio->io_size != 0);
 
-#ifdef _KERNEL
 	vdev_file_t *vf = vd->vdev_tsd;
+	uint64_t offset = zio->io_offset + vd->vdev_win_offset;
+	int maxsegs = MIN(zfs_vdev_max_segs, VDEV_MAX_SEGS);
+	vf_callback_t *vb;
 
-	NTSTATUS status;
-	PIRP irp = NULL;
-	PIO_STACK_LOCATION irpStack = NULL;
-	//KEVENT completionEvent;
-
-	IO_STATUS_BLOCK IoStatusBlock;
-	LARGE_INTEGER offset;
-
-	offset.QuadPart = zio->io_offset + vd->vdev_win_offset;
-
-	vf_callback_t *vb = (vf_callback_t *)kmem_alloc(sizeof(vf_callback_t), KM_SLEEP);
-	vb->zio = zio;
-	KeInitializeEvent(&vb->Event, NotificationEvent, FALSE);
+	/*
+	 * Read or write the ABD's chunks in place if it allows, otherwise
+	 * go through a contiguous buffer.
+	 */
+	vb = vdev_file_cb_alloc(vf, zio, MAX(maxsegs, 1));
+	vb->vb_nsegs = vdev_io_borrow_segs(zio, vb->vb_bufs, maxsegs);
 
+	if (vb->vb_nsegs == 0) {
 #ifdef DEBUG
-	if (zio->io_abd->abd_size != zio->io_size) {
-		zfs_vdev_file_size_mismatch_cnt++;
-		// this dprintf can be very noisy
-		dprintf("ZFS: %s: trimming zio->io_abd from 0x%x to 0x%llx\n", 
-			__func__, zio->io_abd->abd_size, zio->io_size);
-	}
+		if (zio->io_abd->abd_size != zio->io_size) {
+			zfs_vdev_file_size_mismatch_cnt++;
+			// this dprintf can be very noisy
+			dprintf("ZFS: %s: trimming zio->io_abd from 0x%x to 0x%llx\n", 
+				__func__, zio->io_abd->abd_size, zio->io_size);
+		}
 #endif
 
-	if (zio->io_type == ZIO_TYPE_READ) {
-		ASSERT3S(zio->io_abd->abd_size, >= , zio->io_size);
-		vb->b_data =
-			abd_borrow_buf(zio->io_abd, zio->io_abd->abd_size);
-	} else {
-		ASSERT3S(zio->io_abd->abd_size, >= , zio->io_size);
-		vb->b_data =
-			abd_borrow_buf_copy(zio->io_abd, zio->io_abd->abd_size);
+		if (zio->io_type == ZIO_TYPE_READ) {
+			ASSERT3S(zio->io_abd->abd_size, >= , zio->io_size);
+			vb->b_data =
+				abd_borrow_buf(zio->io_abd, zio->io_abd->abd_size);
+		} else {
+			ASSERT3S(zio->io_abd->abd_size, >= , zio->io_size);
+			vb->b_data =
+				abd_borrow_buf_copy(zio->io_abd, zio->io_abd->abd_size);
+		}
+		vb->vb_bufs[0].as_base = vb->b_data;
+		vb->vb_bufs[0].as_len = zio->io_size;
+		vb->vb_nsegs = 1;
 	}
 
-	if (zio->io_type == ZIO_TYPE_READ) {
-		irp = IoBuildAsynchronousFsdRequest(IRP_MJ_READ,
-			vf->vf_DeviceObject,
-			vb->b_data,
-			(ULONG)zio->io_size,
-			&offset,
-			&IoStatusBlock);
-	} else {
-		irp = IoBuildAsynchronousFsdRequest(IRP_MJ_WRITE,
-			vf->vf_DeviceObject,
-			vb->b_data,
-			(ULONG)zio->io_size,
-			&offset,
-			&IoStatusBlock);
-	}
+	atomic_inc_64(&vf->vf_inflight);
 
-	if (!irp) {
-		kmem_free(vb, sizeof(vf_callback_t));
-		zio->io_error = EIO;
-		zio_interrupt(zio);
-		return;
-	}
+	/*
+	 * Hold an extra count while issuing, so that no completion can finish
+	 * the i/o before every segment has been sent.
+	 */
+	vb->vb_pending = vb->vb_nsegs + 1;
+
+	for (int i = 0; i < vb->vb_nsegs; i++) {
+		vf_seg_t *vs = &vb->vb_segs[i];
+		abd_seg_t *buf = &vb->vb_bufs[i];
+
+		vs->vs_cb = vb;
 
-	vb->irp = irp;
+#ifdef _KERNEL
+		PIRP irp = NULL;
+		PIO_STACK_LOCATION irpStack = NULL;
+		LARGE_INTEGER loffset;
+
+		loffset.QuadPart = offset;
+
+		irp = IoBuildAsynchronousFsdRequest(
+			zio->io_type == ZIO_TYPE_READ ? IRP_MJ_READ : IRP_MJ_WRITE,
+			vf->vf_DeviceObject,
+			buf->as_base,
+			(ULONG)buf->as_len,
+			&loffset,
+			&vs->vs_iosb);
+
+		if (!irp) {
+			vb->vb_error = EIO;
+			(void) atomic_dec_32_nv(&vb->vb_pending);
+		} else {
+			vs->vs_irp = irp;
 
-	irpStack = IoGetNextIrpStackLocation(irp);
+			irpStack = IoGetNextIrpStackLocation(irp);
 
-	irpStack->Flags |= SL_OVERRIDE_VERIFY_VOLUME; // SetFlag(IoStackLocation->Flags, SL_OVERRIDE_VERIFY_VOLUME);
-												  //SetFlag(ReadIrp->Flags, IRP_NOCACHE);
-	irpStack->FileObject = vf->vf_FileObject;
+			irpStack->Flags |= SL_OVERRIDE_VERIFY_VOLUME; // SetFlag(IoStackLocation->Flags, SL_OVERRIDE_VERIFY_VOLUME);
+														  //SetFlag(ReadIrp->Flags, IRP_NOCACHE);
+			irpStack->FileObject = vf->vf_FileObject;
 
-	IoSetCompletionRoutine(irp,
-		vdev_file_io_intrxxx,
-		&vb->Event, // "Context" in vdev_disk_io_intr()
-		TRUE, // On Success
-		TRUE, // On Error
-		TRUE);// On Cancel
+			IoSetCompletionRoutine(irp,
+				vdev_file_io_intrxxx,
+				vs, // "Context" in vdev_file_io_intrxxx()
+				TRUE, // On Success
+				TRUE, // On Error
+				TRUE);// On Cancel
 
-			  // Start a thread to wait for IO completion, which is signalled
-			  // by CompletionRouting setting event.
-	(void)thread_create(NULL, 0, vdev_file_io_intr, vb, 0, &p0,
-		TS_RUN, minclsyspri);
+			// Completion is picked up by vf_done_thread.
+			(void) IoCallDriver(vf->vf_DeviceObject, irp);
+		}
+#else
+		BOOL ok;
+
+		vs->vs_overlapped.Offset = (DWORD)offset;
+		vs->vs_overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+		if (zio->io_type == ZIO_TYPE_READ)
+			ok = ReadFile(vf->vf_handle, buf->as_base,
+			    (DWORD)buf->as_len, NULL, &vs->vs_overlapped);
+		else
+			ok = WriteFile(vf->vf_handle, buf->as_base,
+			    (DWORD)buf->as_len, NULL, &vs->vs_overlapped);
+
+		/*
+		 * Anything other than success or ERROR_IO_PENDING failed
+		 * without queueing a completion packet.
+		 */
+		if (!ok && GetLastError() != ERROR_IO_PENDING) {
+			vb->vb_error = EIO;
+			(void) atomic_dec_32_nv(&vb->vb_pending);
+		}
+#endif
 
-	status = IoCallDriver(vf->vf_DeviceObject, irp);
+		offset += buf->as_len;
+	}
 
+	/* Drop the issuing count; finish here if everything is done */
+	if (atomic_dec_32_nv(&vb->vb_pending) == 0) {
+#ifdef _KERNEL
+		vdev_file_io_intr(vb);
+#else
+		vdev_file_io_finish(vb);
 #endif
+	}
 
     return;
 }
@@ -537,12 +915,41 @@ vdev_file_init(void)
 	    max_ncpus, INT_MAX, TASKQ_PREPOPULATE | TASKQ_THREADS_CPU_PCT);
 
 	VERIFY(vdev_file_taskq);
+
+#ifndef _KERNEL
+	vdev_file_iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL,
+	    0, 0);
+	VERIFY(vdev_file_iocp != NULL);
+
+	mutex_init(&vdev_file_iocp_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vdev_file_iocp_cv, NULL, CV_DEFAULT, NULL);
+	for (int i = 0; i < VDEV_FILE_IOCP_THREADS; i++) {
+		(void) thread_create(NULL, 0, vdev_file_iocp_thread, NULL, 0,
+		    &p0, TS_RUN, minclsyspri);
+		vdev_file_iocp_running++;
+	}
+#endif
 }
 
 void
 vdev_file_fini(void)
 {
 	taskq_destroy(vdev_file_taskq);
+
+#ifndef _KERNEL
+	for (int i = 0; i < VDEV_FILE_IOCP_THREADS; i++)
+		VERIFY(PostQueuedCompletionStatus(vdev_file_iocp, 0, 0, NULL));
+
+	mutex_enter(&vdev_file_iocp_lock);
+	while (vdev_file_iocp_running > 0)
+		cv_wait(&vdev_file_iocp_cv, &vdev_file_iocp_lock);
+	mutex_exit(&vdev_file_iocp_lock);
+	mutex_destroy(&vdev_file_iocp_lock);
+	cv_destroy(&vdev_file_iocp_cv);
+
+	CloseHandle(vdev_file_iocp);
+	vdev_file_iocp = NULL;
+#endif
 }
 
 /*
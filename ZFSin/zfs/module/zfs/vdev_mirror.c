@@ -48,6 +48,8 @@ typedef struct mirror_child {
 	uint8_t		mc_tried;
 	uint8_t		mc_skipped;
 	uint8_t		mc_speculative;
+	int		mc_load;
+	uint64_t	mc_latency;
 } mirror_child_t;
 
 typedef struct mirror_map {
@@ -60,6 +62,31 @@ typedef struct mirror_map {
 
 int vdev_mirror_shift = 21;
 
+/*
+ * The load configuration settings below are tuned by default for
+ * the case where all devices are of the same rotational type.
+ *
+ * If there is a mixture of rotating and non-rotating media, setting
+ * zfs_vdev_mirror_non_rotating_seek_inc to 0 may well provide better results
+ * as it will direct more reads to the non-rotating vdevs which are more likely
+ * to have a higher performance.
+ */
+
+/* Rotating media load calculation configuration. */
+int zfs_vdev_mirror_rotating_inc = 0;
+int zfs_vdev_mirror_rotating_seek_inc = 5;
+int zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
+
+/* Non-rotating media load calculation configuration. */
+int zfs_vdev_mirror_non_rotating_inc = 0;
+int zfs_vdev_mirror_non_rotating_seek_inc = 1;
+
+/*
+ * Scale the load of each child by how much slower it has recently been
+ * than the fastest readable child, see vdev_mirror_child_select().
+ */
+int zfs_vdev_mirror_latency_aware = 1;
+
 static void
 vdev_mirror_map_free(zio_t *zio)
 {
@@ -85,8 +112,22 @@ vdev_mirror_map_alloc(zio_t *zio)
 		dva_t *dva = zio->io_bp->blk_dva;
 		spa_t *spa = zio->io_spa;
 		dva_t dva_copy[SPA_DVAS_PER_BP];
+		dsl_scan_t *scn = spa->spa_dsl_pool != NULL ?
+		    spa->spa_dsl_pool->dp_scan : NULL;
 
-		c = BP_GET_NDVAS(zio->io_bp);
+		/*
+		 * A sorted scan reads every DVA of a block separately, from
+		 * the queue of its vdev, and moves that DVA to the front. The
+		 * other copies are kept for repair but only read if the first
+		 * attempt fails and the zio is retried.
+		 */
+		if ((zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER)) &&
+		    !(zio->io_flags & ZIO_FLAG_IO_RETRY) &&
+		    scn != NULL && scn->scn_is_sorted) {
+			c = 1;
+		} else {
+			c = BP_GET_NDVAS(zio->io_bp);
+		}
 
 		/*
 		 * If we do not trust the pool config, some DVAs might be
@@ -276,9 +317,90 @@ vdev_mirror_scrub_done(zio_t *zio)
 	mc->mc_skipped = 0;
 }
 
+/*
+ * Number of queued-i/o equivalents that a read at zio_offset would add to
+ * the load of a child: its active queue length, plus a seek penalty that
+ * depends on the distance from the last i/o we sent it and on whether it
+ * is rotational.
+ */
+static int
+vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
+{
+	uint64_t lastoffset;
+	int load;
+
+	/* All DVAs have equal weight at the root. */
+	if (mm->mm_root)
+		return (INT_MAX);
+
+	/*
+	 * We don't return INT_MAX if the device is resilvering i.e.
+	 * vdev_resilver_txg != 0 as when tested performance was slightly
+	 * worse overall when resilvering with compared to without.
+	 */
+
+	/* Standard load based on pending queue length. */
+	load = vdev_queue_length(vd);
+	lastoffset = vdev_queue_lastoffset(vd);
+
+	if (vd->vdev_nonrot) {
+		/* Non-rotating media. */
+		if (lastoffset == zio_offset)
+			return (load + zfs_vdev_mirror_non_rotating_inc);
+
+		/*
+		 * Apply a seek penalty even for non-rotating devices as
+		 * sequential I/O's can be aggregated into fewer operations on
+		 * the device, thus avoiding unnecessary per-command overhead
+		 * and boosting performance.
+		 */
+		return (load + zfs_vdev_mirror_non_rotating_seek_inc);
+	}
+
+	/* Rotating media I/O's which directly follow the last I/O. */
+	if (lastoffset == zio_offset)
+		return (load + zfs_vdev_mirror_rotating_inc);
+
+	/*
+	 * Apply half the seek increment to I/O's within seek offset
+	 * of the last I/O queued to this vdev as they should incur less
+	 * of a seek increment.
+	 */
+	if ((lastoffset > zio_offset ? lastoffset - zio_offset :
+	    zio_offset - lastoffset) <
+	    (uint64_t)zfs_vdev_mirror_rotating_seek_offset)
+		return (load + (zfs_vdev_mirror_rotating_seek_inc / 2));
+
+	/* Apply the full seek increment to all other I/O's. */
+	return (load + zfs_vdev_mirror_rotating_seek_inc);
+}
+
+/*
+ * Recent device latency of a child, or 0 if unknown. Only leaves have a
+ * queue and therefore an estimate; a replacing or spare vdev under a
+ * mirror reports 0, which disables latency weighting for the read.
+ */
+static uint64_t
+vdev_mirror_latency(mirror_map_t *mm, vdev_t *vd)
+{
+	if (mm->mm_root || !vd->vdev_ops->vdev_op_leaf)
+		return (0);
+
+	return (vdev_queue_latency(vd));
+}
+
 /*
  * Try to find a child whose DTL doesn't contain the block we want to read.
  * If we can't, try the read on any vdev we haven't already tried.
+ *
+ * Among the children that have the block, pick the least loaded one. When
+ * the latency of every candidate is known, each child's load (plus one for
+ * the read itself) is multiplied by how many times slower than the fastest
+ * candidate it has recently been, rounded down. Children within a factor
+ * of two of each other are thus balanced on load alone, while a read only
+ * goes to, say, a disk that is 50 times slower than its SSD partner once
+ * the SSD has 50 times as much queued. Ties go to the first child starting
+ * from mm_preferred, which keeps the existing striping and DVA locality.
  */
 static int
 vdev_mirror_child_select(zio_t *zio)
@@ -286,18 +408,18 @@ vdev_mirror_child_select(zio_t *zio)
 	mirror_map_t *mm = zio->io_vsd;
 	mirror_child_t *mc;
 	uint64_t txg = zio->io_txg;
-	int i, c;
+	uint64_t min_latency = UINT64_MAX;
+	boolean_t use_latency = (zfs_vdev_mirror_latency_aware != 0);
+	int i, c, best = -1;
 
 	ASSERT(zio->io_bp == NULL || BP_PHYSICAL_BIRTH(zio->io_bp) == txg);
 
 	/*
-	 * Try to find a child whose DTL doesn't contain the block to read.
+	 * Find the children whose DTL doesn't contain the block to read.
 	 * If a child is known to be completely inaccessible (indicated by
 	 * vdev_readable() returning B_FALSE), don't even try.
 	 */
-	for (i = 0, c = mm->mm_preferred; i < mm->mm_children; i++, c++) {
-		if (c >= mm->mm_children)
-			c = 0;
+	for (c = 0; c < mm->mm_children; c++) {
 		mc = &mm->mm_child[c];
 		if (mc->mc_tried || mc->mc_skipped)
 			continue;
@@ -307,20 +429,57 @@ vdev_mirror_child_select(zio_t *zio)
 			mc->mc_skipped = 1;
 			continue;
 		}
-		if (!vdev_dtl_contains(mc->mc_vd, DTL_MISSING, txg, 1))
-			return (c);
-		mc->mc_error = SET_ERROR(ESTALE);
-		mc->mc_skipped = 1;
-		mc->mc_speculative = 1;
+		if (vdev_dtl_contains(mc->mc_vd, DTL_MISSING, txg, 1)) {
+			mc->mc_error = SET_ERROR(ESTALE);
+			mc->mc_skipped = 1;
+			mc->mc_speculative = 1;
+			continue;
+		}
+
+		mc->mc_load = vdev_mirror_load(mm, mc->mc_vd, mc->mc_offset);
+		mc->mc_latency = vdev_mirror_latency(mm, mc->mc_vd);
+		if (mc->mc_latency == 0)
+			use_latency = B_FALSE;
+		else
+			min_latency = MIN(min_latency, mc->mc_latency);
+	}
+
+	uint64_t best_cost = UINT64_MAX;
+	for (i = 0, c = mm->mm_preferred; i < mm->mm_children; i++, c++) {
+		uint64_t cost;
+
+		if (c >= mm->mm_children)
+			c = 0;
+		mc = &mm->mm_child[c];
+		if (mc->mc_tried || mc->mc_skipped)
+			continue;
+
+		cost = (uint64_t)mc->mc_load;
+		if (use_latency)
+			cost = (cost + 1) * (mc->mc_latency / min_latency);
+
+		if (best == -1 || cost < best_cost) {
+			best = c;
+			best_cost = cost;
+		}
+	}
+
+	if (best != -1) {
+		vdev_queue_register_lastoffset(mm->mm_child[best].mc_vd, zio);
+		return (best);
 	}
 
 	/*
 	 * Every device is either missing or has this txg in its DTL.
 	 * Look for any child we haven't already tried before giving up.
 	 */
-	for (c = 0; c < mm->mm_children; c++)
-		if (!mm->mm_child[c].mc_tried)
+	for (c = 0; c < mm->mm_children; c++) {
+		if (!mm->mm_child[c].mc_tried) {
+			vdev_queue_register_lastoffset(mm->mm_child[c].mc_vd,
+			    zio);
 			return (c);
+		}
+	}
 
 	/*
 	 * Every child failed.  There's no place left to look.
@@ -119,6 +119,29 @@
  * maximum percentage, this indicates that the rate of incoming data is
  * greater than the rate that the backend storage can handle. In this case, we
  * must further throttle incoming writes (see dmu_tx_delay() for details).
+ *
+ * Deadline Mode
+ *
+ * The limits above say nothing about how long an i/o may sit in the queue.
+ * With zfs_vdev_deadline set, each class also has a target latency
+ * (zfs_vdev_*_deadline_ms) and two things change:
+ *
+ *  - An i/o that has been queued for longer than its class's target is
+ *    promoted: its class is served before all others, oldest i/o first,
+ *    for as long as the class is below its max_active.
+ *
+ *  - The max_active of the non-synchronous classes adapts to the latency
+ *    the synchronous ones observe. When a sync read or write takes longer
+ *    than its target from queueing to completion, the effective maximum
+ *    of every other class is halved (at most once per target period, and
+ *    never below its min_active), since it is their i/os sitting in the
+ *    device that a sync i/o has to wait behind. Each i/o that then
+ *    completes within its own class's target raises its class's
+ *    effective maximum by one, back up to the configured max_active.
+ *
+ * The time i/os spend queued is recorded per class in the vdev's queue
+ * histograms (zpool iostat -w); promotions, misses and limit cuts are
+ * counted in the vdev_queue_stats kstat.
  */
 
 /*
@@ -158,6 +181,22 @@ uint32_t zfs_vdev_removal_min_active = 1;
 uint32_t zfs_vdev_removal_max_active = 2;
 uint32_t zfs_vdev_initializing_min_active = 1;
 uint32_t zfs_vdev_initializing_max_active = 1;
+uint32_t zfs_vdev_trim_min_active = 1;
+uint32_t zfs_vdev_trim_max_active = 2;
+
+/*
+ * Deadline scheduling, off by default; see "Deadline Mode" above. The
+ * per-class targets are in milliseconds from queueing to completion.
+ */
+int zfs_vdev_deadline = 0;
+uint32_t zfs_vdev_sync_read_deadline_ms = 10;
+uint32_t zfs_vdev_sync_write_deadline_ms = 10;
+uint32_t zfs_vdev_async_read_deadline_ms = 100;
+uint32_t zfs_vdev_async_write_deadline_ms = 1000;
+uint32_t zfs_vdev_scrub_deadline_ms = 1000;
+uint32_t zfs_vdev_removal_deadline_ms = 1000;
+uint32_t zfs_vdev_initializing_deadline_ms = 2000;
+uint32_t zfs_vdev_trim_deadline_ms = 2000;
 
 /*
  * When the pool has less than zfs_vdev_async_write_active_min_dirty_percent
@@ -204,6 +243,54 @@ uint64_t zfs_vdev_queue_depth_pct = 300;
  */
 int zfs_vdev_def_queue_depth = 32;
 
+/*
+ * Each leaf vdev keeps an exponentially weighted moving average of the
+ * time its i/os spend in the device (zio->io_delay), which the mirror
+ * vdev uses to steer reads away from slow children. Every completion
+ * moves the average 1/2^zfs_vdev_latency_ewma_shift of the way towards
+ * the latest sample. Writes are sampled too, so that the estimate of a
+ * child that gets no reads (because it was slow) keeps tracking it.
+ */
+int zfs_vdev_latency_ewma_shift = 3;
+
+/*
+ * Leaf vdevs do reads and writes straight into the chunks of a scattered
+ * ABD when it can be described with at most this many segments (see
+ * abd_borrow_segs()), issuing one request per segment. Buffers that are
+ * more fragmented than that, or whose pieces are not whole sectors, are
+ * linearized through a bounce buffer as before. Zero always linearizes.
+ */
+int zfs_vdev_max_segs = 16;
+
+/*
+ * Aggregated i/os are normally given a buffer of their own: the data of
+ * the i/os they are made of is copied into it before a write and out of
+ * it after a read. When this is set, the aggregate instead gets a gang
+ * ABD (see abd_alloc_gang()) that refers to the child buffers in place,
+ * and only the read gaps and the optional NODATA writes are backed by a
+ * scratch buffer. Children that don't split into whole ABD chunks still
+ * take the copying path.
+ */
+int zfs_vdev_aggregate_gang = 1;
+
+vdev_queue_stats_t vdev_queue_stats = {
+	/* aggregated i/os issued, and how many of them were gangs */
+	{ "agg_ios",		KSTAT_DATA_UINT64 },
+	{ "agg_gang_ios",	KSTAT_DATA_UINT64 },
+	/* child data copied into or out of aggregates, or referenced */
+	{ "agg_copied_bytes",	KSTAT_DATA_UINT64 },
+	{ "agg_gang_bytes",	KSTAT_DATA_UINT64 },
+	/* deadline mode: i/os promoted, i/os late, max_active cuts */
+	{ "deadline_promoted",	KSTAT_DATA_UINT64 },
+	{ "deadline_missed",	KSTAT_DATA_UINT64 },
+	{ "deadline_backoffs",	KSTAT_DATA_UINT64 },
+};
+
+#define	VQSTAT_BUMP(stat)	atomic_inc_64(&vdev_queue_stats.stat.value.ui64)
+#define	VQSTAT_INCR(stat, val)	\
+	atomic_add_64(&vdev_queue_stats.stat.value.ui64, (val))
+
+static kstat_t *vdev_queue_ksp;
 
 int
 vdev_queue_offset_compare(const void *x1, const void *x2)
@@ -233,11 +320,14 @@ vdev_queue_class_tree(vdev_queue_t *vq, zio_priority_t p)
 static inline avl_tree_t *
 vdev_queue_type_tree(vdev_queue_t *vq, zio_type_t t)
 {
-	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE);
+	ASSERT(t == ZIO_TYPE_READ || t == ZIO_TYPE_WRITE ||
+	    t == ZIO_TYPE_TRIM);
 	if (t == ZIO_TYPE_READ)
 		return (&vq->vq_read_offset_tree);
-	else
+	else if (t == ZIO_TYPE_WRITE)
 		return (&vq->vq_write_offset_tree);
+	else
+		return (&vq->vq_trim_offset_tree);
 }
 
 int
@@ -277,6 +367,8 @@ vdev_queue_class_min_active(zio_priority_t p)
 		return (zfs_vdev_removal_min_active);
 	case ZIO_PRIORITY_INITIALIZING:
 		return (zfs_vdev_initializing_min_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_min_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
@@ -340,25 +432,127 @@ vdev_queue_class_max_active(spa_t *spa, zio_priority_t p)
 		return (zfs_vdev_removal_max_active);
 	case ZIO_PRIORITY_INITIALIZING:
 		return (zfs_vdev_initializing_max_active);
+	case ZIO_PRIORITY_TRIM:
+		return (zfs_vdev_trim_max_active);
 	default:
 		panic("invalid priority %u", p);
 		return (0);
 	}
 }
 
+static hrtime_t
+vdev_queue_class_deadline(zio_priority_t p)
+{
+	switch (p) {
+	case ZIO_PRIORITY_SYNC_READ:
+		return (MSEC2NSEC(zfs_vdev_sync_read_deadline_ms));
+	case ZIO_PRIORITY_SYNC_WRITE:
+		return (MSEC2NSEC(zfs_vdev_sync_write_deadline_ms));
+	case ZIO_PRIORITY_ASYNC_READ:
+		return (MSEC2NSEC(zfs_vdev_async_read_deadline_ms));
+	case ZIO_PRIORITY_ASYNC_WRITE:
+		return (MSEC2NSEC(zfs_vdev_async_write_deadline_ms));
+	case ZIO_PRIORITY_SCRUB:
+		return (MSEC2NSEC(zfs_vdev_scrub_deadline_ms));
+	case ZIO_PRIORITY_REMOVAL:
+		return (MSEC2NSEC(zfs_vdev_removal_deadline_ms));
+	case ZIO_PRIORITY_INITIALIZING:
+		return (MSEC2NSEC(zfs_vdev_initializing_deadline_ms));
+	case ZIO_PRIORITY_TRIM:
+		return (MSEC2NSEC(zfs_vdev_trim_deadline_ms));
+	default:
+		panic("invalid priority %u", p);
+		return (0);
+	}
+}
+
+/*
+ * The max_active of a class, less whatever the deadline scheduler has
+ * taken off it.
+ */
+static int
+vdev_queue_class_limit(vdev_queue_t *vq, zio_priority_t p)
+{
+	int max = vdev_queue_class_max_active(vq->vq_vdev->vdev_spa, p);
+
+	if (!zfs_vdev_deadline)
+		return (max);
+
+	return (MAX(MIN(max, vq->vq_class[p].vqc_limit),
+	    vdev_queue_class_min_active(p)));
+}
+
+/*
+ * Deadline mode feedback from a completed i/o; see "Deadline Mode" above.
+ */
+static void
+vdev_queue_deadline_update(vdev_queue_t *vq, zio_t *zio, hrtime_t now)
+{
+	zio_priority_t p = zio->io_priority;
+	vdev_queue_class_t *vqc = &vq->vq_class[p];
+	hrtime_t deadline = vdev_queue_class_deadline(p);
+
+	ASSERT(MUTEX_HELD(&vq->vq_lock));
+
+	if (zio->io_delta <= deadline) {
+		if (vqc->vqc_limit < vdev_queue_class_max_active(
+		    vq->vq_vdev->vdev_spa, p))
+			vqc->vqc_limit++;
+		return;
+	}
+
+	VQSTAT_BUMP(vqs_deadline_missed);
+
+	if (p != ZIO_PRIORITY_SYNC_READ && p != ZIO_PRIORITY_SYNC_WRITE)
+		return;
+	if (now - vq->vq_dl_backoff_ts < deadline)
+		return;
+
+	vq->vq_dl_backoff_ts = now;
+	VQSTAT_BUMP(vqs_deadline_backoffs);
+	for (zio_priority_t q = 0; q < ZIO_PRIORITY_NUM_QUEUEABLE; q++) {
+		if (q == ZIO_PRIORITY_SYNC_READ || q == ZIO_PRIORITY_SYNC_WRITE)
+			continue;
+		vq->vq_class[q].vqc_limit = MAX(vdev_queue_class_min_active(q),
+		    vdev_queue_class_limit(vq, q) / 2);
+	}
+}
+
 /*
  * Return the i/o class to issue from, or ZIO_PRIORITY_MAX_QUEUEABLE if
- * there is no eligible class.
+ * there is no eligible class. *expiredp is set if the class is being
+ * served because its oldest i/o is past its deadline, in which case that
+ * i/o should be the one issued.
  */
 static zio_priority_t
-vdev_queue_class_to_issue(vdev_queue_t *vq)
+vdev_queue_class_to_issue(vdev_queue_t *vq, boolean_t *expiredp)
 {
 	spa_t *spa = vq->vq_vdev->vdev_spa;
 	zio_priority_t p;
 
+	*expiredp = B_FALSE;
+
 	if (avl_numnodes(&vq->vq_active_tree) >= zfs_vdev_max_active)
 		return (ZIO_PRIORITY_NUM_QUEUEABLE);
 
+	/* find a queue whose oldest i/o has waited too long */
+	if (zfs_vdev_deadline) {
+		hrtime_t now = gethrtime();
+
+		for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
+			zio_t *zio = list_head(&vq->vq_class[p].vqc_fifo);
+
+			if (zio != NULL &&
+			    now - zio->io_timestamp >
+			    vdev_queue_class_deadline(p) &&
+			    vq->vq_class[p].vqc_active <
+			    vdev_queue_class_max_active(spa, p)) {
+				*expiredp = B_TRUE;
+				return (p);
+			}
+		}
+	}
+
 	/* find a queue that has not reached its minimum # outstanding i/os */
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		if (avl_numnodes(vdev_queue_class_tree(vq, p)) > 0 &&
@@ -374,7 +568,7 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		if (avl_numnodes(vdev_queue_class_tree(vq, p)) > 0 &&
 		    vq->vq_class[p].vqc_active <
-		    vdev_queue_class_max_active(spa, p))
+		    vdev_queue_class_limit(vq, p))
 			return (p);
 	}
 
@@ -382,6 +576,27 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	return (ZIO_PRIORITY_NUM_QUEUEABLE);
 }
 
+void
+vdev_queue_stat_init(void)
+{
+	vdev_queue_ksp = kstat_create("zfs", 0, "vdev_queue_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (vdev_queue_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (vdev_queue_ksp != NULL) {
+		vdev_queue_ksp->ks_data = &vdev_queue_stats;
+		kstat_install(vdev_queue_ksp);
+	}
+}
+
+void
+vdev_queue_stat_fini(void)
+{
+	if (vdev_queue_ksp != NULL) {
+		kstat_delete(vdev_queue_ksp);
+		vdev_queue_ksp = NULL;
+	}
+}
+
 void
 vdev_queue_init(vdev_t *vd)
 {
@@ -400,6 +615,9 @@ vdev_queue_init(vdev_t *vd)
 	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE),
 		vdev_queue_offset_compare, sizeof (zio_t),
 		offsetof(struct zio, io_offset_node));
+	avl_create(vdev_queue_type_tree(vq, ZIO_TYPE_TRIM),
+		vdev_queue_offset_compare, sizeof (zio_t),
+		offsetof(struct zio, io_offset_node));
 
 	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		int (*compfn) (const void *, const void *);
@@ -415,9 +633,14 @@ vdev_queue_init(vdev_t *vd)
 			compfn = vdev_queue_offset_compare;
 		avl_create(vdev_queue_class_tree(vq, p), compfn,
 			sizeof (zio_t), offsetof(struct zio, io_queue_node));
+		list_create(&vq->vq_class[p].vqc_fifo, sizeof (zio_t),
+		    offsetof(struct zio, io_fifo_node));
+		vq->vq_class[p].vqc_limit = zfs_vdev_max_active;
 	}
 
 	vq->vq_lastoffset = 0;
+	vq->vq_lat_ewma = 0;
+	vq->vq_lat_samples = 0;
 }
 
 void
@@ -426,11 +649,14 @@ vdev_queue_fini(vdev_t *vd)
 	vdev_queue_t *vq = &vd->vdev_queue;
 	zio_priority_t p;
 
-	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
+	for (p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++) {
 		avl_destroy(vdev_queue_class_tree(vq, p));
+		list_destroy(&vq->vq_class[p].vqc_fifo);
+	}
 	avl_destroy(&vq->vq_active_tree);
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_READ));
 	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_WRITE));
+	avl_destroy(vdev_queue_type_tree(vq, ZIO_TYPE_TRIM));
 
 	mutex_destroy(&vq->vq_lock);
 }
@@ -446,6 +672,7 @@ vdev_queue_io_add(vdev_queue_t *vq, zio_t *zio)
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
 	avl_add(vdev_queue_class_tree(vq, zio->io_priority), zio);
 	avl_add(vdev_queue_type_tree(vq, zio->io_type), zio);
+	list_insert_tail(&vq->vq_class[zio->io_priority].vqc_fifo, zio);
 
 #ifdef LINUX
     if (ssh->kstat != NULL) {
@@ -467,6 +694,7 @@ vdev_queue_io_remove(vdev_queue_t *vq, zio_t *zio)
 	ASSERT3U(zio->io_priority, <, ZIO_PRIORITY_NUM_QUEUEABLE);
 	avl_remove(vdev_queue_class_tree(vq, zio->io_priority), zio);
 	avl_remove(vdev_queue_type_tree(vq, zio->io_type), zio);
+	list_remove(&vq->vq_class[zio->io_priority].vqc_fifo, zio);
 
 #ifdef LINUX
 	if (ssh->kstat != NULL) {
@@ -490,6 +718,19 @@ vdev_queue_pending_add(vdev_queue_t *vq, zio_t *zio)
 	vq->vq_class[zio->io_priority].vqc_active++;
 	avl_add(&vq->vq_active_tree, zio);
 
+	/*
+	 * Split the queue wait out of the vdev_io_start stage time, which
+	 * then only covers the device.  Aggregate I/Os have not run any
+	 * stage yet and are not timed.
+	 */
+	if (zio->io_stage_last != 0) {
+		hrtime_t now = gethrtime();
+
+		spa_zio_stage_add(zio->io_spa, zio->io_type, zio->io_priority,
+		    ZIO_STAGE_STAT_QUEUE, now - zio->io_timestamp);
+		zio->io_stage_ts = now;
+	}
+
 #ifdef LINUX
 	if (ssh->kstat != NULL) {
 		mutex_enter(&ssh->lock);
@@ -533,12 +774,21 @@ vdev_queue_pending_remove(vdev_queue_t *vq, zio_t *zio)
 static void
 vdev_queue_agg_io_done(zio_t *aio)
 {
+	if (abd_is_gang(aio->io_abd)) {
+		/* the data is already where it belongs */
+		abd_put(aio->io_abd);
+		if (aio->io_private != NULL)
+			abd_free(aio->io_private);
+		return;
+	}
+
 	if (aio->io_type == ZIO_TYPE_READ) {
 		zio_t *pio;
 		zio_link_t *zl = NULL;
 		while ((pio = zio_walk_parents(aio, &zl)) != NULL) {
 			abd_copy_off(pio->io_abd, aio->io_abd,
 			    0, pio->io_offset - aio->io_offset, pio->io_size);
+			VQSTAT_INCR(vqs_agg_copied_bytes, pio->io_size);
 		}
 	}
 
@@ -554,10 +804,79 @@ vdev_queue_agg_io_done(zio_t *aio)
 #define	IO_SPAN(fio, lio) ((lio)->io_offset + (lio)->io_size - (fio)->io_offset)
 #define	IO_GAP(fio, lio) (-IO_SPAN(lio, fio))
 
+/*
+ * Build a gang ABD for the aggregation of first..last out of the
+ * children's own buffers. Read gaps and NODATA writes are pointed at a
+ * scratch buffer, returned in *scratchp, which must be freed along with
+ * the gang. Returns NULL if some child can't be referenced in place.
+ */
+static abd_t *
+vdev_queue_agg_gang(avl_tree_t *t, zio_t *first, zio_t *last, uint64_t size,
+    abd_t **scratchp)
+{
+	zio_t *dio, *prev;
+	abd_t *abd, *scratch = NULL;
+	uint64_t fill = 0, foff = 0;
+	boolean_t ok = B_TRUE;
+
+	/* how much of the span isn't covered by child data */
+	prev = NULL;
+	for (dio = first; ; dio = AVL_NEXT(t, dio)) {
+		if (prev != NULL) {
+			ASSERT3S((int64_t)IO_GAP(prev, dio), >=, 0);
+			fill += IO_GAP(prev, dio);
+		}
+		if (dio->io_flags & ZIO_FLAG_NODATA)
+			fill += dio->io_size;
+		prev = dio;
+		if (dio == last)
+			break;
+	}
+
+	if (fill != 0) {
+		scratch = abd_alloc_linear(fill, B_FALSE);
+		if (first->io_type == ZIO_TYPE_WRITE)
+			abd_zero(scratch, fill);
+	}
+
+	abd = abd_alloc_gang(size);
+	prev = NULL;
+	for (dio = first; ok; dio = AVL_NEXT(t, dio)) {
+		if (prev != NULL && IO_GAP(prev, dio) != 0) {
+			ok = abd_gang_add(abd, scratch, foff,
+			    IO_GAP(prev, dio));
+			foff += IO_GAP(prev, dio);
+		}
+		if (!ok) {
+			break;
+		} else if (dio->io_flags & ZIO_FLAG_NODATA) {
+			ok = abd_gang_add(abd, scratch, foff, dio->io_size);
+			foff += dio->io_size;
+		} else {
+			ok = abd_gang_add(abd, dio->io_abd, 0, dio->io_size);
+		}
+		prev = dio;
+		if (dio == last)
+			break;
+	}
+
+	if (!ok) {
+		abd_put(abd);
+		if (scratch != NULL)
+			abd_free(scratch);
+		return (NULL);
+	}
+
+	ASSERT3U(foff, ==, fill);
+	*scratchp = scratch;
+	return (abd);
+}
+
 static zio_t *
 vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 {
 	zio_t *first, *last, *aio, *dio, *mandatory, *nio;
+	abd_t *abd = NULL, *scratch = NULL;
 	uint64_t maxgap = 0;
 	uint64_t size;
 	boolean_t stretch = B_FALSE;
@@ -567,6 +886,13 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	if (zio->io_flags & ZIO_FLAG_DONT_AGGREGATE)
 		return (NULL);
 
+	/*
+	 * TRIMs are not aggregated; vdev_trim.c already issues them as
+	 * large contiguous extents.
+	 */
+	if (zio->io_type == ZIO_TYPE_TRIM)
+		return (NULL);
+
 	/*
 	 * Prevent users from setting the zfs_vdev_aggregation_limit
 	 * tuning larger than SPA_MAXBLOCKSIZE.
@@ -681,10 +1007,20 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 	size = IO_SPAN(first, last);
 	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
 
+	if (zfs_vdev_aggregate_gang)
+		abd = vdev_queue_agg_gang(t, first, last, size, &scratch);
+	VQSTAT_BUMP(vqs_agg_ios);
+	if (abd != NULL) {
+		VQSTAT_BUMP(vqs_agg_gang_ios);
+		VQSTAT_INCR(vqs_agg_gang_bytes, size);
+	} else {
+		abd = abd_alloc_for_io(size, B_TRUE);
+	}
+
 	aio = zio_vdev_delegated_io(first->io_vd, first->io_offset,
-	    abd_alloc_for_io(size, B_TRUE), size, first->io_type,
+	    abd, size, first->io_type,
 	    zio->io_priority, flags | ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE,
-	    vdev_queue_agg_io_done, NULL);
+	    vdev_queue_agg_io_done, scratch);
 	aio->io_timestamp = first->io_timestamp;
 
 	nio = first;
@@ -693,13 +1029,16 @@ vdev_queue_aggregate(vdev_queue_t *vq, zio_t *zio)
 		nio = AVL_NEXT(t, dio);
 		ASSERT3U(dio->io_type, ==, aio->io_type);
 
-		if (dio->io_flags & ZIO_FLAG_NODATA) {
+		if (abd_is_gang(aio->io_abd)) {
+			/* filled in by vdev_queue_agg_gang() */
+		} else if (dio->io_flags & ZIO_FLAG_NODATA) {
 			ASSERT3U(dio->io_type, ==, ZIO_TYPE_WRITE);
 			abd_zero_off(aio->io_abd,
 			    dio->io_offset - aio->io_offset, dio->io_size);
 		} else if (dio->io_type == ZIO_TYPE_WRITE) {
 			abd_copy_off(aio->io_abd, dio->io_abd,
 			    dio->io_offset - aio->io_offset, 0, dio->io_size);
+			VQSTAT_INCR(vqs_agg_copied_bytes, dio->io_size);
 		}
 
 		zio_add_child(dio, aio);
@@ -718,11 +1057,12 @@ vdev_queue_io_to_issue(vdev_queue_t *vq)
 	zio_priority_t p;
 	avl_index_t idx;
 	avl_tree_t *tree;
+	boolean_t expired;
 
 again:
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
-	p = vdev_queue_class_to_issue(vq);
+	p = vdev_queue_class_to_issue(vq, &expired);
 
 	if (p == ZIO_PRIORITY_NUM_QUEUEABLE) {
 		/* No eligible queued i/os */
@@ -734,15 +1074,22 @@ again:
 	 * i/o which follows the most recently issued i/o in LBA (offset) order.
 	 *
 	 * For FIFO queues (sync), issue the i/o with the lowest timestamp.
+	 *
+	 * An i/o past its deadline is issued regardless.
 	 */
-	tree = vdev_queue_class_tree(vq, p);
-	vq->vq_io_search.io_timestamp = 0;
-	vq->vq_io_search.io_offset = vq->vq_last_offset + 1;
-	VERIFY3P(avl_find(tree, &vq->vq_io_search,
-	    &idx), ==, NULL);
-	zio = avl_nearest(tree, idx, AVL_AFTER);
-	if (zio == NULL)
-		zio = avl_first(tree);
+	if (expired) {
+		zio = list_head(&vq->vq_class[p].vqc_fifo);
+		VQSTAT_BUMP(vqs_deadline_promoted);
+	} else {
+		tree = vdev_queue_class_tree(vq, p);
+		vq->vq_io_search.io_timestamp = 0;
+		vq->vq_io_search.io_offset = vq->vq_last_offset + 1;
+		VERIFY3P(avl_find(tree, &vq->vq_io_search,
+		    &idx), ==, NULL);
+		zio = avl_nearest(tree, idx, AVL_AFTER);
+		if (zio == NULL)
+			zio = avl_first(tree);
+	}
 	ASSERT3U(zio->io_priority, ==, p);
 
 	aio = vdev_queue_aggregate(vq, zio);
@@ -791,13 +1138,15 @@ vdev_queue_io(zio_t *zio)
 		    zio->io_priority != ZIO_PRIORITY_REMOVAL &&
 		    zio->io_priority != ZIO_PRIORITY_INITIALIZING)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_READ;
-	} else {
-		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
+	} else if (zio->io_type == ZIO_TYPE_WRITE) {
 		if (zio->io_priority != ZIO_PRIORITY_SYNC_WRITE &&
 		    zio->io_priority != ZIO_PRIORITY_ASYNC_WRITE &&
 		    zio->io_priority != ZIO_PRIORITY_REMOVAL &&
 		    zio->io_priority != ZIO_PRIORITY_INITIALIZING)
 			zio->io_priority = ZIO_PRIORITY_ASYNC_WRITE;
+	} else {
+		ASSERT(zio->io_type == ZIO_TYPE_TRIM);
+		ASSERT(zio->io_priority == ZIO_PRIORITY_TRIM);
 	}
 
 	zio->io_flags |= ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_QUEUE;
@@ -833,6 +1182,24 @@ vdev_queue_io_done(zio_t *zio)
 	vq->vq_io_complete_ts = gethrtime();
 	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
 
+	if (zfs_vdev_deadline)
+		vdev_queue_deadline_update(vq, zio, vq->vq_io_complete_ts);
+
+	/*
+	 * TRIMs take time in proportion to their (often huge) size and
+	 * don't tell us anything about how fast reads would be.
+	 */
+	if (zio->io_type != ZIO_TYPE_TRIM && zio->io_delay > 0) {
+		uint64_t lat = zio->io_delay;
+		int shift = MIN(MAX(zfs_vdev_latency_ewma_shift, 0), 16);
+
+		if (vq->vq_lat_samples++ == 0)
+			vq->vq_lat_ewma = lat;
+		else
+			vq->vq_lat_ewma = vq->vq_lat_ewma -
+			    (vq->vq_lat_ewma >> shift) + (lat >> shift);
+	}
+
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
@@ -848,7 +1215,7 @@ vdev_queue_io_done(zio_t *zio)
 }
 
 /*
- * As these three methods are only used for load calculations we're not
+ * As these methods are only used for load calculations we're not
  * concerned if we get an incorrect value on 32bit platforms due to lack of
  * vq_lock mutex use here, instead we prefer to keep it lock free for
  * performance.
@@ -870,3 +1237,13 @@ vdev_queue_register_lastoffset(vdev_t *vd, zio_t *zio)
 {
 	vd->vdev_queue.vq_lastoffset = zio->io_offset + zio->io_size;
 }
+
+/*
+ * Moving average of the device time of the vdev's i/os, in nanoseconds,
+ * or 0 if nothing is known yet (or the vdev isn't a leaf).
+ */
+uint64_t
+vdev_queue_latency(vdev_t *vd)
+{
+	return (vd->vdev_queue.vq_lat_ewma);
+}
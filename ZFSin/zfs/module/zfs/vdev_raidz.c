@@ -32,6 +32,7 @@
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
 #include <sys/abd.h>
+#include <sys/vdev_raidz_impl.h>
 #include <sys/fs/zfs.h>
 #include <sys/fm/fs/zfs.h>
 
@@ -138,29 +139,6 @@ typedef struct raidz_map {
 #define	VDEV_RAIDZ_Q		1
 #define	VDEV_RAIDZ_R		2
 
-#define	VDEV_RAIDZ_MUL_2(x)	(((x) << 1) ^ (((x) & 0x80) ? 0x1d : 0))
-#define	VDEV_RAIDZ_MUL_4(x)	(VDEV_RAIDZ_MUL_2(VDEV_RAIDZ_MUL_2(x)))
-
-/*
- * We provide a mechanism to perform the field multiplication operation on a
- * 64-bit value all at once rather than a byte at a time. This works by
- * creating a mask from the top bit in each byte and using that to
- * conditionally apply the XOR of 0x1d.
- */
-#define	VDEV_RAIDZ_64MUL_2(x, mask) \
-{ \
-	(mask) = (x) & 0x8080808080808080ULL; \
-	(mask) = ((mask) << 1) - ((mask) >> 7); \
-	(x) = (((x) << 1) & 0xfefefefefefefefeULL) ^ \
-	    ((mask) & 0x1d1d1d1d1d1d1d1dULL); \
-}
-
-#define	VDEV_RAIDZ_64MUL_4(x, mask) \
-{ \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-	VDEV_RAIDZ_64MUL_2((x), mask); \
-}
-
 #define VDEV_LABEL_OFFSET(x)    (x + VDEV_LABEL_START_SIZE)
 
 /*
@@ -609,23 +587,27 @@ vdev_raidz_map_alloc(abd_t *abd, uint64_t size, uint64_t offset,
 	return (rm);
 }
 
+/*
+ * The parity columns are always linear buffers; these callbacks walk them
+ * in step with the chunks of a (possibly scattered) data column. The math
+ * itself is done by the backend selected in vdev_raidz_math.c.
+ */
 struct pqr_struct {
-	uint64_t *p;
-	uint64_t *q;
-	uint64_t *r;
+	const raidz_math_t *rzm;
+	uint8_t *p;
+	uint8_t *q;
+	uint8_t *r;
 };
 
 static int
 vdev_raidz_p_func(void *buf, size_t size, void *private)
 {
 	struct pqr_struct *pqr = private;
-	const uint64_t *src = buf;
-	int i, cnt = size / sizeof (src[0]);
 
 	ASSERT(pqr->p && !pqr->q && !pqr->r);
 
-	for (i = 0; i < cnt; i++, src++, pqr->p++)
-		*pqr->p ^= *src;
+	vdev_raidz_math_add(pqr->rzm, pqr->p, buf, size);
+	pqr->p += size;
 
 	return (0);
 }
@@ -634,17 +616,12 @@ static int
 vdev_raidz_pq_func(void *buf, size_t size, void *private)
 {
 	struct pqr_struct *pqr = private;
-	const uint64_t *src = buf;
-	uint64_t mask;
-	int i, cnt = size / sizeof (src[0]);
 
 	ASSERT(pqr->p && pqr->q && !pqr->r);
 
-	for (i = 0; i < cnt; i++, src++, pqr->p++, pqr->q++) {
-		*pqr->p ^= *src;
-		VDEV_RAIDZ_64MUL_2(*pqr->q, mask);
-		*pqr->q ^= *src;
-	}
+	vdev_raidz_math_gen_pq(pqr->rzm, pqr->p, pqr->q, buf, size);
+	pqr->p += size;
+	pqr->q += size;
 
 	return (0);
 }
@@ -653,27 +630,22 @@ static int
 vdev_raidz_pqr_func(void *buf, size_t size, void *private)
 {
 	struct pqr_struct *pqr = private;
-	const uint64_t *src = buf;
-	uint64_t mask;
-	int i, cnt = size / sizeof (src[0]);
 
 	ASSERT(pqr->p && pqr->q && pqr->r);
 
-	for (i = 0; i < cnt; i++, src++, pqr->p++, pqr->q++, pqr->r++) {
-		*pqr->p ^= *src;
-		VDEV_RAIDZ_64MUL_2(*pqr->q, mask);
-		*pqr->q ^= *src;
-		VDEV_RAIDZ_64MUL_4(*pqr->r, mask);
-		*pqr->r ^= *src;
-	}
+	vdev_raidz_math_gen_pqr(pqr->rzm, pqr->p, pqr->q, pqr->r, buf,
+	    size);
+	pqr->p += size;
+	pqr->q += size;
+	pqr->r += size;
 
 	return (0);
 }
 
 static void
-vdev_raidz_generate_parity_p(raidz_map_t *rm)
+vdev_raidz_generate_parity_p(raidz_map_t *rm, const raidz_math_t *rzm)
 {
-	uint64_t *p;
+	uint8_t *p;
 	int c;
 	abd_t *src;
 
@@ -685,7 +657,7 @@ vdev_raidz_generate_parity_p(raidz_map_t *rm)
 			ASSERT3U(src->abd_size,>=,rm->rm_col[c].rc_size);
 			abd_copy_to_buf_off(p, src, 0, rm->rm_col[c].rc_size);
 		} else {
-			struct pqr_struct pqr = { p, NULL, NULL };
+			struct pqr_struct pqr = { rzm, p, NULL, NULL };
 			(void) abd_iterate_func(src, 0, rm->rm_col[c].rc_size,
 			    vdev_raidz_p_func, &pqr);
 		}
@@ -693,13 +665,14 @@ vdev_raidz_generate_parity_p(raidz_map_t *rm)
 }
 
 static void
-vdev_raidz_generate_parity_pq(raidz_map_t *rm)
+vdev_raidz_generate_parity_pq(raidz_map_t *rm, const raidz_math_t *rzm)
 {
-	uint64_t *p, *q, pcnt, ccnt, mask, i;
+	uint8_t *p, *q;
+	uint64_t psize, csize;
 	int c;
 	abd_t *src;
 
-	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (p[0]);
+	psize = rm->rm_col[VDEV_RAIDZ_P].rc_size;
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
 
@@ -708,45 +681,46 @@ vdev_raidz_generate_parity_pq(raidz_map_t *rm)
 		p = abd_to_buf(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
 		q = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
 
-		ccnt = rm->rm_col[c].rc_size / sizeof (p[0]);
+		csize = rm->rm_col[c].rc_size;
 
 		if (c == rm->rm_firstdatacol) {
-			ASSERT(ccnt == pcnt || ccnt == 0);
+			ASSERT(csize == psize || csize == 0);
 
-			abd_copy_to_buf_off(p, src, 0, rm->rm_col[c].rc_size);
-			(void) memcpy(q, p, rm->rm_col[c].rc_size);
+			abd_copy_to_buf_off(p, src, 0, csize);
+			(void) memcpy(q, p, csize);
 
-			for (i = ccnt; i < pcnt; i++) {
-				p[i] = 0;
-				q[i] = 0;
+			if (csize < psize) {
+				bzero(p + csize, psize - csize);
+				bzero(q + csize, psize - csize);
 			}
 		} else {
-			struct pqr_struct pqr = { p, q, NULL };
+			struct pqr_struct pqr = { rzm, p, q, NULL };
 
-			ASSERT(ccnt <= pcnt);
+			ASSERT(csize <= psize);
 
-			(void) abd_iterate_func(src, 0, rm->rm_col[c].rc_size,
+			(void) abd_iterate_func(src, 0, csize,
 			    vdev_raidz_pq_func, &pqr);
 
 			/*
 			 * Treat short columns as though they are full of 0s.
 			 * Note that there's therefore nothing needed for P.
 			 */
-			for (i = ccnt; i < pcnt; i++) {
-				VDEV_RAIDZ_64MUL_2(q[i], mask);
-			}
+			if (csize < psize)
+				vdev_raidz_math_mul2(rzm, q + csize,
+				    psize - csize);
 		}
 	}
 }
 
 static void
-vdev_raidz_generate_parity_pqr(raidz_map_t *rm)
+vdev_raidz_generate_parity_pqr(raidz_map_t *rm, const raidz_math_t *rzm)
 {
-	uint64_t *p, *q, *r, pcnt, ccnt, mask, i;
+	uint8_t *p, *q, *r;
+	uint64_t psize, csize;
 	int c;
 	abd_t *src;
 
-	pcnt = rm->rm_col[VDEV_RAIDZ_P].rc_size / sizeof (p[0]);
+	psize = rm->rm_col[VDEV_RAIDZ_P].rc_size;
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
 	    rm->rm_col[VDEV_RAIDZ_Q].rc_size);
 	ASSERT(rm->rm_col[VDEV_RAIDZ_P].rc_size ==
@@ -758,34 +732,38 @@ vdev_raidz_generate_parity_pqr(raidz_map_t *rm)
 		q = abd_to_buf(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
 		r = abd_to_buf(rm->rm_col[VDEV_RAIDZ_R].rc_abd);
 
-		ccnt = rm->rm_col[c].rc_size / sizeof (p[0]);
+		csize = rm->rm_col[c].rc_size;
 
 		if (c == rm->rm_firstdatacol) {
-			ASSERT3S(src->abd_size,>=,rm->rm_col[c].rc_size);
-			ASSERT(ccnt == pcnt || ccnt == 0);
-			abd_copy_to_buf_off(p, src, 0, rm->rm_col[c].rc_size);
-			(void) memcpy(q, p, rm->rm_col[c].rc_size);
-			(void) memcpy(r, p, rm->rm_col[c].rc_size);
-
-			for (i = ccnt; i < pcnt; i++) {
-				p[i] = 0;
-				q[i] = 0;
-				r[i] = 0;
+			ASSERT3S(src->abd_size,>=,csize);
+			ASSERT(csize == psize || csize == 0);
+			abd_copy_to_buf_off(p, src, 0, csize);
+			(void) memcpy(q, p, csize);
+			(void) memcpy(r, p, csize);
+
+			if (csize < psize) {
+				bzero(p + csize, psize - csize);
+				bzero(q + csize, psize - csize);
+				bzero(r + csize, psize - csize);
 			}
 		} else {
-			struct pqr_struct pqr = { p, q, r };
+			struct pqr_struct pqr = { rzm, p, q, r };
 
-			ASSERT(ccnt <= pcnt);
-			(void) abd_iterate_func(src, 0, rm->rm_col[c].rc_size,
+			ASSERT(csize <= psize);
+			(void) abd_iterate_func(src, 0, csize,
 			    vdev_raidz_pqr_func, &pqr);
 
 			/*
 			 * Treat short columns as though they are full of 0s.
 			 * Note that there's therefore nothing needed for P.
 			 */
-			for (i = ccnt; i < pcnt; i++) {
-				VDEV_RAIDZ_64MUL_2(q[i], mask);
-				VDEV_RAIDZ_64MUL_4(r[i], mask);
+			if (csize < psize) {
+				vdev_raidz_math_mul2(rzm, q + csize,
+				    psize - csize);
+				vdev_raidz_math_mul2(rzm, r + csize,
+				    psize - csize);
+				vdev_raidz_math_mul2(rzm, r + csize,
+				    psize - csize);
 			}
 		}
 	}
@@ -798,117 +776,106 @@ vdev_raidz_generate_parity_pqr(raidz_map_t *rm)
 static void
 vdev_raidz_generate_parity(raidz_map_t *rm)
 {
+	raidz_math_t rzm;
+
+	vdev_raidz_math_begin(&rzm);
 	switch (rm->rm_firstdatacol) {
 	case 1:
-		vdev_raidz_generate_parity_p(rm);
+		vdev_raidz_generate_parity_p(rm, &rzm);
 		break;
 	case 2:
-		vdev_raidz_generate_parity_pq(rm);
+		vdev_raidz_generate_parity_pq(rm, &rzm);
 		break;
 	case 3:
-		vdev_raidz_generate_parity_pqr(rm);
+		vdev_raidz_generate_parity_pqr(rm, &rzm);
 		break;
 	default:
 		cmn_err(CE_PANIC, "invalid RAID-Z configuration");
 	}
+	vdev_raidz_math_end(&rzm);
 }
 
-/* ARGSUSED */
 static int
 vdev_raidz_reconst_p_func(void *dbuf, void *sbuf, size_t size, void *private)
 {
-	uint64_t *dst = dbuf;
-	uint64_t *src = sbuf;
-	int cnt = size / sizeof (src[0]);
-
-	for (int i = 0; i < cnt; i++) {
-		dst[i] ^= src[i];
-	}
+	vdev_raidz_math_add(private, dbuf, sbuf, size);
 
 	return (0);
 }
 
-/* ARGSUSED */
 static int
 vdev_raidz_reconst_q_pre_func(void *dbuf, void *sbuf, size_t size,
     void *private)
 {
-	uint64_t *dst = dbuf;
-	uint64_t *src = sbuf;
-	uint64_t mask;
-	int cnt = size / sizeof (dst[0]);
-
-	for (int i = 0; i < cnt; i++, dst++, src++) {
-		VDEV_RAIDZ_64MUL_2(*dst, mask);
-		*dst ^= *src;
-	}
+	vdev_raidz_math_mul2_add(private, dbuf, sbuf, size);
 
 	return (0);
 }
 
-/* ARGSUSED */
 static int
 vdev_raidz_reconst_q_pre_tail_func(void *buf, size_t size, void *private)
 {
-	uint64_t *dst = buf;
-	uint64_t mask;
-	int cnt = size / sizeof (dst[0]);
-
-	for (int i = 0; i < cnt; i++, dst++) {
-		/* same operation as vdev_raidz_reconst_q_pre_func() on dst */
-		VDEV_RAIDZ_64MUL_2(*dst, mask);
-	}
+	/* same operation as vdev_raidz_reconst_q_pre_func() on dst */
+	vdev_raidz_math_mul2(private, buf, size);
 
 	return (0);
 }
 
 struct reconst_q_struct {
-	uint64_t *q;
-	int exp;
+	const raidz_math_t *rzm;
+	uint8_t *q;
+	uint8_t coeff;
 };
 
 static int
 vdev_raidz_reconst_q_post_func(void *buf, size_t size, void *private)
 {
 	struct reconst_q_struct *rq = private;
-	uint64_t *dst = buf;
-	int cnt = size / sizeof (dst[0]);
-
-	for (int i = 0; i < cnt; i++, dst++, rq->q++) {
-		*dst ^= *rq->q;
 
-		int j;
-		uint8_t *b;
-		for (j = 0, b = (uint8_t *)dst; j < 8; j++, b++) {
-			*b = vdev_raidz_exp2(*b, rq->exp);
-		}
-	}
+	vdev_raidz_math_add(rq->rzm, buf, rq->q, size);
+	vdev_raidz_math_mul(rq->rzm, buf, buf, rq->coeff, size);
+	rq->q += size;
 
 	return (0);
 }
 
+/*
+ * Pxy and Qxy are scratch buffers owned by vdev_raidz_reconstruct_pq(), so
+ * P + Pxy and Q + Qxy are accumulated into them in place.
+ */
 struct reconst_pq_struct {
+	const raidz_math_t *rzm;
 	uint8_t *p;
 	uint8_t *q;
 	uint8_t *pxy;
 	uint8_t *qxy;
-	int aexp;
-	int bexp;
+	uint8_t a;
+	uint8_t b;
 };
 
+static void
+vdev_raidz_reconst_pq_x(struct reconst_pq_struct *rpq, uint8_t *xd,
+    size_t size)
+{
+	vdev_raidz_math_add(rpq->rzm, rpq->pxy, rpq->p, size);
+	vdev_raidz_math_add(rpq->rzm, rpq->qxy, rpq->q, size);
+	vdev_raidz_math_mul(rpq->rzm, xd, rpq->pxy, rpq->a, size);
+	vdev_raidz_math_mul_add(rpq->rzm, xd, rpq->qxy, rpq->b, size);
+}
+
 static int
 vdev_raidz_reconst_pq_func(void *xbuf, void *ybuf, size_t size, void *private)
 {
 	struct reconst_pq_struct *rpq = private;
-	uint8_t *xd = xbuf;
-	uint8_t *yd = ybuf;
-
-	for (int i = 0; i < size;
-	    i++, rpq->p++, rpq->q++, rpq->pxy++, rpq->qxy++, xd++, yd++) {
-		*xd = vdev_raidz_exp2(*rpq->p ^ *rpq->pxy, rpq->aexp) ^
-		    vdev_raidz_exp2(*rpq->q ^ *rpq->qxy, rpq->bexp);
-		*yd = *rpq->p ^ *rpq->pxy ^ *xd;
-	}
+
+	vdev_raidz_reconst_pq_x(rpq, xbuf, size);
+	(void) memcpy(ybuf, rpq->pxy, size);
+	vdev_raidz_math_add(rpq->rzm, ybuf, xbuf, size);
+
+	rpq->p += size;
+	rpq->q += size;
+	rpq->pxy += size;
+	rpq->qxy += size;
 
 	return (0);
 }
@@ -917,14 +884,14 @@ static int
 vdev_raidz_reconst_pq_tail_func(void *xbuf, size_t size, void *private)
 {
 	struct reconst_pq_struct *rpq = private;
-	uint8_t *xd = xbuf;
 
-	for (int i = 0; i < size;
-	    i++, rpq->p++, rpq->q++, rpq->pxy++, rpq->qxy++, xd++) {
-		/* same operation as vdev_raidz_reconst_pq_func() on xd */
-		*xd = vdev_raidz_exp2(*rpq->p ^ *rpq->pxy, rpq->aexp) ^
-		    vdev_raidz_exp2(*rpq->q ^ *rpq->qxy, rpq->bexp);
-	}
+	/* same operation as vdev_raidz_reconst_pq_func() on xd */
+	vdev_raidz_reconst_pq_x(rpq, xbuf, size);
+
+	rpq->p += size;
+	rpq->q += size;
+	rpq->pxy += size;
+	rpq->qxy += size;
 
 	return (0);
 }
@@ -935,6 +902,7 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 	int x = tgts[0];
 	int c;
 	abd_t *dst, *src;
+	raidz_math_t rzm;
 
 	ASSERT(ntgts == 1);
 	ASSERT(x >= rm->rm_firstdatacol);
@@ -950,6 +918,7 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 	ASSERT3S(src->abd_size,>=,rm->rm_col[x].rc_size);
 	abd_copy_off(dst, src, 0, 0, rm->rm_col[x].rc_size);
 
+	vdev_raidz_math_begin(&rzm);
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
 		uint64_t size = MIN(rm->rm_col[x].rc_size,
 		    rm->rm_col[c].rc_size);
@@ -961,8 +930,9 @@ vdev_raidz_reconstruct_p(raidz_map_t *rm, int *tgts, int ntgts)
 			continue;
 
 		(void) abd_iterate_func2(dst, src, 0, 0, size,
-		    vdev_raidz_reconst_p_func, NULL);
+		    vdev_raidz_reconst_p_func, &rzm);
 	}
+	vdev_raidz_math_end(&rzm);
 
 	return (1 << VDEV_RAIDZ_P);
 }
@@ -973,11 +943,13 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 	int x = tgts[0];
 	int c, exp;
 	abd_t *dst, *src;
+	raidz_math_t rzm;
 
 	ASSERT(ntgts == 1);
 
 	ASSERT(rm->rm_col[x].rc_size <= rm->rm_col[VDEV_RAIDZ_Q].rc_size);
 
+	vdev_raidz_math_begin(&rzm);
 	for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
 		uint64_t size = (c == x) ? 0 : MIN(rm->rm_col[x].rc_size,
 		    rm->rm_col[c].rc_size);
@@ -998,10 +970,10 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 			ASSERT3U(size, <=, rm->rm_col[x].rc_size);
 			if (src != dst)
 				(void) abd_iterate_func2(dst, src, 0, 0, size,
-				    vdev_raidz_reconst_q_pre_func, NULL);
+				    vdev_raidz_reconst_q_pre_func, &rzm);
 			(void) abd_iterate_func(dst,
 			    size, rm->rm_col[x].rc_size - size,
-			    vdev_raidz_reconst_q_pre_tail_func, NULL);
+			    vdev_raidz_reconst_q_pre_tail_func, &rzm);
 		}
 	}
 
@@ -1009,9 +981,11 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 	dst = rm->rm_col[x].rc_abd;
 	exp = 255 - (rm->rm_cols - 1 - x);
 
-	struct reconst_q_struct rq = { abd_to_buf(src), exp };
+	struct reconst_q_struct rq = { &rzm, abd_to_buf(src),
+	    vdev_raidz_exp2(1, exp) };
 	(void) abd_iterate_func(dst, 0, rm->rm_col[x].rc_size,
 	    vdev_raidz_reconst_q_post_func, &rq);
+	vdev_raidz_math_end(&rzm);
 
 	return (1 << VDEV_RAIDZ_Q);
 }
@@ -1019,12 +993,13 @@ vdev_raidz_reconstruct_q(raidz_map_t *rm, int *tgts, int ntgts)
 static int
 vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 {
-	uint8_t *p, *q, *pxy, *qxy, tmp, a, b, aexp, bexp;
+	uint8_t *p, *q, *pxy, *qxy, tmp, a, b;
 	abd_t *pdata, *qdata;
 	uint64_t xsize, ysize;
 	int x = tgts[0];
 	int y = tgts[1];
 	abd_t *xd, *yd;
+	raidz_math_t rzm;
 
 	ASSERT(ntgts == 2);
 	ASSERT(x < y);
@@ -1052,7 +1027,8 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	rm->rm_col[x].rc_size = 0;
 	rm->rm_col[y].rc_size = 0;
 
-	vdev_raidz_generate_parity_pq(rm);
+	vdev_raidz_math_begin(&rzm);
+	vdev_raidz_generate_parity_pq(rm, &rzm);
 
 	rm->rm_col[x].rc_size = xsize;
 	rm->rm_col[y].rc_size = ysize;
@@ -1083,15 +1059,14 @@ vdev_raidz_reconstruct_pq(raidz_map_t *rm, int *tgts, int ntgts)
 	b = vdev_raidz_pow2[255 - (rm->rm_cols - 1 - x)];
 	tmp = 255 - vdev_raidz_log2[a ^ 1];
 
-	aexp = vdev_raidz_log2[vdev_raidz_exp2(a, tmp)];
-	bexp = vdev_raidz_log2[vdev_raidz_exp2(b, tmp)];
-
 	ASSERT3U(xsize, >=, ysize);
-	struct reconst_pq_struct rpq = { p, q, pxy, qxy, aexp, bexp };
+	struct reconst_pq_struct rpq = { &rzm, p, q, pxy, qxy,
+	    vdev_raidz_exp2(a, tmp), vdev_raidz_exp2(b, tmp) };
 	(void) abd_iterate_func2(xd, yd, 0, 0, ysize,
 	    vdev_raidz_reconst_pq_func, &rpq);
 	(void) abd_iterate_func(xd, ysize, xsize - ysize,
 	    vdev_raidz_reconst_pq_tail_func, &rpq);
+	vdev_raidz_math_end(&rzm);
 
 	abd_free(rm->rm_col[VDEV_RAIDZ_P].rc_abd);
 	abd_free(rm->rm_col[VDEV_RAIDZ_Q].rc_abd);
@@ -1387,76 +1362,44 @@ static void
 vdev_raidz_matrix_reconstruct(raidz_map_t *rm, int n, int nmissing,
     int *missing, uint8_t **invrows, const uint8_t *used)
 {
-	int i, j, x, cc, c;
-	uint8_t *src;
-	uint64_t ccount;
-	uint8_t *dst[VDEV_RAIDZ_MAXPARITY];
-	uint64_t dcount[VDEV_RAIDZ_MAXPARITY];
-	uint8_t log = 0;
-	uint8_t val;
-	int ll;
-	uint8_t *invlog[VDEV_RAIDZ_MAXPARITY];
-	uint8_t *p, *pp;
-	size_t psize;
-
-	psize = sizeof (invlog[0][0]) * n * nmissing;
-	p = kmem_alloc(psize, KM_SLEEP);
-
-	for (pp = p, i = 0; i < nmissing; i++) {
-		invlog[i] = pp;
-		pp += n;
-	}
-
-	for (i = 0; i < nmissing; i++) {
-		for (j = 0; j < n; j++) {
-			ASSERT3U(invrows[i][j], !=, 0);
-			invlog[i][j] = vdev_raidz_log2[invrows[i][j]];
-		}
-	}
+	int i, j, cc, c;
+	uint8_t *src, *dst;
+	uint64_t ccount, dcount;
+	raidz_math_t rzm;
 
+	/*
+	 * Each missing column is the sum of the used columns, each multiplied
+	 * by the corresponding coefficient of its row of the inverted matrix.
+	 */
+	vdev_raidz_math_begin(&rzm);
 	for (i = 0; i < n; i++) {
 		c = used[i];
 		ASSERT3U(c, <, rm->rm_cols);
 
 		src = abd_to_buf(rm->rm_col[c].rc_abd);
 		ccount = rm->rm_col[c].rc_size;
+
 		for (j = 0; j < nmissing; j++) {
 			cc = missing[j] + rm->rm_firstdatacol;
 			ASSERT3U(cc, >=, rm->rm_firstdatacol);
 			ASSERT3U(cc, <, rm->rm_cols);
 			ASSERT3U(cc, !=, c);
+			ASSERT3U(invrows[j][i], !=, 0);
 
-			dst[j] = abd_to_buf(rm->rm_col[cc].rc_abd);
-			dcount[j] = rm->rm_col[cc].rc_size;
-		}
-
-		ASSERT(ccount >= rm->rm_col[missing[0]].rc_size || i > 0);
+			dst = abd_to_buf(rm->rm_col[cc].rc_abd);
+			dcount = rm->rm_col[cc].rc_size;
 
-		for (x = 0; x < ccount; x++, src++) {
-			if (*src != 0)
-				log = vdev_raidz_log2[*src];
+			ASSERT(ccount >= dcount || i > 0);
 
-			for (cc = 0; cc < nmissing; cc++) {
-				if (x >= dcount[cc])
-					continue;
-
-				if (*src == 0) {
-					val = 0;
-				} else {
-					if ((ll = log + invlog[cc][i]) >= 255)
-						ll -= 255;
-					val = vdev_raidz_pow2[ll];
-				}
-
-				if (i == 0)
-					dst[cc][x] = val;
-				else
-					dst[cc][x] ^= val;
-			}
+			if (i == 0)
+				vdev_raidz_math_mul(&rzm, dst, src,
+				    invrows[j][i], MIN(ccount, dcount));
+			else
+				vdev_raidz_math_mul_add(&rzm, dst, src,
+				    invrows[j][i], MIN(ccount, dcount));
 		}
 	}
-
-	kmem_free(p, psize);
+	vdev_raidz_math_end(&rzm);
 }
 
 static int
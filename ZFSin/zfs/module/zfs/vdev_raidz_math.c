@@ -0,0 +1,731 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * RAID-Z parity math backends.
+ *
+ * vdev_raidz.c expresses parity generation and every reconstruction case
+ * in terms of a handful of buffer primitives (see raidz_impl_ops_t). This
+ * file provides the portable scalar versions of those primitives and picks
+ * the implementation used at runtime; the vectorized ones live in
+ * vdev_raidz_math_{sse,avx2,avx512bw}.c.
+ *
+ * At module load each implementation the CPU supports is verified against
+ * the scalar code and benchmarked twice: once generating triple parity
+ * ("gen") and once multiplying and accumulating by a constant, which is
+ * what reconstruction spends its time on ("rec"). By default the winner of
+ * each benchmark supplies the corresponding primitives. The results are
+ * exported as zfs:0:vdev_raidz_bench, in MB/s of data processed, and the
+ * zfs_vdev_raidz_impl tunable can force a single implementation.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/kstat.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz.h>
+#include <sys/vdev_raidz_impl.h>
+
+/*
+ * Scalar implementation. P/Q/R generation works on 64-bit words with
+ * VDEV_RAIDZ_64MUL_2(); multiplication by a constant uses the nibble
+ * tables a byte at a time.
+ */
+static void
+raidz_scalar_add(void *dst, const void *src, size_t size)
+{
+	uint64_t *d = dst;
+	const uint64_t *s = src;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++)
+		d[i] ^= s[i];
+
+	for (i = cnt * sizeof (uint64_t); i < size; i++)
+		((uint8_t *)dst)[i] ^= ((const uint8_t *)src)[i];
+}
+
+static void
+raidz_scalar_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	uint64_t *pp = p, *qp = q;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++) {
+		pp[i] ^= s[i];
+		VDEV_RAIDZ_64MUL_2(qp[i], mask);
+		qp[i] ^= s[i];
+	}
+
+	for (i = cnt * sizeof (uint64_t); i < size; i++) {
+		uint8_t sb = ((const uint8_t *)src)[i];
+		uint8_t *qb = &((uint8_t *)q)[i];
+
+		((uint8_t *)p)[i] ^= sb;
+		*qb = VDEV_RAIDZ_MUL_2(*qb) ^ sb;
+	}
+}
+
+static void
+raidz_scalar_gen_pqr(void *p, void *q, void *r, const void *src, size_t size)
+{
+	uint64_t *pp = p, *qp = q, *rp = r;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++) {
+		pp[i] ^= s[i];
+		VDEV_RAIDZ_64MUL_2(qp[i], mask);
+		qp[i] ^= s[i];
+		VDEV_RAIDZ_64MUL_4(rp[i], mask);
+		rp[i] ^= s[i];
+	}
+
+	for (i = cnt * sizeof (uint64_t); i < size; i++) {
+		uint8_t sb = ((const uint8_t *)src)[i];
+		uint8_t *qb = &((uint8_t *)q)[i];
+		uint8_t *rb = &((uint8_t *)r)[i];
+
+		((uint8_t *)p)[i] ^= sb;
+		*qb = VDEV_RAIDZ_MUL_2(*qb) ^ sb;
+		*rb = VDEV_RAIDZ_MUL_4(*rb) ^ sb;
+	}
+}
+
+static void
+raidz_scalar_mul2(void *dst, size_t size)
+{
+	uint64_t *d = dst;
+	uint64_t mask;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++)
+		VDEV_RAIDZ_64MUL_2(d[i], mask);
+
+	for (i = cnt * sizeof (uint64_t); i < size; i++) {
+		uint8_t *db = &((uint8_t *)dst)[i];
+
+		*db = VDEV_RAIDZ_MUL_2(*db);
+	}
+}
+
+static void
+raidz_scalar_mul2_add(void *dst, const void *src, size_t size)
+{
+	uint64_t *d = dst;
+	const uint64_t *s = src;
+	uint64_t mask;
+	size_t i, cnt = size / sizeof (uint64_t);
+
+	for (i = 0; i < cnt; i++) {
+		VDEV_RAIDZ_64MUL_2(d[i], mask);
+		d[i] ^= s[i];
+	}
+
+	for (i = cnt * sizeof (uint64_t); i < size; i++) {
+		uint8_t *db = &((uint8_t *)dst)[i];
+
+		*db = VDEV_RAIDZ_MUL_2(*db) ^ ((const uint8_t *)src)[i];
+	}
+}
+
+static void
+raidz_scalar_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	uint8_t lo[16], hi[16];
+	size_t i;
+
+	vdev_raidz_mul_tables(c, lo, hi);
+
+	for (i = 0; i < size; i++)
+		d[i] = lo[s[i] & 0x0f] ^ hi[s[i] >> 4];
+}
+
+static void
+raidz_scalar_mul_add(void *dst, const void *src, uint8_t c, size_t size)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	uint8_t lo[16], hi[16];
+	size_t i;
+
+	vdev_raidz_mul_tables(c, lo, hi);
+
+	for (i = 0; i < size; i++)
+		d[i] ^= lo[s[i] & 0x0f] ^ hi[s[i] >> 4];
+}
+
+static boolean_t
+raidz_scalar_valid(void)
+{
+	return (B_TRUE);
+}
+
+const raidz_impl_ops_t vdev_raidz_scalar_impl = {
+	.add = raidz_scalar_add,
+	.gen_pq = raidz_scalar_gen_pq,
+	.gen_pqr = raidz_scalar_gen_pqr,
+	.mul2 = raidz_scalar_mul2,
+	.mul2_add = raidz_scalar_mul2_add,
+	.mul = raidz_scalar_mul,
+	.mul_add = raidz_scalar_mul_add,
+	.valid = raidz_scalar_valid,
+	.name = "scalar"
+};
+
+/*
+ * Multiply two field elements by shifting and adding.
+ */
+uint8_t
+vdev_raidz_gf_mul(uint8_t a, uint8_t b)
+{
+	uint8_t r = 0;
+
+	while (b != 0) {
+		if (b & 1)
+			r ^= a;
+		a = VDEV_RAIDZ_MUL_2(a);
+		b >>= 1;
+	}
+
+	return (r);
+}
+
+void
+vdev_raidz_mul_tables(uint8_t c, uint8_t *lo, uint8_t *hi)
+{
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		lo[i] = vdev_raidz_gf_mul(c, i);
+		hi[i] = vdev_raidz_gf_mul(c, i << 4);
+	}
+}
+
+/*
+ * All implementations known to this build, in the order used by the
+ * zfs_vdev_raidz_impl tunable: 0 combines the fastest "gen" and "rec"
+ * implementations found by the benchmark, N selects the Nth entry below
+ * for everything.
+ */
+static const raidz_impl_ops_t *vdev_raidz_impls[] = {
+	&vdev_raidz_scalar_impl,
+#if defined(HAVE_SIMD_X86)
+	&vdev_raidz_sse2_impl,
+	&vdev_raidz_ssse3_impl,
+	&vdev_raidz_avx2_impl,
+	&vdev_raidz_avx512bw_impl,
+#endif
+};
+
+#define	RAIDZ_IMPL_COUNT	\
+	(sizeof (vdev_raidz_impls) / sizeof (vdev_raidz_impls[0]))
+
+#define	RAIDZ_IMPL_FASTEST	0
+
+/* Size of the benchmark buffers and time spent on each measurement */
+#define	RAIDZ_BENCH_SIZE	(64 * 1024)
+#define	RAIDZ_BENCH_NS		(MSEC2NSEC(1))
+
+/* Constant used by the "rec" benchmark; any value but 0 and 1 will do */
+#define	RAIDZ_BENCH_COEFF	0x8e
+
+typedef struct raidz_bench {
+	uint64_t	rb_gen;		/* MB/s */
+	uint64_t	rb_rec;		/* MB/s */
+} raidz_bench_t;
+
+static raidz_bench_t vdev_raidz_stat_data[RAIDZ_IMPL_COUNT];
+
+/*
+ * Benchmark winners for each class of primitive, and the composite
+ * implementation built from them.
+ */
+static const raidz_impl_ops_t *vdev_raidz_fastest_gen =
+	&vdev_raidz_scalar_impl;
+static const raidz_impl_ops_t *vdev_raidz_fastest_rec =
+	&vdev_raidz_scalar_impl;
+static raidz_impl_ops_t vdev_raidz_fastest_impl;
+static const raidz_impl_ops_t *vdev_raidz_selected_impl =
+	&vdev_raidz_scalar_impl;
+
+/* Tunable, see vdev_raidz_impls[] for the accepted values */
+uint64_t zfs_vdev_raidz_impl = RAIDZ_IMPL_FASTEST;
+
+/* Parity is computed one ABD chunk at a time, see abd_iterate_func() */
+extern size_t zfs_abd_chunk_size;
+
+static kstat_t *vdev_raidz_kstat;
+static kstat_named_t vdev_raidz_kstat_data[2 + 2 * RAIDZ_IMPL_COUNT];
+
+static inline const raidz_impl_ops_t *
+vdev_raidz_impl_get(void)
+{
+	if (!kfpu_allowed())
+		return (&vdev_raidz_scalar_impl);
+
+	return (vdev_raidz_selected_impl);
+}
+
+/*
+ * Save the vector state before running anything but the scalar code.
+ * Returns B_FALSE when the state cannot be saved; the caller must then
+ * fall back to the scalar implementation and skip vdev_raidz_kfpu_end().
+ */
+static inline boolean_t
+vdev_raidz_kfpu_begin(const raidz_impl_ops_t *ops, kfpu_state_t *fpu)
+{
+	return (ops == &vdev_raidz_scalar_impl || kfpu_begin(fpu));
+}
+
+static inline void
+vdev_raidz_kfpu_end(const raidz_impl_ops_t *ops, kfpu_state_t *fpu)
+{
+	if (ops != &vdev_raidz_scalar_impl)
+		kfpu_end(fpu);
+}
+
+static void
+vdev_raidz_fastest_impl_build(void)
+{
+	raidz_impl_ops_t *ops = &vdev_raidz_fastest_impl;
+
+	ops->add = vdev_raidz_fastest_gen->add;
+	ops->gen_pq = vdev_raidz_fastest_gen->gen_pq;
+	ops->gen_pqr = vdev_raidz_fastest_gen->gen_pqr;
+	ops->mul2 = vdev_raidz_fastest_gen->mul2;
+	ops->mul2_add = vdev_raidz_fastest_rec->mul2_add;
+	ops->mul = vdev_raidz_fastest_rec->mul;
+	ops->mul_add = vdev_raidz_fastest_rec->mul_add;
+	ops->valid = raidz_scalar_valid;
+	ops->name = "fastest";
+}
+
+/*
+ * Select the implementation used for RAID-Z parity math. An id of
+ * RAIDZ_IMPL_FASTEST uses the benchmark winners, any other id is an index
+ * (1-based) into vdev_raidz_impls[]. Returns EINVAL for unknown ids and
+ * ENOTSUP for implementations the CPU cannot run.
+ */
+int
+vdev_raidz_impl_set(uint64_t id)
+{
+	const raidz_impl_ops_t *ops;
+
+	if (id == RAIDZ_IMPL_FASTEST) {
+		ops = &vdev_raidz_fastest_impl;
+	} else {
+		if (id > RAIDZ_IMPL_COUNT)
+			return (EINVAL);
+		ops = vdev_raidz_impls[id - 1];
+		if (!ops->valid())
+			return (ENOTSUP);
+	}
+
+	zfs_vdev_raidz_impl = id;
+	vdev_raidz_selected_impl = ops;
+	return (0);
+}
+
+const char *
+vdev_raidz_impl_name(void)
+{
+	return (vdev_raidz_impl_get()->name);
+}
+
+/*
+ * Entry points used by vdev_raidz.c. The implementation picked by
+ * vdev_raidz_math_begin() handles the RAIDZ_MATH_ALIGN-aligned part of
+ * the buffer, the scalar code the rest.
+ */
+void
+vdev_raidz_math_begin(raidz_math_t *rzm)
+{
+	rzm->rzm_ops = vdev_raidz_impl_get();
+	if (!vdev_raidz_kfpu_begin(rzm->rzm_ops, &rzm->rzm_fpu))
+		rzm->rzm_ops = &vdev_raidz_scalar_impl;
+}
+
+void
+vdev_raidz_math_end(raidz_math_t *rzm)
+{
+	vdev_raidz_kfpu_end(rzm->rzm_ops, &rzm->rzm_fpu);
+}
+
+#define	RAIDZ_OFF(buf, off)	((uint8_t *)(buf) + (off))
+#define	RAIDZ_COFF(buf, off)	((const uint8_t *)(buf) + (off))
+
+void
+vdev_raidz_math_add(const raidz_math_t *rzm, void *dst, const void *src,
+    size_t size)
+{
+	const size_t p2size = P2ALIGN(size, RAIDZ_MATH_ALIGN);
+
+	if (p2size > 0)
+		rzm->rzm_ops->add(dst, src, p2size);
+	if (p2size < size)
+		raidz_scalar_add(RAIDZ_OFF(dst, p2size),
+		    RAIDZ_COFF(src, p2size), size - p2size);
+}
+
+void
+vdev_raidz_math_gen_pq(const raidz_math_t *rzm, void *p, void *q,
+    const void *src, size_t size)
+{
+	const size_t p2size = P2ALIGN(size, RAIDZ_MATH_ALIGN);
+
+	if (p2size > 0)
+		rzm->rzm_ops->gen_pq(p, q, src, p2size);
+	if (p2size < size)
+		raidz_scalar_gen_pq(RAIDZ_OFF(p, p2size), RAIDZ_OFF(q, p2size),
+		    RAIDZ_COFF(src, p2size), size - p2size);
+}
+
+void
+vdev_raidz_math_gen_pqr(const raidz_math_t *rzm, void *p, void *q, void *r,
+    const void *src, size_t size)
+{
+	const size_t p2size = P2ALIGN(size, RAIDZ_MATH_ALIGN);
+
+	if (p2size > 0)
+		rzm->rzm_ops->gen_pqr(p, q, r, src, p2size);
+	if (p2size < size)
+		raidz_scalar_gen_pqr(RAIDZ_OFF(p, p2size),
+		    RAIDZ_OFF(q, p2size), RAIDZ_OFF(r, p2size),
+		    RAIDZ_COFF(src, p2size), size - p2size);
+}
+
+void
+vdev_raidz_math_mul2(const raidz_math_t *rzm, void *dst, size_t size)
+{
+	const size_t p2size = P2ALIGN(size, RAIDZ_MATH_ALIGN);
+
+	if (p2size > 0)
+		rzm->rzm_ops->mul2(dst, p2size);
+	if (p2size < size)
+		raidz_scalar_mul2(RAIDZ_OFF(dst, p2size), size - p2size);
+}
+
+void
+vdev_raidz_math_mul2_add(const raidz_math_t *rzm, void *dst,
+    const void *src, size_t size)
+{
+	const size_t p2size = P2ALIGN(size, RAIDZ_MATH_ALIGN);
+
+	if (p2size > 0)
+		rzm->rzm_ops->mul2_add(dst, src, p2size);
+	if (p2size < size)
+		raidz_scalar_mul2_add(RAIDZ_OFF(dst, p2size),
+		    RAIDZ_COFF(src, p2size), size - p2size);
+}
+
+void
+vdev_raidz_math_mul(const raidz_math_t *rzm, void *dst, const void *src,
+    uint8_t c, size_t size)
+{
+	const size_t p2size = P2ALIGN(size, RAIDZ_MATH_ALIGN);
+
+	if (p2size > 0)
+		rzm->rzm_ops->mul(dst, src, c, p2size);
+	if (p2size < size)
+		raidz_scalar_mul(RAIDZ_OFF(dst, p2size),
+		    RAIDZ_COFF(src, p2size), c, size - p2size);
+}
+
+void
+vdev_raidz_math_mul_add(const raidz_math_t *rzm, void *dst, const void *src,
+    uint8_t c, size_t size)
+{
+	const size_t p2size = P2ALIGN(size, RAIDZ_MATH_ALIGN);
+
+	if (p2size > 0)
+		rzm->rzm_ops->mul_add(dst, src, c, p2size);
+	if (p2size < size)
+		raidz_scalar_mul_add(RAIDZ_OFF(dst, p2size),
+		    RAIDZ_COFF(src, p2size), c, size - p2size);
+}
+
+/*
+ * Verify every primitive of an implementation against the scalar code
+ * before it is allowed to win the benchmark. 'buf' holds 'size' bytes of
+ * test data followed by room for six more buffers of the same size, which
+ * are seeded with rotated copies of the test data.
+ */
+static boolean_t
+vdev_raidz_verify_impl(const raidz_impl_ops_t *ops, uint8_t *buf,
+    size_t size)
+{
+	static const uint8_t coeffs[] = { 0x00, 0x01, 0x02, 0x1d, 0x8e, 0xff };
+	const uint8_t *src = buf;
+	uint8_t *ref[3], *tst[3];
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		ref[i] = buf + (1 + i) * size;
+		tst[i] = buf + (4 + i) * size;
+	}
+
+#define	RAIDZ_VERIFY_RESET()						\
+	do {								\
+		for (j = 0; j < 3; j++) {				\
+			size_t rot = (j + 1) * RAIDZ_MATH_ALIGN;	\
+			(void) memcpy(ref[j], src + rot, size - rot);	\
+			(void) memcpy(ref[j] + size - rot, src, rot);	\
+			(void) memcpy(tst[j], ref[j], size);		\
+		}							\
+	} while (0)
+
+#define	RAIDZ_VERIFY_CHECK()						\
+	do {								\
+		for (j = 0; j < 3; j++) {				\
+			if (memcmp(ref[j], tst[j], size) != 0)		\
+				return (B_FALSE);			\
+		}							\
+	} while (0)
+
+	RAIDZ_VERIFY_RESET();
+	raidz_scalar_add(ref[0], src, size);
+	ops->add(tst[0], src, size);
+	RAIDZ_VERIFY_CHECK();
+
+	RAIDZ_VERIFY_RESET();
+	raidz_scalar_gen_pq(ref[0], ref[1], src, size);
+	ops->gen_pq(tst[0], tst[1], src, size);
+	RAIDZ_VERIFY_CHECK();
+
+	RAIDZ_VERIFY_RESET();
+	raidz_scalar_gen_pqr(ref[0], ref[1], ref[2], src, size);
+	ops->gen_pqr(tst[0], tst[1], tst[2], src, size);
+	RAIDZ_VERIFY_CHECK();
+
+	RAIDZ_VERIFY_RESET();
+	raidz_scalar_mul2(ref[0], size);
+	ops->mul2(tst[0], size);
+	raidz_scalar_mul2_add(ref[1], src, size);
+	ops->mul2_add(tst[1], src, size);
+	RAIDZ_VERIFY_CHECK();
+
+	for (i = 0; i < sizeof (coeffs); i++) {
+		RAIDZ_VERIFY_RESET();
+		raidz_scalar_mul(ref[0], src, coeffs[i], size);
+		ops->mul(tst[0], src, coeffs[i], size);
+		raidz_scalar_mul_add(ref[1], src, coeffs[i], size);
+		ops->mul_add(tst[1], src, coeffs[i], size);
+		/* in place */
+		raidz_scalar_mul(ref[2], ref[2], coeffs[i], size);
+		ops->mul(tst[2], tst[2], coeffs[i], size);
+		RAIDZ_VERIFY_CHECK();
+	}
+
+#undef	RAIDZ_VERIFY_RESET
+#undef	RAIDZ_VERIFY_CHECK
+
+	return (B_TRUE);
+}
+
+static boolean_t
+vdev_raidz_verify(const raidz_impl_ops_t *ops, uint8_t *buf, size_t size)
+{
+	kfpu_state_t fpu;
+	boolean_t ok;
+
+	if (!vdev_raidz_kfpu_begin(ops, &fpu))
+		return (B_FALSE);
+	ok = vdev_raidz_verify_impl(ops, buf, size);
+	vdev_raidz_kfpu_end(ops, &fpu);
+
+	return (ok);
+}
+
+static uint64_t
+vdev_raidz_benchmark_impl(const raidz_impl_ops_t *ops, boolean_t gen,
+    uint8_t *buf, size_t chunk)
+{
+	const uint8_t *src = buf;
+	uint8_t *p = buf + RAIDZ_BENCH_SIZE;
+	uint8_t *q = p + RAIDZ_BENCH_SIZE;
+	uint8_t *r = q + RAIDZ_BENCH_SIZE;
+	uint64_t run_count = 0;
+	hrtime_t start, run_time;
+	kfpu_state_t fpu;
+	size_t off;
+
+	start = gethrtime();
+	do {
+		if (!vdev_raidz_kfpu_begin(ops, &fpu))
+			return (0);
+		for (off = 0; off < RAIDZ_BENCH_SIZE; off += chunk) {
+			if (gen)
+				ops->gen_pqr(p + off, q + off, r + off,
+				    src + off, chunk);
+			else
+				ops->mul_add(p + off, src + off,
+				    RAIDZ_BENCH_COEFF, chunk);
+		}
+		vdev_raidz_kfpu_end(ops, &fpu);
+		run_count++;
+		run_time = gethrtime() - start;
+	} while (run_time < RAIDZ_BENCH_NS);
+
+	/* MB/s */
+	return ((run_count * RAIDZ_BENCH_SIZE * NANOSEC /
+	    (uint64_t)run_time) >> 20);
+}
+
+static void
+vdev_raidz_benchmark(void)
+{
+	const size_t bufsize = 7 * RAIDZ_BENCH_SIZE;
+	uint64_t best_gen = 0, best_rec = 0;
+	size_t chunk;
+	uint8_t *buf;
+	int i;
+
+	/*
+	 * Parity is computed one ABD chunk at a time, so measure at that
+	 * granularity. The vector state is saved once per pass, as
+	 * vdev_raidz.c saves it once per operation.
+	 */
+	chunk = MAX(MIN(zfs_abd_chunk_size, RAIDZ_BENCH_SIZE),
+	    RAIDZ_MATH_ALIGN);
+
+	buf = kmem_zalloc(bufsize, KM_SLEEP);
+	for (i = 0; i < RAIDZ_BENCH_SIZE / sizeof (uint64_t); i++)
+		((uint64_t *)buf)[i] = (uintptr_t)(buf + i) *
+		    0x9e3779b97f4a7c15ULL;
+
+	vdev_raidz_fastest_gen = &vdev_raidz_scalar_impl;
+	vdev_raidz_fastest_rec = &vdev_raidz_scalar_impl;
+
+	for (i = 0; i < RAIDZ_IMPL_COUNT; i++) {
+		const raidz_impl_ops_t *ops = vdev_raidz_impls[i];
+		raidz_bench_t *rb = &vdev_raidz_stat_data[i];
+
+		if (!ops->valid() ||
+		    !vdev_raidz_verify(ops, buf, RAIDZ_BENCH_SIZE)) {
+			rb->rb_gen = rb->rb_rec = 0;
+			continue;
+		}
+
+		rb->rb_gen = vdev_raidz_benchmark_impl(ops, B_TRUE, buf,
+		    chunk);
+		rb->rb_rec = vdev_raidz_benchmark_impl(ops, B_FALSE, buf,
+		    chunk);
+
+		if (rb->rb_gen > best_gen) {
+			best_gen = rb->rb_gen;
+			vdev_raidz_fastest_gen = ops;
+		}
+		if (rb->rb_rec > best_rec) {
+			best_rec = rb->rb_rec;
+			vdev_raidz_fastest_rec = ops;
+		}
+	}
+
+	kmem_free(buf, bufsize);
+	vdev_raidz_fastest_impl_build();
+}
+
+static int
+vdev_raidz_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *knp = ksp->ks_data;
+	const raidz_impl_ops_t *gen, *rec;
+	int i;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	if (vdev_raidz_selected_impl == &vdev_raidz_fastest_impl) {
+		gen = vdev_raidz_fastest_gen;
+		rec = vdev_raidz_fastest_rec;
+	} else {
+		gen = rec = vdev_raidz_selected_impl;
+	}
+
+	(void) strlcpy(knp->value.c, gen->name, sizeof (knp->value.c));
+	knp++;
+	(void) strlcpy(knp->value.c, rec->name, sizeof (knp->value.c));
+	knp++;
+
+	for (i = 0; i < RAIDZ_IMPL_COUNT; i++) {
+		knp->value.ui64 = vdev_raidz_stat_data[i].rb_gen;
+		knp++;
+		knp->value.ui64 = vdev_raidz_stat_data[i].rb_rec;
+		knp++;
+	}
+
+	return (0);
+}
+
+/*
+ * Benchmark all usable implementations and select the fastest ones, unless
+ * the administrator already asked for a specific one.
+ */
+void
+vdev_raidz_math_init(void)
+{
+	kstat_named_t *knp = vdev_raidz_kstat_data;
+	char name[KSTAT_STRLEN];
+	int i;
+
+	vdev_raidz_benchmark();
+
+	if (vdev_raidz_impl_set(zfs_vdev_raidz_impl) != 0)
+		(void) vdev_raidz_impl_set(RAIDZ_IMPL_FASTEST);
+
+	kstat_named_init(knp++, "gen_selected", KSTAT_DATA_CHAR);
+	kstat_named_init(knp++, "rec_selected", KSTAT_DATA_CHAR);
+	for (i = 0; i < RAIDZ_IMPL_COUNT; i++) {
+		(void) snprintf(name, sizeof (name), "%s_gen",
+		    vdev_raidz_impls[i]->name);
+		kstat_named_init(knp++, name, KSTAT_DATA_UINT64);
+		(void) snprintf(name, sizeof (name), "%s_rec",
+		    vdev_raidz_impls[i]->name);
+		kstat_named_init(knp++, name, KSTAT_DATA_UINT64);
+	}
+
+	vdev_raidz_kstat = kstat_create("zfs", 0, "vdev_raidz_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (vdev_raidz_kstat_data) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (vdev_raidz_kstat != NULL) {
+		vdev_raidz_kstat->ks_data = vdev_raidz_kstat_data;
+		vdev_raidz_kstat->ks_update = vdev_raidz_kstat_update;
+		kstat_install(vdev_raidz_kstat);
+	}
+}
+
+void
+vdev_raidz_math_fini(void)
+{
+	if (vdev_raidz_kstat != NULL) {
+		kstat_delete(vdev_raidz_kstat);
+		vdev_raidz_kstat = NULL;
+	}
+
+	vdev_raidz_selected_impl = &vdev_raidz_scalar_impl;
+	vdev_raidz_fastest_gen = &vdev_raidz_scalar_impl;
+	vdev_raidz_fastest_rec = &vdev_raidz_scalar_impl;
+}
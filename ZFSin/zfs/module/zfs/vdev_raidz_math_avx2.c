@@ -0,0 +1,228 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX2 RAID-Z math. This is the SSSE3 implementation widened to 256 bits:
+ * multiplication by 2 uses add and a signed compare to find the bytes that
+ * need the 0x1d reduction, and multiplication by a constant looks up both
+ * nibbles of every byte with vpshufb.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(HAVE_SIMD_X86)
+
+#define	RAIDZ_AVX2_LOAD(p)	_mm256_loadu_si256(p)
+#define	RAIDZ_AVX2_STORE(p, v)	_mm256_storeu_si256(p, v)
+#define	RAIDZ_AVX2_XOR(a, b)	_mm256_xor_si256(a, b)
+#define	RAIDZ_AVX2_AND(a, b)	_mm256_and_si256(a, b)
+
+/* Requires 'zero' and 'poly' (0x1d in every byte) to be set up */
+#define	RAIDZ_AVX2_MUL2(x)						\
+	RAIDZ_AVX2_XOR(_mm256_add_epi8(x, x),				\
+	    RAIDZ_AVX2_AND(_mm256_cmpgt_epi8(zero, x), poly))
+
+#define	RAIDZ_AVX2_MUL2_SETUP()						\
+	do {								\
+		zero = _mm256_setzero_si256();				\
+		poly = _mm256_set1_epi8(0x1d);				\
+	} while (0)
+
+/*
+ * c * x = lo[x & 15] ^ hi[x >> 4]. vpshufb looks up within each 128-bit
+ * lane, so the tables are broadcast to both lanes.
+ */
+#define	RAIDZ_AVX2_MUL(x)						\
+	RAIDZ_AVX2_XOR(_mm256_shuffle_epi8(lo, RAIDZ_AVX2_AND(x, nib)),	\
+	    _mm256_shuffle_epi8(hi,					\
+	    RAIDZ_AVX2_AND(_mm256_srli_epi64(x, 4), nib)))
+
+#define	RAIDZ_AVX2_MUL_SETUP(c)						\
+	do {								\
+		vdev_raidz_mul_tables(c, lotab, hitab);			\
+		lo = _mm256_broadcastsi128_si256(			\
+		    _mm_loadu_si128((const __m128i *)lotab));		\
+		hi = _mm256_broadcastsi128_si256(			\
+		    _mm_loadu_si128((const __m128i *)hitab));		\
+		nib = _mm256_set1_epi8(0x0f);				\
+	} while (0)
+
+static void
+raidz_avx2_add(void *dst, const void *src, size_t size)
+{
+	__m256i *d = dst;
+	const __m256i *s = src;
+	size_t i, cnt = size / sizeof (__m256i);
+
+	for (i = 0; i < cnt; i++)
+		RAIDZ_AVX2_STORE(d + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_LOAD(d + i),
+		    RAIDZ_AVX2_LOAD(s + i)));
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx2_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	__m256i *pp = p, *qp = q;
+	const __m256i *s = src;
+	__m256i zero, poly, sv, t;
+	size_t i, cnt = size / sizeof (__m256i);
+
+	RAIDZ_AVX2_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		sv = RAIDZ_AVX2_LOAD(s + i);
+		RAIDZ_AVX2_STORE(pp + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_LOAD(pp + i), sv));
+		t = RAIDZ_AVX2_LOAD(qp + i);
+		RAIDZ_AVX2_STORE(qp + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_MUL2(t), sv));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx2_gen_pqr(void *p, void *q, void *r, const void *src, size_t size)
+{
+	__m256i *pp = p, *qp = q, *rp = r;
+	const __m256i *s = src;
+	__m256i zero, poly, sv, t;
+	size_t i, cnt = size / sizeof (__m256i);
+
+	RAIDZ_AVX2_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		sv = RAIDZ_AVX2_LOAD(s + i);
+		RAIDZ_AVX2_STORE(pp + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_LOAD(pp + i), sv));
+		t = RAIDZ_AVX2_LOAD(qp + i);
+		RAIDZ_AVX2_STORE(qp + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_MUL2(t), sv));
+		t = RAIDZ_AVX2_LOAD(rp + i);
+		t = RAIDZ_AVX2_MUL2(t);
+		RAIDZ_AVX2_STORE(rp + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_MUL2(t), sv));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx2_mul2(void *dst, size_t size)
+{
+	__m256i *d = dst;
+	__m256i zero, poly, t;
+	size_t i, cnt = size / sizeof (__m256i);
+
+	RAIDZ_AVX2_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX2_LOAD(d + i);
+		RAIDZ_AVX2_STORE(d + i, RAIDZ_AVX2_MUL2(t));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx2_mul2_add(void *dst, const void *src, size_t size)
+{
+	__m256i *d = dst;
+	const __m256i *s = src;
+	__m256i zero, poly, t;
+	size_t i, cnt = size / sizeof (__m256i);
+
+	RAIDZ_AVX2_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX2_LOAD(d + i);
+		RAIDZ_AVX2_STORE(d + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_MUL2(t),
+		    RAIDZ_AVX2_LOAD(s + i)));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx2_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m256i *d = dst;
+	const __m256i *s = src;
+	__m256i lo, hi, nib, t;
+	uint8_t lotab[16], hitab[16];
+	size_t i, cnt = size / sizeof (__m256i);
+
+	RAIDZ_AVX2_MUL_SETUP(c);
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX2_LOAD(s + i);
+		RAIDZ_AVX2_STORE(d + i, RAIDZ_AVX2_MUL(t));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx2_mul_add(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m256i *d = dst;
+	const __m256i *s = src;
+	__m256i lo, hi, nib, t;
+	uint8_t lotab[16], hitab[16];
+	size_t i, cnt = size / sizeof (__m256i);
+
+	RAIDZ_AVX2_MUL_SETUP(c);
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX2_LOAD(s + i);
+		t = RAIDZ_AVX2_MUL(t);
+		RAIDZ_AVX2_STORE(d + i,
+		    RAIDZ_AVX2_XOR(RAIDZ_AVX2_LOAD(d + i), t));
+	}
+
+	_mm256_zeroupper();
+}
+
+static boolean_t
+raidz_avx2_valid(void)
+{
+	return (zfs_avx_available() && zfs_avx2_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_avx2_impl = {
+	.add = raidz_avx2_add,
+	.gen_pq = raidz_avx2_gen_pq,
+	.gen_pqr = raidz_avx2_gen_pqr,
+	.mul2 = raidz_avx2_mul2,
+	.mul2_add = raidz_avx2_mul2_add,
+	.mul = raidz_avx2_mul,
+	.mul_add = raidz_avx2_mul_add,
+	.valid = raidz_avx2_valid,
+	.name = "avx2"
+};
+
+#endif /* HAVE_SIMD_X86 */
@@ -0,0 +1,228 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * AVX-512BW RAID-Z math. Multiplication by 2 takes the mask of bytes with
+ * the top bit set straight from vpmovb2m and applies the 0x1d reduction
+ * with a zero-masked move; multiplication by a constant looks up both
+ * nibbles of every byte with vpshufb, as in the AVX2 code.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(HAVE_SIMD_X86)
+
+#define	RAIDZ_AVX512_LOAD(p)	_mm512_loadu_si512(p)
+#define	RAIDZ_AVX512_STORE(p, v)	_mm512_storeu_si512(p, v)
+#define	RAIDZ_AVX512_XOR(a, b)	_mm512_xor_si512(a, b)
+#define	RAIDZ_AVX512_AND(a, b)	_mm512_and_si512(a, b)
+
+/* Requires 'poly' (0x1d in every byte) to be set up */
+#define	RAIDZ_AVX512_MUL2(x)						\
+	RAIDZ_AVX512_XOR(_mm512_add_epi8(x, x),				\
+	    _mm512_maskz_mov_epi8(_mm512_movepi8_mask(x), poly))
+
+#define	RAIDZ_AVX512_MUL2_SETUP()					\
+	do {								\
+		poly = _mm512_set1_epi8(0x1d);				\
+	} while (0)
+
+/*
+ * c * x = lo[x & 15] ^ hi[x >> 4]. vpshufb looks up within each 128-bit
+ * lane, so the tables are broadcast to all four lanes.
+ */
+#define	RAIDZ_AVX512_MUL(x)						\
+	RAIDZ_AVX512_XOR(						\
+	    _mm512_shuffle_epi8(lo, RAIDZ_AVX512_AND(x, nib)),		\
+	    _mm512_shuffle_epi8(hi,					\
+	    RAIDZ_AVX512_AND(_mm512_srli_epi64(x, 4), nib)))
+
+#define	RAIDZ_AVX512_MUL_SETUP(c)					\
+	do {								\
+		vdev_raidz_mul_tables(c, lotab, hitab);			\
+		lo = _mm512_broadcast_i32x4(				\
+		    _mm_loadu_si128((const __m128i *)lotab));		\
+		hi = _mm512_broadcast_i32x4(				\
+		    _mm_loadu_si128((const __m128i *)hitab));		\
+		nib = _mm512_set1_epi8(0x0f);				\
+	} while (0)
+
+static void
+raidz_avx512bw_add(void *dst, const void *src, size_t size)
+{
+	__m512i *d = dst;
+	const __m512i *s = src;
+	size_t i, cnt = size / sizeof (__m512i);
+
+	for (i = 0; i < cnt; i++)
+		RAIDZ_AVX512_STORE(d + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_LOAD(d + i),
+		    RAIDZ_AVX512_LOAD(s + i)));
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx512bw_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	__m512i *pp = p, *qp = q;
+	const __m512i *s = src;
+	__m512i poly, sv, t;
+	size_t i, cnt = size / sizeof (__m512i);
+
+	RAIDZ_AVX512_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		sv = RAIDZ_AVX512_LOAD(s + i);
+		RAIDZ_AVX512_STORE(pp + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_LOAD(pp + i), sv));
+		t = RAIDZ_AVX512_LOAD(qp + i);
+		RAIDZ_AVX512_STORE(qp + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_MUL2(t), sv));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx512bw_gen_pqr(void *p, void *q, void *r, const void *src, size_t size)
+{
+	__m512i *pp = p, *qp = q, *rp = r;
+	const __m512i *s = src;
+	__m512i poly, sv, t;
+	size_t i, cnt = size / sizeof (__m512i);
+
+	RAIDZ_AVX512_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		sv = RAIDZ_AVX512_LOAD(s + i);
+		RAIDZ_AVX512_STORE(pp + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_LOAD(pp + i), sv));
+		t = RAIDZ_AVX512_LOAD(qp + i);
+		RAIDZ_AVX512_STORE(qp + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_MUL2(t), sv));
+		t = RAIDZ_AVX512_LOAD(rp + i);
+		t = RAIDZ_AVX512_MUL2(t);
+		RAIDZ_AVX512_STORE(rp + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_MUL2(t), sv));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx512bw_mul2(void *dst, size_t size)
+{
+	__m512i *d = dst;
+	__m512i poly, t;
+	size_t i, cnt = size / sizeof (__m512i);
+
+	RAIDZ_AVX512_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX512_LOAD(d + i);
+		RAIDZ_AVX512_STORE(d + i, RAIDZ_AVX512_MUL2(t));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx512bw_mul2_add(void *dst, const void *src, size_t size)
+{
+	__m512i *d = dst;
+	const __m512i *s = src;
+	__m512i poly, t;
+	size_t i, cnt = size / sizeof (__m512i);
+
+	RAIDZ_AVX512_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX512_LOAD(d + i);
+		RAIDZ_AVX512_STORE(d + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_MUL2(t),
+		    RAIDZ_AVX512_LOAD(s + i)));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx512bw_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m512i *d = dst;
+	const __m512i *s = src;
+	__m512i lo, hi, nib, t;
+	uint8_t lotab[16], hitab[16];
+	size_t i, cnt = size / sizeof (__m512i);
+
+	RAIDZ_AVX512_MUL_SETUP(c);
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX512_LOAD(s + i);
+		RAIDZ_AVX512_STORE(d + i, RAIDZ_AVX512_MUL(t));
+	}
+
+	_mm256_zeroupper();
+}
+
+static void
+raidz_avx512bw_mul_add(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m512i *d = dst;
+	const __m512i *s = src;
+	__m512i lo, hi, nib, t;
+	uint8_t lotab[16], hitab[16];
+	size_t i, cnt = size / sizeof (__m512i);
+
+	RAIDZ_AVX512_MUL_SETUP(c);
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_AVX512_LOAD(s + i);
+		t = RAIDZ_AVX512_MUL(t);
+		RAIDZ_AVX512_STORE(d + i,
+		    RAIDZ_AVX512_XOR(RAIDZ_AVX512_LOAD(d + i), t));
+	}
+
+	_mm256_zeroupper();
+}
+
+static boolean_t
+raidz_avx512bw_valid(void)
+{
+	return (zfs_avx512f_available() && zfs_avx512bw_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_avx512bw_impl = {
+	.add = raidz_avx512bw_add,
+	.gen_pq = raidz_avx512bw_gen_pq,
+	.gen_pqr = raidz_avx512bw_gen_pqr,
+	.mul2 = raidz_avx512bw_mul2,
+	.mul2_add = raidz_avx512bw_mul2_add,
+	.mul = raidz_avx512bw_mul,
+	.mul_add = raidz_avx512bw_mul_add,
+	.valid = raidz_avx512bw_valid,
+	.name = "avx512bw"
+};
+
+#endif /* HAVE_SIMD_X86 */
@@ -0,0 +1,276 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * SSE2 and SSSE3 RAID-Z math. Multiplication by 2 is done on sixteen bytes
+ * at once: adding a byte to itself shifts it left, and a signed compare
+ * against zero yields the mask of bytes whose top bit was set, which
+ * selects where the 0x1d reduction is applied.
+ *
+ * SSE2 multiplies by an arbitrary constant with shift-and-add, one
+ * multiplication by 2 per bit of the constant. SSSE3 looks up both
+ * nibbles of every byte in the constant's 16-entry tables with pshufb.
+ * Everything else is shared by the two.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/simd.h>
+#include <sys/vdev_raidz_impl.h>
+
+#if defined(HAVE_SIMD_X86)
+
+#define	RAIDZ_SSE_LOAD(p)	_mm_loadu_si128(p)
+#define	RAIDZ_SSE_STORE(p, v)	_mm_storeu_si128(p, v)
+
+/* Requires 'zero' and 'poly' (0x1d in every byte) to be set up */
+#define	RAIDZ_SSE_MUL2(x)						\
+	_mm_xor_si128(_mm_add_epi8(x, x),				\
+	    _mm_and_si128(_mm_cmpgt_epi8(zero, x), poly))
+
+#define	RAIDZ_SSE_MUL2_SETUP()						\
+	do {								\
+		zero = _mm_setzero_si128();				\
+		poly = _mm_set1_epi8(0x1d);				\
+	} while (0)
+
+static void
+raidz_sse_add(void *dst, const void *src, size_t size)
+{
+	__m128i *d = dst;
+	const __m128i *s = src;
+	size_t i, cnt = size / sizeof (__m128i);
+
+	for (i = 0; i < cnt; i++)
+		RAIDZ_SSE_STORE(d + i, _mm_xor_si128(RAIDZ_SSE_LOAD(d + i),
+		    RAIDZ_SSE_LOAD(s + i)));
+}
+
+static void
+raidz_sse_gen_pq(void *p, void *q, const void *src, size_t size)
+{
+	__m128i *pp = p, *qp = q;
+	const __m128i *s = src;
+	__m128i zero, poly, sv, t;
+	size_t i, cnt = size / sizeof (__m128i);
+
+	RAIDZ_SSE_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		sv = RAIDZ_SSE_LOAD(s + i);
+		RAIDZ_SSE_STORE(pp + i,
+		    _mm_xor_si128(RAIDZ_SSE_LOAD(pp + i), sv));
+		t = RAIDZ_SSE_LOAD(qp + i);
+		RAIDZ_SSE_STORE(qp + i, _mm_xor_si128(RAIDZ_SSE_MUL2(t), sv));
+	}
+}
+
+static void
+raidz_sse_gen_pqr(void *p, void *q, void *r, const void *src, size_t size)
+{
+	__m128i *pp = p, *qp = q, *rp = r;
+	const __m128i *s = src;
+	__m128i zero, poly, sv, t;
+	size_t i, cnt = size / sizeof (__m128i);
+
+	RAIDZ_SSE_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		sv = RAIDZ_SSE_LOAD(s + i);
+		RAIDZ_SSE_STORE(pp + i,
+		    _mm_xor_si128(RAIDZ_SSE_LOAD(pp + i), sv));
+		t = RAIDZ_SSE_LOAD(qp + i);
+		RAIDZ_SSE_STORE(qp + i, _mm_xor_si128(RAIDZ_SSE_MUL2(t), sv));
+		t = RAIDZ_SSE_LOAD(rp + i);
+		t = RAIDZ_SSE_MUL2(t);
+		RAIDZ_SSE_STORE(rp + i, _mm_xor_si128(RAIDZ_SSE_MUL2(t), sv));
+	}
+}
+
+static void
+raidz_sse_mul2(void *dst, size_t size)
+{
+	__m128i *d = dst;
+	__m128i zero, poly, t;
+	size_t i, cnt = size / sizeof (__m128i);
+
+	RAIDZ_SSE_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_SSE_LOAD(d + i);
+		RAIDZ_SSE_STORE(d + i, RAIDZ_SSE_MUL2(t));
+	}
+}
+
+static void
+raidz_sse_mul2_add(void *dst, const void *src, size_t size)
+{
+	__m128i *d = dst;
+	const __m128i *s = src;
+	__m128i zero, poly, t;
+	size_t i, cnt = size / sizeof (__m128i);
+
+	RAIDZ_SSE_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_SSE_LOAD(d + i);
+		RAIDZ_SSE_STORE(d + i, _mm_xor_si128(RAIDZ_SSE_MUL2(t),
+		    RAIDZ_SSE_LOAD(s + i)));
+	}
+}
+
+/*
+ * SSE2: c * x as the sum of x * 2^k over the bits k set in c.
+ */
+#define	RAIDZ_SSE2_MUL(x, c, acc)					\
+	do {								\
+		uint8_t __b;						\
+		(acc) = zero;						\
+		for (__b = (c); __b != 0; __b >>= 1) {			\
+			if (__b & 1)					\
+				(acc) = _mm_xor_si128((acc), (x));	\
+			(x) = RAIDZ_SSE_MUL2(x);			\
+		}							\
+	} while (0)
+
+static void
+raidz_sse2_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m128i *d = dst;
+	const __m128i *s = src;
+	__m128i zero, poly, t, acc;
+	size_t i, cnt = size / sizeof (__m128i);
+
+	RAIDZ_SSE_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_SSE_LOAD(s + i);
+		RAIDZ_SSE2_MUL(t, c, acc);
+		RAIDZ_SSE_STORE(d + i, acc);
+	}
+}
+
+static void
+raidz_sse2_mul_add(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m128i *d = dst;
+	const __m128i *s = src;
+	__m128i zero, poly, t, acc;
+	size_t i, cnt = size / sizeof (__m128i);
+
+	RAIDZ_SSE_MUL2_SETUP();
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_SSE_LOAD(s + i);
+		RAIDZ_SSE2_MUL(t, c, acc);
+		RAIDZ_SSE_STORE(d + i,
+		    _mm_xor_si128(RAIDZ_SSE_LOAD(d + i), acc));
+	}
+}
+
+static boolean_t
+raidz_sse2_valid(void)
+{
+	return (zfs_sse2_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_sse2_impl = {
+	.add = raidz_sse_add,
+	.gen_pq = raidz_sse_gen_pq,
+	.gen_pqr = raidz_sse_gen_pqr,
+	.mul2 = raidz_sse_mul2,
+	.mul2_add = raidz_sse_mul2_add,
+	.mul = raidz_sse2_mul,
+	.mul_add = raidz_sse2_mul_add,
+	.valid = raidz_sse2_valid,
+	.name = "sse2"
+};
+
+/*
+ * SSSE3: c * x = lo[x & 15] ^ hi[x >> 4], sixteen lookups per pshufb.
+ */
+#define	RAIDZ_SSSE3_MUL(x)						\
+	_mm_xor_si128(_mm_shuffle_epi8(lo, _mm_and_si128(x, nib)),	\
+	    _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4), nib)))
+
+static void
+raidz_ssse3_mul(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m128i *d = dst;
+	const __m128i *s = src;
+	__m128i lo, hi, nib, t;
+	uint8_t lotab[16], hitab[16];
+	size_t i, cnt = size / sizeof (__m128i);
+
+	vdev_raidz_mul_tables(c, lotab, hitab);
+
+
+	lo = _mm_loadu_si128((const __m128i *)lotab);
+	hi = _mm_loadu_si128((const __m128i *)hitab);
+	nib = _mm_set1_epi8(0x0f);
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_SSE_LOAD(s + i);
+		RAIDZ_SSE_STORE(d + i, RAIDZ_SSSE3_MUL(t));
+	}
+}
+
+static void
+raidz_ssse3_mul_add(void *dst, const void *src, uint8_t c, size_t size)
+{
+	__m128i *d = dst;
+	const __m128i *s = src;
+	__m128i lo, hi, nib, t;
+	uint8_t lotab[16], hitab[16];
+	size_t i, cnt = size / sizeof (__m128i);
+
+	vdev_raidz_mul_tables(c, lotab, hitab);
+
+
+	lo = _mm_loadu_si128((const __m128i *)lotab);
+	hi = _mm_loadu_si128((const __m128i *)hitab);
+	nib = _mm_set1_epi8(0x0f);
+
+	for (i = 0; i < cnt; i++) {
+		t = RAIDZ_SSE_LOAD(s + i);
+		RAIDZ_SSE_STORE(d + i,
+		    _mm_xor_si128(RAIDZ_SSE_LOAD(d + i), RAIDZ_SSSE3_MUL(t)));
+	}
+}
+
+static boolean_t
+raidz_ssse3_valid(void)
+{
+	return (zfs_sse2_available() && zfs_ssse3_available());
+}
+
+const raidz_impl_ops_t vdev_raidz_ssse3_impl = {
+	.add = raidz_sse_add,
+	.gen_pq = raidz_sse_gen_pq,
+	.gen_pqr = raidz_sse_gen_pqr,
+	.mul2 = raidz_sse_mul2,
+	.mul2_add = raidz_sse_mul2_add,
+	.mul = raidz_ssse3_mul,
+	.mul_add = raidz_ssse3_mul_add,
+	.valid = raidz_ssse3_valid,
+	.name = "ssse3"
+};
+
+#endif /* HAVE_SIMD_X86 */
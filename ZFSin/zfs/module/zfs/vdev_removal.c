@@ -47,6 +47,7 @@
 //#include <inttypes.h>
 #define PRIu64 "llu"  // fixme, add inttypes.h
 #include <sys/vdev_initialize.h>
+#include <sys/vdev_trim.h>
 
 /*
  * This file contains the necessary logic to remove vdevs from a
@@ -293,7 +294,7 @@ vdev_remove_initiate_sync(void *arg, dmu_tx_t *tx)
 		    ms->ms_sm->sm_phys->smp_alloc);
 
 		spa->spa_removing_phys.sr_to_copy +=
-		    space_map_allocated(ms->ms_sm);
+		    metaslab_allocated_space(ms);
 
 		/*
 		 * Space which we are freeing this txg does not need to
@@ -960,6 +961,10 @@ spa_vdev_copy_segment(vdev_t *vd, range_tree_t *segs,
 	 */
 	int error = metaslab_alloc_dva(spa, mg->mg_class, size,
 	    &dst, 0, NULL, txg, 0, zal, 0);
+	if (error == ENOSPC && mg->mg_class != spa_normal_class(spa)) {
+		error = metaslab_alloc_dva(spa, spa_normal_class(spa), size,
+		    &dst, 0, NULL, txg, 0, zal, 0);
+	}
 	if (error != 0)
 		return (error);
 
@@ -1058,6 +1063,17 @@ vdev_remove_complete_sync(void *arg, dmu_tx_t *tx)
 
 	vdev_destroy_spacemaps(vd, tx);
 
+	/*
+	 * A removed special vdev no longer holds the allocation_classes
+	 * feature active.
+	 */
+	if (vd->vdev_top_zap != 0 && zap_contains(spa->spa_meta_objset,
+	    vd->vdev_top_zap, VDEV_TOP_ZAP_ALLOCATION_BIAS) == 0) {
+		VERIFY0(zap_remove(spa->spa_meta_objset, vd->vdev_top_zap,
+		    VDEV_TOP_ZAP_ALLOCATION_BIAS, tx));
+		spa_feature_decr(spa, SPA_FEATURE_ALLOCATION_CLASSES, tx);
+	}
+
 	/* destroy leaf zaps, if any */
 	ASSERT3P(svr->svr_zaplist, !=, NULL);
 	for (nvpair_t *pair = nvlist_next_nvpair(svr->svr_zaplist, NULL);
@@ -1109,6 +1125,7 @@ vdev_remove_replace_with_indirect(vdev_t *vd, uint64_t txg)
 
 	ivd = vdev_add_parent(vd, &vdev_indirect_ops);
 	ivd->vdev_removing = 0;
+	ivd->vdev_alloc_bias = VDEV_BIAS_NONE;
 
 	vd->vdev_leaf_zap = 0;
 
@@ -1149,6 +1166,8 @@ vdev_remove_complete(spa_t *spa)
 	txg = spa_vdev_enter(spa);
 	vdev_t *vd = vdev_lookup_top(spa, spa->spa_vdev_removal->svr_vdev_id);
 	ASSERT3P(vd->vdev_initialize_thread, ==, NULL);
+	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
+	ASSERT3P(vd->vdev_autotrim_thread, ==, NULL);
 
 	sysevent_t *ev = spa_event_create(spa, vd, NULL,
 	    ESC_ZFS_VDEV_REMOVE_DEV);
@@ -1417,6 +1436,14 @@ spa_vdev_remove_thread(void *arg)
 			    SM_ALLOC));
 			space_map_close(sm);
 
+			/*
+			 * With log space maps, the changes since the last
+			 * flush of the metaslab are only in the logs.
+			 */
+			range_tree_walk(msp->ms_unflushed_allocs,
+			    range_tree_add, svr->svr_allocd_segs);
+			range_tree_walk(msp->ms_unflushed_frees,
+			    range_tree_remove, svr->svr_allocd_segs);
 			range_tree_walk(msp->ms_freeing,
 			    range_tree_remove, svr->svr_allocd_segs);
 
@@ -1623,6 +1650,10 @@ spa_vdev_remove_cancel_sync(void *arg, dmu_tx_t *tx)
 			mutex_enter(&svr->svr_lock);
 			VERIFY0(space_map_load(msp->ms_sm,
 			    svr->svr_allocd_segs, SM_ALLOC));
+			range_tree_walk(msp->ms_unflushed_allocs,
+			    range_tree_add, svr->svr_allocd_segs);
+			range_tree_walk(msp->ms_unflushed_frees,
+			    range_tree_remove, svr->svr_allocd_segs);
 			range_tree_walk(msp->ms_freeing,
 			    range_tree_remove, svr->svr_allocd_segs);
 
@@ -1706,6 +1737,8 @@ spa_vdev_remove_cancel(spa_t *spa)
 		spa_config_enter(spa, SCL_ALLOC | SCL_VDEV, FTAG, RW_WRITER);
 		vdev_t *vd = vdev_lookup_top(spa, vdid);
 		metaslab_group_activate(vd->vdev_mg);
+		spa_async_request(spa, SPA_ASYNC_TRIM_RESTART);
+		spa_async_request(spa, SPA_ASYNC_AUTOTRIM_RESTART);
 		spa_config_exit(spa, SCL_ALLOC | SCL_VDEV, FTAG);
 	}
 
@@ -1826,8 +1859,10 @@ spa_vdev_remove_log(vdev_t *vd, uint64_t *txg)
 	/* Make sure these changes are sync'ed */
 	spa_vdev_config_exit(spa, NULL, *txg, 0, FTAG);
 
-	/* Stop initializing */
+	/* Stop initializing and TRIM */
 	(void) vdev_initialize_stop_all(vd, VDEV_INITIALIZE_CANCELED);
+	vdev_trim_stop_all(vd, VDEV_TRIM_CANCELED);
+	vdev_autotrim_stop_wait(vd);
 
 	*txg = spa_vdev_config_enter(spa);
 
@@ -1870,16 +1905,35 @@ spa_vdev_remove_top_check(vdev_t *vd)
 	if (!spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REMOVAL))
 		return (SET_ERROR(ENOTSUP));
 
-	/*
-	 * There has to be enough free space to remove the
-	 * device and leave double the "slop" space (i.e. we
-	 * must leave at least 3% of the pool free, in addition to
-	 * the normal slop space).
-	 */
-	if (dsl_dir_space_available(spa->spa_dsl_pool->dp_root_dir,
-	    NULL, 0, B_TRUE) <
-	    vd->vdev_stat.vs_dspace + spa_get_slop_space(spa)) {
-		return (SET_ERROR(ENOSPC));
+	metaslab_class_t *mc = vd->vdev_mg->mg_class;
+	metaslab_class_t *normal = spa_normal_class(spa);
+	if (mc != normal) {
+		/*
+		 * Space allocated from the special class is included in the
+		 * DMU's space usage, but not in spa_dspace.  Therefore there
+		 * is always at least as much space available in the normal
+		 * class as is allocated from the special class, which is
+		 * where the data lands if the other special devices are
+		 * full.  As a backup check, return ENOSPC if this is
+		 * violated.
+		 */
+		uint64_t available = metaslab_class_get_space(normal) -
+		    metaslab_class_get_alloc(normal);
+		ASSERT3U(available, >=, vd->vdev_stat.vs_alloc);
+		if (available < vd->vdev_stat.vs_alloc)
+			return (SET_ERROR(ENOSPC));
+	} else {
+		/*
+		 * There has to be enough free space to remove the
+		 * device and leave double the "slop" space (i.e. we
+		 * must leave at least 3% of the pool free, in addition to
+		 * the normal slop space).
+		 */
+		if (dsl_dir_space_available(spa->spa_dsl_pool->dp_root_dir,
+		    NULL, 0, B_TRUE) <
+		    vd->vdev_stat.vs_dspace + spa_get_slop_space(spa)) {
+			return (SET_ERROR(ENOSPC));
+		}
 	}
 
 	/*
@@ -1908,6 +1962,15 @@ spa_vdev_remove_top_check(vdev_t *vd)
 		return (SET_ERROR(EINVAL));
 	}
 
+	/*
+	 * A removed special vdev must have the same ashift as the normal
+	 * class, since its data may be copied there.
+	 */
+	if (vd->vdev_alloc_bias != VDEV_BIAS_NONE &&
+	    vd->vdev_ashift != spa->spa_max_ashift) {
+		return (SET_ERROR(EINVAL));
+	}
+
 	/*
 	 * All vdevs in normal class must have the same ashift
 	 * and not be raidz.
@@ -1916,7 +1979,8 @@ spa_vdev_remove_top_check(vdev_t *vd)
 	int num_indirect = 0;
 	for (uint64_t id = 0; id < rvd->vdev_children; id++) {
 		vdev_t *cvd = rvd->vdev_child[id];
-		if (cvd->vdev_ashift != 0 && !cvd->vdev_islog)
+		if (cvd->vdev_ashift != 0 && !cvd->vdev_islog &&
+		    cvd->vdev_alloc_bias == VDEV_BIAS_NONE)
 			ASSERT3U(cvd->vdev_ashift, ==, spa->spa_max_ashift);
 		if (cvd->vdev_ops == &vdev_indirect_ops)
 			num_indirect++;
@@ -1990,11 +2054,13 @@ spa_vdev_remove_top(vdev_t *vd, uint64_t *txg)
 	error = spa_reset_logs(spa);
 
 	/*
-	 * We stop any initializing that is currently in progress but leave
-	 * the state as "active". This will allow the initializing to resume
-	 * if the removal is canceled sometime later.
+	 * We stop any initializing and TRIM that is currently in progress
+	 * but leave the state as "active". This will allow the process to
+	 * resume if the removal is canceled sometime later.
 	 */
 	vdev_initialize_stop_all(vd, VDEV_INITIALIZE_ACTIVE);
+	vdev_trim_stop_all(vd, VDEV_TRIM_ACTIVE);
+	vdev_autotrim_stop_wait(vd);
 
 	*txg = spa_vdev_config_enter(spa);
 
@@ -2008,6 +2074,8 @@ spa_vdev_remove_top(vdev_t *vd, uint64_t *txg)
 	if (error != 0) {
 		metaslab_group_activate(mg);
 		spa_async_request(spa, SPA_ASYNC_INITIALIZE_RESTART);
+		spa_async_request(spa, SPA_ASYNC_TRIM_RESTART);
+		spa_async_request(spa, SPA_ASYNC_AUTOTRIM_RESTART);
 		return (error);
 	}
 
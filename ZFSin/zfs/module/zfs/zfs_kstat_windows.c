@@ -44,6 +44,9 @@
 #include <sys/spa.h>
 #include <sys/zap_impl.h>
 #include <sys/zil.h>
+#include <zfs_fletcher.h>
+#include <sys/vdev_raidz.h>
+#include <sys/crypto/icp.h>
 
 /*
  * In Solaris the tunable are set via /etc/system. Until we have a load
@@ -77,6 +80,9 @@ osx_kstat_t osx_kstat = {
 	{ "zfs_arc_shrink_shift",		KSTAT_DATA_UINT64 },
 	{ "zfs_arc_p_min_shift",		KSTAT_DATA_UINT64 },
 	{ "zfs_arc_average_blocksize",	KSTAT_DATA_UINT64 },
+	{ "zfs_arc_hash_locks_per_cpu",	KSTAT_DATA_UINT64 },
+	{ "zfs_arc_hash_lockless",		KSTAT_DATA_UINT64 },
+	{ "zfs_arc_pressure_grow_shift",	KSTAT_DATA_UINT64 },
 
 	{ "l2arc_write_max",			KSTAT_DATA_UINT64 },
 	{ "l2arc_write_boost",			KSTAT_DATA_UINT64 },
@@ -97,6 +103,17 @@ osx_kstat_t osx_kstat = {
 	{ "async_write_max_active",		KSTAT_DATA_UINT64 },
 	{ "scrub_min_active",			KSTAT_DATA_UINT64 },
 	{ "scrub_max_active",			KSTAT_DATA_UINT64 },
+	{ "trim_min_active",			KSTAT_DATA_UINT64 },
+	{ "trim_max_active",			KSTAT_DATA_UINT64 },
+	{ "deadline",				KSTAT_DATA_UINT64 },
+	{ "sync_read_deadline_ms",		KSTAT_DATA_UINT64 },
+	{ "sync_write_deadline_ms",		KSTAT_DATA_UINT64 },
+	{ "async_read_deadline_ms",		KSTAT_DATA_UINT64 },
+	{ "async_write_deadline_ms",		KSTAT_DATA_UINT64 },
+	{ "scrub_deadline_ms",			KSTAT_DATA_UINT64 },
+	{ "removal_deadline_ms",		KSTAT_DATA_UINT64 },
+	{ "initializing_deadline_ms",		KSTAT_DATA_UINT64 },
+	{ "trim_deadline_ms",			KSTAT_DATA_UINT64 },
 	{ "async_write_min_dirty_pct",	KSTAT_DATA_INT64  },
 	{ "async_write_max_dirty_pct",	KSTAT_DATA_INT64  },
 	{ "aggregation_limit",			KSTAT_DATA_INT64  },
@@ -118,6 +135,8 @@ osx_kstat_t osx_kstat = {
 	{"zfetch_array_rd_sz",			KSTAT_DATA_INT64  },
 	{"zfs_default_bs",				KSTAT_DATA_INT64  },
 	{"zfs_default_ibs",				KSTAT_DATA_INT64  },
+	{"dmu_object_alloc_chunk_shift",	KSTAT_DATA_INT64  },
+	{"dbuf_hash_load_max",			KSTAT_DATA_INT64  },
 	{"metaslab_aliquot",			KSTAT_DATA_INT64  },
 	{"spa_max_replication_override",KSTAT_DATA_INT64  },
 	{"spa_mode_global",				KSTAT_DATA_INT64  },
@@ -127,6 +146,15 @@ osx_kstat_t osx_kstat = {
 	{"zfs_vdev_cache_size",			KSTAT_DATA_INT64  },
 	{"zfs_vdev_cache_bshift",		KSTAT_DATA_INT64  },
 	{"vdev_mirror_shift",			KSTAT_DATA_INT64  },
+	{"zfs_vdev_mirror_rotating_inc",	KSTAT_DATA_INT64  },
+	{"zfs_vdev_mirror_rot_seek_inc",	KSTAT_DATA_INT64  },
+	{"zfs_vdev_mirror_rot_seek_off",	KSTAT_DATA_INT64  },
+	{"zfs_vdev_mirror_nonrot_inc",	KSTAT_DATA_INT64  },
+	{"zfs_vdev_mirror_nonrot_seek_inc",	KSTAT_DATA_INT64  },
+	{"zfs_vdev_mirror_latency_aware",	KSTAT_DATA_INT64  },
+	{"zfs_vdev_latency_ewma_shift",		KSTAT_DATA_INT64  },
+	{"zfs_vdev_max_segs",			KSTAT_DATA_INT64  },
+	{"zfs_vdev_aggregate_gang",		KSTAT_DATA_INT64  },
 	{"zfs_scrub_limit",				KSTAT_DATA_INT64  },
 	{"zfs_no_scrub_io",				KSTAT_DATA_INT64  },
 	{"zfs_no_scrub_prefetch",		KSTAT_DATA_INT64  },
@@ -143,11 +171,37 @@ osx_kstat_t osx_kstat = {
 	{ "l2arc_noprefetch",			KSTAT_DATA_INT64  },
 	{ "l2arc_feed_again",			KSTAT_DATA_INT64  },
 	{ "l2arc_norw",					KSTAT_DATA_INT64  },
+	{ "l2arc_rebuild_enabled",		KSTAT_DATA_INT64  },
+	{ "l2arc_rebuild_blks_min_l2size",	KSTAT_DATA_UINT64  },
 
 	{"zfs_top_maxinflight",			KSTAT_DATA_INT64  },
 	{"zfs_resilver_delay",			KSTAT_DATA_INT64  },
 	{"zfs_scrub_delay",				KSTAT_DATA_INT64  },
 	{"zfs_scan_idle",				KSTAT_DATA_INT64  },
+	{"zfs_scan_legacy",				KSTAT_DATA_INT64  },
+	{"zfs_scan_vdev_limit",			KSTAT_DATA_UINT64  },
+	{"zfs_scan_checkpoint_intval",	KSTAT_DATA_INT64  },
+	{"zfs_scan_strict_mem_lim",		KSTAT_DATA_INT64  },
+	{"zfs_scan_mem_lim_fact",		KSTAT_DATA_INT64  },
+	{"zfs_scan_mem_lim_soft_fact",	KSTAT_DATA_INT64  },
+
+	{"zfs_trim_extent_bytes_max",	KSTAT_DATA_UINT64  },
+	{"zfs_trim_extent_bytes_min",	KSTAT_DATA_UINT64  },
+	{"zfs_trim_metaslab_skip",		KSTAT_DATA_INT64  },
+	{"zfs_trim_queue_limit",		KSTAT_DATA_INT64  },
+	{"zfs_trim_txg_batch",			KSTAT_DATA_INT64  },
+
+	{"zfs_ddt_data_is_special",		KSTAT_DATA_INT64  },
+	{"zfs_user_indirect_is_special",	KSTAT_DATA_INT64  },
+	{"zfs_special_class_md_rsrv_pct",	KSTAT_DATA_INT64  },
+
+	{"zfs_unflushed_max_mem_amt",	KSTAT_DATA_UINT64  },
+	{"zfs_unflushed_max_mem_ppm",	KSTAT_DATA_UINT64  },
+	{"zfs_unflushed_log_block_max",	KSTAT_DATA_UINT64  },
+	{"zfs_unflushed_log_block_min",	KSTAT_DATA_UINT64  },
+	{"zfs_unflushed_log_block_pct",	KSTAT_DATA_UINT64  },
+	{"zfs_min_metaslabs_to_flush",	KSTAT_DATA_UINT64  },
+	{"zfs_keep_log_sm_at_export",	KSTAT_DATA_INT64  },
 
 	{"zfs_recover",					KSTAT_DATA_INT64  },
 
@@ -167,8 +221,14 @@ osx_kstat_t osx_kstat = {
 
 	{"zfs_vdev_queue_depth_pct",KSTAT_DATA_UINT64  },
 	{"zio_dva_throttle_enabled",KSTAT_DATA_UINT64  },
+	{"zio_stage_stats",KSTAT_DATA_UINT64  },
 
 	{"zfs_vdev_file_size_mismatch_cnt",KSTAT_DATA_UINT64  },
+
+	{"zfs_fletcher_4_impl",			KSTAT_DATA_UINT64  },
+	{"zfs_vdev_raidz_impl",			KSTAT_DATA_UINT64  },
+	{"icp_aes_impl",				KSTAT_DATA_UINT64  },
+	{"icp_gcm_impl",				KSTAT_DATA_UINT64  },
 };
 
 
@@ -213,6 +273,9 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		l2arc_noprefetch = ks->l2arc_noprefetch.value.i64;
 		l2arc_feed_again = ks->l2arc_feed_again.value.i64;
 		l2arc_norw = ks->l2arc_norw.value.i64;
+		l2arc_rebuild_enabled = ks->l2arc_rebuild_enabled.value.i64;
+		l2arc_rebuild_blocks_min_l2size =
+			ks->l2arc_rebuild_blocks_min_l2size.value.ui64;
 
 		/* vdev_queue */
 
@@ -238,6 +301,28 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_vdev_scrub_min_active.value.ui64;
 		zfs_vdev_scrub_max_active =
 			ks->zfs_vdev_scrub_max_active.value.ui64;
+		zfs_vdev_trim_min_active =
+			ks->zfs_vdev_trim_min_active.value.ui64;
+		zfs_vdev_trim_max_active =
+			ks->zfs_vdev_trim_max_active.value.ui64;
+		zfs_vdev_deadline =
+			ks->zfs_vdev_deadline.value.ui64;
+		zfs_vdev_sync_read_deadline_ms =
+			ks->zfs_vdev_sync_read_deadline_ms.value.ui64;
+		zfs_vdev_sync_write_deadline_ms =
+			ks->zfs_vdev_sync_write_deadline_ms.value.ui64;
+		zfs_vdev_async_read_deadline_ms =
+			ks->zfs_vdev_async_read_deadline_ms.value.ui64;
+		zfs_vdev_async_write_deadline_ms =
+			ks->zfs_vdev_async_write_deadline_ms.value.ui64;
+		zfs_vdev_scrub_deadline_ms =
+			ks->zfs_vdev_scrub_deadline_ms.value.ui64;
+		zfs_vdev_removal_deadline_ms =
+			ks->zfs_vdev_removal_deadline_ms.value.ui64;
+		zfs_vdev_initializing_deadline_ms =
+			ks->zfs_vdev_initializing_deadline_ms.value.ui64;
+		zfs_vdev_trim_deadline_ms =
+			ks->zfs_vdev_trim_deadline_ms.value.ui64;
 		zfs_vdev_async_write_active_min_dirty_percent =
 			ks->zfs_vdev_async_write_active_min_dirty_percent.value.i64;
 		zfs_vdev_async_write_active_max_dirty_percent =
@@ -279,6 +364,10 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_default_bs.value.i64;
 		zfs_default_ibs =
 			ks->zfs_default_ibs.value.i64;
+		dmu_object_alloc_chunk_shift =
+			ks->dmu_object_alloc_chunk_shift.value.i64;
+		dbuf_hash_load_max =
+			ks->dbuf_hash_load_max.value.i64;
 		metaslab_aliquot =
 			ks->metaslab_aliquot.value.i64;
 		spa_max_replication_override =
@@ -293,6 +382,24 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_vdev_cache_max.value.i64;
 		zfs_vdev_cache_size =
 			ks->zfs_vdev_cache_size.value.i64;
+		zfs_vdev_mirror_rotating_inc =
+			ks->zfs_vdev_mirror_rotating_inc.value.i64;
+		zfs_vdev_mirror_rotating_seek_inc =
+			ks->zfs_vdev_mirror_rotating_seek_inc.value.i64;
+		zfs_vdev_mirror_rotating_seek_offset =
+			ks->zfs_vdev_mirror_rotating_seek_offset.value.i64;
+		zfs_vdev_mirror_non_rotating_inc =
+			ks->zfs_vdev_mirror_non_rotating_inc.value.i64;
+		zfs_vdev_mirror_non_rotating_seek_inc =
+			ks->zfs_vdev_mirror_non_rotating_seek_inc.value.i64;
+		zfs_vdev_mirror_latency_aware =
+			ks->zfs_vdev_mirror_latency_aware.value.i64;
+		zfs_vdev_latency_ewma_shift =
+			ks->zfs_vdev_latency_ewma_shift.value.i64;
+		zfs_vdev_max_segs =
+			ks->zfs_vdev_max_segs.value.i64;
+		zfs_vdev_aggregate_gang =
+			ks->zfs_vdev_aggregate_gang.value.i64;
 		zfs_no_scrub_io =
 			ks->zfs_no_scrub_io.value.i64;
 		zfs_no_scrub_prefetch =
@@ -324,6 +431,58 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			ks->zfs_scrub_delay.value.i64;
 		zfs_scan_idle =
 			ks->zfs_scan_idle.value.i64;
+		zfs_scan_legacy =
+			ks->zfs_scan_legacy.value.i64;
+		zfs_scan_vdev_limit =
+			ks->zfs_scan_vdev_limit.value.ui64;
+		zfs_scan_checkpoint_intval =
+			ks->zfs_scan_checkpoint_intval.value.i64;
+		zfs_scan_strict_mem_lim =
+			ks->zfs_scan_strict_mem_lim.value.i64;
+		if (ks->zfs_scan_mem_lim_fact.value.i64 > 0)
+			zfs_scan_mem_lim_fact =
+				ks->zfs_scan_mem_lim_fact.value.i64;
+		if (ks->zfs_scan_mem_lim_soft_fact.value.i64 > 0)
+			zfs_scan_mem_lim_soft_fact =
+				ks->zfs_scan_mem_lim_soft_fact.value.i64;
+
+		if (ks->zfs_trim_extent_bytes_max.value.ui64 > 0)
+			zfs_trim_extent_bytes_max =
+				ks->zfs_trim_extent_bytes_max.value.ui64;
+		zfs_trim_extent_bytes_min =
+			ks->zfs_trim_extent_bytes_min.value.ui64;
+		zfs_trim_metaslab_skip =
+			ks->zfs_trim_metaslab_skip.value.i64;
+		if (ks->zfs_trim_queue_limit.value.i64 > 0)
+			zfs_trim_queue_limit =
+				ks->zfs_trim_queue_limit.value.i64;
+		zfs_trim_txg_batch =
+			ks->zfs_trim_txg_batch.value.i64;
+
+		zfs_ddt_data_is_special =
+			ks->zfs_ddt_data_is_special.value.i64;
+		zfs_user_indirect_is_special =
+			ks->zfs_user_indirect_is_special.value.i64;
+		if (ks->zfs_special_class_metadata_reserve_pct.value.i64 >= 0 &&
+			ks->zfs_special_class_metadata_reserve_pct.value.i64 <= 100)
+			zfs_special_class_metadata_reserve_pct =
+				ks->zfs_special_class_metadata_reserve_pct.value.i64;
+
+		zfs_unflushed_max_mem_amt =
+			ks->zfs_unflushed_max_mem_amt.value.ui64;
+		if (ks->zfs_unflushed_max_mem_ppm.value.ui64 <= 1000000)
+			zfs_unflushed_max_mem_ppm =
+				ks->zfs_unflushed_max_mem_ppm.value.ui64;
+		zfs_unflushed_log_block_max =
+			ks->zfs_unflushed_log_block_max.value.ui64;
+		zfs_unflushed_log_block_min =
+			ks->zfs_unflushed_log_block_min.value.ui64;
+		zfs_unflushed_log_block_pct =
+			ks->zfs_unflushed_log_block_pct.value.ui64;
+		zfs_min_metaslabs_to_flush =
+			ks->zfs_min_metaslabs_to_flush.value.ui64;
+		zfs_keep_log_spacemaps_at_export =
+			ks->zfs_keep_log_spacemaps_at_export.value.i64;
 		zfs_recover =
 			ks->zfs_recover.value.i64;
 
@@ -355,6 +514,25 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 
 		zio_dva_throttle_enabled =
 		    (boolean_t) ks->zio_dva_throttle_enabled.value.ui64;
+		zio_stage_stats = ks->zio_stage_stats.value.ui64;
+
+		/* 0 is fastest, N picks the Nth entry in fletcher_4_impls[] */
+		if (ks->zfs_fletcher_4_impl.value.ui64 != zfs_fletcher_4_impl)
+			(void) fletcher_4_impl_set(
+			    ks->zfs_fletcher_4_impl.value.ui64);
+
+		/* 0 is fastest, N picks the Nth entry in vdev_raidz_impls[] */
+		if (ks->zfs_vdev_raidz_impl.value.ui64 != zfs_vdev_raidz_impl)
+			(void) vdev_raidz_impl_set(
+			    ks->zfs_vdev_raidz_impl.value.ui64);
+
+		/* 0 is fastest, 1 is the generic code, 2 is AES-NI */
+		if (ks->icp_aes_impl.value.ui64 != icp_aes_impl)
+			(void) aes_impl_set(ks->icp_aes_impl.value.ui64);
+
+		/* 0 is fastest, 1 is the generic code, 2 is PCLMULQDQ */
+		if (ks->icp_gcm_impl.value.ui64 != icp_gcm_impl)
+			(void) gcm_impl_set(ks->icp_gcm_impl.value.ui64);
 	} else {
 
 		/* kstat READ */
@@ -387,6 +565,9 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 		ks->l2arc_noprefetch.value.i64               = l2arc_noprefetch;
 		ks->l2arc_feed_again.value.i64               = l2arc_feed_again;
 		ks->l2arc_norw.value.i64                     = l2arc_norw;
+		ks->l2arc_rebuild_enabled.value.i64          = l2arc_rebuild_enabled;
+		ks->l2arc_rebuild_blocks_min_l2size.value.ui64 =
+			l2arc_rebuild_blocks_min_l2size;
 
 		/* vdev_queue */
 		ks->zfs_vdev_max_active.value.ui64 =
@@ -411,6 +592,28 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_vdev_scrub_min_active ;
 		ks->zfs_vdev_scrub_max_active.value.ui64 =
 			zfs_vdev_scrub_max_active ;
+		ks->zfs_vdev_trim_min_active.value.ui64 =
+			zfs_vdev_trim_min_active ;
+		ks->zfs_vdev_trim_max_active.value.ui64 =
+			zfs_vdev_trim_max_active ;
+		ks->zfs_vdev_deadline.value.ui64 =
+			zfs_vdev_deadline ;
+		ks->zfs_vdev_sync_read_deadline_ms.value.ui64 =
+			zfs_vdev_sync_read_deadline_ms ;
+		ks->zfs_vdev_sync_write_deadline_ms.value.ui64 =
+			zfs_vdev_sync_write_deadline_ms ;
+		ks->zfs_vdev_async_read_deadline_ms.value.ui64 =
+			zfs_vdev_async_read_deadline_ms ;
+		ks->zfs_vdev_async_write_deadline_ms.value.ui64 =
+			zfs_vdev_async_write_deadline_ms ;
+		ks->zfs_vdev_scrub_deadline_ms.value.ui64 =
+			zfs_vdev_scrub_deadline_ms ;
+		ks->zfs_vdev_removal_deadline_ms.value.ui64 =
+			zfs_vdev_removal_deadline_ms ;
+		ks->zfs_vdev_initializing_deadline_ms.value.ui64 =
+			zfs_vdev_initializing_deadline_ms ;
+		ks->zfs_vdev_trim_deadline_ms.value.ui64 =
+			zfs_vdev_trim_deadline_ms ;
 		ks->zfs_vdev_async_write_active_min_dirty_percent.value.i64 =
 			zfs_vdev_async_write_active_min_dirty_percent ;
 		ks->zfs_vdev_async_write_active_max_dirty_percent.value.i64 =
@@ -452,6 +655,10 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_default_bs;
 		ks->zfs_default_ibs.value.i64 =
 			zfs_default_ibs;
+		ks->dmu_object_alloc_chunk_shift.value.i64 =
+			dmu_object_alloc_chunk_shift;
+		ks->dbuf_hash_load_max.value.i64 =
+			dbuf_hash_load_max;
 		ks->metaslab_aliquot.value.i64 =
 			metaslab_aliquot;
 		ks->spa_max_replication_override.value.i64 =
@@ -466,6 +673,24 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_vdev_cache_max;
 		ks->zfs_vdev_cache_size.value.i64 =
 			zfs_vdev_cache_size;
+		ks->zfs_vdev_mirror_rotating_inc.value.i64 =
+			zfs_vdev_mirror_rotating_inc;
+		ks->zfs_vdev_mirror_rotating_seek_inc.value.i64 =
+			zfs_vdev_mirror_rotating_seek_inc;
+		ks->zfs_vdev_mirror_rotating_seek_offset.value.i64 =
+			zfs_vdev_mirror_rotating_seek_offset;
+		ks->zfs_vdev_mirror_non_rotating_inc.value.i64 =
+			zfs_vdev_mirror_non_rotating_inc;
+		ks->zfs_vdev_mirror_non_rotating_seek_inc.value.i64 =
+			zfs_vdev_mirror_non_rotating_seek_inc;
+		ks->zfs_vdev_mirror_latency_aware.value.i64 =
+			zfs_vdev_mirror_latency_aware;
+		ks->zfs_vdev_latency_ewma_shift.value.i64 =
+			zfs_vdev_latency_ewma_shift;
+		ks->zfs_vdev_max_segs.value.i64 =
+			zfs_vdev_max_segs;
+		ks->zfs_vdev_aggregate_gang.value.i64 =
+			zfs_vdev_aggregate_gang;
 		ks->zfs_no_scrub_io.value.i64 =
 			zfs_no_scrub_io;
 		ks->zfs_no_scrub_prefetch.value.i64 =
@@ -497,6 +722,51 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 			zfs_scrub_delay;
 		ks->zfs_scan_idle.value.i64 =
 			zfs_scan_idle;
+		ks->zfs_scan_legacy.value.i64 =
+			zfs_scan_legacy;
+		ks->zfs_scan_vdev_limit.value.ui64 =
+			zfs_scan_vdev_limit;
+		ks->zfs_scan_checkpoint_intval.value.i64 =
+			zfs_scan_checkpoint_intval;
+		ks->zfs_scan_strict_mem_lim.value.i64 =
+			zfs_scan_strict_mem_lim;
+		ks->zfs_scan_mem_lim_fact.value.i64 =
+			zfs_scan_mem_lim_fact;
+		ks->zfs_scan_mem_lim_soft_fact.value.i64 =
+			zfs_scan_mem_lim_soft_fact;
+
+		ks->zfs_trim_extent_bytes_max.value.ui64 =
+			zfs_trim_extent_bytes_max;
+		ks->zfs_trim_extent_bytes_min.value.ui64 =
+			zfs_trim_extent_bytes_min;
+		ks->zfs_trim_metaslab_skip.value.i64 =
+			zfs_trim_metaslab_skip;
+		ks->zfs_trim_queue_limit.value.i64 =
+			zfs_trim_queue_limit;
+		ks->zfs_trim_txg_batch.value.i64 =
+			zfs_trim_txg_batch;
+
+		ks->zfs_ddt_data_is_special.value.i64 =
+			zfs_ddt_data_is_special;
+		ks->zfs_user_indirect_is_special.value.i64 =
+			zfs_user_indirect_is_special;
+		ks->zfs_special_class_metadata_reserve_pct.value.i64 =
+			zfs_special_class_metadata_reserve_pct;
+
+		ks->zfs_unflushed_max_mem_amt.value.ui64 =
+			zfs_unflushed_max_mem_amt;
+		ks->zfs_unflushed_max_mem_ppm.value.ui64 =
+			zfs_unflushed_max_mem_ppm;
+		ks->zfs_unflushed_log_block_max.value.ui64 =
+			zfs_unflushed_log_block_max;
+		ks->zfs_unflushed_log_block_min.value.ui64 =
+			zfs_unflushed_log_block_min;
+		ks->zfs_unflushed_log_block_pct.value.ui64 =
+			zfs_unflushed_log_block_pct;
+		ks->zfs_min_metaslabs_to_flush.value.ui64 =
+			zfs_min_metaslabs_to_flush;
+		ks->zfs_keep_log_spacemaps_at_export.value.i64 =
+			zfs_keep_log_spacemaps_at_export;
 
 		ks->zfs_recover.value.i64 =
 			zfs_recover;
@@ -525,8 +795,14 @@ static int osx_kstat_update(kstat_t *ksp, int rw)
 
 		ks->zfs_vdev_queue_depth_pct.value.ui64 = zfs_vdev_queue_depth_pct;
 		ks->zio_dva_throttle_enabled.value.ui64 = (uint64_t) zio_dva_throttle_enabled;
+		ks->zio_stage_stats.value.ui64 = zio_stage_stats;
 
 		ks->zfs_vdev_file_size_mismatch_cnt.value.ui64 = zfs_vdev_file_size_mismatch_cnt;
+
+		ks->zfs_fletcher_4_impl.value.ui64 = zfs_fletcher_4_impl;
+		ks->zfs_vdev_raidz_impl.value.ui64 = zfs_vdev_raidz_impl;
+		ks->icp_aes_impl.value.ui64 = icp_aes_impl;
+		ks->icp_gcm_impl.value.ui64 = icp_gcm_impl;
 	}
 
 	return 0;
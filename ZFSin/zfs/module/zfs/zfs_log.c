@@ -39,6 +39,7 @@
 #include <sys/stat.h>
 #include <sys/acl.h>
 #include <sys/dmu.h>
+#include <sys/dnode.h>
 #include <sys/spa.h>
 #include <sys/zfs_fuid.h>
 #include <sys/dsl_dataset.h>
@@ -250,6 +251,7 @@ zfs_log_create(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	size_t lrsize;
 	size_t namesize = strlen(name) + 1;
 	size_t fuidsz = 0;
+	int dnodesize;
 
 	if (zil_replaying(zilog, tx))
 		return;
@@ -282,7 +284,10 @@ zfs_log_create(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 
 	lr = (lr_create_t *)&itx->itx_lr;
 	lr->lr_doid = dzp->z_id;
-	lr->lr_foid = zp->z_id;
+	lr->lr_foid = 0;
+	LR_FOID_SET_OBJ(lr->lr_foid, zp->z_id);
+	dmu_object_dnsize_from_db(sa_get_db(zp->z_sa_hdl), &dnodesize);
+	LR_FOID_SET_SLOTS(lr->lr_foid, dnodesize >> DNODE_SHIFT);
 	lr->lr_mode = zp->z_mode;
 	if (!IS_EPHEMERAL(zp->z_uid)) {
 		lr->lr_uid = (uint64_t)zp->z_uid;
@@ -401,6 +406,7 @@ zfs_log_symlink(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	lr_create_t *lr;
 	size_t namesize = strlen(name) + 1;
 	size_t linksize = strlen(link) + 1;
+	int dnodesize;
 
 	if (zil_replaying(zilog, tx))
 		return;
@@ -408,7 +414,10 @@ zfs_log_symlink(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
 	itx = zil_itx_create(txtype, sizeof (*lr) + namesize + linksize);
 	lr = (lr_create_t *)&itx->itx_lr;
 	lr->lr_doid = dzp->z_id;
-	lr->lr_foid = zp->z_id;
+	lr->lr_foid = 0;
+	LR_FOID_SET_OBJ(lr->lr_foid, zp->z_id);
+	dmu_object_dnsize_from_db(sa_get_db(zp->z_sa_hdl), &dnodesize);
+	LR_FOID_SET_SLOTS(lr->lr_foid, dnodesize >> DNODE_SHIFT);
 	lr->lr_uid = zp->z_uid;
 	lr->lr_gid = zp->z_gid;
 	lr->lr_mode = zp->z_mode;
@@ -472,6 +481,8 @@ zfs_log_write(zilog_t *zilog, dmu_tx_t *tx, int txtype,
 
 	if (zilog->zl_logbias == ZFS_LOGBIAS_THROUGHPUT)
 		write_state = WR_INDIRECT;
+	else if (ioflag & FDIRECT)
+		write_state = WR_INDIRECT;	/* already on disk */
 	else if (!spa_has_slogs(zilog->zl_spa) &&
 	    resid >= zfs_immediate_write_sz)
 		write_state = WR_INDIRECT;
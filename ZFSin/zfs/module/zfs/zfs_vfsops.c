@@ -3210,6 +3210,14 @@ zfs_vfs_unmount(struct mount *mp, int mntflags, vfs_context_t *context)
 	VERIFY(zfsvfs_teardown(zfsvfs, B_TRUE) == 0);
 	os = zfsvfs->z_os;
 
+#ifdef _WIN32
+	/*
+	 * MDL chains lent by zfs_mdl_read() still hold dbufs of the objset;
+	 * wait for the requesters to complete them.
+	 */
+	zfs_mdl_loan_drain(zfsvfs);
+#endif
+
     dprintf("OS %p\n", os);
 	/*
 	 * z_os will be NULL if there was an error in
@@ -3772,6 +3780,10 @@ zfs_init(void)
 	 */
 	zfs_vnodes_adjust();
 
+#ifdef _WIN32
+	zfs_mdl_loan_init();
+#endif
+
 	dmu_objset_register_type(DMU_OST_ZFS, zfs_space_delta_cb);
 }
 
@@ -3779,6 +3791,9 @@ void
 zfs_fini(void)
 {
 //	zfsctl_fini();
+#ifdef _WIN32
+	zfs_mdl_loan_fini();
+#endif
 	zfs_znode_fini();
 	zfs_vnodes_adjust_back();
 }
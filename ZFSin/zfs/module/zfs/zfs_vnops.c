@@ -583,6 +583,35 @@ mappedread(vnode_t *vp, int nbytes, struct uio *uio)
 
 offset_t zfs_read_chunk_size = MAX_UPL_TRANSFER * PAGE_SIZE; /* Tunable */
 
+/*
+ * Can the next nbytes of this read or write bypass the ARC?  The dataset's
+ * "direct" property decides whether to try at all.  The transfer must
+ * then cover whole blocks from a single kernel buffer, and the file must
+ * have no cached pages that would go stale.  Encrypted blocks need the
+ * ARC's key handling, so encrypted datasets always use the ARC.
+ */
+static boolean_t
+zfs_direct_ok(znode_t *zp, uio_t *uio, ssize_t nbytes, int ioflag)
+{
+	objset_t *os = zp->z_zfsvfs->z_os;
+	uint64_t blksz = zp->z_blksz;
+
+	if (os->os_direct == ZFS_DIRECT_DISABLED ||
+	    (os->os_direct == ZFS_DIRECT_STANDARD && !(ioflag & FDIRECT)))
+		return (B_FALSE);
+
+	if (os->os_encrypted || vn_has_cached_data(ZTOV(zp)))
+		return (B_FALSE);
+
+	if (uio->uio_segflg != UIO_SYSSPACE ||
+	    uio_curriovlen(uio) < (user_size_t)nbytes)
+		return (B_FALSE);
+
+	return (nbytes > 0 && ISP2(blksz) &&
+	    P2PHASE(uio_offset(uio), blksz) == 0 &&
+	    P2PHASE(nbytes, blksz) == 0);
+}
+
 /*
  * Read bytes from specified file into supplied buffer.
  *
@@ -607,6 +636,7 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	znode_t		*zp = VTOZ(vp);
 	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
 	objset_t	*os;
+	ssize_t		start_resid = uio_resid(uio);
 	ssize_t		n, nbytes;
 	int		error = 0;
 	rl_t		*rl;
@@ -719,7 +749,16 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 			error = mappedread_sf(vp, nbytes, uio);
 		else
 #endif /* __FreeBSD__ */
-		if (vn_has_cached_data(vp))
+		if (zfs_direct_ok(zp, uio, nbytes, ioflag)) {
+			error = dmu_read_direct_dbuf(sa_get_db(zp->z_sa_hdl),
+			    uio_offset(uio), nbytes,
+			    (void *)uio_curriovbase(uio));
+			if (error == 0) {
+				uio_update(uio, nbytes);
+				dataset_kstats_update_direct_read_kstats(
+				    &os->os_dsks, nbytes);
+			}
+		} else if (vn_has_cached_data(vp))
 			error = mappedread(vp, nbytes, uio);
 		else
 			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
@@ -736,12 +775,105 @@ zfs_read(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 out:
 	zfs_range_unlock(rl);
 
+	dataset_kstats_update_read_kstats(&os->os_dsks,
+	    start_resid - uio_resid(uio));
 	ZFS_ACCESSTIME_STAMP(zfsvfs, zp);
 	ZFS_EXIT(zfsvfs);
     if (error) dprintf("zfs_read returning error %d\n", error);
 	return (error);
 }
 
+typedef struct zfs_loan {
+	rl_t			*zl_rl;
+	dmu_loan_done_func_t	*zl_done;
+	void			*zl_arg;
+} zfs_loan_t;
+
+static void
+zfs_loan_done(dmu_loan_t *loan, void *arg)
+{
+	zfs_loan_t *zl = arg;
+
+	zfs_range_unlock(zl->zl_rl);
+	if (zl->zl_done != NULL)
+		zl->zl_done(loan, zl->zl_arg);
+	kmem_free(zl, sizeof (zfs_loan_t));
+}
+
+/*
+ * Lend the caller the file's data for [offset, offset + size) instead of
+ * copying it into a uio; see dmu_read_loan().  The range is cut short at
+ * end-of-file and at DMU_MAX_ACCESS / 2, so check the loan's dl_size.  At
+ * or past end-of-file nothing is loaned and *loanp is set to NULL.  Files
+ * with data in the page cache get EAGAIN and must go through zfs_read().
+ * The range stays read-locked until the loan is returned, as zvol_read_loan()
+ * does: writers, including one that grows the file's only block and would
+ * free the loaned buffer, wait for it.  vp must stay referenced until then.
+ */
+int
+zfs_read_loan(vnode_t *vp, uint64_t offset, uint64_t size,
+    dmu_loan_done_func_t *done, void *arg, dmu_loan_t **loanp)
+{
+	znode_t		*zp = VTOZ(vp);
+	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
+	int		error = 0;
+	zfs_loan_t	*zl;
+	rl_t		*rl;
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(zp);
+
+	*loanp = NULL;
+
+	if (zp->z_pflags & ZFS_AV_QUARANTINED) {
+		ZFS_EXIT(zfsvfs);
+		return (SET_ERROR(EACCES));
+	}
+
+	if (vn_has_cached_data(vp)) {
+		ZFS_EXIT(zfsvfs);
+		return (SET_ERROR(EAGAIN));
+	}
+
+	if (size == 0) {
+		ZFS_EXIT(zfsvfs);
+		return (0);
+	}
+
+	rl = zfs_range_lock(zp, offset, size, RL_READER);
+
+	if (offset < zp->z_size) {
+		size = MIN(size, zp->z_size - offset);
+		size = MIN(size, DMU_MAX_ACCESS >> 1);
+
+		zl = kmem_alloc(sizeof (zfs_loan_t), KM_SLEEP);
+		zl->zl_rl = rl;
+		zl->zl_done = done;
+		zl->zl_arg = arg;
+
+		error = dmu_read_loan_dbuf(sa_get_db(zp->z_sa_hdl), offset,
+		    size, DMU_READ_PREFETCH, zfs_loan_done, zl, loanp);
+		if (error == 0) {
+			dataset_kstats_update_read_kstats(
+			    &zfsvfs->z_os->os_dsks, size);
+			/* zfs_loan_done() drops the range lock */
+			rl = NULL;
+		} else {
+			kmem_free(zl, sizeof (zfs_loan_t));
+			/* convert checksum errors into IO errors */
+			if (error == ECKSUM)
+				error = SET_ERROR(EIO);
+		}
+	}
+
+	if (rl != NULL)
+		zfs_range_unlock(rl);
+
+	ZFS_ACCESSTIME_STAMP(zfsvfs, zp);
+	ZFS_EXIT(zfsvfs);
+	return (error);
+}
+
 /*
  * Write the bytes to a file.
  *
@@ -785,6 +917,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	//int		iovcnt = uio_iovcnt(uio);
 	iovec_t		*iovp =  (iovec_t *)uio_curriovbase(uio);
 	int		write_eof;
+	boolean_t	direct;
 	int		count = 0;
 	sa_bulk_attr_t	bulk[4];
 	uint64_t	mtime[2], ctime[2];
@@ -931,6 +1064,13 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		abuf = NULL;
 		woff = uio_offset(uio);
 
+		/*
+		 * A direct write needs no borrowed buffer.  Whether this
+		 * chunk really goes direct is settled once the block size
+		 * is final, below.
+		 */
+		direct = zfs_direct_ok(zp, uio, MIN(n, max_blksz), ioflag);
+
 		if (zfs_owner_overquota(zfsvfs, zp, B_FALSE) ||
 		    zfs_owner_overquota(zfsvfs, zp, B_TRUE)) {
 			if (abuf != NULL)
@@ -953,7 +1093,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 			    ((char *)aiov->iov_base - (char *)abuf->b_data +
 			    aiov->iov_len == arc_buf_size(abuf)));
 			i_iov++;
-		} else if (abuf == NULL && n >= max_blksz &&
+		} else if (abuf == NULL && !direct && n >= max_blksz &&
 		    woff >= zp->z_size &&
 		    P2PHASE(woff, max_blksz) == 0 &&
 		    zp->z_blksz == max_blksz) {
@@ -1031,7 +1171,21 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		if (woff + nbytes > zp->z_size)
 			vnode_pager_setsize(vp, woff + nbytes);
 
-		if (abuf == NULL) {
+		if (direct && abuf == NULL)
+			direct = zfs_direct_ok(zp, uio, nbytes, ioflag);
+
+		if (direct && abuf == NULL) {
+			error = dmu_write_direct_dbuf(sa_get_db(zp->z_sa_hdl),
+			    woff, nbytes, (const void *)uio_curriovbase(uio),
+			    tx);
+			tx_bytes = 0;
+			if (error == 0) {
+				uio_update(uio, nbytes);
+				tx_bytes = nbytes;
+				dataset_kstats_update_direct_write_kstats(
+				    &zfsvfs->z_os->os_dsks, nbytes);
+			}
+		} else if (abuf == NULL) {
 
             if ( vn_has_cached_data(vp) )
                 uio_copy = uio_duplicate(uio);
@@ -1146,7 +1300,9 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 
 		error = sa_bulk_update(zp->z_sa_hdl, bulk, count, tx);
 
-		zfs_log_write(zilog, tx, TX_WRITE, zp, woff, tx_bytes, ioflag,
+		/* FDIRECT tells the log the data is already on disk */
+		zfs_log_write(zilog, tx, TX_WRITE, zp, woff, tx_bytes,
+		    direct ? (ioflag | FDIRECT) : (ioflag & ~FDIRECT),
 		    NULL, NULL);
 		dmu_tx_commit(tx);
 
@@ -1180,6 +1336,9 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		return (error);
 	}
 
+	dataset_kstats_update_write_kstats(&zfsvfs->z_os->os_dsks,
+	    start_resid - uio_resid(uio));
+
 	if (ioflag & (FSYNC | FDSYNC) ||
 	    zfsvfs->z_os->os_sync == ZFS_SYNC_ALWAYS)
 		zil_commit(zilog, zp->z_id);
@@ -3393,7 +3393,9 @@ NTSTATUS fs_read(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp
 
 	if (FlagOn(IrpSp->MinorFunction, IRP_MN_COMPLETE)) {
 		dprintf("%s: IRP_MN_COMPLETE\n", __func__);
-		CcMdlReadComplete(IrpSp->FileObject, Irp->MdlAddress);
+		// MDL chains lent by zfs_mdl_read() go back to the ARC
+		if (!zfs_mdl_read_complete(Irp->MdlAddress))
+			CcMdlReadComplete(IrpSp->FileObject, Irp->MdlAddress);
 		// Mdl is now deallocated.
 		Irp->MdlAddress = NULL;
 		return STATUS_SUCCESS;
@@ -3441,6 +3443,12 @@ NTSTATUS fs_read(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp
 	if (byteOffset.QuadPart + bufferLength > filesize)
 		bufferLength = filesize - byteOffset.QuadPart;
 
+	// Apply the dataset's readlimit/iopslimit in the thread that asked
+	// for the data, whichever way it is then served. Paging reads only
+	// fill the cache or a mapped view and must never be put to sleep.
+	if (!pagingio)
+		dmu_throttle(zp->z_zfsvfs->z_os, B_FALSE, bufferLength);
+
 	// nocache transfer, make sure we flush first.
 	if (!pagingio && nocache && fileObject->SectionObjectPointer &&
 		(fileObject->SectionObjectPointer->DataSectionObject != NULL)) {
@@ -3461,6 +3469,20 @@ NTSTATUS fs_read(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp
 	if (fileObject->SectionObjectPointer == NULL)
 		fileObject->SectionObjectPointer = vnode_sectionpointer(vp);
 
+	// MDL read (how the SMB server reads): lend the ARC's buffers rather
+	// than copying them out, they come back with IRP_MN_COMPLETE. If the
+	// cache manager holds data for the file, it may be newer than the
+	// ARC's, so answer from there with CcMdlRead() instead; likewise when
+	// zfs_mdl_read() cannot lend the data.
+	if (FlagOn(IrpSp->MinorFunction, IRP_MN_MDL)) {
+		if (fileObject->SectionObjectPointer->DataSectionObject == NULL) {
+			Status = zfs_mdl_read(vp, byteOffset.QuadPart, bufferLength, Irp);
+			if (Status != STATUS_RETRY)
+				goto out;
+		}
+		nocache = 0;
+	}
+
 	if (nocache) {
 
 	} else {
@@ -3526,7 +3548,6 @@ NTSTATUS fs_read(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp
 
 	} // !nocache
 
-
 	uio_t *uio;
 	void *address = NULL;
 
@@ -3539,7 +3560,10 @@ NTSTATUS fs_read(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp
 	ASSERT(address != NULL);
 	uio_addiov(uio, address, bufferLength);
 
-	error = zfs_read(vp, uio, 0, NULL, NULL);
+	// FILE_FLAG_NO_BUFFERING asks for direct I/O, if the dataset allows it
+	error = zfs_read(vp, uio,
+		(!pagingio && FlagOn(fileObject->Flags, FO_NO_INTERMEDIATE_BUFFERING)) ?
+		FDIRECT : 0, NULL, NULL);
 
 	// Update bytes read
 	Irp->IoStatus.Information = bufferLength - uio_resid(uio);
@@ -3638,6 +3662,12 @@ NTSTATUS fs_write(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpS
 	if (!nocache && !CcCanIWrite(fileObject, bufferLength, TRUE, FALSE))
 		return STATUS_PENDING;
 
+	// Apply the dataset's writelimit/iopslimit to the writer itself. The
+	// paging writes of the lazy writer and mapped page writer only flush
+	// data that was charged here, and must never be put to sleep.
+	if (!pagingio)
+		dmu_throttle(zp->z_zfsvfs->z_os, B_TRUE, bufferLength);
+
 
 	if (nocache && !pagingio && fileObject->SectionObjectPointer &&
 		fileObject->SectionObjectPointer->DataSectionObject) {
@@ -3762,8 +3792,10 @@ NTSTATUS fs_write(PDEVICE_OBJECT DeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpS
 
 	if (FlagOn(Irp->Flags, IRP_PAGING_IO))
 		error = zfs_write(vp, uio, 0, NULL, NULL);  // Should we call vnop_pageout instead?
-	else
-		error = zfs_write(vp, uio, 0, NULL, NULL);
+	else	// FILE_FLAG_NO_BUFFERING asks for direct I/O, if the dataset allows it
+		error = zfs_write(vp, uio,
+			FlagOn(fileObject->Flags, FO_NO_INTERMEDIATE_BUFFERING) ? FDIRECT : 0,
+			NULL, NULL);
 
 	//if (error == 0)
 	//	zp->z_pflags |= ZFS_ARCHIVE;
@@ -2844,3 +2844,197 @@ err:
 	if (groupsid != NULL)
 		zfs_freesid(groupsid);
 }
+
+/*
+ * MDL reads (IRP_MN_MDL, which is how the SMB server reads) are answered
+ * with the ARC's own buffers instead of a copy: zfs_read_loan() lends the
+ * data, every loaned segment gets an MDL, and the MDLs are chained the way
+ * CcMdlRead() chains them.  The requester hands the chain back with
+ * IRP_MN_MDL | IRP_MN_COMPLETE, and only then is the loan returned; until
+ * then zfs_mdl_loans maps the head of the chain to its loan.  The loaned
+ * dbufs pin the objset, so each zfsvfs counts its loans in z_mdl_loans and
+ * unmount waits for them in zfs_mdl_loan_drain().  The loan also keeps the
+ * range read-locked, so each one holds a reference on its vnode.
+ */
+typedef struct zfs_mdl_loan {
+	avl_node_t	zml_node;
+	PMDL		zml_mdl;	/* head of the MDL chain */
+	dmu_loan_t	*zml_loan;
+	zfsvfs_t	*zml_zfsvfs;
+	struct vnode	*zml_vp;
+} zfs_mdl_loan_t;
+
+static kmutex_t		zfs_mdl_loans_lock;
+static kcondvar_t	zfs_mdl_loans_cv;
+static avl_tree_t	zfs_mdl_loans;
+
+static int
+zfs_mdl_loan_compare(const void *arg1, const void *arg2)
+{
+	const zfs_mdl_loan_t *zml1 = arg1;
+	const zfs_mdl_loan_t *zml2 = arg2;
+
+	if ((uintptr_t)zml1->zml_mdl < (uintptr_t)zml2->zml_mdl)
+		return (-1);
+	if ((uintptr_t)zml1->zml_mdl > (uintptr_t)zml2->zml_mdl)
+		return (1);
+	return (0);
+}
+
+void
+zfs_mdl_loan_init(void)
+{
+	mutex_init(&zfs_mdl_loans_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zfs_mdl_loans_cv, NULL, CV_DEFAULT, NULL);
+	avl_create(&zfs_mdl_loans, zfs_mdl_loan_compare,
+	    sizeof (zfs_mdl_loan_t), offsetof(zfs_mdl_loan_t, zml_node));
+}
+
+void
+zfs_mdl_loan_fini(void)
+{
+	/* Every file system has been unmounted, and so drained */
+	ASSERT(avl_is_empty(&zfs_mdl_loans));
+	avl_destroy(&zfs_mdl_loans);
+	cv_destroy(&zfs_mdl_loans_cv);
+	mutex_destroy(&zfs_mdl_loans_lock);
+}
+
+/*
+ * Drop a loan from zfsvfs's count, waking up zfs_mdl_loan_drain() when it
+ * was the last one.
+ */
+static void
+zfs_mdl_loan_rele(zfsvfs_t *zfsvfs)
+{
+	mutex_enter(&zfs_mdl_loans_lock);
+	ASSERT3U(zfsvfs->z_mdl_loans, >, 0);
+	if (--zfsvfs->z_mdl_loans == 0)
+		cv_broadcast(&zfs_mdl_loans_cv);
+	mutex_exit(&zfs_mdl_loans_lock);
+}
+
+/*
+ * Wait until every MDL chain lent out from zfsvfs has been completed.
+ * Called by unmount once zfsvfs_teardown() has stopped new reads, before
+ * the objset is disowned.
+ */
+void
+zfs_mdl_loan_drain(zfsvfs_t *zfsvfs)
+{
+	mutex_enter(&zfs_mdl_loans_lock);
+	while (zfsvfs->z_mdl_loans != 0)
+		cv_wait(&zfs_mdl_loans_cv, &zfs_mdl_loans_lock);
+	mutex_exit(&zfs_mdl_loans_lock);
+}
+
+static void
+zfs_mdl_free_chain(PMDL mdl)
+{
+	PMDL next;
+
+	for (; mdl != NULL; mdl = next) {
+		next = mdl->Next;
+		IoFreeMdl(mdl);
+	}
+}
+
+/*
+ * Answer an MDL read of [offset, offset + length) of vp by lending the
+ * cached data; Irp->MdlAddress gets the chain and IoStatus.Information
+ * the number of bytes it describes.  STATUS_RETRY means the data cannot be
+ * lent and must be read through the cache manager instead.
+ */
+NTSTATUS
+zfs_mdl_read(struct vnode *vp, uint64_t offset, ULONG length, PIRP Irp)
+{
+	zfsvfs_t *zfsvfs = VTOZ(vp)->z_zfsvfs;
+	zfs_mdl_loan_t *zml;
+	dmu_loan_t *loan;
+	PMDL head = NULL, tail = NULL, mdl;
+	const void *data;
+	uint64_t len;
+	int error, i;
+
+	/*
+	 * Count the loan before it is made, so that an unmount racing with
+	 * us either stops zfs_read_loan() or waits for the loan.
+	 */
+	mutex_enter(&zfs_mdl_loans_lock);
+	zfsvfs->z_mdl_loans++;
+	mutex_exit(&zfs_mdl_loans_lock);
+
+	error = zfs_read_loan(vp, offset, length, NULL, NULL, &loan);
+	if (error != 0 || loan == NULL) {
+		zfs_mdl_loan_rele(zfsvfs);
+		if (error == EAGAIN)
+			return (STATUS_RETRY);
+		if (error == EACCES)
+			return (STATUS_ACCESS_DENIED);
+		if (error != 0)
+			return (STATUS_UNEXPECTED_IO_ERROR);
+		return (STATUS_END_OF_FILE);
+	}
+
+	for (i = 0; i < loan->dl_numbufs; i++) {
+		data = dmu_loan_segment(loan, i, &len);
+		mdl = IoAllocateMdl((PVOID)data, (ULONG)len, FALSE, FALSE,
+		    NULL);
+		if (mdl == NULL) {
+			zfs_mdl_free_chain(head);
+			dmu_loan_return(loan);
+			zfs_mdl_loan_rele(zfsvfs);
+			return (STATUS_INSUFFICIENT_RESOURCES);
+		}
+		/* ARC buffers come from the SPL, which uses nonpaged pool */
+		MmBuildMdlForNonPagedPool(mdl);
+		if (tail != NULL)
+			tail->Next = mdl;
+		else
+			head = mdl;
+		tail = mdl;
+	}
+
+	zml = kmem_alloc(sizeof (zfs_mdl_loan_t), KM_SLEEP);
+	zml->zml_mdl = head;
+	zml->zml_loan = loan;
+	zml->zml_zfsvfs = zfsvfs;
+	zml->zml_vp = vp;
+	vnode_ref(vp);
+	mutex_enter(&zfs_mdl_loans_lock);
+	avl_add(&zfs_mdl_loans, zml);
+	mutex_exit(&zfs_mdl_loans_lock);
+
+	Irp->MdlAddress = head;
+	Irp->IoStatus.Information = loan->dl_size;
+	return (STATUS_SUCCESS);
+}
+
+/*
+ * IRP_MN_COMPLETE for an MDL read: if the chain came from zfs_mdl_read(),
+ * free it, return its loan and return B_TRUE.  Otherwise it came from the
+ * cache manager, and B_FALSE tells the caller to hand it back there.
+ */
+boolean_t
+zfs_mdl_read_complete(PMDL mdl)
+{
+	zfs_mdl_loan_t search, *zml;
+
+	search.zml_mdl = mdl;
+	mutex_enter(&zfs_mdl_loans_lock);
+	zml = avl_find(&zfs_mdl_loans, &search, NULL);
+	if (zml != NULL)
+		avl_remove(&zfs_mdl_loans, zml);
+	mutex_exit(&zfs_mdl_loans_lock);
+
+	if (zml == NULL)
+		return (B_FALSE);
+
+	zfs_mdl_free_chain(zml->zml_mdl);
+	/* Returning the loan drops its range lock, which needs the vnode */
+	dmu_loan_return(zml->zml_loan);
+	vnode_rele(zml->zml_vp);
+	zfs_mdl_loan_rele(zml->zml_zfsvfs);
+	kmem_free(zml, sizeof (zfs_mdl_loan_t));
+	return (B_TRUE);
+}
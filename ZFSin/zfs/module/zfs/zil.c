@@ -151,7 +151,7 @@ static void zil_async_to_sync(zilog_t *zilog, uint64_t foid);
  * ziltest is by and large an ugly hack, but very useful in
  * checking replay without tedious work.
  * When running ziltest we want to keep all itx's and so maintain
- * a single list in the zl_itxg[] that uses a high txg: ZILTEST_TXG
+ * a single list per CPU in the itxgs, using a high txg: ZILTEST_TXG
  * We subtract TXG_CONCURRENT_STATES to allow for common code.
  */
 #define	ZILTEST_TXG (UINT64_MAX - TXG_CONCURRENT_STATES)
@@ -1770,22 +1770,24 @@ zil_remove_async(zilog_t *zilog, uint64_t oid)
 		otxg = spa_last_synced_txg(zilog->zl_spa) + 1;
 
 	for (txg = otxg; txg < (otxg + TXG_CONCURRENT_STATES); txg++) {
-		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
+		for (int c = 0; c < zilog->zl_itxg_ncpu; c++) {
+			itxg_t *itxg = ZIL_ITXG(zilog, c, txg);
 
-		mutex_enter(&itxg->itxg_lock);
-		if (itxg->itxg_txg != txg) {
+			mutex_enter(&itxg->itxg_lock);
+			if (itxg->itxg_txg != txg) {
+				mutex_exit(&itxg->itxg_lock);
+				continue;
+			}
+
+			/*
+			 * Locate the object node and append its list.
+			 */
+			t = &itxg->itxg_itxs->i_async_tree;
+			ian = avl_find(t, &oid, &where);
+			if (ian != NULL)
+				list_move_tail(&clean_list, &ian->ia_list);
 			mutex_exit(&itxg->itxg_lock);
-			continue;
 		}
-
-		/*
-		 * Locate the object node and append its list.
-		 */
-		t = &itxg->itxg_itxs->i_async_tree;
-		ian = avl_find(t, &oid, &where);
-		if (ian != NULL)
-			list_move_tail(&clean_list, &ian->ia_list);
-		mutex_exit(&itxg->itxg_lock);
 	}
 	while ((itx = list_head(&clean_list)) != NULL) {
 		list_remove(&clean_list, itx);
@@ -1802,6 +1804,7 @@ zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 	uint64_t txg;
 	itxg_t *itxg;
 	itxs_t *itxs, *clean = NULL;
+	int c;
 
 	/*
 	 * Object ids can be re-instantiated in the next txg so
@@ -1824,7 +1827,11 @@ zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 	else
 		txg = dmu_tx_get_txg(tx);
 
-	itxg = &zilog->zl_itxg[txg & TXG_MASK];
+	kpreempt_disable();
+	c = CPU_SEQID % zilog->zl_itxg_ncpu;
+	kpreempt_enable();
+
+	itxg = ZIL_ITXG(zilog, c, txg);
 	mutex_enter(&itxg->itxg_lock);
 	itxs = itxg->itxg_itxs;
 	if (itxg->itxg_txg != txg) {
@@ -1848,6 +1855,13 @@ zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 		    sizeof (itx_async_node_t),
 		    offsetof(itx_async_node_t, ia_node));
 	}
+
+	/*
+	 * Taking the sequence number under itxg_lock keeps the lists of
+	 * this itxg sorted by it; see zil_get_commit_list().
+	 */
+	itx->itx_seq = atomic_inc_64_nv(&zilog->zl_itx_seq);
+
 	if (itx->itx_sync) {
 		list_insert_tail(&itxs->i_sync_list, itx);
 	} else {
@@ -1894,33 +1908,57 @@ zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 void
 zil_clean(zilog_t *zilog, uint64_t synced_txg)
 {
-	itxg_t *itxg = &zilog->zl_itxg[synced_txg & TXG_MASK];
 	itxs_t *clean_me;
 
 	ASSERT3U(synced_txg, <, ZILTEST_TXG);
+	ASSERT3P(zilog->zl_dmu_pool, !=, NULL);
+	ASSERT3P(zilog->zl_dmu_pool->dp_zil_clean_taskq, !=, NULL);
 
-	mutex_enter(&itxg->itxg_lock);
-	if (itxg->itxg_itxs == NULL || itxg->itxg_txg == ZILTEST_TXG) {
+	for (int c = 0; c < zilog->zl_itxg_ncpu; c++) {
+		itxg_t *itxg = ZIL_ITXG(zilog, c, synced_txg);
+
+		mutex_enter(&itxg->itxg_lock);
+		if (itxg->itxg_itxs == NULL ||
+		    itxg->itxg_txg == ZILTEST_TXG) {
+			mutex_exit(&itxg->itxg_lock);
+			continue;
+		}
+		ASSERT3U(itxg->itxg_txg, <=, synced_txg);
+		ASSERT3U(itxg->itxg_txg, !=, 0);
+		clean_me = itxg->itxg_itxs;
+		itxg->itxg_itxs = NULL;
+		itxg->itxg_txg = 0;
 		mutex_exit(&itxg->itxg_lock);
-		return;
+		/*
+		 * Preferably start a task queue to free up the old itxs but
+		 * if taskq_dispatch can't allocate resources to do that then
+		 * free it in-line. This should be rare. Note, using TQ_SLEEP
+		 * created a bad performance problem.
+		 */
+		if (taskq_dispatch(zilog->zl_dmu_pool->dp_zil_clean_taskq,
+		    (void (*)(void *))zil_itxg_clean, clean_me,
+		    TQ_NOSLEEP) == 0)
+			zil_itxg_clean(clean_me);
+	}
+}
+
+/*
+ * Merge the itxs on src into dst, both sorted by itx_seq, leaving src
+ * empty.
+ */
+static void
+zil_itx_list_merge(list_t *dst, list_t *src)
+{
+	itx_t *itx, *next = list_head(dst);
+
+	while ((itx = list_remove_head(src)) != NULL) {
+		while (next != NULL && next->itx_seq < itx->itx_seq)
+			next = list_next(dst, next);
+		if (next == NULL)
+			list_insert_tail(dst, itx);
+		else
+			list_insert_before(dst, next, itx);
 	}
-	ASSERT3U(itxg->itxg_txg, <=, synced_txg);
-	ASSERT3U(itxg->itxg_txg, !=, 0);
-	clean_me = itxg->itxg_itxs;
-	itxg->itxg_itxs = NULL;
-	itxg->itxg_txg = 0;
-	mutex_exit(&itxg->itxg_lock);
-	/*
-	 * Preferably start a task queue to free up the old itxs but
-	 * if taskq_dispatch can't allocate resources to do that then
-	 * free it in-line. This should be rare. Note, using TQ_SLEEP
-	 * created a bad performance problem.
-	 */
-	ASSERT3P(zilog->zl_dmu_pool, !=, NULL);
-	ASSERT3P(zilog->zl_dmu_pool->dp_zil_clean_taskq, !=, NULL);
-	if (taskq_dispatch(zilog->zl_dmu_pool->dp_zil_clean_taskq,
-	    (void (*)(void *))zil_itxg_clean, clean_me, TQ_NOSLEEP) == 0)
-		zil_itxg_clean(clean_me);
 }
 
 /*
@@ -1930,8 +1968,10 @@ zil_clean(zilog_t *zilog, uint64_t synced_txg)
 static void
 zil_get_commit_list(zilog_t *zilog)
 {
-	uint64_t otxg, txg;
+	uint64_t otxg, txg, maxseq;
 	list_t *commit_list = &zilog->zl_itx_commit_list;
+	list_t **lists = zilog->zl_itxg_lists;
+	int c, nlists;
 
 	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 
@@ -1940,18 +1980,119 @@ zil_get_commit_list(zilog_t *zilog)
 	else
 		otxg = spa_last_synced_txg(zilog->zl_spa) + 1;
 
-	for (txg = otxg; txg < (otxg + TXG_CONCURRENT_STATES); txg++) {
-		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
+	/*
+	 * An itx is stamped and queued under the itxg_lock of the CPU it is
+	 * assigned on, so every itx stamped up to maxseq is on its list by
+	 * the time we take that lock below. Only those are committed; any
+	 * stamped later sit at the tails of the lists and are left for the
+	 * next commit. So an itx never goes out ahead of one assigned before
+	 * it on another CPU, without holding every CPU's lock at once.
+	 */
+	maxseq = zilog->zl_itx_seq;
+	membar_consumer();
 
-		mutex_enter(&itxg->itxg_lock);
-		if (itxg->itxg_txg != txg) {
+	for (txg = otxg; txg < (otxg + TXG_CONCURRENT_STATES); txg++) {
+		nlists = 0;
+		for (c = 0; c < zilog->zl_itxg_ncpu; c++) {
+			itxg_t *itxg = ZIL_ITXG(zilog, c, txg);
+			list_t *own = &zilog->zl_itxg_cpu[c].ic_commit_list;
+			list_t *sync_list;
+			itx_t *itx;
+
+			mutex_enter(&itxg->itxg_lock);
+			if (itxg->itxg_txg != txg) {
+				mutex_exit(&itxg->itxg_lock);
+				continue;
+			}
+			sync_list = &itxg->itxg_itxs->i_sync_list;
+			list_move_tail(own, sync_list);
+			while ((itx = list_tail(own)) != NULL &&
+			    itx->itx_seq > maxseq) {
+				list_remove(own, itx);
+				list_insert_head(sync_list, itx);
+			}
 			mutex_exit(&itxg->itxg_lock);
-			continue;
+
+			if (!list_is_empty(own))
+				lists[nlists++] = own;
 		}
 
-		list_move_tail(commit_list, &itxg->itxg_itxs->i_sync_list);
+		/*
+		 * Each list is sorted by itx_seq; repeatedly take the lowest
+		 * head. Usually only a few CPUs have anything to commit.
+		 */
+		while (nlists > 1) {
+			int min = 0;
 
-		mutex_exit(&itxg->itxg_lock);
+			for (c = 1; c < nlists; c++) {
+				if (((itx_t *)list_head(lists[c]))->itx_seq <
+				    ((itx_t *)list_head(lists[min]))->itx_seq)
+					min = c;
+			}
+			list_insert_tail(commit_list,
+			    list_remove_head(lists[min]));
+			if (list_is_empty(lists[min]))
+				lists[min] = lists[--nlists];
+		}
+		if (nlists == 1)
+			list_move_tail(commit_list, lists[0]);
+	}
+}
+
+/*
+ * Enough bins for any number of async nodes an itxg can hold.
+ */
+#define	ZIL_ASYNC_MERGE_BINS	32
+
+/*
+ * Merge every async list of an itxg into its sync list, destroying the
+ * async tree. The lists are each sorted by itx_seq. Merging them into the
+ * sync list one at a time would walk the sync list once per object, so
+ * they are first merged with each other pairwise in the manner of a
+ * binary counter: bins[i] holds the merge of 2^i lists, and every itx
+ * takes part in O(log n) merges. The result is merged into the sync list
+ * once.
+ */
+static void
+zil_async_merge_all(itxs_t *itxs)
+{
+	itx_async_node_t *bins[ZIL_ASYNC_MERGE_BINS];
+	itx_async_node_t *ian, *carry;
+	void *cookie = NULL;
+	int i, nbins = 0;
+
+	while ((ian = avl_destroy_nodes(&itxs->i_async_tree,
+	    &cookie)) != NULL) {
+		carry = ian;
+		for (i = 0; i < nbins && bins[i] != NULL; i++) {
+			zil_itx_list_merge(&carry->ia_list, &bins[i]->ia_list);
+			list_destroy(&bins[i]->ia_list);
+			kmem_free(bins[i], sizeof (itx_async_node_t));
+			bins[i] = NULL;
+		}
+		ASSERT3S(i, <, ZIL_ASYNC_MERGE_BINS);
+		bins[i] = carry;
+		if (i == nbins)
+			nbins++;
+	}
+
+	carry = NULL;
+	for (i = 0; i < nbins; i++) {
+		if (bins[i] == NULL)
+			continue;
+		if (carry == NULL) {
+			carry = bins[i];
+			continue;
+		}
+		zil_itx_list_merge(&carry->ia_list, &bins[i]->ia_list);
+		list_destroy(&bins[i]->ia_list);
+		kmem_free(bins[i], sizeof (itx_async_node_t));
+	}
+
+	if (carry != NULL) {
+		zil_itx_list_merge(&itxs->i_sync_list, &carry->ia_list);
+		list_destroy(&carry->ia_list);
+		kmem_free(carry, sizeof (itx_async_node_t));
 	}
 }
 
@@ -1972,38 +2113,36 @@ zil_async_to_sync(zilog_t *zilog, uint64_t foid)
 		otxg = spa_last_synced_txg(zilog->zl_spa) + 1;
 
 	for (txg = otxg; txg < (otxg + TXG_CONCURRENT_STATES); txg++) {
-		itxg_t *itxg = &zilog->zl_itxg[txg & TXG_MASK];
+		for (int c = 0; c < zilog->zl_itxg_ncpu; c++) {
+			itxg_t *itxg = ZIL_ITXG(zilog, c, txg);
+			list_t *sync_list;
 
-		mutex_enter(&itxg->itxg_lock);
-		if (itxg->itxg_txg != txg) {
-			mutex_exit(&itxg->itxg_lock);
-			continue;
-		}
-
-		/*
-		 * If a foid is specified then find that node and append its
-		 * list. Otherwise walk the tree appending all the lists
-		 * to the sync list. We add to the end rather than the
-		 * beginning to ensure the create has happened.
-		 */
-		t = &itxg->itxg_itxs->i_async_tree;
-		if (foid != 0) {
-			ian = avl_find(t, &foid, &where);
-			if (ian != NULL) {
-				list_move_tail(&itxg->itxg_itxs->i_sync_list,
-				    &ian->ia_list);
+			mutex_enter(&itxg->itxg_lock);
+			if (itxg->itxg_txg != txg) {
+				mutex_exit(&itxg->itxg_lock);
+				continue;
 			}
-		} else {
-			void *cookie = NULL;
 
-			while ((ian = avl_destroy_nodes(t, &cookie)) != NULL) {
-				list_move_tail(&itxg->itxg_itxs->i_sync_list,
-				    &ian->ia_list);
-				list_destroy(&ian->ia_list);
-				kmem_free(ian, sizeof (itx_async_node_t));
+			/*
+			 * If a foid is specified then find that node and
+			 * merge its list into the sync list. Otherwise merge
+			 * all the lists. Merging by itx_seq rather than
+			 * appending keeps the itxs in the order they were
+			 * assigned, which also ensures the create comes
+			 * first.
+			 */
+			t = &itxg->itxg_itxs->i_async_tree;
+			sync_list = &itxg->itxg_itxs->i_sync_list;
+			if (foid != 0) {
+				ian = avl_find(t, &foid, &where);
+				if (ian != NULL)
+					zil_itx_list_merge(sync_list,
+					    &ian->ia_list);
+			} else {
+				zil_async_merge_all(itxg->itxg_itxs);
 			}
+			mutex_exit(&itxg->itxg_lock);
 		}
-		mutex_exit(&itxg->itxg_lock);
 	}
 }
 
@@ -2761,8 +2900,12 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 		 */
 		ASSERT(list_is_empty(&zilog->zl_lwb_list));
 		ASSERT3P(zilog->zl_last_lwb_opened, ==, NULL);
-		for (int i = 0; i < TXG_SIZE; i++)
-			ASSERT3P(zilog->zl_itxg[i].itxg_itxs, ==, NULL);
+		for (int c = 0; c < zilog->zl_itxg_ncpu; c++) {
+			for (int i = 0; i < TXG_SIZE; i++) {
+				ASSERT3P(ZIL_ITXG(zilog, c, i)->itxg_itxs, ==,
+				    NULL);
+			}
+		}
 		return;
 	}
 
@@ -2778,6 +2921,7 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 		return;
 	}
 
+	dataset_kstats_update_zil_kstats(&zilog->zl_os->os_dsks);
 	zil_commit_impl(zilog, foid);
 }
 
@@ -3005,9 +3149,18 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	mutex_init(&zilog->zl_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&zilog->zl_issuer_lock, NULL, MUTEX_DEFAULT, NULL);
 
-	for (i = 0; i < TXG_SIZE; i++) {
-		mutex_init(&zilog->zl_itxg[i].itxg_lock, NULL,
-		    MUTEX_DEFAULT, NULL);
+	zilog->zl_itxg_ncpu = max_ncpus;
+	zilog->zl_itxg_cpu = kmem_zalloc(zilog->zl_itxg_ncpu *
+	    sizeof (itxg_cpu_t), KM_SLEEP);
+	zilog->zl_itxg_lists = kmem_alloc(zilog->zl_itxg_ncpu *
+	    sizeof (list_t *), KM_SLEEP);
+	for (int c = 0; c < zilog->zl_itxg_ncpu; c++) {
+		for (i = 0; i < TXG_SIZE; i++) {
+			mutex_init(&ZIL_ITXG(zilog, c, i)->itxg_lock, NULL,
+			    MUTEX_DEFAULT, NULL);
+		}
+		list_create(&zilog->zl_itxg_cpu[c].ic_commit_list,
+		    sizeof (itx_t), offsetof(itx_t, itx_node));
 	}
 
 	list_create(&zilog->zl_lwb_list, sizeof (lwb_t),
@@ -3037,18 +3190,29 @@ zil_free(zilog_t *zilog)
 	ASSERT(list_is_empty(&zilog->zl_itx_commit_list));
 	list_destroy(&zilog->zl_itx_commit_list);
 
-	for (i = 0; i < TXG_SIZE; i++) {
-		/*
-		 * It's possible for an itx to be generated that doesn't dirty
-		 * a txg (e.g. ztest TX_TRUNCATE). So there's no zil_clean()
-		 * callback to remove the entry. We remove those here.
-		 *
-		 * Also free up the ziltest itxs.
-		 */
-		if (zilog->zl_itxg[i].itxg_itxs)
-			zil_itxg_clean(zilog->zl_itxg[i].itxg_itxs);
-		mutex_destroy(&zilog->zl_itxg[i].itxg_lock);
+	for (int c = 0; c < zilog->zl_itxg_ncpu; c++) {
+		for (i = 0; i < TXG_SIZE; i++) {
+			itxg_t *itxg = ZIL_ITXG(zilog, c, i);
+
+			/*
+			 * It's possible for an itx to be generated that
+			 * doesn't dirty a txg (e.g. ztest TX_TRUNCATE). So
+			 * there's no zil_clean() callback to remove the
+			 * entry. We remove those here.
+			 *
+			 * Also free up the ziltest itxs.
+			 */
+			if (itxg->itxg_itxs)
+				zil_itxg_clean(itxg->itxg_itxs);
+			mutex_destroy(&itxg->itxg_lock);
+		}
+		ASSERT(list_is_empty(&zilog->zl_itxg_cpu[c].ic_commit_list));
+		list_destroy(&zilog->zl_itxg_cpu[c].ic_commit_list);
 	}
+	kmem_free(zilog->zl_itxg_cpu, zilog->zl_itxg_ncpu *
+	    sizeof (itxg_cpu_t));
+	kmem_free(zilog->zl_itxg_lists, zilog->zl_itxg_ncpu *
+	    sizeof (list_t *));
 
 	mutex_destroy(&zilog->zl_issuer_lock);
 	mutex_destroy(&zilog->zl_lock);
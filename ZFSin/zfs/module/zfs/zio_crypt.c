@@ -26,6 +26,8 @@
 #include <sys/zil.h>
 #include <sys/sha2.h>
 #include <sys/hkdf.h>
+#include <sys/kstat.h>
+#include <sys/crypto/icp.h>
 
 /*
  * This file is responsible for handling all of the details of generating
@@ -905,7 +907,6 @@ zio_crypt_copy_dnode_bonus(abd_t *src_abd, uint8_t *dst, uint_t datalen)
 	ddnp = (dnode_phys_t *)dst;
 
 	for (i = 0; i < max_dnp; i += sdnp[i].dn_extra_slots + 1) {
-		VERIFY0(sdnp[i].dn_extra_slots);
 		dnp = &sdnp[i];
 		if (dnp->dn_type != DMU_OT_NONE &&
 		    DMU_OT_IS_ENCRYPTED(dnp->dn_bonustype) &&
@@ -1596,7 +1597,6 @@ zio_crypt_init_uios_dnode(boolean_t encrypt, uint64_t version,
 	 * counting the number of bonus buffers that need to be encrypted.
 	 */
 	for (i = 0; i < max_dnp; i += sdnp[i].dn_extra_slots + 1) {
-		VERIFY0(sdnp[i].dn_extra_slots);
 		/*
 		 * This block may still be byteswapped. However, all of the
 		 * values we use are either uint8_t's (for which byteswapping
@@ -1644,7 +1644,6 @@ zio_crypt_init_uios_dnode(boolean_t encrypt, uint64_t version,
 	 * authenticate onto aadbuf.
 	 */
 	for (i = 0; i < max_dnp; i += sdnp[i].dn_extra_slots + 1) {
-		VERIFY0(sdnp[i].dn_extra_slots);
 		dnp = &sdnp[i];
 
 		/* copy over the core fields and blkptrs (kept as plaintext) */
@@ -1982,6 +1981,219 @@ error:
 	return (ret);
 }
 
+/*
+ * Encryption throughput of the ICP on zio_crypt workloads, measured at
+ * init time for the generic C code and for the fastest implementation
+ * the CPU supports (AES-NI, plus PCLMULQDQ for GHASH). Each run encrypts
+ * one ZIO_CRYPT_BENCH_SIZE block with a context template, as
+ * zio_do_crypt_data() does with the current key of a dataset. Both runs
+ * must produce the same ciphertext and MAC, otherwise the generic code is
+ * forced. The results are exported as zfs:0:zio_crypt_bench, in MB/s.
+ */
+#define	ZIO_CRYPT_BENCH_SIZE	SPA_OLD_MAXBLOCKSIZE
+#define	ZIO_CRYPT_BENCH_NS	(MSEC2NSEC(1))
+
+static const uint64_t zio_crypt_bench_crypts[] = {
+	ZIO_CRYPT_AES_256_CCM,
+	ZIO_CRYPT_AES_256_GCM
+};
+
+#define	ZIO_CRYPT_BENCH_COUNT	\
+	(sizeof (zio_crypt_bench_crypts) / sizeof (zio_crypt_bench_crypts[0]))
+
+typedef struct zio_crypt_bench {
+	uint64_t	zcb_generic;	/* MB/s */
+	uint64_t	zcb_fastest;	/* MB/s */
+} zio_crypt_bench_t;
+
+static zio_crypt_bench_t zio_crypt_stat_data[ZIO_CRYPT_BENCH_COUNT];
+
+static kstat_t *zio_crypt_kstat;
+static kstat_named_t zio_crypt_kstat_data[2 + 2 * ZIO_CRYPT_BENCH_COUNT];
+
+/*
+ * Encrypt 'plain' into 'cipher' with a fixed key and IV until
+ * ZIO_CRYPT_BENCH_NS have passed. 'cipher' must have room for the data
+ * followed by the MAC.
+ */
+static uint64_t
+zio_crypt_benchmark_impl(uint64_t crypt, uint8_t *plain, uint8_t *cipher)
+{
+	zio_crypt_info_t *ci = &zio_crypt_table[crypt];
+	uint8_t keydata[MASTER_KEY_MAX_LEN];
+	uint8_t iv[ZIO_DATA_IV_LEN];
+	uint64_t aad[3];
+	crypto_mechanism_t mech;
+	crypto_ctx_template_t tmpl;
+	crypto_key_t key;
+	uio_t *puio, *cuio;
+	uint64_t run_count = 0;
+	hrtime_t start, run_time = 0;
+	int ret;
+
+	memset(keydata, 0x5a, sizeof (keydata));
+	memset(iv, 0xa5, sizeof (iv));
+	aad[0] = aad[1] = aad[2] = LE_64(crypt);
+
+	key.ck_format = CRYPTO_KEY_RAW;
+	key.ck_data = keydata;
+	key.ck_length = CRYPTO_BYTES2BITS(ci->ci_keylen);
+
+	/* The key schedule is built for the implementation selected now */
+	mech.cm_type = crypto_mech2id(ci->ci_mechname);
+	mech.cm_param = NULL;
+	mech.cm_param_len = 0;
+	if (crypto_create_ctx_template(&mech, &key, &tmpl, KM_SLEEP) !=
+	    CRYPTO_SUCCESS)
+		tmpl = NULL;
+
+	start = gethrtime();
+	do {
+		puio = uio_create(1, 0, UIO_SYSSPACE, UIO_READ);
+		cuio = uio_create(2, 0, UIO_SYSSPACE, UIO_WRITE);
+		VERIFY0(uio_addiov(puio, (user_addr_t)plain,
+		    ZIO_CRYPT_BENCH_SIZE));
+		VERIFY0(uio_addiov(cuio, (user_addr_t)cipher,
+		    ZIO_CRYPT_BENCH_SIZE));
+		VERIFY0(uio_addiov(cuio,
+		    (user_addr_t)(cipher + ZIO_CRYPT_BENCH_SIZE),
+		    ZIO_DATA_MAC_LEN));
+
+		ret = zio_do_crypt_uio(B_TRUE, crypt, &key, tmpl, iv,
+		    ZIO_CRYPT_BENCH_SIZE, puio, cuio, (uint8_t *)aad,
+		    sizeof (aad));
+
+		uio_free(puio);
+		uio_free(cuio);
+		if (ret != 0)
+			break;
+
+		run_count++;
+		run_time = gethrtime() - start;
+	} while (run_time < ZIO_CRYPT_BENCH_NS);
+
+	crypto_destroy_ctx_template(tmpl);
+	if (ret != 0)
+		return (0);
+
+	/* MB/s */
+	return ((run_count * ZIO_CRYPT_BENCH_SIZE * NANOSEC /
+	    (uint64_t)run_time) >> 20);
+}
+
+static void
+zio_crypt_benchmark(void)
+{
+	const size_t bufsize = ZIO_CRYPT_BENCH_SIZE + ZIO_DATA_MAC_LEN;
+	uint64_t aes_impl = icp_aes_impl, gcm_impl = icp_gcm_impl;
+	boolean_t mismatch = B_FALSE;
+	uint8_t *plain, *generic, *fastest;
+	int i;
+
+	plain = kmem_alloc(ZIO_CRYPT_BENCH_SIZE, KM_SLEEP);
+	generic = kmem_zalloc(bufsize, KM_SLEEP);
+	fastest = kmem_zalloc(bufsize, KM_SLEEP);
+	for (i = 0; i < ZIO_CRYPT_BENCH_SIZE / sizeof (uint64_t); i++)
+		((uint64_t *)plain)[i] = (uintptr_t)(plain + i) *
+		    0x9e3779b97f4a7c15ULL;
+
+	for (i = 0; i < ZIO_CRYPT_BENCH_COUNT; i++) {
+		uint64_t crypt = zio_crypt_bench_crypts[i];
+		zio_crypt_bench_t *zcb = &zio_crypt_stat_data[i];
+
+		VERIFY0(aes_impl_set(AES_IMPL_GENERIC));
+		VERIFY0(gcm_impl_set(GCM_IMPL_GENERIC));
+		zcb->zcb_generic = zio_crypt_benchmark_impl(crypt, plain,
+		    generic);
+
+		VERIFY0(aes_impl_set(AES_IMPL_FASTEST));
+		VERIFY0(gcm_impl_set(GCM_IMPL_FASTEST));
+		zcb->zcb_fastest = zio_crypt_benchmark_impl(crypt, plain,
+		    fastest);
+
+		if (bcmp(generic, fastest, bufsize) != 0)
+			mismatch = B_TRUE;
+	}
+
+	(void) aes_impl_set(aes_impl);
+	(void) gcm_impl_set(gcm_impl);
+	if (mismatch) {
+		cmn_err(CE_WARN, "zio_crypt: accelerated AES (%s/%s) does not "
+		    "match the generic code, disabling it", aes_impl_name(),
+		    gcm_impl_name());
+		(void) aes_impl_set(AES_IMPL_GENERIC);
+		(void) gcm_impl_set(GCM_IMPL_GENERIC);
+	}
+
+	kmem_free(plain, ZIO_CRYPT_BENCH_SIZE);
+	kmem_free(generic, bufsize);
+	kmem_free(fastest, bufsize);
+}
+
+static int
+zio_crypt_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *knp = ksp->ks_data;
+	int i;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	(void) strlcpy(knp->value.c, aes_impl_name(), sizeof (knp->value.c));
+	knp++;
+	(void) strlcpy(knp->value.c, gcm_impl_name(), sizeof (knp->value.c));
+	knp++;
+
+	for (i = 0; i < ZIO_CRYPT_BENCH_COUNT; i++) {
+		knp->value.ui64 = zio_crypt_stat_data[i].zcb_generic;
+		knp++;
+		knp->value.ui64 = zio_crypt_stat_data[i].zcb_fastest;
+		knp++;
+	}
+
+	return (0);
+}
+
+void
+zio_crypt_init(void)
+{
+	kstat_named_t *knp = zio_crypt_kstat_data;
+	char name[KSTAT_STRLEN];
+	int i;
+
+	zio_crypt_benchmark();
+
+	kstat_named_init(knp++, "aes_selected", KSTAT_DATA_CHAR);
+	kstat_named_init(knp++, "gcm_selected", KSTAT_DATA_CHAR);
+	for (i = 0; i < ZIO_CRYPT_BENCH_COUNT; i++) {
+		const char *ci_name =
+		    zio_crypt_table[zio_crypt_bench_crypts[i]].ci_name;
+
+		(void) snprintf(name, sizeof (name), "%s_generic", ci_name);
+		kstat_named_init(knp++, name, KSTAT_DATA_UINT64);
+		(void) snprintf(name, sizeof (name), "%s_fastest", ci_name);
+		kstat_named_init(knp++, name, KSTAT_DATA_UINT64);
+	}
+
+	zio_crypt_kstat = kstat_create("zfs", 0, "zio_crypt_bench", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zio_crypt_kstat_data) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (zio_crypt_kstat != NULL) {
+		zio_crypt_kstat->ks_data = zio_crypt_kstat_data;
+		zio_crypt_kstat->ks_update = zio_crypt_kstat_update;
+		kstat_install(zio_crypt_kstat);
+	}
+}
+
+void
+zio_crypt_fini(void)
+{
+	if (zio_crypt_kstat != NULL) {
+		kstat_delete(zio_crypt_kstat);
+		zio_crypt_kstat = NULL;
+	}
+}
+
 #if defined(_KERNEL) && defined(HAVE_SPL)
 /* BEGIN CSTYLED */
 module_param(zfs_key_max_salt_uses, ulong, 0644);
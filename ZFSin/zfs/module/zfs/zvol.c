@@ -2210,6 +2210,7 @@ zvol_read(dev_t dev, struct uio *uio, int p)
 	zvol_state_t *zv;
 	uint64_t volsize;
 	rl_t *rl;
+	ssize_t start_resid = uio_resid(uio);
 	int error = 0;
 
 	zv = zfsdev_get_soft_state(minor, ZSST_ZVOL);
@@ -2239,6 +2240,7 @@ zvol_read(dev_t dev, struct uio *uio, int p)
 		if (bytes > volsize - uio_offset(uio))
 			bytes = volsize - uio_offset(uio);
 
+		dmu_throttle(zv->zv_objset, B_FALSE, bytes);
 		error = dmu_read_uio_dbuf(zv->zv_dbuf, uio, bytes);
 		if (error) {
 			/* convert checksum errors into IO errors */
@@ -2248,6 +2250,8 @@ zvol_read(dev_t dev, struct uio *uio, int p)
 		}
 	}
 	zfs_range_unlock(rl);
+	dataset_kstats_update_read_kstats(&zv->zv_objset->os_dsks,
+	    start_resid - uio_resid(uio));
 	return (error);
 }
 
@@ -2259,6 +2263,7 @@ zvol_write(dev_t dev, struct uio *uio, int p)
 	zvol_state_t *zv;
 	uint64_t volsize;
 	rl_t *rl;
+	ssize_t start_resid = uio_resid(uio);
 	int error = 0;
 	boolean_t sync;
 
@@ -2293,6 +2298,8 @@ zvol_write(dev_t dev, struct uio *uio, int p)
 		if (bytes > volsize - off)	/* don't write past the end */
 			bytes = volsize - off;
 
+		/* charge the writelimit before the tx is assigned */
+		dmu_throttle(zv->zv_objset, B_TRUE, bytes);
 		dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
 		error = dmu_tx_assign(tx, TXG_WAIT);
 		if (error) {
@@ -2308,11 +2315,76 @@ zvol_write(dev_t dev, struct uio *uio, int p)
 			break;
 	}
 	zfs_range_unlock(rl);
+	dataset_kstats_update_write_kstats(&zv->zv_objset->os_dsks,
+	    start_resid - uio_resid(uio));
 	if (sync)
 		zil_commit(zv->zv_zilog, ZVOL_OBJ);
 	return (error);
 }
 
+/*
+ * Read loans: lend the volume's data for [offset, offset + size) to the
+ * caller instead of copying it; see dmu_read_loan().  The range stays
+ * locked against writers until the loan is returned, so the data can't
+ * change while the caller is still sending it on.  The range is cut short
+ * at the end of the volume and at DMU_MAX_ACCESS / 2; check dl_size.
+ */
+typedef struct zvol_loan {
+	rl_t			*zl_rl;
+	dmu_loan_done_func_t	*zl_done;
+	void			*zl_arg;
+} zvol_loan_t;
+
+static void
+zvol_loan_done(dmu_loan_t *loan, void *arg)
+{
+	zvol_loan_t *zl = arg;
+
+	zfs_range_unlock(zl->zl_rl);
+	if (zl->zl_done != NULL)
+		zl->zl_done(loan, zl->zl_arg);
+	kmem_free(zl, sizeof (zvol_loan_t));
+}
+
+int
+zvol_read_loan(zvol_state_t *zv, uint64_t offset, uint64_t size,
+    dmu_loan_done_func_t *done, void *arg, dmu_loan_t **loanp)
+{
+	zvol_loan_t *zl;
+	uint64_t volsize;
+	int error;
+
+	if (zv == NULL)
+		return (ENXIO);
+
+	volsize = zv->zv_volsize;
+	if (size == 0 || offset >= volsize)
+		return (EIO);
+
+	size = MIN(size, volsize - offset);
+	size = MIN(size, DMU_MAX_ACCESS >> 1);
+
+	zl = kmem_alloc(sizeof (zvol_loan_t), KM_SLEEP);
+	zl->zl_done = done;
+	zl->zl_arg = arg;
+	zl->zl_rl = zfs_range_lock(&zv->zv_znode, offset, size, RL_READER);
+
+	dmu_throttle(zv->zv_objset, B_FALSE, size);
+	error = dmu_read_loan_dbuf(zv->zv_dbuf, offset, size,
+	    DMU_READ_PREFETCH, zvol_loan_done, zl, loanp);
+	if (error) {
+		zfs_range_unlock(zl->zl_rl);
+		kmem_free(zl, sizeof (zvol_loan_t));
+		/* convert checksum errors into IO errors */
+		if (error == ECKSUM)
+			error = EIO;
+		return (error);
+	}
+
+	dataset_kstats_update_read_kstats(&zv->zv_objset->os_dsks, size);
+	return (0);
+}
+
 /*
  * IOKit read operations will pass IOMemoryDescriptor along here, so
  * that we can call io->writeBytes to read into IOKit zvolumes.
@@ -2355,6 +2427,7 @@ zvol_read_iokit(zvol_state_t *zv, uint64_t position,
 		    "zvol_read_iokit: position",
 		    position, offset, count, bytes);
 
+		dmu_throttle(zv->zv_objset, B_FALSE, bytes);
 		error =  dmu_read_iokit_dbuf(zv->zv_dbuf, ZVOL_OBJ,
 		    &offset, position, &bytes, iomem);
 
@@ -2367,6 +2440,7 @@ zvol_read_iokit(zvol_state_t *zv, uint64_t position,
 		count -= MIN(count, DMU_MAX_ACCESS >> 1) - bytes;
 	}
 	zfs_range_unlock(rl);
+	dataset_kstats_update_read_kstats(&zv->zv_objset->os_dsks, offset);
 
 	return (error);
 }
@@ -2425,6 +2499,8 @@ zvol_write_iokit(zvol_state_t *zv, uint64_t position,
 		if (bytes > volsize - (position + off))
 			bytes = volsize - (position + off);
 
+		/* charge the writelimit before the tx is assigned */
+		dmu_throttle(zv->zv_objset, B_TRUE, bytes);
 		dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
 		error = dmu_tx_assign(tx, TXG_WAIT);
 		if (error) {
@@ -2446,6 +2522,7 @@ zvol_write_iokit(zvol_state_t *zv, uint64_t position,
 			break;
 	}
 	zfs_range_unlock(rl);
+	dataset_kstats_update_write_kstats(&zv->zv_objset->os_dsks, offset);
 
 	if (sync)
 		zil_commit(zv->zv_zilog, ZVOL_OBJ);